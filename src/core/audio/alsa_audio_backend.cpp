@@ -0,0 +1,276 @@
+#include "alsa_audio_backend.h"
+#include "audio_mixer.h"
+#include "../timing/thread_placement.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+
+#if defined(AUDIO_OUTPUT_ALSA)
+#include <alsa/asoundlib.h>
+#endif
+
+AlsaAudioBackend::AlsaAudioBackend(const std::string& device)
+    : device(device)
+    , pcm(nullptr)
+    , mmapAccess(false)
+    , rate(0)
+    , periodFrames(0)
+    , bufferFrames(0)
+    , mixer(nullptr)
+    , quit(false)
+    , paused(false)
+    , volume(1.0f)
+    , queuedPeriods(MIN_QUEUED_PERIODS)
+    , underruns(0)
+{
+}
+
+AlsaAudioBackend::~AlsaAudioBackend() {
+    stop();
+}
+
+bool AlsaAudioBackend::start(AudioMixer* mixer, float volume) {
+    stop();
+#if defined(AUDIO_OUTPUT_ALSA)
+    this->mixer = mixer;
+    this->volume.store(volume, std::memory_order_relaxed);
+    if (!open()) {
+        close();
+        return false;
+    }
+    mixer->setOutputSampleRate(static_cast<int>(rate));
+    
+    quit.store(false, std::memory_order_relaxed);
+    paused.store(false, std::memory_order_relaxed);
+    queuedPeriods.store(MIN_QUEUED_PERIODS, std::memory_order_relaxed);
+    underruns.store(0, std::memory_order_relaxed);
+    thread = std::thread(&AlsaAudioBackend::run, this);
+    std::printf("AlsaAudioBackend: %s at %u Hz, %lu frame periods, %s\n", device.c_str(), rate,
+                periodFrames, mmapAccess ? "mmap" : "read/write");
+    return true;
+#else
+    (void)mixer;
+    (void)volume;
+    std::fprintf(stderr, "AlsaAudioBackend: built without AUDIO_OUTPUT_ALSA\n");
+    return false;
+#endif
+}
+
+void AlsaAudioBackend::stop() {
+    if (thread.joinable()) {
+        quit.store(true, std::memory_order_relaxed);
+        thread.join();
+    }
+    close();
+}
+
+int AlsaAudioBackend::getBufferSize() const {
+    return queuedPeriods.load(std::memory_order_relaxed) * static_cast<int>(periodFrames) *
+           2 * static_cast<int>(sizeof(int16_t));
+}
+
+#if defined(AUDIO_OUTPUT_ALSA)
+
+bool AlsaAudioBackend::open() {
+    if (snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_PLAYBACK, 0) < 0) {
+        std::fprintf(stderr, "AlsaAudioBackend: Cannot open %s\n", device.c_str());
+        pcm = nullptr;
+        return false;
+    }
+    
+    snd_pcm_hw_params_t* hw;
+    snd_pcm_hw_params_alloca(&hw);
+    snd_pcm_hw_params_any(pcm, hw);
+    // The mixer resamples, the device runs at a rate of its own rather than converting
+    snd_pcm_hw_params_set_rate_resample(pcm, hw, 0);
+    mmapAccess = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+    if (!mmapAccess && snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) {
+        std::fprintf(stderr, "AlsaAudioBackend: No interleaved access\n");
+        return false;
+    }
+    rate = PREFERRED_RATE;
+    snd_pcm_uframes_t period = PERIOD_FRAMES;
+    snd_pcm_uframes_t buffer = PERIOD_FRAMES * BUFFER_PERIODS;
+    if (snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16) < 0 ||
+        snd_pcm_hw_params_set_channels(pcm, hw, 2) < 0 ||
+        snd_pcm_hw_params_set_rate_near(pcm, hw, &rate, nullptr) < 0 ||
+        snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, nullptr) < 0 ||
+        snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buffer) < 0 ||
+        snd_pcm_hw_params(pcm, hw) < 0) {
+        std::fprintf(stderr, "AlsaAudioBackend: No 16-bit stereo configuration\n");
+        return false;
+    }
+    periodFrames = period;
+    bufferFrames = buffer;
+    if (!mmapAccess) {
+        writeBuffer.assign(bufferFrames * 2, 0);
+    }
+    if (bufferFrames < periodFrames * (MIN_QUEUED_PERIODS + 1)) {
+        std::fprintf(stderr, "AlsaAudioBackend: Device buffer too small\n");
+        return false;
+    }
+    return setWakeUpLevel();
+}
+
+void AlsaAudioBackend::close() {
+    if (pcm) {
+        snd_pcm_drop(pcm);
+        snd_pcm_close(pcm);
+        pcm = nullptr;
+    }
+}
+
+bool AlsaAudioBackend::setWakeUpLevel() {
+    // Woken up once a period of the frames aimed at has been played, and started
+    // as soon as there is anything to play
+    snd_pcm_uframes_t queued = static_cast<snd_pcm_uframes_t>(queuedPeriods.load(std::memory_order_relaxed)) * periodFrames;
+    snd_pcm_sw_params_t* sw;
+    snd_pcm_sw_params_alloca(&sw);
+    snd_pcm_sw_params_current(pcm, sw);
+    snd_pcm_sw_params_set_avail_min(pcm, sw, bufferFrames - queued + periodFrames);
+    snd_pcm_sw_params_set_start_threshold(pcm, sw, 1);
+    return snd_pcm_sw_params(pcm, sw) == 0;
+}
+
+void AlsaAudioBackend::run() {
+    // Real-time priority when the user is allowed to, the default otherwise
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::ROLE_AUDIO, "sano-audio");
+    
+    using Clock = std::chrono::steady_clock;
+    auto lastUnderrun = Clock::now();
+    uint64_t seenUnderruns = 0;
+    bool dropped = false;
+    
+    while (!quit.load(std::memory_order_relaxed)) {
+        if (paused.load(std::memory_order_relaxed)) {
+            if (!dropped) {
+                snd_pcm_drop(pcm);
+                dropped = true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+        if (dropped) {
+            snd_pcm_prepare(pcm);
+            dropped = false;
+        }
+    
+        // Adaptive sizing: one period more per underrun, one less after a long clean stretch
+        auto now = Clock::now();
+        uint64_t seen = underruns.load(std::memory_order_relaxed);
+        int periods = queuedPeriods.load(std::memory_order_relaxed);
+        int maxPeriods = static_cast<int>(bufferFrames / periodFrames) - 1;
+        if (seen != seenUnderruns) {
+            seenUnderruns = seen;
+            lastUnderrun = now;
+            if (periods < maxPeriods) {
+                queuedPeriods.store(periods + 1, std::memory_order_relaxed);
+                setWakeUpLevel();
+            }
+        } else if (periods > MIN_QUEUED_PERIODS &&
+                   now - lastUnderrun > std::chrono::milliseconds(SHRINK_AFTER_MS)) {
+            lastUnderrun = now;
+            queuedPeriods.store(periods - 1, std::memory_order_relaxed);
+            setWakeUpLevel();
+        }
+    
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+        if (avail < 0) {
+            recover(avail);
+            continue;
+        }
+        unsigned long queued = bufferFrames - std::min<unsigned long>(static_cast<unsigned long>(avail), bufferFrames);
+        unsigned long target = static_cast<unsigned long>(queuedPeriods.load(std::memory_order_relaxed)) * periodFrames;
+        if (queued + periodFrames > target) {
+            // Bounded, so that pausing and quitting are seen
+            int result = snd_pcm_wait(pcm, 10);
+            if (result < 0) {
+                recover(result);
+            }
+            continue;
+        }
+        if (!fill(target - queued)) {
+            continue;
+        }
+        if (snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED) {
+            snd_pcm_start(pcm);
+        }
+    }
+}
+
+bool AlsaAudioBackend::fill(unsigned long frames) {
+    float gain = volume.load(std::memory_order_relaxed);
+    
+    if (mmapAccess) {
+        // Mixed straight into the device buffer, in as many pieces as it wraps around
+        while (frames > 0) {
+            const snd_pcm_channel_area_t* areas;
+            snd_pcm_uframes_t offset;
+            snd_pcm_uframes_t count = frames;
+            int error = snd_pcm_mmap_begin(pcm, &areas, &offset, &count);
+            if (error < 0) {
+                recover(error);
+                return false;
+            }
+            if (count == 0) {
+                break;
+            }
+            int16_t* samples = reinterpret_cast<int16_t*>(static_cast<char*>(areas[0].addr) +
+                                                          areas[0].first / 8 + offset * areas[0].step / 8);
+            mixer->generateSamples(samples, static_cast<int>(count));
+            if (gain != 1.0f) {
+                for (snd_pcm_uframes_t i = 0; i < count * 2; ++i) {
+                    samples[i] = static_cast<int16_t>(samples[i] * gain);
+                }
+            }
+            snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm, offset, count);
+            if (committed < 0 || static_cast<snd_pcm_uframes_t>(committed) != count) {
+                recover(committed < 0 ? committed : -EPIPE);
+                return false;
+            }
+            frames -= count;
+        }
+        return true;
+    }
+    
+    int16_t* samples = writeBuffer.data();
+    mixer->generateSamples(samples, static_cast<int>(frames));
+    if (gain != 1.0f) {
+        for (unsigned long i = 0; i < frames * 2; ++i) {
+            samples[i] = static_cast<int16_t>(samples[i] * gain);
+        }
+    }
+    const int16_t* pending = samples;
+    while (frames > 0) {
+        snd_pcm_sframes_t written = snd_pcm_writei(pcm, pending, frames);
+        if (written < 0) {
+            recover(written);
+            return false;
+        }
+        pending += written * 2;
+        frames -= static_cast<unsigned long>(written);
+    }
+    return true;
+}
+
+void AlsaAudioBackend::recover(long error) {
+    if (error == -EPIPE) {
+        underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (snd_pcm_recover(pcm, static_cast<int>(error), 1) < 0) {
+        // Not recoverable, e.g. the device went away: idle rather than spin
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+#else
+
+bool AlsaAudioBackend::open() { return false; }
+void AlsaAudioBackend::close() {}
+void AlsaAudioBackend::run() {}
+bool AlsaAudioBackend::setWakeUpLevel() { return false; }
+bool AlsaAudioBackend::fill(unsigned long) { return false; }
+void AlsaAudioBackend::recover(long) {}
+
+#endif
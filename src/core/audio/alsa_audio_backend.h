@@ -0,0 +1,74 @@
+#ifndef ALSA_AUDIO_BACKEND_H
+#define ALSA_AUDIO_BACKEND_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "audio_backend.h"
+
+// alsa/asoundlib.h, which the header does not need
+struct _snd_pcm;
+
+/**
+ * ALSA Audio Backend
+ *
+ * Low latency output on Linux: the device buffer is filled a few periods of
+ * PERIOD_FRAMES ahead only, through the mmap interface when the device has
+ * one, by a thread of its own at real-time priority when it is allowed to
+ * (see ThreadPlacement, ROLE_AUDIO).
+ * Every underrun queues one period more, up to the whole device buffer, and
+ * a long enough stretch without one gives a period back.
+ *
+ * Built with AUDIO_OUTPUT_ALSA and linked against libasound; start() fails
+ * without.
+ */
+class AlsaAudioBackend : public AudioBackend {
+public:
+    static constexpr int PERIOD_FRAMES = 64;        // 1.3 ms at 48 kHz
+    static constexpr int MIN_QUEUED_PERIODS = 2;
+    static constexpr int BUFFER_PERIODS = 16;
+    static constexpr int PREFERRED_RATE = 48000;   // Usual native rate
+    static constexpr int SHRINK_AFTER_MS = 30000;  // Without an underrun
+    
+    explicit AlsaAudioBackend(const std::string& device = "default");
+    ~AlsaAudioBackend() override;
+    
+    const char* getName() const override { return "ALSA"; }
+    bool start(AudioMixer* mixer, float volume) override;
+    void stop() override;
+    void pause() override { paused.store(true, std::memory_order_relaxed); }
+    void resume() override { paused.store(false, std::memory_order_relaxed); }
+    void setVolume(float volume) override { this->volume.store(volume, std::memory_order_relaxed); }
+    int getBufferSize() const override;
+    
+    // Underruns seen by the device since start()
+    uint64_t getUnderrunCount() const { return underruns.load(std::memory_order_relaxed); }
+
+private:
+    std::string device;
+    _snd_pcm* pcm;
+    bool mmapAccess;
+    unsigned int rate;
+    unsigned long periodFrames;
+    unsigned long bufferFrames;
+    std::vector<int16_t> writeBuffer;  // Without mmap access
+    
+    AudioMixer* mixer;
+    std::thread thread;
+    std::atomic<bool> quit;
+    std::atomic<bool> paused;
+    std::atomic<float> volume;
+    std::atomic<int> queuedPeriods;  // Device side fill level aimed at
+    std::atomic<uint64_t> underruns;
+    
+    bool open();
+    void close();
+    void run();
+    bool setWakeUpLevel();
+    bool fill(unsigned long frames);
+    void recover(long error);
+};
+
+#endif // ALSA_AUDIO_BACKEND_H
@@ -0,0 +1,32 @@
+#ifndef AUDIO_BACKEND_H
+#define AUDIO_BACKEND_H
+
+// Forward declarations
+class AudioMixer;
+
+/**
+ * Audio Backend
+ *
+ * What AudioOutput plays through: opens an audio device and has it drain
+ * the mixer's output ring from the device's own thread or callback. The
+ * ring is lock-free, nothing else is shared with the emulation thread.
+ * Backends tell the mixer the rate the device runs at.
+ */
+class AudioBackend {
+public:
+    virtual ~AudioBackend() = default;
+    
+    virtual const char* getName() const = 0;
+    
+    // Opens the default device and starts draining the mixer, false if it cannot
+    virtual bool start(AudioMixer* mixer, float volume) = 0;
+    virtual void stop() = 0;
+    virtual void pause() = 0;
+    virtual void resume() = 0;
+    virtual void setVolume(float volume) = 0;  // 0.0-1.0
+    
+    // Buffered on the device side, in bytes
+    virtual int getBufferSize() const = 0;
+};
+
+#endif // AUDIO_BACKEND_H
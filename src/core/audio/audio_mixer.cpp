@@ -3,13 +3,33 @@
 #include <algorithm>
 #include <cmath>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AUDIO_MIX_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AUDIO_MIX_NEON
+#endif
+
 AudioMixer::AudioMixer()
     : cpld1(nullptr)
     , masterVolume(1.0f)
     , autoGainControl(true)
     , currentGain(1.0f)
     , targetGain(1.0f)
+    , blockFrames(0)
+    , targetBufferedFrames(SAMPLE_RATE / 30)  // Two video frames
+    , historyPosition(0)
+    , resamplePhase(0.0)
+    , outputSampleRate(SAMPLE_RATE)
+    , inputStep(1.0)
+    , rateAdjustment(0.0)
+    , underruns(0)
+    , capture(nullptr)
 {
+    historyLeft.fill(0.0f);
+    historyRight.fill(0.0f);
+    buildResamplerCoefficients();
     reset();
 }
 
@@ -28,89 +48,156 @@ void AudioMixer::reset() {
     autoGainControl = true;
     currentGain = 1.0f;
     targetGain = 1.0f;
+    blockFrames = 0;
+    updateGains();
 }
 
 //=============================================================================
 // Sample Generation
 //=============================================================================
 
-void AudioMixer::generateSamples(int16_t* buffer, int numFrames) {
-    if (!cpld1) {
-        // No audio source - output silence
-        std::fill_n(buffer, numFrames * 2, 0);
+void AudioMixer::produceFrame() {
+    if (++blockFrames < BLOCK_FRAMES) {
         return;
     }
+    blockFrames = 0;
+    
+    // One pull per channel of what CPLD1 played over the block, silence before
+    // the first samples if it played fewer (just started)
+    int16_t samples[BLOCK_FRAMES];
+    for (int ch = 0; ch < NUM_CHANNELS; ++ch) {
+        int count = cpld1 ? cpld1->readChannelBlock(ch, samples, BLOCK_FRAMES) : 0;
+        float* row = blockSamples[ch].data();
+        int silent = BLOCK_FRAMES - count;
+        std::fill(row, row + silent, 0.0f);
+        for (int i = 0; i < count; ++i) {
+            row[silent + i] = static_cast<float>(samples[i]);
+        }
+    }
+    mixBlock();
+}
+
+void AudioMixer::generateSamples(int16_t* buffer, int numFrames) {
+    // Dynamic rate control: drain a bit faster above the target fill level,
+    // a bit slower below, so the ring neither runs dry nor fills up
+    int level = getBufferedFrames();
+    int target = getTargetBufferedFrames();
+    // Whole requests are served from the ring, keep at least one video frame more than that
+    int requestFrames = static_cast<int>(numFrames * inputStep) + 1;
+    if (target < requestFrames + SAMPLE_RATE / 60) {
+        setTargetBufferedFrames(requestFrames + SAMPLE_RATE / 60);
+        target = getTargetBufferedFrames();
+    }
+    double error = static_cast<double>(level - target) / target;
+    double adjust = std::clamp(error * MAX_RATE_ADJUST, -MAX_RATE_ADJUST, MAX_RATE_ADJUST);
+    rateAdjustment.store(adjust, std::memory_order_relaxed);
+    const double step = inputStep * (1.0 + adjust);
     
-    // Generate stereo frames
     for (int i = 0; i < numFrames; ++i) {
-        int16_t left = 0, right = 0;
-        
-        // Mix all channels
-        mixFrame(left, right);
-        
-        // Apply automatic gain control if enabled
-        if (autoGainControl) {
-            applyAGC(left, right);
+        // Filter for the two tabulated phases around the output position, blended
+        float position = static_cast<float>(resamplePhase) * RESAMPLER_PHASES;
+        int phase = std::min(static_cast<int>(position), RESAMPLER_PHASES - 1);
+        float blend = position - phase;
+        const float* below = resamplerCoefficients[phase].data();
+        const float* above = resamplerCoefficients[phase + 1].data();
+        const float* left = historyLeft.data() + historyPosition;
+        const float* right = historyRight.data() + historyPosition;
+    
+        float leftBelow = filterTaps(left, below);
+        float rightBelow = filterTaps(right, below);
+        buffer[i * 2 + 0] = clamp(leftBelow + (filterTaps(left, above) - leftBelow) * blend);
+        buffer[i * 2 + 1] = clamp(rightBelow + (filterTaps(right, above) - rightBelow) * blend);
+    
+        resamplePhase += step;
+        while (resamplePhase >= 1.0) {
+            resamplePhase -= 1.0;
+    
+            uint32_t frame;
+            if (output.pop(frame)) {
+                pushHistory(static_cast<int16_t>(frame & 0xFFFF), static_cast<int16_t>(frame >> 16));
+            } else {
+                // Ran dry, fade to silence rather than click on a held sample
+                int newest = (historyPosition + RESAMPLER_TAPS - 1) % RESAMPLER_TAPS;
+                pushHistory(historyLeft[newest] * 0.5f, historyRight[newest] * 0.5f);
+                underruns.fetch_add(1, std::memory_order_relaxed);
+            }
         }
-        
-        // Write stereo pair
-        buffer[i * 2 + 0] = left;
-        buffer[i * 2 + 1] = right;
     }
 }
 
-void AudioMixer::mixFrame(int16_t& leftOut, int16_t& rightOut) {
-    float leftSum = 0.0f;
-    float rightSum = 0.0f;
+int AudioMixer::getBufferedFrames() const {
+    return static_cast<int>(output.getLevel());
+}
+
+void AudioMixer::setTargetBufferedFrames(int frames) {
+    targetBufferedFrames.store(std::clamp(frames, 1, static_cast<int>(OutputRing::CAPACITY) / 2),
+                               std::memory_order_relaxed);
+}
+
+void AudioMixer::setOutputSampleRate(int rate) {
+    outputSampleRate = std::max(rate, 1);
+    inputStep = static_cast<double>(SAMPLE_RATE) / outputSampleRate;
+    buildResamplerCoefficients();
+}
+
+void AudioMixer::mixBlock() {
+    mixLeft.fill(0.0f);
+    mixRight.fill(0.0f);
     
-    // Mix all 8 channels
+    // Each channel added to the mix with its own gains, four frames at a time
     for (int ch = 0; ch < NUM_CHANNELS; ++ch) {
-        if (channels[ch].muted) continue;
-        
-        // Get sample from CPLD FIFO
-        int16_t leftSample, rightSample;
-        cpld1->getAudioFrame(leftSample, rightSample);
+        const float leftGain = gainLeft[ch].load(std::memory_order_relaxed);
+        const float rightGain = gainRight[ch].load(std::memory_order_relaxed);
+        if (leftGain == 0.0f && rightGain == 0.0f) continue;
         
-        // Apply channel volume
-        float sample = static_cast<float>(leftSample) * channels[ch].volume;
-        
-        // Apply panning
-        // pan: -1.0 = full left, 0.0 = center, +1.0 = full right
-        float leftGain, rightGain;
-        if (channels[ch].pan <= 0.0f) {
-            // Panned left
-            leftGain = 1.0f;
-            rightGain = 1.0f + channels[ch].pan;  // 0.0 to 1.0
-        } else {
-            // Panned right
-            leftGain = 1.0f - channels[ch].pan;   // 1.0 to 0.0
-            rightGain = 1.0f;
+        const float* samples = blockSamples[ch].data();
+        int i = 0;
+#if defined(AUDIO_MIX_SSE2)
+        const __m128 left = _mm_set1_ps(leftGain);
+        const __m128 right = _mm_set1_ps(rightGain);
+        for (; i + 4 <= BLOCK_FRAMES; i += 4) {
+            __m128 sample = _mm_load_ps(samples + i);
+            _mm_store_ps(&mixLeft[i], _mm_add_ps(_mm_load_ps(&mixLeft[i]), _mm_mul_ps(sample, left)));
+            _mm_store_ps(&mixRight[i], _mm_add_ps(_mm_load_ps(&mixRight[i]), _mm_mul_ps(sample, right)));
+        }
+#elif defined(AUDIO_MIX_NEON)
+        for (; i + 4 <= BLOCK_FRAMES; i += 4) {
+            float32x4_t sample = vld1q_f32(samples + i);
+            vst1q_f32(&mixLeft[i], vmlaq_n_f32(vld1q_f32(&mixLeft[i]), sample, leftGain));
+            vst1q_f32(&mixRight[i], vmlaq_n_f32(vld1q_f32(&mixRight[i]), sample, rightGain));
+        }
+#endif
+        // Scalar path, and whatever does not fill a vector
+        for (; i < BLOCK_FRAMES; ++i) {
+            mixLeft[i] += samples[i] * leftGain;
+            mixRight[i] += samples[i] * rightGain;
         }
-        
-        leftSum += sample * leftGain;
-        rightSum += sample * rightGain;
     }
     
-    // Apply master volume
-    leftSum *= masterVolume;
-    rightSum *= masterVolume;
+    // Apply automatic gain control if enabled
+    if (autoGainControl) {
+        applyAGC(BLOCK_FRAMES);
+    }
     
-    // Clamp to 16-bit range
-    leftOut = clamp(leftSum);
-    rightOut = clamp(rightSum);
+    // Clamp to 16-bit range. Dropped when full, the emulation ran too far ahead of the audio device
+    for (int i = 0; i < BLOCK_FRAMES; ++i) {
+        int16_t left = clamp(mixLeft[i]);
+        int16_t right = clamp(mixRight[i]);
+        output.push(static_cast<uint16_t>(left) | (static_cast<uint32_t>(static_cast<uint16_t>(right)) << 16));
+        if (capture) {
+            capture->push_back(left);
+            capture->push_back(right);
+        }
+    }
 }
 
 //=============================================================================
 // Automatic Gain Control
 //=============================================================================
 
-void AudioMixer::applyAGC(int16_t& left, int16_t& right) {
-    // Calculate peak level of current samples
-    float leftF = static_cast<float>(left);
-    float rightF = static_cast<float>(right);
-    float peak = std::max(std::abs(leftF), std::abs(rightF));
-    
-    // If peak exceeds 16-bit range, reduce gain
+void AudioMixer::applyAGC(int count) {
+    // If the peak of the block exceeds 16-bit range, reduce gain
+    float peak = calculatePeakLevel(count);
     if (peak > 32767.0f) {
         targetGain = 32767.0f / peak;
     } else {
@@ -118,18 +205,92 @@ void AudioMixer::applyAGC(int16_t& left, int16_t& right) {
         targetGain = 1.0f;
     }
     
-    // Smooth gain changes (attack/release)
-    const float alpha = 0.01f;  // Smoothing factor
-    currentGain += (targetGain - currentGain) * alpha;
+    // Smooth gain changes (attack/release), as far as the per-frame smoothing
+    // factor would get over the whole block, ramping across it
+    const float alpha = 0.01f;  // Smoothing factor, per frame
+    float startGain = currentGain;
+    currentGain += (targetGain - currentGain) * (1.0f - std::pow(1.0f - alpha, static_cast<float>(count)));
     
     // Apply gain
-    left = clamp(leftF * currentGain);
-    right = clamp(rightF * currentGain);
+    float step = (currentGain - startGain) / count;
+    for (int i = 0; i < count; ++i) {
+        float gain = startGain + step * (i + 1);
+        mixLeft[i] *= gain;
+        mixRight[i] *= gain;
+    }
+}
+
+float AudioMixer::calculatePeakLevel(int count) {
+    float peak = 0.0f;
+    for (int i = 0; i < count; ++i) {
+        peak = std::max(peak, std::max(std::abs(mixLeft[i]), std::abs(mixRight[i])));
+    }
+    return peak;
+}
+
+//=============================================================================
+// Resampling
+//=============================================================================
+
+void AudioMixer::buildResamplerCoefficients() {
+    // Low pass below the lower of the two Nyquist frequencies, leaving room for the
+    // transition band, in cycles per input frame
+    const double pi = 3.14159265358979323846;
+    const double cutoff = 0.5 * 0.9 * std::min(1.0, 1.0 / inputStep);
+    const double halfWidth = RESAMPLER_TAPS / 2;
+    
+    for (int phase = 0; phase <= RESAMPLER_PHASES; ++phase) {
+        // Tap RESAMPLER_TAPS / 2 - 1 is the frame before the output position
+        double offset = static_cast<double>(phase) / RESAMPLER_PHASES;
+        double coefficients[RESAMPLER_TAPS];
+        double sum = 0.0;
+        for (int tap = 0; tap < RESAMPLER_TAPS; ++tap) {
+            double distance = tap - (halfWidth - 1) - offset;
+            double x = 2.0 * cutoff * distance;
+            double sinc = distance == 0.0 ? 1.0 : std::sin(pi * x) / (pi * x);
+            // Blackman window, zero halfWidth frames away
+            double w = pi * distance / halfWidth;
+            double window = 0.42 + 0.5 * std::cos(w) + 0.08 * std::cos(2.0 * w);
+            coefficients[tap] = std::abs(distance) >= halfWidth ? 0.0 : sinc * window;
+            sum += coefficients[tap];
+        }
+        // Unity gain at DC for every phase
+        for (int tap = 0; tap < RESAMPLER_TAPS; ++tap) {
+            resamplerCoefficients[phase][tap] = static_cast<float>(coefficients[tap] / sum);
+        }
+    }
 }
 
-float AudioMixer::calculatePeakLevel() {
-    // Helper function for AGC analysis (not currently used)
-    return 1.0f;
+void AudioMixer::pushHistory(float left, float right) {
+    historyLeft[historyPosition] = historyLeft[historyPosition + RESAMPLER_TAPS] = left;
+    historyRight[historyPosition] = historyRight[historyPosition + RESAMPLER_TAPS] = right;
+    historyPosition = (historyPosition + 1) % RESAMPLER_TAPS;
+}
+
+float AudioMixer::filterTaps(const float* history, const float* coefficients) {
+    // The history window starts anywhere, the coefficient rows are aligned
+#if defined(AUDIO_MIX_SSE2)
+    __m128 sum = _mm_setzero_ps();
+    for (int i = 0; i < RESAMPLER_TAPS; i += 4) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(history + i), _mm_load_ps(coefficients + i)));
+    }
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#elif defined(AUDIO_MIX_NEON)
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    for (int i = 0; i < RESAMPLER_TAPS; i += 4) {
+        sum = vmlaq_f32(sum, vld1q_f32(history + i), vld1q_f32(coefficients + i));
+    }
+    float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#else
+    float sum = 0.0f;
+    for (int i = 0; i < RESAMPLER_TAPS; ++i) {
+        sum += history[i] * coefficients[i];
+    }
+    return sum;
+#endif
 }
 
 //=============================================================================
@@ -139,18 +300,48 @@ float AudioMixer::calculatePeakLevel() {
 void AudioMixer::setChannelVolume(int channel, float volume) {
     if (channel >= 0 && channel < NUM_CHANNELS) {
         channels[channel].volume = std::clamp(volume, 0.0f, 1.0f);
+        updateGains();
     }
 }
 
 void AudioMixer::setChannelPan(int channel, float pan) {
     if (channel >= 0 && channel < NUM_CHANNELS) {
         channels[channel].pan = std::clamp(pan, -1.0f, 1.0f);
+        updateGains();
     }
 }
 
 void AudioMixer::setChannelMute(int channel, bool muted) {
     if (channel >= 0 && channel < NUM_CHANNELS) {
         channels[channel].muted = muted;
+        updateGains();
+    }
+}
+
+void AudioMixer::updateGains() {
+    for (int ch = 0; ch < NUM_CHANNELS; ++ch) {
+        if (channels[ch].muted) {
+            gainLeft[ch].store(0.0f, std::memory_order_relaxed);
+            gainRight[ch].store(0.0f, std::memory_order_relaxed);
+            continue;
+        }
+        
+        // Apply panning
+        // pan: -1.0 = full left, 0.0 = center, +1.0 = full right
+        float leftGain, rightGain;
+        if (channels[ch].pan <= 0.0f) {
+            // Panned left
+            leftGain = 1.0f;
+            rightGain = 1.0f + channels[ch].pan;  // 0.0 to 1.0
+        } else {
+            // Panned right
+            leftGain = 1.0f - channels[ch].pan;   // 1.0 to 0.0
+            rightGain = 1.0f;
+        }
+        
+        // Apply channel and master volume
+        gainLeft[ch].store(leftGain * channels[ch].volume * masterVolume, std::memory_order_relaxed);
+        gainRight[ch].store(rightGain * channels[ch].volume * masterVolume, std::memory_order_relaxed);
     }
 }
 
@@ -160,6 +351,7 @@ void AudioMixer::setChannelMute(int channel, bool muted) {
 
 void AudioMixer::setMasterVolume(float volume) {
     masterVolume = std::clamp(volume, 0.0f, 1.0f);
+    updateGains();
 }
 
 void AudioMixer::setAutoGainControl(bool enabled) {
@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <array>
+#include <atomic>
 #include <vector>
 #include <memory>
 
@@ -20,6 +21,17 @@ class CPLD1_Audio;
  * 
  * The mixer reads samples from CPLD1_Audio FIFOs and produces
  * stereo PCM output for the Qt audio system.
+ *
+ * Channel samples are read from CPLD1 a block of BLOCK_FRAMES at a time and
+ * mixed, with the per-channel gains worked out whenever a setting
+ * changes. Mixed frames are queued in an output ring,
+ * which the audio device drains at its own pace. The emulation paces itself
+ * on the fill level of the ring; the small remaining mismatch is absorbed by
+ * resampling the output by up to MAX_RATE_ADJUST.
+ *
+ * The same resampler converts to the rate of the audio device: a polyphase
+ * windowed-sinc filter of RESAMPLER_TAPS taps, its coefficients tabulated for
+ * RESAMPLER_PHASES positions between two input frames and interpolated in between.
  */
 class AudioMixer {
 public:
@@ -30,8 +42,29 @@ public:
     void setCPLD1(CPLD1_Audio* cpld1) { this->cpld1 = cpld1; }
     
     // Audio generation
+    // Counts one frame, after CPLD1_Audio::tick(). Once a block is complete the
+    // samples every channel played over it are mixed into the output ring
+    // (emulation thread, 32 kHz)
+    void produceFrame();
+    // Drains the output ring (audio device thread), silence when it runs dry
     void generateSamples(int16_t* buffer, int numFrames);
     
+    // Output ring fill level, in stereo frames
+    int getBufferedFrames() const;
+    int getTargetBufferedFrames() const { return targetBufferedFrames.load(std::memory_order_relaxed); }
+    void setTargetBufferedFrames(int frames);
+    // Rate generateSamples() produces, SAMPLE_RATE unless told otherwise.
+    // Only while the audio device is not draining the mixer.
+    void setOutputSampleRate(int rate);
+    int getOutputSampleRate() const { return outputSampleRate; }
+    // Output rate relative to the emulated one, within +/- MAX_RATE_ADJUST
+    double getRateAdjustment() const { return rateAdjustment.load(std::memory_order_relaxed); }
+    uint64_t getUnderrunCount() const { return underruns.load(std::memory_order_relaxed); }
+    
+    // Every frame mixed is also appended to the buffer, as interleaved left and
+    // right samples, for its owner to take on the emulation thread. nullptr stops it.
+    void setCaptureBuffer(std::vector<int16_t>* buffer) { capture = buffer; }
+    
     // Per-channel controls
     void setChannelVolume(int channel, float volume);    // 0.0-1.0
     void setChannelPan(int channel, float pan);          // -1.0 (left) to +1.0 (right)
@@ -47,6 +80,10 @@ public:
     // Constants
     static constexpr int SAMPLE_RATE = 32000;  // 32 kHz
     static constexpr int NUM_CHANNELS = 8;
+    static constexpr double MAX_RATE_ADJUST = 0.005;  // +/- 0.5%
+    static constexpr int BLOCK_FRAMES = 128;          // 4 ms
+    static constexpr int RESAMPLER_TAPS = 16;         // Multiple of four
+    static constexpr int RESAMPLER_PHASES = 128;
     
 private:
     // CPLD reference
@@ -71,10 +108,86 @@ private:
     float currentGain;
     float targetGain;
     
+    // Left and right gain of each channel: volume, pan, mute and master volume.
+    // Set by the controls' thread while the mixing one reads them
+    std::array<std::atomic<float>, NUM_CHANNELS> gainLeft;
+    std::array<std::atomic<float>, NUM_CHANNELS> gainRight;
+    
+    // Block being collected, one row per channel, and its mix
+    alignas(16) std::array<std::array<float, BLOCK_FRAMES>, NUM_CHANNELS> blockSamples;
+    alignas(16) std::array<float, BLOCK_FRAMES> mixLeft;
+    alignas(16) std::array<float, BLOCK_FRAMES> mixRight;
+    int blockFrames;
+    
+    // Output ring of mixed stereo frames (left in the low half)
+    // Single producer (produceFrame) single consumer (generateSamples)
+    struct OutputRing {
+        static constexpr uint32_t CAPACITY = 8192;  // Power of two, 256 ms
+        static constexpr uint32_t MASK = CAPACITY - 1;
+        
+        std::array<std::atomic<uint32_t>, CAPACITY> frames;
+        // Free running, the level is head - tail
+        std::atomic<uint32_t> head;  // Written by the producer only
+        std::atomic<uint32_t> tail;  // Written by the consumer only
+        
+        OutputRing() : head(0), tail(0) {}
+        
+        // Producer side, false if full
+        bool push(uint32_t frame) {
+            uint32_t h = head.load(std::memory_order_relaxed);
+            if (h - tail.load(std::memory_order_acquire) >= CAPACITY) {
+                return false;
+            }
+            frames[h & MASK].store(frame, std::memory_order_relaxed);
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+        
+        // Consumer side, false if empty
+        bool pop(uint32_t& frame) {
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            if (t == head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            frame = frames[t & MASK].load(std::memory_order_relaxed);
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+        
+        uint32_t getLevel() const {
+            return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+        }
+    };
+    
+    OutputRing output;
+    std::atomic<int> targetBufferedFrames;
+    
+    // Resampler state (consumer side). The last RESAMPLER_TAPS input frames, stored
+    // twice so that the newest ones always follow the oldest in memory; output runs
+    // between the two in the middle, resamplePhase of the way.
+    alignas(16) std::array<float, RESAMPLER_TAPS * 2> historyLeft;
+    alignas(16) std::array<float, RESAMPLER_TAPS * 2> historyRight;
+    int historyPosition;
+    double resamplePhase;
+    int outputSampleRate;
+    double inputStep;  // Input frames per output frame, before the rate adjustment
+    // One row per phase, and one more for the position of the next frame
+    alignas(16) std::array<std::array<float, RESAMPLER_TAPS>, RESAMPLER_PHASES + 1> resamplerCoefficients;
+    std::atomic<double> rateAdjustment;
+    std::atomic<uint64_t> underruns;
+    
+    std::vector<int16_t>* capture;
+    
     // Mixing helpers
-    void mixFrame(int16_t& leftOut, int16_t& rightOut);
-    void applyAGC(int16_t& left, int16_t& right);
-    float calculatePeakLevel();
+    void updateGains();
+    void mixBlock();
+    void applyAGC(int count);
+    float calculatePeakLevel(int count);
+    
+    // Resampling helpers
+    void buildResamplerCoefficients();
+    void pushHistory(float left, float right);
+    static float filterTaps(const float* history, const float* coefficients);
     
     // Clamping
     int16_t clamp(float sample);
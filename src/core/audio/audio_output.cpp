@@ -1,20 +1,37 @@
 #include "audio_output.h"
 #include "audio_mixer.h"
+#include "alsa_audio_backend.h"
 #include <QAudioDevice>
+#include <QAudioFormat>
+#include <QAudioSink>
+#include <QIODevice>
 #include <QMediaDevices>
 
+namespace {
+
 //=============================================================================
 // AudioDevice Implementation (QIODevice wrapper for AudioMixer)
 //=============================================================================
 
-AudioOutput::AudioDevice::AudioDevice(AudioMixer* mixer, QObject* parent)
+class AudioDevice : public QIODevice {
+public:
+    explicit AudioDevice(AudioMixer* mixer, QObject* parent = nullptr);
+    
+    qint64 readData(char* data, qint64 maxlen) override;
+    qint64 writeData(const char* data, qint64 len) override;
+
+private:
+    AudioMixer* mixer;
+};
+
+AudioDevice::AudioDevice(AudioMixer* mixer, QObject* parent)
     : QIODevice(parent)
     , mixer(mixer)
 {
     open(QIODevice::ReadOnly);
 }
 
-qint64 AudioOutput::AudioDevice::readData(char* data, qint64 maxlen) {
+qint64 AudioDevice::readData(char* data, qint64 maxlen) {
     if (!mixer) return 0;
     
     // Calculate number of frames to generate
@@ -28,7 +45,7 @@ qint64 AudioOutput::AudioDevice::readData(char* data, qint64 maxlen) {
     return numFrames * 4;
 }
 
-qint64 AudioOutput::AudioDevice::writeData(const char* data, qint64 len) {
+qint64 AudioDevice::writeData(const char* data, qint64 len) {
     // Read-only device
     Q_UNUSED(data);
     Q_UNUSED(len);
@@ -36,74 +53,140 @@ qint64 AudioOutput::AudioDevice::writeData(const char* data, qint64 len) {
 }
 
 //=============================================================================
-// AudioOutput Implementation
+// QtAudioBackend Implementation (QAudioSink pulling from the AudioDevice)
 //=============================================================================
 
-AudioOutput::AudioOutput(QObject* parent)
-    : QObject(parent)
-    , mixer(nullptr)
-    , playing(false)
-    , volume(1.0f)
-    , bufferSize(0)
-{
-    setupFormat();
-}
+class QtAudioBackend : public AudioBackend {
+public:
+    const char* getName() const override { return "QAudioSink"; }
+    bool start(AudioMixer* mixer, float volume) override;
+    void stop() override;
+    void pause() override;
+    void resume() override;
+    void setVolume(float volume) override;
+    int getBufferSize() const override { return bufferSize; }
 
-AudioOutput::~AudioOutput() {
-    stop();
-}
+private:
+    QAudioFormat format;
+    std::unique_ptr<QAudioSink> audioSink;
+    std::unique_ptr<AudioDevice> audioDevice;
+    int bufferSize = 0;
+};
 
-void AudioOutput::setupFormat() {
-    // Configure audio format: 32 kHz, 16-bit stereo
-    format.setSampleRate(SAMPLE_RATE);
-    format.setChannelCount(CHANNELS);
-    format.setSampleFormat(QAudioFormat::Int16);
-}
-
-bool AudioOutput::initializeAudio() {
-    if (!mixer) {
-        qWarning("AudioOutput: No mixer set");
-        return false;
-    }
-    
+bool QtAudioBackend::start(AudioMixer* mixer, float volume) {
     // Get default audio output device
-    QAudioDevice audioDevice = QMediaDevices::defaultAudioOutput();
-    if (audioDevice.isNull()) {
+    QAudioDevice device = QMediaDevices::defaultAudioOutput();
+    if (device.isNull()) {
         qWarning("AudioOutput: No audio output device available");
         return false;
     }
     
+    // Configure audio format: 32 kHz, 16-bit stereo
+    format.setSampleRate(AudioOutput::SAMPLE_RATE);
+    format.setChannelCount(AudioOutput::CHANNELS);
+    format.setSampleFormat(QAudioFormat::Int16);
+    
     // Check if format is supported
-    if (!audioDevice.isFormatSupported(format)) {
-        qWarning("AudioOutput: Requested format not supported");
-        
-        // Try to find a similar format
-        QAudioFormat nearestFormat = audioDevice.preferredFormat();
-        nearestFormat.setSampleRate(SAMPLE_RATE);
-        nearestFormat.setChannelCount(CHANNELS);
-        
-        if (audioDevice.isFormatSupported(nearestFormat)) {
+    if (!device.isFormatSupported(format)) {
+        // The mixer resamples to the device's own rate rather than leaving it to the OS,
+        // only the sample format and channel count have to be ours
+        QAudioFormat nearestFormat = device.preferredFormat();
+        nearestFormat.setChannelCount(AudioOutput::CHANNELS);
+        nearestFormat.setSampleFormat(QAudioFormat::Int16);
+    
+        if (device.isFormatSupported(nearestFormat)) {
             format = nearestFormat;
-            qInfo("AudioOutput: Using nearest supported format");
+            qInfo("AudioOutput: Resampling to the device rate of %d Hz", format.sampleRate());
         } else {
+            qWarning("AudioOutput: No supported 16-bit stereo format");
             return false;
         }
     }
+    mixer->setOutputSampleRate(format.sampleRate());
     
     // Create audio sink
-    audioSink = std::make_unique<QAudioSink>(audioDevice, format);
+    audioSink = std::make_unique<QAudioSink>(device, format);
     audioSink->setVolume(volume);
     
     // Calculate buffer size (aim for ~50ms latency)
-    bufferSize = (SAMPLE_RATE * CHANNELS * sizeof(int16_t) * 50) / 1000;
+    bufferSize = (format.sampleRate() * AudioOutput::CHANNELS * sizeof(int16_t) * 50) / 1000;
     audioSink->setBufferSize(bufferSize);
     
     qInfo("AudioOutput: Initialized - Sample Rate: %d Hz, Channels: %d, Buffer: %d bytes",
           format.sampleRate(), format.channelCount(), bufferSize);
     
+    // Create audio device wrapper
+    audioDevice = std::make_unique<AudioDevice>(mixer);
+    
+    // Start playback
+    audioSink->start(audioDevice.get());
+    
+    if (audioSink->error() != QAudio::NoError) {
+        qWarning("AudioOutput: Failed to start playback - error: %d",
+                 static_cast<int>(audioSink->error()));
+        audioDevice.reset();
+        audioSink.reset();
+        return false;
+    }
     return true;
 }
 
+void QtAudioBackend::stop() {
+    if (audioSink) {
+        audioSink->stop();
+    }
+    
+    audioDevice.reset();
+    audioSink.reset();
+}
+
+void QtAudioBackend::pause() {
+    if (audioSink) {
+        audioSink->suspend();
+    }
+}
+
+void QtAudioBackend::resume() {
+    if (audioSink) {
+        audioSink->resume();
+    }
+}
+
+void QtAudioBackend::setVolume(float volume) {
+    if (audioSink) {
+        audioSink->setVolume(volume);
+    }
+}
+
+} // namespace
+
+//=============================================================================
+// AudioOutput Implementation
+//=============================================================================
+
+AudioOutput::AudioOutput(QObject* parent)
+    : QObject(parent)
+    , mixer(nullptr)
+    , requestedBackend(BACKEND_QT)
+    , playing(false)
+    , volume(1.0f)
+{
+}
+
+AudioOutput::~AudioOutput() {
+    stop();
+}
+
+std::unique_ptr<AudioBackend> AudioOutput::createBackend(Backend kind) {
+    switch (kind) {
+        case BACKEND_LOW_LATENCY:
+            return std::make_unique<AlsaAudioBackend>();
+        case BACKEND_QT:
+        default:
+            return std::make_unique<QtAudioBackend>();
+    }
+}
+
 bool AudioOutput::start() {
     if (playing) {
         qWarning("AudioOutput: Already playing");
@@ -115,63 +198,55 @@ bool AudioOutput::start() {
         return false;
     }
     
-    // Initialize audio system
-    if (!initializeAudio()) {
-        qWarning("AudioOutput: Failed to initialize audio");
-        return false;
-    }
-    
-    // Create audio device wrapper
-    audioDevice = std::make_unique<AudioDevice>(mixer);
-    
-    // Start playback
-    audioSink->start(audioDevice.get());
-    
-    if (audioSink->error() != QAudio::NoError) {
-        qWarning("AudioOutput: Failed to start playback - error: %d", 
-                 static_cast<int>(audioSink->error()));
-        audioDevice.reset();
-        audioSink.reset();
-        return false;
+    backend = createBackend(requestedBackend);
+    if (!backend->start(mixer, volume)) {
+        if (requestedBackend == BACKEND_QT) {
+            qWarning("AudioOutput: Failed to initialize audio");
+            backend.reset();
+            return false;
+        }
+        qWarning("AudioOutput: %s unavailable, falling back to QAudioSink", backend->getName());
+        backend = createBackend(BACKEND_QT);
+        if (!backend->start(mixer, volume)) {
+            qWarning("AudioOutput: Failed to initialize audio");
+            backend.reset();
+            return false;
+        }
     }
     
     playing = true;
-    qInfo("AudioOutput: Playback started");
+    qInfo("AudioOutput: Playback started (%s)", backend->getName());
     return true;
 }
 
 void AudioOutput::stop() {
     if (!playing) return;
     
-    if (audioSink) {
-        audioSink->stop();
-    }
-    
-    audioDevice.reset();
-    audioSink.reset();
+    backend->stop();
+    backend.reset();
     playing = false;
     
     qInfo("AudioOutput: Playback stopped");
 }
 
 void AudioOutput::pause() {
-    if (!playing || !audioSink) return;
+    if (!playing) return;
     
-    audioSink->suspend();
+    backend->pause();
     qInfo("AudioOutput: Playback paused");
 }
 
 void AudioOutput::resume() {
-    if (!playing || !audioSink) return;
+    if (!playing) return;
     
-    audioSink->resume();
+    backend->resume();
     qInfo("AudioOutput: Playback resumed");
 }
 
 void AudioOutput::setVolume(float vol) {
     volume = qBound(0.0f, vol, 1.0f);
     
-    if (audioSink) {
-        audioSink->setVolume(volume);
+    if (backend) {
+        backend->setVolume(volume);
     }
 }
@@ -2,20 +2,20 @@
 #define AUDIO_OUTPUT_H
 
 #include <QObject>
-#include <QAudioFormat>
-#include <QAudioSink>
-#include <QIODevice>
 #include <memory>
+#include "audio_backend.h"
 
 // Forward declarations
 class AudioMixer;
 
 /**
  * Audio Output
- * 
- * Qt Multimedia wrapper for audio output.
- * Manages the Qt audio system and feeds it with samples from AudioMixer.
- * 
+ *
+ * Plays the AudioMixer output through one of the audio backends.
+ * QAudioSink (Qt Multimedia, ~50 ms of buffering) is the default; the
+ * low latency backend, ALSA on Linux, keeps a few milliseconds queued and
+ * falls back to the default when it cannot open the device.
+ *
  * Usage:
  *   AudioOutput output;
  *   output.setMixer(&mixer);
@@ -25,13 +25,22 @@ class AudioMixer;
  */
 class AudioOutput : public QObject {
     Q_OBJECT
-    
+
 public:
+    enum Backend {
+        BACKEND_QT,             // QAudioSink
+        BACKEND_LOW_LATENCY     // AlsaAudioBackend
+    };
+    
     explicit AudioOutput(QObject* parent = nullptr);
     ~AudioOutput();
     
     // Configuration
     void setMixer(AudioMixer* mixer) { this->mixer = mixer; }
+    // Used from the next start()
+    void setBackend(Backend backend) { requestedBackend = backend; }
+    // Backend playing, nullptr when stopped
+    const char* getBackendName() const { return backend ? backend->getName() : nullptr; }
     
     // Playback control
     bool start();
@@ -45,40 +54,24 @@ public:
     
     // Status
     bool isPlaying() const { return playing; }
-    int getBufferSize() const { return bufferSize; }
+    int getBufferSize() const { return backend ? backend->getBufferSize() : 0; }
     
     // Constants
-    static constexpr int SAMPLE_RATE = 32000;  // 32 kHz
+    static constexpr int SAMPLE_RATE = 32000;  // 32 kHz, preferred; else the device rate
     static constexpr int CHANNELS = 2;         // Stereo
     static constexpr int SAMPLE_SIZE = 16;     // 16-bit
-    
+
 private:
-    // Audio device (custom QIODevice that reads from mixer)
-    class AudioDevice : public QIODevice {
-    public:
-        explicit AudioDevice(AudioMixer* mixer, QObject* parent = nullptr);
-        
-        qint64 readData(char* data, qint64 maxlen) override;
-        qint64 writeData(const char* data, qint64 len) override;
-        
-    private:
-        AudioMixer* mixer;
-    };
-    
     // Components
     AudioMixer* mixer;
-    QAudioFormat format;
-    std::unique_ptr<QAudioSink> audioSink;
-    std::unique_ptr<AudioDevice> audioDevice;
+    Backend requestedBackend;
+    std::unique_ptr<AudioBackend> backend;
     
     // State
     bool playing;
     float volume;
-    int bufferSize;
     
-    // Setup
-    void setupFormat();
-    bool initializeAudio();
+    std::unique_ptr<AudioBackend> createBackend(Backend kind);
 };
 
 #endif // AUDIO_OUTPUT_H
@@ -1,15 +1,35 @@
 #include "cartridge.h"
+#include "compressed_rom.h"
+#include "save_ram_file.h"
+#include "../state/save_state.h"
+#include "../cpu/Log.hpp"
+#include <algorithm>
 #include <fstream>
 #include <cstring>
 #include <iostream>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CARTRIDGE_MMAP
+#endif
+
 Cartridge::Cartridge()
-    : currentBank(0)
+    : rom(nullptr)
+    , romSize(0)
+    , romMapping(nullptr)
+    , romMappingSize(0)
+    , currentBank(0)
 {
     std::memset(&header, 0, sizeof(header));
+    updateBankWindows();
 }
 
 Cartridge::~Cartridge() {
+    detachSaveRAMFile();
+    releaseROM();
 }
 
 //=============================================================================
@@ -17,6 +37,74 @@ Cartridge::~Cartridge() {
 //=============================================================================
 
 bool Cartridge::loadROM(const std::string& filename) {
+    // The page table must not keep pointers into the ROM being replaced
+    releaseROM();
+    notifyPagePointersChanged(0x0000, 0xFFFF);
+    
+    bool loaded = mapROMFile(filename) || readROMFile(filename);
+    if (!loaded) {
+        return false;
+    }
+    if (CompressedROM::isCompressed(rom, romSize) && !openCompressedROM()) {
+        releaseROM();
+        return false;
+    }
+    
+    std::cout << "Cartridge: Loaded ROM (" << romSize << " bytes, " 
+              << getBankCount() << " banks" << (romMapping ? ", mapped" : "")
+              << (compressedROM ? ", compressed" : "") << ")" << std::endl;
+    
+    updateBankWindows();
+    
+    // Parse header
+    parseHeader();
+    
+    // Reset to bank 0
+    currentBank = 0;
+    notifyPagePointersChanged(0x0000, 0xFFFF);
+    
+    return true;
+}
+
+bool Cartridge::mapROMFile(const std::string& filename) {
+#if defined(CARTRIDGE_MMAP)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0 || (size_t)info.st_size > BANK_SIZE * MAX_BANKS) {
+        // Size errors are reported by readROMFile()
+        close(fd);
+        return false;
+    }
+    
+    size_t fileSize = info.st_size;
+    void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file referenced
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    
+    // Banks are accessed through the window, no point reading ahead across all of them,
+    // but the header and the vectors are needed right away
+    madvise(mapping, fileSize, MADV_RANDOM);
+    madvise(mapping, std::min<size_t>(fileSize, 0x10000), MADV_WILLNEED);
+    
+    romMapping = mapping;
+    romMappingSize = fileSize;
+    rom = static_cast<uint8_t*>(mapping);
+    romSize = fileSize;
+    return true;
+#else
+    (void)filename;
+    return false;
+#endif
+}
+
+bool Cartridge::readROMFile(const std::string& filename) {
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
         std::cerr << "Cartridge: Failed to open ROM file: " << filename << std::endl;
@@ -39,25 +127,91 @@ bool Cartridge::loadROM(const std::string& filename) {
     }
     
     // Allocate and read ROM
-    rom.resize(fileSize);
-    if (!file.read(reinterpret_cast<char*>(rom.data()), fileSize)) {
+    romBuffer.resize(fileSize);
+    if (!file.read(reinterpret_cast<char*>(romBuffer.data()), fileSize)) {
         std::cerr << "Cartridge: Failed to read ROM data" << std::endl;
-        rom.clear();
+        romBuffer.clear();
         return false;
     }
     
-    std::cout << "Cartridge: Loaded ROM (" << fileSize << " bytes, " 
-              << getBankCount() << " banks)" << std::endl;
-    
-    // Parse header
-    parseHeader();
+    rom = romBuffer.data();
+    romSize = fileSize;
+    return true;
+}
+
+bool Cartridge::openCompressedROM() {
+    compressedROM = std::make_unique<CompressedROM>();
+    if (!compressedROM->open(rom, romSize)) {
+        compressedROM.reset();
+        return false;
+    }
     
-    // Reset to bank 0
-    currentBank = 0;
+    // Bank 0 is decompressed right away (header, vectors), the others when selected
+    const uint8_t* bank0 = compressedROM->selectBank(0);
+    if (!bank0) {
+        compressedROM.reset();
+        return false;
+    }
     
+    rom = const_cast<uint8_t*>(bank0);
+    romSize = compressedROM->getSize();
+    compressedROM->prefetchBank(1);
     return true;
 }
 
+const uint8_t* Cartridge::getImageData() const {
+    if (romMapping) {
+        return static_cast<const uint8_t*>(romMapping);
+    }
+    return sharedROM ? sharedROM->data() : romBuffer.data();
+}
+
+size_t Cartridge::getImageSize() const {
+    if (romMapping) {
+        return romMappingSize;
+    }
+    return sharedROM ? sharedROM->size() : romBuffer.size();
+}
+
+void Cartridge::releaseROM() {
+    // Decompressed banks first, they are read from the mapping
+    compressedROM.reset();
+    
+#if defined(CARTRIDGE_MMAP)
+    if (romMapping) {
+        munmap(romMapping, romMappingSize);
+    }
+#endif
+    romMapping = nullptr;
+    romMappingSize = 0;
+    romBuffer.clear();
+    romBuffer.shrink_to_fit();
+    sharedROM.reset();
+    rom = nullptr;
+    romSize = 0;
+    updateBankWindows();
+}
+
+void Cartridge::updateBankWindows() {
+    for (int bank = 0; bank < MAX_BANKS; bank++) {
+        if (compressedROM && bank != 0) {
+            // Filled in by setBank() once decompressed
+            bankWindows[bank].base = nullptr;
+            bankWindows[bank].size = 0;
+            continue;
+        }
+
+        size_t start = (size_t)bank * BANK_SIZE;
+        if (start < romSize) {
+            bankWindows[bank].base = rom + start;
+            bankWindows[bank].size = (uint32_t)std::min<size_t>(BANK_SIZE, romSize - start);
+        } else {
+            bankWindows[bank].base = nullptr;
+            bankWindows[bank].size = 0;
+        }
+    }
+}
+
 bool Cartridge::loadROM(const uint8_t* data, size_t size) {
     if (!data || size == 0) {
         std::cerr << "Cartridge: Invalid ROM data" << std::endl;
@@ -69,21 +223,63 @@ bool Cartridge::loadROM(const uint8_t* data, size_t size) {
         return false;
     }
     
-    rom.assign(data, data + size);
+    releaseROM();
+    romBuffer.assign(data, data + size);
+    rom = romBuffer.data();
+    romSize = size;
+    if (CompressedROM::isCompressed(rom, romSize) && !openCompressedROM()) {
+        releaseROM();
+        return false;
+    }
+    updateBankWindows();
     
     std::cout << "Cartridge: Loaded ROM from memory (" << size << " bytes)" << std::endl;
     
     parseHeader();
     currentBank = 0;
+    notifyPagePointersChanged(0x0000, 0xFFFF);
+    
+    return true;
+}
+
+bool Cartridge::loadROM(std::shared_ptr<const std::vector<uint8_t>> image) {
+    if (!image || image->empty()) {
+        std::cerr << "Cartridge: Invalid ROM data" << std::endl;
+        return false;
+    }
+    
+    if (image->size() > BANK_SIZE * MAX_BANKS) {
+        std::cerr << "Cartridge: ROM data too large (max 64MB)" << std::endl;
+        return false;
+    }
+    
+    releaseROM();
+    sharedROM = std::move(image);
+    // Only ever read, as a mapped file is
+    rom = const_cast<uint8_t*>(sharedROM->data());
+    romSize = sharedROM->size();
+    if (CompressedROM::isCompressed(rom, romSize) && !openCompressedROM()) {
+        releaseROM();
+        return false;
+    }
+    updateBankWindows();
+    
+    std::cout << "Cartridge: Loaded shared ROM (" << romSize << " bytes)" << std::endl;
+    
+    parseHeader();
+    currentBank = 0;
+    notifyPagePointersChanged(0x0000, 0xFFFF);
     
     return true;
 }
 
 void Cartridge::unload() {
-    rom.clear();
+    detachSaveRAMFile();
+    releaseROM();
     saveRAM.clear();
     currentBank = 0;
     std::memset(&header, 0, sizeof(header));
+    notifyPagePointersChanged(0x0000, 0xFFFF);
 }
 
 //=============================================================================
@@ -91,7 +287,7 @@ void Cartridge::unload() {
 //=============================================================================
 
 void Cartridge::parseHeader() {
-    if (rom.size() < 256) {
+    if (romSize < 256) {
         std::cerr << "Cartridge: ROM too small for header" << std::endl;
         return;
     }
@@ -114,9 +310,10 @@ void Cartridge::parseHeader() {
     
     std::cout << "Cartridge Header:" << std::endl;
     std::cout << "  Title: " << header.title << std::endl;
-    std::cout << "  Main CPU Entry: $" << std::hex << header.mainCPU_entryPoint << std::dec << std::endl;
-    std::cout << "  Graphics CPU Entry: $" << std::hex << header.graphicsCPU_entryPoint << std::dec << std::endl;
-    std::cout << "  Sound CPU Entry; $" << std::hex << header.soundCPU_entryPoint << std::dec << std::endl;
+    // Not through std::hex, the flags of std::cout are shared by every instance
+    Log::inf("Cartridge").str("  Main CPU Entry: ").hex(header.mainCPU_entryPoint, 6).show();
+    Log::inf("Cartridge").str("  Graphics CPU Entry: ").hex(header.graphicsCPU_entryPoint, 6).show();
+    Log::inf("Cartridge").str("  Sound CPU Entry: ").hex(header.soundCPU_entryPoint, 6).show();
     std::cout << "  Version: " << static_cast<int>(header.version) << std::endl;
 }
 
@@ -132,14 +329,21 @@ bool Cartridge::ROMHeader::isValid() const {
 //=============================================================================
 
 uint8_t Cartridge::readByte(const Address& address) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
+
+    // ROM window first, it is where nearly all reads go
+    if (flatAddr >= ROM_WINDOW_START) {
+        const BankWindow& window = bankWindows[currentBank.load(std::memory_order_relaxed)];
+        uint32_t offset = flatAddr - ROM_WINDOW_START;
+        return offset < window.size ? window.base[offset] : 0xFF;
+    }
 
     // Check reset vector area: $00FFFC-$00FFFF
     if (flatAddr >= 0x00FFFC && flatAddr <= 0x00FFFF) {
         uint32_t romAddr = flatAddr;
-        if (romAddr < rom.size()) {
+        if (romAddr < romSize) {
             uint8_t value = rom[romAddr];
-            std::cout << "Reading reset vector $" << std::hex << flatAddr << " = $" << (int)value << std::dec << std::endl;
+            Log::trc("Cartridge").str("Reading reset vector ").hex(flatAddr, 6).str(" = ").hex(value, 2).show();
             return value;
         }
         return 0xFF;
@@ -148,25 +352,11 @@ uint8_t Cartridge::readByte(const Address& address) {
 
     if (flatAddr >= 0x008000 && flatAddr <= 0x00FFFF) {
         uint32_t offset = flatAddr;  // Offset into ROM
-        if (offset < rom.size()) {
-            return rom[offset];
-            // Debug vector reads
-            if (flatAddr >= 0x00FFE4 && flatAddr <= 0x00FFFF) {
-                std::cout << "[ROM MIRROR] Read vector at $" << std::hex << flatAddr
-                << " = $" << (int)rom[offset] << std::dec << std::endl;
-            }
+        if (offset < romSize) {
             return rom[offset];
         }
         return 0xFF;
     }
-
-    if (addressInROMWindow(flatAddr)) {
-        uint32_t romAddr = mapAddress(flatAddr);
-        if (romAddr < rom.size()) {
-            return rom[romAddr];
-        }
-        return 0xFF;
-    }
     
     // Check save RAM
     if (addressInSaveRAM(flatAddr)) {
@@ -181,7 +371,7 @@ uint8_t Cartridge::readByte(const Address& address) {
 }
 
 void Cartridge::storeByte(const Address& address, uint8_t value) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     // Bank register
     if (flatAddr == BANK_REGISTER) {
         setBank(value & 0x0F);  // 4-bit bank number
@@ -201,7 +391,7 @@ void Cartridge::storeByte(const Address& address, uint8_t value) {
 }
 
 bool Cartridge::decodeAddress(const Address& address, Address& decoded) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
 
     // Check reset vector area: $00FFFC-$00FFFF
     if (flatAddr >= 0x00FFFC && flatAddr <= 0x00FFFF) {
@@ -236,6 +426,52 @@ bool Cartridge::decodeAddress(const Address& address, Address& decoded) {
     return false;
 }
 
+PageMapping Cartridge::mapPage(uint16_t page) {
+    // Same regions as decodeAddress(); the reset vector lies inside the bank 0 mirror.
+    const PageMapping mappings[] = {
+        mapPageInRange(page, 0x008000, 0x00FFFF),
+        mapPageInRange(page, ROM_WINDOW_START, ROM_WINDOW_END),
+        mapPageInRange(page, BANK_REGISTER, BANK_REGISTER),
+        mapPageInRange(page, SAVE_RAM_START, SAVE_RAM_END)
+    };
+    for (PageMapping mapping : mappings) {
+        if (mapping != PageMapping::Unmapped) return mapping;
+    }
+    return PageMapping::Unmapped;
+}
+
+uint8_t* Cartridge::getPageReadPointer(uint16_t page) {
+    uint32_t pageStart = (uint32_t)page * PAGE_SIZE_BYTES;
+
+    // Bank 0 mirror and ROM window are plain ROM, as long as the whole page is backed
+    if (addressInROMWindow(pageStart)) {
+        const BankWindow& window = bankWindows[currentBank.load(std::memory_order_relaxed)];
+        uint32_t offset = pageStart - ROM_WINDOW_START;
+        if (offset + PAGE_SIZE_BYTES <= window.size) {
+            // Never written through, ROM has no write pointers
+            return const_cast<uint8_t*>(window.base + offset);
+        }
+        return nullptr;  // Open bus, the slow path returns $FF
+    }
+    
+    if (pageStart >= 0x008000 && pageStart <= 0x00FFFF) {
+        if (pageStart + PAGE_SIZE_BYTES <= romSize) {
+            return rom + pageStart;
+        }
+        return nullptr;
+    }
+    
+    return getPageWritePointer(page);
+}
+
+uint8_t* Cartridge::getPageWritePointer(uint16_t page) {
+    // Only save RAM is writable memory, ROM writes and the bank register need readByte/storeByte
+    uint32_t pageStart = (uint32_t)page * PAGE_SIZE_BYTES;
+    if (addressInSaveRAM(pageStart) && !saveRAM.empty()) {
+        return saveRAM.data() + (pageStart - SAVE_RAM_START);
+    }
+    return nullptr;
+}
 
 //=============================================================================
 // Banking
@@ -245,29 +481,50 @@ void Cartridge::setBank(uint8_t bank) {
     if (bank >= MAX_BANKS) {
         bank = 0;
     }
+    if (compressedROM) {
+        // The window entry of a bank is only read while it is the current one
+        const uint8_t* base = compressedROM->selectBank(bank);
+        bankWindows[bank].base = base;
+        bankWindows[bank].size = base ? compressedROM->getBankSize(bank) : 0;
+        // Banks are usually walked in order
+        compressedROM->prefetchBank(bank + 1);
+    }
     currentBank = bank;
+
+#if defined(CARTRIDGE_MMAP)
+    // Start reading the new bank in before the CPU gets to it
+    if (romMapping && !compressedROM && (size_t)bank * BANK_SIZE < romSize) {
+        size_t length = std::min<size_t>(BANK_SIZE, romSize - (size_t)bank * BANK_SIZE);
+        madvise(rom + (size_t)bank * BANK_SIZE, length, MADV_WILLNEED);
+    }
+#endif
+
+    // The ROM window now points into another bank
+    notifyPagePointersChanged(ROM_WINDOW_START >> 8, ROM_WINDOW_END >> 8);
 }
 
 int Cartridge::getBankCount() const {
-    if (rom.empty()) return 0;
-    return (rom.size() + BANK_SIZE - 1) / BANK_SIZE;
+    if (romSize == 0) return 0;
+    return (romSize + BANK_SIZE - 1) / BANK_SIZE;
+}
+
+size_t Cartridge::readROM(uint32_t offset, uint8_t* dest, size_t length) const {
+    if (offset >= romSize) {
+        return 0;
+    }
+    // Only bank 0 of a compressed image stays decompressed
+    if (compressedROM) {
+        return compressedROM->read(offset, dest, length);
+    }
+    size_t count = std::min<size_t>(length, romSize - offset);
+    std::memcpy(dest, rom + offset, count);
+    return count;
 }
 
 //=============================================================================
 // Address Mapping
 //=============================================================================
 
-uint32_t Cartridge::mapAddress(uint32_t address) {
-    // Map CPU address in ROM window to physical ROM address
-    // ROM window: $C00000-$FFFFFF (4MB)
-    // Physical ROM address = (currentBank × 4MB) + offset
-    
-    uint32_t offset = address - ROM_WINDOW_START;
-    uint32_t romAddr = (currentBank * BANK_SIZE) + offset;
-    
-    return romAddr;
-}
-
 bool Cartridge::addressInROMWindow(uint32_t address) const {
     return address >= ROM_WINDOW_START && address <= ROM_WINDOW_END;
 }
@@ -283,10 +540,74 @@ bool Cartridge::addressInSaveRAM(uint32_t address) const {
 void Cartridge::createSaveRAM() {
     if (saveRAM.empty()) {
         saveRAM.resize(SAVE_RAM_SIZE, 0xFF);
+        notifyPagePointersChanged(SAVE_RAM_START >> 8, SAVE_RAM_END >> 8);
         std::cout << "Cartridge: Created 64KB save RAM" << std::endl;
     }
 }
 
+bool Cartridge::attachSaveRAMFile(const std::string& filename) {
+    detachSaveRAMFile();
+    createSaveRAM();
+    std::unique_ptr<SaveRAMFile> file = std::make_unique<SaveRAMFile>();
+    if (!file->open(filename, saveRAM.data(), saveRAM.size())) {
+        return false;
+    }
+    saveRAMFile = std::move(file);
+    notifyPageContentsChanged(SAVE_RAM_START >> 8, SAVE_RAM_END >> 8);
+    return true;
+}
+
+void Cartridge::detachSaveRAMFile() {
+    saveRAMFile.reset();
+}
+
+void Cartridge::snapshotSaveRAM() {
+    if (saveRAMFile) {
+        saveRAMFile->snapshot();
+    }
+}
+
+void Cartridge::setSaveRAM(const std::vector<uint8_t>& contents) {
+    createSaveRAM();
+    std::memcpy(saveRAM.data(), contents.data(), std::min(contents.size(), saveRAM.size()));
+    notifyPageContentsChanged(SAVE_RAM_START >> 8, SAVE_RAM_END >> 8);
+}
+
+void Cartridge::saveState(StateWriter& writer) const {
+    writer.writeValue(static_cast<uint64_t>(romSize));
+    writer.writeValue(currentBank.load());
+    writer.writeValue(static_cast<uint8_t>(hasSaveRAM()));
+    if (hasSaveRAM()) {
+        writer.write(saveRAM.data(), saveRAM.size());
+    }
+}
+
+bool Cartridge::loadState(StateReader& reader) {
+    uint64_t savedROMSize;
+    uint8_t bank;
+    uint8_t savedRAM;
+    if (!reader.readValue(savedROMSize) || !reader.readValue(bank) || !reader.readValue(savedRAM)) {
+        return false;
+    }
+    if (savedROMSize != romSize) {
+        std::cerr << "Cartridge: State was saved with another ROM" << std::endl;
+        return false;
+    }
+
+    if (savedRAM) {
+        createSaveRAM();
+        if (!reader.read(saveRAM.data(), saveRAM.size())) {
+            return false;
+        }
+        notifyPageContentsChanged(SAVE_RAM_START >> 8, SAVE_RAM_END >> 8);
+    }
+
+    if (bank != currentBank) {
+        setBank(bank);
+    }
+    return true;
+}
+
 bool Cartridge::loadSaveRAM(const std::string& filename) {
     std::ifstream file(filename, std::ios::binary);
     if (!file.is_open()) {
@@ -6,7 +6,14 @@
 #include <string>
 #include <array>
 #include <memory>
+#include <atomic>
 #include "../cpu/SystemBusDevice.hpp"
+
+class CompressedROM;
+class SaveRAMFile;
+class StateWriter;
+class StateReader;
+
 /**
  * Cartridge
  * 
@@ -16,6 +23,11 @@
  * - ROM window: $C00000-$FFFFFF (4MB, bank-switched)
  * - Save RAM: Optional 64KB at $700000-$70FFFF
  * 
+ * ROM files are mapped read-only into memory where the platform allows it,
+ * the ROM window then points straight into the page cache and only the
+ * banks touched are ever read from disk. Compressed images (see
+ * CompressedROM) are decompressed one bank at a time as banks get selected.
+ * 
  * ROM Header Structure (at $000000):
  * - 256 bytes with resource pointers
  * - Reset vector at $00FFFC
@@ -28,12 +40,18 @@ public:
     // ROM loading
     bool loadROM(const std::string& filename);
     bool loadROM(const uint8_t* data, size_t size);
+    // Image shared with other cartridges, never written, read in place
+    bool loadROM(std::shared_ptr<const std::vector<uint8_t>> image);
     void unload();
     
     // Memory access
     uint8_t readByte(const Address& address) override;
     void storeByte(const Address& address, uint8_t value) override;
     bool decodeAddress(const Address& address, Address& decoded) override;
+    PageMapping mapPage(uint16_t page) override;
+    uint8_t* getPageReadPointer(uint16_t page) override;
+    uint8_t* getPageWritePointer(uint16_t page) override;
+    const char* getDeviceType() const override { return "Cartridge"; }
     
     // Banking
     void setBank(uint8_t bank);
@@ -44,11 +62,36 @@ public:
     bool loadSaveRAM(const std::string& filename);
     bool saveSaveRAM(const std::string& filename);
     void createSaveRAM();  // Initialize empty 64KB save RAM
+    // Backs the save RAM with a file, read now and written back in the
+    // background as the RAM changes (see SaveRAMFile), until detached or
+    // the ROM unloaded. Creates the save RAM if there is none.
+    bool attachSaveRAMFile(const std::string& filename);
+    void detachSaveRAMFile();
+    // Between frames, hands the save RAM file the copy it writes from
+    void snapshotSaveRAM();
+    bool isSaveRAMPersistent() const { return saveRAMFile != nullptr; }
+    const std::vector<uint8_t>& getSaveRAM() const { return saveRAM; }
+    void setSaveRAM(const std::vector<uint8_t>& contents);
+    
+    // Save states, bank and save RAM. The ROM is not part of it, the state
+    // only loads back with a ROM of the same size.
+    void saveState(StateWriter& writer) const;
+    bool loadState(StateReader& reader);
     
     // ROM info
-    bool isLoaded() const { return rom.size() > 0; }
-    size_t getROMSize() const { return rom.size(); }
+    bool isLoaded() const { return romSize > 0; }
+    size_t getROMSize() const { return romSize; }
+    bool isROMMapped() const { return romMapping != nullptr; }
+    bool isROMCompressed() const { return compressedROM != nullptr; }
+    // The image as loaded, the file (compressed or not) rather than the ROM it holds.
+    // Reading all of it touches every page of a mapped file.
+    const uint8_t* getImageData() const;
+    size_t getImageSize() const;
     int getBankCount() const;
+    // Copies ROM bytes from an offset in the whole ROM, whatever the current
+    // bank, for hardware reading the cartridge on its own (CPLD1 streaming).
+    // Returns the bytes copied, fewer at the end of the ROM.
+    size_t readROM(uint32_t offset, uint8_t* dest, size_t length) const;
     
     // Header parsing
     struct ROMHeader {
@@ -82,21 +125,42 @@ public:
     static constexpr uint32_t BANK_SIZE = 0x400000;  // 4MB per bank
     
 private:
-    // ROM data
-    std::vector<uint8_t> rom;
+    // ROM data, either mapped from the file, copied into romBuffer or shared.
+    // With a compressed image those hold the container, and rom points to
+    // the decompressed bank 0 (romSize still is the whole ROM size).
+    uint8_t* rom;
+    size_t romSize;
+    std::vector<uint8_t> romBuffer;
+    std::shared_ptr<const std::vector<uint8_t>> sharedROM;
+    void* romMapping;
+    size_t romMappingSize;
+    std::unique_ptr<CompressedROM> compressedROM;
     
     // Save RAM (optional)
     std::vector<uint8_t> saveRAM;
+    std::unique_ptr<SaveRAMFile> saveRAMFile;
     
-    // Current bank
-    uint8_t currentBank;
+    // Current bank, written by one CPU while the others may read through it
+    std::atomic<uint8_t> currentBank;
+    
+    // Where each bank lies in the ROM and how much of it is backed, worked out
+    // on load so that a bank switch only changes currentBank
+    struct BankWindow {
+        const uint8_t* base;
+        uint32_t size;
+    };
+    std::array<BankWindow, MAX_BANKS> bankWindows;
     
     // ROM header
     ROMHeader header;
     
     // Helper functions
+    bool mapROMFile(const std::string& filename);
+    bool readROMFile(const std::string& filename);
+    void releaseROM();
+    bool openCompressedROM();
+    void updateBankWindows();
     void parseHeader();
-    uint32_t mapAddress(uint32_t address);
     bool addressInROMWindow(uint32_t address) const;
     bool addressInSaveRAM(uint32_t address) const;
 };
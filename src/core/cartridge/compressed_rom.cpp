@@ -0,0 +1,341 @@
+#include "compressed_rom.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+static constexpr size_t HEADER_SIZE = 20;
+static constexpr size_t INDEX_ENTRY_SIZE = 16;
+
+static constexpr uint32_t METHOD_STORED = 0;
+static constexpr uint32_t METHOD_LZ4 = 1;
+
+static uint32_t read32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read64(const uint8_t* p) {
+    return read32(p) | ((uint64_t)read32(p + 4) << 32);
+}
+
+CompressedROM::CompressedROM()
+    : data(nullptr)
+    , dataSize(0)
+    , romSize(0)
+    , useCounter(0)
+    , currentBank(-1)
+    , previousBank(-1)
+{
+    for (CacheSlot& slot : cache) {
+        slot.bank = -1;
+        slot.lastUse = 0;
+    }
+    for (CacheSlot& slot : readCache) {
+        slot.bank = -1;
+        slot.lastUse = 0;
+    }
+}
+
+CompressedROM::~CompressedROM() {
+    close();
+}
+
+//=============================================================================
+// Container
+//=============================================================================
+
+bool CompressedROM::isCompressed(const uint8_t* data, size_t size) {
+    return size >= HEADER_SIZE && std::memcmp(data, "SNZ1", 4) == 0;
+}
+
+bool CompressedROM::open(const uint8_t* source, size_t size) {
+    close();
+
+    if (!isCompressed(source, size)) {
+        return false;
+    }
+
+    uint32_t blockSize = read32(source + 4);
+    uint64_t uncompressedSize = read64(source + 8);
+    uint32_t blockCount = read32(source + 16);
+
+    if (blockSize != BLOCK_SIZE || uncompressedSize == 0 ||
+        blockCount != (uncompressedSize + BLOCK_SIZE - 1) / BLOCK_SIZE ||
+        HEADER_SIZE + (uint64_t)blockCount * INDEX_ENTRY_SIZE > size) {
+        std::cerr << "CompressedROM: Invalid container header" << std::endl;
+        return false;
+    }
+
+    blocks.resize(blockCount);
+    for (uint32_t i = 0; i < blockCount; i++) {
+        const uint8_t* entry = source + HEADER_SIZE + i * INDEX_ENTRY_SIZE;
+        blocks[i].offset = read64(entry);
+        blocks[i].size = read32(entry + 8);
+        blocks[i].method = read32(entry + 12);
+
+        if (blocks[i].offset > size || blocks[i].size > size - blocks[i].offset ||
+            blocks[i].method > METHOD_LZ4) {
+            std::cerr << "CompressedROM: Invalid index entry for block " << i << std::endl;
+            blocks.clear();
+            return false;
+        }
+    }
+
+    data = source;
+    dataSize = size;
+    romSize = uncompressedSize;
+    return true;
+}
+
+void CompressedROM::close() {
+    waitForPrefetch();
+
+    std::lock_guard<std::mutex> lock(cacheLock);
+    for (CacheSlot& slot : cache) {
+        slot.bank = -1;
+        slot.lastUse = 0;
+        slot.data.clear();
+        slot.data.shrink_to_fit();
+    }
+    for (CacheSlot& slot : readCache) {
+        slot.bank = -1;
+        slot.lastUse = 0;
+        slot.data.clear();
+        slot.data.shrink_to_fit();
+    }
+    blocks.clear();
+    data = nullptr;
+    dataSize = 0;
+    romSize = 0;
+    currentBank = -1;
+    previousBank = -1;
+}
+
+uint32_t CompressedROM::getBankSize(int bank) const {
+    size_t start = (size_t)bank * BANK_SIZE;
+    if (bank < 0 || start >= romSize) {
+        return 0;
+    }
+    return (uint32_t)std::min<size_t>(BANK_SIZE, romSize - start);
+}
+
+//=============================================================================
+// Bank Cache
+//=============================================================================
+
+const uint8_t* CompressedROM::selectBank(int bank) {
+    std::lock_guard<std::mutex> lock(cacheLock);
+
+    CacheSlot* slot = loadBank(bank);
+    if (!slot) {
+        return nullptr;
+    }
+
+    if (bank != currentBank) {
+        previousBank = currentBank;
+        currentBank = bank;
+    }
+    return slot->data.data();
+}
+
+void CompressedROM::prefetchBank(int bank) {
+    if (getBankSize(bank) == 0) {
+        return;
+    }
+
+    // One at a time, a bank switch arriving meanwhile waits for it anyway
+    if (prefetch.valid() && prefetch.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+    }
+
+    prefetch = std::async(std::launch::async, [this, bank]() {
+        std::lock_guard<std::mutex> lock(cacheLock);
+        loadBank(bank);
+    });
+}
+
+size_t CompressedROM::read(size_t offset, uint8_t* dest, size_t length) {
+    std::lock_guard<std::mutex> lock(cacheLock);
+
+    // A bank of the CPUs when it is decompressed already, a block otherwise
+    size_t copied = 0;
+    while (copied < length && offset < romSize) {
+        const uint8_t* source;
+        size_t available;
+        if (const CacheSlot* slot = findBank((int)(offset / BANK_SIZE))) {
+            source = slot->data.data() + offset % BANK_SIZE;
+            available = BANK_SIZE - offset % BANK_SIZE;
+        } else if (const CacheSlot* slot = loadReadBlock((uint32_t)(offset / BLOCK_SIZE))) {
+            source = slot->data.data() + offset % BLOCK_SIZE;
+            available = BLOCK_SIZE - offset % BLOCK_SIZE;
+        } else {
+            break;
+        }
+
+        size_t count = std::min<size_t>({length - copied, available, romSize - offset});
+        std::memcpy(dest + copied, source, count);
+        copied += count;
+        offset += count;
+    }
+    return copied;
+}
+
+const CompressedROM::CacheSlot* CompressedROM::findBank(int bank) const {
+    for (const CacheSlot& slot : cache) {
+        if (slot.bank == bank) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+CompressedROM::CacheSlot* CompressedROM::loadReadBlock(uint32_t block) {
+    CacheSlot* victim = &readCache[0];
+    for (CacheSlot& slot : readCache) {
+        if (slot.bank == (int)block) {
+            slot.lastUse = ++useCounter;
+            return &slot;
+        }
+        if (slot.bank < 0 || (victim->bank >= 0 && slot.lastUse < victim->lastUse)) {
+            victim = &slot;
+        }
+    }
+
+    uint32_t size = (uint32_t)std::min<size_t>(BLOCK_SIZE, romSize - (size_t)block * BLOCK_SIZE);
+    victim->bank = -1;
+    victim->data.resize(BLOCK_SIZE);
+    if (!decompressBlock(block, victim->data.data(), size)) {
+        std::cerr << "CompressedROM: Failed to decompress block " << block << std::endl;
+        return nullptr;
+    }
+    victim->bank = (int)block;
+    victim->lastUse = ++useCounter;
+    return victim;
+}
+
+void CompressedROM::waitForPrefetch() {
+    if (prefetch.valid()) {
+        prefetch.wait();
+    }
+}
+
+CompressedROM::CacheSlot* CompressedROM::loadBank(int bank) {
+    if (getBankSize(bank) == 0) {
+        return nullptr;
+    }
+
+    CacheSlot* victim = nullptr;
+    for (CacheSlot& slot : cache) {
+        if (slot.bank == bank) {
+            slot.lastUse = ++useCounter;
+            return &slot;
+        }
+
+        // Bank 0, the current bank and the previous one stay
+        bool pinned = slot.bank == 0 || (slot.bank >= 0 && (slot.bank == currentBank || slot.bank == previousBank));
+        if (pinned) continue;
+        if (!victim || slot.bank < 0 || (victim->bank >= 0 && slot.lastUse < victim->lastUse)) {
+            victim = &slot;
+        }
+    }
+
+    if (!victim) {
+        return nullptr;
+    }
+
+    victim->bank = -1;
+    victim->data.resize(BANK_SIZE);
+    if (!decompressBank(bank, victim->data.data())) {
+        std::cerr << "CompressedROM: Failed to decompress bank " << bank << std::endl;
+        return nullptr;
+    }
+    victim->bank = bank;
+    victim->lastUse = ++useCounter;
+    return victim;
+}
+
+bool CompressedROM::decompressBank(int bank, uint8_t* dest) {
+    uint32_t bankSize = getBankSize(bank);
+    uint32_t firstBlock = (uint32_t)((size_t)bank * BANK_SIZE / BLOCK_SIZE);
+    uint32_t blockCount = (bankSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    for (uint32_t i = 0; i < blockCount; i++) {
+        uint32_t expected = std::min<uint32_t>(BLOCK_SIZE, bankSize - i * BLOCK_SIZE);
+        if (!decompressBlock(firstBlock + i, dest + (size_t)i * BLOCK_SIZE, expected)) {
+            return false;
+        }
+    }
+
+    // Whatever lies past the end of the ROM reads as open bus
+    std::fill(dest + bankSize, dest + BANK_SIZE, 0xFF);
+    return true;
+}
+
+bool CompressedROM::decompressBlock(uint32_t block, uint8_t* dest, uint32_t size) {
+    const BlockEntry& entry = blocks[block];
+    const uint8_t* in = data + entry.offset;
+    if (entry.method == METHOD_STORED) {
+        if (entry.size != size) return false;
+        std::memcpy(dest, in, size);
+        return true;
+    }
+    return decompressLZ4(in, entry.size, dest, size);
+}
+
+//=============================================================================
+// LZ4 Block Decoding
+//=============================================================================
+
+bool CompressedROM::decompressLZ4(const uint8_t* src, size_t srcSize, uint8_t* dest, size_t destSize) {
+    const uint8_t* in = src;
+    const uint8_t* inEnd = src + srcSize;
+    uint8_t* out = dest;
+    uint8_t* outEnd = dest + destSize;
+
+    while (in < inEnd) {
+        // Token: literal length in the high nibble, match length - 4 in the low one
+        uint8_t token = *in++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t extra;
+            do {
+                if (in >= inEnd) return false;
+                extra = *in++;
+                literals += extra;
+            } while (extra == 255);
+        }
+        if (literals > (size_t)(inEnd - in) || literals > (size_t)(outEnd - out)) return false;
+        std::memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+
+        // The last sequence has literals only
+        if (in == inEnd) break;
+
+        if (inEnd - in < 2) return false;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - dest)) return false;
+
+        size_t length = (token & 0x0F) + 4;
+        if ((token & 0x0F) == 15) {
+            uint8_t extra;
+            do {
+                if (in >= inEnd) return false;
+                extra = *in++;
+                length += extra;
+            } while (extra == 255);
+        }
+        if (length > (size_t)(outEnd - out)) return false;
+
+        // Matches may overlap what they produce, copy byte by byte
+        const uint8_t* match = out - offset;
+        for (size_t i = 0; i < length; i++) {
+            out[i] = match[i];
+        }
+        out += length;
+    }
+
+    return out == outEnd;
+}
@@ -0,0 +1,105 @@
+#ifndef COMPRESSED_ROM_H
+#define COMPRESSED_ROM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <future>
+
+/**
+ * Compressed ROM
+ *
+ * Chunked compressed cartridge image, decompressed one 4MB bank at a time
+ * on first access into a small LRU cache, so that resident memory follows
+ * the banks actually used rather than the size of the cartridge.
+ *
+ * Container format (little endian):
+ * - Header: magic "SNZ1", uint32 block size (64KB), uint64 ROM size, uint32 block count
+ * - Index:  one entry per block: uint64 file offset, uint32 stored size, uint32 method
+ * - Blocks: method 0 = stored as is, method 1 = LZ4 block format (as produced
+ *           by LZ4_compress_default()), each decompressing to one full block
+ *           (the last one may be shorter)
+ *
+ * Bank 0 holds the header and the vectors and is never evicted, neither are
+ * the current bank and the one before it (threaded CPUs may still be reading
+ * through it until they reach their next sync point).
+ *
+ * read() serves the hardware reading the ROM on its own, CPLD1 streams.
+ * Outside the cached banks it decompresses single blocks into slots of its
+ * own, one per stream, so that it neither evicts the CPUs' banks nor runs
+ * out of room for them.
+ */
+class CompressedROM {
+public:
+    static constexpr uint32_t BLOCK_SIZE = 0x10000;     // 64KB
+    static constexpr uint32_t BANK_SIZE = 0x400000;     // 4MB, as the cartridge window
+    static constexpr int CACHED_BANKS = 4;
+    static constexpr int CACHED_READ_BLOCKS = 8;        // CPLD1 channels
+
+    CompressedROM();
+    ~CompressedROM();
+
+    // Whether the data starts like a compressed container
+    static bool isCompressed(const uint8_t* data, size_t size);
+
+    // The data is referenced, not copied, it must stay valid until close()
+    bool open(const uint8_t* data, size_t size);
+    void close();
+
+    size_t getSize() const { return romSize; }
+    int getBankCount() const { return static_cast<int>((romSize + BANK_SIZE - 1) / BANK_SIZE); }
+    uint32_t getBankSize(int bank) const;
+
+    // Makes the bank the current one and returns its data, decompressing it
+    // first unless it is cached already (nullptr if it cannot)
+    const uint8_t* selectBank(int bank);
+    // Decompresses the bank in the background, ahead of selectBank()
+    void prefetchBank(int bank);
+    // Copies from the ROM without changing the current bank. Returns the
+    // bytes copied, fewer at the end of the ROM or if a block cannot be
+    // decompressed.
+    size_t read(size_t offset, uint8_t* dest, size_t length);
+
+private:
+    struct BlockEntry {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t method;
+    };
+
+    struct CacheSlot {
+        int bank;            // -1 when free
+        uint64_t lastUse;
+        std::vector<uint8_t> data;
+    };
+
+    const uint8_t* data;
+    size_t dataSize;
+    size_t romSize;
+    std::vector<BlockEntry> blocks;
+
+    // Guards the slots, decompression runs with the lock held
+    std::mutex cacheLock;
+    std::array<CacheSlot, CACHED_BANKS> cache;
+    // read()'s, bank standing for the block number
+    std::array<CacheSlot, CACHED_READ_BLOCKS> readCache;
+    uint64_t useCounter;
+    int currentBank;
+    int previousBank;
+    std::future<void> prefetch;
+
+    // Slot of the bank, decompressing it into the least recently used one if needed
+    CacheSlot* loadBank(int bank);
+    bool decompressBank(int bank, uint8_t* dest);
+    // Slot of the block in the read() cache, decompressing it if needed
+    CacheSlot* loadReadBlock(uint32_t block);
+    const CacheSlot* findBank(int bank) const;
+    bool decompressBlock(uint32_t block, uint8_t* dest, uint32_t size);
+    void waitForPrefetch();
+
+    static bool decompressLZ4(const uint8_t* src, size_t srcSize, uint8_t* dest, size_t destSize);
+};
+
+#endif // COMPRESSED_ROM_H
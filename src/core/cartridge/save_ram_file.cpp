@@ -0,0 +1,154 @@
+#include "save_ram_file.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define SAVE_RAM_FSYNC
+#endif
+
+bool SaveRAMFile::open(const std::string& filename, uint8_t* memory, size_t size) {
+    close();
+
+    file = std::fopen(filename.c_str(), "r+b");
+    if (!file) {
+        file = std::fopen(filename.c_str(), "w+b");
+    }
+    if (!file) {
+        std::cerr << "SaveRAMFile: Failed to open " << filename << std::endl;
+        return false;
+    }
+
+    // The file as it is becomes the save RAM, pages it does not fully cover
+    // are written out on the first pass
+    size_t pageCount = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t bytesRead = std::fread(memory, 1, size, file);
+    written.assign(memory, memory + size);
+    copy.assign(size, 0);
+    dirty.assign(pageCount, false);
+    for (size_t page = bytesRead / PAGE_SIZE; page < pageCount; page++) {
+        dirty[page] = true;
+    }
+
+    this->filename = filename;
+    this->memory = memory;
+    this->size = size;
+    quit = false;
+    snapshotWanted = false;
+    snapshotReady = false;
+    thread = std::thread(&SaveRAMFile::run, this);
+
+    std::cout << "SaveRAMFile: " << filename << " (" << bytesRead << " bytes read)" << std::endl;
+    return true;
+}
+
+void SaveRAMFile::close() {
+    if (!memory) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_one();
+    thread.join();
+
+    // The last pass, from what the memory holds now
+    std::memcpy(copy.data(), memory, size);
+    flush();
+
+    std::fclose(file);
+    file = nullptr;
+    memory = nullptr;
+    size = 0;
+    if (writeErrors.load(std::memory_order_relaxed) > 0) {
+        std::cerr << "SaveRAMFile: " << writeErrors.load() << " failed writes to " << filename << std::endl;
+    }
+}
+
+void SaveRAMFile::snapshot() {
+    if (!snapshotWanted.load(std::memory_order_acquire)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::memcpy(copy.data(), memory, size);
+        snapshotWanted.store(false, std::memory_order_relaxed);
+        snapshotReady = true;
+    }
+    wake.notify_one();
+}
+
+void SaveRAMFile::run() {
+    // close() makes the last pass itself
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS), [this] { return quit; });
+        if (quit) {
+            break;
+        }
+        snapshotWanted.store(true, std::memory_order_release);
+        wake.wait(lock, [this] { return quit || snapshotReady; });
+        if (quit) {
+            break;
+        }
+        snapshotReady = false;
+        // snapshot() leaves the copy alone until asked again
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+    snapshotWanted.store(false, std::memory_order_relaxed);
+}
+
+void SaveRAMFile::flush() {
+    // Pages are compared and written from the copy snapshot() took
+    size_t pageCount = dirty.size();
+    for (size_t page = 0; page < pageCount; page++) {
+        size_t offset = page * PAGE_SIZE;
+        size_t length = std::min<size_t>(PAGE_SIZE, size - offset);
+        if (!dirty[page] && std::memcmp(copy.data() + offset, written.data() + offset, length) != 0) {
+            dirty[page] = true;
+        }
+    }
+
+    // Runs of changed pages in one write, failed ones are tried again next pass
+    bool wrote = false;
+    size_t page = 0;
+    while (page < pageCount) {
+        if (!dirty[page]) {
+            page++;
+            continue;
+        }
+        size_t first = page;
+        while (page < pageCount && dirty[page]) {
+            page++;
+        }
+        size_t offset = first * PAGE_SIZE;
+        size_t length = std::min<size_t>(page * PAGE_SIZE, size) - offset;
+        if (!writeRun(offset, length)) {
+            writeErrors.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        std::memcpy(written.data() + offset, copy.data() + offset, length);
+        std::fill(dirty.begin() + first, dirty.begin() + page, false);
+        pagesWritten.fetch_add(page - first, std::memory_order_relaxed);
+        wrote = true;
+    }
+
+    if (wrote) {
+        std::fflush(file);
+#if defined(SAVE_RAM_FSYNC)
+        fsync(fileno(file));
+#endif
+    }
+}
+
+bool SaveRAMFile::writeRun(size_t offset, size_t length) {
+    if (std::fseek(file, static_cast<long>(offset), SEEK_SET) != 0) {
+        return false;
+    }
+    return std::fwrite(copy.data() + offset, 1, length, file) == length;
+}
@@ -0,0 +1,75 @@
+#ifndef SAVE_RAM_FILE_H
+#define SAVE_RAM_FILE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Save RAM File
+ *
+ * Keeps a file in step with the save RAM from a thread of its own. Every
+ * FLUSH_INTERVAL_MS the writer asks for a copy of the memory, which the
+ * emulation thread takes in snapshot() at the end of its next frame, while
+ * no CPU runs, so that a save spanning several stores is never persisted
+ * half written. The writer compares each PAGE_SIZE page of the copy against
+ * the one last written, which also catches the stores going through the
+ * direct bus pointers, writes runs of changed pages in one go and syncs the
+ * file once. The emulation thread never waits for the disk.
+ */
+class SaveRAMFile {
+public:
+    static constexpr uint32_t PAGE_SIZE = 0x1000;  // 4KB
+    static constexpr int FLUSH_INTERVAL_MS = 500;
+
+    SaveRAMFile() = default;
+    ~SaveRAMFile() { close(); }
+    SaveRAMFile(const SaveRAMFile&) = delete;
+    SaveRAMFile& operator=(const SaveRAMFile&) = delete;
+
+    // Reads the file into memory, creating it when there is none (what the
+    // file lacks is written on the first pass), then starts the writer.
+    // memory must outlive close().
+    bool open(const std::string& filename, uint8_t* memory, size_t size);
+    // Emulation thread, between frames: copies the memory if the writer
+    // asked for it, otherwise returns at once
+    void snapshot();
+    // Stops the writer, then writes what changed since the last pass and
+    // syncs. No CPU may be running meanwhile
+    void close();
+    bool isOpen() const { return memory != nullptr; }
+
+    const std::string& getFilename() const { return filename; }
+    uint64_t getPagesWritten() const { return pagesWritten.load(std::memory_order_relaxed); }
+    uint64_t getWriteErrors() const { return writeErrors.load(std::memory_order_relaxed); }
+
+private:
+    std::string filename;
+    std::FILE* file = nullptr;
+    uint8_t* memory = nullptr;
+    size_t size = 0;
+    std::vector<uint8_t> written;  // As on disk, the writer's own
+    std::vector<uint8_t> copy;     // Of the memory, filled by snapshot()
+    std::vector<bool> dirty;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool quit = false;
+    std::atomic<bool> snapshotWanted{false};
+    bool snapshotReady = false;
+    std::atomic<uint64_t> pagesWritten{0};
+    std::atomic<uint64_t> writeErrors{0};
+
+    void run();
+    void flush();
+    bool writeRun(size_t offset, size_t length);
+};
+
+#endif // SAVE_RAM_FILE_H
@@ -1,12 +1,21 @@
 #include "cpld1_audio.h"
-#include <iostream>
+#include "../state/save_state.h"
+#include "../cpu/Log.hpp"
+#include "../cartridge/cartridge.h"
 #include <algorithm>
 #include "../memory/mailbox.h"
 
 CPLD1_Audio::CPLD1_Audio()
-    : irqThreshold(128)
+    : droppedSamples(0)
+    , playedHead(0)
+    , irqThreshold(128)
     , irqStatus(0)
     , enabled(true)
+    , dmaSource(0)
+    , dmaCount(0)
+    , streamSource(0)
+    , streamLength(0)
+    , streamLoop(0)
     , irqCallback(nullptr)
 {
     reset();
@@ -19,32 +28,101 @@ void CPLD1_Audio::reset() {
     irqThreshold = 128;
     irqStatus = 0;
     enabled = true;
+    sampleLow.fill(0);
+    dmaSource = 0;
+    dmaCount = 0;
+    dma.fill(DMAChannel{0, 0});
+    streamSource = 0;
+    streamLength = 0;
+    streamLoop = 0;
+    streams.fill(StreamChannel{0, 0, 0, 0});
+    playedRead.fill(playedHead);
+    updateIRQ();
+}
+
+void CPLD1_Audio::saveState(StateWriter& writer) const {
+    // Queued samples oldest first, whatever their position in the ring
+    for (const AudioFIFO& fifo : fifos) {
+        int16_t samples[AudioFIFO::CAPACITY] = {};
+        uint32_t tail = fifo.tail.load(std::memory_order_acquire);
+        uint32_t level = fifo.head.load(std::memory_order_acquire) - tail;
+        for (uint32_t i = 0; i < level; i++) {
+            samples[i] = fifo.samples[(tail + i) & AudioFIFO::MASK].load(std::memory_order_relaxed);
+        }
+        writer.writeValue(samples);
+        writer.writeValue(level);
+        writer.writeValue(fifo.irqPending);
+    }
+    writer.writeValue(irqThreshold);
+    writer.writeValue(irqStatus);
+    writer.writeValue(enabled);
+    writer.writeValue(sampleLow);
+    writer.writeValue(dmaSource);
+    writer.writeValue(dmaCount);
+    writer.writeValue(dma);
+    writer.writeValue(streamSource);
+    writer.writeValue(streamLength);
+    writer.writeValue(streamLoop);
+    writer.writeValue(streams);
+}
+
+bool CPLD1_Audio::loadState(StateReader& reader) {
+    for (AudioFIFO& fifo : fifos) {
+        int16_t samples[AudioFIFO::CAPACITY];
+        uint32_t level;
+        bool irqPending;
+        if (!reader.readValue(samples) || !reader.readValue(level) || !reader.readValue(irqPending) ||
+            level > AudioFIFO::CAPACITY) {
+            return false;
+        }
+        for (uint32_t i = 0; i < level; i++) {
+            fifo.samples[i].store(samples[i], std::memory_order_relaxed);
+        }
+        fifo.tail.store(0, std::memory_order_release);
+        fifo.head.store(level, std::memory_order_release);
+        fifo.irqPending = irqPending;
+    }
+    bool ok = reader.readValue(irqThreshold) &&
+              reader.readValue(irqStatus) &&
+              reader.readValue(enabled) &&
+              reader.readValue(sampleLow) &&
+              reader.readValue(dmaSource) &&
+              reader.readValue(dmaCount) &&
+              reader.readValue(dma) &&
+              reader.readValue(streamSource) &&
+              reader.readValue(streamLength) &&
+              reader.readValue(streamLoop) &&
+              reader.readValue(streams);
+    // Nothing played yet from the loaded FIFOs
+    playedRead.fill(playedHead);
+    updateIRQ();
+    return ok;
 }
 
 uint8_t CPLD1_Audio::readByte(const Address& address) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     uint32_t offset = flatAddr - getBaseAddress();
     
     switch (offset) {
         // FIFO_STATUS_0_3 ($400110)
         case 0x10:
-            return fifos[0].getLevel();
+            return fifos[0].getStatusLevel();
         case 0x11:
-            return fifos[1].getLevel();
+            return fifos[1].getStatusLevel();
         case 0x12:
-            return fifos[2].getLevel();
+            return fifos[2].getStatusLevel();
         case 0x13:
-            return fifos[3].getLevel();
+            return fifos[3].getStatusLevel();
             
         // FIFO_STATUS_4_7 ($400112)
         case 0x14:
-            return fifos[4].getLevel();
+            return fifos[4].getStatusLevel();
         case 0x15:
-            return fifos[5].getLevel();
+            return fifos[5].getStatusLevel();
         case 0x16:
-            return fifos[6].getLevel();
+            return fifos[6].getStatusLevel();
         case 0x17:
-            return fifos[7].getLevel();
+            return fifos[7].getStatusLevel();
             
         // IRQ_STATUS ($400118)
         case 0x18:
@@ -54,29 +132,68 @@ uint8_t CPLD1_Audio::readByte(const Address& address) {
         case 0x1C:
             return irqThreshold;
             
+        // DMA_SOURCE ($400120), DMA_COUNT ($400122)
+        case 0x20:
+            return dmaSource & 0xFF;
+        case 0x21:
+            return dmaSource >> 8;
+        case 0x22:
+            return dmaCount & 0xFF;
+        case 0x23:
+            return dmaCount >> 8;
+            
+        // DMA_ACTIVE ($400125)
+        case 0x25: {
+            uint8_t active = 0;
+            for (int ch = 0; ch < 8; ch++) {
+                if (dma[ch].count != 0) {
+                    active |= 1 << ch;
+                }
+            }
+            return active;
+        }
+            
+        // STREAM_SOURCE ($400128), STREAM_LENGTH ($40012C), STREAM_LOOP ($400130)
+        case 0x28: case 0x29: case 0x2A: case 0x2B:
+            return (streamSource >> ((offset - 0x28) * 8)) & 0xFF;
+        case 0x2C: case 0x2D: case 0x2E: case 0x2F:
+            return (streamLength >> ((offset - 0x2C) * 8)) & 0xFF;
+        case 0x30: case 0x31: case 0x32: case 0x33:
+            return (streamLoop >> ((offset - 0x30) * 8)) & 0xFF;
+            
+        // STREAM_ACTIVE ($400135)
+        case 0x35: {
+            uint8_t active = 0;
+            for (int ch = 0; ch < 8; ch++) {
+                if (streams[ch].length != 0) {
+                    active |= 1 << ch;
+                }
+            }
+            return active;
+        }
+            
         default:
             return 0x00;
     }
 }
 
 void CPLD1_Audio::storeByte(const Address& address, uint8_t value) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     uint32_t offset = flatAddr - getBaseAddress();
     
-    // FIFO writes ($400100-$40010E, 16-bit values)
-    if (offset >= 0x00 && offset <= 0x0E && (offset % 2) == 0) {
+    // FIFO writes ($400100-$40010F, 16-bit values): a 16-bit store writes the
+    // low byte first, the sample is complete with the high byte
+    if (offset <= 0x0F) {
         int channel = offset / 2;
-        
-        // For 16-bit writes, we need to handle both bytes
-        // This is simplified - in real implementation we'd buffer the bytes
-        // For now, treat each byte write as a separate 8-bit sample (extended to 16-bit)
-        int16_t sample = static_cast<int16_t>(value) << 8;
-        
-        if (!fifos[channel].isFull()) {
-            fifos[channel].samples.push(sample);
+        if ((offset % 2) == 0) {
+            sampleLow[channel] = value;
+            return;
         }
-        // If full, sample is dropped
         
+        // If full, sample is dropped
+        if (!fifos[channel].push(static_cast<int16_t>(sampleLow[channel] | (value << 8)))) {
+            droppedSamples.fetch_add(1, std::memory_order_relaxed);
+        }
         return;
     }
     
@@ -104,13 +221,70 @@ void CPLD1_Audio::storeByte(const Address& address, uint8_t value) {
             enabled = (value & 0x01) != 0;
             break;
             
+        // DMA_SOURCE ($400120), DMA_COUNT ($400122)
+        case 0x20:
+            dmaSource = (dmaSource & 0xFF00) | value;
+            break;
+        case 0x21:
+            dmaSource = (dmaSource & 0x00FF) | (value << 8);
+            break;
+        case 0x22:
+            dmaCount = (dmaCount & 0xFF00) | value;
+            break;
+        case 0x23:
+            dmaCount = (dmaCount & 0x00FF) | (value << 8);
+            break;
+            
+        // DMA_START ($400124)
+        case 0x24: {
+            int channel = value & 0x07;
+            streams[channel].length = 0;
+            dma[channel].source = dmaSource;
+            dma[channel].count = soundRAM ? dmaCount : 0;
+            runDMA(channel);
+            break;
+        }
+            
+        // STREAM_SOURCE ($400128), STREAM_LENGTH ($40012C), STREAM_LOOP ($400130)
+        case 0x28: case 0x29: case 0x2A: case 0x2B: {
+            uint32_t shift = (offset - 0x28) * 8;
+            streamSource = (streamSource & ~(0xFFu << shift)) | (static_cast<uint32_t>(value) << shift);
+            break;
+        }
+        case 0x2C: case 0x2D: case 0x2E: case 0x2F: {
+            uint32_t shift = (offset - 0x2C) * 8;
+            streamLength = (streamLength & ~(0xFFu << shift)) | (static_cast<uint32_t>(value) << shift);
+            break;
+        }
+        case 0x30: case 0x31: case 0x32: case 0x33: {
+            uint32_t shift = (offset - 0x30) * 8;
+            streamLoop = (streamLoop & ~(0xFFu << shift)) | (static_cast<uint32_t>(value) << shift);
+            break;
+        }
+            
+        // STREAM_START ($400134)
+        case 0x34: {
+            int channel = value & 0x07;
+            StreamChannel& stream = streams[channel];
+            stream.length = 0;
+            if (!(value & 0x80) && cartridge) {
+                dma[channel].count = 0;
+                stream.source = streamSource;
+                stream.length = streamLength;
+                stream.loop = streamLoop;
+                stream.position = 0;
+                runStream(channel);
+            }
+            break;
+        }
+            
         default:
             break;
     }
 }
 
 bool CPLD1_Audio::decodeAddress(const Address& address, Address& decoded) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     if (flatAddr >= getBaseAddress() && flatAddr < getBaseAddress() + getSize()) {
         decoded = address;
         return true;
@@ -118,15 +292,30 @@ bool CPLD1_Audio::decodeAddress(const Address& address, Address& decoded) {
     return false;
 }
 
+PageMapping CPLD1_Audio::mapPage(uint16_t page) {
+    return mapPageInRange(page, getBaseAddress(), getBaseAddress() + getSize() - 1);
+}
+
 void CPLD1_Audio::tick() {
+    // Disabled, the FIFOs hold on to their front sample
+    uint32_t position = playedHead++ & (PLAYED_CAPACITY - 1);
+    for (int ch = 0; ch < 8; ch++) {
+        int16_t sample;
+        played[ch][position] = fifos[ch].front(sample) ? sample : 0;
+    }
     if (!enabled) {
         return;
     }
     
     // Called at 32 kHz - drain one sample from each FIFO
     for (int ch = 0; ch < 8; ch++) {
-        if (!fifos[ch].samples.empty()) {
-            fifos[ch].samples.pop();
+        if (fifos[ch].pop()) {
+            if (dma[ch].count != 0) {
+                runDMA(ch);
+            } else if (streams[ch].length != 0 &&
+                       fifos[ch].getLevel() <= AudioFIFO::CAPACITY - STREAM_BLOCK) {
+                runStream(ch);
+            }
             
             // Check if FIFO dropped below threshold
             if (fifos[ch].getLevel() < irqThreshold) {
@@ -141,67 +330,132 @@ void CPLD1_Audio::tick() {
     updateIRQ();
 }
 
-void CPLD1_Audio::getAudioFrame(int16_t& leftOut, int16_t& rightOut) {
-    // Simple mixing: sum all 8 channels and normalize
-    int32_t mixL = 0;
-    int32_t mixR = 0;
+void CPLD1_Audio::runDMA(int channel) {
+    DMAChannel& transfer = dma[channel];
+    AudioFIFO& fifo = fifos[channel];
+    if (transfer.count == 0 || !soundRAM) {
+        return;
+    }
     
-    for (int ch = 0; ch < 8; ch++) {
-        if (!fifos[ch].samples.empty()) {
-            int16_t sample = fifos[ch].samples.front();
-            mixL += sample;
-            mixR += sample;
+    // Little-endian samples, the source wraps in the 64 KB of Sound RAM
+    const uint8_t* ram = soundRAM->getPointer();
+    while (transfer.count != 0 && !fifo.isFull()) {
+        uint16_t source = transfer.source;
+        int16_t sample = static_cast<int16_t>(ram[source] | (ram[static_cast<uint16_t>(source + 1)] << 8));
+        fifo.push(sample);
+        transfer.source = static_cast<uint16_t>(source + 2);
+        transfer.count--;
+    }
+}
+
+void CPLD1_Audio::setCartridge(Cartridge* cartridge) {
+    this->cartridge = cartridge;
+    if (!cartridge) {
+        for (StreamChannel& stream : streams) {
+            stream.length = 0;
         }
     }
+}
+
+void CPLD1_Audio::runStream(int channel) {
+    StreamChannel& stream = streams[channel];
+    AudioFIFO& fifo = fifos[channel];
+    if (stream.length == 0 || !cartridge) {
+        return;
+    }
     
-    // Normalize by number of channels to prevent clipping
-    mixL /= 8;
-    mixR /= 8;
+    // Little-endian samples, as many as the FIFO takes up to the end of the
+    // stream, then from the loop point again
+    uint8_t block[AudioFIFO::CAPACITY * 2];
+    uint32_t room = AudioFIFO::CAPACITY - fifo.getLevel();
+    while (stream.length != 0 && room != 0) {
+        if (stream.position >= stream.length) {
+            if (stream.loop >= stream.length) {
+                stream.length = 0;
+                break;
+            }
+            stream.position = stream.loop;
+        }
+        
+        uint32_t count = std::min(room, stream.length - stream.position);
+        uint64_t offset = stream.source + static_cast<uint64_t>(stream.position) * 2;
+        size_t read = offset < Cartridge::BANK_SIZE * Cartridge::MAX_BANKS ?
+            cartridge->readROM(static_cast<uint32_t>(offset), block, count * 2) : 0;
+        uint32_t samples = static_cast<uint32_t>(read / 2);
+        for (uint32_t i = 0; i < samples; i++) {
+            fifo.push(static_cast<int16_t>(block[i * 2] | (block[i * 2 + 1] << 8)));
+        }
+        stream.position += samples;
+        room -= samples;
+        if (samples < count) {
+            // Past the end of the ROM it is over, otherwise the read failed
+            if (offset + samples * 2 + 2 > cartridge->getROMSize()) {
+                stream.length = 0;
+            }
+            break;
+        }
+    }
+}
+
+int CPLD1_Audio::readChannelBlock(int channel, int16_t* out, int count) {
+    if (channel < 0 || channel >= 8 || count <= 0) {
+        return 0;
+    }
     
-    // Clamp to 16-bit range
-    leftOut = std::clamp(mixL, (int32_t)-32768, (int32_t)32767);
-    rightOut = std::clamp(mixR, (int32_t)-32768, (int32_t)32767);
+    uint32_t available = std::min(playedHead - playedRead[channel], PLAYED_CAPACITY);
+    uint32_t taken = std::min(available, static_cast<uint32_t>(count));
+    const std::array<int16_t, PLAYED_CAPACITY>& ring = played[channel];
+    for (uint32_t i = 0, position = playedHead - taken; i < taken; i++, position++) {
+        out[i] = ring[position & (PLAYED_CAPACITY - 1)];
+    }
+    playedRead[channel] = playedHead;
+    return static_cast<int>(taken);
+}
+
+void CPLD1_Audio::getChannelSamples(int16_t* samples) const {
+    for (int ch = 0; ch < 8; ch++) {
+        if (!fifos[ch].front(samples[ch])) {
+            samples[ch] = 0;
+        }
+    }
 }
 
 void CPLD1_Audio::updateIRQ() {
     // Check if any channel has IRQ pending
     bool anyIRQ = (irqStatus != 0);
     
-    if (anyIRQ && irqCallback) {
-        irqCallback();
+    if (irqCallback) {
+        irqCallback(anyIRQ);
     }
 }
 
 void CPLD1_Audio::onMailboxBWrite() {
-    if (mailboxB && soundRAM) {
-        Address addr(0x41, 0x0000);  // Mailbox B base
-        uint8_t cmd = mailboxB->readByte(addr);
-
-        if (cmd == 0x01) {
-            addr = Address(0x41, 0x0001);
-            uint8_t destLo = mailboxB->readByte(addr);
-            addr = Address(0x41, 0x0002);
-            uint8_t destHi = mailboxB->readByte(addr);
-            uint16_t destAddr = destLo | (destHi << 8);
-
-            addr = Address(0x41, 0x0003);
-            uint8_t lenLo = mailboxB->readByte(addr);
-            addr = Address(0x41, 0x0004);
-            uint8_t lenHi = mailboxB->readByte(addr);
-            uint16_t length = lenLo | (lenHi << 8);
-
-            std::cout << "[CPLD1] Boot command: copy " << length
-            << " bytes to Sound RAM $" << std::hex << destAddr << std::dec << std::endl;
-
-            for (uint16_t i = 0; i < length; i++) {
-                addr = Address(0x41, 0x0005 + i);
-                uint8_t data = mailboxB->readByte(addr);
-                Address ramAddr(0x00, destAddr + i);
-                soundRAM->storeByte(ramAddr, data);
+    // Queued messages are for the Sound CPU to read, boot commands are not
+    if (mailboxB && soundRAM && !mailboxB->isQueueMode()) {
+        uint8_t command[5];
+        if (mailboxB->readBlock(0, command, sizeof(command)) && command[0] == 0x01) {
+            uint16_t destAddr = command[1] | (command[2] << 8);
+            uint16_t length = command[3] | (command[4] << 8);
+
+            Log::dbg("CPLD1").str("Boot command: copy ").num(length)
+                .str(" bytes to Sound RAM ").hex(destAddr, 4).show();
+
+            // Payload from offset 5, no more than the mailbox holds
+            uint32_t capacity = mailboxB->getSize() - sizeof(command);
+            if (length > capacity) {
+                Log::wrn("CPLD1").str("Boot copy of ").num(length).str(" bytes cut to ").num(capacity).show();
+                length = static_cast<uint16_t>(capacity);
+            }
+            bootBuffer.resize(length);
+            if (mailboxB->readBlock(sizeof(command), bootBuffer.data(), length)) {
+                // The destination wraps in the first 64 KB
+                uint32_t first = std::min<uint32_t>(length, 0x10000 - destAddr);
+                soundRAM->writeBlock(destAddr, bootBuffer.data(), first);
+                soundRAM->writeBlock(0, bootBuffer.data() + first, length - first);
             }
 
             if (soundCPUReset) {
-                std::cout << "[CPLD1] Releasing Sound CPU reset" << std::endl;
+                Log::dbg("CPLD1").str("Releasing Sound CPU reset").show();
                 soundCPUReset(false);
             }
 
@@ -225,7 +479,7 @@ uint8_t CPLD1_Audio::getFIFOLevel(int channel) const {
     if (channel < 0 || channel >= 8) {
         return 0;
     }
-    return fifos[channel].getLevel();
+    return fifos[channel].getStatusLevel();
 }
 
 bool CPLD1_Audio::getIRQStatus(int channel) const {
@@ -2,12 +2,17 @@
 #define CPLD1_AUDIO_H
 
 #include "../cpu/SystemBusDevice.hpp"
-#include <queue>
 #include <array>
+#include <atomic>
 #include <cstdint>
 #include <functional>
+#include <vector>
 #include "../memory/mailbox.h"
 #include "../memory/ram.h"
+class Cartridge;
+class StateWriter;
+class StateReader;
+
 /**
  * CPLD #1: Audio FIFO Serializer & TDM Generator
  * 
@@ -15,12 +20,40 @@
  * Drains at 32 kHz and generates TDM output to ADAU1452 DSP
  * Generates IRQ when FIFO level < threshold
  * 
- * Register Map: $400100-$40011F
+ * Register Map: $400100-$40013F
+ *   $400100-$40010F  FIFO data, one 16-bit port per channel: the low byte is
+ *                    latched, writing the high byte pushes the sample
+ *   $400120-$400121  DMA_SOURCE, Sound RAM address of the first sample
+ *   $400122-$400123  DMA_COUNT, samples to move
+ *   $400124          DMA_START, write a channel number to start its transfer
+ *   $400125          DMA_ACTIVE, bit per channel still transferring
+ *   $400128-$40012B  STREAM_SOURCE, cartridge ROM offset of the first sample
+ *   $40012C-$40012F  STREAM_LENGTH, samples in the stream
+ *   $400130-$400133  STREAM_LOOP, sample the stream goes back to past its
+ *                    end, STREAM_LENGTH or more plays it once
+ *   $400134          STREAM_START, write a channel number to start its
+ *                    stream, with bit 7 set to stop it
+ *   $400135          STREAM_ACTIVE, bit per channel streaming
+ *
+ * A DMA transfer fills its FIFO from Sound RAM at once, then tops it up as
+ * it drains, until DMA_COUNT samples went through. Starting a channel again
+ * replaces its transfer, a count of 0 stops it.
+ *
+ * A stream does the same from the cartridge ROM (offsets into the whole
+ * ROM, whatever bank the CPUs see, e.g. from the header's audioData), and
+ * loops until stopped when STREAM_LOOP lies within it. The FIFO is topped
+ * up STREAM_BLOCK samples at a time. The channel's transfer and stream
+ * replace each other. One that runs past the end of the ROM stops there,
+ * as all streams do when the cartridge is removed, one whose samples cannot
+ * be read (a block of a compressed ROM failing to decompress) underruns and
+ * tries again at the next block.
  */
 class CPLD1_Audio : public SystemBusDevice {
 public:
 
     void setSoundRAM(RAM* ram) { soundRAM = ram; }
+    // Streams read from it, nullptr stops them
+    void setCartridge(Cartridge* cartridge);
     void setSoundCPUReset(std::function<void(bool)> callback) { soundCPUReset = callback; }
 
     CPLD1_Audio();
@@ -30,25 +63,38 @@ public:
     uint8_t readByte(const Address& address) override;
     void storeByte(const Address& address, uint8_t value) override;
     bool decodeAddress(const Address& address, Address& decoded) override;
+    PageMapping mapPage(uint16_t page) override;
+    const char* getDeviceType() const override { return "CPLD1_Audio"; }
     uint32_t getBaseAddress() const { return 0x400100; }
-    uint32_t getSize() const { return 0x20; }
+    uint32_t getSize() const { return 0x30; }
     
-    // Timing - called at 32 kHz sample rate
+    // Timing - called at 32 kHz sample rate, plays the sample at the front
+    // of every FIFO (0 for the empty ones) and drains it
     void tick();
     
-    // Get mixed audio output (for emulator audio system)
-    void getAudioFrame(int16_t& leftOut, int16_t& rightOut);
+    // Samples the channel played since the last call, the latest count of them
+    // if there were more. Returns how many were copied to out.
+    int readChannelBlock(int channel, int16_t* out, int count);
+    // Sample at the front of every channel FIFO, 0 for the empty ones
+    void getChannelSamples(int16_t* samples) const;
     
-    // IRQ callback
-    using IRQCallback = std::function<void()>;
+    // FIFO low IRQ output, called with whether any channel's IRQ is pending
+    // whenever the flags may have changed
+    using IRQCallback = std::function<void(bool asserted)>;
     void setIRQCallback(IRQCallback callback) { irqCallback = callback; }
     
     // Reset
     void reset();
     
+    // Save states, registers and FIFOs
+    void saveState(StateWriter& writer) const;
+    bool loadState(StateReader& reader);
+    
     // Debug
     uint8_t getFIFOLevel(int channel) const;
     bool getIRQStatus(int channel) const;
+    // Samples stored into a full FIFO since power on, any thread
+    uint64_t getDroppedSampleCount() const { return droppedSamples.load(std::memory_order_relaxed); }
 
     void setMailboxB(Mailbox* mailbox) { mailboxB = mailbox; }
     void setMailboxBCallback(std::function<void()> callback) { mailboxBCallback = callback; }
@@ -57,40 +103,124 @@ public:
 private:
 
     RAM* soundRAM = nullptr;
+    Cartridge* cartridge = nullptr;
     std::function<void(bool)> soundCPUReset;
 
     // FIFO structure
+    // Single producer (Sound CPU stores) single consumer (tick) ring buffer,
+    // lock-free so that the audio thread may peek at it meanwhile
     struct AudioFIFO {
-        std::queue<int16_t> samples;  // Max 256 samples
+        static constexpr uint32_t CAPACITY = 256;  // Power of two
+        static constexpr uint32_t MASK = CAPACITY - 1;
+
+        std::array<std::atomic<int16_t>, CAPACITY> samples;
+        // Free running, the level is head - tail
+        std::atomic<uint32_t> head;  // Written by the producer only
+        std::atomic<uint32_t> tail;  // Written by the consumer only
         bool irqPending;
         
-        AudioFIFO() : irqPending(false) {}
+        AudioFIFO() : head(0), tail(0), irqPending(false) {}
         
+        // Consumer side, drops everything pushed so far
         void clear() {
-            while (!samples.empty()) samples.pop();
+            tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
             irqPending = false;
         }
         
-        uint8_t getLevel() const {
-            return static_cast<uint8_t>(samples.size());
+        // Producer side, false if full
+        bool push(int16_t sample) {
+            uint32_t h = head.load(std::memory_order_relaxed);
+            if (h - tail.load(std::memory_order_acquire) >= CAPACITY) {
+                return false;
+            }
+            samples[h & MASK].store(sample, std::memory_order_relaxed);
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+        
+        // Consumer side, false if empty
+        bool pop() {
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            if (t == head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+        
+        // Oldest sample, false if empty
+        bool front(int16_t& sample) const {
+            uint32_t t = tail.load(std::memory_order_acquire);
+            if (t == head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            sample = samples[t & MASK].load(std::memory_order_relaxed);
+            return true;
+        }
+        
+        uint32_t getLevel() const {
+            return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+        }
+        
+        // As the 8-bit status registers show it, a full FIFO reads 255
+        uint8_t getStatusLevel() const {
+            uint32_t level = getLevel();
+            return static_cast<uint8_t>(level > 0xFF ? 0xFF : level);
         }
         
         bool isFull() const {
-            return samples.size() >= 256;
+            return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire) >= CAPACITY;
         }
         
         bool isEmpty() const {
-            return samples.empty();
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
         }
     };
     
     // 8 channel FIFOs
     std::array<AudioFIFO, 8> fifos;
+    std::atomic<uint64_t> droppedSamples;
+    
+    // What tick() played, for readChannelBlock(). Free running positions, the
+    // ring only keeps the latest PLAYED_CAPACITY samples of each channel.
+    static constexpr uint32_t PLAYED_CAPACITY = 256;  // Power of two
+    std::array<std::array<int16_t, PLAYED_CAPACITY>, 8> played;
+    uint32_t playedHead;
+    std::array<uint32_t, 8> playedRead;
     
     // Registers
     uint8_t irqThreshold;  // FIFO low threshold (default 128)
     uint8_t irqStatus;     // IRQ flags (bit per channel)
     bool enabled;          // Master enable
+    std::array<uint8_t, 8> sampleLow;  // Latched low bytes of the data ports
+    uint16_t dmaSource;
+    uint16_t dmaCount;
+    uint32_t streamSource;
+    uint32_t streamLength;
+    uint32_t streamLoop;
+    
+    // Transfers in progress
+    struct DMAChannel {
+        uint16_t source;
+        uint16_t count;    // Samples left, 0 when idle
+    };
+    std::array<DMAChannel, 8> dma;
+    
+    // Moves samples of the channel's transfer while its FIFO has room
+    void runDMA(int channel);
+    
+    // Streams in progress, positions in samples, a length of 0 when idle
+    static constexpr uint32_t STREAM_BLOCK = 64;
+    struct StreamChannel {
+        uint32_t source;
+        uint32_t length;
+        uint32_t loop;
+        uint32_t position;
+    };
+    std::array<StreamChannel, 8> streams;
+    
+    // Same for the channel's stream, reading the ROM a block at a time
+    void runStream(int channel);
     
     // IRQ callback
     IRQCallback irqCallback;
@@ -104,6 +234,8 @@ private:
     // Mailbox B reference
     Mailbox* mailboxB = nullptr;
     std::function<void()> mailboxBCallback;
+    // Boot payload on its way to Sound RAM
+    std::vector<uint8_t> bootBuffer;
 };
 
 #endif // CPLD1_AUDIO_H
@@ -1,6 +1,8 @@
 #include "cpld2_video.h"
-#include <iostream>
-#include <iomanip>
+#include "../state/save_state.h"
+#include "../cpu/Log.hpp"
+#include "../timing/master_clock.h"
+#include <algorithm>
 
 
 
@@ -12,127 +14,383 @@ CPLD2_Video::CPLD2_Video()
     , inHBlank(true)
     , vblankIRQPending(false)
     , hblankIRQPending(false)
+    , irqEnable(0)
     , vblankCallback(nullptr)
     , hblankCallback(nullptr)
+    , mailboxA(nullptr)
+    , mailboxB(nullptr)
+    , dmaActive(false)
+    , dmaDestination(0)
+    , dmaLength(0)
 {
+    registers = Registers();
+    buildFetchWindows();
     reset();
 }
 
 void CPLD2_Video::reset() {
+    uint32_t version = registers.version;
+    registers = Registers();
+    registers.brightness = 31;
+    for (Registers::Layer& layer : registers.layers) {
+        layer.blend = 16;
+    }
+    registers.version = version + 1;
+    videoMode = VideoMode::MODE_240P;
+    startFrameLog();
     rasterLine = 0;
     rasterX = 0;
     inVBlank = true;
     inHBlank = true;
     vblankIRQPending = false;
     hblankIRQPending = false;
+    irqEnable = 0;
+    updateIRQs();
+    cancelDMA();
+}
+
+void CPLD2_Video::saveState(StateWriter& writer) const {
+    writer.writeValue(videoMode);
+    writer.writeValue(rasterLine);
+    writer.writeValue(rasterX);
+    writer.writeValue(inVBlank);
+    writer.writeValue(inHBlank);
+    writer.writeValue(vblankIRQPending);
+    writer.writeValue(hblankIRQPending);
+    writer.writeValue(irqEnable);
+    writer.writeValue(dmaActive);
+    writer.writeValue(dmaDestination);
+    writer.writeValue(dmaLength);
+    for (const Registers::Layer& layer : registers.layers) {
+        writer.writeValue(layer.scrollX);
+        writer.writeValue(layer.scrollY);
+        writer.writeValue(layer.control);
+        writer.writeValue(layer.priority);
+        writer.writeValue(layer.blend);
+    }
+    writer.writeValue(registers.mode);
+    writer.writeValue(registers.layerEnable);
+    writer.writeValue(registers.brightness);
+    writer.writeValue(registers.tintR);
+    writer.writeValue(registers.tintG);
+    writer.writeValue(registers.tintB);
+    writer.writeValue(registers.mosaic);
+    writer.writeValue(registers.mosaicEnable);
+    for (int window = 0; window < Registers::WINDOW_COUNT; ++window) {
+        writer.writeValue(registers.windowEnable[window]);
+        writer.writeValue(registers.windowLeft[window]);
+        writer.writeValue(registers.windowRight[window]);
+    }
+    writer.writeValue(registers.windowInvert);
+}
+
+bool CPLD2_Video::loadState(StateReader& reader) {
+    bool ok = reader.readValue(videoMode) &&
+              reader.readValue(rasterLine) &&
+              reader.readValue(rasterX) &&
+              reader.readValue(inVBlank) &&
+              reader.readValue(inHBlank) &&
+              reader.readValue(vblankIRQPending) &&
+              reader.readValue(hblankIRQPending) &&
+              reader.readValue(irqEnable) &&
+              reader.readValue(dmaActive) &&
+              reader.readValue(dmaDestination) &&
+              reader.readValue(dmaLength);
+    for (Registers::Layer& layer : registers.layers) {
+        ok = ok && reader.readValue(layer.scrollX) &&
+             reader.readValue(layer.scrollY) &&
+             reader.readValue(layer.control) &&
+             reader.readValue(layer.priority) &&
+             reader.readValue(layer.blend);
+    }
+    ok = ok && reader.readValue(registers.mode) &&
+         reader.readValue(registers.layerEnable) &&
+         reader.readValue(registers.brightness) &&
+         reader.readValue(registers.tintR) &&
+         reader.readValue(registers.tintG) &&
+         reader.readValue(registers.tintB) &&
+         reader.readValue(registers.mosaic) &&
+         reader.readValue(registers.mosaicEnable);
+    for (int window = 0; window < Registers::WINDOW_COUNT; ++window) {
+        ok = ok && reader.readValue(registers.windowEnable[window]) &&
+             reader.readValue(registers.windowLeft[window]) &&
+             reader.readValue(registers.windowRight[window]);
+    }
+    ok = ok && reader.readValue(registers.windowInvert);
+    registers.version++;
+    updateIRQs();
+    // Rendered again as it is
+    startFrameLog();
+    return ok;
+}
+
+void CPLD2_Video::setVideoMode(VideoMode mode) {
+    videoMode = mode;
+    writeRegister(0x00, (registers.mode & ~0x04) | (mode == VideoMode::MODE_480I ? 0x04 : 0x00));
+}
+
+void CPLD2_Video::writeRegister(uint8_t offset, uint8_t value) {
+    if (!applyRegister(registers, offset, value)) {
+        return;
+    }
+    registers.version++;
+    
+    // Without a cycle source there are no lines to tell apart, frames start
+    // with the latest registers
+    if (!cycleSource) {
+        frameRegisters = registers;
+        return;
+    }
+    
+    // Lines as rendered, 0 the first active one. Past HBlank the line is
+    // already on its way, the write shows from the next one
+    RasterPosition position = getRasterPosition();
+    uint16_t line = (position.line % LINES_PER_FRAME_240P + LINES_PER_FRAME_240P - VBLANK_LINES_240P) %
+                    LINES_PER_FRAME_240P;
+    if (!position.inHBlank) {
+        line++;
+    }
+    registerWrites.push_back(RegisterWrite{ line, position.x, offset, value });
+}
+
+void CPLD2_Video::startFrameLog() {
+    frameRegisters = registers;
+    frameField = getRasterPosition().line >= LINES_PER_FRAME_240P ? 1 : 0;
+    registerWrites.clear();
+}
+
+bool CPLD2_Video::applyRegister(Registers& registers, uint8_t offset, uint8_t value) {
+    uint8_t* field = nullptr;
+    switch (offset) {
+        // VIDEO_MODE ($400200), LAYER_ENABLE ($400201)
+        case 0x00: field = &registers.mode; break;
+        case 0x01: field = &registers.layerEnable; break;
+        
+        // MOSAIC ($400238), MOSAIC_ENABLE ($400239), WINDOW_ENABLE ($40023A-$40023B),
+        // WINDOW_INVERT ($40023C)
+        case 0x38: field = &registers.mosaic; break;
+        case 0x39: field = &registers.mosaicEnable; break;
+        case 0x3A: field = &registers.windowEnable[0]; break;
+        case 0x3B: field = &registers.windowEnable[1]; break;
+        case 0x3C: field = &registers.windowInvert; break;
+        
+        // BRIGHTNESS ($400248), TINT_R/G/B ($400249-$40024B)
+        case 0x48: field = &registers.brightness; break;
+        case 0x49: field = reinterpret_cast<uint8_t*>(&registers.tintR); break;
+        case 0x4A: field = reinterpret_cast<uint8_t*>(&registers.tintG); break;
+        case 0x4B: field = reinterpret_cast<uint8_t*>(&registers.tintB); break;
+        
+        default:
+            break;
+    }
+    
+    // Window edges, $400240 on
+    if (offset >= 0x40 && offset < 0x40 + Registers::WINDOW_COUNT * 4u) {
+        int window = (offset - 0x40) / 4;
+        uint16_t& edge = (offset & 0x02) ? registers.windowRight[window] : registers.windowLeft[window];
+        uint16_t word = (offset & 1) ? (edge & 0x00FF) | (value << 8)
+                                     : (edge & 0xFF00) | value;
+        if (edge == word) {
+            return false;
+        }
+        edge = word;
+        return true;
+    }
+    
+    // Layer registers, $400210 on
+    if (offset >= 0x10 && offset < 0x10 + LAYER_COUNT * 8u) {
+        Registers::Layer& layer = registers.layers[(offset - 0x10) / 8];
+        uint8_t index = offset & 0x07;
+        if (index < 4) {
+            uint16_t& scroll = (index < 2) ? layer.scrollX : layer.scrollY;
+            uint16_t word = (index & 1) ? (scroll & 0x00FF) | (value << 8)
+                                        : (scroll & 0xFF00) | value;
+            if (scroll == word) {
+                return false;
+            }
+            scroll = word;
+            return true;
+        }
+        if (index == 4) {
+            field = &layer.control;
+        } else if (index == 5) {
+            field = &layer.priority;
+        } else if (index == 6) {
+            field = &layer.blend;
+        }
+    }
+    
+    if (!field || *field == value) {
+        return false;
+    }
+    *field = value;
+    return true;
 }
 
 uint8_t CPLD2_Video::readByte(const Address& address) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     uint32_t offset = flatAddr - getBaseAddress();
     
+    // Only worked out for the raster registers
+    RasterPosition raster = {};
+    if (offset >= 0x02 && offset <= 0x09) {
+        raster = getRasterPosition();
+    }
+    
     switch (offset) {
         // VIDEO_MODE ($400200)
         case 0x00:
-            return static_cast<uint8_t>(videoMode);
+            return registers.mode;
+        // LAYER_ENABLE ($400201)
         case 0x01:
-            return 0x00;
+            return registers.layerEnable;
             
         // RASTER_LINE ($400202)
         case 0x02:
-            return rasterLine & 0xFF;
+            return raster.line & 0xFF;
         case 0x03:
-            return (rasterLine >> 8) & 0xFF;
+            return (raster.line >> 8) & 0xFF;
             
         // RASTER_X ($400204)
         case 0x04:
-            return rasterX & 0xFF;
+            return raster.x & 0xFF;
         case 0x05:
-            return (rasterX >> 8) & 0xFF;
+            return (raster.x >> 8) & 0xFF;
             
         // VBLANK_STATUS ($400206)
         case 0x06:
-            return inVBlank ? 0x01 : 0x00;
+            return raster.inVBlank ? 0x01 : 0x00;
         case 0x07:
             return 0x00;
             
         // HBLANK_STATUS ($400208)
         case 0x08:
-            return inHBlank ? 0x01 : 0x00;
+            return raster.inHBlank ? 0x01 : 0x00;
         case 0x09:
             return 0x00;
             
+        // IRQ_ENABLE ($40020C)
+        case 0x0C:
+            return irqEnable;
+            
+        // MOSAIC ($400238) to WINDOW_INVERT ($40023C)
+        case 0x38:
+            return registers.mosaic;
+        case 0x39:
+            return registers.mosaicEnable;
+        case 0x3A:
+            return registers.windowEnable[0];
+        case 0x3B:
+            return registers.windowEnable[1];
+        case 0x3C:
+            return registers.windowInvert;
+            
+        // BRIGHTNESS ($400248), TINT_R/G/B ($400249-$40024B)
+        case 0x48:
+            return registers.brightness;
+        case 0x49:
+            return static_cast<uint8_t>(registers.tintR);
+        case 0x4A:
+            return static_cast<uint8_t>(registers.tintG);
+        case 0x4B:
+            return static_cast<uint8_t>(registers.tintB);
+
         default:
-            return 0x00;
+            break;
+    }
+    
+    // Layer registers, $400210 on
+    if (offset >= 0x10 && offset < 0x10 + LAYER_COUNT * 8u) {
+        const Registers::Layer& layer = registers.layers[(offset - 0x10) / 8];
+        switch (offset & 0x07) {
+            case 0: return layer.scrollX & 0xFF;
+            case 1: return (layer.scrollX >> 8) & 0xFF;
+            case 2: return layer.scrollY & 0xFF;
+            case 3: return (layer.scrollY >> 8) & 0xFF;
+            case 4: return layer.control;
+            case 5: return layer.priority;
+            case 6: return layer.blend;
+            default: break;
+        }
+    }
+    
+    // Window edges, $400240 on
+    if (offset >= 0x40 && offset < 0x40 + Registers::WINDOW_COUNT * 4u) {
+        int window = (offset - 0x40) / 4;
+        uint16_t edge = (offset & 0x02) ? registers.windowRight[window] : registers.windowLeft[window];
+        return (offset & 1) ? (edge >> 8) & 0xFF : edge & 0xFF;
     }
+    return 0x00;
 }
 
 void CPLD2_Video::storeByte(const Address& address, uint8_t value) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     uint32_t offset = flatAddr - getBaseAddress();
+    if (offset >= getSize()) {
+        return;
+    }
     
     switch (offset) {
         // VIDEO_MODE ($400200)
         case 0x00:
-            videoMode = (value & 0x01) ? VideoMode::MODE_480I : VideoMode::MODE_240P;
+            videoMode = (value & 0x04) ? VideoMode::MODE_480I : VideoMode::MODE_240P;
             break;
             
         // IRQ_CLEAR ($40020A)
         case 0x0A:
             if (value != 0) {
                 vblankIRQPending = false;
+                hblankIRQPending = false;
+                updateIRQs();
             }
             break;
             
+        // IRQ_ENABLE ($40020C)
+        case 0x0C:
+            irqEnable = value & 0x03;
+            updateIRQs();
+            break;
+            
         default:
             break;
     }
+    
+    writeRegister(static_cast<uint8_t>(offset), value);
 }
 
 void CPLD2_Video::onMailboxAWrite() {
-    if (mailboxA && graphicsRAM) {
-        Address addr(0x40, 0x0000);  // Mailbox A base
-        uint8_t cmd = mailboxA->readByte(addr);
-
-        if (cmd == 0x01) {
-            addr = Address(0x40, 0x0001);
-            uint8_t destLo = mailboxA->readByte(addr);
-            addr = Address(0x40, 0x0002);
-            uint8_t destHi = mailboxA->readByte(addr);
-            uint16_t destAddr = destLo | (destHi << 8);
-
-            addr = Address(0x40, 0x0003);
-            uint8_t lenLo = mailboxA->readByte(addr);
-            addr = Address(0x40, 0x0004);
-            uint8_t lenHi = mailboxA->readByte(addr);
-            uint16_t length = lenLo | (lenHi << 8);
-
-            std::cout << "[CPLD2] Boot command: copy " << length
-            << " bytes to VRAM $" << std::hex << destAddr << std::dec << std::endl;
-
-            // Copy data from mailbox to VRAM
-            for (uint16_t i = 0; i < length; i++) {
-                addr = Address(0x40, 0x0005 + i);
-                uint8_t data = mailboxA->readByte(addr);
-                Address vramAddr(0x00, destAddr + i);
-                graphicsRAM->storeByte(vramAddr, data);
-            }
+    // A transfer in flight reads the mailbox once it is done
+    if (dmaActive) {
+        return;
+    }
 
-            std::cout << "[CPLD2] VRAM hexdump after copy:" << std::endl;
-            std::cout << "  ";
-            for (uint16_t i = 0; i < 32; i++) {
-                Address vramAddr(0x00, i);
-                std::cout << std::hex << std::setw(2) << std::setfill('0')
-                << (int)graphicsRAM->readByte(vramAddr) << " ";
-                if ((i + 1) % 16 == 0) std::cout << std::endl << "  ";
-            }
-            std::cout << std::dec << std::endl;
+    // Queued messages are for the Graphics CPU to read, boot commands are not
+    if (mailboxA && graphicsRAM && !mailboxA->isQueueMode()) {
+        uint8_t command[BOOT_PAYLOAD];
+        if (mailboxA->readBlock(0, command, sizeof(command)) && command[0] == BOOT_COMMAND) {
+            uint16_t destAddr = command[1] | (command[2] << 8);
+            uint16_t length = command[3] | (command[4] << 8);
+
+            Log::dbg("CPLD2").str("Boot command: copy ").num(length)
+                .str(" bytes to VRAM ").hex(destAddr, 4).show();
 
-            if (graphicsCPUReset) {
-                std::cout << "[CPLD2] Releasing Graphics CPU reset" << std::endl;
-                graphicsCPUReset(false);
+            // No more than the mailbox holds
+            uint32_t capacity = mailboxA->getSize() - BOOT_PAYLOAD;
+            if (length > capacity) {
+                Log::wrn("CPLD2").str("Boot copy of ").num(length).str(" bytes cut to ").num(capacity).show();
+                length = static_cast<uint16_t>(capacity);
             }
 
+            dmaActive = true;
+            dmaDestination = destAddr;
+            dmaLength = length;
+            uint32_t cycles = length * DMA_CYCLES_PER_BYTE;
+            if (cycles == 0 || !dmaStartCallback) {
+                completeDMA();
+            } else {
+                mailboxA->setBusy(true);
+                dmaStartCallback(cycles);
+            }
             return;
         }
     }
@@ -142,6 +400,37 @@ void CPLD2_Video::onMailboxAWrite() {
     }
 }
 
+void CPLD2_Video::completeDMA() {
+    if (!dmaActive) {
+        return;
+    }
+    dmaActive = false;
+
+    if (mailboxA && graphicsRAM) {
+        mailboxA->setBusy(false);
+
+        // The destination counter wraps in the first 64 KB of VRAM
+        dmaBuffer.resize(dmaLength);
+        if (mailboxA->readBlock(BOOT_PAYLOAD, dmaBuffer.data(), dmaLength)) {
+            uint32_t first = std::min<uint32_t>(dmaLength, 0x10000 - dmaDestination);
+            graphicsRAM->writeBlock(dmaDestination, dmaBuffer.data(), first);
+            graphicsRAM->writeBlock(0, dmaBuffer.data() + first, dmaLength - first);
+        }
+    }
+
+    if (graphicsCPUReset) {
+        Log::dbg("CPLD2").str("Releasing Graphics CPU reset").show();
+        graphicsCPUReset(false);
+    }
+}
+
+void CPLD2_Video::cancelDMA() {
+    if (dmaActive && mailboxA) {
+        mailboxA->setBusy(false);
+    }
+    dmaActive = false;
+}
+
 void CPLD2_Video::onMailboxBWrite() {
     if (mailboxBCallback) {
         mailboxBCallback();  // Trigger Sound CPU IRQ
@@ -149,7 +438,7 @@ void CPLD2_Video::onMailboxBWrite() {
 }
 
 bool CPLD2_Video::decodeAddress(const Address& address, Address& decoded) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     if (flatAddr >= getBaseAddress() && flatAddr < getBaseAddress() + getSize()) {
         decoded = address;
         return true;
@@ -157,6 +446,10 @@ bool CPLD2_Video::decodeAddress(const Address& address, Address& decoded) {
     return false;
 }
 
+PageMapping CPLD2_Video::mapPage(uint16_t page) {
+    return mapPageInRange(page, getBaseAddress(), getBaseAddress() + getSize() - 1);
+}
+
 void CPLD2_Video::tick() {
     // Increment pixel counter
     rasterX++;
@@ -174,9 +467,7 @@ void CPLD2_Video::tick() {
             // VBlank IRQ on line 0
             if (!vblankIRQPending) {
                 vblankIRQPending = true;
-                if (vblankCallback) {
-                    vblankCallback();
-                }
+                updateIRQs();
             }
         }
     }
@@ -188,20 +479,106 @@ void CPLD2_Video::tick() {
 void CPLD2_Video::updateBlankingFlags() {
     // HBlank: pixels 0-137
     inHBlank = (rasterX >= HBLANK_START && rasterX <= HBLANK_END);
-    
+    inVBlank = isVBlankLine(rasterLine);
+}
+
+bool CPLD2_Video::isVBlankLine(uint16_t line) const {
     // VBlank: lines 0-21 (for both modes)
     if (videoMode == VideoMode::MODE_240P) {
-        inVBlank = (rasterLine < VBLANK_LINES_240P);
-    } else {
-        // 480i: VBlank per field
-        inVBlank = (rasterLine < VBLANK_LINES_480I) || 
-                   (rasterLine >= 262 && rasterLine < 262 + VBLANK_LINES_480I);
+        return line < VBLANK_LINES_240P;
+    }
+    // 480i: VBlank per field
+    return (line < VBLANK_LINES_480I) ||
+           (line >= 262 && line < 262 + VBLANK_LINES_480I);
+}
+
+CPLD2_Video::RasterPosition CPLD2_Video::getRasterPosition() const {
+    if (!cycleSource) {
+        return RasterPosition{ rasterLine, rasterX, inVBlank, inHBlank };
+    }
+
+    // The scheduler's lines: spread evenly over the frame, the active ones
+    // first, where CPLD2 counts from the start of VBlank
+    const uint64_t frame = MasterClock::CYCLES_PER_FRAME_GRAPHICS;
+    const uint64_t lines = MasterClock::TOTAL_SCANLINES;
+    uint64_t time = cycleSource();
+    uint64_t cycle = time % frame;
+    uint64_t line = cycle * lines / frame;
+    if ((line + 1) * frame / lines <= cycle) {
+        line++;
+    }
+    uint64_t lineStart = line * frame / lines;
+
+    RasterPosition position;
+    position.line = static_cast<uint16_t>((line + VBLANK_LINES_240P) % lines);
+    // Fields start with their VBlank, at the scheduler line CPLD2 counts as 0
+    const uint64_t fieldShift = frame - (lines - VBLANK_LINES_240P) * frame / lines;
+    if (videoMode == VideoMode::MODE_480I && (((time + fieldShift) / frame) & 1)) {
+        // Second field
+        position.line += static_cast<uint16_t>(lines);
+    }
+    position.x = static_cast<uint16_t>(cycle - lineStart);
+    position.inHBlank = position.x <= HBLANK_END;
+    position.inVBlank = isVBlankLine(position.line);
+    return position;
+}
+
+void CPLD2_Video::onHSync(uint16_t line) {
+    if (line == 0) {
+        startFrameLog();
+    }
+    bool changed = !hblankIRQPending;
+    hblankIRQPending = true;
+    if (line == MasterClock::SCANLINES_PER_FRAME && !vblankIRQPending) {
+        vblankIRQPending = true;
+        changed = true;
+    }
+    if (changed) {
+        updateIRQs();
+    }
+}
+
+void CPLD2_Video::updateIRQs() {
+    if (vblankCallback) {
+        vblankCallback(vblankIRQPending && (irqEnable & 0x01));
+    }
+    if (hblankCallback) {
+        hblankCallback(hblankIRQPending && (irqEnable & 0x02));
     }
 }
 
 bool CPLD2_Video::allowGCpuVramAccess() const {
     // G-CPU can access VRAM during blanking periods only
-    return inHBlank || inVBlank;
+    RasterPosition position = getRasterPosition();
+    return position.inHBlank || position.inVBlank;
+}
+
+void CPLD2_Video::buildFetchWindows() {
+    // The lines of getRasterPosition(), the second 480i field alike
+    const uint64_t frame = MasterClock::CYCLES_PER_FRAME_GRAPHICS;
+    const uint64_t lines = MasterClock::TOTAL_SCANLINES;
+    fetchWindows.resize(lines);
+    for (uint64_t line = 0; line < lines; line++) {
+        uint32_t lineStart = static_cast<uint32_t>(line * frame / lines);
+        uint32_t lineEnd = static_cast<uint32_t>((line + 1) * frame / lines);
+        if (line + VBLANK_LINES_240P >= lines) {
+            fetchWindows[line] = FetchWindow{ lineEnd, lineEnd };
+        } else {
+            fetchWindows[line] = FetchWindow{ lineStart + HBLANK_END + 1, lineEnd };
+        }
+    }
+}
+
+uint32_t CPLD2_Video::getGCpuVramStall(uint64_t masterCycle) const {
+    const uint64_t frame = MasterClock::CYCLES_PER_FRAME_GRAPHICS;
+    const uint64_t lines = MasterClock::TOTAL_SCANLINES;
+    uint32_t cycle = static_cast<uint32_t>(masterCycle % frame);
+    uint64_t line = cycle * lines / frame;
+    if ((line + 1) * frame / lines <= cycle) {
+        line++;
+    }
+    const FetchWindow& window = fetchWindows[line];
+    return cycle >= window.start && cycle < window.end ? window.end - cycle : 0;
 }
 
 uint16_t CPLD2_Video::getTotalLines() const {
@@ -4,11 +4,15 @@
 #include "../cpu/SystemBusDevice.hpp"
 #include <cstdint>
 #include <functional>
+#include <vector>
 #include "../memory/ram.h"
 #include "../memory/mailbox.h"
 
 class Mailbox;
 
+class StateWriter;
+class StateReader;
+
 /**
  * CPLD #2: Video Timing Generator & VRAM Arbiter
  * 
@@ -16,8 +20,25 @@ class Mailbox;
  * Tracks raster position (scanline, pixel)
  * Arbitrates VRAM access (G-CPU vs raster engine)
  * Manages mailbox control
+ * Boot DMA: a command 0x01 in mailbox A (destination and length words at
+ * offsets 1 and 3) copies the payload from offset 5 on into VRAM, one byte
+ * per pixel clock, then releases the Graphics CPU from reset
  * 
- * Register Map: $400200-$40021F
+ * Register Map: $400200-$40024B, on the Graphics CPU bus. These addresses are
+ * in mailbox A's window, the Graphics CPU reaches the registers there instead
+ * of the mailbox bytes; the Main CPU still sees the mailbox
+ * - $400200 video mode: bits 0-1 render mode, bit 2 480i; $400201 layer
+ *   enable
+ * - $400202-$400209 raster status (read), $40020A IRQ clear (write)
+ * - $40020C IRQ enable: bit 0 VBlank, bit 1 HBlank, both off after reset
+ * - $400210 + layer * 8: scroll X, scroll Y (words), control, priority,
+ *   blend (coverage in sixteenths, 16 and over opaque)
+ * - $400238 mosaic: blocks of bits 0-3 + 1 pixels square, $400239 the layers
+ *   it applies to, as layer enable
+ * - $40023A, $40023B the layers window 0 and 1 hide, $40023C bits 0-1 turn
+ *   window 0 and 1 inside out
+ * - $400240 + window * 4: left and right edge (words), [left, right)
+ * - $400248 brightness, $400249-$40024B RGB tint
  */
 class CPLD2_Video : public SystemBusDevice {
 public:
@@ -31,8 +52,10 @@ public:
     uint8_t readByte(const Address& address) override;
     void storeByte(const Address& address, uint8_t value) override;
     bool decodeAddress(const Address& address, Address& decoded) override;
+    PageMapping mapPage(uint16_t page) override;
+    const char* getDeviceType() const override { return "CPLD2_Video"; }
     uint32_t getBaseAddress() const { return 0x400200; }
-    uint32_t getSize() const { return 0x20; }
+    uint32_t getSize() const { return 0x4C; }
 
     // Mailbox management (CPLD2 watches mailboxes and triggers IRQs)
     void setMailboxA(Mailbox* mailbox) { mailboxA = mailbox; }
@@ -42,17 +65,83 @@ public:
     void onMailboxAWrite();
     void onMailboxBWrite();
     
-    // Timing - called at PIXCLK rate (13.5 MHz)
+    // Boot DMA. A transfer that takes any time is handed to the start
+    // callback with its length in master cycles, for the owner to call
+    // completeDMA() that much later; mailbox A is busy meanwhile. Without
+    // a callback transfers complete at once.
+    static constexpr uint32_t DMA_CYCLES_PER_BYTE = 1;
+    using DMAStartCallback = std::function<void(uint32_t cycles)>;
+    void setDMAStartCallback(DMAStartCallback callback) { dmaStartCallback = callback; }
+    bool isDMAActive() const { return dmaActive; }
+    void completeDMA();
+    // Drops the transfer in flight, its completion was not scheduled again
+    void cancelDMA();
+    
+    // Timing - called at PIXCLK rate (13.5 MHz). Reference model for
+    // conformance tests: with a cycle source the raster position is worked
+    // out from the time instead
     void tick();
     
+    // Master cycles since reset (see Scheduler). Raster registers read
+    // derive the position from it, nothing is counted per pixel
+    using CycleSource = std::function<uint64_t()>;
+    void setCycleSource(CycleSource source) { cycleSource = source; }
+    
+    // Start of a scanline, scheduled: line 0 is the first active line, where
+    // the register write log restarts. HBlank IRQ on every line, VBlank IRQ
+    // after the last active one
+    void onHSync(uint16_t line);
+    
     // Video mode
     enum class VideoMode {
         MODE_240P = 0,
         MODE_480I = 1
     };
     
-    void setVideoMode(VideoMode mode) { videoMode = mode; }
+    void setVideoMode(VideoMode mode);
     VideoMode getVideoMode() const { return videoMode; }
+    // 480i: the field the frame being rendered is, 1 the one on the odd lines.
+    // 0 in 240p
+    uint8_t getFrameField() const { return frameField; }
+    
+    // Renderer configuration, as last written. version changes with any of
+    // it, for the renderer to keep what it decoded until then
+    static constexpr int LAYER_COUNT = 5;
+    struct Registers {
+        uint8_t mode;               // Bits 0-1 the render mode, bit 2 480i
+        uint8_t layerEnable;
+        uint8_t brightness;         // 0-31
+        int8_t tintR, tintG, tintB;
+        struct Layer {
+            uint16_t scrollX, scrollY;
+            uint8_t control;
+            uint8_t priority;
+            uint8_t blend;          // 0-16, opaque after reset
+        } layers[LAYER_COUNT];
+        uint8_t mosaic;             // Bits 0-3 the block size less one
+        uint8_t mosaicEnable;
+        static constexpr int WINDOW_COUNT = 2;
+        uint8_t windowEnable[WINDOW_COUNT];
+        uint8_t windowInvert;
+        uint16_t windowLeft[WINDOW_COUNT], windowRight[WINDOW_COUNT];
+        uint32_t version;
+    };
+    const Registers& getRegisters() const { return registers; }
+    
+    // Writes to the registers above since the frame started (HSync of its
+    // first line), in order. line is the first line, as rendered, a write
+    // shows on, 240 and over for the next frame; x where it was written
+    struct RegisterWrite {
+        uint16_t line;
+        uint16_t x;
+        uint8_t offset;
+        uint8_t value;
+    };
+    const Registers& getFrameRegisters() const { return frameRegisters; }
+    const std::vector<RegisterWrite>& getRegisterWrites() const { return registerWrites; }
+    // Whether the write changed anything, version left as it is
+    static bool applyRegister(Registers& registers, uint8_t offset, uint8_t value);
+    
     uint8_t getRegister(uint8_t reg) {
         uint32_t addr = getBaseAddress() + reg;
         Address address(addr >> 16, addr & 0xFFFF);
@@ -65,21 +154,40 @@ public:
         storeByte(address, value);
     }
 
-    // Raster position
-    uint16_t getRasterLine() const { return rasterLine; }
-    uint16_t getRasterX() const { return rasterX; }
+    // Raster position, line 0 is the first line of VBlank
+    struct RasterPosition {
+        uint16_t line;
+        uint16_t x;
+        bool inVBlank;
+        bool inHBlank;
+    };
+    RasterPosition getRasterPosition() const;
+    uint16_t getRasterLine() const { return getRasterPosition().line; }
+    uint16_t getRasterX() const { return getRasterPosition().x; }
     
     // Blanking status
-    bool isInVBlank() const { return inVBlank; }
-    bool isInHBlank() const { return inHBlank; }
+    bool isInVBlank() const { return getRasterPosition().inVBlank; }
+    bool isInHBlank() const { return getRasterPosition().inHBlank; }
     
     // VRAM arbiter - check if G-CPU can access VRAM
     bool allowGCpuVramAccess() const;
     
-    // IRQ callbacks
+    // VRAM arbitration model. The raster engine fetches VRAM from
+    // VRAM_FETCH_START on (OAM, palettes, tilemaps, tiles) through the active
+    // part of every active line, the G-CPU gets it in the blanking intervals.
+    // Master cycles a G-CPU access made at the given time waits for the next
+    // one, 0 within one. The windows are cycle ranges worked out once, nothing
+    // is looked at per pixel
+    static constexpr uint32_t VRAM_FETCH_START = 0x013000;
+    uint32_t getGCpuVramStall(uint64_t masterCycle) const;
+    
+    // IRQ outputs, called with whether the IRQ is pending and enabled whenever
+    // that may have changed. Pending until IRQ_CLEAR is written
+    using IRQLineCallback = std::function<void(bool asserted)>;
+    void setVBlankCallback(IRQLineCallback callback) { vblankCallback = callback; }
+    void setHBlankCallback(IRQLineCallback callback) { hblankCallback = callback; }
+
     using IRQCallback = std::function<void()>;
-    void setVBlankCallback(IRQCallback callback) { vblankCallback = callback; }
-    void setHBlankCallback(IRQCallback callback) { hblankCallback = callback; }
 
     // Mailbox IRQ callbacks
     void setMailboxACallback(IRQCallback callback) { mailboxACallback = callback; }
@@ -88,6 +196,10 @@ public:
     // Reset
     void reset();
     
+    // Save states, mode and raster position
+    void saveState(StateWriter& writer) const;
+    bool loadState(StateReader& reader);
+    
 private:
 
     RAM* graphicsRAM = nullptr;
@@ -96,6 +208,15 @@ private:
     // Video mode
     VideoMode videoMode;
     
+    Registers registers;
+    void writeRegister(uint8_t offset, uint8_t value);
+    
+    // Frame change log
+    Registers frameRegisters;
+    uint8_t frameField;
+    std::vector<RegisterWrite> registerWrites;
+    void startFrameLog();
+    
     // Raster position
     uint16_t rasterLine;
     uint16_t rasterX;
@@ -107,10 +228,12 @@ private:
     // IRQ state
     bool vblankIRQPending;
     bool hblankIRQPending;
+    uint8_t irqEnable;
     
     // IRQ callbacks
-    IRQCallback vblankCallback;
-    IRQCallback hblankCallback;
+    IRQLineCallback vblankCallback;
+    IRQLineCallback hblankCallback;
+    void updateIRQs();
     
     // Timing constants (240p mode)
     static constexpr uint16_t PIXELS_PER_LINE = 857;
@@ -126,6 +249,18 @@ private:
     
     // Update blanking flags
     void updateBlankingFlags();
+    bool isVBlankLine(uint16_t line) const;
+    
+    CycleSource cycleSource;
+    
+    // Per scheduler line (0 the first active one), the cycles of the frame
+    // the raster engine holds VRAM, [start, end), empty in VBlank
+    struct FetchWindow {
+        uint32_t start;
+        uint32_t end;
+    };
+    std::vector<FetchWindow> fetchWindows;
+    void buildFetchWindows();
     
     // Get total lines for current mode
     uint16_t getTotalLines() const;
@@ -137,6 +272,15 @@ private:
     // Mailbox IRQ callbacks
     IRQCallback mailboxACallback;
     IRQCallback mailboxBCallback;
+
+    // Boot DMA
+    static constexpr uint8_t BOOT_COMMAND = 0x01;
+    static constexpr uint32_t BOOT_PAYLOAD = 5;
+    bool dmaActive;
+    uint16_t dmaDestination;
+    uint16_t dmaLength;
+    std::vector<uint8_t> dmaBuffer;
+    DMAStartCallback dmaStartCallback;
 };
 
 #endif // CPLD2_VIDEO_H
@@ -1,4 +1,5 @@
 #include "cpld3_raster.h"
+#include "../state/save_state.h"
 #include <iostream>
 
 CPLD3_Raster::CPLD3_Raster()
@@ -14,6 +15,7 @@ CPLD3_Raster::CPLD3_Raster()
     , irqEnable(false)
     , irqPending(false)
     , irqCallback(nullptr)
+    , lineEffectsUsed(false)
 {
     reset();
 }
@@ -30,16 +32,73 @@ void CPLD3_Raster::reset() {
     irqScanline = 0;
     irqEnable = false;
     irqPending = false;
+    if (irqCallback) {
+        irqCallback(false);
+    }
     
     // Clear table
     for (auto& entry : scanlineTable) {
         entry.scrollOffset = 0;
         entry.paletteSelect = 0;
     }
+    rebuildLineEffects();
+}
+
+void CPLD3_Raster::saveState(StateWriter& writer) const {
+    writer.writeValue(tableMode);
+    writer.writeValue(scrollOffsetReg);
+    writer.writeValue(paletteSelectReg);
+    writer.writeValue(currentScrollOffset);
+    writer.writeValue(currentPaletteSelect);
+    writer.writeValue(scanlineTable);
+    writer.writeValue(tableIndex);
+    writer.writeValue(tableAddr);
+    writer.writeValue(tableByteOffset);
+    writer.writeValue(irqScanline);
+    writer.writeValue(irqEnable);
+    writer.writeValue(irqPending);
+}
+
+bool CPLD3_Raster::loadState(StateReader& reader) {
+    bool ok = reader.readValue(tableMode) &&
+              reader.readValue(scrollOffsetReg) &&
+              reader.readValue(paletteSelectReg) &&
+              reader.readValue(currentScrollOffset) &&
+              reader.readValue(currentPaletteSelect) &&
+              reader.readValue(scanlineTable) &&
+              reader.readValue(tableIndex) &&
+              reader.readValue(tableAddr) &&
+              reader.readValue(tableByteOffset) &&
+              reader.readValue(irqScanline) &&
+              reader.readValue(irqEnable) &&
+              reader.readValue(irqPending);
+    rebuildLineEffects();
+    if (irqCallback) {
+        irqCallback(irqPending);
+    }
+    return ok;
+}
+
+void CPLD3_Raster::rebuildLineEffects() {
+    // States are taken between frames: the table index is back where the
+    // frame started, 262 lines on
+    lineEffectsUsed = false;
+    for (int line = 0; line < ACTIVE_LINES; line++) {
+        LineEffect& effect = lineEffects[line];
+        if (tableMode) {
+            const TableEntry& entry = scanlineTable[(tableIndex + line) % scanlineTable.size()];
+            effect.scrollOffset = entry.scrollOffset;
+            effect.paletteSelect = entry.paletteSelect;
+        } else {
+            effect.scrollOffset = scrollOffsetReg;
+            effect.paletteSelect = paletteSelectReg;
+        }
+        lineEffectsUsed = lineEffectsUsed || effect.scrollOffset != 0 || effect.paletteSelect != 0;
+    }
 }
 
 uint8_t CPLD3_Raster::readByte(const Address& address) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     uint32_t offset = flatAddr - getBaseAddress();
     
     switch (offset) {
@@ -98,7 +157,7 @@ uint8_t CPLD3_Raster::readByte(const Address& address) {
 
 void CPLD3_Raster::storeByte(const Address& address, uint8_t value) {
 
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     uint32_t offset = flatAddr - getBaseAddress();
     
     switch (offset) {
@@ -130,8 +189,11 @@ void CPLD3_Raster::storeByte(const Address& address, uint8_t value) {
             
         // IRQ_STATUS ($400308) - write 1 to clear
         case 0x08:
-            if (value & 0x01) {
+            if ((value & 0x01) && irqPending) {
                 irqPending = false;
+                if (irqCallback) {
+                    irqCallback(false);
+                }
             }
             break;
             
@@ -181,7 +243,7 @@ void CPLD3_Raster::storeByte(const Address& address, uint8_t value) {
 }
 
 bool CPLD3_Raster::decodeAddress(const Address& address, Address& decoded) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     if (flatAddr >= getBaseAddress() && flatAddr < getBaseAddress() + getSize()) {
         decoded = address;
         return true;
@@ -189,10 +251,22 @@ bool CPLD3_Raster::decodeAddress(const Address& address, Address& decoded) {
     return false;
 }
 
+PageMapping CPLD3_Raster::mapPage(uint16_t page) {
+    return mapPageInRange(page, getBaseAddress(), getBaseAddress() + getSize() - 1);
+}
+
 void CPLD3_Raster::onHSync(uint16_t currentLine) {
     // Update effects for this scanline
     updateEffects();
     
+    if (currentLine < ACTIVE_LINES) {
+        if (currentLine == 0) {
+            lineEffectsUsed = false;
+        }
+        lineEffects[currentLine] = LineEffect{ currentScrollOffset, currentPaletteSelect };
+        lineEffectsUsed = lineEffectsUsed || currentScrollOffset != 0 || currentPaletteSelect != 0;
+    }
+    
     // Check IRQ condition
     checkIRQ(currentLine);
 }
@@ -222,7 +296,7 @@ void CPLD3_Raster::checkIRQ(uint16_t currentLine) {
         if (!irqPending) {
             irqPending = true;
             if (irqCallback) {
-                irqCallback();
+                irqCallback(true);
             }
         }
     }
@@ -6,6 +6,9 @@
 #include <cstdint>
 #include <functional>
 
+class StateWriter;
+class StateReader;
+
 /**
  * CPLD #3: Raster FX Engine
  * 
@@ -18,6 +21,10 @@
  * - Register mode: G-CPU writes value, used for all lines
  * - Table mode: Pre-loaded 262-entry table, auto-advance
  * 
+ * The values latched on the active lines of a frame are kept for the
+ * renderer: the scroll offset moves BG0-FG1 horizontally, the palette
+ * select is added to the palette bank of their 2bpp and 4bpp tiles.
+ * 
  * Register Map: $400300-$40031F
  */
 class CPLD3_Raster : public SystemBusDevice {
@@ -29,6 +36,8 @@ public:
     uint8_t readByte(const Address& address) override;
     void storeByte(const Address& address, uint8_t value) override;
     bool decodeAddress(const Address& address, Address& decoded) override;
+    PageMapping mapPage(uint16_t page) override;
+    const char* getDeviceType() const override { return "CPLD3_Raster"; }
     
     uint32_t getBaseAddress() const { return 0x400300; }
     uint32_t getSize() const { return 0x20; }
@@ -40,13 +49,28 @@ public:
     int16_t getScrollOffset() const { return currentScrollOffset; }
     uint8_t getPaletteSelect() const { return currentPaletteSelect; }
     
-    // IRQ callback
-    using IRQCallback = std::function<void()>;
+    // Values latched on each active line of the frame (line 0 the first),
+    // and whether any of them does anything
+    static constexpr int ACTIVE_LINES = 240;
+    struct LineEffect {
+        int16_t scrollOffset;
+        uint8_t paletteSelect;
+    };
+    const std::array<LineEffect, ACTIVE_LINES>& getLineEffects() const { return lineEffects; }
+    bool hasLineEffects() const { return lineEffectsUsed; }
+    
+    // Split-line IRQ output, called with true when it goes pending and false once
+    // cleared through IRQ_STATUS
+    using IRQCallback = std::function<void(bool asserted)>;
     void setIRQCallback(IRQCallback callback) { irqCallback = callback; }
     
     // Reset
     void reset();
     
+    // Save states, registers and scanline table
+    void saveState(StateWriter& writer) const;
+    bool loadState(StateReader& reader);
+    
 private:
     // Operating mode
     bool tableMode;
@@ -60,11 +84,14 @@ private:
     uint8_t currentPaletteSelect;
     
     // Table mode
+    // Written to save states as it is, the padding is spelled out so that
+    // states of identical machines are identical
     struct TableEntry {
         int16_t scrollOffset;
         uint8_t paletteSelect;
+        uint8_t reserved;
         
-        TableEntry() : scrollOffset(0), paletteSelect(0) {}
+        TableEntry() : scrollOffset(0), paletteSelect(0), reserved(0) {}
     };
     
     std::array<TableEntry, 262> scanlineTable;
@@ -84,6 +111,11 @@ private:
     // Update current values (called on HSYNC)
     void updateEffects();
     
+    std::array<LineEffect, ACTIVE_LINES> lineEffects;
+    bool lineEffectsUsed;
+    // What the lines of a frame latch as things stand, after a reset or load
+    void rebuildLineEffects();
+    
     // Check IRQ condition
     void checkIRQ(uint16_t currentLine);
 };
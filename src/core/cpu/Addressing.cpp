@@ -23,35 +23,35 @@
 
 #define LOG_TAG "Addressing"
 
-bool Cpu65816::opCodeAddressingCrossesPageBoundary(OpCode &opCode) {
+uint8_t Cpu65816::readOperandByte() {
+    if (mOperandDecoded) {
+        return mOperand[0];
+    }
+    return mSystemBus.readByte(mProgramAddress.newWithOffset(1));
+}
+
+uint16_t Cpu65816::readOperandTwoBytes() {
+    if (mOperandDecoded) {
+        return ((uint16_t)mOperand[1] << 8) | mOperand[0];
+    }
+    return mSystemBus.readTwoBytes(mProgramAddress.newWithOffset(1));
+}
+
+Address Cpu65816::readOperandAddress() {
+    if (mOperandDecoded) {
+        return Address(mOperand[2], ((uint16_t)mOperand[1] << 8) | mOperand[0]);
+    }
+    return mSystemBus.readAddressAt(mProgramAddress.newWithOffset(1));
+}
+
+bool Cpu65816::opCodeAddressingCrossesPageBoundary(const OpCode &opCode) {
     switch(opCode.getAddressingMode()) {
         case AddressingMode::AbsoluteIndexedWithX:
-        {
-            Address initialAddress(mDB, mSystemBus.readTwoBytes(mProgramAddress.newWithOffset(1)));
-            // TODO: figure out when to wrap around and when not to, it should not matter in this case
-            // but it matters when fetching data
-            Address finalAddress = Address::sumOffsetToAddress(initialAddress, indexWithXRegister());
-            return Address::offsetsAreOnDifferentPages(initialAddress.getOffset(), finalAddress.getOffset());
-        }
         case AddressingMode::AbsoluteIndexedWithY:
-        {
-            Address initialAddress(mDB, mSystemBus.readTwoBytes(mProgramAddress.newWithOffset(1)));
-            // TODO: figure out when to wrap around and when not to, it should not matter in this case
-            // but it matters when fetching data
-            Address finalAddress = Address::sumOffsetToAddress(initialAddress, indexWithYRegister());
-            return Address::offsetsAreOnDifferentPages(initialAddress.getOffset(), finalAddress.getOffset());
-        }
         case AddressingMode::DirectPageIndirectIndexedWithY:
-        {
-            uint16_t firstStageOffset = mD + mSystemBus.readByte(mProgramAddress.newWithOffset(1));
-            Address firstStageAddress(0x00, firstStageOffset);
-            uint16_t secondStageOffset = mSystemBus.readTwoBytes(firstStageAddress);
-            Address thirdStageAddress(mDB, secondStageOffset);
-            // TODO: figure out when to wrap around and when not to, it should not matter in this case
-            // but it matters when fetching data
-            Address finalAddress = Address::sumOffsetToAddress(thirdStageAddress, indexWithYRegister());
-            return Address::offsetsAreOnDifferentPages(thirdStageAddress.getOffset(), finalAddress.getOffset());
-        }
+            // Found out along with the address, without reading the operands again
+            getAddressOfOpCodeData(opCode);
+            return mDataAddressCrossesPage;
         default:
         {
             Log::err(LOG_TAG).str("!!! Unsupported opCodeAddressingCrossesPageBoundary for opCode: ").hex(opCode.getCode(), 2).show();
@@ -62,9 +62,16 @@ bool Cpu65816::opCodeAddressingCrossesPageBoundary(OpCode &opCode) {
     return false;
 }
 
-Address Cpu65816::getAddressOfOpCodeData(OpCode &opCode) {
-    uint8_t dataAddressBank;
-    uint16_t dataAddressOffset;
+Address Cpu65816::getAddressOfOpCodeData(const OpCode &opCode) {
+    if (mDataAddressValid) {
+        return mDataAddress;
+    }
+
+    uint8_t dataAddressBank = 0;
+    uint16_t dataAddressOffset = 0;
+    // Offset indexing started from, for the modes adding a cycle when it crosses a page
+    uint16_t indexedOffset = 0;
+    bool indexed = false;
 
     switch(opCode.getAddressingMode()) {
         case AddressingMode::Interrupt:
@@ -88,27 +95,27 @@ Address Cpu65816::getAddressOfOpCodeData(OpCode &opCode) {
             break;
         case AddressingMode::Absolute:
             dataAddressBank = mDB;
-            dataAddressOffset = mSystemBus.readTwoBytes(mProgramAddress.newWithOffset(1));
+            dataAddressOffset = readOperandTwoBytes();
             break;
         case AddressingMode::AbsoluteLong:
-            mSystemBus.readAddressAt(mProgramAddress.newWithOffset(1)).getBankAndOffset(&dataAddressBank, &dataAddressOffset);
+            readOperandAddress().getBankAndOffset(&dataAddressBank, &dataAddressOffset);
             break;
         case AddressingMode::AbsoluteIndirect:
         {
             dataAddressBank = mProgramAddress.getBank();
-            Address addressOfOffset(0x00, mSystemBus.readTwoBytes(mProgramAddress.newWithOffset(1)));
+            Address addressOfOffset(0x00, readOperandTwoBytes());
             dataAddressOffset = mSystemBus.readTwoBytes(addressOfOffset);
         }
             break;
         case AddressingMode::AbsoluteIndirectLong:
         {
-            Address addressOfEffectiveAddress(0x00, mSystemBus.readTwoBytes(mProgramAddress.newWithOffset(1)));
+            Address addressOfEffectiveAddress(0x00, readOperandTwoBytes());
             mSystemBus.readAddressAt(addressOfEffectiveAddress).getBankAndOffset(&dataAddressBank, &dataAddressOffset);
         }
             break;
         case AddressingMode::AbsoluteIndexedIndirectWithX:
         {
-            Address firstStageAddress(mProgramAddress.getBank(), mSystemBus.readTwoBytes(mProgramAddress.newWithOffset(1)));
+            Address firstStageAddress(mProgramAddress.getBank(), readOperandTwoBytes());
             Address secondStageAddress = firstStageAddress.newWithOffsetNoWrapAround(indexWithXRegister());
             dataAddressBank = mProgramAddress.getBank();
             dataAddressOffset = mSystemBus.readTwoBytes(secondStageAddress);
@@ -116,23 +123,27 @@ Address Cpu65816::getAddressOfOpCodeData(OpCode &opCode) {
             break;
         case AddressingMode::AbsoluteIndexedWithX:
         {
-            Address firstStageAddress(mDB, mSystemBus.readTwoBytes(mProgramAddress.newWithOffset(1)));
+            Address firstStageAddress(mDB, readOperandTwoBytes());
             Address::sumOffsetToAddressNoWrapAround(firstStageAddress, indexWithXRegister())
                 .getBankAndOffset(&dataAddressBank, &dataAddressOffset);;
+            indexedOffset = firstStageAddress.getOffset();
+            indexed = true;
         }
             break;
         case AddressingMode::AbsoluteLongIndexedWithX:
         {
-            Address firstStageAddress = mSystemBus.readAddressAt(mProgramAddress.newWithOffset(1));
+            Address firstStageAddress = readOperandAddress();
             Address::sumOffsetToAddressNoWrapAround(firstStageAddress, indexWithXRegister())
                 .getBankAndOffset(&dataAddressBank, &dataAddressOffset);;
         }
             break;
         case AddressingMode::AbsoluteIndexedWithY:
         {
-            Address firstStageAddress(mDB, mSystemBus.readTwoBytes(mProgramAddress.newWithOffset(1)));
+            Address firstStageAddress(mDB, readOperandTwoBytes());
             Address::sumOffsetToAddressNoWrapAround(firstStageAddress, indexWithYRegister())
                 .getBankAndOffset(&dataAddressBank, &dataAddressOffset);;
+            indexedOffset = firstStageAddress.getOffset();
+            indexed = true;
         }
             break;
         case AddressingMode::DirectPage:
@@ -141,58 +152,60 @@ Address Cpu65816::getAddressOfOpCodeData(OpCode &opCode) {
             dataAddressBank = 0x00;
             if (mCpuStatus.emulationFlag()) {
                 // 6502 uses zero page
-                dataAddressOffset = mSystemBus.readByte(mProgramAddress.newWithOffset(1));
+                dataAddressOffset = readOperandByte();
             } else {
                 // 65816 uses direct page
-                dataAddressOffset = mD + mSystemBus.readByte(mProgramAddress.newWithOffset(1));
+                dataAddressOffset = mD + readOperandByte();
             }
         }
             break;
         case AddressingMode::DirectPageIndexedWithX:
         {
             dataAddressBank = 0x00;
-            dataAddressOffset = mD + indexWithXRegister() + mSystemBus.readByte(mProgramAddress.newWithOffset(1));
+            dataAddressOffset = mD + indexWithXRegister() + readOperandByte();
         }
             break;
         case AddressingMode::DirectPageIndexedWithY:
         {
             dataAddressBank = 0x00;
-            dataAddressOffset = mD + indexWithYRegister() + mSystemBus.readByte(mProgramAddress.newWithOffset(1));
+            dataAddressOffset = mD + indexWithYRegister() + readOperandByte();
         }
             break;
         case AddressingMode::DirectPageIndirect:
         {
-            Address firstStageAddress(0x00, mD + mSystemBus.readByte(mProgramAddress.newWithOffset(1)));
+            Address firstStageAddress(0x00, mD + readOperandByte());
             dataAddressBank = mDB;
             dataAddressOffset = mSystemBus.readTwoBytes(firstStageAddress);
         }
             break;
         case AddressingMode::DirectPageIndirectLong:
         {
-            Address firstStageAddress(0x00, mD + mSystemBus.readByte(mProgramAddress.newWithOffset(1)));
+            Address firstStageAddress(0x00, mD + readOperandByte());
             mSystemBus.readAddressAt(firstStageAddress)
                 .getBankAndOffset(&dataAddressBank, &dataAddressOffset);;
         }
             break;
         case AddressingMode::DirectPageIndexedIndirectWithX:
         {
-            Address firstStageAddress(0x00, mD + mSystemBus.readByte(mProgramAddress.newWithOffset(1)) + indexWithXRegister());
+            Address firstStageAddress(0x00, mD + readOperandByte() + indexWithXRegister());
             dataAddressBank = mDB;
             dataAddressOffset = mSystemBus.readTwoBytes(firstStageAddress);
         }
             break;
         case AddressingMode::DirectPageIndirectIndexedWithY:
         {
-            Address firstStageAddress(0x00, mD + mSystemBus.readByte(mProgramAddress.newWithOffset(1)));
+            Address firstStageAddress(0x00, mD + readOperandByte());
             uint16_t secondStageOffset = mSystemBus.readTwoBytes(firstStageAddress);
             Address thirdStageAddress(mDB, secondStageOffset);
             Address::sumOffsetToAddressNoWrapAround(thirdStageAddress, indexWithYRegister())
                 .getBankAndOffset(&dataAddressBank, &dataAddressOffset);
+            indexedOffset = secondStageOffset;
+            indexed = true;
         }
             break;
         case AddressingMode::DirectPageIndirectLongIndexedWithY:
         {
-            Address firstStageAddress(0x00, mD + mSystemBus.readByte(mProgramAddress.newWithOffset(1)));
+            Address firstStageAddress(0x00, mD + readOperandByte());
             Address secondStageAddress = mSystemBus.readAddressAt(firstStageAddress);
             Address::sumOffsetToAddressNoWrapAround(secondStageAddress, indexWithYRegister())
                 .getBankAndOffset(&dataAddressBank, &dataAddressOffset);
@@ -201,18 +214,18 @@ Address Cpu65816::getAddressOfOpCodeData(OpCode &opCode) {
         case AddressingMode::StackRelative:
         {
             dataAddressBank = 0x00;
-            dataAddressOffset = mStack.getStackPointer() + mSystemBus.readByte(mProgramAddress.newWithOffset(1));
+            dataAddressOffset = mStack.getStackPointer() + readOperandByte();
         }
             break;
         case AddressingMode::StackDirectPageIndirect:
         {
             dataAddressBank = 0x00;
-            dataAddressOffset = mD + mSystemBus.readByte(mProgramAddress.newWithOffset(1));
+            dataAddressOffset = mD + readOperandByte();
         }
             break;
         case AddressingMode::StackRelativeIndirectIndexedWithY:
         {
-            Address firstStageAddress(0x00, mStack.getStackPointer() + mSystemBus.readByte(mProgramAddress.newWithOffset(1)));
+            Address firstStageAddress(0x00, mStack.getStackPointer() + readOperandByte());
             uint16_t secondStageOffset = mSystemBus.readTwoBytes(firstStageAddress);
             Address thirdStageAddress(mDB, secondStageOffset);
             Address::sumOffsetToAddressNoWrapAround(thirdStageAddress, indexWithYRegister())
@@ -221,5 +234,8 @@ Address Cpu65816::getAddressOfOpCodeData(OpCode &opCode) {
             break;
     }
 
-    return Address(dataAddressBank, dataAddressOffset);
+    mDataAddress = Address(dataAddressBank, dataAddressOffset);
+    mDataAddressCrossesPage = indexed && Address::offsetsAreOnDifferentPages(indexedOffset, dataAddressOffset);
+    mDataAddressValid = true;
+    return mDataAddress;
 }
@@ -106,7 +106,8 @@ uint16_t convert16BitToBcd(uint16_t val)
   	return result;
 }
 
-bool bcdSum8Bit(uint8_t bcdFirst, uint8_t bcdSecond, uint8_t *result, bool carry) {
+// Digit by digit, used to fill the tables below
+static bool digitSum8Bit(uint8_t bcdFirst, uint8_t bcdSecond, uint8_t *result, bool carry) {
 	uint8_t shift = 0;
 	*result = 0;
 
@@ -127,7 +128,7 @@ bool bcdSum8Bit(uint8_t bcdFirst, uint8_t bcdSecond, uint8_t *result, bool carry
 	return carry;
 }
 
-bool bcdSubtract8Bit(uint8_t bcdFirst, uint8_t bcdSecond, uint8_t *result, bool borrow) {
+static bool digitSubtract8Bit(uint8_t bcdFirst, uint8_t bcdSecond, uint8_t *result, bool borrow) {
 	uint8_t shift = 0;
 	*result = 0;
 
@@ -148,36 +149,58 @@ bool bcdSubtract8Bit(uint8_t bcdFirst, uint8_t bcdSecond, uint8_t *result, bool
 	return borrow;
 }
 
+// Every 8 bit sum and difference, indexed by (carry << 16) | (first << 8) | second. Each entry
+// is the result with the carry (borrow) out in bit 8. Invalid BCD digits give what the digit
+// by digit routines give.
+struct BcdTables {
+    uint16_t sum[2 * 0x10000];
+    uint16_t difference[2 * 0x10000];
+
+    BcdTables() {
+        for (uint32_t index = 0; index < 2 * 0x10000; index++) {
+            const auto first = static_cast<uint8_t>(index >> 8);
+            const auto second = static_cast<uint8_t>(index);
+            const bool carry = index >> 16;
+            uint8_t result;
+            bool carryOut = digitSum8Bit(first, second, &result, carry);
+            sum[index] = static_cast<uint16_t>(result | (carryOut ? 0x100 : 0));
+            carryOut = digitSubtract8Bit(first, second, &result, carry);
+            difference[index] = static_cast<uint16_t>(result | (carryOut ? 0x100 : 0));
+        }
+    }
+};
+
+static const BcdTables bcdTables;
+
+static inline uint32_t bcdIndex(uint8_t first, uint8_t second, bool carry) {
+    return (carry ? 0x10000 : 0) | ((uint32_t)first << 8) | second;
+}
+
+bool bcdSum8Bit(uint8_t bcdFirst, uint8_t bcdSecond, uint8_t *result, bool carry) {
+    const uint16_t entry = bcdTables.sum[bcdIndex(bcdFirst, bcdSecond, carry)];
+    *result = static_cast<uint8_t>(entry);
+    return entry & 0x100;
+}
+
+bool bcdSubtract8Bit(uint8_t bcdFirst, uint8_t bcdSecond, uint8_t *result, bool borrow) {
+    const uint16_t entry = bcdTables.difference[bcdIndex(bcdFirst, bcdSecond, borrow)];
+    *result = static_cast<uint8_t>(entry);
+    return entry & 0x100;
+}
+
+// Low bytes first, the carry of the first lookup going into the second
 bool bcdSum16Bit(uint16_t bcdFirst, uint16_t bcdSecond, uint16_t *result, bool carry) {
-	*result = 0;
-	uint8_t shift = 0;
-	while (shift < 16) {
-        auto digitOfFirst = static_cast<uint8_t>(bcdFirst & 0xFF);
-        auto digitOfSecond = static_cast<uint8_t>(bcdSecond & 0xFF);
-		uint8_t partialresult = 0;
-		carry = bcdSum8Bit(digitOfFirst, digitOfSecond, &partialresult, carry);
-		*result |= partialresult << shift;
-		shift += 8;
-		bcdFirst >>= shift;
-		bcdSecond >>= shift;
-	}
-	return carry;
+    const uint16_t low = bcdTables.sum[bcdIndex(lower8BitsOf(bcdFirst), lower8BitsOf(bcdSecond), carry)];
+    const uint16_t high = bcdTables.sum[bcdIndex(higher8BitsOf(bcdFirst), higher8BitsOf(bcdSecond), low & 0x100)];
+    *result = static_cast<uint16_t>((high << 8) | (low & 0xFF));
+    return high & 0x100;
 }
 
 bool bcdSubtract16Bit(uint16_t bcdFirst, uint16_t bcdSecond, uint16_t *result, bool borrow) {
-	*result = 0;
-	uint8_t shift = 0;
-	while (shift < 16) {
-        auto digitOfFirst = static_cast<uint8_t>(bcdFirst & 0xFF);
-        auto digitOfSecond = static_cast<uint8_t>(bcdSecond & 0xFF);
-		uint8_t partialresult = 0;
-		borrow = bcdSubtract8Bit(digitOfFirst, digitOfSecond, &partialresult, borrow);
-		*result |= partialresult << shift;
-		shift += 8;
-		bcdFirst >>= shift;
-		bcdSecond >>= shift;
-	}
-	return borrow;
+    const uint16_t low = bcdTables.difference[bcdIndex(lower8BitsOf(bcdFirst), lower8BitsOf(bcdSecond), borrow)];
+    const uint16_t high = bcdTables.difference[bcdIndex(higher8BitsOf(bcdFirst), higher8BitsOf(bcdSecond), low & 0x100)];
+    *result = static_cast<uint16_t>((high << 8) | (low & 0xFF));
+    return high & 0x100;
 }
 
 }
@@ -26,4 +26,16 @@
  * This define enables some minor differences in cycles counting
  * for some opcodes.
  * */
-//#define EMU_65C02
\ No newline at end of file
+//#define EMU_65C02
+/**
+ * The following define makes the Cpu65816 dispatch opcodes through the
+ * OP_CODE_TABLE pointers to member functions instead of the switch in
+ * OpCodeDispatch.cpp. Both are generated from OpCodeList.hpp.
+ * */
+//#define CPU_TABLE_DISPATCH
+
+/**
+ * The following define disables the DecodedBlockCache, every instruction
+ * is then fetched from the SystemBus when it is executed.
+ * */
+//#define CPU_DISABLE_BLOCK_CACHE
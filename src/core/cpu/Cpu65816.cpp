@@ -18,8 +18,14 @@
  */
 
 #include "Cpu65816.hpp"
+#include "Cpu65816Profiler.hpp"
+#include "Cpu65816Trace.hpp"
+#include "Cpu65816Stats.hpp"
+#include "Cpu65816Debugger.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 
 #ifdef EMU_65C02
 #define LOG_TAG "Cpu65C02"
@@ -31,7 +37,11 @@ Cpu65816::Cpu65816(SystemBus &systemBus, EmulationModeInterrupts *emulationInter
             mSystemBus(systemBus),
             mEmulationInterrupts(emulationInterrupts),
             mNativeInterrupts(nativeInterrupts),
-            mStack(&mSystemBus) {
+            mStack(&mSystemBus)
+#ifndef CPU_DISABLE_BLOCK_CACHE
+            , mBlockCache(systemBus)
+#endif
+            {
 }
 
 
@@ -83,6 +93,53 @@ void Cpu65816::reset() {
     mProgramAddress = Address(0x00, mEmulationInterrupts->reset);
 }
 
+Cpu65816::State Cpu65816::saveState() {
+    State state;
+    std::memset(&state, 0, sizeof(state));
+    state.totalCycles = mTotalCyclesCounter;
+    state.a = mA;
+    state.x = mX;
+    state.y = mY;
+    state.d = mD;
+    state.stackPointer = mStack.getStackPointer();
+    state.programCounter = mProgramAddress.getOffset();
+    state.flags = mCpuStatus.getAllFlags();
+    state.programBank = mProgramAddress.getBank();
+    state.db = mDB;
+    state.pinRES = mPins.RES;
+    state.pinRDY = mPins.RDY;
+    const uint8_t requests = mInterrupts.getRequests();
+    state.pinNMI = (requests & InterruptController::NMI) != 0;
+    state.pinIRQ = (mInterrupts.getPendingSources() & (1u << InterruptController::PIN_SOURCE)) != 0;
+    state.pinABORT = (requests & InterruptController::ABORT) != 0;
+    state.irqSources = mInterrupts.getPendingSources();
+    return state;
+}
+
+void Cpu65816::loadState(const State &state) {
+    mTotalCyclesCounter = state.totalCycles;
+    mA = state.a;
+    mX = state.x;
+    mY = state.y;
+    mD = state.d;
+    mStack = Stack(&mSystemBus, state.stackPointer);
+    mProgramAddress = Address(state.programBank, state.programCounter);
+    mCpuStatus.setAllFlags(state.flags);
+    mDB = state.db;
+    mPins.RES = state.pinRES;
+    mPins.RDY = state.pinRDY;
+    mInterrupts.restore(state.irqSources, state.pinNMI, state.pinABORT);
+    // Taken at another time
+    mIdleLoop.address = 0xFFFFFFFF;
+
+#ifndef CPU_DISABLE_BLOCK_CACHE
+    mBlock = nullptr;
+    mBlockPosition = 0;
+#endif
+    mOperandDecoded = false;
+    mDataAddressValid = false;
+}
+
 void Cpu65816::setRESPin(bool value) {
     if (value == false && mPins.RES == true) {
         reset();
@@ -98,59 +155,309 @@ bool Cpu65816::executeNextInstruction() {
     if (mPins.RES) {
         return false;
     }
-    if ((mPins.IRQ) && (!mCpuStatus.interruptDisableFlag())) {
-        /*
-        The program bank register (PB, the A16-A23 part of the address bus) is pushed onto the hardware stack (65C816/65C802 only when operating in native mode).
-        The most significant byte (MSB) of the program counter (PC) is pushed onto the stack.
-        The least significant byte (LSB) of the program counter is pushed onto the stack.
-        The status register (SR) is pushed onto the stack.
-        The interrupt disable flag is set in the status register.
-        PB is loaded with $00 (65C816/65C802 only when operating in native mode).
-        PC is loaded from the relevant vector (see tables).
-        */
-        if (!mCpuStatus.emulationFlag())  {
-            mStack.push8Bit(mProgramAddress.getBank());
-            mStack.push16Bit(mProgramAddress.getOffset());
-            mStack.push8Bit(mCpuStatus.getRegisterValue());
-            mCpuStatus.setInterruptDisableFlag();
-            mProgramAddress = Address(0x00,mSystemBus.readTwoBytes(Address(0x00,0xFFEE)));
-        } else {
-            mStack.push16Bit(mProgramAddress.getOffset());
-            mStack.push8Bit(mCpuStatus.getRegisterValue());
-            mCpuStatus.setInterruptDisableFlag();
-            mProgramAddress = Address(0x00,mSystemBus.readTwoBytes(Address(0x00,0xFFFE)));
+    const uint8_t requests = mInterrupts.getRequests();
+    if (!mPins.RDY) {
+        // Waiting since WAI, an interrupt wakes the CPU up even if it is masked
+        if ((requests & (InterruptController::IRQ | InterruptController::NMI)) == 0) {
+            return false;
+        }
+        mPins.RDY = true;
+    }
+    if (mDebugger != nullptr && mDebugger->checkBreak()) {
+        return false;
+    }
+    if (requests != 0 && takeInterrupt(requests)) {
+        notifyCall();
+        // Breakpoints at the handler
+        if (mDebugger != nullptr && mDebugger->checkBreak()) {
+            return false;
         }
     }
 
     // Fetch the instruction
-    const uint8_t instruction = mSystemBus.readByte(mProgramAddress);
-    OpCode opCode = OP_CODE_TABLE[instruction];
+#ifndef CPU_DISABLE_BLOCK_CACHE
+    const DecodedBlockCache::Instruction *decoded = nextDecodedInstruction();
+    mOperandDecoded = decoded != nullptr;
+    if (mOperandDecoded) {
+        // Copied, executing the instruction may discard its block
+        mOperand[0] = decoded->operand[0];
+        mOperand[1] = decoded->operand[1];
+        mOperand[2] = decoded->operand[2];
+    }
+    const uint8_t instruction = mOperandDecoded ? decoded->code : fetchInstruction();
+#else
+    const uint8_t instruction = fetchInstruction();
+#endif
+    mDataAddressValid = false;
+    if (mTrace != nullptr) {
+        mTrace->record(instruction);
+    }
     // Execute it
-    return opCode.execute(*this);
+    if (mStats != nullptr) {
+        return executeCounted(instruction);
+    }
+#ifdef CPU_TABLE_DISPATCH
+    return OP_CODE_TABLE[instruction].execute(*this);
+#else
+    return dispatchOpCode(instruction);
+#endif
+}
+
+bool Cpu65816::executeCounted(uint8_t instruction) {
+    // Idle loop iterations counted over are not the branch's
+    const uint64_t cycles = mTotalCyclesCounter - mSkippedIdleCycles;
+#ifdef CPU_TABLE_DISPATCH
+    const bool executed = OP_CODE_TABLE[instruction].execute(*this);
+#else
+    const bool executed = dispatchOpCode(instruction);
+#endif
+    mStats->record(instruction, mTotalCyclesCounter - mSkippedIdleCycles - cycles);
+    return executed;
+}
+
+uint64_t Cpu65816::run(uint64_t cycleBudget) {
+    const uint64_t startCycles = mTotalCyclesCounter;
+    const uint64_t targetCycles = startCycles + cycleBudget;
+    while (mTotalCyclesCounter < targetCycles) {
+        // Runs in one go up to the next sample, if any is due within the budget
+        const uint64_t stopCycles = std::min(targetCycles, mNextSampleCycle);
+        mRunStopCycles = stopCycles;
+        while (mTotalCyclesCounter < stopCycles) {
+#ifndef CPU_DISABLE_BLOCK_CACHE
+            if (mBlockExecution && mDebugger == nullptr && mTrace == nullptr) {
+                const int executed = runBlock(stopCycles);
+                if (executed < 0) {
+                    mRunStopCycles = 0;
+                    return mTotalCyclesCounter - startCycles;
+                }
+                if (executed > 0) {
+                    continue;
+                }
+            }
+#endif
+            if (!executeNextInstruction()) {
+                mRunStopCycles = 0;
+                return mTotalCyclesCounter - startCycles;
+            }
+        }
+        if (mTotalCyclesCounter >= mNextSampleCycle) {
+            mProfiler->takeSample();
+        }
+    }
+    mRunStopCycles = 0;
+    return mTotalCyclesCounter - startCycles;
+}
+
+void Cpu65816::checkIdleLoop() {
+    const uint32_t address = mProgramAddress.getFlat();
+    const uint64_t stores = mSystemBus.getStoreCount();
+    const uint64_t deviceReads = mSystemBus.getDeviceReadCount();
+    const uint16_t flags = mCpuStatus.getAllFlags();
+    const uint16_t stackPointer = mStack.getStackPointer();
+
+    if (address == mIdleLoop.address && stores == mIdleLoop.stores && mA == mIdleLoop.a && mX == mIdleLoop.x &&
+            mY == mIdleLoop.y && mD == mIdleLoop.d && stackPointer == mIdleLoop.stackPointer &&
+            flags == mIdleLoop.flags && mDB == mIdleLoop.db && mDebugger == nullptr &&
+            (deviceReads == mIdleLoop.deviceReads || !mSystemBus.isDeferringUpdates())) {
+        // Nothing the loop reads changed since the last iteration, all of them up to the end of
+        // the run go the same way. Lands on the last time this branch would be taken before the
+        // end, from where it is executed.
+        const uint64_t period = mTotalCyclesCounter - mIdleLoop.cycles;
+        if (period > 0 && mRunStopCycles > mTotalCyclesCounter) {
+            const uint64_t skipped = (mRunStopCycles - 1 - mTotalCyclesCounter) / period * period;
+            mTotalCyclesCounter += skipped;
+            mSkippedIdleCycles += skipped;
+        }
+    }
+
+    mIdleLoop.address = address;
+    mIdleLoop.cycles = mTotalCyclesCounter;
+    mIdleLoop.stores = stores;
+    mIdleLoop.deviceReads = deviceReads;
+    mIdleLoop.a = mA;
+    mIdleLoop.x = mX;
+    mIdleLoop.y = mY;
+    mIdleLoop.d = mD;
+    mIdleLoop.stackPointer = stackPointer;
+    mIdleLoop.flags = flags;
+    mIdleLoop.db = mDB;
 }
 
-bool Cpu65816::accumulatorIs8BitWide() {
-    // Accumulator is always 8 bit in emulation mode.
-    if (mCpuStatus.emulationFlag()) return true;
-    // Accumulator width set to one means 8 bit accumulator.
-    else return mCpuStatus.accumulatorWidthFlag();
+void Cpu65816::profileCall() {
+    mProfiler->onCall();
 }
 
-bool Cpu65816::accumulatorIs16BitWide() {
-    return !accumulatorIs8BitWide();
+void Cpu65816::profileReturn() {
+    mProfiler->onReturn();
 }
 
-bool Cpu65816::indexIs8BitWide() {
-    // Index is always 8 bit in emulation mode.
-    if (mCpuStatus.emulationFlag()) return true;
-    // Index width set to one means 8 bit accumulator.
-    else return mCpuStatus.indexWidthFlag();
+uint64_t Cpu65816::getTotalCycles() {
+    return mTotalCyclesCounter;
 }
 
-bool Cpu65816::indexIs16BitWide() {
-    return !indexIs8BitWide();
+bool Cpu65816::takeInterrupt(uint8_t requests) {
+    uint16_t vector;
+    if (requests & InterruptController::ABORT) {
+        mInterrupts.onABORTTaken();
+        vector = 0xFFE8;
+    } else if (requests & InterruptController::NMI) {
+        mInterrupts.onNMITaken();
+        vector = 0xFFEA;
+    } else if (!mCpuStatus.interruptDisableFlag()) {
+        mInterrupts.onIRQTaken();
+        vector = 0xFFEE;
+    } else {
+        return false;
+    }
+
+    /*
+    The program bank register (PB, the A16-A23 part of the address bus) is pushed onto the hardware stack (65C816/65C802 only when operating in native mode).
+    The most significant byte (MSB) of the program counter (PC) is pushed onto the stack.
+    The least significant byte (LSB) of the program counter is pushed onto the stack.
+    The status register (SR) is pushed onto the stack.
+    The interrupt disable flag is set in the status register.
+    PB is loaded with $00 (65C816/65C802 only when operating in native mode).
+    PC is loaded from the relevant vector (see tables).
+    */
+    if (!mCpuStatus.emulationFlag())  {
+        mStack.push8Bit(mProgramAddress.getBank());
+        mStack.push16Bit(mProgramAddress.getOffset());
+        mStack.push8Bit(mCpuStatus.getRegisterValue());
+        addToCycles(8);
+    } else {
+        mStack.push16Bit(mProgramAddress.getOffset());
+        mStack.push8Bit(mCpuStatus.getRegisterValue());
+        // Emulation mode vectors are 16 bytes up
+        vector += 0x10;
+        addToCycles(7);
+    }
+    mCpuStatus.setInterruptDisableFlag();
+    mCpuStatus.clearDecimalFlag();
+    mProgramAddress = Address(0x00, readVector(vector));
+    return true;
+}
+
+uint16_t Cpu65816::readVector(uint16_t address) {
+#ifndef CPU_DISABLE_BLOCK_CACHE
+    uint16_t vector;
+    if (mBlockCache.lookupVector(address, vector)) {
+        return vector;
+    }
+#endif
+    return mSystemBus.readTwoBytes(Address(0x00, address));
+}
+
+uint8_t Cpu65816::fetchInstruction() {
+    uint8_t bytes[4];
+    mOperandDecoded = mSystemBus.readInstruction(mProgramAddress, bytes);
+    if (!mOperandDecoded) {
+        // Operands are read from the device as the instruction asks for them
+        return mSystemBus.readByte(mProgramAddress);
+    }
+    mOperand[0] = bytes[1];
+    mOperand[1] = bytes[2];
+    mOperand[2] = bytes[3];
+    return bytes[0];
+}
+
+#ifndef CPU_DISABLE_BLOCK_CACHE
+const DecodedBlockCache::Instruction *Cpu65816::nextDecodedInstruction() {
+    const bool accumulatorIs8Bit = mCpuStatus.accumulatorIs8BitWide();
+    const bool indexIs8Bit = mCpuStatus.indexIs8BitWide();
+    const bool emulation = mCpuStatus.emulationFlag();
+
+    // Still running through the current block?
+    if (mBlock != nullptr && mBlockGeneration == mBlockCache.getGeneration() &&
+            mBlockPosition < mBlock->instructions.size() &&
+            mBlock->instructions[mBlockPosition].address == mProgramAddress.getFlat() &&
+            mBlock->accumulatorIs8BitWide == accumulatorIs8Bit && mBlock->indexIs8BitWide == indexIs8Bit &&
+            mBlock->emulation == emulation) {
+        return &mBlock->instructions[mBlockPosition++];
+    }
+
+    mBlock = mBlockCache.lookup(mProgramAddress, accumulatorIs8Bit, indexIs8Bit, emulation);
+    mBlockGeneration = mBlockCache.getGeneration();
+    if (mBlock == nullptr) {
+        return nullptr;
+    }
+    mBlockPosition = 1;
+    return &mBlock->instructions[0];
 }
 
+int Cpu65816::runBlock(uint64_t stopCycles) {
+    // Whatever has to happen before the next instruction goes through executeNextInstruction()
+    if (mPins.RES || !mPins.RDY || interruptDue(mInterrupts.getRequests())) {
+        return 0;
+    }
+    const bool accumulatorIs8Bit = mCpuStatus.accumulatorIs8BitWide();
+    const bool indexIs8Bit = mCpuStatus.indexIs8BitWide();
+    const bool emulation = mCpuStatus.emulationFlag();
+    uint32_t generation = mBlockCache.getGeneration();
+
+    // Chained to the block just left, if it went on with the same one last time
+    const DecodedBlockCache::Block *previous = nullptr;
+    const DecodedBlockCache::Block *block = nullptr;
+    if (mBlock != nullptr && mBlockGeneration == generation && mBlockPosition == mBlock->instructions.size()) {
+        previous = mBlock;
+        const DecodedBlockCache::Block *successor = previous->successor;
+        if (successor != nullptr && previous->successorGeneration == generation &&
+                successor->instructions[0].address == mProgramAddress.getFlat() &&
+                successor->accumulatorIs8BitWide == accumulatorIs8Bit && successor->indexIs8BitWide == indexIs8Bit &&
+                successor->emulation == emulation) {
+            block = successor;
+        }
+    }
+    if (block == nullptr) {
+        block = mBlockCache.lookup(mProgramAddress, accumulatorIs8Bit, indexIs8Bit, emulation);
+        if (block == nullptr) {
+            return 0;
+        }
+        // Decoding may have discarded blocks
+        if (previous != nullptr && mBlockCache.getGeneration() == generation) {
+            previous->successor = block;
+            previous->successorGeneration = generation;
+        }
+        generation = mBlockCache.getGeneration();
+    }
+
+    // Only the last instruction of a block can branch or change the widths, the others follow
+    // each other with the widths the block was decoded for
+    const DecodedBlockCache::Instruction *decoded = block->instructions.data();
+    const int count = static_cast<int>(block->instructions.size());
+    int executed = 0;
+    mOperandDecoded = true;
+    while (executed < count) {
+        // Copied, executing the instruction may discard its block
+        const uint8_t instruction = decoded->code;
+        mOperand[0] = decoded->operand[0];
+        mOperand[1] = decoded->operand[1];
+        mOperand[2] = decoded->operand[2];
+        ++decoded;
+        mDataAddressValid = false;
+#ifdef CPU_TABLE_DISPATCH
+        const bool executedOne = mStats != nullptr ? executeCounted(instruction) : OP_CODE_TABLE[instruction].execute(*this);
+#else
+        const bool executedOne = mStats != nullptr ? executeCounted(instruction) : dispatchOpCode(instruction);
+#endif
+        if (!executedOne) {
+            mBlock = nullptr;
+            return -1;
+        }
+        ++executed;
+        if (mTotalCyclesCounter >= stopCycles || mBlockCache.getGeneration() != generation ||
+                mPins.RES || !mPins.RDY || interruptDue(mInterrupts.getRequests())) {
+            break;
+        }
+    }
+
+    // executeNextInstruction() carries on from where the block was left
+    mBlock = mBlockCache.getGeneration() == generation ? block : nullptr;
+    mBlockGeneration = generation;
+    mBlockPosition = executed;
+    return executed;
+}
+#endif
+
 void Cpu65816::addToCycles(int cycles) {
     mTotalCyclesCounter += cycles;
 }
@@ -24,6 +24,7 @@
 
 #include "SystemBus.hpp"
 #include "Interrupt.hpp"
+#include "InterruptController.hpp"
 #include "Addressing.hpp"
 #include "Stack.hpp"
 #include "CpuStatus.hpp"
@@ -31,26 +32,64 @@
 #include "Log.hpp"
 #include "Binary.hpp"
 #include "BuildConfig.hpp"
+#include "DecodedBlockCache.hpp"
 
 // Macro used by OpCode methods when an unrecognized OpCode is being executed.
 #define LOG_UNEXPECTED_OPCODE(opCode) Log::err(LOG_TAG).str("Unexpected OpCode: ").str(opCode.getName()).show();
 
 class Cpu65816Debugger;
+class Cpu65816Profiler;
+class Cpu65816Trace;
+class Cpu65816Stats;
 
-class Cpu65816 {
+// Cache line aligned: the bus, registers, program address and cycle counter, used by every
+// instruction, come first and share the first lines, which no other CPU's state does.
+class alignas(64) Cpu65816 {
         friend class Cpu65816Debugger;
+        friend class Cpu65816Profiler;
+        friend class Cpu65816Trace;
+        friend class Cpu65816Stats;
     public:
         Cpu65816(SystemBus &, EmulationModeInterrupts *, NativeModeInterrupts *);
 
         void setRESPin(bool);
         void setRDYPin(bool);
+        bool getRESPin() const { return mPins.RES; }
 
-        void setIRQPin(bool value) { mPins.IRQ = value;}
-        void setNMIPin(bool value) { mPins.NMI = value;}
-        void setABORTPin(bool value) { mPins.ABORT = value;}
+        // The pins, in terms of the interrupt controller: IRQ is its source 0
+        void setIRQPin(bool value) { mInterrupts.setSource(InterruptController::PIN_SOURCE, value); }
+        void setNMIPin(bool value) { mInterrupts.setNMILine(value); }
+        void setABORTPin(bool value) { mInterrupts.setABORT(value); }
+        InterruptController &getInterrupts() { return mInterrupts; }
 
         // Temporary
         bool executeNextInstruction();
+        // Executes instructions until at least the specified number of cycles has elapsed or the
+        // CPU cannot execute anymore (reset held, WAI, unsupported OpCode).
+        // Returns the number of cycles consumed.
+        uint64_t run(uint64_t cycleBudget);
+        uint64_t getTotalCycles();
+        // Wait states a device inserts into the access being made, see CPLD2_Video VRAM arbitration.
+        // run() counts them against its budget like any other cycle.
+        void addWaitCycles(uint32_t cycles) {
+            mTotalCyclesCounter += cycles;
+        }
+        // Idle loops: a branch back taken again with the registers it was last taken with and
+        // no store made in between is a loop that will spin alike until something outside the
+        // CPU changes. Within run() its iterations are then counted over to the end of the budget
+        // instead of being executed, the cycle counter ends up where it would have. Relies on
+        // devices and pins only changing between two run() calls. With threaded execution (the
+        // bus deferring its updates) other CPUs change shared devices such as the mailboxes
+        // during a run, so loops reading a device are not skipped there. A pin another thread
+        // raises is still only seen at the end of the run, up to a quantum late. On by default.
+        void setIdleLoopSkipping(bool enabled) { mIdleLoopSkipping = enabled; }
+        // Cycles counted over so far
+        uint64_t getSkippedIdleCycles() const { return mSkippedIdleCycles; }
+        // Block execution: within run(), decoded blocks are executed whole, without going back
+        // through executeNextInstruction() between their instructions. Leaves a block at the first
+        // interrupt to take, at the end of the budget or when a store rewrites decoded code.
+        // Not used while a debugger or trace is attached. Off by default.
+        void setBlockExecution(bool enabled) { mBlockExecution = enabled; }
         void setXL(uint8_t x);
         void setYL(uint8_t y);
         void setX(uint16_t x);
@@ -63,10 +102,33 @@ class Cpu65816 {
         Stack *getStack();
         CpuStatus *getCpuStatus();
 
+        // Registers, pins and cycle counter, as saved in save states. Taken and
+        // restored between instructions, decoded code is not part of it.
+        struct State {
+            uint64_t totalCycles;
+            uint16_t a;
+            uint16_t x;
+            uint16_t y;
+            uint16_t d;
+            uint16_t stackPointer;
+            uint16_t programCounter;
+            uint16_t flags;
+            uint8_t programBank;
+            uint8_t db;
+            bool pinRES;
+            bool pinRDY;
+            // NMI and ABORT latched, IRQ the pin's source
+            bool pinNMI;
+            bool pinIRQ;
+            bool pinABORT;
+            // Pending interrupt controller sources
+            uint32_t irqSources;
+        };
+        State saveState();
+        void loadState(const State &);
+
     private:
         SystemBus &mSystemBus;
-        EmulationModeInterrupts *mEmulationInterrupts;
-        NativeModeInterrupts *mNativeInterrupts;
 
         // Accumulator register
         uint16_t mA = 0;
@@ -81,39 +143,114 @@ class Cpu65816 {
         // Direct page register
         uint16_t mD = 0;
 
+        // Address of the current instruction's data and whether indexing it crossed a page,
+        // worked out together the first time the instruction asks for either.
+        bool mDataAddressValid = false;
+        bool mDataAddressCrossesPage = false;
+        Address mDataAddress {0x00, 0x0000};
+
+        // Address of the current OpCode
+        Address mProgramAddress {0x00, 0x0000};
+
+        // Total number of cycles
+        uint64_t mTotalCyclesCounter = 0;
+
+        // Bytes following the current opcode, valid if they were fetched with it: from the block
+        // cache or in one read from host memory.
+        bool mOperandDecoded = false;
+        uint8_t mOperand[3];
+
         struct {
             // Reset to true means low power mode (do nothing) (should jump indirect via 0x00FFFC)
             bool RES = true;
-            // Ready to false means CPU is waiting for an NMI/IRQ/ABORT/RESET
-            bool RDY = false;
+            // Ready to false means CPU is waiting for an NMI/IRQ/ABORT/RESET, as after WAI
+            bool RDY = true;
+        } mPins;
 
-            // nmi true execute nmi vector (0x00FFEA)
-            bool NMI = false;
-            // irq true exucute irq vector (0x00FFEE)
-            bool IRQ = false;
-            // abort true execute abort vector (0x00FFE8)
-            bool ABORT = false;
+        EmulationModeInterrupts *mEmulationInterrupts;
+        NativeModeInterrupts *mNativeInterrupts;
 
-        } mPins;
+        // NMI, IRQ and ABORT requests. Taken before the next instruction, through the vectors
+        // at 0x00FFEA, 0x00FFEE, 0x00FFE8 (native mode) or 0x00FFFA, 0x00FFFE, 0x00FFF8
+        InterruptController mInterrupts;
 
         Stack mStack;
 
-        // Address of the current OpCode
-        Address mProgramAddress {0x00, 0x0000};
+#ifndef CPU_DISABLE_BLOCK_CACHE
+        // Straight-line code already fetched from the bus, and where we are in it.
+        DecodedBlockCache mBlockCache;
+        const DecodedBlockCache::Block *mBlock = nullptr;
+        uint32_t mBlockGeneration = 0;
+        size_t mBlockPosition = 0;
 
-        // Total number of cycles
-        uint64_t mTotalCyclesCounter = 0;
+        const DecodedBlockCache::Instruction *nextDecodedInstruction();
+        // Executes the block at the program address up to stopCycles, see setBlockExecution().
+        // Returns the number of instructions executed, -1 if one of them could not be.
+        int runBlock(uint64_t stopCycles);
+#endif
+        bool mBlockExecution = false;
+        // An interrupt would be taken before the next instruction
+        bool interruptDue(uint8_t requests) {
+            return (requests & (InterruptController::ABORT | InterruptController::NMI)) != 0 ||
+                ((requests & InterruptController::IRQ) != 0 && !mCpuStatus.interruptDisableFlag());
+        }
+        // Opcode at the program address, with its operands when they can be read at once
+        uint8_t fetchInstruction();
+        // Enters the handler of the most urgent request, if it can be taken now
+        bool takeInterrupt(uint8_t requests);
+        uint16_t readVector(uint16_t address);
+        // Sampling profiler, see Cpu65816Profiler. run() stops for a sample once
+        // the cycle counter reaches mNextSampleCycle, never without a profiler.
+        Cpu65816Profiler *mProfiler = nullptr;
+        uint64_t mNextSampleCycle = UINT64_MAX;
+
+        void notifyCall() { if (mProfiler != nullptr) profileCall(); }
+        void notifyReturn() { if (mProfiler != nullptr) profileReturn(); }
+        void profileCall();
+        void profileReturn();
 
-        bool accumulatorIs8BitWide();
-        bool accumulatorIs16BitWide();
-        bool indexIs8BitWide();
-        bool indexIs16BitWide();
+        // Instruction trace, see Cpu65816Trace. Records each instruction when set.
+        Cpu65816Trace *mTrace = nullptr;
+        // Execution counts, see Cpu65816Stats. Instructions go through executeCounted() when set.
+        Cpu65816Stats *mStats = nullptr;
+        bool executeCounted(uint8_t);
+        // Set while breakpoints or watchpoints are, asked before each instruction.
+        Cpu65816Debugger *mDebugger = nullptr;
+
+        // Idle loop detection, see setIdleLoopSkipping(). The state at the last branch back.
+        struct {
+            uint32_t address = 0xFFFFFFFF;
+            uint64_t cycles;
+            uint64_t stores;
+            uint64_t deviceReads;
+            uint16_t a, x, y, d, stackPointer, flags;
+            uint8_t db;
+        } mIdleLoop;
+        bool mIdleLoopSkipping = true;
+        // Where the current run() stops, idle iterations are not counted over past it
+        uint64_t mRunStopCycles = 0;
+        uint64_t mSkippedIdleCycles = 0;
+
+        void notifyBranchBack() { if (mIdleLoopSkipping) checkIdleLoop(); }
+        void checkIdleLoop();
+
+        // Accumulator and index are always 8 bit in emulation mode, otherwise
+        // their width is given by the m and x flags. CpuStatus keeps the
+        // result cached, see CpuStatus::updateRegisterWidths().
+        bool accumulatorIs8BitWide() { return mCpuStatus.accumulatorIs8BitWide(); }
+        bool accumulatorIs16BitWide() { return !mCpuStatus.accumulatorIs8BitWide(); }
+        bool indexIs8BitWide() { return mCpuStatus.indexIs8BitWide(); }
+        bool indexIs16BitWide() { return !mCpuStatus.indexIs8BitWide(); }
 
         uint16_t indexWithXRegister();
         uint16_t indexWithYRegister();
 
-        Address getAddressOfOpCodeData(OpCode &);
-        bool opCodeAddressingCrossesPageBoundary(OpCode &);
+        uint8_t readOperandByte();
+        uint16_t readOperandTwoBytes();
+        Address readOperandAddress();
+
+        Address getAddressOfOpCodeData(const OpCode &);
+        bool opCodeAddressingCrossesPageBoundary(const OpCode &);
 
         void addToCycles(int);
         void subtractFromCycles(int);
@@ -121,84 +258,88 @@ class Cpu65816 {
         void addToProgramAddressAndCycles(int, int);
 
         // OpCode Table.
-        static OpCode OP_CODE_TABLE[];
+        static const OpCode OP_CODE_TABLE[];
+
+        // Switch based dispatcher, see opcodes/OpCodeDispatch.cpp.
+        bool dispatchOpCode(uint8_t);
 
         // OpCodes handling routines.
         // Implementations for these methods can be found in the corresponding OpCode_XXX.cpp file.
-        void executeORA(OpCode &);
-        void executeORA8Bit(OpCode &);
-        void executeORA16Bit(OpCode &);
-        void executeStack(OpCode &);
-        void executeStatusReg(OpCode &);
-        void executeMemoryROL(OpCode &);
-        void executeAccumulatorROL(OpCode &);
-        void executeROL(OpCode &);
-        void executeMemoryROR(OpCode &);
-        void executeAccumulatorROR(OpCode &);
-        void executeROR(OpCode &);
-        void executeInterrupt(OpCode &);
-        void executeJumpReturn(OpCode &);
-        void execute8BitSBC(OpCode &);
-        void execute16BitSBC(OpCode &);
-        void execute8BitBCDSBC(OpCode &);
-        void execute16BitBCDSBC(OpCode &);
-        void executeSBC(OpCode &);
-        void execute8BitADC(OpCode &);
-        void execute16BitADC(OpCode &);
-        void execute8BitBCDADC(OpCode &);
-        void execute16BitBCDADC(OpCode &);
-        void executeADC(OpCode &);
-        void executeSTA(OpCode &);
-        void executeSTX(OpCode &);
-        void executeSTY(OpCode &);
-        void executeSTZ(OpCode &);
-        void executeTransfer(OpCode &);
-        void executeMemoryASL(OpCode &);
-        void executeAccumulatorASL(OpCode &);
-        void executeASL(OpCode &);
-        void executeAND8Bit(OpCode &);
-        void executeAND16Bit(OpCode &);
-        void executeAND(OpCode &);
-        void executeLDA8Bit(OpCode &);
-        void executeLDA16Bit(OpCode &);
-        void executeLDA(OpCode &);
-        void executeLDX8Bit(OpCode &);
-        void executeLDX16Bit(OpCode &);
-        void executeLDX(OpCode &);
-        void executeLDY8Bit(OpCode &);
-        void executeLDY16Bit(OpCode &);
-        void executeLDY(OpCode &);
-        void executeEOR8Bit(OpCode &);
-        void executeEOR16Bit(OpCode &);
-        void executeEOR(OpCode &);
-        int executeBranchShortOnCondition(bool, OpCode &);
-        int executeBranchLongOnCondition(bool, OpCode &);
-        void executeBranch(OpCode &);
-        void execute8BitCMP(OpCode &);
-        void execute16BitCMP(OpCode &);
-        void executeCMP(OpCode &);
-        void execute8BitDecInMemory(OpCode &);
-        void execute16BitDecInMemory(OpCode &);
-        void execute8BitIncInMemory(OpCode &);
-        void execute16BitIncInMemory(OpCode &);
-        void executeINCDEC(OpCode &);
-        void execute8BitCPX(OpCode &);
-        void execute16BitCPX(OpCode &);
-        void execute8BitCPY(OpCode &);
-        void execute16BitCPY(OpCode &);
-        void executeCPXCPY(OpCode &);
-        void execute8BitTSB(OpCode &);
-        void execute16BitTSB(OpCode &);
-        void execute8BitTRB(OpCode &);
-        void execute16BitTRB(OpCode &);
-        void executeTSBTRB(OpCode &);
-        void execute8BitBIT(OpCode &);
-        void execute16BitBIT(OpCode &);
-        void executeBIT(OpCode &);
-        void executeMemoryLSR(OpCode &);
-        void executeAccumulatorLSR(OpCode &);
-        void executeLSR(OpCode &);
-        void executeMisc(OpCode &);
+        void executeORA(const OpCode &);
+        void executeORA8Bit(const OpCode &);
+        void executeORA16Bit(const OpCode &);
+        void executeStack(const OpCode &);
+        void executeStatusReg(const OpCode &);
+        void executeMemoryROL(const OpCode &);
+        void executeAccumulatorROL(const OpCode &);
+        void executeROL(const OpCode &);
+        void executeMemoryROR(const OpCode &);
+        void executeAccumulatorROR(const OpCode &);
+        void executeROR(const OpCode &);
+        void executeInterrupt(const OpCode &);
+        void executeJumpReturn(const OpCode &);
+        void execute8BitSBC(const OpCode &);
+        void execute16BitSBC(const OpCode &);
+        void execute8BitBCDSBC(const OpCode &);
+        void execute16BitBCDSBC(const OpCode &);
+        void executeSBC(const OpCode &);
+        void execute8BitADC(const OpCode &);
+        void execute16BitADC(const OpCode &);
+        void execute8BitBCDADC(const OpCode &);
+        void execute16BitBCDADC(const OpCode &);
+        void executeADC(const OpCode &);
+        void executeSTA(const OpCode &);
+        void executeSTX(const OpCode &);
+        void executeSTY(const OpCode &);
+        void executeSTZ(const OpCode &);
+        void executeTransfer(const OpCode &);
+        void executeMemoryASL(const OpCode &);
+        void executeAccumulatorASL(const OpCode &);
+        void executeASL(const OpCode &);
+        void executeAND8Bit(const OpCode &);
+        void executeAND16Bit(const OpCode &);
+        void executeAND(const OpCode &);
+        void executeLDA8Bit(const OpCode &);
+        void executeLDA16Bit(const OpCode &);
+        void executeLDA(const OpCode &);
+        void executeLDX8Bit(const OpCode &);
+        void executeLDX16Bit(const OpCode &);
+        void executeLDX(const OpCode &);
+        void executeLDY8Bit(const OpCode &);
+        void executeLDY16Bit(const OpCode &);
+        void executeLDY(const OpCode &);
+        void executeEOR8Bit(const OpCode &);
+        void executeEOR16Bit(const OpCode &);
+        void executeEOR(const OpCode &);
+        int executeBranchShortOnCondition(bool, const OpCode &);
+        int executeBranchLongOnCondition(bool, const OpCode &);
+        void executeBranch(const OpCode &);
+        void execute8BitCMP(const OpCode &);
+        void execute16BitCMP(const OpCode &);
+        void executeCMP(const OpCode &);
+        void execute8BitDecInMemory(const OpCode &);
+        void execute16BitDecInMemory(const OpCode &);
+        void execute8BitIncInMemory(const OpCode &);
+        void execute16BitIncInMemory(const OpCode &);
+        void executeINCDEC(const OpCode &);
+        void execute8BitCPX(const OpCode &);
+        void execute16BitCPX(const OpCode &);
+        void execute8BitCPY(const OpCode &);
+        void execute16BitCPY(const OpCode &);
+        void executeCPXCPY(const OpCode &);
+        void execute8BitTSB(const OpCode &);
+        void execute16BitTSB(const OpCode &);
+        void execute8BitTRB(const OpCode &);
+        void execute16BitTRB(const OpCode &);
+        void executeTSBTRB(const OpCode &);
+        void execute8BitBIT(const OpCode &);
+        void execute16BitBIT(const OpCode &);
+        void executeBIT(const OpCode &);
+        void executeMemoryLSR(const OpCode &);
+        void executeAccumulatorLSR(const OpCode &);
+        void executeLSR(const OpCode &);
+        void executeMisc(const OpCode &);
+        void executeBlockMove(const OpCode &, bool decrement);
 
         void reset();
 };
@@ -19,11 +19,17 @@
 
 #include "Cpu65816Debugger.hpp"
 #include "Cpu65816.hpp"
+#include "Cpu65816Trace.hpp"
+
+#include <algorithm>
 
 #define LOG_TAG "Cpu65816Debugger"
 
-Cpu65816Debugger::Cpu65816Debugger(Cpu65816 &cpu) : mCpu(cpu) {
+Cpu65816Debugger::Cpu65816Debugger(Cpu65816 &cpu) : mBreakPointPages(PAGE_COUNT / 64, 0), mCpu(cpu) {
     cpu.setRESPin(false);
+    mCpu.mSystemBus.setWatchHandler([this](uint32_t address, uint8_t value, bool write) {
+        onAccess(address, value, write);
+    });
 
     Log::dbg(LOG_TAG).str("Cpu is ready to run").show();
     Log::dbg(LOG_TAG).str("Emulation mode RST vector at").sp().hex(mCpu.mEmulationInterrupts->reset, 4).show();
@@ -31,25 +37,25 @@ Cpu65816Debugger::Cpu65816Debugger(Cpu65816 &cpu) : mCpu(cpu) {
     Log::dbg(LOG_TAG).str("Native mode VSYNC vector at").sp().hex(mCpu.mNativeInterrupts->nonMaskableInterrupt, 4).show();
 }
 
+Cpu65816Debugger::~Cpu65816Debugger() {
+    clearBreakPoints();
+    mCpu.mSystemBus.setWatchHandler(nullptr);
+}
+
 void Cpu65816Debugger::step() {
-    if (mBreakpointHit) return;
+    if (mStopped) return;
 
     mOnBeforeStepHandler();
     const uint8_t instruction = mCpu.mSystemBus.readByte(mCpu.mProgramAddress);
     OpCode opCode = mCpu.OP_CODE_TABLE[instruction];
+    // Not executing yet, what the last instruction fetched and worked out does not apply
+    mCpu.mOperandDecoded = false;
+    mCpu.mDataAddressValid = false;
     logOpCode(opCode);
 
     mCpu.executeNextInstruction();
 
     mOnAfterStepHandler();
-
-    if (mCpu.mProgramAddress.getBank() == mBreakPointAddress.getBank() &&
-        mCpu.mProgramAddress.getOffset() == mBreakPointAddress.getOffset()) {
-        mBreakpointHit = true;
-        Log::dbg(LOG_TAG).str("BREAKPOINT").sp()
-                .hex(mBreakPointAddress.getBank(), 2).hex(mBreakPointAddress.getOffset(), 4).show();
-        mOnBreakPointHandler();
-    }
 }
 
 void Cpu65816Debugger::doBeforeStep(const std::function<void ()> handler) {
@@ -65,7 +71,151 @@ void Cpu65816Debugger::onBreakPoint(const std::function<void ()> handler) {
 }
 
 void Cpu65816Debugger::setBreakPoint(const Address &address) {
-    mBreakPointAddress = address;
+    if (mAddressBreakPointId != 0) {
+        removeBreakPoint(mAddressBreakPointId);
+    }
+    mAddressBreakPointId = addBreakPoint(address.getFlat());
+}
+
+int Cpu65816Debugger::addBreakPoint(uint32_t address, Condition condition) {
+    const int id = mNextId++;
+    mBreakPoints.push_back(BreakPoint{id, address & 0xFFFFFF, condition});
+    refreshBreakPointPages();
+    updateAttachment();
+    return id;
+}
+
+int Cpu65816Debugger::addWatchPoint(uint32_t firstAddress, uint32_t lastAddress, bool read, bool write,
+                                    WatchCondition condition) {
+    const int id = mNextId++;
+    firstAddress &= 0xFFFFFF;
+    lastAddress = std::max(firstAddress, lastAddress & 0xFFFFFF);
+    const uint8_t access = (read ? SystemBus::WATCH_READ : 0) | (write ? SystemBus::WATCH_WRITE : 0);
+    mWatchPoints.push_back(WatchPoint{id, firstAddress, lastAddress, access, condition});
+    refreshWatchedPages(firstAddress, lastAddress);
+    updateAttachment();
+    return id;
+}
+
+void Cpu65816Debugger::removeBreakPoint(int id) {
+    mBreakPoints.erase(std::remove_if(mBreakPoints.begin(), mBreakPoints.end(),
+                                      [id](const BreakPoint &breakPoint) { return breakPoint.id == id; }),
+                       mBreakPoints.end());
+    if (id == mAddressBreakPointId) {
+        mAddressBreakPointId = 0;
+    }
+    refreshBreakPointPages();
+    updateAttachment();
+}
+
+void Cpu65816Debugger::removeWatchPoint(int id) {
+    auto found = std::find_if(mWatchPoints.begin(), mWatchPoints.end(),
+                              [id](const WatchPoint &watchPoint) { return watchPoint.id == id; });
+    if (found == mWatchPoints.end()) return;
+
+    const uint32_t firstAddress = found->firstAddress;
+    const uint32_t lastAddress = found->lastAddress;
+    mWatchPoints.erase(found);
+    refreshWatchedPages(firstAddress, lastAddress);
+    updateAttachment();
+}
+
+void Cpu65816Debugger::clearBreakPoints() {
+    mBreakPoints.clear();
+    mAddressBreakPointId = 0;
+    refreshBreakPointPages();
+    while (!mWatchPoints.empty()) {
+        removeWatchPoint(mWatchPoints.back().id);
+    }
+    updateAttachment();
+}
+
+void Cpu65816Debugger::resume() {
+    if (!mStopped) return;
+
+    mStopped = false;
+    mResuming = true;
+    mResumeAddress = mCpu.mProgramAddress.getFlat();
+    updateAttachment();
+}
+
+bool Cpu65816Debugger::checkBreak() {
+    if (mStopped) return true;
+
+    const uint32_t address = mCpu.mProgramAddress.getFlat();
+    const bool resuming = mResuming && address == mResumeAddress;
+    mResuming = false;
+
+    // Made by the previous instruction
+    if (mWatchPointHit) {
+        mWatchPointHit = false;
+        stop(mLastHit);
+        return true;
+    }
+
+    const uint16_t page = static_cast<uint16_t>(address >> 8);
+    if (resuming || (mBreakPointPages[page >> 6] & (1ull << (page & 63))) == 0) {
+        return false;
+    }
+    for (const BreakPoint &breakPoint : mBreakPoints) {
+        if (breakPoint.address == address && (!breakPoint.condition || breakPoint.condition(mCpu.saveState()))) {
+            stop(Hit{HitKind::BREAKPOINT, breakPoint.id, address, 0});
+            return true;
+        }
+    }
+    return false;
+}
+
+void Cpu65816Debugger::onAccess(uint32_t address, uint8_t value, bool write) {
+    // The first access of the instruction is the one reported
+    if (mStopped || mWatchPointHit) return;
+
+    const uint8_t access = write ? SystemBus::WATCH_WRITE : SystemBus::WATCH_READ;
+    for (const WatchPoint &watchPoint : mWatchPoints) {
+        if ((watchPoint.access & access) && address >= watchPoint.firstAddress && address <= watchPoint.lastAddress &&
+                (!watchPoint.condition || watchPoint.condition(address, value))) {
+            mLastHit = Hit{write ? HitKind::WRITE : HitKind::READ, watchPoint.id, address, value};
+            mWatchPointHit = true;
+            return;
+        }
+    }
+}
+
+void Cpu65816Debugger::stop(const Hit &hit) {
+    mStopped = true;
+    mLastHit = hit;
+
+    Log::dbg(LOG_TAG).str(hit.kind == HitKind::BREAKPOINT ? "BREAKPOINT" : "WATCHPOINT").sp()
+            .num(hit.id).sp().hex(hit.address, 6).show();
+    logTrace();
+    if (mOnBreakPointHandler) {
+        mOnBreakPointHandler();
+    }
+}
+
+void Cpu65816Debugger::refreshBreakPointPages() {
+    std::fill(mBreakPointPages.begin(), mBreakPointPages.end(), 0);
+    for (const BreakPoint &breakPoint : mBreakPoints) {
+        const uint16_t page = static_cast<uint16_t>(breakPoint.address >> 8);
+        mBreakPointPages[page >> 6] |= 1ull << (page & 63);
+    }
+}
+
+void Cpu65816Debugger::refreshWatchedPages(uint32_t firstAddress, uint32_t lastAddress) {
+    for (uint32_t page = firstAddress >> 8; page <= lastAddress >> 8; page++) {
+        uint8_t access = 0;
+        for (const WatchPoint &watchPoint : mWatchPoints) {
+            if ((watchPoint.firstAddress >> 8) <= page && page <= (watchPoint.lastAddress >> 8)) {
+                access |= watchPoint.access;
+            }
+        }
+        mCpu.mSystemBus.setPageWatch(static_cast<uint16_t>(page), access);
+    }
+}
+
+void Cpu65816Debugger::updateAttachment() {
+    const bool armed = !mBreakPoints.empty() || !mWatchPoints.empty() || mStopped;
+    mCpu.mDebugger = armed ? this : nullptr;
 }
 
 void Cpu65816Debugger::logStatusRegister() const {
@@ -82,10 +232,18 @@ void Cpu65816Debugger::dumpCpu() const {
     Log::trc(LOG_TAG).str("====== CPU status end ======").show();
 }
 
-void Cpu65816Debugger::logOpCode(OpCode &opCode) const {
+void Cpu65816Debugger::logTrace(size_t entries) const {
+    if (mCpu.mTrace == nullptr) return;
+
+    for (const Cpu65816Trace::Entry &entry : mCpu.mTrace->getEntries(entries)) {
+        Log::dbg(LOG_TAG).str(Cpu65816Trace::formatEntry(entry)).show();
+    }
+}
+
+void Cpu65816Debugger::logOpCode(const OpCode &opCode) const {
     Address onePlusOpCodeAddress = mCpu.mProgramAddress.newWithOffset(1);
 
-    Log &log = Log::trc(LOG_TAG);
+    auto log = Log::trc(LOG_TAG);
     log.hex(mCpu.mProgramAddress.getBank(), 2).str(":").hex(mCpu.mProgramAddress.getOffset(), 4);
     log.str(" | ").hex(opCode.getCode(), 2).sp().str(opCode.getName()).sp();
 
@@ -22,35 +22,119 @@
 
 #include <cstdint>
 #include <functional>
+#include <vector>
 
 #include "SystemBusDevice.hpp"
 #include "BuildConfig.hpp"
 #include "Cpu65816.hpp"
 
+/**
+ * Breakpoints and watchpoints for one CPU, and single stepping.
+ *
+ * Any number of execute breakpoints, each with an optional condition on the registers, and
+ * of read / write watchpoints over address ranges. While any is set the CPU asks before each
+ * instruction whether to stop: pages with breakpoints are flagged in a bitmap, so an address
+ * elsewhere costs a single bit test. Watchpoints remove the host pointers of their pages from
+ * the SystemBus page table, only accesses to these pages take the slow path and are checked.
+ *
+ * Once a breakpoint or watchpoint is hit the CPU stops before its next instruction, executes
+ * nothing until resume() and the onBreakPoint() handler is called on the thread running it.
+ * A watchpoint stops after the instruction that made the access.
+ */
 class Cpu65816Debugger {
+        friend class Cpu65816;
     public:
+        // Taken with the state of the CPU before the instruction at the breakpoint
+        using Condition = std::function<bool (const Cpu65816::State &)>;
+        // Given the address and value of the byte accessed
+        using WatchCondition = std::function<bool (uint32_t address, uint8_t value)>;
+
+        enum class HitKind {
+            NONE,
+            BREAKPOINT,
+            READ,
+            WRITE
+        };
+
+        struct Hit {
+            HitKind kind;
+            int id;
+            // Instruction address for a breakpoint, accessed byte for a watchpoint
+            uint32_t address;
+            uint8_t value;
+        };
+
         Cpu65816Debugger(Cpu65816 &);
+        ~Cpu65816Debugger();
 
         void step();
+        // Replaces the breakpoint set by the previous call
         void setBreakPoint(const Address &);
         void dumpCpu() const ;
         void logStatusRegister() const ;
-        void logOpCode(OpCode &) const ;
+        void logOpCode(const OpCode &) const ;
+        // Last instructions of the CPU's trace, if it is being traced
+        void logTrace(size_t entries = 16) const ;
+
+        // Return an id for the remove calls, addresses are PB:PC / bank in bits 16-23
+        int addBreakPoint(uint32_t address, Condition condition = nullptr);
+        int addWatchPoint(uint32_t firstAddress, uint32_t lastAddress, bool read, bool write,
+                          WatchCondition condition = nullptr);
+        void removeBreakPoint(int id);
+        void removeWatchPoint(int id);
+        void clearBreakPoints();
+
+        bool isStopped() const { return mStopped; }
+        const Hit &getLastHit() const { return mLastHit; }
+        // Lets the CPU go on, the breakpoint it stopped at is not hit again right away
+        void resume();
 
         void doBeforeStep(std::function<void ()>);
         void doAfterStep(std::function<void ()>);
         void onBreakPoint(std::function<void ()>);
 
     private:
+        struct BreakPoint {
+            int id;
+            uint32_t address;
+            Condition condition;
+        };
+
+        struct WatchPoint {
+            int id;
+            uint32_t firstAddress;
+            uint32_t lastAddress;
+            uint8_t access;
+            WatchCondition condition;
+        };
+
         std::function<void ()> mOnBeforeStepHandler;
         std::function<void ()> mOnAfterStepHandler;
         std::function<void ()> mOnBreakPointHandler;
 
-        // Let's assume $00:$0000 is not a valid address for code
-        Address mBreakPointAddress {0x00, 0x0000};
-        bool mBreakpointHit = false;
+        std::vector<BreakPoint> mBreakPoints;
+        std::vector<WatchPoint> mWatchPoints;
+        // One bit per 256 byte page holding a breakpoint
+        std::vector<uint64_t> mBreakPointPages;
+        int mNextId = 1;
+        int mAddressBreakPointId = 0;
+
+        bool mStopped = false;
+        bool mWatchPointHit = false;
+        // Address resume() was called at, not stopped at again by the next instruction
+        bool mResuming = false;
+        uint32_t mResumeAddress = 0;
+        Hit mLastHit {HitKind::NONE, 0, 0, 0};
 
         Cpu65816 &mCpu;
+
+        // Called by the CPU before each instruction while attached, true to stop it
+        bool checkBreak();
+        void onAccess(uint32_t address, uint8_t value, bool write);
+        void stop(const Hit &);
+        void refreshBreakPointPages();
+        void refreshWatchedPages(uint32_t firstAddress, uint32_t lastAddress);
+        void updateAttachment();
 };
 
 #endif // CPU65816DEBUGGER_H
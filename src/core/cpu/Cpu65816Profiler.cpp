@@ -0,0 +1,140 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Cpu65816Profiler.hpp"
+#include "Cpu65816.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+static std::string formatAddress(uint32_t address) {
+    char text[8];
+    std::snprintf(text, sizeof(text), "%02X:%04X", (address >> 16) & 0xFF, address & 0xFFFF);
+    return text;
+}
+
+Cpu65816Profiler::Cpu65816Profiler(Cpu65816 &cpu, const std::string &name) : mCpu(cpu), mName(name) {
+    mCallStack.reserve(MAX_CALL_DEPTH);
+}
+
+Cpu65816Profiler::~Cpu65816Profiler() {
+    stop();
+}
+
+void Cpu65816Profiler::start(uint32_t intervalCycles) {
+    mInterval = intervalCycles > 0 ? intervalCycles : DEFAULT_INTERVAL;
+    mRunning = true;
+    // Calls made before are not known, samples start from the current subroutine
+    mCallStack.clear();
+    mUntrackedDepth = 0;
+    mCpu.mProfiler = this;
+    mCpu.mNextSampleCycle = mCpu.mTotalCyclesCounter + mInterval;
+}
+
+void Cpu65816Profiler::stop() {
+    if (mCpu.mProfiler == this) {
+        mCpu.mProfiler = nullptr;
+        mCpu.mNextSampleCycle = std::numeric_limits<uint64_t>::max();
+    }
+    mRunning = false;
+}
+
+void Cpu65816Profiler::clear() {
+    mSampleCount = 0;
+    mFlatSamples.clear();
+    mStackSamples.clear();
+}
+
+void Cpu65816Profiler::onCall() {
+    if (mCallStack.size() == MAX_CALL_DEPTH) {
+        mUntrackedDepth++;
+        return;
+    }
+    mCallStack.push_back(Frame{mCpu.mProgramAddress.getFlat(), mCpu.mStack.getStackPointer()});
+}
+
+void Cpu65816Profiler::onReturn() {
+    if (mUntrackedDepth > 0) {
+        mUntrackedDepth--;
+        return;
+    }
+    dropReturnedFrames(mCpu.mStack.getStackPointer());
+}
+
+void Cpu65816Profiler::dropReturnedFrames(uint16_t stackPointer) {
+    // The stack grows down, a subroutine never runs above the pointer it was called with
+    while (!mCallStack.empty() && mCallStack.back().stackPointer < stackPointer) {
+        mCallStack.pop_back();
+    }
+}
+
+void Cpu65816Profiler::takeSample() {
+    // As many intervals as went by, a long instruction does not skip samples
+    const uint64_t cycles = mCpu.mTotalCyclesCounter;
+    uint64_t weight = 0;
+    while (mCpu.mNextSampleCycle <= cycles) {
+        mCpu.mNextSampleCycle += mInterval;
+        weight++;
+    }
+
+    // Frames left without a return (stack pointer reset, return address pulled)
+    if (mUntrackedDepth == 0) {
+        dropReturnedFrames(mCpu.mStack.getStackPointer());
+    }
+
+    const uint32_t address = mCpu.mProgramAddress.getFlat();
+    mFlatSamples[address] += weight;
+
+    mStackKey.clear();
+    for (const Frame &frame : mCallStack) {
+        mStackKey.push_back(frame.entry);
+    }
+    mStackKey.push_back(address);
+    mStackSamples[mStackKey] += weight;
+
+    mSampleCount += weight;
+}
+
+void Cpu65816Profiler::writeFlatProfile(std::ostream &out, size_t maxEntries) const {
+    std::vector<std::pair<uint32_t, uint64_t>> entries(mFlatSamples.begin(), mFlatSamples.end());
+    std::sort(entries.begin(), entries.end(), [](const std::pair<uint32_t, uint64_t> &a,
+                                                 const std::pair<uint32_t, uint64_t> &b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    if (maxEntries != 0 && entries.size() > maxEntries) {
+        entries.resize(maxEntries);
+    }
+
+    for (const auto &entry : entries) {
+        char percent[16];
+        std::snprintf(percent, sizeof(percent), "%6.2f%%", 100.0 * entry.second / mSampleCount);
+        out << entry.second << " " << percent << " " << mName << " " << formatAddress(entry.first) << "\n";
+    }
+}
+
+void Cpu65816Profiler::writeFoldedStacks(std::ostream &out) const {
+    for (const auto &stack : mStackSamples) {
+        out << mName;
+        for (uint32_t address : stack.first) {
+            out << ";" << formatAddress(address);
+        }
+        out << " " << stack.second << "\n";
+    }
+}
@@ -0,0 +1,99 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPU65816PROFILER_H
+#define CPU65816PROFILER_H
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SystemBusDevice.hpp"
+
+class Cpu65816;
+
+/**
+ * Sampling profiler for the code run by one CPU.
+ *
+ * Every given number of cycles Cpu65816::run() stops between two instructions
+ * and the program address is counted. The CPU also reports its calls (JSR, JSL,
+ * interrupts) and returns, so that each sample comes with the entry points of
+ * the subroutines being run. A frame is dropped once the stack pointer went
+ * back above the one it was called with.
+ *
+ * When not started the CPU only tests a null pointer on calls and returns.
+ * The profile belongs to the thread running the CPU, read it when the CPU is
+ * not running.
+ */
+class Cpu65816Profiler {
+    public:
+        static constexpr uint32_t DEFAULT_INTERVAL = 997;   // Prime, not to beat with loops
+        static constexpr size_t MAX_CALL_DEPTH = 64;
+
+        Cpu65816Profiler(Cpu65816 &, const std::string &name);
+        ~Cpu65816Profiler();
+
+        void start(uint32_t intervalCycles = DEFAULT_INTERVAL);
+        void stop();
+        bool isRunning() const { return mRunning; }
+        void clear();
+
+        uint64_t getSampleCount() const { return mSampleCount; }
+        const std::string &getName() const { return mName; }
+
+        // "samples percent name PB:PC", most sampled first, all of them for 0
+        void writeFlatProfile(std::ostream &, size_t maxEntries = 0) const;
+        // "name;PB:PC;...;PB:PC samples": entry points of the subroutines from the
+        // outermost one, then the sampled address, as taken by flame graph tools
+        void writeFoldedStacks(std::ostream &) const;
+
+    private:
+        friend class Cpu65816;
+
+        // Called by the CPU, after the return address went on the stack or came off it
+        void onCall();
+        void onReturn();
+        void takeSample();
+
+        void dropReturnedFrames(uint16_t stackPointer);
+
+        struct Frame {
+            uint32_t entry;
+            uint16_t stackPointer;
+        };
+
+        Cpu65816 &mCpu;
+        std::string mName;
+        bool mRunning = false;
+        uint32_t mInterval = DEFAULT_INTERVAL;
+
+        std::vector<Frame> mCallStack;
+        // Calls deeper than MAX_CALL_DEPTH, not recorded
+        size_t mUntrackedDepth = 0;
+
+        uint64_t mSampleCount = 0;
+        std::unordered_map<uint32_t, uint64_t> mFlatSamples;
+        std::map<std::vector<uint32_t>, uint64_t> mStackSamples;
+        std::vector<uint32_t> mStackKey;
+};
+
+#endif // CPU65816PROFILER_H
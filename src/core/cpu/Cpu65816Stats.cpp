@@ -0,0 +1,225 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Cpu65816Stats.hpp"
+
+#include <cstdio>
+
+static const char * const ADDRESSING_MODE_NAMES[Cpu65816Stats::ADDRESSING_MODE_COUNT] = {
+    "Interrupt",
+    "Accumulator",
+    "BlockMove",
+    "Implied",
+    "Immediate",
+    "Absolute",
+    "AbsoluteLong",
+    "AbsoluteIndirect",
+    "AbsoluteIndirectLong",
+    "AbsoluteIndexedIndirectWithX",
+    "AbsoluteIndexedWithX",
+    "AbsoluteLongIndexedWithX",
+    "AbsoluteIndexedWithY",
+    "DirectPage",
+    "DirectPageIndexedWithX",
+    "DirectPageIndexedWithY",
+    "DirectPageIndirect",
+    "DirectPageIndirectLong",
+    "DirectPageIndexedIndirectWithX",
+    "DirectPageIndirectIndexedWithY",
+    "DirectPageIndirectLongIndexedWithY",
+    "StackImplied",
+    "StackRelative",
+    "StackAbsolute",
+    "StackDirectPageIndirect",
+    "StackProgramCounterRelativeLong",
+    "StackRelativeIndirectIndexedWithY",
+    "ProgramCounterRelative",
+    "ProgramCounterRelativeLong"
+};
+
+Cpu65816Stats::Cpu65816Stats(Cpu65816 &cpu, const std::string &name) : mCpu(cpu), mName(name) {
+}
+
+Cpu65816Stats::~Cpu65816Stats() {
+    stop();
+}
+
+void Cpu65816Stats::start() {
+    clear();
+    mRunning = true;
+    mCpu.mStats = this;
+    mCpu.mSystemBus.setAccessCounting(true);
+}
+
+void Cpu65816Stats::stop() {
+    if (mCpu.mStats == this) {
+        mCpu.mStats = nullptr;
+        mCpu.mSystemBus.setAccessCounting(false);
+    }
+    mRunning = false;
+}
+
+void Cpu65816Stats::clear() {
+    for (Count &count : mOpCodes) {
+        count = Count();
+    }
+    mCpu.mSystemBus.clearAccessCounts();
+}
+
+Cpu65816Stats::Count Cpu65816Stats::getAddressingModeCount(AddressingMode mode) const {
+    Count total = {};
+    for (int code = 0; code < OPCODE_COUNT; code++) {
+        if (Cpu65816::OP_CODE_TABLE[code].getAddressingMode() == mode) {
+            total.executions += mOpCodes[code].executions;
+            total.cycles += mOpCodes[code].cycles;
+        }
+    }
+    return total;
+}
+
+const std::vector<SystemBus::DeviceAccessCount> &Cpu65816Stats::getBusAccessCounts() const {
+    return mCpu.mSystemBus.getAccessCounts();
+}
+
+const char *Cpu65816Stats::getAddressingModeName(AddressingMode mode) {
+    const int index = static_cast<int>(mode);
+    return index >= 0 && index < ADDRESSING_MODE_COUNT ? ADDRESSING_MODE_NAMES[index] : "Unknown";
+}
+
+//=============================================================================
+// Output
+//=============================================================================
+
+// Quoted, as CSV field and JSON string. ROM titles are whatever the header holds.
+static void writeCSVField(std::ostream &out, const std::string &text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"') {
+            out << '"';
+        }
+        out << c;
+    }
+    out << '"';
+}
+
+static void writeJSONString(std::ostream &out, const std::string &text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+            out << escaped;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+static std::string opCodeKey(uint8_t code, const char *name) {
+    char key[16];
+    std::snprintf(key, sizeof(key), "%02X %s", code, name);
+    return key;
+}
+
+void Cpu65816Stats::writeCSVHeader(std::ostream &out) {
+    out << "rom,cpu,category,key,count,cycles\n";
+}
+
+void Cpu65816Stats::writeCSV(std::ostream &out, const std::string &romTitle) const {
+    auto row = [&](const char *category, const std::string &key, uint64_t count, const uint64_t *cycles) {
+        writeCSVField(out, romTitle);
+        out << ',';
+        writeCSVField(out, mName);
+        out << ',' << category << ',';
+        writeCSVField(out, key);
+        out << ',' << count << ',';
+        if (cycles != nullptr) {
+            out << *cycles;
+        }
+        out << '\n';
+    };
+
+    for (int code = 0; code < OPCODE_COUNT; code++) {
+        const Count &count = mOpCodes[code];
+        if (count.executions != 0) {
+            row("opcode", opCodeKey(code, Cpu65816::OP_CODE_TABLE[code].getName()), count.executions, &count.cycles);
+        }
+    }
+    for (int mode = 0; mode < ADDRESSING_MODE_COUNT; mode++) {
+        const Count count = getAddressingModeCount(static_cast<AddressingMode>(mode));
+        if (count.executions != 0) {
+            row("addressing_mode", ADDRESSING_MODE_NAMES[mode], count.executions, &count.cycles);
+        }
+    }
+    for (const SystemBus::DeviceAccessCount &device : getBusAccessCounts()) {
+        if (device.reads != 0) {
+            row("bus_read", device.deviceType, device.reads, nullptr);
+        }
+        if (device.writes != 0) {
+            row("bus_write", device.deviceType, device.writes, nullptr);
+        }
+    }
+}
+
+void Cpu65816Stats::writeJSON(std::ostream &out, const std::string &romTitle) const {
+    Count total = {};
+    for (const Count &count : mOpCodes) {
+        total.executions += count.executions;
+        total.cycles += count.cycles;
+    }
+
+    out << "{\"rom\": ";
+    writeJSONString(out, romTitle);
+    out << ", \"cpu\": ";
+    writeJSONString(out, mName);
+    out << ", \"instructions\": " << total.executions << ", \"cycles\": " << total.cycles << ",\n   \"opcodes\": [";
+    const char *separator = "";
+    for (int code = 0; code < OPCODE_COUNT; code++) {
+        const Count &count = mOpCodes[code];
+        if (count.executions != 0) {
+            const OpCode &opCode = Cpu65816::OP_CODE_TABLE[code];
+            out << separator << "\n    {\"code\": " << code << ", \"name\": \"" << opCode.getName()
+                << "\", \"mode\": \"" << getAddressingModeName(opCode.getAddressingMode())
+                << "\", \"count\": " << count.executions << ", \"cycles\": " << count.cycles << "}";
+            separator = ",";
+        }
+    }
+    out << "],\n   \"addressing_modes\": [";
+    separator = "";
+    for (int mode = 0; mode < ADDRESSING_MODE_COUNT; mode++) {
+        const Count count = getAddressingModeCount(static_cast<AddressingMode>(mode));
+        if (count.executions != 0) {
+            out << separator << "\n    {\"mode\": \"" << ADDRESSING_MODE_NAMES[mode]
+                << "\", \"count\": " << count.executions << ", \"cycles\": " << count.cycles << "}";
+            separator = ",";
+        }
+    }
+    out << "],\n   \"bus\": [";
+    separator = "";
+    for (const SystemBus::DeviceAccessCount &device : getBusAccessCounts()) {
+        out << separator << "\n    {\"device\": ";
+        writeJSONString(out, device.deviceType);
+        out << ", \"reads\": " << device.reads << ", \"writes\": " << device.writes << "}";
+        separator = ",";
+    }
+    out << "]}";
+}
@@ -0,0 +1,94 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPU65816STATS_H
+#define CPU65816STATS_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Cpu65816.hpp"
+
+/**
+ * Execution counts of one CPU.
+ *
+ * While started the CPU counts how many times it executes each opcode and the cycles
+ * they take, and its bus counts the accesses reaching each type of device, see
+ * SystemBus::setAccessCounting(). Addressing mode counts are the opcode ones summed up
+ * by OP_CODE_TABLE. Cycles spent entering interrupt handlers are nobody's, idle loop
+ * iterations counted over are not the branch's.
+ *
+ * When not started the CPU only tests a null pointer per instruction; when started it
+ * bumps two counters more, cheap enough to leave on for minutes. The counts belong to
+ * the thread running the CPU, read them when the CPU is not running.
+ */
+class Cpu65816Stats {
+    public:
+        static constexpr int OPCODE_COUNT = 256;
+        static constexpr int ADDRESSING_MODE_COUNT = static_cast<int>(AddressingMode::ProgramCounterRelativeLong) + 1;
+
+        struct Count {
+            uint64_t executions;
+            uint64_t cycles;
+        };
+
+        Cpu65816Stats(Cpu65816 &, const std::string &name);
+        ~Cpu65816Stats();
+
+        // Counts from zero
+        void start();
+        void stop();
+        bool isRunning() const { return mRunning; }
+        void clear();
+
+        const Count &getOpCodeCount(uint8_t code) const { return mOpCodes[code]; }
+        Count getAddressingModeCount(AddressingMode) const;
+        // Of the bus of the CPU, accesses made by any of its masters included
+        const std::vector<SystemBus::DeviceAccessCount> &getBusAccessCounts() const;
+        const std::string &getName() const { return mName; }
+
+        static const char *getAddressingModeName(AddressingMode);
+
+        // Rows of "rom,cpu,category,key,count,cycles", category one of opcode,
+        // addressing_mode, bus_read and bus_write. Rows counting nothing are left out.
+        static void writeCSVHeader(std::ostream &);
+        void writeCSV(std::ostream &, const std::string &romTitle) const;
+        // One object: {"rom", "cpu", "instructions", "cycles", "opcodes", "addressing_modes", "bus"}
+        void writeJSON(std::ostream &, const std::string &romTitle) const;
+
+    private:
+        friend class Cpu65816;
+
+        // Called by the CPU once it executed an opcode
+        void record(uint8_t code, uint64_t cycles) {
+            Count &count = mOpCodes[code];
+            count.executions++;
+            count.cycles += cycles;
+        }
+
+        Cpu65816 &mCpu;
+        std::string mName;
+        bool mRunning = false;
+
+        Count mOpCodes[OPCODE_COUNT] = {};
+};
+
+#endif // CPU65816STATS_H
@@ -0,0 +1,239 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Cpu65816Trace.hpp"
+
+#include <cstdio>
+#include <algorithm>
+
+static const char TRACE_MAGIC[4] = {'T', 'R', 'C', '1'};
+// Entry without its padding
+static const size_t ENTRY_SIZE = 30;
+
+Cpu65816Trace::Cpu65816Trace(Cpu65816 &cpu, const std::string &name) : mCpu(cpu), mName(name) {
+}
+
+Cpu65816Trace::~Cpu65816Trace() {
+    stop();
+}
+
+void Cpu65816Trace::start(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    mEntries.assign(size, Entry());
+    mMask = size - 1;
+    mRecorded = 0;
+    mRunning = true;
+    mCpu.mTrace = this;
+}
+
+void Cpu65816Trace::stop() {
+    if (mCpu.mTrace == this) {
+        mCpu.mTrace = nullptr;
+    }
+    mRunning = false;
+}
+
+void Cpu65816Trace::clear() {
+    mRecorded = 0;
+}
+
+std::vector<Cpu65816Trace::Entry> Cpu65816Trace::getEntries(size_t maxEntries) const {
+    uint64_t count = std::min<uint64_t>(mRecorded, mEntries.size());
+    if (maxEntries != 0 && count > maxEntries) {
+        count = maxEntries;
+    }
+    std::vector<Entry> entries;
+    entries.reserve(count);
+    for (uint64_t i = mRecorded - count; i < mRecorded; i++) {
+        entries.push_back(mEntries[i & mMask]);
+    }
+    return entries;
+}
+
+//=============================================================================
+// Binary format
+//=============================================================================
+
+static void put16(std::ostream &out, uint16_t value) {
+    const char bytes[2] = {static_cast<char>(value), static_cast<char>(value >> 8)};
+    out.write(bytes, 2);
+}
+
+static void put32(std::ostream &out, uint32_t value) {
+    put16(out, static_cast<uint16_t>(value));
+    put16(out, static_cast<uint16_t>(value >> 16));
+}
+
+static uint16_t get16(const uint8_t *data) {
+    return static_cast<uint16_t>(data[0] | (data[1] << 8));
+}
+
+static uint32_t get32(const uint8_t *data) {
+    return get16(data) | (static_cast<uint32_t>(get16(data + 2)) << 16);
+}
+
+static void writeEntry(std::ostream &out, const Cpu65816Trace::Entry &entry) {
+    put32(out, static_cast<uint32_t>(entry.cycle));
+    put32(out, static_cast<uint32_t>(entry.cycle >> 32));
+    put32(out, entry.address);
+    put16(out, entry.a);
+    put16(out, entry.x);
+    put16(out, entry.y);
+    put16(out, entry.stackPointer);
+    put16(out, entry.d);
+    const char bytes[8] = {
+        static_cast<char>(entry.code), static_cast<char>(entry.p), static_cast<char>(entry.db),
+        static_cast<char>(entry.flags), static_cast<char>(entry.operand[0]),
+        static_cast<char>(entry.operand[1]), static_cast<char>(entry.operand[2]), 0
+    };
+    out.write(bytes, sizeof(bytes));
+}
+
+static Cpu65816Trace::Entry readEntry(const uint8_t *data) {
+    Cpu65816Trace::Entry entry;
+    entry.cycle = get32(data) | (static_cast<uint64_t>(get32(data + 4)) << 32);
+    entry.address = get32(data + 8);
+    entry.a = get16(data + 12);
+    entry.x = get16(data + 14);
+    entry.y = get16(data + 16);
+    entry.stackPointer = get16(data + 18);
+    entry.d = get16(data + 20);
+    entry.code = data[22];
+    entry.p = data[23];
+    entry.db = data[24];
+    entry.flags = data[25];
+    entry.operand[0] = data[26];
+    entry.operand[1] = data[27];
+    entry.operand[2] = data[28];
+    entry.reserved = 0;
+    return entry;
+}
+
+void Cpu65816Trace::write(std::ostream &out) const {
+    const std::vector<Entry> entries = getEntries();
+    const size_t nameLength = std::min<size_t>(mName.size(), 255);
+    out.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    out.put(static_cast<char>(nameLength));
+    out.write(mName.data(), nameLength);
+    put32(out, static_cast<uint32_t>(entries.size()));
+    for (const Entry &entry : entries) {
+        writeEntry(out, entry);
+    }
+}
+
+bool Cpu65816Trace::read(std::istream &in, std::string &name, std::vector<Entry> &entries) {
+    char magic[sizeof(TRACE_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), TRACE_MAGIC)) {
+        return false;
+    }
+    const int nameLength = in.get();
+    if (nameLength < 0) {
+        return false;
+    }
+    name.resize(nameLength);
+    uint8_t count[4];
+    if (!in.read(&name[0], nameLength) || !in.read(reinterpret_cast<char *>(count), sizeof(count))) {
+        return false;
+    }
+
+    entries.clear();
+    uint8_t data[ENTRY_SIZE];
+    for (uint32_t i = get32(count); i > 0; i--) {
+        if (!in.read(reinterpret_cast<char *>(data), sizeof(data))) {
+            return false;
+        }
+        entries.push_back(readEntry(data));
+    }
+    return true;
+}
+
+//=============================================================================
+// Text format
+//=============================================================================
+
+/**
+ * Returns the number of bytes following the opcode.
+ */
+static int operandLength(uint8_t code, AddressingMode mode, bool accumulatorIs8BitWide, bool indexIs8BitWide) {
+    switch (code) {
+        case 0x09: case 0x29: case 0x49: case 0x69: // Immediate, accumulator wide
+        case 0x89: case 0xA9: case 0xC9: case 0xE9:
+            return accumulatorIs8BitWide ? 1 : 2;
+        case 0xA0: case 0xA2: case 0xC0: case 0xE0: // Immediate, index wide
+            return indexIs8BitWide ? 1 : 2;
+    }
+
+    switch (mode) {
+        case AddressingMode::Accumulator:
+        case AddressingMode::Implied:
+        case AddressingMode::StackImplied:
+            return 0;
+        case AddressingMode::Interrupt:
+        case AddressingMode::Immediate:
+        case AddressingMode::ProgramCounterRelative:
+        case AddressingMode::DirectPage:
+        case AddressingMode::DirectPageIndexedWithX:
+        case AddressingMode::DirectPageIndexedWithY:
+        case AddressingMode::DirectPageIndirect:
+        case AddressingMode::DirectPageIndirectLong:
+        case AddressingMode::DirectPageIndexedIndirectWithX:
+        case AddressingMode::DirectPageIndirectIndexedWithY:
+        case AddressingMode::DirectPageIndirectLongIndexedWithY:
+        case AddressingMode::StackRelative:
+        case AddressingMode::StackDirectPageIndirect:
+        case AddressingMode::StackRelativeIndirectIndexedWithY:
+            return 1;
+        case AddressingMode::AbsoluteLong:
+        case AddressingMode::AbsoluteLongIndexedWithX:
+            return 3;
+        default:
+            return 2;
+    }
+}
+
+std::string Cpu65816Trace::formatEntry(const Entry &entry) {
+    OpCode opCode = Cpu65816::OP_CODE_TABLE[entry.code];
+
+    char operand[16] = "";
+    if (entry.flags & OPERAND_VALID) {
+        const int length = operandLength(entry.code, opCode.getAddressingMode(),
+                                         entry.flags & ACCUMULATOR_8BIT, entry.flags & INDEX_8BIT);
+        const uint32_t value = entry.operand[0] | (entry.operand[1] << 8) | (entry.operand[2] << 16);
+        if (length > 0) {
+            std::snprintf(operand, sizeof(operand), "$%0*X", length * 2, value & ((1u << (length * 8)) - 1));
+        }
+    }
+
+    char text[128];
+    std::snprintf(text, sizeof(text),
+                  "%12llu %02X:%04X %02X %s %-8s A:%04X X:%04X Y:%04X S:%04X D:%04X DB:%02X P:%02X%s",
+                  static_cast<unsigned long long>(entry.cycle), (entry.address >> 16) & 0xFF,
+                  entry.address & 0xFFFF, entry.code, opCode.getName(), operand, entry.a, entry.x, entry.y,
+                  entry.stackPointer, entry.d, entry.db, entry.p, (entry.flags & EMULATION) ? " E" : "");
+    return text;
+}
+
+void Cpu65816Trace::writeText(std::ostream &out, size_t maxEntries) const {
+    for (const Entry &entry : getEntries(maxEntries)) {
+        out << mName << " " << formatEntry(entry) << "\n";
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPU65816TRACE_H
+#define CPU65816TRACE_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Cpu65816.hpp"
+
+/**
+ * Instruction trace of one CPU, kept in a ring buffer.
+ *
+ * While started the CPU records every instruction it is about to execute, with the
+ * registers before it, as a fixed size binary entry: the last getCapacity() ones are
+ * kept. Nothing is formatted while recording, the trace is written out in binary on
+ * demand (crash, breakpoint, API) and turned into text by formatEntry(), offline with
+ * the sano_trace tool or in process.
+ *
+ * When not started the CPU only tests a null pointer per instruction. The trace
+ * belongs to the thread running the CPU, read it when the CPU is not running.
+ */
+class Cpu65816Trace {
+    public:
+        static constexpr size_t DEFAULT_CAPACITY = 65536;
+
+        struct Entry {
+            uint64_t cycle;
+            // Address of the opcode, bank in bits 16-23
+            uint32_t address;
+            uint16_t a;
+            uint16_t x;
+            uint16_t y;
+            uint16_t stackPointer;
+            uint16_t d;
+            uint8_t code;
+            uint8_t p;
+            uint8_t db;
+            uint8_t flags;
+            // Bytes following the opcode, valid with OPERAND_VALID
+            uint8_t operand[3];
+            uint8_t reserved;
+        };
+        static_assert(sizeof(Entry) == 32, "Two entries per cache line");
+
+        // Entry::flags
+        static constexpr uint8_t EMULATION = 0x01;
+        static constexpr uint8_t ACCUMULATOR_8BIT = 0x02;
+        static constexpr uint8_t INDEX_8BIT = 0x04;
+        static constexpr uint8_t OPERAND_VALID = 0x08;
+
+        Cpu65816Trace(Cpu65816 &, const std::string &name);
+        ~Cpu65816Trace();
+
+        // Capacity rounded up to a power of two, previous entries are dropped
+        void start(size_t capacity = DEFAULT_CAPACITY);
+        void stop();
+        bool isRunning() const { return mRunning; }
+        void clear();
+
+        size_t getCapacity() const { return mEntries.size(); }
+        // Recorded since started, including the ones overwritten
+        uint64_t getRecordedCount() const { return mRecorded; }
+        const std::string &getName() const { return mName; }
+
+        // The last maxEntries entries (all kept ones for 0), oldest first
+        std::vector<Entry> getEntries(size_t maxEntries = 0) const;
+
+        // Binary block: "TRC1", name length (1 byte), name, entry count (4 bytes),
+        // entries of 30 bytes, fields in order. Little endian, blocks of several
+        // CPUs may follow each other.
+        void write(std::ostream &) const;
+        // One formatEntry() line per entry, oldest first
+        void writeText(std::ostream &, size_t maxEntries = 0) const;
+
+        // Reads the next block written by write(), false at the end or on bad data
+        static bool read(std::istream &, std::string &name, std::vector<Entry> &entries);
+        // "cycle PB:PC NAME operand A:.... X:.... Y:.... S:.... D:.... DB:.. P:.."
+        static std::string formatEntry(const Entry &);
+
+    private:
+        friend class Cpu65816;
+
+        // Called by the CPU with the opcode it fetched, before executing it
+        void record(uint8_t code) {
+            Entry &entry = mEntries[mRecorded++ & mMask];
+            entry.cycle = mCpu.mTotalCyclesCounter;
+            entry.address = mCpu.mProgramAddress.getFlat();
+            entry.a = mCpu.mA;
+            entry.x = mCpu.mX;
+            entry.y = mCpu.mY;
+            entry.stackPointer = mCpu.mStack.getStackPointer();
+            entry.d = mCpu.mD;
+            entry.code = code;
+            entry.p = mCpu.mCpuStatus.getRegisterValue();
+            entry.db = mCpu.mDB;
+            entry.flags = (mCpu.mCpuStatus.emulationFlag() ? EMULATION : 0) |
+                    (mCpu.mCpuStatus.accumulatorIs8BitWide() ? ACCUMULATOR_8BIT : 0) |
+                    (mCpu.mCpuStatus.indexIs8BitWide() ? INDEX_8BIT : 0) |
+                    (mCpu.mOperandDecoded ? OPERAND_VALID : 0);
+            // Only known from the block cache, reading the bus here could have side effects
+            entry.operand[0] = mCpu.mOperand[0];
+            entry.operand[1] = mCpu.mOperand[1];
+            entry.operand[2] = mCpu.mOperand[2];
+            entry.reserved = 0;
+        }
+
+        Cpu65816 &mCpu;
+        std::string mName;
+        bool mRunning = false;
+
+        std::vector<Entry> mEntries;
+        uint64_t mMask = 0;
+        uint64_t mRecorded = 0;
+};
+
+#endif // CPU65816TRACE_H
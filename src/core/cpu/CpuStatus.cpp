@@ -59,10 +59,12 @@ CpuStatus::CpuStatus() {
 }
 
 void CpuStatus::setZeroFlag() {
+    materializeSignAndZero();
     mZeroFlag = true;
 }
 
 void CpuStatus::setSignFlag() {
+    materializeSignAndZero();
     mSignFlag = true;
 }
 
@@ -76,10 +78,12 @@ void CpuStatus::setInterruptDisableFlag() {
 
 void CpuStatus::setAccumulatorWidthFlag() {
     mAccumulatorWidthFlag = true;
+    updateRegisterWidths();
 }
 
 void CpuStatus::setIndexWidthFlag() {
     mIndexWidthFlag = true;
+    updateRegisterWidths();
 }
 
 void CpuStatus::setCarryFlag() {
@@ -88,13 +92,16 @@ void CpuStatus::setCarryFlag() {
 
 void CpuStatus::setEmulationFlag() {
     mEmulationFlag = true;
+    updateRegisterWidths();
 }
 
 void CpuStatus::clearZeroFlag() {
+    materializeSignAndZero();
     mZeroFlag = false;
 }
 
 void CpuStatus::clearSignFlag() {
+    materializeSignAndZero();
     mSignFlag = false;
 }
 
@@ -108,10 +115,12 @@ void CpuStatus::clearInterruptDisableFlag() {
 
 void CpuStatus::clearAccumulatorWidthFlag() {
     mAccumulatorWidthFlag = false;
+    updateRegisterWidths();
 }
 
 void CpuStatus::clearIndexWidthFlag() {
     mIndexWidthFlag = false;
+    updateRegisterWidths();
 }
 
 void CpuStatus::clearCarryFlag() {
@@ -120,14 +129,7 @@ void CpuStatus::clearCarryFlag() {
 
 void CpuStatus::clearEmulationFlag() {
     mEmulationFlag = false;
-}
-
-bool CpuStatus::zeroFlag() {
-    return mZeroFlag;
-}
-
-bool CpuStatus::signFlag() {
-    return mSignFlag;
+    updateRegisterWidths();
 }
 
 bool CpuStatus::decimalFlag() {
@@ -178,6 +180,11 @@ bool CpuStatus::overflowFlag() {
     return mOverflowFlag;
 }
 
+void CpuStatus::updateRegisterWidths() {
+    mAccumulatorIs8BitWide = mEmulationFlag || mAccumulatorWidthFlag;
+    mIndexIs8BitWide = mEmulationFlag || mIndexWidthFlag;
+}
+
 uint8_t CpuStatus::getRegisterValue() {
     uint8_t value = 0;
     if (carryFlag())                                    value |= STATUS_CARRY;
@@ -224,6 +231,36 @@ void CpuStatus::setRegisterValue(uint8_t value) {
     else clearSignFlag();
 }
 
+uint16_t CpuStatus::getAllFlags() const {
+    uint16_t flags = 0;
+    if (mCarryFlag)                 flags |= 1 << 0;
+    if (zeroFlag())                 flags |= 1 << 1;
+    if (mInterruptDisableFlag)      flags |= 1 << 2;
+    if (mDecimalFlag)               flags |= 1 << 3;
+    if (mIndexWidthFlag)            flags |= 1 << 4;
+    if (mAccumulatorWidthFlag)      flags |= 1 << 5;
+    if (mOverflowFlag)              flags |= 1 << 6;
+    if (signFlag())                 flags |= 1 << 7;
+    if (mBreakFlag)                 flags |= 1 << 8;
+    if (mEmulationFlag)             flags |= 1 << 9;
+    return flags;
+}
+
+void CpuStatus::setAllFlags(uint16_t flags) {
+    mCarryFlag = (flags & (1 << 0)) != 0;
+    mZeroFlag = (flags & (1 << 1)) != 0;
+    mInterruptDisableFlag = (flags & (1 << 2)) != 0;
+    mDecimalFlag = (flags & (1 << 3)) != 0;
+    mIndexWidthFlag = (flags & (1 << 4)) != 0;
+    mAccumulatorWidthFlag = (flags & (1 << 5)) != 0;
+    mOverflowFlag = (flags & (1 << 6)) != 0;
+    mSignFlag = (flags & (1 << 7)) != 0;
+    mBreakFlag = (flags & (1 << 8)) != 0;
+    mEmulationFlag = (flags & (1 << 9)) != 0;
+    mSignAndZeroPending = false;
+    updateRegisterWidths();
+}
+
 void CpuStatus::updateZeroFlagFrom8BitValue(uint8_t value) {
     if (Binary::is8bitValueZero(value)) setZeroFlag();
     else clearZeroFlag();
@@ -244,12 +281,10 @@ void CpuStatus::updateSignFlagFrom16BitValue(uint16_t value) {
     else clearSignFlag();
 }
 
-void CpuStatus::updateSignAndZeroFlagFrom8BitValue(uint8_t value) {
-    updateSignFlagFrom8BitValue(value);
-    updateZeroFlagFrom8BitValue(value);
-}
-
-void CpuStatus::updateSignAndZeroFlagFrom16BitValue(uint16_t value) {
-    updateSignFlagFrom16BitValue(value);
-    updateZeroFlagFrom16BitValue(value);
+void CpuStatus::materializeSignAndZero() {
+    if (mSignAndZeroPending) {
+        mZeroFlag = mSignAndZeroResult == 0;
+        mSignFlag = (mSignAndZeroResult & mSignAndZeroSignBit) != 0;
+        mSignAndZeroPending = false;
+    }
 }
@@ -28,11 +28,15 @@ class CpuStatus {
     
         void setZeroFlag();
         void clearZeroFlag();
-        bool zeroFlag();
+        bool zeroFlag() const {
+            return mSignAndZeroPending ? mSignAndZeroResult == 0 : mZeroFlag;
+        }
         
         void setSignFlag();
         void clearSignFlag();
-        bool signFlag();
+        bool signFlag() const {
+            return mSignAndZeroPending ? (mSignAndZeroResult & mSignAndZeroSignBit) != 0 : mSignFlag;
+        }
         
         void setDecimalFlag();
         void clearDecimalFlag();
@@ -68,13 +72,34 @@ class CpuStatus {
         
         uint8_t getRegisterValue();
         void setRegisterValue(uint8_t);
+
+        // Every flag, e and b included, which the register value cannot hold
+        // all at once. Used by save states.
+        uint16_t getAllFlags() const;
+        void setAllFlags(uint16_t);
+
+        // Effective register widths, derived from the e, m and x flags.
+        // These are recomputed only when one of those flags changes so that
+        // the opcode handlers can query them with a single load.
+        bool accumulatorIs8BitWide() const { return mAccumulatorIs8BitWide; }
+        bool indexIs8BitWide() const { return mIndexIs8BitWide; }
         
         void updateZeroFlagFrom8BitValue(uint8_t);
         void updateZeroFlagFrom16BitValue(uint16_t);
         void updateSignFlagFrom8BitValue(uint8_t);
         void updateSignFlagFrom16BitValue(uint16_t);
-        void updateSignAndZeroFlagFrom8BitValue(uint8_t);
-        void updateSignAndZeroFlagFrom16BitValue(uint16_t);
+        // Most results are overwritten before anything looks at n and z, so these only
+        // remember the value. The flags get evaluated from it when read.
+        void updateSignAndZeroFlagFrom8BitValue(uint8_t value) {
+            mSignAndZeroResult = value;
+            mSignAndZeroSignBit = 0x80;
+            mSignAndZeroPending = true;
+        }
+        void updateSignAndZeroFlagFrom16BitValue(uint16_t value) {
+            mSignAndZeroResult = value;
+            mSignAndZeroSignBit = 0x8000;
+            mSignAndZeroPending = true;
+        }
     
     private:
         bool mZeroFlag = false;
@@ -87,6 +112,19 @@ class CpuStatus {
         bool mEmulationFlag = true; // CPU Starts in emulation mode
         bool mOverflowFlag = false;
         bool mBreakFlag = false;
+
+        // When pending, n and z describe mSignAndZeroResult rather than mSignFlag and mZeroFlag
+        bool mSignAndZeroPending = false;
+        uint16_t mSignAndZeroResult = 0;
+        uint16_t mSignAndZeroSignBit = 0x80;
+
+        void materializeSignAndZero();
+
+        // Always 8 bit in emulation mode, which is where the CPU starts.
+        bool mAccumulatorIs8BitWide = true;
+        bool mIndexIs8BitWide = true;
+
+        void updateRegisterWidths();
 };
 
 #endif // CPUSTATUS_H
@@ -0,0 +1,268 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "DecodedBlockCache.hpp"
+#include "Addressing.hpp"
+#include "OpCodeList.hpp"
+
+#define LOG_TAG "DecodedBlockCache"
+
+// Longest run of instructions kept in one block, short enough to span at most two pages
+#define MAX_BLOCK_INSTRUCTIONS          32
+// Past this many blocks the whole cache is dropped
+#define MAX_BLOCKS                      8192
+// Pages losing their code this many times are not decoded anymore
+#define MAX_PAGE_INVALIDATIONS          32
+// Where the interrupt vectors are, bank 0 page 0xFF
+#define VECTOR_PAGE                     0x00FF
+
+#define ADDRESSING_MODE_ENTRY(code, name, mode, executor) AddressingMode::mode,
+#define ADDRESSING_MODE_ENTRY_UNIMPLEMENTED(code, name, mode) AddressingMode::mode,
+
+static const AddressingMode ADDRESSING_MODES[] = {
+    OP_CODE_LIST(ADDRESSING_MODE_ENTRY, ADDRESSING_MODE_ENTRY_UNIMPLEMENTED)
+};
+
+DecodedBlockCache::DecodedBlockCache(SystemBus &systemBus) :
+        mSystemBus(systemBus),
+        mPageInvalidations(PAGE_COUNT, 0) {
+    mSystemBus.addCodeCache(this);
+}
+
+DecodedBlockCache::~DecodedBlockCache() {
+    clear();
+    mSystemBus.removeCodeCache(this);
+}
+
+/**
+ * Returns the number of bytes of the instruction, or 0 if the block has to end with it.
+ */
+uint8_t DecodedBlockCache::instructionLength(uint8_t code, bool accumulatorIs8BitWide, bool indexIs8BitWide) {
+    switch (code) {
+        case 0x20: case 0x22: case 0x4C: case 0x5C: // JSR, JSL, JMP, JML
+        case 0x6C: case 0x7C: case 0xDC: case 0xFC: // JMP, JMP, JML, JSR indirect
+        case 0x40: case 0x60: case 0x6B:            // RTI, RTS, RTL
+        case 0xC2: case 0xE2: case 0xFB: case 0x28: // REP, SEP, XCE, PLP change the widths
+        case 0x44: case 0x54:                       // MVP, MVN repeat themselves
+        case 0xCB: case 0xDB:                       // WAI, STP
+            return 0;
+        case 0x09: case 0x29: case 0x49: case 0x69: // Immediate, accumulator wide
+        case 0x89: case 0xA9: case 0xC9: case 0xE9:
+            return accumulatorIs8BitWide ? 2 : 3;
+        case 0xA0: case 0xA2: case 0xC0: case 0xE0: // Immediate, index wide
+            return indexIs8BitWide ? 2 : 3;
+        case 0x42:                                  // WDM, Implied with a signature byte
+            return 2;
+    }
+
+    switch (ADDRESSING_MODES[code]) {
+        case AddressingMode::Interrupt:
+        case AddressingMode::ProgramCounterRelative:
+        case AddressingMode::ProgramCounterRelativeLong:
+            return 0;
+        case AddressingMode::Accumulator:
+        case AddressingMode::Implied:
+        case AddressingMode::StackImplied:
+            return 1;
+        case AddressingMode::Immediate:
+        case AddressingMode::DirectPage:
+        case AddressingMode::DirectPageIndexedWithX:
+        case AddressingMode::DirectPageIndexedWithY:
+        case AddressingMode::DirectPageIndirect:
+        case AddressingMode::DirectPageIndirectLong:
+        case AddressingMode::DirectPageIndexedIndirectWithX:
+        case AddressingMode::DirectPageIndirectIndexedWithY:
+        case AddressingMode::DirectPageIndirectLongIndexedWithY:
+        case AddressingMode::StackRelative:
+        case AddressingMode::StackDirectPageIndirect:
+        case AddressingMode::StackRelativeIndirectIndexedWithY:
+            return 2;
+        case AddressingMode::AbsoluteLong:
+        case AddressingMode::AbsoluteLongIndexedWithX:
+            return 4;
+        default:
+            return 3;
+    }
+}
+
+const DecodedBlockCache::Block *DecodedBlockCache::lookup(const Address &address, bool accumulatorIs8BitWide,
+                                                          bool indexIs8BitWide, bool emulation) {
+    uint32_t key = address.getFlat() |
+            (accumulatorIs8BitWide ? 1 << 24 : 0) | (indexIs8BitWide ? 1 << 25 : 0) | (emulation ? 1 << 26 : 0);
+
+    auto found = mBlocks.find(key);
+    if (found != mBlocks.end()) {
+        return &found->second;
+    }
+
+    Block block;
+    block.accumulatorIs8BitWide = accumulatorIs8BitWide;
+    block.indexIs8BitWide = indexIs8BitWide;
+    block.emulation = emulation;
+    block.pageCount = 0;
+    block.successor = nullptr;
+    block.successorGeneration = 0;
+
+    Address instructionAddress = address;
+    while (block.instructions.size() < MAX_BLOCK_INSTRUCTIONS) {
+        uint16_t page = instructionAddress.getPage();
+        uint8_t offsetInPage = instructionAddress.getOffset() & 0xFF;
+        // Instructions straddling two pages are left to the bus
+        if (offsetInPage > PAGE_SIZE_BYTES - 4) break;
+        if (mPageInvalidations[page] >= MAX_PAGE_INVALIDATIONS) break;
+        const uint8_t *pointer = mSystemBus.getCodePagePointer(page);
+        if (pointer == nullptr) break;
+
+        if (block.pageCount == 0 || block.pages[block.pageCount - 1] != page) {
+            block.pages[block.pageCount++] = page;
+        }
+
+        Instruction instruction;
+        instruction.address = instructionAddress.getFlat();
+        instruction.code = pointer[offsetInPage];
+        instruction.operand[0] = pointer[offsetInPage + 1];
+        instruction.operand[1] = pointer[offsetInPage + 2];
+        instruction.operand[2] = pointer[offsetInPage + 3];
+        block.instructions.push_back(instruction);
+
+        uint8_t length = instructionLength(instruction.code, accumulatorIs8BitWide, indexIs8BitWide);
+        if (length == 0) break;
+        instructionAddress.incrementOffsetBy(length);
+        // Wrapping to the start of the bank would make the block span three pages
+        if (instructionAddress.getOffset() < length) break;
+    }
+
+    if (block.instructions.empty()) {
+        return nullptr;
+    }
+
+    if (mBlocks.size() >= MAX_BLOCKS) {
+        clear();
+    }
+
+    for (uint8_t i = 0; i < block.pageCount; i++) {
+        std::vector<uint32_t> &keys = mBlocksByPage[block.pages[i]];
+        if (keys.empty()) {
+            mSystemBus.watchCodePage(block.pages[i]);
+        }
+        keys.push_back(key);
+    }
+    return &mBlocks.emplace(key, std::move(block)).first->second;
+}
+
+void DecodedBlockCache::eraseBlock(uint32_t key) {
+    auto found = mBlocks.find(key);
+    if (found == mBlocks.end()) {
+        return;
+    }
+
+    const Block &block = found->second;
+    for (uint8_t i = 0; i < block.pageCount; i++) {
+        auto keys = mBlocksByPage.find(block.pages[i]);
+        keys->second.erase(std::find(keys->second.begin(), keys->second.end(), key));
+        if (keys->second.empty()) {
+            mBlocksByPage.erase(keys);
+            mSystemBus.unwatchCodePage(block.pages[i]);
+        }
+    }
+    mBlocks.erase(found);
+}
+
+void DecodedBlockCache::invalidatePage(uint16_t page) {
+    auto keys = mBlocksByPage.find(page);
+    if (keys == mBlocksByPage.end()) {
+        return;
+    }
+
+    if (mPageInvalidations[page] < MAX_PAGE_INVALIDATIONS) {
+        mPageInvalidations[page]++;
+    }
+    // eraseBlock() drops the list once it is empty
+    std::vector<uint32_t> keysToErase = keys->second;
+    for (uint32_t key : keysToErase) {
+        eraseBlock(key);
+    }
+    mGeneration++;
+}
+
+bool DecodedBlockCache::lookupVector(uint16_t address, uint16_t &vector) {
+    if (!mVectorsValid) {
+        const uint8_t *pointer = mSystemBus.getCodePagePointer(VECTOR_PAGE);
+        if (pointer == nullptr) {
+            return false;
+        }
+        std::memcpy(mVectorPage, pointer, PAGE_SIZE_BYTES);
+        mSystemBus.watchCodePage(VECTOR_PAGE);
+        mVectorsValid = true;
+    }
+    // The high byte of a vector at 0xFFFF would be at 0x0000, in another page
+    uint8_t offsetInPage = address & 0xFF;
+    if ((address >> 8) != (VECTOR_PAGE & 0xFF) || offsetInPage == 0xFF) {
+        return false;
+    }
+    vector = ((uint16_t)mVectorPage[offsetInPage + 1] << 8) | mVectorPage[offsetInPage];
+    return true;
+}
+
+void DecodedBlockCache::dropVectors() {
+    if (mVectorsValid) {
+        mVectorsValid = false;
+        mSystemBus.unwatchCodePage(VECTOR_PAGE);
+    }
+}
+
+void DecodedBlockCache::invalidatePages(uint16_t firstPage, uint16_t lastPage) {
+    if (firstPage <= VECTOR_PAGE && lastPage >= VECTOR_PAGE) {
+        dropVectors();
+    }
+    if (mBlocksByPage.empty()) {
+        return;
+    }
+
+    if ((uint32_t)(lastPage - firstPage) < mBlocksByPage.size()) {
+        for (uint32_t page = firstPage; page <= lastPage; page++) {
+            invalidatePage(static_cast<uint16_t>(page));
+        }
+        return;
+    }
+
+    // Wide ranges (remapping, reloading): only visit the pages holding code
+    std::vector<uint16_t> pages;
+    for (const auto &entry : mBlocksByPage) {
+        if (entry.first >= firstPage && entry.first <= lastPage) {
+            pages.push_back(entry.first);
+        }
+    }
+    for (uint16_t page : pages) {
+        invalidatePage(page);
+    }
+}
+
+void DecodedBlockCache::clear() {
+    dropVectors();
+    for (const auto &entry : mBlocksByPage) {
+        mSystemBus.unwatchCodePage(entry.first);
+    }
+    mBlocksByPage.clear();
+    mBlocks.clear();
+    mGeneration++;
+}
@@ -0,0 +1,104 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DECODED_BLOCK_CACHE_HPP
+#define DECODED_BLOCK_CACHE_HPP
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+#include "SystemBus.hpp"
+
+/**
+ * Caches runs of straight-line code, already fetched from the bus.
+ *
+ * A block starts at a given PB:PC and register widths (instruction lengths depend on them) and
+ * ends at the first instruction that may change the flow of execution or the widths.
+ * Only pages the bus reports as cacheable are decoded. While a page holds decoded code the bus
+ * routes its stores here, and the page is discarded when its contents change.
+ */
+class DecodedBlockCache {
+    public:
+        struct Instruction {
+            // Address of the opcode, bank in bits 16-23
+            uint32_t address;
+            uint8_t code;
+            // The three bytes following the opcode, whether the instruction uses them or not
+            uint8_t operand[3];
+        };
+
+        struct Block {
+            bool accumulatorIs8BitWide;
+            bool indexIs8BitWide;
+            bool emulation;
+            uint16_t pages[2];
+            uint8_t pageCount;
+            std::vector<Instruction> instructions;
+            // Block executed after this one the last time, valid while the generation is
+            // the one it was linked in
+            mutable const Block *successor;
+            mutable uint32_t successorGeneration;
+        };
+
+        DecodedBlockCache(SystemBus &);
+        ~DecodedBlockCache();
+
+        /**
+          Returns the block starting at the specified address for the specified widths, decoding it
+          if needed. Returns nullptr if the code at that address cannot be cached.
+          Any call to invalidatePages() or clear() may destroy returned blocks, compare
+          getGeneration() before reusing one.
+         */
+        const Block *lookup(const Address &, bool accumulatorIs8BitWide, bool indexIs8BitWide, bool emulation);
+
+        /**
+          Interrupt vectors, the word at the specified address of page 0x00FF. Read at once and kept
+          like code, false if that page cannot be cached: the vector has to be read from the bus.
+         */
+        bool lookupVector(uint16_t address, uint16_t &vector);
+
+        void invalidatePages(uint16_t firstPage, uint16_t lastPage);
+        void clear();
+
+        uint32_t getGeneration() const {
+            return mGeneration;
+        }
+
+    private:
+        SystemBus &mSystemBus;
+
+        std::unordered_map<uint32_t, Block> mBlocks;
+        // Keys of the blocks decoded from each page
+        std::unordered_map<uint16_t, std::vector<uint32_t>> mBlocksByPage;
+        // How many times each page lost its code, pages rewritten too often are left alone
+        std::vector<uint8_t> mPageInvalidations;
+        uint32_t mGeneration = 0;
+        // Page 0x00FF as last read for the vectors, while mVectorsValid the page is watched
+        uint8_t mVectorPage[PAGE_SIZE_BYTES];
+        bool mVectorsValid = false;
+        void dropVectors();
+
+        void eraseBlock(uint32_t key);
+        void invalidatePage(uint16_t page);
+
+        static uint8_t instructionLength(uint8_t code, bool accumulatorIs8BitWide, bool indexIs8BitWide);
+};
+
+#endif // DECODED_BLOCK_CACHE_HPP
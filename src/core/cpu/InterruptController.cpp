@@ -0,0 +1,72 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "InterruptController.hpp"
+
+void InterruptController::setSource(uint8_t source, bool pending) {
+    const uint32_t bit = 1u << (source % MAX_SOURCES);
+    mPending = pending ? (mPending | bit) : (mPending & ~bit);
+    update();
+}
+
+void InterruptController::setEnabled(uint8_t source, bool enabled) {
+    const uint32_t bit = 1u << (source % MAX_SOURCES);
+    mEnabled = enabled ? (mEnabled | bit) : (mEnabled & ~bit);
+    update();
+}
+
+void InterruptController::setAcknowledgedWhenTaken(uint8_t source, bool acknowledged) {
+    const uint32_t bit = 1u << (source % MAX_SOURCES);
+    mAcknowledgedWhenTaken = acknowledged ? (mAcknowledgedWhenTaken | bit) : (mAcknowledgedWhenTaken & ~bit);
+}
+
+void InterruptController::setNMILine(bool level) {
+    if (level && !mNMILine) {
+        mNMILatched = true;
+    }
+    mNMILine = level;
+    update();
+}
+
+void InterruptController::setABORT(bool pending) {
+    mABORTLatched = pending;
+    update();
+}
+
+void InterruptController::onIRQTaken() {
+    mPending &= ~(mAcknowledgedWhenTaken & mEnabled);
+    update();
+}
+
+void InterruptController::onNMITaken() {
+    mNMILatched = false;
+    update();
+}
+
+void InterruptController::onABORTTaken() {
+    mABORTLatched = false;
+    update();
+}
+
+void InterruptController::restore(uint32_t pendingSources, bool nmiLatched, bool abortLatched) {
+    mPending = pendingSources;
+    mNMILatched = nmiLatched;
+    mABORTLatched = abortLatched;
+    update();
+}
@@ -0,0 +1,93 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INTERRUPT_CONTROLLER_HPP
+#define INTERRUPT_CONTROLLER_HPP
+
+#include <stdint.h>
+
+/**
+ * Interrupt requests of one CPU.
+ *
+ * IRQ sources are numbered by whoever wires the devices, one bit each, 0 being the CPU's own
+ * IRQ pin. The IRQ line is asserted while any enabled source is pending: devices raise their
+ * source and lower it once acknowledged through their own registers. Sources without such a
+ * register can be acknowledged by the CPU taking the IRQ instead.
+ * NMI is edge triggered, latched on a rising edge and cleared once taken. ABORT is latched
+ * until taken.
+ *
+ * All of it is folded into getRequests(), a single word the CPU tests before each instruction.
+ */
+class InterruptController {
+    public:
+        static const uint8_t PIN_SOURCE = 0;
+        static const uint8_t MAX_SOURCES = 32;
+
+        // getRequests() bits
+        static const uint8_t IRQ = 0x01;
+        static const uint8_t NMI = 0x02;
+        static const uint8_t ABORT = 0x04;
+
+        void setSource(uint8_t source, bool pending);
+        void raise(uint8_t source) { setSource(source, true); }
+        void lower(uint8_t source) { setSource(source, false); }
+        // All sources are enabled by default
+        void setEnabled(uint8_t source, bool enabled);
+        // Cleared by the CPU taking the IRQ rather than by the device
+        void setAcknowledgedWhenTaken(uint8_t source, bool acknowledged);
+
+        void setNMILine(bool level);
+        void setABORT(bool pending);
+
+        uint8_t getRequests() const {
+            return mRequests;
+        }
+        uint32_t getPendingSources() const {
+            return mPending;
+        }
+        bool isNMILine() const {
+            return mNMILine;
+        }
+
+        // By the CPU as it enters the handlers
+        void onIRQTaken();
+        void onNMITaken();
+        void onABORTTaken();
+
+        // Pending sources and latches, as saved in save states. What is enabled and
+        // acknowledged when is wiring, not state.
+        void restore(uint32_t pendingSources, bool nmiLatched, bool abortLatched);
+        void reset() { restore(0, false, false); mNMILine = false; }
+
+    private:
+        uint32_t mPending = 0;
+        uint32_t mEnabled = 0xFFFFFFFF;
+        uint32_t mAcknowledgedWhenTaken = 0;
+        bool mNMILine = false;
+        bool mNMILatched = false;
+        bool mABORTLatched = false;
+        uint8_t mRequests = 0;
+
+        void update() {
+            mRequests = ((mPending & mEnabled) != 0 ? IRQ : 0) | (mNMILatched ? NMI : 0) |
+                        (mABORTLatched ? ABORT : 0);
+        }
+};
+
+#endif // INTERRUPT_CONTROLLER_HPP
@@ -1,122 +1,193 @@
 #ifndef LOG_HPP
 #define LOG_HPP
 
-#include <iostream>
-#include <iomanip>
-#include <sstream>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <string>
 
-// Chainable logging class matching Lib65816's Log API
-class Log {
-private:
-    std::ostringstream buffer;
-    std::ostream* output;
-    
+// Log levels, most important first
+enum class LogLevel : int {
+    Error = 0,
+    Warning = 1,
+    Info = 2,
+    Debug = 3,
+    Trace = 4
+};
+
+// Lines above this level compile to nothing: only up to Info in release
+// builds, everything otherwise. May be set by the build (0 = errors only).
+#ifndef LOG_COMPILED_LEVEL
+#ifdef NDEBUG
+#define LOG_COMPILED_LEVEL 2
+#else
+#define LOG_COMPILED_LEVEL 4
+#endif
+#endif
+
+constexpr bool isLogLevelCompiled(LogLevel level) {
+    return static_cast<int>(level) <= LOG_COMPILED_LEVEL;
+}
+
+// One log line, formatted into a fixed buffer and written out with a single
+// call on show(), nothing is allocated. A line below the run time level is
+// not formatted at all.
+template <bool Compiled>
+class LogLine {
 public:
-    Log() : output(&std::cout) {}
-    
-    Log(std::ostream& os) : output(&os) {}
-    
-    // Reset for reuse
-    void reset(std::ostream& os) {
-        buffer.str("");
-        buffer.clear();
-        output = &os;
-    }
-    
-    // Add string
-    Log& str(const std::string& s) {
-        buffer << s;
+    LogLine(FILE* output, bool enabled) : output(enabled ? output : nullptr), length(0) {}
+
+    LogLine& str(const char* s) {
+        if (output) {
+            append(s, std::strlen(s));
+        }
         return *this;
     }
-    
-    Log& str(const char* s) {
-        buffer << s;
+
+    LogLine& str(const std::string& s) {
+        if (output) {
+            append(s.data(), s.size());
+        }
         return *this;
     }
-    
+
     // Add space
-    Log& sp() {
-        buffer << " ";
-        return *this;
+    LogLine& sp() {
+        return str(" ");
     }
-    
+
     // Add hex value with optional width
-    Log& hex(uint32_t value, int width = 0) {
-        buffer << "0x" << std::hex << std::uppercase << std::setfill('0');
-        if (width > 0) {
-            buffer << std::setw(width);
+    LogLine& hex(uint32_t value, int width = 0) {
+        if (output) {
+            char digits[16];
+            int count = std::snprintf(digits, sizeof(digits), "0x%0*X", width, value);
+            append(digits, static_cast<size_t>(count));
         }
-        buffer << value << std::dec;
         return *this;
     }
-    
+
     // Add decimal number
-    Log& num(int value) {
-        buffer << value;
+    LogLine& num(long long value) {
+        if (output) {
+            char digits[24];
+            int count = std::snprintf(digits, sizeof(digits), "%lld", value);
+            append(digits, static_cast<size_t>(count));
+        }
         return *this;
     }
-    
+
     // Actually output the log
     void show() {
         if (output) {
-            *output << buffer.str() << std::endl;
+            buffer[length++] = '\n';
+            std::fwrite(buffer, 1, length, output);
+            output = nullptr;
+        }
+    }
+
+private:
+    static constexpr size_t CAPACITY = 256;
+
+    FILE* output;
+    size_t length;
+    char buffer[CAPACITY];
+
+    // Long lines are cut, room is kept for the newline
+    void append(const char* text, size_t count) {
+        size_t room = CAPACITY - 1 - length;
+        if (count > room) {
+            count = room;
         }
-        buffer.str("");
-        buffer.clear();
-    }
-    
-    // Static methods for each log level - return references to static instances
-    static Log& err(const std::string& tag) {
-        static thread_local Log instance;
-        instance.reset(std::cerr);
-        instance.str("[ERROR][").str(tag).str("] ");
-        return instance;
-    }
-    
-    static Log& wrn(const std::string& tag) {
-        static thread_local Log instance;
-        instance.reset(std::cout);
-        instance.str("[WARN][").str(tag).str("] ");
-        return instance;
-    }
-    
-    static Log& inf(const std::string& tag) {
-        static thread_local Log instance;
-        instance.reset(std::cout);
-        instance.str("[INFO][").str(tag).str("] ");
-        return instance;
-    }
-    
-    static Log& dbg(const std::string& tag) {
-        static thread_local Log instance;
-        instance.reset(std::cout);
-        instance.str("[DEBUG][").str(tag).str("] ");
-        return instance;
-    }
-    
-    static Log& trc(const std::string& tag) {
-        static thread_local Log instance;
-        instance.reset(std::cout);
-        instance.str("[TRACE][").str(tag).str("] ");
-        return instance;
-    }
-    
+        std::memcpy(buffer + length, text, count);
+        length += count;
+    }
+};
+
+// Level compiled out, every call is inlined away
+template <>
+class LogLine<false> {
+public:
+    LogLine(FILE*, bool) {}
+    LogLine& str(const char*) { return *this; }
+    LogLine& str(const std::string&) { return *this; }
+    LogLine& sp() { return *this; }
+    LogLine& hex(uint32_t, int = 0) { return *this; }
+    LogLine& num(long long) { return *this; }
+    void show() {}
+};
+
+// Chainable logging class matching Lib65816's Log API:
+//     Log::dbg(LOG_TAG).str("value").sp().hex(value, 4).show();
+// Arguments are still evaluated for lines compiled out, guard expensive ones
+// with Log::isEnabled().
+class Log {
+public:
+    // Lines up to this level are written, Info by default. Any thread.
+    static void setLevel(LogLevel level) {
+        runtimeLevel().store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+    static LogLevel getLevel() {
+        return static_cast<LogLevel>(runtimeLevel().load(std::memory_order_relaxed));
+    }
+
+    static bool isEnabled(LogLevel level) {
+        return isLogLevelCompiled(level) && static_cast<int>(level) <= runtimeLevel().load(std::memory_order_relaxed);
+    }
+
+    static LogLine<isLogLevelCompiled(LogLevel::Error)> err(const char* tag) {
+        return start<isLogLevelCompiled(LogLevel::Error)>(LogLevel::Error, stderr, "[ERROR][", tag);
+    }
+
+    static LogLine<isLogLevelCompiled(LogLevel::Warning)> wrn(const char* tag) {
+        return start<isLogLevelCompiled(LogLevel::Warning)>(LogLevel::Warning, stdout, "[WARN][", tag);
+    }
+
+    static LogLine<isLogLevelCompiled(LogLevel::Info)> inf(const char* tag) {
+        return start<isLogLevelCompiled(LogLevel::Info)>(LogLevel::Info, stdout, "[INFO][", tag);
+    }
+
+    static LogLine<isLogLevelCompiled(LogLevel::Debug)> dbg(const char* tag) {
+        return start<isLogLevelCompiled(LogLevel::Debug)>(LogLevel::Debug, stdout, "[DEBUG][", tag);
+    }
+
+    static LogLine<isLogLevelCompiled(LogLevel::Trace)> trc(const char* tag) {
+        return start<isLogLevelCompiled(LogLevel::Trace)>(LogLevel::Trace, stdout, "[TRACE][", tag);
+    }
+
     // Simple non-chainable helpers
     static void info(const std::string& msg) {
-        std::cout << "[INFO] " << msg << std::endl;
+        start<isLogLevelCompiled(LogLevel::Info)>(LogLevel::Info, stdout, "[INFO", nullptr).str(msg).show();
     }
-    
+
     static void debug(const std::string& msg) {
-        std::cout << "[DEBUG] " << msg << std::endl;
+        start<isLogLevelCompiled(LogLevel::Debug)>(LogLevel::Debug, stdout, "[DEBUG", nullptr).str(msg).show();
     }
-    
+
     static void warning(const std::string& msg) {
-        std::cout << "[WARNING] " << msg << std::endl;
+        start<isLogLevelCompiled(LogLevel::Warning)>(LogLevel::Warning, stdout, "[WARNING", nullptr).str(msg).show();
     }
-    
+
     static void error(const std::string& msg) {
-        std::cerr << "[ERROR] " << msg << std::endl;
+        start<isLogLevelCompiled(LogLevel::Error)>(LogLevel::Error, stderr, "[ERROR", nullptr).str(msg).show();
+    }
+
+private:
+    static std::atomic<int>& runtimeLevel() {
+        static std::atomic<int> level(static_cast<int>(LogLevel::Info));
+        return level;
+    }
+
+    // "[LEVEL][tag] ", or "[LEVEL] " without a tag
+    template <bool Compiled>
+    static LogLine<Compiled> start(LogLevel level, FILE* output, const char* prefix, const char* tag) {
+        LogLine<Compiled> line(output, isEnabled(level));
+        line.str(prefix);
+        if (tag) {
+            line.str(tag);
+        }
+        line.str("] ");
+        return line;
     }
 };
 
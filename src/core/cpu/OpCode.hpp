@@ -31,33 +31,32 @@ class OpCode {
         uint8_t mCode;
         const char * const mName;
         AddressingMode mAddressingMode;
-        void (Cpu65816::*mExecutor)(OpCode &);
+        void (Cpu65816::*mExecutor)(const OpCode &);
 
     public:
         OpCode(uint8_t code, const char * const name, const AddressingMode &addressingMode) :
             mCode(code), mName(name), mAddressingMode(addressingMode), mExecutor(0) {
         }
 
-        OpCode(uint8_t code, const char * const name, const AddressingMode &addressingMode, void (Cpu65816::*executor)(OpCode &)) :
+        OpCode(uint8_t code, const char * const name, const AddressingMode &addressingMode, void (Cpu65816::*executor)(const OpCode &)) :
             mCode(code), mName(name), mAddressingMode(addressingMode), mExecutor(executor) {
         }
 
-        const uint8_t getCode() {
+        const uint8_t getCode() const {
             return mCode;
         }
 
-        const char *getName() {
+        const char *getName() const {
             return mName;
         }
 
-        const AddressingMode getAddressingMode() {
+        const AddressingMode getAddressingMode() const {
             return mAddressingMode;
         }
 
-        const bool execute(Cpu65816 &cpu) {
+        const bool execute(Cpu65816 &cpu) const {
             if (mExecutor != 0) {
-                OpCode opCode = *this;
-                (cpu.*mExecutor)(opCode);
+                (cpu.*mExecutor)(*this);
                 return true;
             }
             return false;
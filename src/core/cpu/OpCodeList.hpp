@@ -0,0 +1,290 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPCODE_LIST_HPP
+#define OPCODE_LIST_HPP
+
+/**
+ * The complete 65816 instruction set, one entry per OpCode:
+ *
+ *  X(code, name, addressing mode, executor) for implemented OpCodes
+ *  U(code, name, addressing mode) for OpCodes without an executor
+ *
+ * Expanded by OpCodeTable.cpp to build OP_CODE_TABLE and by OpCodeDispatch.cpp
+ * to build the dispatch switch, so that the two can never disagree.
+ */
+#define OP_CODE_LIST(X, U) \
+    X(0x00, "BRK", Interrupt,                             executeInterrupt) \
+    X(0x01, "ORA", DirectPageIndexedIndirectWithX,        executeORA) \
+    X(0x02, "COP", Interrupt,                             executeInterrupt) \
+    X(0x03, "ORA", StackRelative,                         executeORA) \
+    X(0x04, "TSB", DirectPage,                            executeTSBTRB) \
+    X(0x05, "ORA", DirectPage,                            executeORA) \
+    X(0x06, "ASL", DirectPage,                            executeASL) \
+    X(0x07, "ORA", DirectPageIndirectLong,                executeORA) \
+    X(0x08, "PHP", StackImplied,                          executeStack) \
+    X(0x09, "ORA", Immediate,                             executeORA) \
+    X(0x0A, "ASL", Accumulator,                           executeASL) \
+    X(0x0B, "PHD", StackImplied,                          executeStack) \
+    X(0x0C, "TSB", Absolute,                              executeTSBTRB) \
+    X(0x0D, "ORA", Absolute,                              executeORA) \
+    X(0x0E, "ASL", Absolute,                              executeASL) \
+    X(0x0F, "ORA", AbsoluteLong,                          executeORA) \
+    X(0x10, "BPL", ProgramCounterRelative,                executeBranch) \
+    X(0x11, "ORA", DirectPageIndirectIndexedWithY,        executeORA) \
+    X(0x12, "ORA", DirectPageIndirect,                    executeORA) \
+    X(0x13, "ORA", StackRelativeIndirectIndexedWithY,     executeORA) \
+    X(0x14, "TRB", DirectPage,                            executeTSBTRB) \
+    X(0x15, "ORA", DirectPageIndexedWithX,                executeORA) \
+    X(0x16, "ASL", DirectPageIndexedWithX,                executeASL) \
+    X(0x17, "ORA", DirectPageIndirectLongIndexedWithY,    executeORA) \
+    X(0x18, "CLC", Implied,                               executeStatusReg) \
+    X(0x19, "ORA", AbsoluteIndexedWithY,                  executeORA) \
+    X(0x1A, "INC", Accumulator,                           executeINCDEC) \
+    X(0x1B, "TCS", Implied,                               executeTransfer) \
+    X(0x1C, "TRB", Absolute,                              executeTSBTRB) \
+    X(0x1D, "ORA", AbsoluteIndexedWithX,                  executeORA) \
+    X(0x1E, "ASL", AbsoluteIndexedWithX,                  executeASL) \
+    X(0x1F, "ORA", AbsoluteLongIndexedWithX,              executeORA) \
+    X(0x20, "JSR", Absolute,                              executeJumpReturn) \
+    X(0x21, "AND", DirectPageIndexedIndirectWithX,        executeAND) \
+    X(0x22, "JSR", AbsoluteLong,                          executeJumpReturn) \
+    X(0x23, "AND", StackRelative,                         executeAND) \
+    X(0x24, "BIT", DirectPage,                            executeBIT) \
+    X(0x25, "AND", DirectPage,                            executeAND) \
+    X(0x26, "ROL", DirectPage,                            executeROL) \
+    X(0x27, "AND", DirectPageIndirectLong,                executeAND) \
+    X(0x28, "PLP", StackImplied,                          executeStack) \
+    X(0x29, "AND", Immediate,                             executeAND) \
+    X(0x2A, "ROL", Accumulator,                           executeROL) \
+    X(0x2B, "PLD", StackImplied,                          executeStack) \
+    X(0x2C, "BIT", Absolute,                              executeBIT) \
+    X(0x2D, "AND", Absolute,                              executeAND) \
+    X(0x2E, "ROL", Absolute,                              executeROL) \
+    X(0x2F, "AND", AbsoluteLong,                          executeAND) \
+    X(0x30, "BMI", ProgramCounterRelative,                executeBranch) \
+    X(0x31, "AND", DirectPageIndirectIndexedWithY,        executeAND) \
+    X(0x32, "AND", DirectPageIndirect,                    executeAND) \
+    X(0x33, "AND", StackRelativeIndirectIndexedWithY,     executeAND) \
+    X(0x34, "BIT", DirectPageIndexedWithX,                executeBIT) \
+    X(0x35, "AND", DirectPageIndexedWithX,                executeAND) \
+    X(0x36, "ROL", DirectPageIndexedWithX,                executeROL) \
+    X(0x37, "AND", DirectPageIndirectLongIndexedWithY,    executeAND) \
+    X(0x38, "SEC", Implied,                               executeStatusReg) \
+    X(0x39, "AND", AbsoluteIndexedWithY,                  executeAND) \
+    X(0x3A, "DEC", Accumulator,                           executeINCDEC) \
+    X(0x3B, "TSC", Implied,                               executeTransfer) \
+    X(0x3C, "BIT", AbsoluteIndexedWithX,                  executeBIT) \
+    X(0x3D, "AND", AbsoluteIndexedWithX,                  executeAND) \
+    X(0x3E, "ROL", AbsoluteIndexedWithX,                  executeROL) \
+    X(0x3F, "AND", AbsoluteLongIndexedWithX,              executeAND) \
+    X(0x40, "RTI", StackImplied,                          executeInterrupt) \
+    X(0x41, "EOR", DirectPageIndexedIndirectWithX,        executeEOR) \
+    X(0x42, "WDM", Implied,                               executeMisc) \
+    X(0x43, "EOR", StackRelative,                         executeEOR) \
+    X(0x44, "MVP", BlockMove,                             executeMisc) \
+    X(0x45, "EOR", DirectPage,                            executeEOR) \
+    X(0x46, "LSR", DirectPage,                            executeLSR) \
+    X(0x47, "EOR", DirectPageIndirectLong,                executeEOR) \
+    X(0x48, "PHA", StackImplied,                          executeStack) \
+    X(0x49, "EOR", Immediate,                             executeEOR) \
+    X(0x4A, "LSR", Accumulator,                           executeLSR) \
+    X(0x4B, "PHK", StackImplied,                          executeStack) \
+    X(0x4C, "JMP", Absolute,                              executeJumpReturn) \
+    X(0x4D, "EOR", Absolute,                              executeEOR) \
+    X(0x4E, "LSR", Absolute,                              executeLSR) \
+    X(0x4F, "EOR", AbsoluteLong,                          executeEOR) \
+    X(0x50, "BVC", ProgramCounterRelative,                executeBranch) \
+    X(0x51, "EOR", DirectPageIndirectIndexedWithY,        executeEOR) \
+    X(0x52, "EOR", DirectPageIndirect,                    executeEOR) \
+    X(0x53, "EOR", StackRelativeIndirectIndexedWithY,     executeEOR) \
+    X(0x54, "MVN", BlockMove,                             executeMisc) \
+    X(0x55, "EOR", DirectPageIndexedWithX,                executeEOR) \
+    X(0x56, "LSR", DirectPageIndexedWithX,                executeLSR) \
+    X(0x57, "EOR", DirectPageIndirectLongIndexedWithY,    executeEOR) \
+    X(0x58, "CLI", Implied,                               executeStatusReg) \
+    X(0x59, "EOR", AbsoluteIndexedWithY,                  executeEOR) \
+    X(0x5A, "PHY", StackImplied,                          executeStack) \
+    X(0x5B, "TCD", Implied,                               executeTransfer) \
+    X(0x5C, "JMP", AbsoluteLong,                          executeJumpReturn) \
+    X(0x5D, "EOR", AbsoluteIndexedWithX,                  executeEOR) \
+    X(0x5E, "LSR", AbsoluteIndexedWithX,                  executeLSR) \
+    X(0x5F, "EOR", AbsoluteLongIndexedWithX,              executeEOR) \
+    X(0x60, "RTS", StackImplied,                          executeJumpReturn) \
+    X(0x61, "ADC", DirectPageIndexedIndirectWithX,        executeADC) \
+    X(0x62, "PER", StackProgramCounterRelativeLong,       executeStack) \
+    X(0x63, "ADC", StackRelative,                         executeADC) \
+    X(0x64, "STZ", DirectPage,                            executeSTZ) \
+    X(0x65, "ADC", DirectPage,                            executeADC) \
+    X(0x66, "ROR", DirectPage,                            executeROR) \
+    X(0x67, "ADC", DirectPageIndirectLong,                executeADC) \
+    X(0x68, "PLA", StackImplied,                          executeStack) \
+    X(0x69, "ADC", Immediate,                             executeADC) \
+    X(0x6A, "ROR", Accumulator,                           executeROR) \
+    X(0x6B, "RTL", StackImplied,                          executeJumpReturn) \
+    X(0x6C, "JMP", AbsoluteIndirect,                      executeJumpReturn) \
+    X(0x6D, "ADC", Absolute,                              executeADC) \
+    X(0x6E, "ROR", Absolute,                              executeROR) \
+    X(0x6F, "ADC", AbsoluteLong,                          executeADC) \
+    X(0x70, "BVS", ProgramCounterRelative,                executeBranch) \
+    X(0x71, "ADC", DirectPageIndirectIndexedWithY,        executeADC) \
+    X(0x72, "ADC", DirectPageIndirect,                    executeADC) \
+    X(0x73, "ADC", StackRelativeIndirectIndexedWithY,     executeADC) \
+    X(0x74, "STZ", DirectPageIndexedWithX,                executeSTZ) \
+    X(0x75, "ADC", DirectPageIndexedWithX,                executeADC) \
+    X(0x76, "ROR", DirectPageIndexedWithX,                executeROR) \
+    X(0x77, "ADC", DirectPageIndirectLongIndexedWithY,    executeADC) \
+    X(0x78, "SEI", Implied,                               executeStatusReg) \
+    X(0x79, "ADC", AbsoluteIndexedWithY,                  executeADC) \
+    X(0x7A, "PLY", StackImplied,                          executeStack) \
+    X(0x7B, "TDC", Implied,                               executeTransfer) \
+    X(0x7C, "JMP", AbsoluteIndexedIndirectWithX,          executeJumpReturn) \
+    X(0x7D, "ADC", AbsoluteIndexedWithX,                  executeADC) \
+    X(0x7E, "ROR", AbsoluteIndexedWithX,                  executeROR) \
+    X(0x7F, "ADC", AbsoluteLongIndexedWithX,              executeADC) \
+    X(0x80, "BRA", ProgramCounterRelative,                executeBranch) \
+    X(0x81, "STA", DirectPageIndexedIndirectWithX,        executeSTA) \
+    X(0x82, "BRL", ProgramCounterRelativeLong,            executeBranch) \
+    X(0x83, "STA", StackRelative,                         executeSTA) \
+    X(0x84, "STY", DirectPage,                            executeSTY) \
+    X(0x85, "STA", DirectPage,                            executeSTA) \
+    X(0x86, "STX", DirectPage,                            executeSTX) \
+    X(0x87, "STA", DirectPageIndirectLong,                executeSTA) \
+    X(0x88, "DEY", Implied,                               executeINCDEC) \
+    X(0x89, "BIT", Immediate,                             executeBIT) \
+    X(0x8A, "TXA", Implied,                               executeTransfer) \
+    X(0x8B, "PHB", StackImplied,                          executeStack) \
+    X(0x8C, "STY", Absolute,                              executeSTY) \
+    X(0x8D, "STA", Absolute,                              executeSTA) \
+    X(0x8E, "STX", Absolute,                              executeSTX) \
+    X(0x8F, "STA", AbsoluteLong,                          executeSTA) \
+    X(0x90, "BCC", ProgramCounterRelative,                executeBranch) \
+    X(0x91, "STA", DirectPageIndirectIndexedWithY,        executeSTA) \
+    X(0x92, "STA", DirectPageIndirect,                    executeSTA) \
+    X(0x93, "STA", StackRelativeIndirectIndexedWithY,     executeSTA) \
+    X(0x94, "STY", DirectPageIndexedWithX,                executeSTY) \
+    X(0x95, "STA", DirectPageIndexedWithX,                executeSTA) \
+    X(0x96, "STX", DirectPageIndexedWithY,                executeSTX) \
+    X(0x97, "STA", DirectPageIndirectLongIndexedWithY,    executeSTA) \
+    X(0x98, "TYA", Implied,                               executeTransfer) \
+    X(0x99, "STA", AbsoluteIndexedWithY,                  executeSTA) \
+    X(0x9A, "TXS", Implied,                               executeTransfer) \
+    X(0x9B, "TXY", Implied,                               executeTransfer) \
+    X(0x9C, "STZ", Absolute,                              executeSTZ) \
+    X(0x9D, "STA", AbsoluteIndexedWithX,                  executeSTA) \
+    X(0x9E, "STZ", AbsoluteIndexedWithX,                  executeSTZ) \
+    X(0x9F, "STA", AbsoluteLongIndexedWithX,              executeSTA) \
+    X(0xA0, "LDY", Immediate,                             executeLDY) \
+    X(0xA1, "LDA", DirectPageIndexedIndirectWithX,        executeLDA) \
+    X(0xA2, "LDX", Immediate,                             executeLDX) \
+    X(0xA3, "LDA", StackRelative,                         executeLDA) \
+    X(0xA4, "LDY", DirectPage,                            executeLDY) \
+    X(0xA5, "LDA", DirectPage,                            executeLDA) \
+    X(0xA6, "LDX", DirectPage,                            executeLDX) \
+    X(0xA7, "LDA", DirectPageIndirectLong,                executeLDA) \
+    X(0xA8, "TAY", Implied,                               executeTransfer) \
+    X(0xA9, "LDA", Immediate,                             executeLDA) \
+    X(0xAA, "TAX", Implied,                               executeTransfer) \
+    X(0xAB, "PLB", StackImplied,                          executeStack) \
+    X(0xAC, "LDY", Absolute,                              executeLDY) \
+    X(0xAD, "LDA", Absolute,                              executeLDA) \
+    X(0xAE, "LDX", Absolute,                              executeLDX) \
+    X(0xAF, "LDA", AbsoluteLong,                          executeLDA) \
+    X(0xB0, "BCS", ProgramCounterRelative,                executeBranch) \
+    X(0xB1, "LDA", DirectPageIndirectIndexedWithY,        executeLDA) \
+    X(0xB2, "LDA", DirectPageIndirect,                    executeLDA) \
+    X(0xB3, "LDA", StackRelativeIndirectIndexedWithY,     executeLDA) \
+    X(0xB4, "LDY", DirectPageIndexedWithX,                executeLDY) \
+    X(0xB5, "LDA", DirectPageIndexedWithX,                executeLDA) \
+    X(0xB6, "LDX", DirectPageIndexedWithY,                executeLDX) \
+    X(0xB7, "LDA", DirectPageIndirectLongIndexedWithY,    executeLDA) \
+    X(0xB8, "CLV", Implied,                               executeStatusReg) \
+    X(0xB9, "LDA", AbsoluteIndexedWithY,                  executeLDA) \
+    X(0xBA, "TSX", Implied,                               executeTransfer) \
+    X(0xBB, "TYX", Implied,                               executeTransfer) \
+    X(0xBC, "LDY", AbsoluteIndexedWithX,                  executeLDY) \
+    X(0xBD, "LDA", AbsoluteIndexedWithX,                  executeLDA) \
+    X(0xBE, "LDX", AbsoluteIndexedWithY,                  executeLDX) \
+    X(0xBF, "LDA", AbsoluteLongIndexedWithX,              executeLDA) \
+    X(0xC0, "CPY", Immediate,                             executeCPXCPY) \
+    X(0xC1, "CMP", DirectPageIndexedIndirectWithX,        executeCMP) \
+    X(0xC2, "REP", Immediate,                             executeStatusReg) \
+    X(0xC3, "CMP", StackRelative,                         executeCMP) \
+    X(0xC4, "CPY", DirectPage,                            executeCPXCPY) \
+    X(0xC5, "CMP", DirectPage,                            executeCMP) \
+    X(0xC6, "DEC", DirectPage,                            executeINCDEC) \
+    X(0xC7, "CMP", DirectPageIndirectLong,                executeCMP) \
+    X(0xC8, "INY", Implied,                               executeINCDEC) \
+    X(0xC9, "CMP", Immediate,                             executeCMP) \
+    X(0xCA, "DEX", Implied,                               executeINCDEC) \
+    X(0xCB, "WAI", Implied,                               executeMisc) \
+    X(0xCC, "CPY", Absolute,                              executeCPXCPY) \
+    X(0xCD, "CMP", Absolute,                              executeCMP) \
+    X(0xCE, "DEC", Absolute,                              executeINCDEC) \
+    X(0xCF, "CMP", AbsoluteLong,                          executeCMP) \
+    X(0xD0, "BNE", ProgramCounterRelative,                executeBranch) \
+    X(0xD1, "CMP", DirectPageIndirectIndexedWithY,        executeCMP) \
+    X(0xD2, "CMP", DirectPageIndirect,                    executeCMP) \
+    X(0xD3, "CMP", StackRelativeIndirectIndexedWithY,     executeCMP) \
+    X(0xD4, "PEI", StackDirectPageIndirect,               executeStack) \
+    X(0xD5, "CMP", DirectPageIndexedWithX,                executeCMP) \
+    X(0xD6, "DEC", DirectPageIndexedWithX,                executeINCDEC) \
+    X(0xD7, "CMP", DirectPageIndirectLongIndexedWithY,    executeCMP) \
+    X(0xD8, "CLD", Implied,                               executeStatusReg) \
+    X(0xD9, "CMP", AbsoluteIndexedWithY,                  executeCMP) \
+    X(0xDA, "PHX", StackImplied,                          executeStack) \
+    X(0xDB, "STP", Implied,                               executeMisc) \
+    X(0xDC, "JMP", AbsoluteIndirectLong,                  executeJumpReturn) \
+    X(0xDD, "CMP", AbsoluteIndexedWithX,                  executeCMP) \
+    X(0xDE, "DEC", AbsoluteIndexedWithX,                  executeINCDEC) \
+    X(0xDF, "CMP", AbsoluteLongIndexedWithX,              executeCMP) \
+    X(0xE0, "CPX", Immediate,                             executeCPXCPY) \
+    X(0xE1, "SBC", DirectPageIndexedIndirectWithX,        executeSBC) \
+    X(0xE2, "SEP", Immediate,                             executeStatusReg) \
+    X(0xE3, "SBC", StackRelative,                         executeSBC) \
+    X(0xE4, "CPX", DirectPage,                            executeCPXCPY) \
+    X(0xE5, "SBC", DirectPage,                            executeSBC) \
+    X(0xE6, "INC", DirectPage,                            executeINCDEC) \
+    X(0xE7, "SBC", DirectPageIndirectLong,                executeSBC) \
+    X(0xE8, "INX", Implied,                               executeINCDEC) \
+    X(0xE9, "SBC", Immediate,                             executeSBC) \
+    X(0xEA, "NOP", Implied,                               executeMisc) \
+    X(0xEB, "XBA", Implied,                               executeMisc) \
+    X(0xEC, "CPX", Absolute,                              executeCPXCPY) \
+    X(0xED, "SBC", Absolute,                              executeSBC) \
+    X(0xEE, "INC", Absolute,                              executeINCDEC) \
+    X(0xEF, "SBC", AbsoluteLong,                          executeSBC) \
+    X(0xF0, "BEQ", ProgramCounterRelative,                executeBranch) \
+    X(0xF1, "SBC", DirectPageIndirectIndexedWithY,        executeSBC) \
+    X(0xF2, "SBC", DirectPageIndirect,                    executeSBC) \
+    X(0xF3, "SBC", StackRelativeIndirectIndexedWithY,     executeSBC) \
+    X(0xF4, "PEA", StackAbsolute,                         executeStack) \
+    X(0xF5, "SBC", DirectPageIndexedWithX,                executeSBC) \
+    X(0xF6, "INC", DirectPageIndexedWithX,                executeINCDEC) \
+    X(0xF7, "SBC", DirectPageIndirectLongIndexedWithY,    executeSBC) \
+    X(0xF8, "SED", Implied,                               executeStatusReg) \
+    X(0xF9, "SBC", AbsoluteIndexedWithY,                  executeSBC) \
+    X(0xFA, "PLX", StackImplied,                          executeStack) \
+    X(0xFB, "XCE", Implied,                               executeStatusReg) \
+    X(0xFC, "JSR", AbsoluteIndexedIndirectWithX,          executeJumpReturn) \
+    X(0xFD, "SBC", AbsoluteIndexedWithX,                  executeSBC) \
+    X(0xFE, "INC", AbsoluteIndexedWithX,                  executeINCDEC) \
+    X(0xFF, "SBC", AbsoluteLongIndexedWithX,              executeSBC)
+
+#endif // OPCODE_LIST_HPP
@@ -25,17 +25,28 @@
 Stack::Stack(SystemBus *systemBus) :
         mSystemBus(systemBus),
         mStackAddress(0x00, STACK_POINTER_DEFAULT) {
+    selectPage(mStackAddress.getPage());
     Log::trc(LOG_TAG).str("Initialized at default location ").sp().hex(mStackAddress.getOffset(), 4).show();
 }
 
 Stack::Stack(SystemBus *systemBus, uint16_t stackPointer) :
         mSystemBus(systemBus),
         mStackAddress(0x00, stackPointer) {
+    selectPage(mStackAddress.getPage());
     Log::trc(LOG_TAG).str("Initialized at location ").sp().hex(mStackAddress.getOffset(), 4).show();
 }
 
 void Stack::push8Bit(uint8_t value) {
-    mSystemBus->storeByte(mStackAddress, value);
+    if (mStackAddress.getPage() != mPage) {
+        selectPage(mStackAddress.getPage());
+    }
+    uint8_t *pointer = *mWritePointer;
+    if (pointer) {
+        mSystemBus->countStore();
+        pointer[mStackAddress.getOffset() & 0xFF] = value;
+    } else {
+        mSystemBus->storeByte(mStackAddress, value);
+    }
     mStackAddress.decrementOffsetBy(sizeof(uint8_t));
 }
 
@@ -48,6 +59,13 @@ void Stack::push16Bit(uint16_t value) {
 
 uint8_t Stack::pull8Bit() {
     mStackAddress.incrementOffsetBy(sizeof(uint8_t));
+    if (mStackAddress.getPage() != mPage) {
+        selectPage(mStackAddress.getPage());
+    }
+    const uint8_t *pointer = *mReadPointer;
+    if (pointer) {
+        return pointer[mStackAddress.getOffset() & 0xFF];
+    }
     return mSystemBus->readByte(mStackAddress);
 }
 
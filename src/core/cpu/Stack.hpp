@@ -42,6 +42,18 @@ class Stack {
     private:
         SystemBus *mSystemBus;
         Address mStackAddress;
+
+        // Bus pointer slots of the page S is in, so that pushes and pulls to host memory skip
+        // the bus calls. Looked up again whenever S moves to another page.
+        uint16_t mPage;
+        uint8_t * const *mReadPointer;
+        uint8_t * const *mWritePointer;
+
+        void selectPage(uint16_t page) {
+            mPage = page;
+            mReadPointer = mSystemBus->getReadPointerSlot(page);
+            mWritePointer = mSystemBus->getWritePointerSlot(page);
+        }
 };
 
 #endif
@@ -18,77 +18,438 @@
  */
 
 #include <cmath>
+#include <algorithm>
+#include <cstring>
 #include "SystemBus.hpp"
+#include "DecodedBlockCache.hpp"
 #include "Log.hpp"
 
 #define LOG_TAG "SystemBus"
 
+namespace {
+    // Never accessed, its address only marks pages that need a full device scan.
+    class PartialPageMarker : public SystemBusDevice {
+        public:
+            void storeByte(const Address &, uint8_t) override {}
+            uint8_t readByte(const Address &) override { return 0; }
+            bool decodeAddress(const Address &, Address &) override { return false; }
+    };
+    PartialPageMarker partialPageMarker;
+}
+
+SystemBusDevice * const SystemBus::mPartialPage = &partialPageMarker;
+
+SystemBus::SystemBus() :
+        mPageTable(PAGE_COUNT, nullptr),
+        mReadPointers(PAGE_COUNT, nullptr),
+        mWritePointers(PAGE_COUNT, nullptr),
+        mCodePageWatchers(PAGE_COUNT, 0),
+        mWatchedPages(PAGE_COUNT, 0) {
+}
+
 void SystemBus::registerDevice(SystemBusDevice *device) {
     mDevices.push_back(device);
+    device->mBuses.push_back(this);
+    rebuildPageTable();
 }
 
-void SystemBus::storeByte(const Address &address, uint8_t value) {
-    for (SystemBusDevice *device : mDevices) {
-        Address decodedAddress;
-        if (device->decodeAddress(address, decodedAddress)) {
-            device->storeByte(decodedAddress, value);
+void SystemBus::unregisterDevice(SystemBusDevice *device) {
+    mDevices.erase(std::remove(mDevices.begin(), mDevices.end(), device), mDevices.end());
+    device->mBuses.erase(std::remove(device->mBuses.begin(), device->mBuses.end(), this), device->mBuses.end());
+    rebuildPageTable();
+}
+
+void SystemBus::refreshPagePointers(SystemBusDevice *device, uint16_t firstPage, uint16_t lastPage) {
+    if (mDeferUpdates) {
+        deferUpdate(device, firstPage, lastPage);
+        return;
+    }
+    refreshPagePointersNow(device, firstPage, lastPage);
+}
+
+void SystemBus::refreshPagePointersNow(SystemBusDevice *device, uint16_t firstPage, uint16_t lastPage) {
+    for (uint32_t page = firstPage; page <= lastPage; page++) {
+        if (mPageTable[page] == device) {
+            mReadPointers[page] = readPointerFor(static_cast<uint16_t>(page));
+            mWritePointers[page] = writePointerFor(static_cast<uint16_t>(page));
+        }
+    }
+    // Whatever the device now shows in these pages is not what was decoded
+    invalidateCodePagesNow(firstPage, lastPage);
+}
+
+void SystemBus::rebuildPageTable() {
+    for (uint32_t page = 0; page < PAGE_COUNT; page++) {
+        // Devices registered first take precedence, as with the linear scan.
+        SystemBusDevice *entry = nullptr;
+        for (SystemBusDevice *device : mDevices) {
+            PageMapping mapping = device->mapPage(static_cast<uint16_t>(page));
+            if (mapping == PageMapping::Full) {
+                entry = device;
+                break;
+            }
+            if (mapping == PageMapping::Partial) {
+                entry = mPartialPage;
+                break;
+            }
+        }
+        mPageTable[page] = entry;
+        mReadPointers[page] = readPointerFor(static_cast<uint16_t>(page));
+        mWritePointers[page] = writePointerFor(static_cast<uint16_t>(page));
+    }
+    invalidateCodePagesNow(0, PAGE_COUNT - 1);
+
+    // Everything queued so far is covered
+    std::lock_guard<std::mutex> lock(mDeferredUpdatesLock);
+    mDeferredUpdates.clear();
+    mHasDeferredUpdates.store(false, std::memory_order_release);
+}
+
+uint8_t *SystemBus::readPointerFor(uint16_t page) {
+    SystemBusDevice *device = mPageTable[page];
+    if (device == nullptr || device == mPartialPage || (mWatchedPages[page] & WATCH_READ)) {
+        return nullptr;
+    }
+    return device->getPageReadPointer(page);
+}
+
+uint8_t *SystemBus::writePointerFor(uint16_t page) {
+    SystemBusDevice *device = mPageTable[page];
+    if (device == nullptr || device == mPartialPage || mCodePageWatchers[page] != 0 ||
+            (mWatchedPages[page] & WATCH_WRITE)) {
+        return nullptr;
+    }
+    return device->getPageWritePointer(page);
+}
+
+const uint8_t *SystemBus::getCodePagePointer(uint16_t page) {
+    SystemBusDevice *device = mPageTable[page];
+    if (device == nullptr || device == mPartialPage) {
+        return nullptr;
+    }
+    // Read watchpoints are about data, code on their pages is still cached
+    const uint8_t *pointer = device->getPageReadPointer(page);
+    if (pointer == nullptr) {
+        return nullptr;
+    }
+    // Memory shared with other buses can be written behind our back, unless not even the
+    // device lets anyone write it directly (ROM), in which case it reports its own changes.
+    if (device->mBuses.size() > 1 && device->getPageWritePointer(page) != nullptr) {
+        return nullptr;
+    }
+    return pointer;
+}
+
+void SystemBus::addCodeCache(DecodedBlockCache *cache) {
+    mCodeCaches.push_back(cache);
+}
+
+void SystemBus::removeCodeCache(DecodedBlockCache *cache) {
+    mCodeCaches.erase(std::remove(mCodeCaches.begin(), mCodeCaches.end(), cache), mCodeCaches.end());
+}
+
+void SystemBus::watchCodePage(uint16_t page) {
+    if (mCodePageWatchers[page]++ == 0) {
+        mWritePointers[page] = nullptr;
+    }
+}
+
+void SystemBus::unwatchCodePage(uint16_t page) {
+    if (--mCodePageWatchers[page] == 0) {
+        mWritePointers[page] = writePointerFor(page);
+    }
+}
+
+void SystemBus::setWatchHandler(std::function<void (uint32_t, uint8_t, bool)> handler) {
+    mWatchHandler = handler;
+}
+
+void SystemBus::setPageWatch(uint16_t page, uint8_t access) {
+    mWatchedPages[page] = mWatchHandler ? access : 0;
+    mReadPointers[page] = readPointerFor(page);
+    mWritePointers[page] = writePointerFor(page);
+}
+
+void SystemBus::invalidateCodePages(uint16_t firstPage, uint16_t lastPage) {
+    if (mDeferUpdates) {
+        deferUpdate(nullptr, firstPage, lastPage);
+        return;
+    }
+    invalidateCodePagesNow(firstPage, lastPage);
+}
+
+void SystemBus::invalidateCodePagesNow(uint16_t firstPage, uint16_t lastPage) {
+    for (DecodedBlockCache *cache : mCodeCaches) {
+        cache->invalidatePages(firstPage, lastPage);
+    }
+}
+
+void SystemBus::setDeferUpdates(bool defer) {
+    if (!defer) {
+        applyDeferredUpdates();
+    }
+    mDeferUpdates = defer;
+}
+
+void SystemBus::deferUpdate(SystemBusDevice *device, uint16_t firstPage, uint16_t lastPage) {
+    std::lock_guard<std::mutex> lock(mDeferredUpdatesLock);
+    mDeferredUpdates.push_back(DeferredUpdate{device, firstPage, lastPage});
+    mHasDeferredUpdates.store(true, std::memory_order_release);
+}
+
+void SystemBus::applyQueuedUpdates() {
+    std::vector<DeferredUpdate> updates;
+    {
+        std::lock_guard<std::mutex> lock(mDeferredUpdatesLock);
+        updates.swap(mDeferredUpdates);
+        mHasDeferredUpdates.store(false, std::memory_order_release);
+    }
+    for (const DeferredUpdate &update : updates) {
+        if (update.device) {
+            refreshPagePointersNow(update.device, update.firstPage, update.lastPage);
+        } else {
+            invalidateCodePagesNow(update.firstPage, update.lastPage);
+        }
+    }
+}
+
+void SystemBus::countAccess(const SystemBusDevice *device, uint64_t reads, uint64_t writes) {
+    // A handful of device types per bus
+    const char *type = device->getDeviceType();
+    for (DeviceAccessCount &count : mAccessCounts) {
+        if (count.deviceType == type || std::strcmp(count.deviceType, type) == 0) {
+            count.reads += reads;
+            count.writes += writes;
             return;
         }
     }
+    mAccessCounts.push_back({type, reads, writes});
 }
 
-void SystemBus::storeTwoBytes(const Address &address, uint16_t value) {
+SystemBusDevice *SystemBus::findDeviceByScan(const Address &address, Address &decodedAddress) {
     for (SystemBusDevice *device : mDevices) {
-        Address decodedAddress;
         if (device->decodeAddress(address, decodedAddress)) {
-            uint8_t leastSignificantByte = (uint8_t)(value & 0xFF);
-            uint8_t mostSignificantByte = (uint8_t)((value & 0xFF00) >> 8);
-            device->storeByte(decodedAddress, leastSignificantByte);
-            decodedAddress.incrementOffsetBy(1);
-            device->storeByte(decodedAddress, mostSignificantByte);
-            return;
+            return device;
         }
     }
+    return nullptr;
+}
+
+SystemBusDevice *SystemBus::findDevice(const Address &address, Address &decodedAddress) {
+    SystemBusDevice *device = mPageTable[pageOf(address)];
+    if (device == mPartialPage) {
+        return findDeviceByScan(address, decodedAddress);
+    }
+    if (device) {
+        decodedAddress = address;
+    }
+    return device;
+}
+
+void SystemBus::storeByte(const Address &address, uint8_t value) {
+    mStoreCount++;
+    uint8_t *pointer = mWritePointers[pageOf(address)];
+    if (pointer) {
+        pointer[address.getOffset() & 0xFF] = value;
+        return;
+    }
+
+    Address decodedAddress;
+    SystemBusDevice *device = findDevice(address, decodedAddress);
+    if (device) {
+        device->storeByte(decodedAddress, value);
+        reportAccess(address, 0, value, WATCH_WRITE);
+        if (mCountAccesses) {
+            countAccess(device, 0, 1);
+        }
+    }
+    // What the store changed has to be visible to the next access
+    applyDeferredUpdates();
+    uint16_t page = pageOf(address);
+    if (mCodePageWatchers[page] != 0) {
+        invalidateCodePagesNow(page, page);
+    }
+}
+
+void SystemBus::storeTwoBytes(const Address &address, uint16_t value) {
+    mStoreCount++;
+    uint8_t *pointer = mWritePointers[pageOf(address)];
+    uint8_t offsetInPage = address.getOffset() & 0xFF;
+    if (pointer && offsetInPage != 0xFF) {
+        pointer[offsetInPage] = (uint8_t)(value & 0xFF);
+        pointer[offsetInPage + 1] = (uint8_t)((value & 0xFF00) >> 8);
+        return;
+    }
+
+    Address decodedAddress;
+    SystemBusDevice *device = findDevice(address, decodedAddress);
+    if (device) {
+        uint8_t leastSignificantByte = (uint8_t)(value & 0xFF);
+        uint8_t mostSignificantByte = (uint8_t)((value & 0xFF00) >> 8);
+        device->storeByte(decodedAddress, leastSignificantByte);
+        decodedAddress.incrementOffsetBy(1);
+        device->storeByte(decodedAddress, mostSignificantByte);
+        reportAccess(address, 0, leastSignificantByte, WATCH_WRITE);
+        reportAccess(address, 1, mostSignificantByte, WATCH_WRITE);
+        if (mCountAccesses) {
+            countAccess(device, 0, 1);
+        }
+    }
+    applyDeferredUpdates();
+    // The second byte may land on the next page
+    uint16_t page = pageOf(address);
+    uint16_t nextPage = page == PAGE_COUNT - 1 ? page : page + 1;
+    if (mCodePageWatchers[page] != 0 || mCodePageWatchers[nextPage] != 0) {
+        invalidateCodePagesNow(page, nextPage);
+    }
 }
 
 uint8_t SystemBus::readByte(const Address &address) {
-    for (SystemBusDevice *device : mDevices) {
-        Address decodedAddress;
-        if (device->decodeAddress(address, decodedAddress)) {
-            return device->readByte(decodedAddress);
+    const uint8_t *pointer = mReadPointers[pageOf(address)];
+    if (pointer) {
+        return pointer[address.getOffset() & 0xFF];
+    }
+
+    Address decodedAddress;
+    SystemBusDevice *device = findDevice(address, decodedAddress);
+    if (device) {
+        mDeviceReadCount++;
+        uint8_t value = device->readByte(decodedAddress);
+        reportAccess(address, 0, value, WATCH_READ);
+        if (mCountAccesses) {
+            countAccess(device, 1, 0);
         }
+        return value;
     }
     return 0;
 }
 
 uint16_t SystemBus::readTwoBytes(const Address &address) {
-    for (SystemBusDevice *device : mDevices) {
-        Address decodedAddress;
-        if (device->decodeAddress(address, decodedAddress)) {
-            uint8_t leastSignificantByte = device->readByte(decodedAddress);
-            decodedAddress.incrementOffsetBy(sizeof(uint8_t));
-            uint8_t mostSignificantByte = device->readByte(decodedAddress);
-            uint16_t value = ((uint16_t)mostSignificantByte << 8) | leastSignificantByte;
-            return value;
+    const uint8_t *pointer = mReadPointers[pageOf(address)];
+    uint8_t offsetInPage = address.getOffset() & 0xFF;
+    if (pointer && offsetInPage != 0xFF) {
+        // Both bytes in the same page, otherwise the device handles the wrap around
+        return ((uint16_t)pointer[offsetInPage + 1] << 8) | pointer[offsetInPage];
+    }
+
+    Address decodedAddress;
+    SystemBusDevice *device = findDevice(address, decodedAddress);
+    if (device) {
+        mDeviceReadCount++;
+        uint8_t leastSignificantByte = device->readByte(decodedAddress);
+        decodedAddress.incrementOffsetBy(sizeof(uint8_t));
+        uint8_t mostSignificantByte = device->readByte(decodedAddress);
+        reportAccess(address, 0, leastSignificantByte, WATCH_READ);
+        reportAccess(address, 1, mostSignificantByte, WATCH_READ);
+        if (mCountAccesses) {
+            countAccess(device, 1, 0);
         }
+        uint16_t value = ((uint16_t)mostSignificantByte << 8) | leastSignificantByte;
+        return value;
     }
     return 0;
 }
 
 Address SystemBus::readAddressAt(const Address &address) {
+    const uint8_t *pointer = mReadPointers[pageOf(address)];
+    uint8_t offsetInPage = address.getOffset() & 0xFF;
+    if (pointer && offsetInPage < 0xFE) {
+        uint16_t offset = ((uint16_t)pointer[offsetInPage + 1] << 8) | pointer[offsetInPage];
+        return Address(pointer[offsetInPage + 2], offset);
+    }
+
     Address decodedAddress { 0x00, 0x0000 };
-    for (SystemBusDevice *device : mDevices) {
-        if (device->decodeAddress(address, decodedAddress)) {
-            // Read offset
-            uint8_t leastSignificantByte = device->readByte(decodedAddress);
-            decodedAddress.incrementOffsetBy(sizeof(uint8_t));
-            uint8_t mostSignificantByte = device->readByte(decodedAddress);
-            uint16_t offset = ((uint16_t)mostSignificantByte << 8) | leastSignificantByte;
-            // Read bank
-            decodedAddress.incrementOffsetBy(sizeof(uint8_t));
-            uint8_t bank = device->readByte(decodedAddress);
-            return Address(bank, offset);
+    SystemBusDevice *device = findDevice(address, decodedAddress);
+    if (device) {
+        mDeviceReadCount++;
+        // Read offset
+        uint8_t leastSignificantByte = device->readByte(decodedAddress);
+        decodedAddress.incrementOffsetBy(sizeof(uint8_t));
+        uint8_t mostSignificantByte = device->readByte(decodedAddress);
+        uint16_t offset = ((uint16_t)mostSignificantByte << 8) | leastSignificantByte;
+        // Read bank
+        decodedAddress.incrementOffsetBy(sizeof(uint8_t));
+        uint8_t bank = device->readByte(decodedAddress);
+        reportAccess(address, 0, leastSignificantByte, WATCH_READ);
+        reportAccess(address, 1, mostSignificantByte, WATCH_READ);
+        reportAccess(address, 2, bank, WATCH_READ);
+        if (mCountAccesses) {
+            countAccess(device, 1, 0);
         }
+        return Address(bank, offset);
     }
     return decodedAddress;
 }
+
+bool SystemBus::readInstruction(const Address &address, uint8_t bytes[4]) {
+    const uint8_t *pointer = mReadPointers[pageOf(address)];
+    uint8_t offsetInPage = address.getOffset() & 0xFF;
+    if (pointer == nullptr || offsetInPage > PAGE_SIZE_BYTES - 4) {
+        return false;
+    }
+    std::memcpy(bytes, pointer + offsetInPage, 4);
+    return true;
+}
+
+// Bytes of a block move, both runs from their lowest address on. Moved in the order the CPU
+// moves them where the runs overlap so that the order shows (MVN one byte up fills memory).
+static void moveRun(uint8_t *to, const uint8_t *from, uint16_t count, bool decrement) {
+    const uintptr_t toAddress = (uintptr_t)to;
+    const uintptr_t fromAddress = (uintptr_t)from;
+    const bool ordered = decrement ? (toAddress < fromAddress && toAddress + count > fromAddress)
+                                   : (toAddress > fromAddress && toAddress < fromAddress + count);
+    if (!ordered) {
+        std::memmove(to, from, count);
+    } else if (decrement) {
+        for (int i = count - 1; i >= 0; i--) {
+            to[i] = from[i];
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            to[i] = from[i];
+        }
+    }
+}
+
+uint16_t SystemBus::moveBlock(const Address &source, const Address &destination, uint16_t count, bool decrement) {
+    const uint8_t sourceOffset = source.getOffset() & 0xFF;
+    const uint8_t destinationOffset = destination.getOffset() & 0xFF;
+    const uint16_t room = decrement ? std::min(sourceOffset, destinationOffset) + 1
+                                    : PAGE_SIZE_BYTES - std::max(sourceOffset, destinationOffset);
+    const uint16_t length = std::min(count, room);
+    const uint16_t sourcePage = pageOf(source);
+    const uint16_t destinationPage = pageOf(destination);
+    const uint8_t *from = mReadPointers[sourcePage];
+    uint8_t *to = mWritePointers[destinationPage];
+    // Where the runs start, going down they end at the addresses given
+    const uint8_t sourceStart = decrement ? sourceOffset - (length - 1) : sourceOffset;
+    const uint8_t destinationStart = decrement ? destinationOffset - (length - 1) : destinationOffset;
+
+    if (from && to && length > 1) {
+        moveRun(to + destinationStart, from + sourceStart, length, decrement);
+        mStoreCount += length;
+        return length;
+    }
+
+    // Into a device mapping the whole page, unless each byte has to be reported or the run
+    // reads what it writes
+    SystemBusDevice *device = mPageTable[destinationPage];
+    if (from && length > 1 && device && device != mPartialPage && sourcePage != destinationPage &&
+            !(mWatchedPages[destinationPage] & WATCH_WRITE)) {
+        uint8_t run[PAGE_SIZE_BYTES];
+        std::memcpy(run, from + sourceStart, length);
+        device->storeBytes(Address::fromFlat((destination.getFlat() & ~0xFFu) | destinationStart), run, length);
+        mStoreCount += length;
+        if (mCountAccesses) {
+            countAccess(device, 0, length);
+        }
+        applyDeferredUpdates();
+        if (mCodePageWatchers[destinationPage] != 0) {
+            invalidateCodePagesNow(destinationPage, destinationPage);
+        }
+        return length;
+    }
+
+    storeByte(destination, readByte(source));
+    return 1;
+}
@@ -22,21 +22,180 @@
 
 #include <stdint.h>
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
 
 #include "SystemBusDevice.hpp"
 
+class DecodedBlockCache;
+
+// Number of PAGE_SIZE_BYTES pages in the 24 bit address space
+#define PAGE_COUNT                     0x10000
+
 class SystemBus {
     public:
+        SystemBus();
+
         void registerDevice(SystemBusDevice *);
+        void unregisterDevice(SystemBusDevice *);
         void storeByte(const Address&, uint8_t);
         void storeTwoBytes(const Address&, uint16_t);
         uint8_t readByte(const Address&);
         uint16_t readTwoBytes(const Address&);
         Address readAddressAt(const Address&);
+        // Opcode fetch: the four bytes from the address on in one read, if they are all in host
+        // memory in the same page. false if they have to be read one by one.
+        bool readInstruction(const Address&, uint8_t bytes[4]);
+
+        // Block moves, see MVN / MVP. Moves up to count bytes one at a time from source to
+        // destination, both addresses going up or both going down, without leaving the pages
+        // they are in. Returns how many were moved: at least 1, at most count. Runs between
+        // host memory, and runs into devices taking them at once, are moved in one go.
+        uint16_t moveBlock(const Address &source, const Address &destination, uint16_t count, bool decrement);
+
+        // Called by devices when the host pointers they publish for some pages change
+        void refreshPagePointers(SystemBusDevice *, uint16_t firstPage, uint16_t lastPage);
+
+        // Code caching support, see DecodedBlockCache.
+        // Returns the host memory backing the page if code decoded from it can be cached, that is
+        // if every change to its contents is seen by this bus, nullptr otherwise.
+        const uint8_t *getCodePagePointer(uint16_t page);
+        void addCodeCache(DecodedBlockCache *);
+        void removeCodeCache(DecodedBlockCache *);
+        // While a page is watched its stores skip the write pointer so that caches hear about them.
+        void watchCodePage(uint16_t page);
+        void unwatchCodePage(uint16_t page);
+        // Discards code decoded from the specified pages in every cache attached to this bus.
+        void invalidateCodePages(uint16_t firstPage, uint16_t lastPage);
+
+        // Memory watchpoints, see Cpu65816Debugger.
+        // Accesses of the given kinds to a watched page skip the host pointers and are reported to
+        // the handler once made, byte by byte. Pages are watched as a whole, the handler filters
+        // the addresses. Code fetched through a code cache is not reported.
+        static const uint8_t WATCH_READ = 0x01;
+        static const uint8_t WATCH_WRITE = 0x02;
+        void setWatchHandler(std::function<void (uint32_t address, uint8_t value, bool write)>);
+        // WATCH_READ and / or WATCH_WRITE, 0 for none
+        void setPageWatch(uint16_t page, uint8_t access);
+
+        // Stores made through this bus since it was created, see Cpu65816 idle loop detection.
+        uint64_t getStoreCount() const {
+            return mStoreCount;
+        }
+        // Reads that reached a device rather than host memory, for the same
+        uint64_t getDeviceReadCount() const {
+            return mDeviceReadCount;
+        }
+
+        // Access counting, see Cpu65816Stats. While on, the accesses reaching a device are
+        // counted for it, a multi byte one once; the ones made through the host pointers
+        // (RAM, ROM) are not. Counts are per SystemBusDevice::getDeviceType(), in the order
+        // each was first accessed.
+        struct DeviceAccessCount {
+            const char *deviceType;
+            uint64_t reads;
+            uint64_t writes;
+        };
+        void setAccessCounting(bool enabled) {
+            mCountAccesses = enabled;
+        }
+        const std::vector<DeviceAccessCount> &getAccessCounts() const {
+            return mAccessCounts;
+        }
+        void clearAccessCounts() {
+            mAccessCounts.clear();
+        }
+
+        // Direct access support, see Stack.
+        // The host pointers of each page as kept by the bus: they stay at the same place and
+        // follow every remapping, so callers keep the slot and read the pointer at each access.
+        // nullptr in the slot means the access has to go through storeByte() / readByte().
+        uint8_t * const *getReadPointerSlot(uint16_t page) const {
+            return &mReadPointers[page];
+        }
+        uint8_t * const *getWritePointerSlot(uint16_t page) const {
+            return &mWritePointers[page];
+        }
+        // Accounts for a store made through a write pointer slot
+        void countStore() {
+            mStoreCount++;
+        }
+
+        // Concurrent execution support.
+        // While deferring, the two calls above only queue their work: devices shared with other
+        // buses may call them from any thread. The queue is applied after each store of this bus
+        // reaching a device, and by applyDeferredUpdates(), which must be called from the thread
+        // running this bus or while no thread does.
+        void setDeferUpdates(bool);
+        bool isDeferringUpdates() const {
+            return mDeferUpdates;
+        }
+        void applyDeferredUpdates() {
+            if (mHasDeferredUpdates.load(std::memory_order_acquire)) {
+                applyQueuedUpdates();
+            }
+        }
 
     private:
+        struct DeferredUpdate {
+            SystemBusDevice *device;    // nullptr for an invalidation
+            uint16_t firstPage;
+            uint16_t lastPage;
+        };
+
+        SystemBusDevice *findDevice(const Address &, Address &);
+        SystemBusDevice *findDeviceByScan(const Address &, Address &);
+        void rebuildPageTable();
+        uint8_t *readPointerFor(uint16_t page);
+        uint8_t *writePointerFor(uint16_t page);
+        void refreshPagePointersNow(SystemBusDevice *, uint16_t firstPage, uint16_t lastPage);
+        void invalidateCodePagesNow(uint16_t firstPage, uint16_t lastPage);
+        void deferUpdate(SystemBusDevice *, uint16_t firstPage, uint16_t lastPage);
+        void applyQueuedUpdates();
+
+        static uint16_t pageOf(const Address &address) {
+            return address.getPage();
+        }
+
+        // Slow path only, after the access reached the device. Later bytes of a multi byte
+        // access are given with their offset from the address.
+        void reportAccess(const Address &address, uint8_t offset, uint8_t value, uint8_t access) {
+            uint32_t flatAddress = (address.getFlat() + offset) & 0xFFFFFF;
+            if (mWatchedPages[flatAddress >> 8] & access) {
+                mWatchHandler(flatAddress, value, access == WATCH_WRITE);
+            }
+        }
 
         std::vector<SystemBusDevice *> mDevices;
+        uint64_t mStoreCount = 0;
+        uint64_t mDeviceReadCount = 0;
+
+        bool mCountAccesses = false;
+        std::vector<DeviceAccessCount> mAccessCounts;
+        void countAccess(const SystemBusDevice *, uint64_t reads, uint64_t writes);
+
+        // One entry per page: the device fully mapping it, nullptr if nothing is mapped
+        // there, or mPartialPage when the devices have to be asked one by one.
+        std::vector<SystemBusDevice *> mPageTable;
+        static SystemBusDevice * const mPartialPage;
+
+        // Host memory backing each page, nullptr when the access must go through the device.
+        std::vector<uint8_t *> mReadPointers;
+        std::vector<uint8_t *> mWritePointers;
+
+        // Number of caches holding code decoded from each page.
+        std::vector<uint8_t> mCodePageWatchers;
+        std::vector<DecodedBlockCache *> mCodeCaches;
+
+        // WATCH_READ / WATCH_WRITE per page.
+        std::vector<uint8_t> mWatchedPages;
+        std::function<void (uint32_t, uint8_t, bool)> mWatchHandler;
+
+        bool mDeferUpdates = false;
+        std::mutex mDeferredUpdatesLock;
+        std::vector<DeferredUpdate> mDeferredUpdates;
+        std::atomic<bool> mHasDeferredUpdates {false};
 };
 
 #endif
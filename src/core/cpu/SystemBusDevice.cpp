@@ -17,25 +17,18 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <cmath>
-
 #include "SystemBusDevice.hpp"
+#include "SystemBus.hpp"
 
 Address Address::sumOffsetToAddressNoWrapAround(const Address &address, uint16_t offset) {
-    uint8_t newBank = address.getBank();
-    uint16_t newOffset;
-    auto offsetSum = (uint32_t)(address.getOffset() + offset);
-    if (offsetSum >= BANK_SIZE_BYTES) {
-        ++newBank;
-        newOffset = static_cast<uint16_t>(offsetSum - BANK_SIZE_BYTES);
-    } else {
-        newOffset = address.getOffset() + offset;
-    }
-    return {newBank, newOffset};
+    // Carries into the bank, bank $FF wrapping to $00
+    return fromFlat(address.getFlat() + offset);
 }
 
 Address Address::sumOffsetToAddressWrapAround(const Address &address, uint16_t offset) {
-    return Address(address.getBank(), address.getOffset() + offset);
+    Address sum = address;
+    sum.incrementOffsetBy(offset);
+    return sum;
 }
 
 Address Address::sumOffsetToAddress(const Address &address, uint16_t offset) {
@@ -45,9 +38,7 @@ Address Address::sumOffsetToAddress(const Address &address, uint16_t offset) {
 }
 
 bool Address::offsetsAreOnDifferentPages(uint16_t offsetFirst, uint16_t offsetSecond) {
-    int pageOfFirst = static_cast<int>(std::floor(offsetFirst / PAGE_SIZE_BYTES));
-    int pageOfSecond = static_cast<int>(std::floor(offsetSecond / PAGE_SIZE_BYTES));
-    return pageOfFirst != pageOfSecond;
+    return ((offsetFirst ^ offsetSecond) >> 8) != 0;
 }
 
 Address Address::newWithOffset(uint16_t offset) {
@@ -62,10 +53,22 @@ Address Address::newWithOffsetWrapAround(uint16_t offset) {
     return sumOffsetToAddressWrapAround((const Address &)*this, offset);
 }
 
-void Address::decrementOffsetBy(uint16_t offset) {
-    mOffset -= offset;
+PageMapping SystemBusDevice::mapPageInRange(uint16_t page, uint32_t start, uint32_t end) {
+    uint32_t pageStart = (uint32_t)page * PAGE_SIZE_BYTES;
+    uint32_t pageEnd = pageStart + PAGE_SIZE_BYTES - 1;
+    if (pageEnd < start || pageStart > end) return PageMapping::Unmapped;
+    if (pageStart >= start && pageEnd <= end) return PageMapping::Full;
+    return PageMapping::Partial;
+}
+
+void SystemBusDevice::notifyPagePointersChanged(uint16_t firstPage, uint16_t lastPage) {
+    for (SystemBus *bus : mBuses) {
+        bus->refreshPagePointers(this, firstPage, lastPage);
+    }
 }
 
-void Address::incrementOffsetBy(uint16_t offset) {
-    mOffset += offset;
+void SystemBusDevice::notifyPageContentsChanged(uint16_t firstPage, uint16_t lastPage) {
+    for (SystemBus *bus : mBuses) {
+        bus->invalidateCodePages(firstPage, lastPage);
+    }
 }
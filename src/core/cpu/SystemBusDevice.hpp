@@ -21,6 +21,7 @@
 #define SYSBUS_DEVICE_H
 
 #include <stdint.h>
+#include <vector>
 
 #define BANK_SIZE_BYTES                0x10000
 #define HALF_BANK_SIZE_BYTES            0x8000
@@ -28,8 +29,8 @@
 
 class Address {
     private:
-        uint8_t mBank;
-        uint16_t mOffset;
+        // Bank and offset packed as the 24 bit address the bus sees, (bank << 16) | offset
+        uint32_t mFlat;
 
     public:
         static bool offsetsAreOnDifferentPages(uint16_t, uint16_t);
@@ -37,34 +38,69 @@ class Address {
         static Address sumOffsetToAddressNoWrapAround(const Address &, uint16_t);
         static Address sumOffsetToAddressWrapAround(const Address &, uint16_t);
 
+        static Address fromFlat(uint32_t flat) {
+            Address address;
+            address.mFlat = flat & 0xFFFFFF;
+            return address;
+        }
+
         Address() = default;
-        Address(uint8_t bank, uint16_t offset) : mBank(bank), mOffset(offset) {};
+        Address(uint8_t bank, uint16_t offset) : mFlat(((uint32_t)bank << 16) | offset) {};
 
         Address newWithOffset(uint16_t);
         Address newWithOffsetNoWrapAround(uint16_t);
         Address newWithOffsetWrapAround(uint16_t);
 
-        void incrementOffsetBy(uint16_t);
-        void decrementOffsetBy(uint16_t);
+        // Both stay in the bank
+        void incrementOffsetBy(uint16_t offset) {
+            mFlat = (mFlat & 0xFF0000) | ((mFlat + offset) & 0xFFFF);
+        }
+        void decrementOffsetBy(uint16_t offset) {
+            mFlat = (mFlat & 0xFF0000) | ((mFlat - offset) & 0xFFFF);
+        }
 
         void getBankAndOffset(uint8_t *bank, uint16_t *offset) {
-            *bank = mBank;
-            *offset = mOffset;
+            *bank = getBank();
+            *offset = getOffset();
         }
 
         uint8_t getBank() const {
-            return mBank;
+            return (uint8_t)(mFlat >> 16);
         }
 
         uint16_t getOffset() const {
-            return mOffset;
+            return (uint16_t)mFlat;
+        }
+
+        uint32_t getFlat() const {
+            return mFlat;
         }
+
+        // Bus page, (bank << 8) | (offset >> 8)
+        uint16_t getPage() const {
+            return (uint16_t)(mFlat >> 8);
+        }
+};
+
+/**
+ How a device responds to the PAGE_SIZE_BYTES addresses of one bus page.
+ */
+enum class PageMapping {
+    // The device decodes none of the addresses in the page.
+    Unmapped,
+    // The device decodes only some addresses in the page, or remaps them: use decodeAddress().
+    Partial,
+    // The device decodes every address in the page, unchanged.
+    Full
 };
 
+class SystemBus;
+
 /**
  Every device (PPU, APU, ...) implements this interface.
  */
 class SystemBusDevice {
+        friend class SystemBus;
     public:
         virtual ~SystemBusDevice() {};
 
@@ -74,6 +110,19 @@ class SystemBusDevice {
          */
         virtual void storeByte(const Address &, uint8_t) = 0;
 
+        /**
+          Stores count bytes from the specified virtual address on, the way count storeByte()
+          calls would. Only asked for pages this device maps Full, the bytes all in one page.
+          Devices that can take a run of bytes at once (and tell about it once) override this.
+         */
+        virtual void storeBytes(const Address &address, const uint8_t *values, uint16_t count) {
+            Address next = address;
+            for (uint16_t i = 0; i < count; i++) {
+                storeByte(next, values[i]);
+                next.incrementOffsetBy(1);
+            }
+        }
+
         /**
           Reads one byte from the real address represented by the specified virtual address.
           That is: maps the virtual address to the real one and reads from it.
@@ -84,6 +133,59 @@ class SystemBusDevice {
           Returns true if the address was decoded successfully by this device.
          */
         virtual bool decodeAddress(const Address &, Address &) = 0;
+
+        /**
+          Tells the system bus how this device maps the specified page (address bits 8-23).
+          The bus uses this to build its page table so that accesses don't have to query
+          every device. Devices that don't override this are always reached through decodeAddress().
+         */
+        virtual PageMapping mapPage(uint16_t /* page */) {
+            return PageMapping::Partial;
+        }
+
+        /**
+          Returns a host pointer to the first byte of the specified page if reading it has no side
+          effects, so the bus can read it directly. Only asked for pages this device maps Full.
+         */
+        virtual uint8_t *getPageReadPointer(uint16_t /* page */) {
+            return nullptr;
+        }
+
+        /**
+          Same as getPageReadPointer() but for writes.
+         */
+        virtual uint8_t *getPageWritePointer(uint16_t /* page */) {
+            return nullptr;
+        }
+
+        /**
+          Name of the kind of device, the same for every instance: bus access counts are
+          reported under it.
+         */
+        virtual const char *getDeviceType() const {
+            return "Device";
+        }
+
+    protected:
+        /**
+          Helper for devices that decode one contiguous range of flat addresses (end is inclusive).
+         */
+        static PageMapping mapPageInRange(uint16_t page, uint32_t start, uint32_t end);
+
+        /**
+          Must be called when the pointers returned for the specified pages change (bank switch,
+          reallocation...), so the buses this device is registered with can refresh them.
+         */
+        void notifyPagePointersChanged(uint16_t firstPage, uint16_t lastPage);
+
+        /**
+          Must be called when the contents of the specified pages change without going through
+          the buses (DMA, file loading...), so that code decoded from them is discarded.
+         */
+        void notifyPageContentsChanged(uint16_t firstPage, uint16_t lastPage);
+
+    private:
+        std::vector<SystemBus *> mBuses;
 };
 
 #endif // SYSBUS_DEVICE_H
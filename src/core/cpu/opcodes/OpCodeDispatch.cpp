@@ -0,0 +1,42 @@
+/*
+ * This file is part of the 65816 Emulator Library.
+ * Copyright (c) 2018 Francesco Rigoni.
+ *
+ * https://github.com/FrancescoRigoni/Lib65816
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Cpu65816.hpp"
+#include "OpCodeList.hpp"
+
+#define LOG_TAG "Cpu::dispatchOpCode"
+
+/**
+ * This file contains the switch based OpCode dispatcher.
+ *
+ * Every OpCode gets its own case calling the executor directly, which avoids
+ * copying the OpCode and calling through a pointer to member function.
+ */
+
+#define OP_CODE_DISPATCH_CASE(code, name, mode, executor) \
+    case code: executor(OP_CODE_TABLE[code]); return true;
+#define OP_CODE_DISPATCH_CASE_UNIMPLEMENTED(code, name, mode) \
+    case code: return false;
+
+bool Cpu65816::dispatchOpCode(uint8_t instruction) {
+    switch (instruction) {
+        OP_CODE_LIST(OP_CODE_DISPATCH_CASE, OP_CODE_DISPATCH_CASE_UNIMPLEMENTED)
+    }
+    return false;
+}
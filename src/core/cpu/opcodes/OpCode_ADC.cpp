@@ -25,7 +25,7 @@
  * This file contains the implementation for all ADC OpCodes.
  */
 
-void Cpu65816::execute8BitADC(OpCode &opCode) {
+void Cpu65816::execute8BitADC(const OpCode &opCode) {
     Address dataAddress = getAddressOfOpCodeData(opCode);
     uint8_t value = mSystemBus.readByte(dataAddress);
     uint8_t accumulator = Binary::lower8BitsOf(mA);
@@ -57,7 +57,7 @@ void Cpu65816::execute8BitADC(OpCode &opCode) {
     Binary::setLower8BitsOf16BitsValue(&mA, result8Bit);
 }
 
-void Cpu65816::execute16BitADC(OpCode &opCode) {
+void Cpu65816::execute16BitADC(const OpCode &opCode) {
     Address dataAddress = getAddressOfOpCodeData(opCode);
     uint16_t value = mSystemBus.readTwoBytes(dataAddress);
     uint16_t accumulator = mA;
@@ -89,7 +89,7 @@ void Cpu65816::execute16BitADC(OpCode &opCode) {
     mA = result16Bit;
 }
 
-void Cpu65816::execute8BitBCDADC(OpCode &opCode) {
+void Cpu65816::execute8BitBCDADC(const OpCode &opCode) {
     Address dataAddress = getAddressOfOpCodeData(opCode);
     uint8_t value = mSystemBus.readByte(dataAddress);
     uint8_t accumulator = Binary::lower8BitsOf(mA);
@@ -103,7 +103,7 @@ void Cpu65816::execute8BitBCDADC(OpCode &opCode) {
     mCpuStatus.updateSignAndZeroFlagFrom8BitValue(result);
 }
 
-void Cpu65816::execute16BitBCDADC(OpCode &opCode) {
+void Cpu65816::execute16BitBCDADC(const OpCode &opCode) {
     Address dataAddress = getAddressOfOpCodeData(opCode);
     uint16_t value = mSystemBus.readTwoBytes(dataAddress);
     uint16_t accumulator = mA;
@@ -117,7 +117,7 @@ void Cpu65816::execute16BitBCDADC(OpCode &opCode) {
     mCpuStatus.updateSignAndZeroFlagFrom8BitValue(result);
 }
 
-void Cpu65816::executeADC(OpCode &opCode) {
+void Cpu65816::executeADC(const OpCode &opCode) {
     if (accumulatorIs8BitWide()) {
         if (mCpuStatus.decimalFlag()) execute8BitBCDADC(opCode);
         else execute8BitADC(opCode);
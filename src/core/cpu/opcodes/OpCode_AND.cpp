@@ -27,7 +27,7 @@
  * This file contains implementations for all AND OpCodes.
  */
 
-void Cpu65816::executeAND8Bit(OpCode &opCode) {
+void Cpu65816::executeAND8Bit(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     uint8_t operand = mSystemBus.readByte(opCodeDataAddress);
     uint8_t result = Binary::lower8BitsOf(mA) & operand;
@@ -35,7 +35,7 @@ void Cpu65816::executeAND8Bit(OpCode &opCode) {
     Binary::setLower8BitsOf16BitsValue(&mA, result);
 }
 
-void Cpu65816::executeAND16Bit(OpCode &opCode) {
+void Cpu65816::executeAND16Bit(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     uint16_t operand = mSystemBus.readTwoBytes(opCodeDataAddress);
     uint16_t result = mA & operand;
@@ -43,7 +43,7 @@ void Cpu65816::executeAND16Bit(OpCode &opCode) {
     mA = result;
 }
 
-void Cpu65816::executeAND(OpCode &opCode) {
+void Cpu65816::executeAND(const OpCode &opCode) {
     if (accumulatorIs16BitWide()) {
         executeAND16Bit(opCode);
         addToCycles(1);
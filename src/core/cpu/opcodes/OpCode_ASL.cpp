@@ -41,7 +41,7 @@
  * This file contains implementations for all ASL OpCodes.
  */
 
-void Cpu65816::executeMemoryASL(OpCode &opCode) {
+void Cpu65816::executeMemoryASL(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
 
     if(accumulatorIs8BitWide()) {
@@ -55,7 +55,7 @@ void Cpu65816::executeMemoryASL(OpCode &opCode) {
     }
 }
 
-void Cpu65816::executeAccumulatorASL(OpCode &opCode) {
+void Cpu65816::executeAccumulatorASL(const OpCode &opCode) {
     if(accumulatorIs8BitWide()) {
         uint8_t value = Binary::lower8BitsOf(mA);
         DO_ASL_8_BIT(value);
@@ -65,7 +65,7 @@ void Cpu65816::executeAccumulatorASL(OpCode &opCode) {
     }
 }
 
-void Cpu65816::executeASL(OpCode &opCode) {
+void Cpu65816::executeASL(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case (0x0A):                // ASL Accumulator
         {
@@ -26,7 +26,7 @@
  * This file contains the implementation for all BIT OpCodes
  */
 
-void Cpu65816::execute8BitBIT(OpCode &opCode) {
+void Cpu65816::execute8BitBIT(const OpCode &opCode) {
     const Address addressOfOpCodeData = getAddressOfOpCodeData(opCode);
     uint8_t value = mSystemBus.readByte(addressOfOpCodeData);
     bool isHighestBitSet = value & 0x80;
@@ -41,7 +41,7 @@ void Cpu65816::execute8BitBIT(OpCode &opCode) {
     mCpuStatus.updateZeroFlagFrom8BitValue(value & Binary::lower8BitsOf(mA));
 }
 
-void Cpu65816::execute16BitBIT(OpCode &opCode) {
+void Cpu65816::execute16BitBIT(const OpCode &opCode) {
     const Address addressOfOpCodeData = getAddressOfOpCodeData(opCode);
     uint16_t value = mSystemBus.readTwoBytes(addressOfOpCodeData);
     bool isHighestBitSet = value & 0x8000;
@@ -56,7 +56,7 @@ void Cpu65816::execute16BitBIT(OpCode &opCode) {
     mCpuStatus.updateZeroFlagFrom16BitValue(value & mA);
 }
 
-void Cpu65816::executeBIT(OpCode &opCode) {
+void Cpu65816::executeBIT(const OpCode &opCode) {
     if (accumulatorIs8BitWide()) {
         execute8BitBIT(opCode);
     } else {
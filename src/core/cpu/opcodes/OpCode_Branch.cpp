@@ -27,7 +27,7 @@
  * This file contains the implementation for all branch OpCodes
  */
 
-int Cpu65816::executeBranchShortOnCondition(bool condition, OpCode &opCode) {
+int Cpu65816::executeBranchShortOnCondition(bool condition, const OpCode &opCode) {
     uint8_t opCycles = 2;
     uint8_t destination =  mSystemBus.readByte(getAddressOfOpCodeData(opCode));
     // This is the address of the next instruction
@@ -42,6 +42,9 @@ int Cpu65816::executeBranchShortOnCondition(bool condition, OpCode &opCode) {
             destination16 = destination;
         }
         actualDestination = mProgramAddress.getOffset() + 2 + destination16;
+        if (Binary::is8bitValueNegative(destination)) {
+            notifyBranchBack();
+        }
         // Emulation mode requires 1 extra cycle on page boundary crossing
         if (Address::offsetsAreOnDifferentPages(mProgramAddress.getOffset(), actualDestination) &&
             mCpuStatus.emulationFlag()) {
@@ -55,7 +58,7 @@ int Cpu65816::executeBranchShortOnCondition(bool condition, OpCode &opCode) {
     return opCycles;
 }
 
-int Cpu65816::executeBranchLongOnCondition(bool condition, OpCode &opCode) {
+int Cpu65816::executeBranchLongOnCondition(bool condition, const OpCode &opCode) {
     if (condition) {
         uint16_t destination = mSystemBus.readTwoBytes(getAddressOfOpCodeData(opCode));
         mProgramAddress.incrementOffsetBy(3 + destination);
@@ -64,7 +67,7 @@ int Cpu65816::executeBranchLongOnCondition(bool condition, OpCode &opCode) {
     return 4;
 }
 
-void Cpu65816::executeBranch(OpCode &opCode) {
+void Cpu65816::executeBranch(const OpCode &opCode) {
 
     switch(opCode.getCode()) {
         case(0xD0):  // BNE
@@ -25,7 +25,7 @@
  * This file contains the implementation for all CMP OpCodes
  */
 
-void Cpu65816::execute8BitCMP(OpCode &opCode) {
+void Cpu65816::execute8BitCMP(const OpCode &opCode) {
     Address valueAddress = getAddressOfOpCodeData(opCode);
     uint8_t value = mSystemBus.readByte(valueAddress);
     uint8_t result = Binary::lower8BitsOf(mA) - value;
@@ -37,7 +37,7 @@ void Cpu65816::execute8BitCMP(OpCode &opCode) {
     }
 }
 
-void Cpu65816::execute16BitCMP(OpCode &opCode) {
+void Cpu65816::execute16BitCMP(const OpCode &opCode) {
     Address valueAddress = getAddressOfOpCodeData(opCode);
     uint16_t value = mSystemBus.readTwoBytes(valueAddress);
     uint16_t result = mA - value;
@@ -48,7 +48,7 @@ void Cpu65816::execute16BitCMP(OpCode &opCode) {
         mCpuStatus.clearCarryFlag();
     }
 }
-void Cpu65816::executeCMP(OpCode &opCode) {
+void Cpu65816::executeCMP(const OpCode &opCode) {
     if (accumulatorIs8BitWide()) {
         execute8BitCMP(opCode);
     } else {
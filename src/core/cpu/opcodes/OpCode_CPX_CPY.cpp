@@ -25,7 +25,7 @@
  * This file contains implementations for all CPX and CPY OpCodes.
  */
 
-void Cpu65816::execute8BitCPX(OpCode &opCode) {
+void Cpu65816::execute8BitCPX(const OpCode &opCode) {
     uint8_t value = mSystemBus.readByte(getAddressOfOpCodeData(opCode));
     uint8_t result = Binary::lower8BitsOf(mX) - value;
     mCpuStatus.updateSignAndZeroFlagFrom8BitValue(result);
@@ -33,7 +33,7 @@ void Cpu65816::execute8BitCPX(OpCode &opCode) {
     else mCpuStatus.clearCarryFlag();
 }
 
-void Cpu65816::execute16BitCPX(OpCode &opCode) {
+void Cpu65816::execute16BitCPX(const OpCode &opCode) {
     uint16_t value = mSystemBus.readTwoBytes(getAddressOfOpCodeData(opCode));
     uint16_t result = mX - value;
     mCpuStatus.updateSignAndZeroFlagFrom16BitValue(result);
@@ -41,7 +41,7 @@ void Cpu65816::execute16BitCPX(OpCode &opCode) {
     else mCpuStatus.clearCarryFlag();
 }
 
-void Cpu65816::execute8BitCPY(OpCode &opCode) {
+void Cpu65816::execute8BitCPY(const OpCode &opCode) {
     uint8_t value = mSystemBus.readByte(getAddressOfOpCodeData(opCode));
     uint8_t result = Binary::lower8BitsOf(mY) - value;
     mCpuStatus.updateSignAndZeroFlagFrom8BitValue(result);
@@ -49,7 +49,7 @@ void Cpu65816::execute8BitCPY(OpCode &opCode) {
     else mCpuStatus.clearCarryFlag();
 }
 
-void Cpu65816::execute16BitCPY(OpCode &opCode) {
+void Cpu65816::execute16BitCPY(const OpCode &opCode) {
     uint16_t value = mSystemBus.readTwoBytes(getAddressOfOpCodeData(opCode));
     uint16_t result = mY - value;
     mCpuStatus.updateSignAndZeroFlagFrom16BitValue(result);
@@ -57,7 +57,7 @@ void Cpu65816::execute16BitCPY(OpCode &opCode) {
     else mCpuStatus.clearCarryFlag();
 }
 
-void Cpu65816::executeCPXCPY(OpCode &opCode) {
+void Cpu65816::executeCPXCPY(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case(0xE0):  // CPX Immediate
         {
@@ -25,7 +25,7 @@
  * This file contains the implementation for all EOR OpCodes.
  */
 
-void Cpu65816::executeEOR8Bit(OpCode &opCode) {
+void Cpu65816::executeEOR8Bit(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     uint8_t operand = mSystemBus.readByte(opCodeDataAddress);
     uint8_t result = Binary::lower8BitsOf(mA) ^ operand;
@@ -33,7 +33,7 @@ void Cpu65816::executeEOR8Bit(OpCode &opCode) {
     Binary::setLower8BitsOf16BitsValue(&mA, result);
 }
 
-void Cpu65816::executeEOR16Bit(OpCode &opCode) {
+void Cpu65816::executeEOR16Bit(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     uint16_t operand = mSystemBus.readTwoBytes(opCodeDataAddress);
     uint16_t result = mA ^ operand;
@@ -41,7 +41,7 @@ void Cpu65816::executeEOR16Bit(OpCode &opCode) {
     mA = result;
 }
 
-void Cpu65816::executeEOR(OpCode &opCode) {
+void Cpu65816::executeEOR(const OpCode &opCode) {
     if (accumulatorIs8BitWide()) {
         executeEOR8Bit(opCode);
     } else {
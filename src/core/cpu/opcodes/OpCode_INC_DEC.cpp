@@ -25,7 +25,7 @@
  * This file contains implementations for all Increment and Decrement OpCodes.
  */
 
-void Cpu65816::execute8BitDecInMemory(OpCode &opCode) {
+void Cpu65816::execute8BitDecInMemory(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     uint8_t value = mSystemBus.readByte(opCodeDataAddress);
     value--;
@@ -33,7 +33,7 @@ void Cpu65816::execute8BitDecInMemory(OpCode &opCode) {
     mSystemBus.storeByte(opCodeDataAddress, value);
 }
 
-void Cpu65816::execute16BitDecInMemory(OpCode &opCode) {
+void Cpu65816::execute16BitDecInMemory(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     uint16_t value = mSystemBus.readTwoBytes(opCodeDataAddress);
     value--;
@@ -41,7 +41,7 @@ void Cpu65816::execute16BitDecInMemory(OpCode &opCode) {
     mSystemBus.storeTwoBytes(opCodeDataAddress, value);
 }
 
-void Cpu65816::execute8BitIncInMemory(OpCode &opCode) {
+void Cpu65816::execute8BitIncInMemory(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     uint8_t value = mSystemBus.readByte(opCodeDataAddress);
     value++;
@@ -49,7 +49,7 @@ void Cpu65816::execute8BitIncInMemory(OpCode &opCode) {
     mSystemBus.storeByte(opCodeDataAddress, value);
 }
 
-void Cpu65816::execute16BitIncInMemory(OpCode &opCode) {
+void Cpu65816::execute16BitIncInMemory(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     uint16_t value = mSystemBus.readTwoBytes(opCodeDataAddress);
     value++;
@@ -57,7 +57,7 @@ void Cpu65816::execute16BitIncInMemory(OpCode &opCode) {
     mSystemBus.storeTwoBytes(opCodeDataAddress, value);
 }
 
-void Cpu65816::executeINCDEC(OpCode &opCode) {
+void Cpu65816::executeINCDEC(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case(0x1A):  // INC Accumulator
         {
@@ -27,7 +27,7 @@
  * that deal with interrupts.
  */
 
-void Cpu65816::executeInterrupt(OpCode &opCode) {
+void Cpu65816::executeInterrupt(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case(0x00):  // BRK
         {
@@ -51,6 +51,7 @@ void Cpu65816::executeInterrupt(OpCode &opCode) {
                 setProgramAddress(newAddress);
                 addToCycles(8);
             }
+            notifyCall();
             break;
         }
         case(0x02):                 // COP
@@ -70,6 +71,7 @@ void Cpu65816::executeInterrupt(OpCode &opCode) {
                 addToCycles(8);
             }
             mCpuStatus.clearDecimalFlag();
+            notifyCall();
             break;
         }
         case(0x40):                 // RTI
@@ -89,6 +91,7 @@ void Cpu65816::executeInterrupt(OpCode &opCode) {
                 mProgramAddress = newProgramAddress;
                 addToCycles(7);
             }
+            notifyReturn();
             break;
         }
         default: {
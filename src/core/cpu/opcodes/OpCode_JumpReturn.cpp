@@ -26,13 +26,14 @@
  * that deal with jumps, calls and returns.
  */
 
-void Cpu65816::executeJumpReturn(OpCode &opCode) {
+void Cpu65816::executeJumpReturn(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case(0x20):  // JSR Absolute
         {
             mStack.push16Bit(mProgramAddress.getOffset() + 2);
             uint16_t destinationAddress = getAddressOfOpCodeData(opCode).getOffset();
             setProgramAddress(Address(mProgramAddress.getBank(), destinationAddress));
+            notifyCall();
             addToCycles(6);
             break;
         }
@@ -41,6 +42,7 @@ void Cpu65816::executeJumpReturn(OpCode &opCode) {
             mStack.push8Bit(mProgramAddress.getBank());
             mStack.push16Bit(mProgramAddress.getOffset() + 3);
             setProgramAddress(getAddressOfOpCodeData(opCode));
+            notifyCall();
             addToCycles(8);
             break;
         }
@@ -50,12 +52,16 @@ void Cpu65816::executeJumpReturn(OpCode &opCode) {
             mStack.push8Bit(mProgramAddress.getBank());
             mStack.push16Bit(mProgramAddress.getOffset() + 2);
             setProgramAddress(destinationAddress);
+            notifyCall();
             addToCycles(8);
             break;
         }
         case(0x4C):  // JMP Absolute
         {
             uint16_t destinationAddress = getAddressOfOpCodeData(opCode).getOffset();
+            if (destinationAddress <= mProgramAddress.getOffset()) {
+                notifyBranchBack();
+            }
             setProgramAddress(Address(mProgramAddress.getBank(), destinationAddress));
             addToCycles(3);
             break;
@@ -94,6 +100,7 @@ void Cpu65816::executeJumpReturn(OpCode &opCode) {
 
             Address returnAddress(newBank, newOffset);
             setProgramAddress(returnAddress);
+            notifyReturn();
             addToCycles(6);
             break;
         }
@@ -101,6 +108,7 @@ void Cpu65816::executeJumpReturn(OpCode &opCode) {
         {
             Address returnAddress(mProgramAddress.getBank(), mStack.pull16Bit() + 1);
             setProgramAddress(returnAddress);
+            notifyReturn();
             addToCycles(6);
             break;
         }
@@ -27,20 +27,20 @@
  * This file contains implementations for all LDX OpCodes.
  */
 
-void Cpu65816::executeLDX8Bit(OpCode &opCode) {
+void Cpu65816::executeLDX8Bit(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     uint8_t value = mSystemBus.readByte(opCodeDataAddress);
     Binary::setLower8BitsOf16BitsValue(&mX, value);
     mCpuStatus.updateSignAndZeroFlagFrom8BitValue(value);
 }
 
-void Cpu65816::executeLDX16Bit(OpCode &opCode) {
+void Cpu65816::executeLDX16Bit(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     mX = mSystemBus.readTwoBytes(opCodeDataAddress);
     mCpuStatus.updateSignAndZeroFlagFrom16BitValue(mX);
 }
 
-void Cpu65816::executeLDX(OpCode &opCode) {
+void Cpu65816::executeLDX(const OpCode &opCode) {
     if (indexIs16BitWide()) {
         executeLDX16Bit(opCode);
         addToCycles(1);
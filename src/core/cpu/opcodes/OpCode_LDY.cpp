@@ -27,20 +27,20 @@
  * This file contains implementations for all LDY OpCodes.
  */
 
-void Cpu65816::executeLDY8Bit(OpCode &opCode) {
+void Cpu65816::executeLDY8Bit(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     uint8_t value = mSystemBus.readByte(opCodeDataAddress);
     Binary::setLower8BitsOf16BitsValue(&mY, value);
     mCpuStatus.updateSignAndZeroFlagFrom8BitValue(value);
 }
 
-void Cpu65816::executeLDY16Bit(OpCode &opCode) {
+void Cpu65816::executeLDY16Bit(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
     mY = mSystemBus.readTwoBytes(opCodeDataAddress);
     mCpuStatus.updateSignAndZeroFlagFrom16BitValue(mY);
 }
 
-void Cpu65816::executeLDY(OpCode &opCode) {
+void Cpu65816::executeLDY(const OpCode &opCode) {
     if (indexIs16BitWide()) {
         executeLDY16Bit(opCode);
         addToCycles(1);
@@ -41,7 +41,7 @@
  * This file contains implementations for all LSR OpCodes.
  */
 
-void Cpu65816::executeMemoryLSR(OpCode &opCode) {
+void Cpu65816::executeMemoryLSR(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
 
     if(accumulatorIs8BitWide()) {
@@ -55,7 +55,7 @@ void Cpu65816::executeMemoryLSR(OpCode &opCode) {
     }
 }
 
-void Cpu65816::executeAccumulatorLSR(OpCode &opCode) {
+void Cpu65816::executeAccumulatorLSR(const OpCode &opCode) {
     if(accumulatorIs8BitWide()) {
         uint8_t value = Binary::lower8BitsOf(mA);
         DO_LSR_8_BIT(value);
@@ -65,7 +65,7 @@ void Cpu65816::executeAccumulatorLSR(OpCode &opCode) {
     }
 }
 
-void Cpu65816::executeLSR(OpCode &opCode) {
+void Cpu65816::executeLSR(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case (0x4A):                // LSR Accumulator
         {
@@ -19,13 +19,15 @@
 
 #include "Cpu65816.hpp"
 
+#include <algorithm>
+
 #define LOG_TAG "Cpu::executeMisc"
 
 /**
  * This file contains implementations for all OpCodes that didn't fall into other categories.
  */
 
-void Cpu65816::executeMisc(OpCode &opCode) {
+void Cpu65816::executeMisc(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case(0xEB):     // XBA
         {
@@ -38,7 +40,8 @@ void Cpu65816::executeMisc(OpCode &opCode) {
         }
         case(0xDB):     // STP
         {
-            reset();
+            // Stopped until the next reset
+            mPins.RES = true;
             addToProgramAddress(1);
             addToCycles(3);
             break;
@@ -66,52 +69,12 @@ void Cpu65816::executeMisc(OpCode &opCode) {
         }
         case(0x44):     // MVP
         {
-            Address addressOfOpCodeData = getAddressOfOpCodeData(opCode);
-            uint8_t destinationBank = mSystemBus.readByte(addressOfOpCodeData);
-            addressOfOpCodeData.incrementOffsetBy(1);
-            uint8_t sourceBank = mSystemBus.readByte(addressOfOpCodeData);
-
-            Address sourceAddress(sourceBank, mX);
-            Address destinationAddress(destinationBank, mY);
-
-            while(mA != 0xFFFF) {
-                uint8_t toTransfer = mSystemBus.readByte(sourceAddress);
-                mSystemBus.storeByte(destinationAddress, toTransfer);
-
-                sourceAddress.decrementOffsetBy(1);
-                destinationAddress.decrementOffsetBy(1);
-                mA--;
-
-                addToCycles(7);
-            }
-            mDB = destinationBank;
-
-            addToProgramAddress(3);
+            executeBlockMove(opCode, true);
             break;
         }
         case(0x54):     // MVN
         {
-            Address addressOfOpCodeData = getAddressOfOpCodeData(opCode);
-            uint8_t destinationBank = mSystemBus.readByte(addressOfOpCodeData);
-            addressOfOpCodeData.incrementOffsetBy(1);
-            uint8_t sourceBank = mSystemBus.readByte(addressOfOpCodeData);
-
-            Address sourceAddress(sourceBank, mX);
-            Address destinationAddress(destinationBank, mY);
-
-            while(mA != 0xFFFF) {
-                uint8_t toTransfer = mSystemBus.readByte(sourceAddress);
-                mSystemBus.storeByte(destinationAddress, toTransfer);
-
-                sourceAddress.incrementOffsetBy(1);
-                destinationAddress.incrementOffsetBy(1);
-                mA--;
-
-                addToCycles(7);
-            }
-            mDB = destinationBank;
-
-            addToProgramAddress(3);
+            executeBlockMove(opCode, false);
             break;
         }
         default:
@@ -120,3 +83,34 @@ void Cpu65816::executeMisc(OpCode &opCode) {
         }
     }
 }
+
+void Cpu65816::executeBlockMove(const OpCode &opCode, bool decrement) {
+    Address addressOfOpCodeData = getAddressOfOpCodeData(opCode);
+    uint8_t destinationBank = mSystemBus.readByte(addressOfOpCodeData);
+    addressOfOpCodeData.incrementOffsetBy(1);
+    uint8_t sourceBank = mSystemBus.readByte(addressOfOpCodeData);
+
+    // The instruction moves one byte, 7 cycles, and executes again until A wraps around. All the
+    // bytes the run has cycles left for (outside a run all of them) are moved here, the bus
+    // moving them a page at most at a time.
+    uint32_t bytes = (uint32_t)mA + 1;
+    if (mRunStopCycles > mTotalCyclesCounter) {
+        bytes = std::min<uint64_t>(bytes, (mRunStopCycles - mTotalCyclesCounter + 6) / 7);
+    }
+    const uint16_t indexMask = indexIs8BitWide() ? 0x00FF : 0xFFFF;
+    while (bytes > 0) {
+        uint16_t count = (uint16_t)std::min<uint32_t>(bytes, PAGE_SIZE_BYTES);
+        uint16_t moved = mSystemBus.moveBlock(Address(sourceBank, mX), Address(destinationBank, mY), count, decrement);
+        uint16_t step = decrement ? (uint16_t)-moved : moved;
+        mX = (mX + step) & indexMask;
+        mY = (mY + step) & indexMask;
+        mA -= moved;
+        bytes -= moved;
+        addToCycles(7 * moved);
+    }
+    mDB = destinationBank;
+
+    if (mA == 0xFFFF) {
+        addToProgramAddress(3);
+    }
+}
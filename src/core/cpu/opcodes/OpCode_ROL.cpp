@@ -46,7 +46,7 @@
 /**
  * This file contains implementations for all ROL OpCodes.
  */
-void Cpu65816::executeMemoryROL(OpCode &opCode) {
+void Cpu65816::executeMemoryROL(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
 
     if(accumulatorIs8BitWide()) {
@@ -60,7 +60,7 @@ void Cpu65816::executeMemoryROL(OpCode &opCode) {
     }
 }
 
-void Cpu65816::executeAccumulatorROL(OpCode &opCode) {
+void Cpu65816::executeAccumulatorROL(const OpCode &opCode) {
     if(accumulatorIs8BitWide()) {
         uint8_t value = Binary::lower8BitsOf(mA);
         DO_ROL_8_BIT(value);
@@ -72,7 +72,7 @@ void Cpu65816::executeAccumulatorROL(OpCode &opCode) {
     }
 }
 
-void Cpu65816::executeROL(OpCode &opCode) {
+void Cpu65816::executeROL(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case (0x2A):                // ROL accumulator
         {
@@ -46,7 +46,7 @@
 /**
  * This file contains implementations for all ROR OpCodes.
  */
-void Cpu65816::executeMemoryROR(OpCode &opCode) {
+void Cpu65816::executeMemoryROR(const OpCode &opCode) {
     Address opCodeDataAddress = getAddressOfOpCodeData(opCode);
 
     if(accumulatorIs8BitWide()) {
@@ -60,7 +60,7 @@ void Cpu65816::executeMemoryROR(OpCode &opCode) {
     }
 }
 
-void Cpu65816::executeAccumulatorROR(OpCode &opCode) {
+void Cpu65816::executeAccumulatorROR(const OpCode &opCode) {
     if(accumulatorIs8BitWide()) {
         uint8_t value = Binary::lower8BitsOf(mA);
         DO_ROR_8_BIT(value);
@@ -72,7 +72,7 @@ void Cpu65816::executeAccumulatorROR(OpCode &opCode) {
     }
 }
 
-void Cpu65816::executeROR(OpCode &opCode) {
+void Cpu65816::executeROR(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case (0x6A):                // ROR accumulator
         {
@@ -26,7 +26,7 @@
  * that deal directly with the status register.
  */
 
-void Cpu65816::executeStatusReg(OpCode &opCode) {
+void Cpu65816::executeStatusReg(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case(0xC2):  // REP #const
         {
@@ -26,7 +26,7 @@
  * This file contains the implementation for TSB and TRB OpCodes
  */
 
-void Cpu65816::execute8BitTSB(OpCode &opCode) {
+void Cpu65816::execute8BitTSB(const OpCode &opCode) {
     const Address addressOfOpCodeData = getAddressOfOpCodeData(opCode);
     uint8_t value = mSystemBus.readByte(addressOfOpCodeData);
     uint8_t lowerA = Binary::lower8BitsOf(mA);
@@ -37,7 +37,7 @@ void Cpu65816::execute8BitTSB(OpCode &opCode) {
     else mCpuStatus.clearZeroFlag();
 }
 
-void Cpu65816::execute16BitTSB(OpCode &opCode) {
+void Cpu65816::execute16BitTSB(const OpCode &opCode) {
     const Address addressOfOpCodeData = getAddressOfOpCodeData(opCode);
     uint16_t value = mSystemBus.readTwoBytes(addressOfOpCodeData);
     const uint16_t result = value | mA;
@@ -47,7 +47,7 @@ void Cpu65816::execute16BitTSB(OpCode &opCode) {
     else mCpuStatus.clearZeroFlag();
 }
 
-void Cpu65816::execute8BitTRB(OpCode &opCode) {
+void Cpu65816::execute8BitTRB(const OpCode &opCode) {
     const Address addressOfOpCodeData = getAddressOfOpCodeData(opCode);
     uint8_t value = mSystemBus.readByte(addressOfOpCodeData);
     uint8_t lowerA = Binary::lower8BitsOf(mA);
@@ -58,7 +58,7 @@ void Cpu65816::execute8BitTRB(OpCode &opCode) {
     else mCpuStatus.clearZeroFlag();
 }
 
-void Cpu65816::execute16BitTRB(OpCode &opCode) {
+void Cpu65816::execute16BitTRB(const OpCode &opCode) {
     const Address addressOfOpCodeData = getAddressOfOpCodeData(opCode);
     uint16_t value = mSystemBus.readTwoBytes(addressOfOpCodeData);
     const uint16_t result = value & ~mA;
@@ -68,7 +68,7 @@ void Cpu65816::execute16BitTRB(OpCode &opCode) {
     else mCpuStatus.clearZeroFlag();
 }
 
-void Cpu65816::executeTSBTRB(OpCode &opCode) {
+void Cpu65816::executeTSBTRB(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case(0x0C):                 // TSB Absolute
         {
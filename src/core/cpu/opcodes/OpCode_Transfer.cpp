@@ -26,7 +26,7 @@
  * These are OpCodes which transfer one register value to another.
  */
 
-void Cpu65816::executeTransfer(OpCode &opCode) {
+void Cpu65816::executeTransfer(const OpCode &opCode) {
     switch (opCode.getCode()) {
         case(0xA8):  // TAY
         {
@@ -1,26 +1,120 @@
 #include "emulator.h"
 #include "cpu/Cpu65816.hpp"
 #include "cpu/Cpu65816Debugger.hpp"
+#include "cpu/Cpu65816Profiler.hpp"
+#include "cpu/Cpu65816Trace.hpp"
+#include "cpu/Cpu65816Stats.hpp"
+#include "cpu/Log.hpp"
 #include "memory/ram.h"
 #include "cartridge/cartridge.h"
 #include "timing/master_clock.h"
+#include "timing/frame_profiler.h"
+#include "timing/frame_pacer.h"
+#include "timing/thread_placement.h"
 #include "cpld/cpld1_audio.h"
 #include "cpld/cpld2_video.h"
 #include "cpld/cpld3_raster.h"
 #include "video/video_renderer.h"
+#include "video/frame_mailbox.h"
+#include "video/frame_sink.h"
 #include "audio/audio_mixer.h"
+#if defined(EMULATOR_HEADLESS)
+// Built without Qt for the headless tools: there is no audio device, the
+// mixer output just is not consumed
+class AudioOutput {};
+#else
 #include "audio/audio_output.h"
+#endif
+#include "state/save_state.h"
+#include "state/rewind_buffer.h"
+#include "state/input_movie.h"
+#include "netplay/rollback_session.h"
 #include "mailbox.h"
 #include "SystemBusDevice.hpp"
 #include "SystemBus.hpp"
 #include <iostream>
-#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <initializer_list>
+
+// Part of the boot snapshot names, builds set their own
+#ifndef SANO_VERSION
+#define SANO_VERSION "dev"
+#endif
+
+struct Emulator::CPUVectors {
+    CPUVectors(const EmulationModeInterrupts& emulation, const NativeModeInterrupts& native)
+        : emulation(emulation), native(native) {}
+    EmulationModeInterrupts emulation;
+    NativeModeInterrupts native;
+};
+
+// Memory sizes
+static constexpr uint32_t MAIN_RAM_SIZE = 128 * 1024;
+static constexpr uint32_t GRAPHICS_RAM_SIZE = 128 * 1024;
+static constexpr uint32_t SOUND_RAM_SIZE = 64 * 1024;
+static constexpr uint32_t MAILBOX_SIZE = 1024;
+
+// Everything initialize() puts in the arena
+static constexpr size_t ARENA_CAPACITY =
+    3 * (MachineArena::footprint<Cpu65816>() + MachineArena::footprint<EmulationModeInterrupts>() +
+         MachineArena::footprint<NativeModeInterrupts>()) +
+    3 * MachineArena::footprint<RAM>() + MachineArena::footprint(MAIN_RAM_SIZE) +
+    MachineArena::footprint(GRAPHICS_RAM_SIZE) + MachineArena::footprint(SOUND_RAM_SIZE) +
+    2 * (MachineArena::footprint<Mailbox>() + MachineArena::footprint(MAILBOX_SIZE)) +
+    MachineArena::footprint<CPLD1_Audio>() + MachineArena::footprint<CPLD2_Video>() +
+    MachineArena::footprint<CPLD3_Raster>();
 
 Emulator::Emulator()
     : running(false)
     , paused(false)
     , initialized(false)
+    , completedFrames(0)
+    , audioEnabled(false)
+    , emulationThreadQuit(false)
+    , mainProcessor(0)
+    , graphicsProcessor(0)
+    , soundProcessor(0)
+    , clockedCycles{0, 0, 0}
+    , nextScanline(0)
+    , nextAudioTick(0)
+    , dmaDoneCycle(0)
+    , vramArbitration(false)
+    , graphicsRunStart(0)
+    , graphicsCPURunStart(0)
+    , vramStallCycles(0)
+    , rewindBuffer(std::make_unique<RewindBuffer>())
+    , rewindEnabled(false)
+    , rewinding(false)
+    , runAheadFrames(0)
+    , headless(false)
+    , turbo(false)
+    , turboInterval(DEFAULT_TURBO_INTERVAL)
+    , turboFrames(0)
+    , mixingAudio(true)
+    , frameButtons(nullptr)
+    , netplaySession(nullptr)
+    , movieMode(MOVIE_NONE)
+    , movieFrame(0)
+    , movieDivergence(-1)
+    , bootSnapshotPending(false)
+    , bootSnapshotRestored(false)
+    , romImageHash(0)
+    , romImageHashed(false)
+    , profiler(std::make_unique<FrameProfiler>())
+    , framePacer(std::make_unique<FramePacer>())
 {
+    for (auto& pending : pendingDeferred) {
+        pending = 0;
+    }
+    for (auto& buttons : controllerState) {
+        buttons = 0;
+    }
+    frameSequence = 0;
+    lineSequences.fill(0);
+    publishedPalette.fill(0);
 }
 
 Emulator::~Emulator() {
@@ -38,8 +132,14 @@ bool Emulator::initialize() {
     
     std::cout << "Initializing SANo Emulator..." << std::endl;
     
+    if (!arena.allocate(ARENA_CAPACITY)) {
+        std::cerr << "Failed to allocate the machine state" << std::endl;
+        return false;
+    }
+    
     // Initialize master clock
     clock = std::make_unique<MasterClock>();
+    scheduler = std::make_unique<Scheduler>();
     
     // Initialize memory first
     if (!initializeMemory()) {
@@ -71,12 +171,17 @@ bool Emulator::initialize() {
     // Setup callbacks
     setupCallbacks();
     
+    // CPUs and timed events
+    setupScheduler();
+    
     initialized = true;
     std::cout << "Emulator initialized successfully" << std::endl;
     return true;
 }
 
 void Emulator::shutdown() {
+    stopEmulationThread();
+    
     if (running) {
         stop();
     }
@@ -84,27 +189,55 @@ void Emulator::shutdown() {
     // Cleanup in reverse order
     audioOutput.reset();
     audioMixer.reset();
+    frameMailbox.reset();
     videoRenderer.reset();
     
     cpld3.reset();
+    if (graphicsBus && cpld2) {
+        graphicsBus->unregisterDevice(cpld2.get());
+    }
     cpld2.reset();
+    if (soundBus && cpld1) {
+        soundBus->unregisterDevice(cpld1.get());
+    }
     cpld1.reset();
     
+    // Park the worker threads before taking their CPUs away
+    if (scheduler) {
+        scheduler->setThreaded(false);
+    }
+
+    // CPUs hold their bus and detach their code caches from it
+    soundStats.reset();
+    graphicsStats.reset();
+    mainStats.reset();
+    soundTrace.reset();
+    graphicsTrace.reset();
+    mainTrace.reset();
+    soundProfiler.reset();
+    graphicsProfiler.reset();
+    mainProfiler.reset();
+    soundCPU.reset();
+    graphicsCPU.reset();
+    mainCPU.reset();
+    
     soundBus.reset();
     graphicsBus.reset();
     mainBus.reset();
     
+    inputPort.reset();
     mailboxB.reset();
     mailboxA.reset();
     soundRAM.reset();
     graphicsRAM.reset();
     mainRAM.reset();
-    
-    soundCPU.reset();
-    graphicsCPU.reset();
-    mainCPU.reset();
+    soundVectors.reset();
+    graphicsVectors.reset();
+    mainVectors.reset();
+    arena.release();
     
     cartridge.reset();
+    scheduler.reset();
     clock.reset();
     
     initialized = false;
@@ -120,18 +253,16 @@ bool Emulator::loadROM(const std::string& filename) {
         return false;
     }
 
+    // Detach the previous cartridge before it is destroyed
+    detachCartridge();
+
     // Create cartridge and load ROM
-    cartridge = std::make_unique<Cartridge>();
-    if (!cartridge->loadROM(filename)) {
+    std::unique_ptr<Cartridge> loaded = std::make_unique<Cartridge>();
+    if (!loaded->loadROM(filename)) {
         std::cerr << "Failed to load ROM: " << filename << std::endl;
-        cartridge.reset();
         return false;
     }
-
-    // Register cartridge with main CPU bus
-    mainBus->registerDevice(cartridge.get());
-    graphicsBus->registerDevice(cartridge.get());
-    soundBus->registerDevice(cartridge.get());
+    attachCartridge(std::move(loaded));
 
     std::cout << "ROM loaded: " << filename << std::endl;
     return true;
@@ -143,21 +274,64 @@ bool Emulator::loadROMFromMemory(const uint8_t* data, size_t size) {
         return false;
     }
     
-    cartridge = std::make_unique<Cartridge>();
-    if (!cartridge->loadROM(data, size)) {
+    detachCartridge();
+    std::unique_ptr<Cartridge> loaded = std::make_unique<Cartridge>();
+    if (!loaded->loadROM(data, size)) {
         std::cerr << "Failed to load ROM from memory" << std::endl;
-        cartridge.reset();
         return false;
     }
+    attachCartridge(std::move(loaded));
     
     std::cout << "ROM loaded from memory" << std::endl;
     return true;
 }
 
+bool Emulator::loadROM(std::shared_ptr<const std::vector<uint8_t>> image) {
+    if (!initialized) {
+        std::cerr << "Emulator not initialized" << std::endl;
+        return false;
+    }
+    
+    detachCartridge();
+    std::unique_ptr<Cartridge> loaded = std::make_unique<Cartridge>();
+    if (!loaded->loadROM(std::move(image))) {
+        std::cerr << "Failed to load shared ROM image" << std::endl;
+        return false;
+    }
+    attachCartridge(std::move(loaded));
+    
+    std::cout << "ROM loaded from shared image" << std::endl;
+    return true;
+}
+
 void Emulator::unloadROM() {
     if (running) {
         stop();
     }
+    if (initialized) {
+        detachCartridge();
+    }
+    cartridge.reset();
+}
+
+void Emulator::attachCartridge(std::unique_ptr<Cartridge> loaded) {
+    // On every bus, the Graphics and Sound CPUs read their code from it too
+    cartridge = std::move(loaded);
+    romImageHashed = false;
+    mainBus->registerDevice(cartridge.get());
+    graphicsBus->registerDevice(cartridge.get());
+    soundBus->registerDevice(cartridge.get());
+    cpld1->setCartridge(cartridge.get());
+    attachSaveRAMFile();
+}
+
+void Emulator::detachCartridge() {
+    if (cartridge) {
+        mainBus->unregisterDevice(cartridge.get());
+        graphicsBus->unregisterDevice(cartridge.get());
+        soundBus->unregisterDevice(cartridge.get());
+        cpld1->setCartridge(nullptr);
+    }
     cartridge.reset();
 }
 
@@ -183,9 +357,9 @@ void Emulator::reset() {
         // Set Main CPU PC from ROM header bitches!!!!! lmmfao im tired of fucking typing
         if (cartridge && cartridge->isLoaded()) {
             uint32_t entryPoint = cartridge->getHeader().mainCPU_entryPoint;
-            Address startAddr(entryPoint >> 16, entryPoint & 0xFFFF);
+            Address startAddr = Address::fromFlat(entryPoint);
             mainCPU->setProgramAddress(startAddr);
-            std::cout << "Main CPU PC set to: $" <<std::hex << entryPoint << std::dec << std::endl;
+            Log::inf("Emulator").str("Main CPU PC set to ").hex(entryPoint, 6).show();
         }
     }
     if (graphicsCPU) {
@@ -197,9 +371,9 @@ void Emulator::reset() {
 
             if (entryPoint != 0) {
                 graphicsCPU->setRESPin(false);
-                Address startAddr(entryPoint >> 16, entryPoint & 0xFFFF);
+                Address startAddr = Address::fromFlat(entryPoint);
                 graphicsCPU->setProgramAddress(startAddr);
-                std::cout << "Graphics CPU PC set to: $" << std::hex << entryPoint << std::dec << std::endl;
+                Log::inf("Emulator").str("Graphics CPU PC set to ").hex(entryPoint, 6).show();
             } else {
                 std::cout << "Graphics CPU held in reset (mailbox boot)" << std::endl;
             }
@@ -212,9 +386,9 @@ void Emulator::reset() {
         // Set Sound CPU PC from ROM header
         if (cartridge && cartridge->isLoaded()) {
             uint32_t entryPoint = cartridge->getHeader().soundCPU_entryPoint;
-            Address startAddr(entryPoint >> 16, entryPoint & 0xFFFF);
+            Address startAddr = Address::fromFlat(entryPoint);
             soundCPU->setProgramAddress(startAddr);
-            std::cout << "Sound CPU PC set to: $" <<std::hex << entryPoint << std::dec << std::endl;
+            Log::inf("Emulator").str("Sound CPU PC set to ").hex(entryPoint, 6).show();
         }
     }
     
@@ -222,6 +396,23 @@ void Emulator::reset() {
     if (clock) {
         clock->reset();
     }
+    if (scheduler) {
+        scheduler->reset();
+        scheduleScanline(0);
+        scheduleAudioTick(0);
+    }
+    for (auto& pending : pendingDeferred) {
+        pending = 0;
+    }
+    // Its completion went with the events
+    if (cpld2) {
+        cpld2->cancelDMA();
+    }
+    clockedCycles[0] = clockedCycles[1] = clockedCycles[2] = 0;
+    completedFrames = 0;
+    // Nothing to go back to before reset
+    rewindBuffer->clear();
+    restoreBootSnapshot();
     std::cout << "Emulator reset" << std::endl;
 }
 
@@ -241,34 +432,95 @@ void Emulator::runFrame() {
     if (!running || paused || !mainCPU) {
         return;
     }
+    
+    {
+        FrameProfiler::Scope scope(profiler.get(), FrameProfiler::FRAME);
+        
+        // A movie holds every frame from its start, none may be stepped back over
+        if (rewinding && rewindEnabled && movieMode == MOVIE_NONE) {
+            rewindFrame();
+        } else {
+            latchInput();
+            
+            int ahead = runAheadFrames;
+            if (headless) {
+                emulateFrame(false, false);
+            } else if (turbo) {
+                // Audio of the frames shown as long as the device keeps up,
+                // so nothing piles up in the output ring once turbo ends
+                if (++turboFrames >= turboInterval) {
+                    turboFrames = 0;
+                    emulateFrame(true, audioMixer->getBufferedFrames() <= audioMixer->getTargetBufferedFrames());
+                    publishFrame();
+                } else {
+                    emulateFrame(false, false);
+                }
+            } else if (ahead > 0) {
+                runAhead(ahead);
+            } else {
+                emulateFrame(true, true);
+                publishFrame();
+            }
+            completedFrames = clock ? clock->getFrameCount() : 0;
+            
+            captureRewindState();
+            checkMovieFrame();
+            checkBootSnapshot();
+        }
+        
+        // No CPU runs until the next frame
+        if (cartridge) {
+            cartridge->snapshotSaveRAM();
+        }
+    }
+    profiler->endFrame();
+}
 
+void Emulator::runFrame(const uint16_t* buttons) {
+    frameButtons = buttons;
+    runFrame();
+    frameButtons = nullptr;
+}
+
+void Emulator::emulateFrame(bool renderVideo, bool mixAudio) {
     // Increment frame counter
     if (clock) {
         clock->runFrame();
     }
-
-    //DEBUG BLOCK
-    static int frameCounter = 0;
-    if (frameCounter++ % 60 == 0) {
-        std::cout << "runFrame() called, frame " << frameCounter << std::endl;
-    }
-    
-    // Simple frame execution - run CPUs for one frame worth of cycles
-    // At 60 Hz, each frame is ~16.67ms
-    // Main CPU runs at ~3.58 MHz = ~59,667 cycles per frame
     
-    const uint32_t CYCLES_PER_FRAME = 59667;
-    
-    runMainCPU(CYCLES_PER_FRAME);
-    runGraphicsCPU(CYCLES_PER_FRAME);
-    runSoundCPU(CYCLES_PER_FRAME);
+    // Interleave the CPUs with the scanline, audio and IRQ events
+    mixingAudio = mixAudio;
+    if (scheduler) {
+        scheduler->runFrame();
+        feedClock();
+    }
+    mixingAudio = true;
     
     // Render video frame
-    if (videoRenderer) {
+    if (renderVideo && videoRenderer) {
+        FrameProfiler::Scope scope(profiler.get(), FrameProfiler::VIDEO_RENDER);
         videoRenderer->renderFrame();
     }
 }
 
+void Emulator::runAhead(int frames) {
+    // The frame that counts, heard but not seen
+    emulateFrame(false, true);
+    if (!saveState(runAheadState)) {
+        return;
+    }
+    
+    // Then the frames ahead, only the last one is shown. A state we just
+    // wrote loads back, the backup loadState() takes is not needed here
+    for (int i = 1; i < frames; i++) {
+        emulateFrame(false, false);
+    }
+    emulateFrame(true, false);
+    publishFrame();
+    
+    readState(runAheadState.data(), runAheadState.size());
+}
+
 void Emulator::step() {
     if (!running || !mainCPU) {
         return;
@@ -283,6 +535,177 @@ void Emulator::stop() {
     std::cout << "Emulator stopped" << std::endl;
 }
 
+//=============================================================================
+// Emulation Thread
+//=============================================================================
+
+void Emulator::startEmulationThread() {
+    if (emulationThread.joinable()) {
+        return;
+    }
+    emulationThreadQuit = false;
+    emulationThread = std::thread(&Emulator::emulationThreadLoop, this);
+}
+
+void Emulator::stopEmulationThread() {
+    if (!emulationThread.joinable()) {
+        return;
+    }
+    emulationThreadQuit = true;
+    emulationThread.join();
+}
+
+void Emulator::emulationThreadLoop() {
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::ROLE_EMULATION, "sano-emulation");
+    
+    using Clock = std::chrono::steady_clock;
+    const auto framePeriod = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / MasterClock::FRAME_RATE));
+    // Further behind than this (debugger, suspended host), start over instead of catching up
+    const auto maxLag = framePeriod * 4;
+    
+    auto deadline = Clock::now();
+    while (!emulationThreadQuit) {
+        // A netplay frame waiting for the peer takes a frame period, there is no audio to pace it
+        bool ran = true;
+        if (netplaySession) {
+            ran = netplaySession->runFrame();
+        } else {
+            runFrame();
+        }
+        
+        if (turbo && !paused) {
+            // As fast as it goes, the pace starts over from where it ends
+            deadline = Clock::now();
+            continue;
+        }
+        if (framePacer->isLocked() && !paused && ran) {
+            // Started just after the display's refresh, the mixer resamples
+            // the audio to the display's rate
+            deadline = framePacer->nextDeadline(deadline);
+            auto now = Clock::now();
+            if (now > deadline + maxLag) {
+                deadline = now;
+            } else if (now < deadline) {
+                std::this_thread::sleep_until(deadline);
+            }
+            continue;
+        }
+        if (audioEnabled && !paused && ran && !rewinding) {
+            // The audio device drains samples at its own rate, run the next frame
+            // once it got down to the target level. Rewinding queues none, the
+            // frame period paces it
+            auto limit = Clock::now() + maxLag;
+            while (!emulationThreadQuit && Clock::now() < limit &&
+                   audioMixer->getBufferedFrames() > audioMixer->getTargetBufferedFrames()) {
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+            deadline = Clock::now();
+            continue;
+        }
+        
+        // Deadlines advance by exact frame periods, so the frame rate does not drift
+        deadline += framePeriod;
+        auto now = Clock::now();
+        if (now > deadline + maxLag) {
+            deadline = now;
+        } else if (now < deadline) {
+            std::this_thread::sleep_until(deadline);
+        }
+    }
+}
+
+void Emulator::publishFrame() {
+    if (!frameMailbox) {
+        return;
+    }
+    
+    // Lines the renderer changed since the last frame are this frame's
+    frameSequence++;
+    bool changed = videoRenderer->hasChangedLines();
+    const std::array<uint8_t, VideoRenderer::OUTPUT_HEIGHT>& changedLines = videoRenderer->getChangedLines();
+    const int height = videoRenderer->getOutputHeight();
+    for (int line = 0; line < height; ++line) {
+        if (changedLines[line]) {
+            lineSequences[line] = frameSequence;
+        }
+    }
+    videoRenderer->clearChangedLines();
+    
+    // The write frame still holds what it was published with, only the lines changed
+    // since have to be copied. Everything when it was written in the other format or
+    // the other height
+    FrameMailbox::Frame& frame = frameMailbox->getWriteFrame();
+    bool indexed = videoRenderer->isIndexedOutput();
+    uint64_t copiedSequence = frame.indexed == indexed && frame.height == height &&
+                              frame.sequence <= frameSequence ? frame.sequence : 0;
+    frame.indexed = indexed;
+    frame.height = height;
+    frame.field = videoRenderer->getOutputField();
+    const int width = FrameMailbox::WIDTH;
+    for (int line = 0; line < height; ++line) {
+        if (lineSequences[line] <= copiedSequence) {
+            continue;
+        }
+        if (indexed) {
+            const uint8_t* indices = videoRenderer->getIndexedFramebuffer() + line * width;
+            std::copy(indices, indices + width, frame.indices.begin() + line * width);
+        } else {
+            const uint32_t* pixels = videoRenderer->getFramebuffer() + line * width;
+            std::copy(pixels, pixels + width, frame.pixels.begin() + line * width);
+        }
+    }
+    if (indexed) {
+        // The same indices in other colors
+        const uint32_t* palette = videoRenderer->getOutputPalette();
+        if (!std::equal(publishedPalette.begin(), publishedPalette.end(), palette)) {
+            std::copy(palette, palette + publishedPalette.size(), publishedPalette.begin());
+            changed = true;
+        }
+        frame.palette = publishedPalette;
+    }
+    frame.number = clock ? clock->getFrameCount() : 0;
+    frame.sequence = frameSequence;
+    frame.lineSequences = lineSequences;
+    
+    // Ahead of the display, which may read the frame once published
+    for (FrameSink* sink : frameSinks) {
+        sink->writeFrame(frame);
+        sink->writeAudio(sinkAudio.data(), sinkAudio.size() / 2);
+    }
+    sinkAudio.clear();
+    frameMailbox->publish();
+    
+    if (frameCallback) {
+        frameCallback(changed);
+    }
+}
+
+void Emulator::captureRewindState() {
+    if (!rewindEnabled) {
+        return;
+    }
+    if (clock->getFrameCount() % rewindBuffer->getInterval() == 0 && saveState(rewindState)) {
+        rewindBuffer->push(rewindState);
+    }
+}
+
+void Emulator::rewindFrame() {
+    // Holds on the oldest frame once the history runs out
+    if (!rewindBuffer->stepBack(rewindState) || !loadState(rewindState)) {
+        return;
+    }
+    
+    // The state holds VRAM and the CPLDs, i.e. everything the frame is made of
+    if (videoRenderer) {
+        {
+            FrameProfiler::Scope scope(profiler.get(), FrameProfiler::VIDEO_RENDER);
+            videoRenderer->renderFrame();
+        }
+        publishFrame();
+    }
+}
+
 void Emulator::pause() {
     paused = true;
 }
@@ -291,10 +714,460 @@ void Emulator::resume() {
     paused = false;
 }
 
+//=============================================================================
+// Save States
+//=============================================================================
+
+// Section tags, in the order they are written
+static constexpr uint32_t SECTION_EMULATOR = SaveState::tag("EMUL");
+static constexpr uint32_t SECTION_SCHEDULER = SaveState::tag("SCHD");
+static constexpr uint32_t SECTION_CLOCK = SaveState::tag("CLCK");
+static constexpr uint32_t SECTION_MAIN_CPU = SaveState::tag("CPUM");
+static constexpr uint32_t SECTION_GRAPHICS_CPU = SaveState::tag("CPUG");
+static constexpr uint32_t SECTION_SOUND_CPU = SaveState::tag("CPUS");
+static constexpr uint32_t SECTION_MAIN_RAM = SaveState::tag("RAMM");
+static constexpr uint32_t SECTION_GRAPHICS_RAM = SaveState::tag("RAMG");
+static constexpr uint32_t SECTION_SOUND_RAM = SaveState::tag("RAMS");
+static constexpr uint32_t SECTION_MAILBOX_A = SaveState::tag("MBXA");
+static constexpr uint32_t SECTION_MAILBOX_B = SaveState::tag("MBXB");
+static constexpr uint32_t SECTION_CPLD1 = SaveState::tag("CPL1");
+static constexpr uint32_t SECTION_CPLD2 = SaveState::tag("CPL2");
+static constexpr uint32_t SECTION_CPLD3 = SaveState::tag("CPL3");
+static constexpr uint32_t SECTION_CARTRIDGE = SaveState::tag("CART");
+
+bool Emulator::saveState(std::vector<uint8_t>& state) {
+    if (!initialized || !isROMLoaded()) {
+        return false;
+    }
+
+    state.clear();
+    StateWriter writer(state);
+
+    writer.beginSection(SECTION_EMULATOR);
+    writer.writeValue(nextScanline);
+    writer.writeValue(nextAudioTick);
+    writer.writeValue(dmaDoneCycle);
+    writer.writeValue(clockedCycles);
+    writer.writeValue(completedFrames.load());
+    for (const auto& pending : pendingDeferred) {
+        writer.writeValue(pending.load());
+    }
+    writer.endSection();
+
+    writer.beginSection(SECTION_SCHEDULER);
+    scheduler->saveState(writer);
+    writer.endSection();
+
+    writer.beginSection(SECTION_CLOCK);
+    clock->saveState(writer);
+    writer.endSection();
+
+    const std::pair<uint32_t, Cpu65816*> cpus[] = {
+        { SECTION_MAIN_CPU, mainCPU.get() },
+        { SECTION_GRAPHICS_CPU, graphicsCPU.get() },
+        { SECTION_SOUND_CPU, soundCPU.get() },
+    };
+    for (const auto& cpu : cpus) {
+        writer.beginSection(cpu.first);
+        writer.writeValue(cpu.second->saveState());
+        writer.endSection();
+    }
+
+    const std::pair<uint32_t, RAM*> rams[] = {
+        { SECTION_MAIN_RAM, mainRAM.get() },
+        { SECTION_GRAPHICS_RAM, graphicsRAM.get() },
+        { SECTION_SOUND_RAM, soundRAM.get() },
+    };
+    for (const auto& ram : rams) {
+        writer.beginSection(ram.first);
+        ram.second->saveState(writer);
+        writer.endSection();
+    }
+
+    writer.beginSection(SECTION_MAILBOX_A);
+    mailboxA->saveState(writer);
+    writer.endSection();
+    writer.beginSection(SECTION_MAILBOX_B);
+    mailboxB->saveState(writer);
+    writer.endSection();
+
+    writer.beginSection(SECTION_CPLD1);
+    cpld1->saveState(writer);
+    writer.endSection();
+    writer.beginSection(SECTION_CPLD2);
+    cpld2->saveState(writer);
+    writer.endSection();
+    writer.beginSection(SECTION_CPLD3);
+    cpld3->saveState(writer);
+    writer.endSection();
+
+    writer.beginSection(SECTION_CARTRIDGE);
+    cartridge->saveState(writer);
+    writer.endSection();
+
+    writer.finish();
+    return true;
+}
+
+bool Emulator::loadState(const uint8_t* data, size_t size) {
+    if (!initialized || !isROMLoaded()) {
+        return false;
+    }
+
+    // Sections are applied as they are read, keep the way back
+    saveState(stateBackup);
+    if (readState(data, size)) {
+        return true;
+    }
+
+    std::cerr << "Emulator: Failed to load state" << std::endl;
+    readState(stateBackup.data(), stateBackup.size());
+    return false;
+}
+
+bool Emulator::readState(const uint8_t* data, size_t size) {
+    StateReader reader(data, size);
+    if (!reader.readHeader()) {
+        return false;
+    }
+
+    uint64_t frames;
+    uint32_t pending[DEFERRED_EVENT_COUNT];
+    if (!reader.enterSection(SECTION_EMULATOR) ||
+        !reader.readValue(nextScanline) ||
+        !reader.readValue(nextAudioTick) ||
+        !reader.readValue(dmaDoneCycle) ||
+        !reader.readValue(clockedCycles) ||
+        !reader.readValue(frames) ||
+        !reader.readValue(pending) ||
+        !reader.leaveSection()) {
+        return false;
+    }
+
+    // Drops the events, the pending ones are scheduled again below
+    if (!reader.enterSection(SECTION_SCHEDULER) || !scheduler->loadState(reader) || !reader.leaveSection()) {
+        return false;
+    }
+    if (!reader.enterSection(SECTION_CLOCK) || !clock->loadState(reader) || !reader.leaveSection()) {
+        return false;
+    }
+
+    const std::pair<uint32_t, Cpu65816*> cpus[] = {
+        { SECTION_MAIN_CPU, mainCPU.get() },
+        { SECTION_GRAPHICS_CPU, graphicsCPU.get() },
+        { SECTION_SOUND_CPU, soundCPU.get() },
+    };
+    for (const auto& cpu : cpus) {
+        Cpu65816::State cpuState;
+        if (!reader.enterSection(cpu.first) || !reader.readValue(cpuState) || !reader.leaveSection()) {
+            return false;
+        }
+        cpu.second->loadState(cpuState);
+    }
+
+    const std::pair<uint32_t, RAM*> rams[] = {
+        { SECTION_MAIN_RAM, mainRAM.get() },
+        { SECTION_GRAPHICS_RAM, graphicsRAM.get() },
+        { SECTION_SOUND_RAM, soundRAM.get() },
+    };
+    for (const auto& ram : rams) {
+        if (!reader.enterSection(ram.first) || !ram.second->loadState(reader) || !reader.leaveSection()) {
+            return false;
+        }
+    }
+
+    if (!reader.enterSection(SECTION_MAILBOX_A) || !mailboxA->loadState(reader) || !reader.leaveSection() ||
+        !reader.enterSection(SECTION_MAILBOX_B) || !mailboxB->loadState(reader) || !reader.leaveSection()) {
+        return false;
+    }
+    if (!reader.enterSection(SECTION_CPLD1) || !cpld1->loadState(reader) || !reader.leaveSection() ||
+        !reader.enterSection(SECTION_CPLD2) || !cpld2->loadState(reader) || !reader.leaveSection() ||
+        !reader.enterSection(SECTION_CPLD3) || !cpld3->loadState(reader) || !reader.leaveSection()) {
+        return false;
+    }
+    if (!reader.enterSection(SECTION_CARTRIDGE) || !cartridge->loadState(reader) || !reader.leaveSection()) {
+        return false;
+    }
+
+    completedFrames = frames;
+    scheduleScanline(nextScanline);
+    scheduleAudioTick(nextAudioTick);
+    if (cpld2->isDMAActive()) {
+        scheduleDMACompletion(dmaDoneCycle);
+    }
+    for (int event = 0; event < DEFERRED_EVENT_COUNT; event++) {
+        pendingDeferred[event] = 0;
+        for (uint32_t i = 0; i < pending[event]; i++) {
+            scheduleAtNextSync(static_cast<DeferredEvent>(event));
+        }
+    }
+    return true;
+}
+
+bool Emulator::saveStateToFile(const std::string& filename) {
+    std::vector<uint8_t> state;
+    if (!saveState(state)) {
+        return false;
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Emulator: Failed to create state file: " << filename << std::endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(state.data()), state.size());
+    return file.good();
+}
+
+bool Emulator::loadStateFromFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Emulator: Failed to open state file: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> state(static_cast<size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    if (!file.read(reinterpret_cast<char*>(state.data()), state.size())) {
+        return false;
+    }
+    return loadState(state);
+}
+
+//=============================================================================
+// Instant-on
+//=============================================================================
+
+void Emulator::setBootSnapshotDirectory(const std::string& directory) {
+    bootSnapshotDirectory = directory;
+    bootSnapshotPending = false;
+}
+
+uint64_t Emulator::getROMImageHash() {
+    // Once per ROM, each reset would read all of it again
+    if (!romImageHashed) {
+        romImageHash = InputMovie::hashState(cartridge->getImageData(), cartridge->getImageSize());
+        romImageHashed = true;
+    }
+    return romImageHash;
+}
+
+std::string Emulator::getBootSnapshotPath() {
+    char name[96];
+    std::snprintf(name, sizeof(name), "%016llx-%s-v%u.snst",
+                  (unsigned long long)getROMImageHash(), SANO_VERSION, (unsigned)SaveState::VERSION);
+    return bootSnapshotDirectory + "/" + name;
+}
+
+void Emulator::restoreBootSnapshot() {
+    bootSnapshotPending = false;
+    bootSnapshotRestored = false;
+    if (bootSnapshotDirectory.empty() || !isROMLoaded() || movieMode != MOVIE_NONE) {
+        return;
+    }
+    
+    // Not there yet: the boot goes on and is saved at its end
+    std::string path = getBootSnapshotPath();
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        bootSnapshotPending = true;
+        return;
+    }
+    std::vector<uint8_t> state(static_cast<size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    // The save RAM stays the file's, not what it was on the first boot
+    std::vector<uint8_t> saveRAM;
+    if (cartridge->isSaveRAMPersistent()) {
+        saveRAM = cartridge->getSaveRAM();
+    }
+    if (!file.read(reinterpret_cast<char*>(state.data()), state.size()) || !loadState(state)) {
+        std::cerr << "Emulator: Boot snapshot unusable, booting: " << path << std::endl;
+        bootSnapshotPending = true;
+        return;
+    }
+    if (!saveRAM.empty()) {
+        cartridge->setSaveRAM(saveRAM);
+    }
+    bootSnapshotRestored = true;
+    std::cout << "Emulator: Boot snapshot restored: " << path << std::endl;
+}
+
+void Emulator::checkBootSnapshot() {
+    if (!bootSnapshotPending) {
+        return;
+    }
+    // Frames of a movie or going back in time are not a boot
+    if (movieMode != MOVIE_NONE || rewinding || completedFrames > BOOT_SNAPSHOT_MAX_FRAMES) {
+        bootSnapshotPending = false;
+        return;
+    }
+    if (mainCPU->getRESPin() || graphicsCPU->getRESPin() || soundCPU->getRESPin() || cpld2->isDMAActive()) {
+        return;
+    }
+    bootSnapshotPending = false;
+    
+    // Written aside and renamed, a launch never finds half a state
+    std::vector<uint8_t> state;
+    if (!saveState(state)) {
+        return;
+    }
+    std::string path = getBootSnapshotPath();
+    std::string partial = path + ".tmp";
+    {
+        std::ofstream file(partial, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(state.data()), state.size());
+        if (!file.good()) {
+            std::cerr << "Emulator: Failed to write boot snapshot: " << partial << std::endl;
+            std::remove(partial.c_str());
+            return;
+        }
+    }
+    if (std::rename(partial.c_str(), path.c_str()) != 0) {
+        std::remove(partial.c_str());
+        return;
+    }
+    std::cout << "Emulator: Boot snapshot saved after " << completedFrames << " frames: " << path << std::endl;
+}
+
+//=============================================================================
+// Save RAM
+//=============================================================================
+
+void Emulator::setSaveRAMDirectory(const std::string& directory) {
+    saveRAMDirectory = directory;
+    if (cartridge) {
+        cartridge->detachSaveRAMFile();
+        attachSaveRAMFile();
+    }
+}
+
+void Emulator::attachSaveRAMFile() {
+    if (saveRAMDirectory.empty() || !cartridge->isLoaded()) {
+        return;
+    }
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.sav", (unsigned long long)getROMImageHash());
+    if (!cartridge->attachSaveRAMFile(saveRAMDirectory + "/" + name)) {
+        std::cerr << "Emulator: Save RAM not kept in " << saveRAMDirectory << std::endl;
+    }
+}
+
+//=============================================================================
+// Input and Movies
+//=============================================================================
+
+void Emulator::setControllerState(int port, uint16_t buttons) {
+    if (port >= 0 && port < InputPort::PORT_COUNT) {
+        controllerState[port].store(buttons, std::memory_order_relaxed);
+    }
+}
+
+uint16_t Emulator::getControllerState(int port) const {
+    if (port >= 0 && port < InputPort::PORT_COUNT) {
+        return controllerState[port].load(std::memory_order_relaxed);
+    }
+    return 0;
+}
+
+bool Emulator::startMovieRecording() {
+    std::vector<uint8_t> state;
+    if (!saveState(state)) {
+        return false;
+    }
+    movie = std::make_unique<InputMovie>();
+    movie->setInitialState(state);
+    movieMode = MOVIE_RECORDING;
+    movieFrame = 0;
+    movieDivergence = -1;
+    return true;
+}
+
+bool Emulator::startMoviePlayback(std::unique_ptr<InputMovie> playback) {
+    if (!playback || !loadState(playback->getInitialState())) {
+        return false;
+    }
+    movie = std::move(playback);
+    movieMode = MOVIE_PLAYBACK;
+    movieFrame = 0;
+    movieDivergence = -1;
+    return true;
+}
+
+std::unique_ptr<InputMovie> Emulator::stopMovie() {
+    movieMode = MOVIE_NONE;
+    return std::move(movie);
+}
+
+bool Emulator::isMoviePlaybackFinished() const {
+    return movieMode == MOVIE_PLAYBACK && movieFrame >= movie->getFrameCount();
+}
+
+void Emulator::latchInput() {
+    uint16_t buttons[InputPort::PORT_COUNT];
+    if (movieMode == MOVIE_PLAYBACK && !isMoviePlaybackFinished()) {
+        const InputMovie::Frame& frame = movie->getFrame(movieFrame);
+        for (int port = 0; port < InputPort::PORT_COUNT; port++) {
+            buttons[port] = frame.buttons[port];
+        }
+    } else if (frameButtons) {
+        for (int port = 0; port < InputPort::PORT_COUNT; port++) {
+            buttons[port] = frameButtons[port];
+        }
+    } else {
+        for (int port = 0; port < InputPort::PORT_COUNT; port++) {
+            buttons[port] = controllerState[port].load(std::memory_order_relaxed);
+        }
+    }
+    
+    if (movieMode == MOVIE_RECORDING) {
+        InputMovie::Frame frame = {};
+        for (int port = 0; port < InputPort::PORT_COUNT; port++) {
+            frame.buttons[port] = buttons[port];
+        }
+        movie->addFrame(frame);
+    }
+    inputPort->latch(buttons);
+}
+
+void Emulator::checkMovieFrame() {
+    if (movieMode == MOVIE_NONE || isMoviePlaybackFinished() || !saveState(movieState)) {
+        return;
+    }
+    
+    uint64_t hash = InputMovie::hashState(movieState.data(), movieState.size());
+    if (movieMode == MOVIE_RECORDING) {
+        movie->setStateHash(movieFrame, hash);
+    } else if (hash != movie->getFrame(movieFrame).stateHash && movieDivergence < 0) {
+        movieDivergence = static_cast<int64_t>(movieFrame);
+        Log::wrn("Emulator").str("Movie playback diverged at frame ").num(movieDivergence).show();
+    }
+    movieFrame++;
+}
+
 //=============================================================================
 // Video Access
 //=============================================================================
 
+void Emulator::addFrameSink(FrameSink* sink) {
+    if (!sink || std::find(frameSinks.begin(), frameSinks.end(), sink) != frameSinks.end()) {
+        return;
+    }
+    frameSinks.push_back(sink);
+    if (audioMixer) {
+        audioMixer->setCaptureBuffer(&sinkAudio);
+    }
+}
+
+void Emulator::removeFrameSink(FrameSink* sink) {
+    frameSinks.erase(std::remove(frameSinks.begin(), frameSinks.end(), sink), frameSinks.end());
+    if (frameSinks.empty()) {
+        if (audioMixer) {
+            audioMixer->setCaptureBuffer(nullptr);
+        }
+        sinkAudio.clear();
+    }
+}
+
 const uint32_t* Emulator::getFramebuffer() const {
     if (videoRenderer) {
         return videoRenderer->getFramebuffer();
@@ -307,7 +1180,31 @@ int Emulator::getFramebufferWidth() const {
 }
 
 int Emulator::getFramebufferHeight() const {
-    return 240;
+    return videoRenderer ? videoRenderer->getOutputHeight() : VideoRenderer::HEIGHT;
+}
+
+void Emulator::setIndexedOutput(bool enabled) {
+    if (videoRenderer) {
+        videoRenderer->setIndexedOutput(enabled);
+    }
+}
+
+bool Emulator::isIndexedOutput() const {
+    return videoRenderer && videoRenderer->isIndexedOutput();
+}
+
+const uint8_t* Emulator::getIndexedFramebuffer() const {
+    if (videoRenderer) {
+        return videoRenderer->getIndexedFramebuffer();
+    }
+    return nullptr;
+}
+
+const uint32_t* Emulator::getFramebufferPalette() const {
+    if (videoRenderer) {
+        return videoRenderer->getOutputPalette();
+    }
+    return nullptr;
 }
 
 //=============================================================================
@@ -315,12 +1212,36 @@ int Emulator::getFramebufferHeight() const {
 //=============================================================================
 
 void Emulator::setAudioEnabled(bool enabled) {
-    // TODO: Implement
+#if !defined(EMULATOR_HEADLESS)
+    if (!audioOutput) {
+        return;
+    }
+    
+    if (enabled) {
+        // Frames are paced by the audio device from now on, if there is one
+        audioEnabled = audioOutput->start();
+    } else {
+        audioEnabled = false;
+        audioOutput->stop();
+    }
+#else
+    (void)enabled;
+#endif
+}
+
+void Emulator::setLowLatencyAudio(bool enabled) {
+#if !defined(EMULATOR_HEADLESS)
+    if (audioOutput) {
+        audioOutput->setBackend(enabled ? AudioOutput::BACKEND_LOW_LATENCY : AudioOutput::BACKEND_QT);
+    }
+#else
+    (void)enabled;
+#endif
 }
 
 void Emulator::setMasterVolume(float volume) {
     if (audioMixer) {
-        // audioMixer->setMasterVolume(volume);
+        audioMixer->setMasterVolume(volume);
     }
 }
 
@@ -329,15 +1250,119 @@ void Emulator::setMasterVolume(float volume) {
 //=============================================================================
 
 double Emulator::getEmulationSpeed() const {
-    // TODO: Calculate actual speed
-    return 1.0;
+    return profiler->getFrameRate() / MasterClock::FRAME_RATE;
 }
 
 uint64_t Emulator::getFrameCount() const {
-    if (clock) {
-        return clock->getFrameCount();
+    // Read from the UI while frames run on the emulation thread
+    return completedFrames;
+}
+
+void Emulator::setGuestProfiling(bool enabled, uint32_t intervalCycles) {
+    if (!initialized) {
+        return;
     }
-    return 0;
+    for (Cpu65816Profiler* profiler : { mainProfiler.get(), graphicsProfiler.get(), soundProfiler.get() }) {
+        if (enabled) {
+            profiler->clear();
+            profiler->start(intervalCycles);
+        } else {
+            profiler->stop();
+        }
+    }
+}
+
+bool Emulator::isGuestProfiling() const {
+    return mainProfiler && mainProfiler->isRunning();
+}
+
+void Emulator::writeGuestProfile(std::ostream& out, bool folded) const {
+    if (!initialized) {
+        return;
+    }
+    for (const Cpu65816Profiler* profiler : { mainProfiler.get(), graphicsProfiler.get(), soundProfiler.get() }) {
+        if (folded) {
+            profiler->writeFoldedStacks(out);
+        } else {
+            profiler->writeFlatProfile(out);
+        }
+    }
+}
+
+void Emulator::setInstructionTrace(bool enabled, size_t entries) {
+    if (!initialized) {
+        return;
+    }
+    for (Cpu65816Trace* trace : { mainTrace.get(), graphicsTrace.get(), soundTrace.get() }) {
+        if (enabled) {
+            trace->start(entries > 0 ? entries : Cpu65816Trace::DEFAULT_CAPACITY);
+        } else {
+            trace->stop();
+        }
+    }
+}
+
+bool Emulator::isInstructionTracing() const {
+    return mainTrace && mainTrace->isRunning();
+}
+
+void Emulator::writeInstructionTrace(std::ostream& out, bool text) const {
+    if (!initialized) {
+        return;
+    }
+    for (const Cpu65816Trace* trace : { mainTrace.get(), graphicsTrace.get(), soundTrace.get() }) {
+        if (text) {
+            trace->writeText(out);
+        } else {
+            trace->write(out);
+        }
+    }
+}
+
+void Emulator::setExecutionStats(bool enabled) {
+    if (!initialized) {
+        return;
+    }
+    for (Cpu65816Stats* stats : { mainStats.get(), graphicsStats.get(), soundStats.get() }) {
+        if (enabled) {
+            stats->start();
+        } else {
+            stats->stop();
+        }
+    }
+}
+
+bool Emulator::isCountingExecution() const {
+    return mainStats && mainStats->isRunning();
+}
+
+void Emulator::writeExecutionStats(std::ostream& out, bool json) const {
+    if (!initialized) {
+        return;
+    }
+    // Header bytes, whatever they are, kept to printable ASCII
+    std::string title = isROMLoaded() ? std::string(cartridge->getHeader().title) : std::string();
+    for (char& c : title) {
+        if (c < 0x20 || c > 0x7E) {
+            c = '?';
+        }
+    }
+    const Cpu65816Stats* cpus[] = { mainStats.get(), graphicsStats.get(), soundStats.get() };
+    if (!json) {
+        Cpu65816Stats::writeCSVHeader(out);
+        for (const Cpu65816Stats* stats : cpus) {
+            stats->writeCSV(out, title);
+        }
+        return;
+    }
+    
+    // An array of the CPUs' objects
+    out << "[\n  ";
+    for (size_t i = 0; i < 3; i++) {
+        cpus[i]->writeJSON(out, title);
+        out << (i < 2 ? ",\n  " : "\n");
+    }
+    out << "]\n";
 }
 
 //=============================================================================
@@ -352,8 +1377,7 @@ bool Emulator::initializeCPUs() {
     // For now, point everything to ROM start address
     const uint16_t DEFAULT_VECTOR = 0x0000;  // Will be set from ROM
     
-    // Create interrupt structures for Main CPU
-    auto mainEmulationInt = new EmulationModeInterrupts{
+    const EmulationModeInterrupts emulationVectors{
         DEFAULT_VECTOR,  // coProcessorEnable
         DEFAULT_VECTOR,  // unused
         DEFAULT_VECTOR,  // abort
@@ -362,7 +1386,7 @@ bool Emulator::initializeCPUs() {
         DEFAULT_VECTOR   // brkIrq
     };
     
-    auto mainNativeInt = new NativeModeInterrupts{
+    const NativeModeInterrupts nativeVectors{
         DEFAULT_VECTOR,  // coProcessorEnable
         DEFAULT_VECTOR,  // brk
         DEFAULT_VECTOR,  // abort
@@ -371,37 +1395,36 @@ bool Emulator::initializeCPUs() {
         DEFAULT_VECTOR   // interruptRequest
     };
     
-    // Graphics CPU interrupts
-    auto graphicsEmulationInt = new EmulationModeInterrupts{
-        DEFAULT_VECTOR, DEFAULT_VECTOR, DEFAULT_VECTOR,
-        DEFAULT_VECTOR, DEFAULT_VECTOR, DEFAULT_VECTOR
-    };
-    
-    auto graphicsNativeInt = new NativeModeInterrupts{
-        DEFAULT_VECTOR, DEFAULT_VECTOR, DEFAULT_VECTOR,
-        DEFAULT_VECTOR, DEFAULT_VECTOR, DEFAULT_VECTOR
-    };
-    
-    // Sound CPU interrupts
-    auto soundEmulationInt = new EmulationModeInterrupts{
-        DEFAULT_VECTOR, DEFAULT_VECTOR, DEFAULT_VECTOR,
-        DEFAULT_VECTOR, DEFAULT_VECTOR, DEFAULT_VECTOR
-    };
-    
-    auto soundNativeInt = new NativeModeInterrupts{
-        DEFAULT_VECTOR, DEFAULT_VECTOR, DEFAULT_VECTOR,
-        DEFAULT_VECTOR, DEFAULT_VECTOR, DEFAULT_VECTOR
-    };
+    // Each CPU's vectors go right before it
+    mainVectors = arena.create<CPUVectors>(emulationVectors, nativeVectors);
+    mainCPU = arena.create<Cpu65816>(*mainBus, &mainVectors->emulation, &mainVectors->native);
+    graphicsVectors = arena.create<CPUVectors>(emulationVectors, nativeVectors);
+    graphicsCPU = arena.create<Cpu65816>(*graphicsBus, &graphicsVectors->emulation, &graphicsVectors->native);
+    soundVectors = arena.create<CPUVectors>(emulationVectors, nativeVectors);
+    soundCPU = arena.create<Cpu65816>(*soundBus, &soundVectors->emulation, &soundVectors->native);
+    if (!mainCPU || !graphicsCPU || !soundCPU) {
+        return false;
+    }
     
-    // Create CPUs with their buses and interrupt vectors
-    mainCPU = std::make_unique<Cpu65816>(*mainBus, mainEmulationInt, mainNativeInt);
-    graphicsCPU = std::make_unique<Cpu65816>(*graphicsBus, graphicsEmulationInt, graphicsNativeInt);
-    soundCPU = std::make_unique<Cpu65816>(*soundBus, soundEmulationInt, soundNativeInt);
+    mainProfiler = std::make_unique<Cpu65816Profiler>(*mainCPU, "main");
+    graphicsProfiler = std::make_unique<Cpu65816Profiler>(*graphicsCPU, "graphics");
+    soundProfiler = std::make_unique<Cpu65816Profiler>(*soundCPU, "sound");
+    mainTrace = std::make_unique<Cpu65816Trace>(*mainCPU, "main");
+    graphicsTrace = std::make_unique<Cpu65816Trace>(*graphicsCPU, "graphics");
+    soundTrace = std::make_unique<Cpu65816Trace>(*soundCPU, "sound");
+    mainStats = std::make_unique<Cpu65816Stats>(*mainCPU, "main");
+    graphicsStats = std::make_unique<Cpu65816Stats>(*graphicsCPU, "graphics");
+    soundStats = std::make_unique<Cpu65816Stats>(*soundCPU, "sound");
     
     // Set initial pin states
     mainCPU->setRDYPin(true);
     graphicsCPU->setRDYPin(true);
     soundCPU->setRDYPin(true);
+    
+    // Decoded blocks executed whole, same results as instruction by instruction
+    mainCPU->setBlockExecution(true);
+    graphicsCPU->setBlockExecution(true);
+    soundCPU->setBlockExecution(true);
 
     //Hold CPUs in reset unitl ROM is loaded
     mainCPU->setRESPin(true);
@@ -418,29 +1441,39 @@ bool Emulator::initializeMemory() {
     soundBus = std::make_unique<SystemBus>();
     
     // Create RAM modules with base addresses and sizes
+    // Contents in the arena as well, each right before its RAM
     // Main RAM: 128KB at $000000
-    mainRAM = std::make_unique<RAM>(0x000000, 128 * 1024, "Main RAM");
+    mainRAM = arena.create<RAM>(0x000000, MAIN_RAM_SIZE, "Main RAM", arena.allocateBytes(MAIN_RAM_SIZE));
     
     // Graphics RAM: 128KB at $000000 (in graphics CPU address space)
-    graphicsRAM = std::make_unique<RAM>(0x000000, 128 * 1024, "Graphics RAM");
+    graphicsRAM = arena.create<RAM>(0x000000, GRAPHICS_RAM_SIZE, "Graphics RAM", arena.allocateBytes(GRAPHICS_RAM_SIZE));
     
     // Sound RAM: 64KB at $000000 (in sound CPU address space)
-    soundRAM = std::make_unique<RAM>(0x000000, 64 * 1024, "Sound RAM");
+    soundRAM = arena.create<RAM>(0x000000, SOUND_RAM_SIZE, "Sound RAM", arena.allocateBytes(SOUND_RAM_SIZE));
     
     // Create mailboxes
     // Mailbox A: Main <-> Graphics at $400000
-    mailboxA = std::make_unique<Mailbox>(0x400000, 1024, "Mailbox A");
+    mailboxA = arena.create<Mailbox>(0x400000, MAILBOX_SIZE, "Mailbox A", arena.allocateBytes(MAILBOX_SIZE));
     
     // Mailbox B: Main <-> Sound at $410000
-    mailboxB = std::make_unique<Mailbox>(0x410000, 1024, "Mailbox B");
+    mailboxB = arena.create<Mailbox>(0x410000, MAILBOX_SIZE, "Mailbox B", arena.allocateBytes(MAILBOX_SIZE));
+    if (!mainRAM || !graphicsRAM || !soundRAM || !mailboxA || !mailboxB) {
+        return false;
+    }
+    
+    // Controllers at $430000
+    inputPort = std::make_unique<InputPort>();
     
     return true;
 }
 
 bool Emulator::initializeVideo() {
     // Create CPLDs
-    cpld2 = std::make_unique<CPLD2_Video>();
-    cpld3 = std::make_unique<CPLD3_Raster>();
+    cpld2 = arena.create<CPLD2_Video>();
+    cpld3 = arena.create<CPLD3_Raster>();
+    if (!cpld2 || !cpld3) {
+        return false;
+    }
     
     // Create video renderer
     videoRenderer = std::make_unique<VideoRenderer>();
@@ -455,19 +1488,33 @@ bool Emulator::initializeVideo() {
     videoRenderer->setCPLD2(cpld2.get());
     videoRenderer->setCPLD3(cpld3.get());
     
+    frameMailbox = std::make_unique<FrameMailbox>();
+    frameSequence = 0;
+    lineSequences.fill(0);
+    publishedPalette.fill(0);
+    
     return true;
 }
 
 bool Emulator::initializeAudio() {
     // Create CPLD1
-    cpld1 = std::make_unique<CPLD1_Audio>();
+    cpld1 = arena.create<CPLD1_Audio>();
+    if (!cpld1) {
+        return false;
+    }
     
     // Create audio components
     audioMixer = std::make_unique<AudioMixer>();
-    audioOutput = std::make_unique<AudioOutput>();
     
-    // TODO: Connect mixer to output
-    // audioMixer->setOutput(audioOutput.get());
+    // Sound CPU FIFOs -> mixer (emulated 32 kHz) -> output ring -> audio device
+    audioMixer->setCPLD1(cpld1.get());
+    if (!frameSinks.empty()) {
+        audioMixer->setCaptureBuffer(&sinkAudio);
+    }
+#if !defined(EMULATOR_HEADLESS)
+    audioOutput = std::make_unique<AudioOutput>();
+    audioOutput->setMixer(audioMixer.get());
+#endif
     
     return true;
 }
@@ -479,14 +1526,18 @@ void Emulator::setupMemoryMaps() {
     mainBus->registerDevice(mainRAM.get());
     mainBus->registerDevice(mailboxA.get());
     mainBus->registerDevice(mailboxB.get());
+    mainBus->registerDevice(inputPort.get());
 
-    // Graphics CPU - VRAM
+    // Graphics CPU - VRAM, CPLD2 registers. CPLD2 sits in mailbox A's window
+    // and is registered first, so $400200-$40024B reach CPLD2
     graphicsBus->registerDevice(graphicsRAM.get());
+    graphicsBus->registerDevice(cpld2.get());
     graphicsBus->registerDevice(mailboxA.get());
 
-    // Sound CPU - sound RAM
+    // Sound CPU - sound RAM, audio FIFOs
     soundBus->registerDevice(soundRAM.get());
     soundBus->registerDevice(mailboxB.get());
+    soundBus->registerDevice(cpld1.get());
 
     std::cout << "Emulator: Memory maps configured" << std::endl;
 }
@@ -500,15 +1551,7 @@ void Emulator::setupCallbacks() {
             graphicsCPU->setRESPin(false);
             graphicsCPU->setProgramAddress(Address(0, 0));
 
-            // Debug: What does Graphics CPU see at $0000?
-            Address testAddr(0, 0);
-            uint8_t fromBus = graphicsBus->readByte(testAddr);
-            std::cout << "[GFX CPU] graphicsBus->readByte($0000) = $"
-            << std::hex << (int)fromBus << std::dec << std::endl;
-
-            Address pc = graphicsCPU->getProgramAddress();
-            std::cout << "[GFX CPU] Released, PC=$" << std::hex
-            << (int)pc.getBank() << ":" << pc.getOffset() << std::dec << std::endl;
+            Log::dbg("Emulator").str("Graphics CPU released").show();
         } else {
             graphicsCPU->setRESPin(true);
         }
@@ -520,10 +1563,7 @@ void Emulator::setupCallbacks() {
             // Release from reset - pulse it
             soundCPU->setRESPin(false);
             soundCPU->setProgramAddress(Address(0, 0));
-
-            Address pc = soundCPU->getProgramAddress();
-            std::cout << "[SFX CPU] Released, PC=$" << std::hex
-            << (int)pc.getBank() << ":" << pc.getOffset() << std::dec << std::endl;
+            Log::dbg("Emulator").str("Sound CPU released").show();
         } else {
             soundCPU->setRESPin(true);
         }
@@ -531,141 +1571,276 @@ void Emulator::setupCallbacks() {
 
     // CPLD2 handles Mailbox A → Graphics CPU
     cpld2->setMailboxA(mailboxA.get());
-    cpld2->setMailboxACallback([this]() {
-        std::cout << "[CPLD2] Mailbox A written - triggering Graphics CPU IRQ" << std::endl;
-        graphicsCPU->setIRQPin(true);
-    });
 
     // CPLD1 handles Mailbox B → Sound CPU
     cpld1->setMailboxB(mailboxB.get());
-    cpld1->setMailboxBCallback([this]() {
-        std::cout << "[CPLD1] Mailbox B written - triggering Sound CPU IRQ" << std::endl;
-        soundCPU->setIRQPin(true);
-    });
 
-    // Tell mailboxes to notify CPLD2 when written
+    // Tell mailboxes to notify CPLD2 when written. The CPLDs DMA into the
+    // RAM of the receiving CPU, which may be running on another thread
     mailboxA->setWriteCallback([this]() {
-        cpld2->onMailboxAWrite();
+        runAtSync(MAILBOX_A_WRITE);
     });
 
     mailboxB->setWriteCallback([this]() {
-        cpld1->onMailboxBWrite();
+        runAtSync(MAILBOX_B_WRITE);
+    });
+
+    // Raster registers are read against the scheduler's time
+    cpld2->setCycleSource([this]() {
+        return scheduler->getCurrentCycle();
     });
 
-    // CPLD2 triggers CPU IRQs when mailboxes are written
+    // Boot copies take their time, the Graphics CPU is released once done
+    cpld2->setDMAStartCallback([this](uint32_t cycles) {
+        scheduleDMACompletion(scheduler->getCurrentCycle() + cycles);
+    });
+
+    // CPLD2 triggers CPU IRQs when mailboxes are written. The writer is
+    // ahead of the receiving CPU, so the IRQ is raised at the next sync point
     cpld2->setMailboxACallback([this]() {
-        std::cout << "[CPLD2] Mailbox A written - triggering Graphics CPU IRQ" << std::endl;
-        graphicsCPU->setIRQPin(true);
+        Log::trc("Emulator").str("Mailbox A written, Graphics CPU IRQ").show();
+        mailboxA->countIRQ();
+        scheduleAtNextSync(GRAPHICS_IRQ);
     });
 
     cpld1->setMailboxBCallback([this]() {
-        std::cout << "[CPLD2] Mailbox B written - triggering Sound CPU IRQ" << std::endl;
-        soundCPU->setIRQPin(true);
+        Log::trc("Emulator").str("Mailbox B written, Sound CPU IRQ").show();
+        mailboxB->countIRQ();
+        scheduleAtNextSync(SOUND_IRQ);
     });
-}
 
-//=============================================================================
-// Emulation Loop Helpers
-//=============================================================================
+    graphicsCPU->getInterrupts().setAcknowledgedWhenTaken(IRQ_SOURCE_MAILBOX, true);
+    soundCPU->getInterrupts().setAcknowledgedWhenTaken(IRQ_SOURCE_MAILBOX, true);
 
-void Emulator::runMainCPU(uint32_t cycles) {
-    if (!mainCPU) return;
-
-    //DEBUG BLOCK
-    static bool first = true;
-    if (first) {
-        std::cout << "First runMainCPU() call" <<std::endl;
-        first = false;
-    }
+    // The other sources stay pending until cleared in their CPLD
+    cpld2->setVBlankCallback([this](bool asserted) {
+        graphicsCPU->getInterrupts().setSource(IRQ_SOURCE_VBLANK, asserted);
+    });
+    cpld2->setHBlankCallback([this](bool asserted) {
+        graphicsCPU->getInterrupts().setSource(IRQ_SOURCE_HBLANK, asserted);
+    });
+    cpld3->setIRQCallback([this](bool asserted) {
+        graphicsCPU->getInterrupts().setSource(IRQ_SOURCE_RASTER, asserted);
+    });
+    cpld1->setIRQCallback([this](bool asserted) {
+        soundCPU->getInterrupts().setSource(IRQ_SOURCE_AUDIO_FIFO, asserted);
+    });
+}
 
-    static int callCount = 0;
-    if (callCount++ == 0) {
-        Address pc = mainCPU->getProgramAddress();
-        uint32_t flatPC = (pc.getBank() << 16) | pc.getOffset();
-        uint8_t opcode = mainBus->readByte(pc);
-        std::cout << " opcode=$" << std::hex << std::setw(2) << std::setfill('0') << (int)opcode << std::dec;
-        if (opcode == 0x8F) {
-            uint8_t addr_lo = mainBus->readByte(pc.newWithOffset(1));
-            uint8_t addr_mid = mainBus->readByte(pc.newWithOffset(2));
-            uint8_t addr_hi = mainBus->readByte(pc.newWithOffset(3));
-            uint32_t targetAddr = (addr_hi << 16) | (addr_mid << 8) | addr_lo;
-            std::cout << " *** STA to $" << std::hex << targetAddr << std::dec << " ***";
+void Emulator::setupScheduler() {
+    // The Main CPU always runs on the thread calling runFrame()
+    mainProcessor = scheduler->addProcessor(MasterClock::MAIN_CPU_FREQ, [this](uint64_t cycles) {
+        return runMainCPU(cycles);
+    });
+    graphicsProcessor = scheduler->addProcessor(MasterClock::GRAPHICS_CPU_FREQ, [this](uint64_t cycles) {
+        return runGraphicsCPU(cycles);
+    }, true);
+    soundProcessor = scheduler->addProcessor(MasterClock::SOUND_CPU_FREQ, [this](uint64_t cycles) {
+        return runSoundCPU(cycles);
+    }, true);
+    scheduler->setWorkerStart([this](size_t processor) {
+        if (processor == graphicsProcessor) {
+            ThreadPlacement::applyToCurrentThread(ThreadPlacement::ROLE_GRAPHICS_CPU, "sano-graphics");
+        } else if (processor == soundProcessor) {
+            ThreadPlacement::applyToCurrentThread(ThreadPlacement::ROLE_SOUND_CPU, "sano-sound");
         }
-        std::cout << "CPU PC at start: $" << std::hex << flatPC << std::dec << std::endl;
-    }
-    
-    //Print first 10 instructions
-    static int instrCount = 0;
+    });
+    // The CPUs only talk through the mailboxes, the CPLDs' IRQs included.
+    // Reads are left out, a CPU polling its mailbox is waiting for a write
+    scheduler->setInteractionSource([this]() {
+        uint64_t interactions = 0;
+        for (const Mailbox* mailbox : { mailboxA.get(), mailboxB.get() }) {
+            Mailbox::Statistics statistics = mailbox->getStatistics();
+            interactions += statistics.writes + statistics.irqs;
+        }
+        return interactions;
+    });
 
-    // Execute instructions until we've used up the cycles
-    // Note: executeNextInstruction() returns true if instruction was executed
-    for (uint32_t i = 0; i < cycles; ++i) {
-        if (!running || paused) break;
+    scheduleScanline(0);
+    scheduleAudioTick(0);
+}
 
-        // TRACE: Print PC before executing
-        if (instrCount < 1) {
-            Address pc = mainCPU->getProgramAddress();
-            uint32_t flatPC = (pc.getBank() << 16) | pc.getOffset();
-            std::cout << "[TRACE] Executing at PC: $" << std::hex << flatPC << std::dec << std::endl;
-            instrCount++;
-        }
+void Emulator::scheduleScanline(uint64_t line) {
+    // Lines are counted from reset, spread evenly over the frame
+    uint64_t time = (line * MasterClock::CYCLES_PER_FRAME_GRAPHICS) / MasterClock::TOTAL_SCANLINES;
+    nextScanline = line;
+    scheduler->scheduleAt(time, [this, line]() {
+        onScanline(static_cast<int>(line % MasterClock::TOTAL_SCANLINES));
+        scheduleScanline(line + 1);
+    });
+}
 
-        mainCPU->executeNextInstruction();
-    }
+void Emulator::scheduleDMACompletion(uint64_t time) {
+    dmaDoneCycle = time;
+    scheduler->scheduleAt(time, [this]() {
+        cpld2->completeDMA();
+    });
+}
+
+void Emulator::scheduleAudioTick(uint64_t tick) {
+    uint64_t time = (tick * MasterClock::GRAPHICS_CPU_FREQ) / MasterClock::AUDIO_SAMPLE_RATE;
+    nextAudioTick = tick;
+    scheduler->scheduleAt(time, [this, tick]() {
+        onAudioSample();
+        scheduleAudioTick(tick + 1);
+    });
 }
 
-void Emulator::runGraphicsCPU(uint32_t cycles) {
-    if (!graphicsCPU) return;
+void Emulator::setSyncGranularity(Scheduler::SyncGranularity granularity) {
+    if (scheduler) {
+        scheduler->setSyncGranularity(granularity);
+    }
+}
 
-/*
-    static bool firstExec = true;
-    if (firstExec) {
-        firstExec = false;
+void Emulator::setThreadedExecution(bool enabled, uint64_t quantum) {
+    if (!initialized) {
+        return;
+    }
+    if (quantum != 0) {
+        scheduler->setQuantum(quantum);
+    }
 
-        Address pcBefore = graphicsCPU->getProgramAddress();
-        std::cout << "[GFX TEST] Before: PC=$" << std::hex << pcBefore.getOffset() << std::dec << std::endl;
+    // The cartridge is on every bus: its bank switches reach the other buses
+    // at their next slice instead of under the feet of their CPU
+    mainBus->setDeferUpdates(enabled);
+    graphicsBus->setDeferUpdates(enabled);
+    soundBus->setDeferUpdates(enabled);
+
+    scheduler->setThreaded(enabled);
+    std::cout << "Threaded execution " << (enabled ? "enabled" : "disabled")
+              << ", quantum " << scheduler->getQuantum() << " cycles";
+    if (scheduler->isAdaptiveQuantum()) {
+        std::cout << ", adapting from " << scheduler->getMinimumQuantum() << " to " << scheduler->getMaximumQuantum();
+    }
+    std::cout << std::endl;
+}
 
-        graphicsCPU->executeNextInstruction();
+bool Emulator::isThreadedExecution() const {
+    return scheduler && scheduler->isThreaded();
+}
 
-        Address pcAfter = graphicsCPU->getProgramAddress();
-        std::cout << "[GFX TEST] After: PC=$" << std::hex << pcAfter.getOffset() << std::dec << std::endl;
+void Emulator::setAdaptiveQuantum(bool enabled) {
+    if (scheduler) {
+        scheduler->setAdaptiveQuantum(enabled);
+    }
+}
 
+void Emulator::setVRAMArbitration(bool enabled) {
+    if (!initialized) {
         return;
     }
-*/
-    for (uint32_t i = 0; i < cycles; ++i) {
-        if (!running || paused) break;
-        graphicsCPU->executeNextInstruction();
+    vramArbitration = enabled;
+    if (!enabled) {
+        graphicsRAM->clearContention();
+        return;
     }
-
-    // After every 1000 frames, dump some VRAM
-    static int frameCheck = 0;
-    if (frameCheck++ == 60) {  // After 1 second
-        std::cout << "[VRAM CHECK] VRAM[$20-$23]: ";
-        for (int i = 0x20; i < 0x24; i++) {
-            std::cout << std::hex << (int)graphicsRAM->readByte(Address(0, i)) << " ";
+    // Only the Graphics CPU stores through a bus into its RAM. The scheduler's
+    // time is the start of the slice, the CPU's own is further on
+    graphicsRAM->setContention(CPLD2_Video::VRAM_FETCH_START, GRAPHICS_RAM_SIZE - 1, [this](uint32_t) {
+        uint64_t now = graphicsRunStart + (graphicsCPU->getTotalCycles() - graphicsCPURunStart);
+        uint32_t stall = cpld2->getGCpuVramStall(now);
+        if (stall > 0) {
+            graphicsCPU->addWaitCycles(stall);
+            vramStallCycles.fetch_add(stall, std::memory_order_relaxed);
         }
-        std::cout << std::dec << std::endl;
+    });
+}
+
+void Emulator::runAtSync(DeferredEvent event) {
+    if (scheduler && scheduler->isThreaded()) {
+        scheduleAtNextSync(event);
+    } else {
+        fireDeferred(event);
     }
+}
+
+void Emulator::scheduleAtNextSync(DeferredEvent event) {
+    // May be called from the CPU threads
+    pendingDeferred[event]++;
+    scheduler->scheduleAtNextSync([this, event]() {
+        pendingDeferred[event]--;
+        fireDeferred(event);
+    });
+}
 
-    // Debug: Print PC occasionally
-    static int debugCount = 0;
-    if (debugCount++ % 10000 == 0) {
-        Address pc = graphicsCPU->getProgramAddress();
-        std::cout << "[GFX CPU] PC=$" << std::hex
-        << (int)pc.getBank() << ":" << pc.getOffset()
-        << " VRAM[0]=$" << (int)graphicsRAM->readByte(Address(0,0))
-        << std::dec << std::endl;
+void Emulator::fireDeferred(DeferredEvent event) {
+    switch (event) {
+        case MAILBOX_A_WRITE:
+            cpld2->onMailboxAWrite();
+            break;
+        case MAILBOX_B_WRITE:
+            cpld1->onMailboxBWrite();
+            break;
+        case GRAPHICS_IRQ:
+            graphicsCPU->getInterrupts().raise(IRQ_SOURCE_MAILBOX);
+            break;
+        case SOUND_IRQ:
+            soundCPU->getInterrupts().raise(IRQ_SOURCE_MAILBOX);
+            break;
+        default:
+            break;
     }
 }
 
-void Emulator::runSoundCPU(uint32_t cycles) {
-    if (!soundCPU) return;
+void Emulator::feedClock() {
+    if (!clock) return;
 
-    for (uint32_t i = 0; i < cycles; ++i) {
-        if (!running || paused) break;
-        soundCPU->executeNextInstruction();
+    // The CPUs may run on several threads, the clock hears about them afterwards
+    const size_t processors[3] = { mainProcessor, graphicsProcessor, soundProcessor };
+    uint64_t elapsed[3];
+    for (int i = 0; i < 3; i++) {
+        uint64_t cycles = scheduler->getProcessorCycles(processors[i]);
+        elapsed[i] = cycles - clockedCycles[i];
+        clockedCycles[i] = cycles;
     }
+    clock->addMainCPUCycles(static_cast<uint32_t>(elapsed[0]));
+    clock->addGraphicsCPUCycles(static_cast<uint32_t>(elapsed[1]));
+    clock->addSoundCPUCycles(static_cast<uint32_t>(elapsed[2]));
+}
+
+//=============================================================================
+// Emulation Loop Helpers
+//=============================================================================
+
+uint64_t Emulator::runMainCPU(uint64_t cycles) {
+    if (!mainCPU) return cycles;
+
+    if (!running || paused) return cycles;
+
+    // Bank switches made by the other CPUs meanwhile
+    mainBus->applyDeferredUpdates();
+    FrameProfiler::Scope scope(profiler.get(), FrameProfiler::MAIN_CPU);
+    // A CPU that stopped early (reset held, WAI) still lets its time go by
+    uint64_t elapsed = std::max<uint64_t>(mainCPU->run(cycles), cycles);
+    return elapsed;
+}
+
+uint64_t Emulator::runGraphicsCPU(uint64_t cycles) {
+    if (!graphicsCPU) return cycles;
+
+    if (!running || paused) return cycles;
+
+    // Bank switches made by the other CPUs meanwhile
+    graphicsBus->applyDeferredUpdates();
+    FrameProfiler::Scope scope(profiler.get(), FrameProfiler::GRAPHICS_CPU);
+    // Master cycles are Graphics CPU cycles
+    graphicsRunStart = scheduler->getProcessorCycles(graphicsProcessor);
+    graphicsCPURunStart = graphicsCPU->getTotalCycles();
+    uint64_t elapsed = std::max<uint64_t>(graphicsCPU->run(cycles), cycles);
+
+    return elapsed;
+}
+
+uint64_t Emulator::runSoundCPU(uint64_t cycles) {
+    if (!soundCPU) return cycles;
+
+    if (!running || paused) return cycles;
+
+    // Bank switches made by the other CPUs meanwhile
+    soundBus->applyDeferredUpdates();
+    FrameProfiler::Scope scope(profiler.get(), FrameProfiler::SOUND_CPU);
+    uint64_t elapsed = std::max<uint64_t>(soundCPU->run(cycles), cycles);
+    return elapsed;
 }
 
 //=============================================================================
@@ -678,10 +1853,26 @@ void Emulator::onVBlank() {
 }
 
 void Emulator::onScanline(int scanline) {
-    // TODO: Handle per-scanline events
-    // Raster effects, etc.
+    // HSYNC: latch raster effects and check the split-line IRQ
+    if (cpld3) {
+        cpld3->onHSync(static_cast<uint16_t>(scanline));
+    }
+    if (cpld2) {
+        cpld2->onHSync(static_cast<uint16_t>(scanline));
+    }
+    if (scanline == MasterClock::SCANLINES_PER_FRAME) {
+        onVBlank();
+    }
 }
 
 void Emulator::onAudioSample() {
-    // TODO: Handle audio sample generation
+    // Play the samples at the front of the FIFOs and drain them, at 32 kHz,
+    // the mixer takes them a block at a time
+    if (cpld1) {
+        cpld1->tick();
+    }
+    if (audioMixer && mixingAudio) {
+        FrameProfiler::Scope scope(profiler.get(), FrameProfiler::AUDIO_MIX);
+        audioMixer->produceFrame();
+    }
 }
@@ -1,13 +1,25 @@
 #ifndef EMULATOR_H
 #define EMULATOR_H
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <iosfwd>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 #include <cstdint>
+#include "memory/input_port.h"
+#include "memory/machine_arena.h"
 #include "memory/mailbox.h"
+#include "timing/scheduler.h"
 
 // Forward declarations
 class Cpu65816;
+class Cpu65816Profiler;
+class Cpu65816Trace;
+class Cpu65816Stats;
 class RAM;
 class Cartridge;
 class MasterClock;
@@ -15,10 +27,17 @@ class CPLD1_Audio;
 class CPLD2_Video;
 class CPLD3_Raster;
 class VideoRenderer;
+class FrameMailbox;
 class AudioMixer;
 class AudioOutput;
 class Mailbox;
 class SystemBus;
+class RewindBuffer;
+class InputMovie;
+class FrameProfiler;
+class FramePacer;
+class FrameSink;
+class RollbackSession;
 
 /**
  * SANo Emulator
@@ -30,7 +49,9 @@ class SystemBus;
  * - Audio output
  * - Timing synchronization
  * 
- * This is the top-level class that ties everything together.
+ * This is the top-level class that ties everything together. Instances
+ * share no mutable state, any number of them may run on threads of their
+ * own, sharing a ROM image if they load the same one.
  */
 class Emulator {
 public:
@@ -44,15 +65,28 @@ public:
     // ROM loading
     bool loadROM(const std::string& filename);
     bool loadROMFromMemory(const uint8_t* data, size_t size);
+    // Read in place, instances loading the same image share its memory (as
+    // they share the page cache of a mapped ROM file)
+    bool loadROM(std::shared_ptr<const std::vector<uint8_t>> image);
     void unloadROM();
     
     // Emulation control
     void reset();
     void run();          // Run until stopped
     void runFrame();     // Run one frame (60 Hz)
+    // One frame on the given buttons, one per port, instead of the
+    // controllers' (netplay, see RollbackSession)
+    void runFrame(const uint16_t* buttons);
     void step();         // Run one instruction on Main CPU
     void stop();
     
+    // Dedicated emulation thread, running frames at 60 Hz on its own
+    // timer, or as fast as the audio device drains them with audio enabled.
+    // Stop it before loading a ROM or resetting.
+    void startEmulationThread();
+    void stopEmulationThread();
+    bool isEmulationThreadRunning() const { return emulationThread.joinable(); }
+    
     // State
     bool isRunning() const { return running; }
     bool isPaused() const { return paused; }
@@ -62,42 +96,228 @@ public:
     void pause();
     void resume();
     
+    // Save states (see StateWriter), a flat binary snapshot of the CPUs,
+    // memories, CPLDs, clock and cartridge bank and save RAM. Both are to be
+    // called between frames on the thread running them, i.e. with the
+    // emulation thread stopped or from the frame callback. A state loads back
+    // with the same ROM only; the machine is left as it was if it failed.
+    bool saveState(std::vector<uint8_t>& state);
+    bool loadState(const uint8_t* data, size_t size);
+    bool loadState(const std::vector<uint8_t>& state) { return loadState(state.data(), state.size()); }
+    bool saveStateToFile(const std::string& filename);
+    bool loadStateFromFile(const std::string& filename);
+    
+    // Instant-on, off by default. The first boot of a ROM saves a state in
+    // the directory once boot is over: every CPU out of reset, the boot DMA
+    // done. The state is named after the hash of the ROM image and the build.
+    // From then on reset() loads it instead of booting. A state that fails
+    // to load is taken again. Empty turns it off.
+    void setBootSnapshotDirectory(const std::string& directory);
+    // reset() loaded the snapshot
+    bool isBootSnapshotRestored() const { return bootSnapshotRestored; }
+    
+    // Battery backed save RAM, off by default. Every ROM gets save RAM kept
+    // in the directory, in a file named after the hash of the ROM image,
+    // written back in the background as it changes. Boot snapshots leave it
+    // as the file has it. Empty turns it off.
+    void setSaveRAMDirectory(const std::string& directory);
+    
+    // Rewind. While enabled a state is pushed into the rewind buffer every
+    // interval frames; while rewinding (e.g. a key held) each frame steps
+    // back one of them instead of running. Both flags may be set from any
+    // thread, configure the buffer with the emulation thread stopped.
+    void setRewindEnabled(bool enabled) { rewindEnabled = enabled; }
+    bool isRewindEnabled() const { return rewindEnabled; }
+    void setRewinding(bool active) { rewinding = active; }
+    bool isRewinding() const { return rewinding; }
+    RewindBuffer* getRewindBuffer() const { return rewindBuffer.get(); }
+    
+    // Input
+    // Buttons held on each controller (see InputPort), from any thread. The
+    // guest sees them from the start of the next frame on.
+    void setControllerState(int port, uint16_t buttons);
+    uint16_t getControllerState(int port) const;
+    
+    // Netplay: while a session is set the emulation thread runs its frames
+    // (see RollbackSession) instead of its own. Not owned, set it with the
+    // emulation thread stopped.
+    void setNetplaySession(RollbackSession* session) { netplaySession = session; }
+    RollbackSession* getNetplaySession() const { return netplaySession; }
+    
+    // Input movies (see InputMovie). Recording takes a state then, every
+    // frame, the buttons latched and the hash of the state reached. Playback
+    // loads the state of the movie and latches its buttons instead of the
+    // controllers', checking every frame against its hash; past its last
+    // frame the controllers are back. Rewinding is held off meanwhile. Like
+    // save states, to be called between frames on the thread running them;
+    // a reset or a state loaded meanwhile is not part of the movie. Frames
+    // replay exactly with the sequential scheduler only.
+    enum MovieMode {
+        MOVIE_NONE,
+        MOVIE_RECORDING,
+        MOVIE_PLAYBACK
+    };
+    bool startMovieRecording();
+    bool startMoviePlayback(std::unique_ptr<InputMovie> movie);
+    // Hands back the movie recorded or played, nullptr without one
+    std::unique_ptr<InputMovie> stopMovie();
+    MovieMode getMovieMode() const { return movieMode; }
+    // Frames recorded or played back so far
+    uint64_t getMovieFrame() const { return movieFrame; }
+    bool isMoviePlaybackFinished() const;
+    // First frame played back whose state hash differs from the movie's, -1 while there is none
+    int64_t getMovieDivergence() const { return movieDivergence; }
+    
     // Video
+    // Completed frames, for a display running on another thread than the emulation
+    FrameMailbox* getFrameMailbox() const { return frameMailbox.get(); }
+    // Called after each completed frame, on the thread that ran it. changed is false
+    // when the frame looks just like the one before, there is nothing new to show
+    using FrameCallback = std::function<void(bool changed)>;
+    void setFrameCallback(FrameCallback callback) { frameCallback = callback; }
+    // Frame sinks (see FrameSink, SharedMemorySink) get every frame published
+    // and the audio mixed since the one before, on the emulation thread. Not
+    // owned; add and remove them with the emulation thread stopped.
+    void addFrameSink(FrameSink* sink);
+    void removeFrameSink(FrameSink* sink);
     const uint32_t* getFramebuffer() const;
     int getFramebufferWidth() const;
-    int getFramebufferHeight() const;
+    int getFramebufferHeight() const;   // 480 in 480i, both fields woven
+    // Indexed output, see VideoRenderer::setIndexedOutput()
+    void setIndexedOutput(bool enabled);
+    bool isIndexedOutput() const;
+    const uint8_t* getIndexedFramebuffer() const;
+    const uint32_t* getFramebufferPalette() const;
     
-    // Audio
+    // Audio (no output device in EMULATOR_HEADLESS builds)
     void setAudioEnabled(bool enabled);
+    // Low latency backend (ALSA) rather than QAudioSink, from the next setAudioEnabled(true)
+    void setLowLatencyAudio(bool enabled);
     void setMasterVolume(float volume);  // 0.0-1.0
     
+    // Run-ahead: every frame is emulated, then the given number of frames
+    // beyond it without audio, the last of which is shown, and the state is
+    // put back to the end of the first one. Input then shows up that many
+    // frames earlier on screen. 0 disables it.
+    void setRunAheadFrames(int frames) { runAheadFrames = frames > 0 ? frames : 0; }
+    int getRunAheadFrames() const { return runAheadFrames; }
+    
+    // Turbo (fast-forward): frames run unthrottled on the emulation thread and
+    // only every interval-th one is rendered, published and mixed, the audio
+    // of the others is dropped. The machine state stays exact, only output is
+    // skipped. Any thread.
+    static constexpr int DEFAULT_TURBO_INTERVAL = 4;
+    void setTurbo(bool enabled) { turbo = enabled; }
+    bool isTurbo() const { return turbo; }
+    void setTurboInterval(int frames) { turboInterval = frames > 0 ? frames : 1; }
+    int getTurboInterval() const { return turboInterval; }
+    
+    // Headless: frames are emulated without rendering nor mixing them,
+    // for batch runs and speculative frames
+    void setHeadless(bool enabled) { headless = enabled; }
+    bool isHeadless() const { return headless; }
+    
+    // Timing
+    void setSyncGranularity(Scheduler::SyncGranularity granularity);
+    // Graphics and Sound CPUs on threads of their own, meeting the Main CPU
+    // every quantum (master cycles, 0 keeps the current one)
+    void setThreadedExecution(bool enabled, uint64_t quantum = 0);
+    bool isThreadedExecution() const;
+    // The quantum grows while the CPUs leave the mailboxes alone and shrinks
+    // as they use them, see Scheduler. Off, it stays as set
+    void setAdaptiveQuantum(bool enabled);
+    // Graphics CPU stores to the VRAM the raster engine fetches wait for the
+    // next blanking interval, see CPLD2_Video. Off by default, then they
+    // never wait
+    void setVRAMArbitration(bool enabled);
+    bool isVRAMArbitration() const { return vramArbitration; }
+    // Master cycles the Graphics CPU waited so far
+    uint64_t getVRAMStallCycles() const { return vramStallCycles.load(std::memory_order_relaxed); }
+    
     // Performance
+    // Frame rate relative to the emulated one, over the last second of frames
     double getEmulationSpeed() const;
     uint64_t getFrameCount() const;
+    // Host time per subsystem and frame, off until enabled
+    FrameProfiler* getProfiler() const { return profiler.get(); }
+    // The display's refreshes, to start frames with on the emulation thread
+    FramePacer* getFramePacer() const { return framePacer.get(); }
+    
+    // Guest code profiling: the program address of each CPU is sampled every
+    // interval cycles (0 for the default one), see Cpu65816Profiler. Turning
+    // it on drops the previous profile. Call these with the emulation thread
+    // stopped, profiles are written as flat ones or as folded stacks.
+    void setGuestProfiling(bool enabled, uint32_t intervalCycles = 0);
+    bool isGuestProfiling() const;
+    void writeGuestProfile(std::ostream& out, bool folded) const;
+    
+    // Instruction traces: each CPU keeps its last entries instructions (0 for
+    // the default count) in a ring buffer, see Cpu65816Trace. Written in the
+    // binary format that tools/trace_decoder reads, or as text. Call these with
+    // the emulation thread stopped.
+    void setInstructionTrace(bool enabled, size_t entries = 0);
+    bool isInstructionTracing() const;
+    void writeInstructionTrace(std::ostream& out, bool text) const;
+    
+    // Execution statistics: executions and cycles per opcode and addressing
+    // mode of each CPU, and accesses per device type of each bus, see
+    // Cpu65816Stats. Turning them on drops the previous counts. Call these with
+    // the emulation thread stopped, written as CSV or JSON tagged with the ROM
+    // title.
+    void setExecutionStats(bool enabled);
+    bool isCountingExecution() const;
+    void writeExecutionStats(std::ostream& out, bool json) const;
     
     // Debug access
     Cpu65816* getMainCPU() const { return mainCPU.get(); }
     Cpu65816* getGraphicsCPU() const { return graphicsCPU.get(); }
     Cpu65816* getSoundCPU() const { return soundCPU.get(); }
     MasterClock* getClock() const { return clock.get(); }
+    Scheduler* getScheduler() const { return scheduler.get(); }
     VideoRenderer* getVideoRenderer() const { return videoRenderer.get(); }
+    // Traffic and IRQ counters in Mailbox::getStatistics()
+    Mailbox* getMailboxA() const { return mailboxA.get(); }
+    Mailbox* getMailboxB() const { return mailboxB.get(); }
+    // Counters read by MetricsExporter
+    AudioMixer* getAudioMixer() const { return audioMixer.get(); }
+    CPLD1_Audio* getAudioCPLD() const { return cpld1.get(); }
     
 private:
+    // CPUs, RAMs, mailboxes and CPLDs, declared first to be freed last
+    MachineArena arena;
+    // Interrupt vector tables, next to their CPU
+    struct CPUVectors;
+    
     // Core components
     std::unique_ptr<MasterClock> clock;
+    std::unique_ptr<Scheduler> scheduler;
     std::unique_ptr<Cartridge> cartridge;
     
     // CPUs
-    std::unique_ptr<Cpu65816> mainCPU;
-    std::unique_ptr<Cpu65816> graphicsCPU;
-    std::unique_ptr<Cpu65816> soundCPU;
+    MachineArena::Pointer<Cpu65816> mainCPU;
+    MachineArena::Pointer<Cpu65816> graphicsCPU;
+    MachineArena::Pointer<Cpu65816> soundCPU;
+    MachineArena::Pointer<CPUVectors> mainVectors;
+    MachineArena::Pointer<CPUVectors> graphicsVectors;
+    MachineArena::Pointer<CPUVectors> soundVectors;
+    // Detach from their CPU, so they go first
+    std::unique_ptr<Cpu65816Profiler> mainProfiler;
+    std::unique_ptr<Cpu65816Profiler> graphicsProfiler;
+    std::unique_ptr<Cpu65816Profiler> soundProfiler;
+    std::unique_ptr<Cpu65816Trace> mainTrace;
+    std::unique_ptr<Cpu65816Trace> graphicsTrace;
+    std::unique_ptr<Cpu65816Trace> soundTrace;
+    std::unique_ptr<Cpu65816Stats> mainStats;
+    std::unique_ptr<Cpu65816Stats> graphicsStats;
+    std::unique_ptr<Cpu65816Stats> soundStats;
     
     // Memory
-    std::unique_ptr<RAM> mainRAM;
-    std::unique_ptr<RAM> graphicsRAM;
-    std::unique_ptr<RAM> soundRAM;
-    std::unique_ptr<Mailbox> mailboxA;  // Main <-> Graphics
-    std::unique_ptr<Mailbox> mailboxB;  // Main <-> Sound
+    MachineArena::Pointer<RAM> mainRAM;
+    MachineArena::Pointer<RAM> graphicsRAM;
+    MachineArena::Pointer<RAM> soundRAM;
+    MachineArena::Pointer<Mailbox> mailboxA;  // Main <-> Graphics
+    MachineArena::Pointer<Mailbox> mailboxB;  // Main <-> Sound
+    std::unique_ptr<InputPort> inputPort;
     
     // System buses
     std::unique_ptr<SystemBus> mainBus;
@@ -105,21 +325,118 @@ private:
     std::unique_ptr<SystemBus> soundBus;
     
     // CPLDs
-    std::unique_ptr<CPLD1_Audio> cpld1;
-    std::unique_ptr<CPLD2_Video> cpld2;
-    std::unique_ptr<CPLD3_Raster> cpld3;
+    MachineArena::Pointer<CPLD1_Audio> cpld1;
+    MachineArena::Pointer<CPLD2_Video> cpld2;
+    MachineArena::Pointer<CPLD3_Raster> cpld3;
     
     // Video
     std::unique_ptr<VideoRenderer> videoRenderer;
+    std::unique_ptr<FrameMailbox> frameMailbox;
+    // Last frame published and the one each line last changed in
+    static constexpr int FRAME_LINES = 480;  // Both fields of 480i
+    uint64_t frameSequence;
+    std::array<uint64_t, FRAME_LINES> lineSequences;
+    std::array<uint32_t, 256> publishedPalette;  // Of indexed output
+    FrameCallback frameCallback;
+    std::vector<FrameSink*> frameSinks;
+    std::vector<int16_t> sinkAudio;     // Mixed since the last frame published
     
     // Audio
     std::unique_ptr<AudioMixer> audioMixer;
     std::unique_ptr<AudioOutput> audioOutput;
     
     // State
-    bool running;
-    bool paused;
+    std::atomic<bool> running;
+    std::atomic<bool> paused;
     bool initialized;
+    std::atomic<uint64_t> completedFrames;
+    std::atomic<bool> audioEnabled;  // Paces the emulation thread
+    
+    // Emulation thread
+    std::thread emulationThread;
+    std::atomic<bool> emulationThreadQuit;
+
+    // Scheduler processors, feeding the clock once per frame
+    size_t mainProcessor;
+    size_t graphicsProcessor;
+    size_t soundProcessor;
+    uint64_t clockedCycles[3];
+    
+    // Only one scanline and one audio tick are pending at any time
+    uint64_t nextScanline;
+    uint64_t nextAudioTick;
+    // Completion of the CPLD2 boot DMA in flight
+    uint64_t dmaDoneCycle;
+    
+    // VRAM arbitration. Where the Graphics CPU's run started, in master
+    // cycles and in its own counter, its time during the run follows
+    bool vramArbitration;
+    uint64_t graphicsRunStart;
+    uint64_t graphicsCPURunStart;
+    std::atomic<uint64_t> vramStallCycles;
+    
+    // Events handed over to the next sync point. Callbacks cannot go into a
+    // save state, so those pending are counted and scheduled again on load.
+    enum DeferredEvent {
+        MAILBOX_A_WRITE,
+        MAILBOX_B_WRITE,
+        GRAPHICS_IRQ,
+        SOUND_IRQ,
+        DEFERRED_EVENT_COUNT
+    };
+    std::atomic<uint32_t> pendingDeferred[DEFERRED_EVENT_COUNT];
+    
+    // IRQ sources on the CPUs' interrupt controllers, 0 being the IRQ pin.
+    // Mailbox IRQs have no status register, taking them acknowledges them
+    enum IRQSource : uint8_t {
+        IRQ_SOURCE_MAILBOX = 1,
+        IRQ_SOURCE_AUDIO_FIFO,
+        IRQ_SOURCE_VBLANK,
+        IRQ_SOURCE_HBLANK,
+        IRQ_SOURCE_RASTER
+    };
+    
+    // Machine state before the last loadState(), put back if it fails
+    std::vector<uint8_t> stateBackup;
+    
+    // Rewind
+    std::unique_ptr<RewindBuffer> rewindBuffer;
+    std::vector<uint8_t> rewindState;
+    std::atomic<bool> rewindEnabled;
+    std::atomic<bool> rewinding;
+    
+    // Run-ahead and headless frames
+    std::atomic<int> runAheadFrames;
+    std::atomic<bool> headless;
+    std::atomic<bool> turbo;
+    std::atomic<int> turboInterval;
+    int turboFrames;    // Since the last one shown
+    bool mixingAudio;
+    std::vector<uint8_t> runAheadState;
+    
+    // Input and movies
+    std::atomic<uint16_t> controllerState[InputPort::PORT_COUNT];
+    const uint16_t* frameButtons;   // Latched instead of the controllers, when set
+    RollbackSession* netplaySession;
+    std::unique_ptr<InputMovie> movie;
+    MovieMode movieMode;
+    uint64_t movieFrame;
+    int64_t movieDivergence;
+    std::vector<uint8_t> movieState;
+    
+    // Instant-on
+    static constexpr uint64_t BOOT_SNAPSHOT_MAX_FRAMES = 600;  // Not booted by then, none taken
+    std::string bootSnapshotDirectory;
+    bool bootSnapshotPending;     // Taken at the end of the first frame after boot
+    bool bootSnapshotRestored;
+    uint64_t romImageHash;        // Of the cartridge, when romImageHashed
+    bool romImageHashed;
+    
+    // Save RAM
+    std::string saveRAMDirectory;
+    
+    std::unique_ptr<FrameProfiler> profiler;
+    std::unique_ptr<FramePacer> framePacer;
     
     // Initialization helpers
     bool initializeCPUs();
@@ -128,11 +445,37 @@ private:
     bool initializeAudio();
     void setupMemoryMaps();
     void setupCallbacks();
+    void setupScheduler();
+    void scheduleScanline(uint64_t line);
+    void scheduleAudioTick(uint64_t tick);
+    void scheduleDMACompletion(uint64_t time);
+    // Runs the event now, or at the next sync point when another CPU may be running
+    void runAtSync(DeferredEvent event);
+    void scheduleAtNextSync(DeferredEvent event);
+    void fireDeferred(DeferredEvent event);
+    void attachCartridge(std::unique_ptr<Cartridge> loaded);
+    void detachCartridge();
+    bool readState(const uint8_t* data, size_t size);
+    void feedClock();
+    void publishFrame();
+    void emulateFrame(bool renderVideo, bool mixAudio);
+    void runAhead(int frames);
+    void captureRewindState();
+    void rewindFrame();
+    void latchInput();
+    void checkMovieFrame();
+    uint64_t getROMImageHash();
+    std::string getBootSnapshotPath();
+    void attachSaveRAMFile();
+    void restoreBootSnapshot();
+    void checkBootSnapshot();
+    void emulationThreadLoop();
     
     // Emulation loop helpers
-    void runMainCPU(uint32_t cycles);
-    void runGraphicsCPU(uint32_t cycles);
-    void runSoundCPU(uint32_t cycles);
+    // Return the cycles that elapsed for the CPU
+    uint64_t runMainCPU(uint64_t cycles);
+    uint64_t runGraphicsCPU(uint64_t cycles);
+    uint64_t runSoundCPU(uint64_t cycles);
     
     // Event handlers
     void onVBlank();
@@ -0,0 +1,41 @@
+#include "input_port.h"
+
+InputPort::InputPort()
+    : latched{0, 0}
+{
+}
+
+uint8_t InputPort::readByte(const Address& address) {
+    uint32_t flatAddr = address.getFlat();
+    uint32_t offset = (flatAddr - BASE_ADDRESS) & 0xFFFFFF;
+
+    if (offset < SIZE) {
+        uint16_t buttons = latched[offset >> 1];
+        return (offset & 1) ? static_cast<uint8_t>(buttons >> 8) : static_cast<uint8_t>(buttons);
+    }
+    return 0xFF;
+}
+
+void InputPort::storeByte(const Address& /* address */, uint8_t /* value */) {
+    // Read-only
+}
+
+bool InputPort::decodeAddress(const Address& address, Address& decoded) {
+    uint32_t flatAddr = address.getFlat();
+
+    if (flatAddr >= BASE_ADDRESS && flatAddr < BASE_ADDRESS + SIZE) {
+        decoded = address;
+        return true;
+    }
+    return false;
+}
+
+PageMapping InputPort::mapPage(uint16_t page) {
+    return mapPageInRange(page, BASE_ADDRESS, BASE_ADDRESS + SIZE - 1);
+}
+
+void InputPort::latch(const uint16_t (&buttons)[PORT_COUNT]) {
+    for (int port = 0; port < PORT_COUNT; port++) {
+        latched[port] = buttons[port];
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef INPUT_PORT_H
+#define INPUT_PORT_H
+
+#include "../cpu/SystemBusDevice.hpp"
+#include <cstdint>
+
+/**
+ * Input Port - Controller registers on the Main CPU bus
+ *
+ * Two controllers, one 16-bit little-endian word of buttons each, held
+ * bits set:
+ * - $430000-$430001: Controller 1
+ * - $430002-$430003: Controller 2
+ *
+ * The buttons are latched once per frame, before the frame runs, so all the
+ * code of a frame sees the same input whatever the host did meanwhile. That
+ * is what makes input movies replay exactly. Writes are ignored.
+ */
+class InputPort : public SystemBusDevice {
+public:
+    static constexpr uint32_t BASE_ADDRESS = 0x430000;
+    static constexpr int PORT_COUNT = 2;
+
+    // Button bits
+    enum Button : uint16_t {
+        BUTTON_B = 0x0001,
+        BUTTON_Y = 0x0002,
+        BUTTON_SELECT = 0x0004,
+        BUTTON_START = 0x0008,
+        BUTTON_UP = 0x0010,
+        BUTTON_DOWN = 0x0020,
+        BUTTON_LEFT = 0x0040,
+        BUTTON_RIGHT = 0x0080,
+        BUTTON_A = 0x0100,
+        BUTTON_X = 0x0200,
+        BUTTON_L = 0x0400,
+        BUTTON_R = 0x0800
+    };
+
+    InputPort();
+    ~InputPort() override = default;
+
+    // SystemBusDevice interface
+    uint8_t readByte(const Address& address) override;
+    void storeByte(const Address& address, uint8_t value) override;
+    bool decodeAddress(const Address& address, Address& decoded) override;
+    PageMapping mapPage(uint16_t page) override;
+    const char* getDeviceType() const override { return "InputPort"; }
+
+    // Buttons the guest sees until the next latch, on the thread running the frames
+    void latch(const uint16_t (&buttons)[PORT_COUNT]);
+    uint16_t getLatched(int port) const { return latched[port]; }
+
+private:
+    static constexpr uint32_t SIZE = PORT_COUNT * 2;
+
+    uint16_t latched[PORT_COUNT];
+};
+
+#endif // INPUT_PORT_H
@@ -0,0 +1,33 @@
+#include "machine_arena.h"
+#include <cstring>
+
+bool MachineArena::allocate(size_t size) {
+    release();
+    size = footprint(size);
+    base = static_cast<uint8_t*>(::operator new(size, std::align_val_t(CACHE_LINE_SIZE), std::nothrow));
+    if (!base) {
+        return false;
+    }
+    std::memset(base, 0, size);
+    capacity = size;
+    return true;
+}
+
+void MachineArena::release() {
+    if (base) {
+        ::operator delete(base, std::align_val_t(CACHE_LINE_SIZE));
+    }
+    base = nullptr;
+    used = 0;
+    capacity = 0;
+}
+
+uint8_t* MachineArena::allocateBytes(size_t size) {
+    size = footprint(size);
+    if (!base || size > capacity - used) {
+        return nullptr;
+    }
+    uint8_t* block = base + used;
+    used += size;
+    return block;
+}
@@ -0,0 +1,69 @@
+#ifndef MACHINE_ARENA_H
+#define MACHINE_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+/**
+ * Machine Arena
+ *
+ * One cache line aligned allocation holding the machine's state: CPUs,
+ * RAM and mailbox contents, CPLDs. Each object starts on a cache line of
+ * its own, in the order it was created, so that state touched together
+ * stays together and no two CPUs share a line under threaded execution.
+ *
+ * Objects are destroyed through their Pointer, the memory is given back
+ * at once by release() or the arena's destructor, once none is left.
+ */
+class MachineArena {
+public:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    template <typename T>
+    struct Deleter {
+        void operator()(T* object) const { object->~T(); }
+    };
+    template <typename T>
+    using Pointer = std::unique_ptr<T, Deleter<T>>;
+
+    MachineArena() = default;
+    ~MachineArena() { release(); }
+    MachineArena(const MachineArena&) = delete;
+    MachineArena& operator=(const MachineArena&) = delete;
+
+    // Room for capacity bytes, footprint() of each object; the previous
+    // allocation is released
+    bool allocate(size_t capacity);
+    void release();
+
+    // Zeroed and cache line aligned, nullptr when the arena is full
+    uint8_t* allocateBytes(size_t size);
+
+    template <typename T, typename... Args>
+    Pointer<T> create(Args&&... args) {
+        static_assert(alignof(T) <= CACHE_LINE_SIZE, "over-aligned type");
+        void* storage = allocateBytes(sizeof(T));
+        return Pointer<T>(storage ? new (storage) T(std::forward<Args>(args)...) : nullptr);
+    }
+
+    // Arena bytes taken by an object or a block of that size
+    static constexpr size_t footprint(size_t size) {
+        return (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    }
+    template <typename T>
+    static constexpr size_t footprint() { return footprint(sizeof(T)); }
+
+    uint8_t* getBase() const { return base; }
+    size_t getUsed() const { return used; }
+    size_t getCapacity() const { return capacity; }
+
+private:
+    uint8_t* base = nullptr;
+    size_t used = 0;
+    size_t capacity = 0;
+};
+
+#endif // MACHINE_ARENA_H
@@ -1,84 +1,279 @@
 #include "mailbox.h"
-#include <iostream>
+#include "../state/save_state.h"
+#include "../cpu/Log.hpp"
 #include <algorithm>
 
-Mailbox::Mailbox(uint32_t baseAddress, uint32_t size, const std::string& name)
+Mailbox::Mailbox(uint32_t baseAddress, uint32_t size, const std::string& name, uint8_t* storage)
     : baseAddress(baseAddress)
     , size(size)
     , name(name)
+    , data(storage)
     , newDataFlag(false)
     , busyFlag(false)
+    , queueMode(false)
+    , queueOverflow(false)
+    , sendOffset(0)
+    , sendLength(0)
+    , queue()
+    , queueHead(0)
+    , queueCount(0)
     , writeCallback(nullptr)
+    , writes(0)
+    , bytesWritten(0)
+    , reads(0)
+    , bytesRead(0)
+    , irqs(0)
+    , doorbells(0)
 {
-    data.resize(size, 0x00);
+    if (!data) {
+        ownedData.resize(size, 0x00);
+        data = ownedData.data();
+    }
 }
 
 uint8_t Mailbox::readByte(const Address& address) {
-        uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+        uint32_t flatAddr = address.getFlat();
     // Calculate offset from base address
     uint32_t offset = (flatAddr - baseAddress) & 0xFFFFFF;
     
     if (offset < size) {
+        std::lock_guard<std::mutex> guard(lock);
         // Reading clears new data flag (data has been consumed)
         if (newDataFlag) {
             newDataFlag = false;
         }
+        count(reads, 1);
+        count(bytesRead, 1);
         return data[offset];
     }
+    if (offset - size < REGISTER_SIZE) {
+        std::lock_guard<std::mutex> guard(lock);
+        return readRegister(offset - size);
+    }
     
-    std::cerr << "Mailbox " << name << ": Read out of bounds at offset $" 
-              << std::hex << offset << std::dec << std::endl;
+    Log::wrn("Mailbox").str(name).str(": Read out of bounds at offset ").hex(offset).show();
     return 0xFF;
 }
 
 void Mailbox::storeByte(const Address& address, uint8_t value) {
-        uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+        uint32_t flatAddr = address.getFlat();
     // Calculate offset from base address
     uint32_t offset = (flatAddr - baseAddress) & 0xFFFFFF;
 
-    std::cout << "[MAILBOX WRITE ATTEMPT] bank=$" << std::hex << (int)address.getBank()
-    << " offset=$" << address.getOffset()
-    << " flat=$" << flatAddr << std::dec << std::endl;
-
-    std::cout << "[MAILBOX DEBUG] " << name << " storeByte called! flatAddr=$"
-    << std::hex << flatAddr << " value=$" << (int)value << std::dec << std::endl;
-    
     if (offset < size) {
-        data[offset] = value;
-        
-        // Writing sets new data flag
-        newDataFlag = true;
+        bool notify;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            data[offset] = value;
+
+            // Writing sets new data flag
+            newDataFlag = true;
+            notify = !busyFlag && !queueMode;
+            count(writes, 1);
+            count(bytesWritten, 1);
+        }
+        if (Log::isEnabled(LogLevel::Trace)) {
+            Log::trc("Mailbox").str(name).str(": ").hex(offset, 3).str(" <- ").hex(value, 2).show();
+        }
         
         // Notify CPLD2 that mailbox was written
-        if (writeCallback) {
+        if (notify && writeCallback) {
+            writeCallback();
+        }
+    } else if (offset - size < REGISTER_SIZE) {
+        bool notify;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            notify = writeRegister(offset - size, value) && !busyFlag;
+        }
+        if (notify && writeCallback) {
             writeCallback();
         }
     } else {
-        std::cerr << "Mailbox " << name << ": Write out of bounds at offset $" 
-                  << std::hex << offset << std::dec << std::endl;
+        Log::wrn("Mailbox").str(name).str(": Write out of bounds at offset ").hex(offset).show();
     }
 }
 
-bool Mailbox::decodeAddress(const Address& address, Address& decoded) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+bool Mailbox::readBlock(uint32_t offset, uint8_t* destination, size_t length) {
+    if (offset > size || length > size - offset) {
+        Log::wrn("Mailbox").str(name).str(": Block read out of bounds at offset ").hex(offset).show();
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    newDataFlag = false;
+    std::copy(data + offset, data + offset + length, destination);
+    count(reads, 1);
+    count(bytesRead, length);
+    return true;
+}
 
-    //std::cout << "[MAILBOX] " << name << " decodeAddress called: flatAddr=$"
-    //<< std::hex << flatAddr << " baseAddress=$" << baseAddress
-    //<< " size=$" << size << std::dec << std::endl;
+bool Mailbox::writeBlock(uint32_t offset, const uint8_t* source, size_t length) {
+    if (offset > size || length > size - offset) {
+        Log::wrn("Mailbox").str(name).str(": Block write out of bounds at offset ").hex(offset).show();
+        return false;
+    }
+    bool notify;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::copy(source, source + length, data + offset);
+        newDataFlag = true;
+        notify = !busyFlag && !queueMode;
+        count(writes, 1);
+        count(bytesWritten, length);
+    }
+    if (notify && writeCallback) {
+        writeCallback();
+    }
+    return true;
+}
+
+bool Mailbox::decodeAddress(const Address& address, Address& decoded) {
+    uint32_t flatAddr = address.getFlat();
 
-    if (flatAddr >= baseAddress && flatAddr < baseAddress + size) {
+    if (flatAddr >= baseAddress && flatAddr < baseAddress + size + REGISTER_SIZE) {
         decoded = address;
-        //std::cout << "[MAILBOX] " << name << " ACCEPTED address" << std::endl;
         return true;
     }
+    return false;
+
+}
 
-    //std::cout << "[MAILBOX] " << name << " REJECTED address" <<    std::endl;
+PageMapping Mailbox::mapPage(uint16_t page) {
+    return mapPageInRange(page, baseAddress, baseAddress + size + REGISTER_SIZE - 1);
+}
+
+uint8_t Mailbox::readRegister(uint32_t offset) const {
+    const Message& head = queue[queueHead];
+    switch (offset) {
+        case 0x00:
+            return queueMode ? 0x01 : 0x00;
+        case 0x01:
+            return (queueCount > 0 ? 0x01 : 0x00) |
+                   (queueCount == QUEUE_DEPTH ? 0x02 : 0x00) |
+                   (queueOverflow ? 0x04 : 0x00);
+        case 0x02: return sendOffset & 0xFF;
+        case 0x03: return sendOffset >> 8;
+        case 0x04: return sendLength & 0xFF;
+        case 0x05: return sendLength >> 8;
+        case 0x07: return queueCount;
+        case 0x08: return queueCount ? head.offset & 0xFF : 0x00;
+        case 0x09: return queueCount ? head.offset >> 8 : 0x00;
+        case 0x0A: return queueCount ? head.length & 0xFF : 0x00;
+        case 0x0B: return queueCount ? head.length >> 8 : 0x00;
+        default:
+            return 0x00;
+    }
+}
+
+bool Mailbox::writeRegister(uint32_t offset, uint8_t value) {
+    switch (offset) {
+        case 0x00:
+            queueMode = (value & 0x01) != 0;
+            queueHead = 0;
+            queueCount = 0;
+            queueOverflow = false;
+            break;
+        case 0x02: sendOffset = (sendOffset & 0xFF00) | value; break;
+        case 0x03: sendOffset = (sendOffset & 0x00FF) | (value << 8); break;
+        case 0x04: sendLength = (sendLength & 0xFF00) | value; break;
+        case 0x05: sendLength = (sendLength & 0x00FF) | (value << 8); break;
+            
+        // DOORBELL
+        case 0x06:
+            if (!queueMode) {
+                break;
+            }
+            if (queueCount == QUEUE_DEPTH) {
+                queueOverflow = true;
+                Log::wrn("Mailbox").str(name).str(": Doorbell rung with the queue full").show();
+                break;
+            }
+            queue[(queueHead + queueCount) % QUEUE_DEPTH] = Message{ sendOffset, sendLength };
+            queueCount++;
+            count(doorbells, 1);
+            return true;
+            
+        // ACK
+        case 0x0C:
+            if (queueCount > 0) {
+                queueHead = (queueHead + 1) % QUEUE_DEPTH;
+                queueCount--;
+            }
+            break;
+            
+        default:
+            break;
+    }
     return false;
+}
+
+void Mailbox::setQueueMode(bool enabled) {
+    std::lock_guard<std::mutex> guard(lock);
+    writeRegister(0x00, enabled ? 0x01 : 0x00);
+}
+
+bool Mailbox::isQueueMode() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return queueMode;
+}
 
+int Mailbox::getQueuedMessages() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return queueCount;
+}
+
+Mailbox::Statistics Mailbox::getStatistics() const {
+    Statistics statistics;
+    statistics.writes = writes.load(std::memory_order_relaxed);
+    statistics.bytesWritten = bytesWritten.load(std::memory_order_relaxed);
+    statistics.reads = reads.load(std::memory_order_relaxed);
+    statistics.bytesRead = bytesRead.load(std::memory_order_relaxed);
+    statistics.irqs = irqs.load(std::memory_order_relaxed);
+    statistics.doorbells = doorbells.load(std::memory_order_relaxed);
+    return statistics;
 }
 
 void Mailbox::clear() {
-    std::fill(data.begin(), data.end(), 0x00);
+    std::lock_guard<std::mutex> guard(lock);
+    std::fill(data, data + size, 0x00);
     newDataFlag = false;
     busyFlag = false;
+    writeRegister(0x00, 0x00);
+    sendOffset = 0;
+    sendLength = 0;
+}
+
+void Mailbox::saveState(StateWriter& writer) const {
+    writer.write(data, size);
+    writer.writeValue(newDataFlag);
+    writer.writeValue(busyFlag);
+    writer.writeValue(queueMode);
+    writer.writeValue(queueOverflow);
+    writer.writeValue(sendOffset);
+    writer.writeValue(sendLength);
+    for (const Message& message : queue) {
+        writer.writeValue(message.offset);
+        writer.writeValue(message.length);
+    }
+    writer.writeValue(queueHead);
+    writer.writeValue(queueCount);
+}
+
+bool Mailbox::loadState(StateReader& reader) {
+    std::lock_guard<std::mutex> guard(lock);
+    bool ok = reader.read(data, size) &&
+              reader.readValue(newDataFlag) &&
+              reader.readValue(busyFlag) &&
+              reader.readValue(queueMode) &&
+              reader.readValue(queueOverflow) &&
+              reader.readValue(sendOffset) &&
+              reader.readValue(sendLength);
+    for (Message& message : queue) {
+        ok = ok && reader.readValue(message.offset) && reader.readValue(message.length);
+    }
+    ok = ok && reader.readValue(queueHead) && reader.readValue(queueCount);
+    // Kept in range whatever the state holds
+    queueHead %= QUEUE_DEPTH;
+    queueCount = std::min<uint8_t>(queueCount, QUEUE_DEPTH);
+    return ok;
 }
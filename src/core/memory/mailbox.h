@@ -2,9 +2,15 @@
 #define MAILBOX_H
 
 #include "../cpu/SystemBusDevice.hpp"
+#include <array>
+#include <atomic>
 #include <vector>
 #include <string>
 #include <functional>
+#include <mutex>
+
+class StateWriter;
+class StateReader;
 
 /**
  * Mailbox - Inter-CPU communication
@@ -12,26 +18,62 @@
  * 
  * Mailbox A: Main CPU <-> Graphics CPU
  * Mailbox B: Main CPU <-> Sound CPU
+ *
+ * Both CPUs may access it at the same time with threaded execution, the write
+ * callback is called outside of the lock.
+ *
+ * Traffic is counted rather than traced: getStatistics() at any time, from
+ * any thread. Stores are traced one by one at the Trace log level only.
+ *
+ * Queue mode: by default every store calls the write callback, i.e. raises
+ * an IRQ on the receiving CPU. With queue mode on (CONTROL bit 0) stores only
+ * fill the mailbox, the sender describes a message in SEND_OFFSET and
+ * SEND_LENGTH then rings DOORBELL: the message is queued, a single callback
+ * made. The receiver reads the oldest message from HEAD_OFFSET/HEAD_LENGTH
+ * and writes ACK once done with it. QUEUE_DEPTH messages may wait, a doorbell
+ * rung with the queue full is dropped and sets STATUS bit 2.
+ *
+ * Registers, right after the mailbox (base + size):
+ * - $00 CONTROL: bit 0 queue mode, written empties the queue
+ * - $01 STATUS (read): bit 0 message waiting, bit 1 queue full, bit 2 overflow
+ * - $02 SEND_OFFSET, $04 SEND_LENGTH (words)
+ * - $06 DOORBELL (write): queues SEND_OFFSET/SEND_LENGTH
+ * - $07 COUNT (read): messages waiting
+ * - $08 HEAD_OFFSET, $0A HEAD_LENGTH (words, read): the oldest message
+ * - $0C ACK (write): drops the oldest message
  */
 class Mailbox : public SystemBusDevice {
 public:
     // Constructor
-    Mailbox(uint32_t baseAddress, uint32_t size, const std::string& name = "Mailbox");
+    // Contents in storage when given, as for RAM
+    Mailbox(uint32_t baseAddress, uint32_t size, const std::string& name = "Mailbox", uint8_t* storage = nullptr);
     ~Mailbox() override = default;
     
     // SystemBusDevice interface
     uint8_t readByte(const Address& address) override;
     void storeByte(const Address& address, uint8_t value) override;
     bool decodeAddress(const Address& address, Address& decoded) override;
+    PageMapping mapPage(uint16_t page) override;
+    const char* getDeviceType() const override { return "Mailbox"; }
     
     uint32_t getBaseAddress() const { return baseAddress; }
+    // Of the data, the registers follow
     uint32_t getSize() const { return size; }
+    static constexpr uint32_t REGISTER_SIZE = 0x10;
+    static constexpr int QUEUE_DEPTH = 8;
+    
+    // Queue mode, see above
+    bool isQueueMode() const;
+    void setQueueMode(bool enabled);
+    int getQueuedMessages() const;
     
     // Mailbox status flags
     bool hasNewData() const { return newDataFlag; }
     void clearNewDataFlag() { newDataFlag = false; }
     void setNewDataFlag() { newDataFlag = true; }
     
+    // Stores while busy (a CPLD transfer out of the mailbox in progress)
+    // do not call the write callback
     bool isBusy() const { return busyFlag; }
     void setBusy(bool busy) { busyFlag = busy; }
     
@@ -39,28 +81,83 @@ public:
     using WriteCallback = std::function<void()>;
     void setWriteCallback(WriteCallback callback) { writeCallback = callback; }
 
+    // Block transfers, offsets from the start of the mailbox. Reading
+    // consumes the data as readByte() does, writing calls the write callback
+    // once for the block. Fail without copying anything when out of bounds.
+    bool readBlock(uint32_t offset, uint8_t* destination, size_t length);
+    bool writeBlock(uint32_t offset, const uint8_t* source, size_t length);
+
+    // Telemetry since construction, rates are up to the caller. irqs are
+    // counted by the owner raising them, with countIRQ()
+    struct Statistics {
+        uint64_t writes;            // Stores and block writes
+        uint64_t bytesWritten;
+        uint64_t reads;             // Loads and block reads
+        uint64_t bytesRead;
+        uint64_t irqs;
+        uint64_t doorbells;         // Messages queued
+    };
+    Statistics getStatistics() const;
+    void countIRQ() { irqs.fetch_add(1, std::memory_order_relaxed); }
+
     // Clear all mailbox data
     void clear();
     
+    // Save states, contents and flags
+    void saveState(StateWriter& writer) const;
+    bool loadState(StateReader& reader);
+    
     // Get name
     const std::string& getName() const { return name; }
     
     // Direct access (for debugging)
-    uint8_t* getPointer() { return data.data(); }
-    const uint8_t* getPointer() const { return data.data(); }
+    uint8_t* getPointer() { return data; }
+    const uint8_t* getPointer() const { return data; }
     
 private:
     uint32_t baseAddress;
     uint32_t size;
     std::string name;
-    std::vector<uint8_t> data;
+    uint8_t* data;
+    std::vector<uint8_t> ownedData;  // Without storage
     
     // Status flags
     bool newDataFlag;
     bool busyFlag;
     
+    // Queue mode
+    struct Message {
+        uint16_t offset;
+        uint16_t length;
+    };
+    bool queueMode;
+    bool queueOverflow;
+    uint16_t sendOffset;
+    uint16_t sendLength;
+    std::array<Message, QUEUE_DEPTH> queue;
+    uint8_t queueHead;
+    uint8_t queueCount;
+    
+    // Register window, under the lock. Whether the write callback is due
+    uint8_t readRegister(uint32_t offset) const;
+    bool writeRegister(uint32_t offset, uint8_t value);
+    
     // Write notification callback
     WriteCallback writeCallback;
+
+    // Serializes the two ports
+    mutable std::mutex lock;
+
+    // Telemetry, bumped under the lock but read from anywhere
+    std::atomic<uint64_t> writes;
+    std::atomic<uint64_t> bytesWritten;
+    std::atomic<uint64_t> reads;
+    std::atomic<uint64_t> bytesRead;
+    std::atomic<uint64_t> irqs;
+    std::atomic<uint64_t> doorbells;
+    static void count(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
 };
 
 #endif // MAILBOX_H
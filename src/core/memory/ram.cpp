@@ -1,19 +1,26 @@
 #include "ram.h"
+#include "../state/save_state.h"
+#include "../cpu/Log.hpp"
 #include <fstream>
 #include <iostream>
 #include <algorithm>
 
-RAM::RAM(uint32_t baseAddress, uint32_t size, const std::string& name)
+RAM::RAM(uint32_t baseAddress, uint32_t size, const std::string& name, uint8_t* storage)
     : baseAddress(baseAddress)
     , size(size)
     , name(name)
+    , data(storage)
+    , contentionRange{0, 0}
 {
-    data.resize(size, 0x00);
+    if (!data) {
+        ownedData.resize(size, 0x00);
+        data = ownedData.data();
+    }
 }
 
 uint8_t RAM::readByte(const Address& address) {
     // Calculate offset from base address
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     uint32_t offset = flatAddr - baseAddress;
     
     if (offset < size) {
@@ -21,27 +28,72 @@ uint8_t RAM::readByte(const Address& address) {
     }
     
     // Out of bounds - shouldn't happen if memory bus is configured correctly
-    std::cerr << "RAM " << name << ": Read out of bounds at offset $" 
-              << std::hex << offset << std::dec << std::endl;
+    Log::wrn("RAM").str(name).str(": Read out of bounds at offset ").hex(offset).show();
     return 0xFF;
 }
 
 void RAM::storeByte(const Address& address, uint8_t value) {
     // Calculate offset from base address
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     uint32_t offset = flatAddr - baseAddress;
     
     if (offset < size) {
+        if (isContended(flatAddr, flatAddr)) {
+            contentionCallback(flatAddr);
+        }
         data[offset] = value;
+        // CPLD DMA writes land here without going through a bus
+        notifyPageContentsChanged(flatAddr >> 8, flatAddr >> 8);
+        if (writeListener && isRangeWatched(flatAddr, flatAddr)) {
+            writeListener(flatAddr, flatAddr);
+        }
     } else {
         // Out of bounds
-        std::cerr << "RAM " << name << ": Write out of bounds at offset $" 
-                  << std::hex << offset << std::dec << std::endl;
+        Log::wrn("RAM").str(name).str(": Write out of bounds at offset ").hex(offset).show();
+    }
+}
+
+void RAM::storeBytes(const Address& address, const uint8_t* values, uint16_t count) {
+    // Block moves through a bus, watchers hear about the run once
+    uint32_t flatAddr = address.getFlat();
+    if (count > 0 && isContended(flatAddr, flatAddr + count - 1)) {
+        contentionCallback(flatAddr);
+    }
+    writeBlock(flatAddr, values, count);
+}
+
+bool RAM::readBlock(uint32_t address, uint8_t* destination, size_t length) const {
+    uint32_t offset = address - baseAddress;
+    if (offset > size || length > size - offset) {
+        Log::wrn("RAM").str(name).str(": Block read out of bounds at offset ").hex(offset).show();
+        return false;
+    }
+    std::copy(data + offset, data + offset + length, destination);
+    return true;
+}
+
+bool RAM::writeBlock(uint32_t address, const uint8_t* source, size_t length) {
+    uint32_t offset = address - baseAddress;
+    if (offset > size || length > size - offset) {
+        Log::wrn("RAM").str(name).str(": Block write out of bounds at offset ").hex(offset).show();
+        return false;
+    }
+    if (length == 0) {
+        return true;
     }
+    std::copy(source, source + length, data + offset);
+
+    // Reported once for the whole block, not per byte
+    uint32_t lastAddress = address + (uint32_t)length - 1;
+    notifyPageContentsChanged(address >> 8, lastAddress >> 8);
+    if (writeListener && isRangeWatched(address, lastAddress)) {
+        writeListener(address, lastAddress);
+    }
+    return true;
 }
 
 bool RAM::decodeAddress(const Address& address, Address& decoded) {
-    uint32_t flatAddr = (address.getBank() << 16) | address.getOffset();
+    uint32_t flatAddr = address.getFlat();
     if (flatAddr >= baseAddress && flatAddr < baseAddress + size) {
         decoded = address;
         return true;
@@ -49,6 +101,83 @@ bool RAM::decodeAddress(const Address& address, Address& decoded) {
     return false;
 }
 
+PageMapping RAM::mapPage(uint16_t page) {
+    return mapPageInRange(page, baseAddress, baseAddress + size - 1);
+}
+
+uint8_t* RAM::getPageReadPointer(uint16_t page) {
+    // Plain memory: the bus can index the page directly
+    uint32_t offset = (uint32_t)page * PAGE_SIZE_BYTES - baseAddress;
+    return data + offset;
+}
+
+uint8_t* RAM::getPageWritePointer(uint16_t page) {
+    // Watched pages have to see every store
+    if (isPageWatched(page)) {
+        return nullptr;
+    }
+    return getPageReadPointer(page);
+}
+
+bool RAM::isPageWatched(uint16_t page) const {
+    uint32_t pageStart = (uint32_t)page * PAGE_SIZE_BYTES;
+    uint32_t pageEnd = pageStart + PAGE_SIZE_BYTES - 1;
+    if (isContended(pageStart, pageEnd)) {
+        return true;
+    }
+    if (!writeListener) {
+        return false;
+    }
+    for (const WatchRange& range : watchRanges) {
+        if (range.start <= pageEnd && pageStart <= range.end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RAM::isRangeWatched(uint32_t firstAddress, uint32_t lastAddress) const {
+    for (const WatchRange& range : watchRanges) {
+        if (range.start <= lastAddress && firstAddress <= range.end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RAM::setWriteListener(WriteListener listener) {
+    writeListener = listener;
+    refreshAllPagePointers();
+}
+
+void RAM::watchWrites(uint32_t startAddress, uint32_t endAddress) {
+    watchRanges.push_back(WatchRange{startAddress, endAddress});
+    refreshAllPagePointers();
+}
+
+void RAM::clearWriteWatches() {
+    watchRanges.clear();
+    refreshAllPagePointers();
+}
+
+void RAM::setContention(uint32_t startAddress, uint32_t endAddress, ContentionCallback callback) {
+    contentionRange = WatchRange{startAddress, endAddress};
+    contentionCallback = callback;
+    refreshAllPagePointers();
+}
+
+void RAM::clearContention() {
+    contentionCallback = nullptr;
+    refreshAllPagePointers();
+}
+
+void RAM::refreshAllPagePointers() {
+    // The buses may have to give up (or get back) their write pointers
+    if (size > 0) {
+        notifyPagePointersChanged(baseAddress >> 8, (baseAddress + size - 1) >> 8);
+    }
+}
+
 bool RAM::loadFromFile(const std::string& filename, uint32_t offset) {
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if (!file.is_open()) {
@@ -68,7 +197,7 @@ bool RAM::loadFromFile(const std::string& filename, uint32_t offset) {
         return false;
     }
     
-    if (!file.read(reinterpret_cast<char*>(data.data() + offset), fileSize)) {
+    if (!file.read(reinterpret_cast<char*>(data + offset), fileSize)) {
         std::cerr << "RAM " << name << ": Failed to read file " 
                   << filename << std::endl;
         file.close();
@@ -76,9 +205,9 @@ bool RAM::loadFromFile(const std::string& filename, uint32_t offset) {
     }
     
     file.close();
-    std::cout << "RAM " << name << ": Loaded " << fileSize 
-              << " bytes from " << filename << " at offset $" 
-              << std::hex << offset << std::dec << std::endl;
+    notifyAllPagesChanged();
+    Log::inf("RAM").str(name).str(": Loaded ").num(fileSize).str(" bytes from ").str(filename)
+        .str(" at offset ").hex(offset).show();
     return true;
 }
 
@@ -90,7 +219,7 @@ bool RAM::saveToFile(const std::string& filename) const {
         return false;
     }
     
-    if (!file.write(reinterpret_cast<const char*>(data.data()), size)) {
+    if (!file.write(reinterpret_cast<const char*>(data), size)) {
         std::cerr << "RAM " << name << ": Failed to write file " 
                   << filename << std::endl;
         file.close();
@@ -104,5 +233,28 @@ bool RAM::saveToFile(const std::string& filename) const {
 }
 
 void RAM::clear(uint8_t value) {
-    std::fill(data.begin(), data.end(), value);
+    std::fill(data, data + size, value);
+    notifyAllPagesChanged();
+}
+
+void RAM::saveState(StateWriter& writer) const {
+    writer.write(data, size);
+}
+
+bool RAM::loadState(StateReader& reader) {
+    if (!reader.read(data, size)) {
+        return false;
+    }
+    // Decoded code and cached tiles are all stale
+    notifyAllPagesChanged();
+    return true;
+}
+
+void RAM::notifyAllPagesChanged() {
+    if (size > 0) {
+        notifyPageContentsChanged(baseAddress >> 8, (baseAddress + size - 1) >> 8);
+        if (writeListener) {
+            writeListener(baseAddress, baseAddress + size - 1);
+        }
+    }
 }
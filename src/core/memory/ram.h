@@ -4,6 +4,10 @@
 #include "../cpu/SystemBusDevice.hpp"
 #include <vector>
 #include <string>
+#include <functional>
+
+class StateWriter;
+class StateReader;
 
 /**
  * Generic RAM module
@@ -11,18 +15,29 @@
  */
 class RAM : public SystemBusDevice {
 public:
-    // Constructor
-    RAM(uint32_t baseAddress, uint32_t size, const std::string& name = "RAM");
+    // Constructor. The contents are held in storage when given, size
+    // zeroed bytes that outlive the RAM (a MachineArena's), else owned
+    RAM(uint32_t baseAddress, uint32_t size, const std::string& name = "RAM", uint8_t* storage = nullptr);
     ~RAM() override = default;
     
     // SystemBusDevice interface
     uint8_t readByte(const Address& address) override;
     void storeByte(const Address& address, uint8_t value) override;
+    void storeBytes(const Address& address, const uint8_t* values, uint16_t count) override;
     bool decodeAddress(const Address& address, Address& decoded) override;
+    PageMapping mapPage(uint16_t page) override;
+    uint8_t* getPageReadPointer(uint16_t page) override;
+    uint8_t* getPageWritePointer(uint16_t page) override;
+    const char* getDeviceType() const override { return "RAM"; }
+    
+    // Block transfers (CPLD DMA), bus addresses. Fail without copying
+    // anything when the block does not fit
+    bool readBlock(uint32_t address, uint8_t* destination, size_t length) const;
+    bool writeBlock(uint32_t address, const uint8_t* source, size_t length);
     
     // Direct memory access (for debugging/testing)
-    uint8_t* getPointer() { return data.data(); }
-    const uint8_t* getPointer() const { return data.data(); }
+    uint8_t* getPointer() { return data; }
+    const uint8_t* getPointer() const { return data; }
     
     // Load data from file
     bool loadFromFile(const std::string& filename, uint32_t offset = 0);
@@ -33,14 +48,54 @@ public:
     // Clear all RAM
     void clear(uint8_t value = 0x00);
     
+    // Save states, the contents as they are
+    void saveState(StateWriter& writer) const;
+    bool loadState(StateReader& reader);
+    
+    // Write watch (for caches of VRAM contents)
+    // Stores to the watched ranges skip the direct bus pointers and are reported to the listener,
+    // with the first and last address written
+    using WriteListener = std::function<void(uint32_t firstAddress, uint32_t lastAddress)>;
+    void setWriteListener(WriteListener listener);
+    void watchWrites(uint32_t startAddress, uint32_t endAddress);
+    void clearWriteWatches();
+    
+    // Contention (VRAM arbitration, see CPLD2_Video): stores made through a
+    // bus to the range skip the direct bus pointers as well, the callback is
+    // told of each as it is made. Block writes of the CPLDs are not contended
+    using ContentionCallback = std::function<void(uint32_t address)>;
+    void setContention(uint32_t startAddress, uint32_t endAddress, ContentionCallback callback);
+    void clearContention();
+    
     // Get name (for debugging)
     const std::string& getName() const { return name; }
     
 private:
+    void notifyAllPagesChanged();
+    bool isPageWatched(uint16_t page) const;
+    bool isRangeWatched(uint32_t firstAddress, uint32_t lastAddress) const;
+    void refreshAllPagePointers();
+
     uint32_t baseAddress;
     uint32_t size;
     std::string name;
-    std::vector<uint8_t> data;
+    uint8_t* data;
+    std::vector<uint8_t> ownedData;  // Without storage
+    
+    // Write watch
+    struct WatchRange {
+        uint32_t start;
+        uint32_t end;
+    };
+    std::vector<WatchRange> watchRanges;
+    WriteListener writeListener;
+    
+    // Contention
+    WatchRange contentionRange;
+    ContentionCallback contentionCallback;
+    bool isContended(uint32_t firstAddress, uint32_t lastAddress) const {
+        return contentionCallback && contentionRange.start <= lastAddress && firstAddress <= contentionRange.end;
+    }
 };
 
 #endif // RAM_H
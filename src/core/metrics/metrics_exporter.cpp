@@ -0,0 +1,238 @@
+#include "metrics_exporter.h"
+#include "../emulator.h"
+#include "../timing/frame_profiler.h"
+#include "../timing/master_clock.h"
+#include "../timing/thread_placement.h"
+#include "../audio/audio_mixer.h"
+#include "../cpld/cpld1_audio.h"
+#include "../video/frame_mailbox.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#define METRICS_EXPORTER
+#endif
+#if defined(METRICS_EXPORTER) && !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+static constexpr size_t MAX_REQUEST_SIZE = 4096;
+
+// Label values of the FrameProfiler sections
+static const char* const SECTION_LABELS[FrameProfiler::SECTION_COUNT] = {
+    "main_cpu", "graphics_cpu", "sound_cpu", "video_render", "audio_mix", "texture_upload", "frame"
+};
+
+static int64_t nowMilliseconds() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+MetricsExporter::MetricsExporter(Emulator* emulator)
+    : emulator(emulator)
+    , listenSocket(-1)
+    , quit(false)
+    , scrapes(0)
+    , sampledFrames(0)
+    , sampledAt(0)
+    , speed(0.0)
+{
+}
+
+MetricsExporter::~MetricsExporter() {
+    stop();
+}
+
+bool MetricsExporter::start(uint16_t port) {
+    stop();
+#if defined(METRICS_EXPORTER)
+    listenSocket = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket < 0) {
+        std::cerr << "MetricsExporter: Failed to create socket" << std::endl;
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listenSocket, 4) != 0) {
+        std::cerr << "MetricsExporter: Failed to listen on port " << port << std::endl;
+        ::close(listenSocket);
+        listenSocket = -1;
+        return false;
+    }
+
+    emulator->getProfiler()->setEnabled(true);
+    sampledFrames = emulator->getFrameCount();
+    sampledAt = nowMilliseconds();
+    speed = 0.0;
+    quit = false;
+    thread = std::thread(&MetricsExporter::run, this);
+    std::cout << "MetricsExporter: Serving on port " << port << std::endl;
+    return true;
+#else
+    (void)port;
+    std::cerr << "MetricsExporter: Not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+void MetricsExporter::stop() {
+    if (!thread.joinable()) {
+        return;
+    }
+    quit = true;
+    thread.join();
+#if defined(METRICS_EXPORTER)
+    ::close(listenSocket);
+#endif
+    listenSocket = -1;
+}
+
+void MetricsExporter::run() {
+#if defined(METRICS_EXPORTER)
+    // Wakes up at least every sample interval, for the speed and to quit
+    while (!quit) {
+        pollfd listening = { listenSocket, POLLIN, 0 };
+        int ready = poll(&listening, 1, SAMPLE_INTERVAL_MS);
+        if (nowMilliseconds() - sampledAt >= SAMPLE_INTERVAL_MS) {
+            sample();
+        }
+        if (ready > 0 && (listening.revents & POLLIN)) {
+            int client = accept(listenSocket, nullptr, nullptr);
+            if (client >= 0) {
+                serve(client);
+                ::close(client);
+            }
+        }
+    }
+#endif
+}
+
+void MetricsExporter::sample() {
+    int64_t now = nowMilliseconds();
+    uint64_t frames = emulator->getFrameCount();
+    double seconds = (now - sampledAt) / 1000.0;
+    speed = seconds > 0.0 ? (frames - sampledFrames) / (seconds * MasterClock::FRAME_RATE) : 0.0;
+    sampledFrames = frames;
+    sampledAt = now;
+}
+
+void MetricsExporter::serve(int client) {
+#if defined(METRICS_EXPORTER)
+    // A client that stalls holds up nobody but the exporter, and not for long
+    timeval timeout = { 1, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[512];
+    while (request.size() < MAX_REQUEST_SIZE && request.find("\r\n\r\n") == std::string::npos) {
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            return;
+        }
+        request.append(buffer, static_cast<size_t>(received));
+    }
+
+    std::ostringstream body;
+    const char* status = "200 OK";
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+        writeMetrics(body);
+        scrapes.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        status = "404 Not Found";
+    }
+    std::string content = body.str();
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << "\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Content-Length: " << content.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << content;
+    std::string text = response.str();
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t written = ::send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0) {
+            return;
+        }
+        sent += static_cast<size_t>(written);
+    }
+#else
+    (void)client;
+#endif
+}
+
+void MetricsExporter::writeMetrics(std::ostringstream& out) const {
+    out.precision(9);
+    out << "# HELP sano_frames_total Frames emulated.\n"
+        << "# TYPE sano_frames_total counter\n"
+        << "sano_frames_total " << emulator->getFrameCount() << "\n"
+        << "# HELP sano_emulation_speed Frame rate relative to the emulated one.\n"
+        << "# TYPE sano_emulation_speed gauge\n"
+        << "sano_emulation_speed " << speed << "\n";
+
+    // Buckets are cumulative in the exposition format
+    const FrameProfiler* profiler = emulator->getProfiler();
+    out << "# HELP sano_frame_time_seconds Host time per frame spent in each subsystem.\n"
+        << "# TYPE sano_frame_time_seconds histogram\n";
+    for (int section = 0; section < FrameProfiler::SECTION_COUNT; section++) {
+        FrameProfiler::Histogram histogram = profiler->getHistogram(static_cast<FrameProfiler::Section>(section));
+        const char* label = SECTION_LABELS[section];
+        uint64_t cumulative = 0;
+        for (int bucket = 0; bucket < FrameProfiler::BUCKET_COUNT; bucket++) {
+            cumulative += histogram.buckets[bucket];
+            out << "sano_frame_time_seconds_bucket{section=\"" << label << "\",le=\""
+                << FrameProfiler::BUCKET_BOUNDS_US[bucket] / 1e6 << "\"} " << cumulative << "\n";
+        }
+        out << "sano_frame_time_seconds_bucket{section=\"" << label << "\",le=\"+Inf\"} " << histogram.count << "\n"
+            << "sano_frame_time_seconds_sum{section=\"" << label << "\"} " << histogram.totalMs / 1000.0 << "\n"
+            << "sano_frame_time_seconds_count{section=\"" << label << "\"} " << histogram.count << "\n";
+    }
+
+    if (const AudioMixer* mixer = emulator->getAudioMixer()) {
+        out << "# HELP sano_audio_underruns_total Output samples the audio device found the mixer ring without.\n"
+            << "# TYPE sano_audio_underruns_total counter\n"
+            << "sano_audio_underruns_total " << mixer->getUnderrunCount() << "\n"
+            << "# HELP sano_audio_buffered_frames Stereo frames queued for the audio device.\n"
+            << "# TYPE sano_audio_buffered_frames gauge\n"
+            << "sano_audio_buffered_frames " << mixer->getBufferedFrames() << "\n";
+    }
+    if (const CPLD1_Audio* audio = emulator->getAudioCPLD()) {
+        out << "# HELP sano_audio_fifo_dropped_samples_total Samples stored into a full CPLD1 FIFO.\n"
+            << "# TYPE sano_audio_fifo_dropped_samples_total counter\n"
+            << "sano_audio_fifo_dropped_samples_total " << audio->getDroppedSampleCount() << "\n";
+    }
+    if (const FrameMailbox* mailbox = emulator->getFrameMailbox()) {
+        out << "# HELP sano_display_dropped_frames_total Frames published that the display never took.\n"
+            << "# TYPE sano_display_dropped_frames_total counter\n"
+            << "sano_display_dropped_frames_total " << mailbox->getDroppedFrameCount() << "\n";
+    }
+
+    // A refused setting shows as 0
+    std::vector<ThreadPlacement::ThreadStatus> threads = ThreadPlacement::getThreads();
+    out << "# HELP sano_thread_realtime_priority SCHED_FIFO priority of each emulator thread, 0 for the normal scheduler.\n"
+        << "# TYPE sano_thread_realtime_priority gauge\n";
+    for (const ThreadPlacement::ThreadStatus& thread : threads) {
+        out << "sano_thread_realtime_priority{thread=\"" << thread.name << "\",role=\""
+            << ThreadPlacement::getRoleName(thread.role) << "\"} " << thread.realTimePriority << "\n";
+    }
+    out << "# HELP sano_thread_pinned_cores Cores each emulator thread is pinned to, 0 for any.\n"
+        << "# TYPE sano_thread_pinned_cores gauge\n";
+    for (const ThreadPlacement::ThreadStatus& thread : threads) {
+        out << "sano_thread_pinned_cores{thread=\"" << thread.name << "\",role=\""
+            << ThreadPlacement::getRoleName(thread.role) << "\",cores=\""
+            << ThreadPlacement::formatCores(thread.cores) << "\"} " << thread.cores.size() << "\n";
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <thread>
+
+class Emulator;
+
+/**
+ * Metrics Exporter
+ *
+ * Serves the emulator's counters in the Prometheus text format, on
+ * http://<host>:<port>/metrics, from a thread of its own:
+ *
+ * - sano_frames_total, sano_emulation_speed (frames over the last
+ *   SAMPLE_INTERVAL_MS against the emulated rate)
+ * - sano_frame_time_seconds, a histogram per FrameProfiler section
+ * - sano_audio_underruns_total, sano_audio_buffered_frames (AudioMixer)
+ * - sano_audio_fifo_dropped_samples_total (CPLD1_Audio)
+ * - sano_display_dropped_frames_total, frames the display never took
+ * - sano_thread_realtime_priority, sano_thread_pinned_cores per thread, as
+ *   ThreadPlacement placed it
+ *
+ * Everything it reads is an atomic counter the frame loop bumps anyway, the
+ * exporter takes no lock the emulation thread could wait on. Frame times
+ * need the profiler, which start() turns on. Stop the exporter before the
+ * emulator is shut down.
+ *
+ * POSIX sockets; start() fails elsewhere.
+ */
+class MetricsExporter {
+public:
+    static constexpr uint16_t DEFAULT_PORT = 9464;
+    static constexpr int SAMPLE_INTERVAL_MS = 1000;
+
+    explicit MetricsExporter(Emulator* emulator);
+    ~MetricsExporter();
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    bool start(uint16_t port = DEFAULT_PORT);
+    void stop();
+    bool isRunning() const { return thread.joinable(); }
+
+    // Served so far
+    uint64_t getScrapeCount() const { return scrapes.load(std::memory_order_relaxed); }
+
+private:
+    Emulator* emulator;
+    int listenSocket;
+    std::thread thread;
+    std::atomic<bool> quit;
+    std::atomic<uint64_t> scrapes;
+
+    // Exporter thread's own
+    uint64_t sampledFrames;
+    int64_t sampledAt;              // Steady clock, milliseconds
+    double speed;
+
+    void run();
+    void sample();
+    void serve(int client);
+    void writeMetrics(std::ostringstream& out) const;
+};
+
+#endif // METRICS_EXPORTER_H
@@ -0,0 +1,25 @@
+#ifndef NETPLAY_TRANSPORT_H
+#define NETPLAY_TRANSPORT_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Netplay Transport
+ *
+ * Carries the packets of a RollbackSession to its peer and back, on the
+ * thread running the session. Packets are small datagrams, one may be
+ * lost, duplicated or come out of order; the session sends its inputs
+ * again until the peer has them. Neither call may block.
+ */
+class NetplayTransport {
+public:
+    virtual ~NetplayTransport() = default;
+
+    // False when the packet could not be sent, it is not queued
+    virtual bool send(const uint8_t* data, size_t size) = 0;
+    // Bytes of the next packet waiting, 0 when there is none
+    virtual size_t receive(uint8_t* data, size_t capacity) = 0;
+};
+
+#endif // NETPLAY_TRANSPORT_H
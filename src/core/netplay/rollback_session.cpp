@@ -0,0 +1,291 @@
+#include "rollback_session.h"
+#include "netplay_transport.h"
+#include "../emulator.h"
+#include "../memory/input_port.h"
+#include "../state/input_movie.h"
+#include "../cpu/Log.hpp"
+#include <algorithm>
+
+// Packet, little endian
+static constexpr size_t PACKET_FRAME = 4;         // Sender's next frame
+static constexpr size_t PACKET_FRAME_SEEN = 8;    // Receiver's, as the sender last heard
+static constexpr size_t PACKET_INPUT_COUNT = 12;  // Receiver's inputs the sender has
+static constexpr size_t PACKET_CHECK_FRAME = 16;  // State hashed, ~0 if none
+static constexpr size_t PACKET_CHECK_HASH = 20;
+static constexpr size_t PACKET_FIRST_INPUT = 28;
+static constexpr size_t PACKET_INPUTS = 32;       // Count, then the buttons
+static constexpr size_t PACKET_HEADER_SIZE = 33;
+static constexpr uint32_t NO_CHECK_FRAME = 0xFFFFFFFF;
+
+static void put16(uint8_t* p, uint16_t value) {
+    p[0] = static_cast<uint8_t>(value);
+    p[1] = static_cast<uint8_t>(value >> 8);
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+    put16(p, static_cast<uint16_t>(value));
+    put16(p + 2, static_cast<uint16_t>(value >> 16));
+}
+
+static uint16_t get16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return get16(p) | (static_cast<uint32_t>(get16(p + 2)) << 16);
+}
+
+RollbackSession::RollbackSession(Emulator* emulator, NetplayTransport* transport, int localPort)
+    : emulator(emulator)
+    , transport(transport)
+    , localPort(localPort & 1)
+    , inputDelay(DEFAULT_INPUT_DELAY)
+    , frame(0)
+    , rollbackFrame(NO_FRAME)
+    , localInputs{}
+    , remoteInputs{}
+    , usedRemote{}
+    , localInputCount(DEFAULT_INPUT_DELAY)
+    , remoteInputCount(0)
+    , peerInputCount(0)
+    , peerFrame(0)
+    , peerFrameSeen(0)
+    , peerHeard(false)
+    , framesSinceSync(0)
+    , desyncFrame(-1)
+    , peerCheckFrame(NO_FRAME)
+    , peerCheckHash(0)
+    , statistics{}
+{
+    for (SavedState& state : states) {
+        state.frame = NO_FRAME;
+        state.hash = 0;
+        state.hashed = false;
+    }
+
+    // Frames the peer does not run
+    emulator->setRewinding(false);
+    emulator->setRewindEnabled(false);
+    emulator->setRunAheadFrames(0);
+    emulator->setTurbo(false);
+}
+
+void RollbackSession::setInputDelay(int frames) {
+    if (frame > 0) {
+        return;
+    }
+    // The first frames of each side run without any button
+    inputDelay = std::clamp(frames, 0, MAX_INPUT_DELAY);
+    localInputCount = static_cast<uint64_t>(inputDelay);
+}
+
+bool RollbackSession::runFrame() {
+    if (!emulator->isRunning() || emulator->isPaused()) {
+        return false;
+    }
+
+    receive();
+    if (rollbackFrame < frame) {
+        rollBack();
+    }
+    checkPeerState();
+
+    // The buttons held now are latched inputDelay frames on
+    bool ahead = isAhead();
+    if (!ahead && localInputCount == frame + inputDelay) {
+        localInputs[localInputCount % INPUT_HISTORY] = emulator->getControllerState(localPort);
+        localInputCount++;
+    }
+    send();
+    if (ahead) {
+        statistics.stalls++;
+        return false;
+    }
+
+    saveState(frame);
+    runEmulatorFrame(frame);
+    frame++;
+    framesSinceSync++;
+    return true;
+}
+
+void RollbackSession::receive() {
+    uint8_t packet[MAX_PACKET_SIZE];
+    size_t size;
+    while ((size = transport->receive(packet, sizeof(packet))) > 0) {
+        readPacket(packet, size);
+    }
+}
+
+void RollbackSession::readPacket(const uint8_t* packet, size_t size) {
+    if (size < PACKET_HEADER_SIZE || get32(packet) != MAGIC) {
+        return;
+    }
+    size_t count = packet[PACKET_INPUTS];
+    if (size < PACKET_HEADER_SIZE + count * 2) {
+        return;
+    }
+
+    // Packets may come out of order, only the newest counts
+    peerHeard = true;
+    peerFrame = std::max<uint64_t>(peerFrame, get32(packet + PACKET_FRAME));
+    peerFrameSeen = std::max<uint64_t>(peerFrameSeen, get32(packet + PACKET_FRAME_SEEN));
+    peerInputCount = std::max<uint64_t>(peerInputCount, get32(packet + PACKET_INPUT_COUNT));
+
+    uint32_t checkFrame = get32(packet + PACKET_CHECK_FRAME);
+    if (checkFrame != NO_CHECK_FRAME && (peerCheckFrame == NO_FRAME || checkFrame > peerCheckFrame)) {
+        peerCheckFrame = checkFrame;
+        peerCheckHash = get32(packet + PACKET_CHECK_HASH) |
+                        (static_cast<uint64_t>(get32(packet + PACKET_CHECK_HASH + 4)) << 32);
+    }
+
+    // Inputs follow on from the ones we have, a gap waits for the packet
+    // resending them. The ring still holds those of the frames that may be
+    // rolled back to.
+    uint64_t first = get32(packet + PACKET_FIRST_INPUT);
+    if (first > remoteInputCount) {
+        return;
+    }
+    uint64_t oldest = frame > MAX_ROLLBACK_FRAMES ? frame - MAX_ROLLBACK_FRAMES : 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t inputFrame = first + i;
+        if (inputFrame < remoteInputCount) {
+            continue;
+        }
+        if (inputFrame >= oldest + INPUT_HISTORY) {
+            break;
+        }
+        uint16_t buttons = get16(packet + PACKET_HEADER_SIZE + i * 2);
+        size_t slot = inputFrame % INPUT_HISTORY;
+        remoteInputs[slot] = buttons;
+        if (inputFrame < frame && usedRemote[slot] != buttons) {
+            rollbackFrame = std::min(rollbackFrame, inputFrame);
+        }
+        remoteInputCount = inputFrame + 1;
+    }
+}
+
+void RollbackSession::send() {
+    uint8_t packet[MAX_PACKET_SIZE];
+    put32(packet, MAGIC);
+    put32(packet + PACKET_FRAME, static_cast<uint32_t>(frame));
+    put32(packet + PACKET_FRAME_SEEN, static_cast<uint32_t>(peerFrame));
+    put32(packet + PACKET_INPUT_COUNT, static_cast<uint32_t>(remoteInputCount));
+
+    // The newest state both sides have every input before
+    uint64_t hash = 0;
+    uint64_t checkFrame = frame > 0 ? std::min(frame - 1, remoteInputCount) : NO_FRAME;
+    if (checkFrame == NO_FRAME || !getStateHash(checkFrame, hash)) {
+        checkFrame = NO_CHECK_FRAME;
+    }
+    put32(packet + PACKET_CHECK_FRAME, static_cast<uint32_t>(checkFrame));
+    put32(packet + PACKET_CHECK_HASH, static_cast<uint32_t>(hash));
+    put32(packet + PACKET_CHECK_HASH + 4, static_cast<uint32_t>(hash >> 32));
+
+    // Every input the peer has not acknowledged, in each packet
+    uint64_t first = std::max<uint64_t>(peerInputCount, localInputCount > INPUT_HISTORY ? localInputCount - INPUT_HISTORY : 0);
+    size_t count = static_cast<size_t>(localInputCount - first);
+    put32(packet + PACKET_FIRST_INPUT, static_cast<uint32_t>(first));
+    packet[PACKET_INPUTS] = static_cast<uint8_t>(count);
+    for (size_t i = 0; i < count; i++) {
+        put16(packet + PACKET_HEADER_SIZE + i * 2, localInputs[(first + i) % INPUT_HISTORY]);
+    }
+    transport->send(packet, PACKET_HEADER_SIZE + count * 2);
+}
+
+void RollbackSession::rollBack() {
+    uint64_t from = rollbackFrame;
+    rollbackFrame = NO_FRAME;
+    const SavedState& saved = states[from % STATE_SLOTS];
+    if (saved.frame != from || !emulator->loadState(saved.data)) {
+        Log::err("RollbackSession").str("No state to roll back to frame ").num(from).show();
+        return;
+    }
+
+    // Neither seen nor heard, the frame about to run is
+    bool wasHeadless = emulator->isHeadless();
+    emulator->setHeadless(true);
+    for (uint64_t resimulated = from; resimulated < frame; resimulated++) {
+        if (resimulated != from) {
+            saveState(resimulated);
+        }
+        runEmulatorFrame(resimulated);
+    }
+    emulator->setHeadless(wasHeadless);
+
+    int depth = static_cast<int>(frame - from);
+    statistics.rollbacks++;
+    statistics.resimulatedFrames += depth;
+    statistics.maxRollback = std::max(statistics.maxRollback, depth);
+}
+
+void RollbackSession::checkPeerState() {
+    // Final on this side once every input before it is in
+    if (peerCheckFrame == NO_FRAME || peerCheckFrame > remoteInputCount || desyncFrame >= 0) {
+        return;
+    }
+    uint64_t hash;
+    if (getStateHash(peerCheckFrame, hash) && hash != peerCheckHash) {
+        desyncFrame = static_cast<int64_t>(peerCheckFrame);
+        Log::wrn("RollbackSession").str("State differs from the peer's at frame ").num(desyncFrame).show();
+    }
+    peerCheckFrame = NO_FRAME;
+}
+
+bool RollbackSession::isAhead() {
+    // Predictions only go so far, and inputs must stay in the ring until acknowledged
+    if (frame >= remoteInputCount + MAX_ROLLBACK_FRAMES ||
+        frame + inputDelay + 1 > peerInputCount + INPUT_HISTORY) {
+        return true;
+    }
+    if (!peerHeard) {
+        return false;
+    }
+
+    // Frames ahead of the peer against frames it sees itself ahead, the
+    // transit time both ways cancels out
+    int64_t localAdvantage = static_cast<int64_t>(frame) - static_cast<int64_t>(peerFrame);
+    int64_t peerAdvantage = static_cast<int64_t>(peerFrame) - static_cast<int64_t>(peerFrameSeen);
+    statistics.frameAdvantage = static_cast<int>((localAdvantage - peerAdvantage) / 2);
+    if (statistics.frameAdvantage >= 1 && framesSinceSync >= SYNC_INTERVAL) {
+        framesSinceSync = 0;
+        return true;
+    }
+    return false;
+}
+
+void RollbackSession::saveState(uint64_t stateFrame) {
+    SavedState& saved = states[stateFrame % STATE_SLOTS];
+    saved.frame = emulator->saveState(saved.data) ? stateFrame : NO_FRAME;
+    saved.hashed = false;
+}
+
+bool RollbackSession::getStateHash(uint64_t stateFrame, uint64_t& hash) {
+    SavedState& saved = states[stateFrame % STATE_SLOTS];
+    if (saved.frame != stateFrame) {
+        return false;
+    }
+    if (!saved.hashed) {
+        saved.hash = InputMovie::hashState(saved.data.data(), saved.data.size());
+        saved.hashed = true;
+    }
+    hash = saved.hash;
+    return true;
+}
+
+void RollbackSession::runEmulatorFrame(uint64_t inputFrame) {
+    // The peer's latest buttons are held on past the last ones in
+    size_t slot = inputFrame % INPUT_HISTORY;
+    uint16_t remote = 0;
+    if (inputFrame < remoteInputCount) {
+        remote = remoteInputs[slot];
+    } else if (remoteInputCount > 0) {
+        remote = remoteInputs[(remoteInputCount - 1) % INPUT_HISTORY];
+    }
+    usedRemote[slot] = remote;
+
+    uint16_t buttons[InputPort::PORT_COUNT] = {};
+    buttons[localPort] = localInputs[slot];
+    buttons[localPort ^ 1] = remote;
+    emulator->runFrame(buttons);
+}
@@ -0,0 +1,126 @@
+#ifndef ROLLBACK_SESSION_H
+#define ROLLBACK_SESSION_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Emulator;
+class NetplayTransport;
+
+/**
+ * Rollback Session
+ *
+ * Two machines, one player each, kept in step over a NetplayTransport.
+ * Every frame the local player's buttons are sent for the frame inputDelay
+ * ahead, and the frame runs at once on the peer's buttons as far as they
+ * came in, its last ones repeated beyond that. A state is saved before each
+ * frame; when the peer's buttons turn out to differ from the ones predicted
+ * the machine goes back to the state of the first frame they differ on and
+ * runs the frames since again headless, within the same host frame. The
+ * frame after is the one seen and heard.
+ *
+ * The session waits instead of running (runFrame() returns false) when the
+ * peer's buttons are more than MAX_ROLLBACK_FRAMES behind, and now and then
+ * to let a peer running late catch up. Both sides hash the state of the
+ * newest frame they both have every input of and compare; frames replay
+ * exactly with the sequential scheduler only.
+ *
+ * Both machines must start from the same state, e.g. the same ROM just
+ * reset. Rewinding, run-ahead and turbo are turned off, frames of a session
+ * only ever go forward. To be driven by the thread running the frames, see
+ * Emulator::setNetplaySession().
+ */
+class RollbackSession {
+public:
+    static constexpr int MAX_ROLLBACK_FRAMES = 8;
+    static constexpr int DEFAULT_INPUT_DELAY = 1;
+    static constexpr int MAX_INPUT_DELAY = 8;
+    static constexpr int INPUT_HISTORY = 32;      // Inputs kept per player, resent until acknowledged
+    static constexpr uint32_t MAGIC = 0x42524E53; // "SNRB"
+    static constexpr size_t MAX_PACKET_SIZE = 40 + INPUT_HISTORY * 2;
+
+    struct Statistics {
+        uint64_t rollbacks;
+        uint64_t resimulatedFrames;
+        uint64_t stalls;            // Frames waited for the peer
+        int maxRollback;            // Frames run again at once, at most
+        int frameAdvantage;         // Frames ahead of the peer, halved round trip included
+    };
+
+    // localPort is the controller port of the local player, its buttons are
+    // read from Emulator::getControllerState(); the peer has the other one
+    RollbackSession(Emulator* emulator, NetplayTransport* transport, int localPort);
+
+    // Frames between a button press and the frame it is latched in; more
+    // delay, fewer rollbacks. Before the first frame only.
+    void setInputDelay(int frames);
+    int getInputDelay() const { return inputDelay; }
+
+    // Receives, rolls back if needed, sends and runs the next frame. False
+    // when it did not run one: waiting for the peer or the emulator paused.
+    bool runFrame();
+
+    // Frames run so far
+    uint64_t getFrame() const { return frame; }
+    // Frames the peer's buttons are in for
+    uint64_t getConfirmedFrames() const { return remoteInputCount; }
+    bool hasPeer() const { return peerHeard; }
+    // First frame whose state differs from the peer's, -1 while there is none
+    int64_t getDesyncFrame() const { return desyncFrame; }
+    const Statistics& getStatistics() const { return statistics; }
+
+private:
+    static constexpr int STATE_SLOTS = MAX_ROLLBACK_FRAMES + 1;
+    static constexpr uint64_t NO_FRAME = ~0ull;
+    static constexpr int SYNC_INTERVAL = 10;   // Frames run between two waits for a late peer
+
+    Emulator* emulator;
+    NetplayTransport* transport;
+    int localPort;
+    int inputDelay;
+
+    uint64_t frame;                 // Next one to run
+    uint64_t rollbackFrame;         // First frame run on a wrong prediction, NO_FRAME if none
+
+    // Buttons by frame, in rings of INPUT_HISTORY. Local ones are known up to
+    // localInputCount, the peer's up to remoteInputCount; usedRemote holds
+    // the peer's buttons each frame ran with, predicted or not.
+    std::array<uint16_t, INPUT_HISTORY> localInputs;
+    std::array<uint16_t, INPUT_HISTORY> remoteInputs;
+    std::array<uint16_t, INPUT_HISTORY> usedRemote;
+    uint64_t localInputCount;
+    uint64_t remoteInputCount;
+    uint64_t peerInputCount;        // Of ours the peer has, as it acknowledged
+    uint64_t peerFrame;             // Peer's latest frame
+    uint64_t peerFrameSeen;         // Ours, as in the latest packet the peer had
+    bool peerHeard;
+    int framesSinceSync;
+
+    // States before each frame, by frame % STATE_SLOTS
+    struct SavedState {
+        std::vector<uint8_t> data;
+        uint64_t frame;
+        uint64_t hash;
+        bool hashed;
+    };
+    std::array<SavedState, STATE_SLOTS> states;
+    int64_t desyncFrame;
+    uint64_t peerCheckFrame;        // Peer's state hash, compared once rolled back
+    uint64_t peerCheckHash;
+
+    Statistics statistics;
+
+    void receive();
+    void readPacket(const uint8_t* packet, size_t size);
+    void send();
+    void rollBack();
+    void checkPeerState();
+    bool isAhead();
+    void saveState(uint64_t stateFrame);
+    bool getStateHash(uint64_t stateFrame, uint64_t& hash);
+    void runEmulatorFrame(uint64_t inputFrame);
+};
+
+#endif // ROLLBACK_SESSION_H
@@ -0,0 +1,126 @@
+#include "udp_transport.h"
+#include <cstring>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define NETPLAY_UDP
+#endif
+
+UdpTransport::UdpTransport()
+    : socket(-1)
+    , peerKnown(false)
+    , peerAddress(0)
+    , peerPort(0)
+{
+}
+
+UdpTransport::~UdpTransport() {
+    close();
+}
+
+bool UdpTransport::open(uint16_t localPort, const std::string& peerHost, uint16_t peerPort) {
+    close();
+#if defined(NETPLAY_UDP)
+    if (!peerHost.empty()) {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo* result = nullptr;
+        if (getaddrinfo(peerHost.c_str(), nullptr, &hints, &result) != 0 || !result) {
+            std::cerr << "UdpTransport: Unknown host " << peerHost << std::endl;
+            return false;
+        }
+        peerAddress = reinterpret_cast<sockaddr_in*>(result->ai_addr)->sin_addr.s_addr;
+        freeaddrinfo(result);
+        this->peerPort = htons(peerPort);
+        peerKnown = true;
+    }
+
+    socket = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket < 0) {
+        std::cerr << "UdpTransport: Failed to create socket" << std::endl;
+        return false;
+    }
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(localPort);
+    if (bind(socket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0 ||
+        fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK) != 0) {
+        std::cerr << "UdpTransport: Failed to bind port " << localPort << std::endl;
+        close();
+        return false;
+    }
+    std::cout << "UdpTransport: Listening on port " << localPort << std::endl;
+    return true;
+#else
+    (void)localPort;
+    (void)peerHost;
+    (void)peerPort;
+    std::cerr << "UdpTransport: Not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+void UdpTransport::close() {
+#if defined(NETPLAY_UDP)
+    if (socket >= 0) {
+        ::close(socket);
+    }
+#endif
+    socket = -1;
+    peerKnown = false;
+    peerAddress = 0;
+    peerPort = 0;
+}
+
+bool UdpTransport::send(const uint8_t* data, size_t size) {
+#if defined(NETPLAY_UDP)
+    if (socket < 0 || !peerKnown) {
+        return false;
+    }
+    sockaddr_in peer = {};
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = peerAddress;
+    peer.sin_port = peerPort;
+    return sendto(socket, data, size, 0, reinterpret_cast<sockaddr*>(&peer), sizeof(peer)) ==
+           static_cast<ssize_t>(size);
+#else
+    (void)data;
+    (void)size;
+    return false;
+#endif
+}
+
+size_t UdpTransport::receive(uint8_t* data, size_t capacity) {
+#if defined(NETPLAY_UDP)
+    while (socket >= 0) {
+        sockaddr_in from = {};
+        socklen_t fromSize = sizeof(from);
+        ssize_t size = recvfrom(socket, data, capacity, 0, reinterpret_cast<sockaddr*>(&from), &fromSize);
+        if (size <= 0) {
+            return 0;
+        }
+        if (!peerKnown) {
+            peerAddress = from.sin_addr.s_addr;
+            peerPort = from.sin_port;
+            peerKnown = true;
+            std::cout << "UdpTransport: Peer " << inet_ntoa(from.sin_addr) << ":" << ntohs(from.sin_port) << std::endl;
+        }
+        // Anyone else's packets are dropped
+        if (from.sin_addr.s_addr == peerAddress && from.sin_port == peerPort) {
+            return static_cast<size_t>(size);
+        }
+    }
+#else
+    (void)data;
+    (void)capacity;
+#endif
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef UDP_TRANSPORT_H
+#define UDP_TRANSPORT_H
+
+#include <cstdint>
+#include <string>
+#include "netplay_transport.h"
+
+/**
+ * UDP Transport
+ *
+ * A non-blocking UDP socket bound to a local port, sending to the peer's
+ * address and taking packets from that address only. With an empty peer
+ * host the first packet received tells who the peer is, the side hosting
+ * a session needs to know nothing more than its port.
+ *
+ * POSIX sockets; open() fails elsewhere.
+ */
+class UdpTransport : public NetplayTransport {
+public:
+    UdpTransport();
+    ~UdpTransport() override;
+
+    bool open(uint16_t localPort, const std::string& peerHost = std::string(), uint16_t peerPort = 0);
+    void close();
+    bool isOpen() const { return socket >= 0; }
+    // A peer was given or has been heard from
+    bool hasPeer() const { return peerKnown; }
+
+    // NetplayTransport
+    bool send(const uint8_t* data, size_t size) override;
+    size_t receive(uint8_t* data, size_t capacity) override;
+
+private:
+    int socket;
+    bool peerKnown;
+    uint32_t peerAddress;   // IPv4, network order
+    uint16_t peerPort;      // Network order
+};
+
+#endif // UDP_TRANSPORT_H
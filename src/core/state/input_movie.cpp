@@ -0,0 +1,97 @@
+#include "input_movie.h"
+#include "save_state.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+static constexpr uint32_t MOVIE_MAGIC = SaveState::tag("SNMV");
+
+static_assert(std::is_trivially_copyable<InputMovie::Frame>::value && sizeof(InputMovie::Frame) == 16,
+              "Frames are written as they are");
+
+struct MovieHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stateVersion;
+    uint32_t portCount;
+    uint64_t frameCount;
+    uint64_t stateSize;
+};
+
+void InputMovie::clear() {
+    initialState.clear();
+    frames.clear();
+}
+
+bool InputMovie::saveToFile(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "InputMovie: Failed to create movie file: " << filename << std::endl;
+        return false;
+    }
+
+    MovieHeader header = {
+        MOVIE_MAGIC, VERSION, SaveState::VERSION, InputPort::PORT_COUNT,
+        frames.size(), initialState.size()
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(initialState.data()), initialState.size());
+    file.write(reinterpret_cast<const char*>(frames.data()), frames.size() * sizeof(Frame));
+    return file.good();
+}
+
+bool InputMovie::loadFromFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "InputMovie: Failed to open movie file: " << filename << std::endl;
+        return false;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(0, std::ios::beg);
+
+    MovieHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != MOVIE_MAGIC || header.version != VERSION) {
+        std::cerr << "InputMovie: Not a movie file: " << filename << std::endl;
+        return false;
+    }
+    if (header.stateVersion != SaveState::VERSION || header.portCount != InputPort::PORT_COUNT) {
+        std::cerr << "InputMovie: Movie recorded by another version: " << filename << std::endl;
+        return false;
+    }
+    // Sizes checked against the file before allocating for them
+    if (header.stateSize > fileSize || header.frameCount > fileSize / sizeof(Frame) ||
+        sizeof(header) + header.stateSize + header.frameCount * sizeof(Frame) != fileSize) {
+        std::cerr << "InputMovie: Truncated movie file: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> state(static_cast<size_t>(header.stateSize));
+    std::vector<Frame> movieFrames(static_cast<size_t>(header.frameCount));
+    if (!file.read(reinterpret_cast<char*>(state.data()), state.size()) ||
+        !file.read(reinterpret_cast<char*>(movieFrames.data()), movieFrames.size() * sizeof(Frame))) {
+        return false;
+    }
+    initialState.swap(state);
+    frames.swap(movieFrames);
+    return true;
+}
+
+uint64_t InputMovie::hashState(const uint8_t* data, size_t size) {
+    // FNV-1a over 64-bit words, the high half folded back down every round
+    // since the multiply only carries upwards. The tail goes in bytewise
+    const uint64_t PRIME = 0x100000001B3ULL;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * PRIME;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ data[i]) * PRIME;
+    }
+    return hash;
+}
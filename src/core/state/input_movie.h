@@ -0,0 +1,56 @@
+#ifndef INPUT_MOVIE_H
+#define INPUT_MOVIE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "../memory/input_port.h"
+
+/**
+ * Input Movie
+ *
+ * A run of the machine that plays back exactly: the save state it starts
+ * from, then for every frame the buttons latched into the InputPort before
+ * it ran and the hash of the state it ended in. Played back from its state,
+ * a movie reaches the same hash on every frame, the first one that does not
+ * is where the build under test went another way.
+ *
+ * Written as a header (magic "SNMV", uint32 version, uint32 save state
+ * version, uint32 controller count, uint64 frame count, uint64 state size),
+ * the state, then the frames. Host byte order, as save states.
+ */
+class InputMovie {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    struct Frame {
+        uint16_t buttons[InputPort::PORT_COUNT];
+        uint32_t reserved;
+        uint64_t stateHash;
+    };
+
+    InputMovie() = default;
+
+    void setInitialState(const std::vector<uint8_t>& state) { initialState = state; }
+    const std::vector<uint8_t>& getInitialState() const { return initialState; }
+
+    void addFrame(const Frame& frame) { frames.push_back(frame); }
+    void setStateHash(size_t frame, uint64_t hash) { frames[frame].stateHash = hash; }
+    const Frame& getFrame(size_t frame) const { return frames[frame]; }
+    size_t getFrameCount() const { return frames.size(); }
+
+    void clear();
+
+    bool saveToFile(const std::string& filename) const;
+    bool loadFromFile(const std::string& filename);
+
+    // 64-bit hash of a save state, eight bytes at a time
+    static uint64_t hashState(const uint8_t* data, size_t size);
+
+private:
+    std::vector<uint8_t> initialState;
+    std::vector<Frame> frames;
+};
+
+#endif // INPUT_MOVIE_H
@@ -0,0 +1,191 @@
+#include "rewind_buffer.h"
+#include <cstring>
+
+// Zero runs shorter than this stay in the literals, a token costs a few bytes
+static constexpr size_t MIN_ZERO_RUN = 8;
+
+static inline uint64_t load64(const uint8_t* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint8_t* writeVarint(uint8_t* out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    *out++ = static_cast<uint8_t>(value);
+    return out;
+}
+
+static inline bool readVarint(const uint8_t*& in, const uint8_t* end, size_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in >= end) return false;
+        uint8_t byte = *in++;
+        value |= static_cast<size_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+RewindBuffer::RewindBuffer()
+    : budget(DEFAULT_BUDGET)
+    , interval(DEFAULT_INTERVAL)
+{
+}
+
+void RewindBuffer::setBudget(size_t bytes) {
+    clear();
+    budget = bytes;
+    storage.clear();
+    storage.shrink_to_fit();
+}
+
+void RewindBuffer::clear() {
+    entries.clear();
+    newest.clear();
+}
+
+size_t RewindBuffer::getUsedBytes() const {
+    size_t used = 0;
+    for (const Entry& entry : entries) {
+        used += entry.size;
+    }
+    return used;
+}
+
+//=============================================================================
+// History
+//=============================================================================
+
+void RewindBuffer::push(const std::vector<uint8_t>& state) {
+    if (newest.size() == state.size()) {
+        encodeDelta(newest.data(), state.data(), state.size(), scratch);
+        uint8_t* dest = allocate(scratch.size());
+        if (dest) {
+            std::memcpy(dest, scratch.data(), scratch.size());
+        }
+    } else {
+        // Another layout (save RAM appeared, other ROM), nothing to diff against
+        entries.clear();
+    }
+    newest = state;
+}
+
+bool RewindBuffer::stepBack(std::vector<uint8_t>& state) {
+    if (entries.empty()) {
+        return false;
+    }
+
+    Entry entry = entries.back();
+    entries.pop_back();
+    if (!applyDelta(storage.data() + entry.offset, entry.size, newest.data(), newest.size())) {
+        clear();
+        return false;
+    }
+    state = newest;
+    return true;
+}
+
+uint8_t* RewindBuffer::allocate(size_t size) {
+    if (storage.size() != budget) {
+        storage.resize(budget);
+    }
+    if (size > storage.size()) {
+        // The history would not reach past this state anyway
+        entries.clear();
+        return nullptr;
+    }
+
+    size_t offset = entries.empty() ? 0 : entries.back().offset + entries.back().size;
+    if (offset + size > storage.size()) {
+        // Whatever lies past the end is older than what is at the start
+        while (!entries.empty() && entries.front().offset >= offset) {
+            entries.pop_front();
+        }
+        offset = 0;
+    }
+    while (!entries.empty() && entries.front().offset < offset + size &&
+           offset < entries.front().offset + entries.front().size) {
+        entries.pop_front();
+    }
+
+    entries.push_back(Entry{offset, size});
+    return storage.data() + offset;
+}
+
+//=============================================================================
+// Delta Encoding
+//=============================================================================
+
+// Sequence of tokens: varint zero run, varint literal count, literals
+void RewindBuffer::encodeDelta(const uint8_t* a, const uint8_t* b, size_t size, std::vector<uint8_t>& out) {
+    // Worst case, every token but the last holds a minimal zero run
+    out.resize(size + (size / MIN_ZERO_RUN + 2) * 20);
+    uint8_t* dest = out.data();
+
+    size_t position = 0;
+    while (position < size) {
+        size_t literalStart = position;
+        while (literalStart + 8 <= size && load64(a + literalStart) == load64(b + literalStart)) {
+            literalStart += 8;
+        }
+        while (literalStart < size && a[literalStart] == b[literalStart]) {
+            literalStart++;
+        }
+
+        // Literals end where a long enough zero run starts
+        size_t literalEnd = literalStart;
+        while (literalEnd < size) {
+            if (a[literalEnd] != b[literalEnd]) {
+                literalEnd++;
+                continue;
+            }
+            size_t run = 1;
+            while (run < MIN_ZERO_RUN && literalEnd + run < size && a[literalEnd + run] == b[literalEnd + run]) {
+                run++;
+            }
+            if (run == MIN_ZERO_RUN || literalEnd + run == size) {
+                break;
+            }
+            literalEnd += run;
+        }
+
+        dest = writeVarint(dest, literalStart - position);
+        dest = writeVarint(dest, literalEnd - literalStart);
+        for (size_t i = literalStart; i < literalEnd; i++) {
+            *dest++ = a[i] ^ b[i];
+        }
+        position = literalEnd;
+    }
+
+    out.resize(dest - out.data());
+}
+
+bool RewindBuffer::applyDelta(const uint8_t* delta, size_t deltaSize, uint8_t* state, size_t size) {
+    const uint8_t* in = delta;
+    const uint8_t* end = delta + deltaSize;
+    size_t position = 0;
+
+    while (in < end) {
+        size_t zeros;
+        size_t literals;
+        if (!readVarint(in, end, zeros) || !readVarint(in, end, literals)) {
+            return false;
+        }
+        if (zeros > size - position || literals > size - position - zeros ||
+            literals > static_cast<size_t>(end - in)) {
+            return false;
+        }
+        position += zeros;
+        for (size_t i = 0; i < literals; i++) {
+            state[position + i] ^= in[i];
+        }
+        in += literals;
+        position += literals;
+    }
+
+    return position == size;
+}
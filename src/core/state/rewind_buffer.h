@@ -0,0 +1,68 @@
+#ifndef REWIND_BUFFER_H
+#define REWIND_BUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+/**
+ * Rewind Buffer
+ *
+ * History of save states, newest last, kept within a fixed memory budget.
+ *
+ * Only the newest state is held as it is. Every older one is stored as the
+ * XOR of itself with the state that followed it, which is zero wherever the
+ * two agree (most of the RAM from one frame to the next), with the zero runs
+ * squeezed out. Stepping back undoes the newest delta, so it costs one pass
+ * over the state whatever the length of the history.
+ *
+ * The deltas share one ring of budget bytes, the oldest ones are dropped to
+ * make room for new ones.
+ */
+class RewindBuffer {
+public:
+    static constexpr size_t DEFAULT_BUDGET = 32 * 1024 * 1024;   // 32MB
+    static constexpr int DEFAULT_INTERVAL = 1;                    // Every frame
+
+    RewindBuffer();
+
+    // Drops the history, the ring is allocated on first use
+    void setBudget(size_t bytes);
+    size_t getBudget() const { return budget; }
+    // Frames between two snapshots, for the owner to follow
+    void setInterval(int frames) { interval = frames > 0 ? frames : 1; }
+    int getInterval() const { return interval; }
+
+    // Newest state, its predecessor goes into the ring
+    void push(const std::vector<uint8_t>& state);
+    // Drops the newest state and returns the one before, false when there is none
+    bool stepBack(std::vector<uint8_t>& state);
+    void clear();
+
+    // States that can be stepped back to
+    size_t getDepth() const { return entries.size(); }
+    size_t getUsedBytes() const;
+
+private:
+    struct Entry {
+        size_t offset;
+        size_t size;
+    };
+
+    size_t budget;
+    std::vector<uint8_t> storage;
+    std::deque<Entry> entries;      // Oldest first
+    std::vector<uint8_t> newest;
+    std::vector<uint8_t> scratch;
+    int interval;
+
+    // Room for a delta of the given size, dropping the oldest ones as needed
+    uint8_t* allocate(size_t size);
+
+    // Zero run encoding of a ^ b, and its inverse applied in place
+    static void encodeDelta(const uint8_t* a, const uint8_t* b, size_t size, std::vector<uint8_t>& out);
+    static bool applyDelta(const uint8_t* delta, size_t deltaSize, uint8_t* state, size_t size);
+};
+
+#endif // REWIND_BUFFER_H
@@ -0,0 +1,125 @@
+#include "save_state.h"
+#include <iostream>
+#include <string>
+
+static constexpr uint32_t STATE_MAGIC = SaveState::tag("SNST");
+static constexpr size_t HEADER_SIZE = 12;
+static constexpr size_t SECTION_HEADER_SIZE = 8;
+
+static void store32(uint8_t* p, uint32_t value) {
+    std::memcpy(p, &value, sizeof(value));
+}
+
+static uint32_t load32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+//=============================================================================
+// Writer
+//=============================================================================
+
+StateWriter::StateWriter(std::vector<uint8_t>& buffer)
+    : buffer(buffer)
+    , start(buffer.size())
+    , sectionStart(0)
+{
+    buffer.resize(start + HEADER_SIZE);
+    store32(buffer.data() + start, STATE_MAGIC);
+    store32(buffer.data() + start + 4, SaveState::VERSION);
+    store32(buffer.data() + start + 8, 0);
+}
+
+void StateWriter::beginSection(uint32_t tag) {
+    sectionStart = buffer.size();
+    buffer.resize(sectionStart + SECTION_HEADER_SIZE);
+    store32(buffer.data() + sectionStart, tag);
+}
+
+void StateWriter::endSection() {
+    size_t payload = buffer.size() - sectionStart - SECTION_HEADER_SIZE;
+    store32(buffer.data() + sectionStart + 4, static_cast<uint32_t>(payload));
+}
+
+void StateWriter::write(const void* data, size_t size) {
+    size_t offset = buffer.size();
+    buffer.resize(offset + size);
+    std::memcpy(buffer.data() + offset, data, size);
+}
+
+void StateWriter::finish() {
+    store32(buffer.data() + start + 8, static_cast<uint32_t>(buffer.size() - start));
+}
+
+//=============================================================================
+// Reader
+//=============================================================================
+
+StateReader::StateReader(const uint8_t* data, size_t size)
+    : data(data)
+    , size(size)
+    , position(0)
+    , sectionEnd(size)
+    , valid(data != nullptr)
+{
+}
+
+bool StateReader::readHeader() {
+    if (!valid || size < HEADER_SIZE || load32(data) != STATE_MAGIC) {
+        std::cerr << "SaveState: Not a save state" << std::endl;
+        valid = false;
+        return false;
+    }
+    if (load32(data + 4) != SaveState::VERSION) {
+        std::cerr << "SaveState: Unsupported version " << load32(data + 4) << std::endl;
+        valid = false;
+        return false;
+    }
+    if (load32(data + 8) > size) {
+        std::cerr << "SaveState: Truncated state" << std::endl;
+        valid = false;
+        return false;
+    }
+
+    size = load32(data + 8);
+    position = HEADER_SIZE;
+    sectionEnd = size;
+    return true;
+}
+
+bool StateReader::enterSection(uint32_t tag) {
+    if (!valid || size - position < SECTION_HEADER_SIZE || load32(data + position) != tag) {
+        std::cerr << "SaveState: Missing section " << std::string(reinterpret_cast<const char*>(&tag), 4) << std::endl;
+        valid = false;
+        return false;
+    }
+
+    uint32_t payload = load32(data + position + 4);
+    position += SECTION_HEADER_SIZE;
+    if (payload > size - position) {
+        valid = false;
+        return false;
+    }
+    sectionEnd = position + payload;
+    return true;
+}
+
+bool StateReader::leaveSection() {
+    if (valid && position != sectionEnd) {
+        std::cerr << "SaveState: Section size mismatch" << std::endl;
+        valid = false;
+    }
+    sectionEnd = size;
+    return valid;
+}
+
+bool StateReader::read(void* dest, size_t count) {
+    if (!valid || count > sectionEnd - position) {
+        valid = false;
+        return false;
+    }
+    std::memcpy(dest, data + position, count);
+    position += count;
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef SAVE_STATE_H
+#define SAVE_STATE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Save State
+ *
+ * Flat binary snapshot of the emulated machine, as written by
+ * Emulator::saveState(). Every component adds one section holding its
+ * registers and memories exactly as they are laid out in memory, so that
+ * saving and loading are a handful of memcpys:
+ *
+ * - Header:   magic "SNST", uint32 version, uint32 total size
+ * - Sections: uint32 tag, uint32 payload size, payload
+ *
+ * Values are stored in host byte order, states are meant to be loaded back
+ * by the build that wrote them (quick save, rewind, run-ahead, replay) and
+ * the version is bumped whenever a section changes layout.
+ */
+class StateWriter {
+public:
+    // Appends to the buffer, which keeps its capacity from one state to the next
+    explicit StateWriter(std::vector<uint8_t>& buffer);
+
+    void beginSection(uint32_t tag);
+    void endSection();
+
+    void write(const void* data, size_t size);
+
+    template <typename T>
+    void writeValue(const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "State values are copied as they are");
+        write(&value, sizeof(T));
+    }
+
+    // Header size patched in, to be called last
+    void finish();
+
+private:
+    std::vector<uint8_t>& buffer;
+    size_t start;
+    size_t sectionStart;
+};
+
+class StateReader {
+public:
+    StateReader(const uint8_t* data, size_t size);
+
+    // Checks the header, false if this is no state or one of another version
+    bool readHeader();
+
+    // False if the next section is not the expected one
+    bool enterSection(uint32_t tag);
+    // False if the section was not consumed exactly
+    bool leaveSection();
+
+    bool read(void* data, size_t size);
+
+    template <typename T>
+    bool readValue(T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "State values are copied as they are");
+        return read(&value, sizeof(T));
+    }
+
+    // Stays false after the first failed read
+    bool isValid() const { return valid; }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+    size_t sectionEnd;
+    bool valid;
+};
+
+namespace SaveState {
+    static constexpr uint32_t VERSION = 9;
+
+    constexpr uint32_t tag(const char (&name)[5]) {
+        return (uint32_t)(uint8_t)name[0] | ((uint32_t)(uint8_t)name[1] << 8) |
+               ((uint32_t)(uint8_t)name[2] << 16) | ((uint32_t)(uint8_t)name[3] << 24);
+    }
+}
+
+#endif // SAVE_STATE_H
@@ -0,0 +1,119 @@
+#include "frame_pacer.h"
+#include "master_clock.h"
+#include <cmath>
+
+static constexpr double FRAME_PERIOD = 1.0 / MasterClock::FRAME_RATE;
+// Vsync intervals further than this from a whole number of refreshes are
+// the display thread held up, the measure starts over
+static constexpr double INTERVAL_TOLERANCE = 0.25;
+// The period is measured over this many refreshes at most, then again
+static constexpr uint64_t MEASURED_REFRESHES = 1200;
+
+static double secondsBetween(FramePacer::Clock::time_point from, FramePacer::Clock::time_point to) {
+    return std::chrono::duration<double>(to - from).count();
+}
+
+FramePacer::FramePacer()
+    : mode(MODE_VSYNC)
+    , refreshPeriod(0.0)
+    , vsyncSeen(false)
+    , measuredRefreshes(0)
+    , phaseError(0.0)
+{
+}
+
+void FramePacer::setMode(Mode mode) {
+    std::lock_guard<std::mutex> guard(lock);
+    this->mode = mode;
+}
+
+FramePacer::Mode FramePacer::getMode() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return mode;
+}
+
+void FramePacer::setRefreshRate(double hz) {
+    std::lock_guard<std::mutex> guard(lock);
+    refreshPeriod = hz > 0.0 ? 1.0 / hz : 0.0;
+    measuredRefreshes = 0;
+}
+
+void FramePacer::onVSync(Clock::time_point time) {
+    std::lock_guard<std::mutex> guard(lock);
+    // Frames may take more than one refresh each. Counted from the first
+    // vsync measured, a late one only throws the period off by its lateness
+    // over the whole span
+    double refreshes = 0.0;
+    if (vsyncSeen && refreshPeriod > 0.0) {
+        double interval = secondsBetween(lastVSync, time);
+        refreshes = std::round(interval / refreshPeriod);
+        if (refreshes < 1.0 || std::fabs(interval - refreshes * refreshPeriod) > refreshPeriod * INTERVAL_TOLERANCE) {
+            refreshes = 0.0;
+        }
+    }
+    if (refreshes == 0.0 || measuredRefreshes >= MEASURED_REFRESHES) {
+        measureStart = time;
+        measuredRefreshes = 0;
+    } else {
+        measuredRefreshes += static_cast<uint64_t>(refreshes);
+        // Too few to tell better than the screen's rate
+        if (measuredRefreshes >= MEASURED_REFRESHES / 20) {
+            refreshPeriod = secondsBetween(measureStart, time) / measuredRefreshes;
+        }
+    }
+    lastVSync = time;
+    vsyncSeen = true;
+}
+
+int FramePacer::refreshesPerFrame() const {
+    if (refreshPeriod <= 0.0) {
+        return 0;
+    }
+    // 60 Hz once, 120 Hz twice...
+    int refreshes = static_cast<int>(std::round(FRAME_PERIOD / refreshPeriod));
+    if (refreshes < 1 || std::fabs(refreshes * refreshPeriod - FRAME_PERIOD) > FRAME_PERIOD * LOCK_TOLERANCE) {
+        return 0;
+    }
+    return refreshes;
+}
+
+bool FramePacer::lockedNow(Clock::time_point now) const {
+    return mode == MODE_VSYNC && vsyncSeen && refreshesPerFrame() > 0 &&
+           now - lastVSync < std::chrono::milliseconds(VSYNC_TIMEOUT_MS);
+}
+
+bool FramePacer::isLocked() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return lockedNow(Clock::now());
+}
+
+FramePacer::Clock::time_point FramePacer::nextDeadline(Clock::time_point deadline) {
+    std::lock_guard<std::mutex> guard(lock);
+    int refreshes = refreshesPerFrame();
+    if (!lockedNow(Clock::now()) || refreshes == 0) {
+        return deadline + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(FRAME_PERIOD));
+    }
+
+    // Phase against the refreshes to come, within half a refresh either way
+    double period = refreshes * refreshPeriod;
+    double next = secondsBetween(lastVSync, deadline) + period - PHASE_OFFSET_MS / 1000.0;
+    double error = next - std::round(next / refreshPeriod) * refreshPeriod;
+    phaseError = error * 1000.0;
+    return deadline + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(period - error * PHASE_GAIN));
+}
+
+double FramePacer::getRefreshRate() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return vsyncSeen && refreshPeriod > 0.0 ? 1.0 / refreshPeriod : 0.0;
+}
+
+int FramePacer::getRefreshesPerFrame() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return refreshesPerFrame();
+}
+
+double FramePacer::getPhaseError() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return phaseError;
+}
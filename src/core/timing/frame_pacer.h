@@ -0,0 +1,81 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * Frame Pacer
+ *
+ * Lines the emulated frames up with the refreshes of the display, so that
+ * none is shown twice and none skipped, as happens when a 60 Hz machine
+ * runs by its own clock next to a display refreshing at 59.94 or 60.02 Hz.
+ *
+ * The display reports each vsync with onVSync(), from the thread swapping
+ * its buffers. When the refresh period times some whole number comes
+ * within LOCK_TOLERANCE of the emulated frame period, the pacer locks:
+ * nextDeadline() then starts a frame every that many refreshes, just after
+ * one of them. It is a small phase controller: the period follows the
+ * refreshes measured, and PHASE_GAIN of the phase error is corrected each
+ * frame, so the jitter of the display thread is smoothed out. The audio
+ * mixer's rate adjustment absorbs the difference with the emulated rate.
+ *
+ * Unlocked, when there are no vsyncs (headless, window hidden), when the
+ * display is too far from a multiple of the frame rate or in MODE_VRR, the
+ * emulation keeps its own exact frame rate. A variable refresh display
+ * follows it, showing each frame as it is published.
+ */
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum Mode {
+        MODE_CLOCK,     // The emulation's own frame rate only
+        MODE_VSYNC,     // Locked to the display's refreshes when they fit
+        MODE_VRR        // The display follows the emulation
+    };
+
+    static constexpr double LOCK_TOLERANCE = 0.005;     // AudioMixer::MAX_RATE_ADJUST
+    static constexpr double PHASE_GAIN = 0.1;
+    static constexpr double PHASE_OFFSET_MS = 1.0;      // After the vsync a frame starts at
+    static constexpr int64_t VSYNC_TIMEOUT_MS = 250;    // Unlocked without vsyncs for that long
+
+    FramePacer();
+
+    void setMode(Mode mode);
+    Mode getMode() const;
+
+    // As the display reports it, 0 for unknown. The pacer refines it from
+    // the vsyncs
+    void setRefreshRate(double hz);
+    // Any thread, with the time its buffers were swapped
+    void onVSync(Clock::time_point time);
+
+    bool isLocked() const;
+    // Emulation thread, once per frame while locked: when the next frame
+    // starts, given when the last one did
+    Clock::time_point nextDeadline(Clock::time_point deadline);
+
+    // Measured, 0 before the first vsyncs
+    double getRefreshRate() const;
+    int getRefreshesPerFrame() const;
+    // Of the last frame started, against its target, in milliseconds
+    double getPhaseError() const;
+
+private:
+    mutable std::mutex lock;
+    Mode mode;
+    double refreshPeriod;           // Seconds, 0 unknown
+    Clock::time_point lastVSync;
+    bool vsyncSeen;
+    Clock::time_point measureStart;
+    uint64_t measuredRefreshes;     // Since measureStart
+    double phaseError;
+
+    // Refreshes per frame when they fit, 0 otherwise. Lock held
+    int refreshesPerFrame() const;
+    bool lockedNow(Clock::time_point now) const;
+};
+
+#endif // FRAME_PACER_H
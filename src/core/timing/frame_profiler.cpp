@@ -0,0 +1,143 @@
+#include "frame_profiler.h"
+#include <algorithm>
+#include <vector>
+
+FrameProfiler::FrameProfiler()
+    : enabled(false)
+{
+    for (int section = 0; section < SECTION_COUNT; section++) {
+        for (auto& bucket : buckets[section]) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        bucketTotals[section].store(0, std::memory_order_relaxed);
+    }
+    reset();
+}
+
+void FrameProfiler::setEnabled(bool enable) {
+    if (enable && !isEnabled()) {
+        reset();
+    }
+    enabled.store(enable, std::memory_order_relaxed);
+}
+
+void FrameProfiler::reset() {
+    for (auto& sum : pending) {
+        sum.store(0, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(historyMutex);
+    historyCount = 0;
+    historyNext = 0;
+    frameEndCount = 0;
+    frameEndNext = 0;
+}
+
+void FrameProfiler::endFrame() {
+    Clock::time_point now = Clock::now();
+    bool profiling = isEnabled();
+
+    std::lock_guard<std::mutex> lock(historyMutex);
+    if (profiling) {
+        for (int section = 0; section < SECTION_COUNT; section++) {
+            uint64_t ticks = pending[section].exchange(0, std::memory_order_relaxed);
+            history[section][historyNext] = ticks;
+            
+            uint64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(Clock::duration(ticks)).count();
+            int bucket = 0;
+            while (bucket < BUCKET_COUNT && microseconds > BUCKET_BOUNDS_US[bucket]) {
+                bucket++;
+            }
+            buckets[section][bucket].fetch_add(1, std::memory_order_relaxed);
+            bucketTotals[section].fetch_add(ticks, std::memory_order_relaxed);
+        }
+        historyCount = std::min(historyCount + 1, HISTORY_FRAMES);
+        historyNext = (historyNext + 1) % HISTORY_FRAMES;
+    }
+    frameEnds[frameEndNext] = now;
+    frameEndCount = std::min(frameEndCount + 1, HISTORY_FRAMES);
+    frameEndNext = (frameEndNext + 1) % HISTORY_FRAMES;
+}
+
+//=============================================================================
+// Statistics
+//=============================================================================
+
+static double toMilliseconds(uint64_t ticks) {
+    return std::chrono::duration<double, std::milli>(FrameProfiler::Clock::duration(ticks)).count();
+}
+
+FrameProfiler::Stats FrameProfiler::getStats(Section section) const {
+    std::vector<uint64_t> samples;
+    {
+        std::lock_guard<std::mutex> lock(historyMutex);
+        for (int i = 1; i <= historyCount; i++) {
+            samples.push_back(history[section][(historyNext - i + HISTORY_FRAMES) % HISTORY_FRAMES]);
+        }
+    }
+
+    Stats stats = {0.0, 0.0, 0.0, 0.0};
+    if (samples.empty()) {
+        return stats;
+    }
+
+    uint64_t total = 0;
+    for (uint64_t sample : samples) {
+        total += sample;
+    }
+    stats.average = toMilliseconds(total) / samples.size();
+
+    // Nearest rank, p99 is the max below a hundred frames
+    auto rank = [&](double percentile) {
+        size_t index = static_cast<size_t>(percentile * (samples.size() - 1) + 0.5);
+        std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+        return toMilliseconds(samples[index]);
+    };
+    stats.p50 = rank(0.50);
+    stats.p99 = rank(0.99);
+    stats.max = toMilliseconds(*std::max_element(samples.begin(), samples.end()));
+    return stats;
+}
+
+double FrameProfiler::getFrameRate() const {
+    std::lock_guard<std::mutex> lock(historyMutex);
+    int frames = std::min(frameEndCount, 61);
+    if (frames < 2) {
+        return 0.0;
+    }
+    Clock::time_point newest = frameEnds[(frameEndNext - 1 + HISTORY_FRAMES) % HISTORY_FRAMES];
+    Clock::time_point oldest = frameEnds[(frameEndNext - frames + HISTORY_FRAMES) % HISTORY_FRAMES];
+    double seconds = std::chrono::duration<double>(newest - oldest).count();
+    return seconds > 0.0 ? (frames - 1) / seconds : 0.0;
+}
+
+int FrameProfiler::getSlowFrameCount() const {
+    const uint64_t budget = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(FRAME_BUDGET_MS)).count();
+
+    std::lock_guard<std::mutex> lock(historyMutex);
+    int slow = 0;
+    for (int i = 1; i <= historyCount; i++) {
+        if (history[FRAME][(historyNext - i + HISTORY_FRAMES) % HISTORY_FRAMES] > budget) {
+            slow++;
+        }
+    }
+    return slow;
+}
+
+FrameProfiler::Histogram FrameProfiler::getHistogram(Section section) const {
+    Histogram histogram;
+    histogram.count = 0;
+    for (int bucket = 0; bucket <= BUCKET_COUNT; bucket++) {
+        histogram.buckets[bucket] = buckets[section][bucket].load(std::memory_order_relaxed);
+        histogram.count += histogram.buckets[bucket];
+    }
+    histogram.totalMs = toMilliseconds(bucketTotals[section].load(std::memory_order_relaxed));
+    return histogram;
+}
+
+const char* FrameProfiler::getSectionName(Section section) {
+    static const char* names[SECTION_COUNT] = {
+        "Main CPU", "Graphics CPU", "Sound CPU", "Render", "Audio mix", "Texture upload", "Frame"
+    };
+    return section < SECTION_COUNT ? names[section] : "";
+}
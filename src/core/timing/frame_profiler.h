@@ -0,0 +1,133 @@
+#ifndef FRAME_PROFILER_H
+#define FRAME_PROFILER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * Frame Profiler
+ *
+ * Host time spent per frame in each subsystem, to tell which one blows the
+ * frame budget when a title stutters.
+ *
+ * Scopes add the time they span to their section, from any thread; once
+ * per frame endFrame() moves those sums into a history of the last
+ * HISTORY_FRAMES frames, from which the percentiles are taken. Scopes only
+ * read the clock while the profiler is enabled.
+ *
+ * Each frame profiled is also counted into a histogram per section, never
+ * reset and read without the lock, for exporters (see MetricsExporter).
+ *
+ * The end of each frame is always recorded, for the frame rate. With
+ * threaded execution the CPU sections overlap each other, so they may add
+ * up to more than the frame.
+ */
+class FrameProfiler {
+public:
+    enum Section {
+        MAIN_CPU,
+        GRAPHICS_CPU,
+        SOUND_CPU,
+        VIDEO_RENDER,
+        AUDIO_MIX,
+        TEXTURE_UPLOAD,     // Display thread, counted in the frame it ends in
+        FRAME,              // The whole Emulator::runFrame()
+        SECTION_COUNT
+    };
+
+    static constexpr int HISTORY_FRAMES = 300;  // 5 seconds
+    static constexpr double FRAME_BUDGET_MS = 1000.0 / 60.0;
+
+    // Milliseconds over the frames in the history
+    struct Stats {
+        double average;
+        double p50;
+        double p99;
+        double max;
+    };
+
+    // Upper bounds of the histogram buckets, in microseconds; one more bucket
+    // holds the frames above the last
+    static constexpr int BUCKET_COUNT = 12;
+    static constexpr uint32_t BUCKET_BOUNDS_US[BUCKET_COUNT] = {
+        250, 500, 1000, 2000, 4000, 8000, 12000, 16667, 20000, 33333, 50000, 100000
+    };
+    
+    // Frames per bucket (not cumulative) and their total time, since start
+    struct Histogram {
+        std::array<uint64_t, BUCKET_COUNT + 1> buckets;
+        uint64_t count;
+        double totalMs;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    class Scope {
+    public:
+        Scope(FrameProfiler* profiler, Section section)
+            : profiler(profiler && profiler->isEnabled() ? profiler : nullptr)
+            , section(section)
+        {
+            if (this->profiler) {
+                start = Clock::now();
+            }
+        }
+        ~Scope() {
+            if (profiler) {
+                profiler->add(section, Clock::now() - start);
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        FrameProfiler* profiler;
+        Section section;
+        Clock::time_point start;
+    };
+
+    FrameProfiler();
+
+    // Drops the history when turned on
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    void add(Section section, Clock::duration elapsed) {
+        pending[section].fetch_add(static_cast<uint64_t>(elapsed.count()), std::memory_order_relaxed);
+    }
+
+    // Closes the frame on the thread running them
+    void endFrame();
+    void reset();
+
+    // Any thread
+    Stats getStats(Section section) const;
+    // Frames per second over the last second of frames, 0 before there are two
+    double getFrameRate() const;
+    // Frames in the history that took more than FRAME_BUDGET_MS
+    int getSlowFrameCount() const;
+    // Lock-free, a frame ending meanwhile may show in part
+    Histogram getHistogram(Section section) const;
+
+    static const char* getSectionName(Section section);
+
+private:
+    std::atomic<bool> enabled;
+    std::array<std::atomic<uint64_t>, SECTION_COUNT> pending;   // Clock ticks
+    std::array<std::array<std::atomic<uint64_t>, BUCKET_COUNT + 1>, SECTION_COUNT> buckets;
+    std::array<std::atomic<uint64_t>, SECTION_COUNT> bucketTotals;  // Clock ticks
+
+    mutable std::mutex historyMutex;
+    std::array<std::array<uint64_t, HISTORY_FRAMES>, SECTION_COUNT> history;
+    int historyCount;
+    int historyNext;
+    std::array<Clock::time_point, HISTORY_FRAMES> frameEnds;
+    int frameEndCount;
+    int frameEndNext;
+};
+
+#endif // FRAME_PROFILER_H
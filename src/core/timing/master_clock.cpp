@@ -1,4 +1,5 @@
 #include "master_clock.h"
+#include "../state/save_state.h"
 #include <chrono>
 #include <algorithm>
 
@@ -38,10 +39,10 @@ void MasterClock::reset() {
     audioSampleCounter = 0;
     audioSamplesThisFrame = 0;
     
-    // Set initial frame targets
-    targetMainCycles = CYCLES_PER_FRAME_MAIN;
-    targetGraphicsCycles = CYCLES_PER_FRAME_GRAPHICS;
-    targetSoundCycles = CYCLES_PER_FRAME_SOUND;
+    // The first runFrame() sets the targets of frame 1
+    targetMainCycles = 0;
+    targetGraphicsCycles = 0;
+    targetSoundCycles = 0;
     
     // Initialize performance tracking
     auto now = std::chrono::steady_clock::now();
@@ -50,6 +51,36 @@ void MasterClock::reset() {
     emulatedTimeStart = 0;
 }
 
+void MasterClock::saveState(StateWriter& writer) const {
+    writer.writeValue(mainCPUCycles);
+    writer.writeValue(graphicsCPUCycles);
+    writer.writeValue(soundCPUCycles);
+    writer.writeValue(masterCycles);
+    writer.writeValue(frameCount);
+    writer.writeValue(currentScanline);
+    writer.writeValue(currentPixel);
+    writer.writeValue(targetMainCycles);
+    writer.writeValue(targetGraphicsCycles);
+    writer.writeValue(targetSoundCycles);
+    writer.writeValue(audioSampleCounter);
+    writer.writeValue(audioSamplesThisFrame);
+}
+
+bool MasterClock::loadState(StateReader& reader) {
+    return reader.readValue(mainCPUCycles) &&
+           reader.readValue(graphicsCPUCycles) &&
+           reader.readValue(soundCPUCycles) &&
+           reader.readValue(masterCycles) &&
+           reader.readValue(frameCount) &&
+           reader.readValue(currentScanline) &&
+           reader.readValue(currentPixel) &&
+           reader.readValue(targetMainCycles) &&
+           reader.readValue(targetGraphicsCycles) &&
+           reader.readValue(targetSoundCycles) &&
+           reader.readValue(audioSampleCounter) &&
+           reader.readValue(audioSamplesThisFrame);
+}
+
 //=============================================================================
 // Cycle Tracking
 //=============================================================================
@@ -147,10 +178,11 @@ void MasterClock::updateAudioTiming() {
 //=============================================================================
 
 void MasterClock::runFrame() {
-    // Set targets for next frame
-    targetMainCycles = mainCPUCycles + CYCLES_PER_FRAME_MAIN;
-    targetGraphicsCycles = graphicsCPUCycles + CYCLES_PER_FRAME_GRAPHICS;
-    targetSoundCycles = soundCPUCycles + CYCLES_PER_FRAME_SOUND;
+    // Set targets for next frame, from the previous targets so that a CPU
+    // overshooting one frame ends the next one that much sooner
+    targetMainCycles += CYCLES_PER_FRAME_MAIN;
+    targetGraphicsCycles += CYCLES_PER_FRAME_GRAPHICS;
+    targetSoundCycles += CYCLES_PER_FRAME_SOUND;
 
     // Reset frame counters
     audioSamplesThisFrame = 0;
@@ -173,6 +205,18 @@ bool MasterClock::shouldRunSoundCPU() const {
     return soundCPUCycles < targetSoundCycles;
 }
 
+uint64_t MasterClock::getMainCPUCyclesToRun() const {
+    return shouldRunMainCPU() ? targetMainCycles - mainCPUCycles : 0;
+}
+
+uint64_t MasterClock::getGraphicsCPUCyclesToRun() const {
+    return shouldRunGraphicsCPU() ? targetGraphicsCycles - graphicsCPUCycles : 0;
+}
+
+uint64_t MasterClock::getSoundCPUCyclesToRun() const {
+    return shouldRunSoundCPU() ? targetSoundCycles - soundCPUCycles : 0;
+}
+
 //=============================================================================
 // Performance Tracking
 //=============================================================================
@@ -4,6 +4,9 @@
 #include <cstdint>
 #include <functional>
 
+class StateWriter;
+class StateReader;
+
 /**
  * Master Clock
  * 
@@ -66,6 +69,12 @@ public:
     bool shouldRunGraphicsCPU() const;  // Check if Graphics CPU needs cycles
     bool shouldRunSoundCPU() const;     // Check if Sound CPU needs cycles
     
+    // Cycles each CPU still has to run to reach the end of the current frame,
+    // overshoot from the previous frame is taken into account
+    uint64_t getMainCPUCyclesToRun() const;
+    uint64_t getGraphicsCPUCyclesToRun() const;
+    uint64_t getSoundCPUCyclesToRun() const;
+    
     // Event callbacks
     using ScanlineCallback = std::function<void(int scanline)>;
     using VBlankCallback = std::function<void()>;
@@ -78,6 +87,10 @@ public:
     // Reset
     void reset();
     
+    // Save states, cycle and frame counters (not the performance tracking)
+    void saveState(StateWriter& writer) const;
+    bool loadState(StateReader& reader);
+    
     // Frame counter
     uint64_t getFrameCount() const { return frameCount; }
     
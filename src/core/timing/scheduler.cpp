@@ -0,0 +1,357 @@
+#include "scheduler.h"
+#include "master_clock.h"
+#include "../state/save_state.h"
+#include <algorithm>
+
+// Master cycles per frame and per scanline (rounded down, see nextHorizon)
+static constexpr uint64_t MASTER_CYCLES_PER_FRAME = MasterClock::CYCLES_PER_FRAME_GRAPHICS;
+static constexpr uint64_t MASTER_CYCLES_PER_SCANLINE = MASTER_CYCLES_PER_FRAME / MasterClock::TOTAL_SCANLINES;
+// Threaded execution: waking the workers costs a few microseconds, keep them busy for longer
+static constexpr uint64_t DEFAULT_QUANTUM = MASTER_CYCLES_PER_SCANLINE * 16;
+// Adaptive quantum: events fire at the end of a slice, a long one delays the scanlines
+static constexpr uint64_t DEFAULT_MINIMUM_QUANTUM = MASTER_CYCLES_PER_SCANLINE;
+static constexpr uint64_t DEFAULT_MAXIMUM_QUANTUM = MASTER_CYCLES_PER_SCANLINE * 64;
+// Interactions in a slice that drop the quantum straight to the minimum
+static constexpr uint64_t INTERACTION_CLUSTER = 8;
+
+Scheduler::Scheduler()
+    : nextSequence(0)
+    , currentCycle(0)
+    , frameStartCycle(0)
+    , sliceEndCycle(0)
+    , syncGranularity(SyncGranularity::Scanline)
+    , threaded(false)
+    , quantum(DEFAULT_QUANTUM)
+    , adaptiveQuantum(true)
+    , minimumQuantum(DEFAULT_MINIMUM_QUANTUM)
+    , maximumQuantum(DEFAULT_MAXIMUM_QUANTUM)
+    , sliceQuantum(DEFAULT_QUANTUM)
+    , interactionsSeen(0)
+    , sliceCount(0)
+    , workGeneration(0)
+    , workersBusy(0)
+    , workersQuit(false)
+{
+}
+
+Scheduler::~Scheduler() {
+    stopWorkers();
+}
+
+void Scheduler::reset() {
+    std::lock_guard<std::mutex> lock(eventsLock);
+    events = decltype(events)();
+    nextSequence = 0;
+    currentCycle = 0;
+    frameStartCycle = 0;
+    sliceEndCycle = 0;
+    sliceCount = 0;
+    restartAdaptation();
+
+    for (Processor& processor : processors) {
+        processor.cycles = 0;
+    }
+}
+
+void Scheduler::saveState(StateWriter& writer) const {
+    writer.writeValue(currentCycle);
+    writer.writeValue(frameStartCycle);
+    writer.writeValue(static_cast<uint32_t>(processors.size()));
+    for (const Processor& processor : processors) {
+        writer.writeValue(processor.cycles);
+    }
+}
+
+bool Scheduler::loadState(StateReader& reader) {
+    uint32_t processorCount;
+    if (!reader.readValue(currentCycle) || !reader.readValue(frameStartCycle) ||
+        !reader.readValue(processorCount) || processorCount != processors.size()) {
+        return false;
+    }
+    for (Processor& processor : processors) {
+        if (!reader.readValue(processor.cycles)) {
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(eventsLock);
+    events = decltype(events)();
+    nextSequence = 0;
+    sliceEndCycle = currentCycle;
+    restartAdaptation();
+    return true;
+}
+
+//=============================================================================
+// Processors and Events
+//=============================================================================
+
+size_t Scheduler::addProcessor(uint32_t frequency, RunCallback run, bool concurrent) {
+    // Workers hold on to their processor, which may move
+    stopWorkers();
+
+    Processor processor{frequency, run, 0, concurrent, 0};
+    processor.cycles = processorCyclesAt(processor, currentCycle);
+    processors.push_back(processor);
+
+    if (threaded) {
+        startWorkers();
+    }
+    return processors.size() - 1;
+}
+
+void Scheduler::scheduleAt(uint64_t masterCycle, EventCallback callback) {
+    std::lock_guard<std::mutex> lock(eventsLock);
+    events.push(Event{masterCycle, nextSequence++, callback});
+}
+
+void Scheduler::scheduleAtNextSync(EventCallback callback) {
+    scheduleAt(sliceEndCycle > currentCycle ? sliceEndCycle : currentCycle, callback);
+}
+
+uint64_t Scheduler::processorCyclesAt(const Processor& processor, uint64_t masterCycle) {
+    // Split to avoid overflowing after a few hours of emulated time
+    const uint64_t master = MasterClock::GRAPHICS_CPU_FREQ;
+    return (masterCycle / master) * processor.frequency +
+           ((masterCycle % master) * processor.frequency) / master;
+}
+
+//=============================================================================
+// Frame Execution
+//=============================================================================
+
+void Scheduler::runFrame() {
+    const uint64_t frameEnd = frameStartCycle + MASTER_CYCLES_PER_FRAME;
+
+    while (currentCycle < frameEnd) {
+        fireDueEvents();
+        sliceEndCycle = nextHorizon(frameEnd);
+
+        if (syncGranularity == SyncGranularity::Instruction) {
+            runProcessorsInterleavedTo(sliceEndCycle);
+        } else {
+            runProcessorsTo(sliceEndCycle);
+        }
+
+        currentCycle = sliceEndCycle;
+        sliceCount++;
+        if (threaded && adaptiveQuantum && syncGranularity != SyncGranularity::Instruction) {
+            adaptQuantum();
+        }
+    }
+
+    frameStartCycle = frameEnd;
+}
+
+uint64_t Scheduler::nextHorizon(uint64_t frameEnd) const {
+    uint64_t horizon = frameEnd;
+
+    if (threaded && syncGranularity != SyncGranularity::Instruction) {
+        // Events due within the quantum fire at its end
+        uint64_t length = adaptiveQuantum ? sliceQuantum : quantum;
+        return currentCycle + length < horizon ? currentCycle + length : horizon;
+    }
+
+    if (syncGranularity == SyncGranularity::Frame) {
+        // Events fire at the start of the following frame
+        return horizon;
+    }
+
+    if (syncGranularity == SyncGranularity::Scanline && currentCycle + MASTER_CYCLES_PER_SCANLINE < horizon) {
+        horizon = currentCycle + MASTER_CYCLES_PER_SCANLINE;
+    }
+
+    if (!events.empty() && events.top().time < horizon) {
+        // Due events have just fired, but never stand still
+        horizon = events.top().time > currentCycle ? events.top().time : currentCycle + 1;
+    }
+
+    return horizon;
+}
+
+void Scheduler::runProcessorsTo(uint64_t horizon) {
+    if (!workers.empty()) {
+        runProcessorsInParallelTo(horizon);
+        return;
+    }
+
+    for (Processor& processor : processors) {
+        processor.target = processorCyclesAt(processor, horizon);
+        runToTarget(processor);
+    }
+}
+
+void Scheduler::runProcessorsInParallelTo(uint64_t horizon) {
+    for (Processor& processor : processors) {
+        processor.target = processorCyclesAt(processor, horizon);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(workLock);
+        workersBusy = workers.size();
+        workGeneration++;
+    }
+    workStart.notify_all();
+
+    // The other processors run on this thread meanwhile
+    for (Processor& processor : processors) {
+        if (!processor.concurrent) {
+            runToTarget(processor);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(workLock);
+    workDone.wait(lock, [this]() { return workersBusy == 0; });
+}
+
+void Scheduler::runToTarget(Processor& processor) {
+    if (processor.cycles < processor.target) {
+        processor.cycles += processor.run(processor.target - processor.cycles);
+    }
+}
+
+void Scheduler::runProcessorsInterleavedTo(uint64_t horizon) {
+    const uint64_t master = MasterClock::GRAPHICS_CPU_FREQ;
+
+    while (true) {
+        // Step the processor furthest behind, in master cycles
+        Processor* behind = nullptr;
+        uint64_t behindBy = 0;
+        for (Processor& processor : processors) {
+            uint64_t target = processorCyclesAt(processor, horizon);
+            if (processor.cycles >= target) {
+                continue;
+            }
+            uint64_t remaining = ((target - processor.cycles) * master) / processor.frequency;
+            if (behind == nullptr || remaining > behindBy) {
+                behind = &processor;
+                behindBy = remaining;
+            }
+        }
+
+        if (behind == nullptr) {
+            break;
+        }
+        // A budget of one cycle executes exactly one instruction
+        behind->cycles += behind->run(1);
+    }
+}
+
+void Scheduler::fireDueEvents() {
+    while (true) {
+        // Copy first, the callback may schedule more events
+        Event event;
+        {
+            std::lock_guard<std::mutex> lock(eventsLock);
+            if (events.empty() || events.top().time > currentCycle) {
+                break;
+            }
+            event = events.top();
+            events.pop();
+        }
+        if (event.callback) {
+            event.callback();
+        }
+    }
+}
+
+//=============================================================================
+// Threaded Execution
+//=============================================================================
+
+void Scheduler::setQuantum(uint64_t masterCycles) {
+    quantum = masterCycles > 0 ? masterCycles : 1;
+    restartAdaptation();
+}
+
+void Scheduler::setAdaptiveQuantum(bool enabled) {
+    adaptiveQuantum = enabled;
+    restartAdaptation();
+}
+
+void Scheduler::setQuantumRange(uint64_t minimum, uint64_t maximum) {
+    minimumQuantum = minimum > 0 ? minimum : 1;
+    maximumQuantum = maximum > minimumQuantum ? maximum : minimumQuantum;
+    restartAdaptation();
+}
+
+void Scheduler::restartAdaptation() {
+    sliceQuantum = std::clamp(quantum, minimumQuantum, maximumQuantum);
+    interactionsSeen = interactionSource ? interactionSource() : 0;
+}
+
+void Scheduler::adaptQuantum() {
+    // Seen after the fact: the slice that had them has run already, the
+    // ones after it are kept short while they go on
+    uint64_t interactions = interactionSource ? interactionSource() : 0;
+    uint64_t count = interactions - interactionsSeen;
+    interactionsSeen = interactions;
+
+    if (count >= INTERACTION_CLUSTER) {
+        sliceQuantum = minimumQuantum;
+    } else if (count > 0) {
+        sliceQuantum = std::max(sliceQuantum / 2, minimumQuantum);
+    } else {
+        sliceQuantum = std::min(sliceQuantum * 2, maximumQuantum);
+    }
+}
+
+void Scheduler::setThreaded(bool enabled) {
+    if (enabled == threaded) {
+        return;
+    }
+    threaded = enabled;
+    if (threaded) {
+        restartAdaptation();
+        startWorkers();
+    } else {
+        stopWorkers();
+    }
+}
+
+void Scheduler::startWorkers() {
+    workersQuit = false;
+    // Taken here: a worker that starts after the first slice was handed out
+    // would wait for the one after
+    uint64_t generation = workGeneration;
+    for (size_t i = 0; i < processors.size(); i++) {
+        if (processors[i].concurrent) {
+            workers.emplace_back(&Scheduler::workerLoop, this, i, generation);
+        }
+    }
+}
+
+void Scheduler::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(workLock);
+        workersQuit = true;
+    }
+    workStart.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void Scheduler::workerLoop(size_t index, uint64_t generation) {
+    if (workerStart) {
+        workerStart(index);
+    }
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(workLock);
+            workStart.wait(lock, [this, generation]() { return workersQuit || workGeneration != generation; });
+            if (workersQuit) {
+                return;
+            }
+            generation = workGeneration;
+        }
+
+        runToTarget(processors[index]);
+
+        std::lock_guard<std::mutex> lock(workLock);
+        if (--workersBusy == 0) {
+            workDone.notify_one();
+        }
+    }
+}
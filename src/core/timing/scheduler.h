@@ -0,0 +1,182 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class StateWriter;
+class StateReader;
+
+/**
+ * Scheduler
+ *
+ * Interleaves the three CPUs with the timed events of the system
+ * (scanline boundaries, audio FIFO drain, mailbox IRQ delivery...).
+ *
+ * Time is counted in master cycles (Graphics CPU clock, see MasterClock).
+ * Events sit in a min-heap; each CPU is run up to the next event horizon,
+ * the due events fire, and so on until the end of the frame.
+ *
+ * The sync granularity caps how far the CPUs may run between two sync
+ * points, trading accuracy for speed:
+ * - Frame:       one slice per frame, events fire in order afterwards
+ * - Scanline:    CPUs never get more than one scanline apart
+ * - Instruction: CPUs execute one instruction at a time, in time order
+ *
+ * With threaded execution the concurrent processors each run on a worker
+ * thread of their own, in parallel with the others, and all of them meet
+ * at sync points spaced by the quantum. Events due within a quantum fire
+ * at its end, while every processor is stopped. Instruction granularity
+ * always runs on the calling thread.
+ *
+ * The quantum adapts by default: it doubles, up to the maximum, after each
+ * slice in which the processors left each other alone, halves after a slice
+ * with an interaction and drops to the minimum when they cluster. What an
+ * interaction is, is up to the interaction source, e.g. the count of mailbox
+ * accesses and IRQs. With adaptation off the quantum stays as set, and the
+ * sync points at the same times from one run to the next.
+ */
+class Scheduler {
+public:
+    enum class SyncGranularity {
+        Frame,
+        Scanline,
+        Instruction
+    };
+
+    using EventCallback = std::function<void()>;
+    // Runs a processor for (at least) the given number of its own cycles
+    // and returns the cycles that elapsed for it
+    using RunCallback = std::function<uint64_t(uint64_t cycles)>;
+
+    Scheduler();
+    ~Scheduler();
+
+    // Processors run between events, at their own clock frequency.
+    // Concurrent processors may run on a worker thread, see setThreaded().
+    // Returns the index of the processor.
+    size_t addProcessor(uint32_t frequency, RunCallback run, bool concurrent = false);
+    // Called by each worker thread first thing, with the index of its processor
+    void setWorkerStart(std::function<void(size_t processor)> callback) { workerStart = std::move(callback); }
+    // Own cycles elapsed for the processor since reset
+    uint64_t getProcessorCycles(size_t processor) const { return processors[processor].cycles; }
+
+    // Events, these two can also be called by running processors from any thread
+    void scheduleAt(uint64_t masterCycle, EventCallback callback);
+    // Fires at the end of the slice being run, i.e. at the next sync point
+    void scheduleAtNextSync(EventCallback callback);
+
+    // Run one frame worth of master cycles
+    void runFrame();
+
+    // Configuration
+    void setSyncGranularity(SyncGranularity granularity) { syncGranularity = granularity; }
+    SyncGranularity getSyncGranularity() const { return syncGranularity; }
+    void setThreaded(bool threaded);
+    bool isThreaded() const { return threaded; }
+    // Master cycles between two sync points with threaded execution,
+    // without adaptation, and where adaptation starts from
+    void setQuantum(uint64_t masterCycles);
+    uint64_t getQuantum() const { return quantum; }
+    void setAdaptiveQuantum(bool enabled);
+    bool isAdaptiveQuantum() const { return adaptiveQuantum; }
+    void setQuantumRange(uint64_t minimum, uint64_t maximum);
+    uint64_t getMinimumQuantum() const { return minimumQuantum; }
+    uint64_t getMaximumQuantum() const { return maximumQuantum; }
+    // Interactions between the processors so far, any count that only goes
+    // up. Read at each sync point, while no processor runs
+    using InteractionSource = std::function<uint64_t()>;
+    void setInteractionSource(InteractionSource source) { interactionSource = std::move(source); }
+    // The quantum of the next slice, and the slices run since reset
+    uint64_t getSliceQuantum() const { return threaded && adaptiveQuantum ? sliceQuantum : quantum; }
+    uint64_t getSliceCount() const { return sliceCount; }
+
+    // Time
+    uint64_t getCurrentCycle() const { return currentCycle; }
+    uint64_t getFrameStartCycle() const { return frameStartCycle; }
+
+    // Drops every event and rewinds time, processors are kept
+    void reset();
+
+    // Save states, time and processor cycles. Events are callbacks and are
+    // not part of it: loading drops them all, like reset(), and leaves it
+    // to the owner to schedule the pending ones again.
+    void saveState(StateWriter& writer) const;
+    bool loadState(StateReader& reader);
+
+private:
+    struct Event {
+        uint64_t time;
+        uint64_t sequence;      // Keeps events at the same time in scheduling order
+        EventCallback callback;
+    };
+
+    struct EventLater {
+        bool operator()(const Event& a, const Event& b) const {
+            if (a.time != b.time) return a.time > b.time;
+            return a.sequence > b.sequence;
+        }
+    };
+
+    struct Processor {
+        uint32_t frequency;
+        RunCallback run;
+        uint64_t cycles;        // Own cycles elapsed since reset
+        bool concurrent;
+        uint64_t target;        // Own cycles to reach by the end of the slice
+    };
+
+    std::priority_queue<Event, std::vector<Event>, EventLater> events;
+    std::mutex eventsLock;
+    std::vector<Processor> processors;
+    uint64_t nextSequence;
+
+    uint64_t currentCycle;
+    uint64_t frameStartCycle;
+    uint64_t sliceEndCycle;
+
+    SyncGranularity syncGranularity;
+    bool threaded;
+    uint64_t quantum;
+    bool adaptiveQuantum;
+    uint64_t minimumQuantum;
+    uint64_t maximumQuantum;
+    uint64_t sliceQuantum;
+    InteractionSource interactionSource;
+    uint64_t interactionsSeen;
+    uint64_t sliceCount;
+
+    // Worker threads, one per concurrent processor. A slice starts when the
+    // generation changes and ends when no worker is busy anymore.
+    std::vector<std::thread> workers;
+    std::function<void(size_t)> workerStart;
+    std::mutex workLock;
+    std::condition_variable workStart;
+    std::condition_variable workDone;
+    uint64_t workGeneration;
+    size_t workersBusy;
+    bool workersQuit;
+
+    uint64_t nextHorizon(uint64_t frameEnd) const;
+    void runProcessorsTo(uint64_t horizon);
+    void runProcessorsInParallelTo(uint64_t horizon);
+    void runProcessorsInterleavedTo(uint64_t horizon);
+    void fireDueEvents();
+    void adaptQuantum();
+    void restartAdaptation();
+
+    void startWorkers();
+    void stopWorkers();
+    void workerLoop(size_t processor, uint64_t generation);
+    static void runToTarget(Processor& processor);
+
+    // Own cycles of the processor at the given master cycle
+    static uint64_t processorCyclesAt(const Processor& processor, uint64_t masterCycle);
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,285 @@
+#include "thread_placement.h"
+#include "../cpu/Log.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <mutex>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#define THREAD_PLACEMENT_PRIORITY
+#endif
+#if defined(__linux__)
+#define THREAD_PLACEMENT_AFFINITY
+#endif
+
+static constexpr int MAX_CORE = 1023;       // CPU_SETSIZE - 1
+static constexpr size_t MAX_NAME_LENGTH = 15;
+
+static const char* const ROLE_NAMES[ThreadPlacement::ROLE_COUNT] = {
+    "emulation", "graphics", "sound", "renderer", "audio"
+};
+
+namespace {
+    struct Placement {
+        std::mutex lock;
+        ThreadPlacement::Policy policies[ThreadPlacement::ROLE_COUNT];
+        bool configured[ThreadPlacement::ROLE_COUNT] = {};
+        std::vector<ThreadPlacement::ThreadStatus> threads;
+#if defined(THREAD_PLACEMENT_AFFINITY)
+        cpu_set_t processCores;     // Before any thread was pinned
+#endif
+
+        Placement() {
+            for (ThreadPlacement::Policy& policy : policies) {
+                policy.realTimePriority = ThreadPlacement::NORMAL_PRIORITY;
+            }
+            policies[ThreadPlacement::ROLE_AUDIO].realTimePriority = ThreadPlacement::DEFAULT_REALTIME_PRIORITY;
+#if defined(THREAD_PLACEMENT_AFFINITY)
+            if (sched_getaffinity(0, sizeof(processCores), &processCores) != 0) {
+                CPU_ZERO(&processCores);
+            }
+#endif
+        }
+    };
+
+    Placement& placement() {
+        static Placement instance;
+        return instance;
+    }
+}
+
+void ThreadPlacement::setPolicy(Role role, const Policy& policy) {
+    Placement& state = placement();
+    std::lock_guard<std::mutex> lock(state.lock);
+    state.policies[role] = policy;
+    state.configured[role] = true;
+}
+
+ThreadPlacement::Policy ThreadPlacement::getPolicy(Role role) {
+    Placement& state = placement();
+    std::lock_guard<std::mutex> lock(state.lock);
+    return state.policies[role];
+}
+
+// "2", "4-7", "1,3,8-9" or "any"
+static bool parseCores(const std::string& text, std::vector<int>& cores) {
+    cores.clear();
+    if (text.empty() || text == "any") {
+        return true;
+    }
+    std::istringstream list(text);
+    std::string range;
+    while (std::getline(list, range, ',')) {
+        char* end;
+        long first = std::strtol(range.c_str(), &end, 10);
+        long last = first;
+        if (*end == '-') {
+            last = std::strtol(end + 1, &end, 10);
+        }
+        if (end == range.c_str() || *end != '\0' || first < 0 || last < first || last > MAX_CORE) {
+            return false;
+        }
+        for (long core = first; core <= last; core++) {
+            cores.push_back(static_cast<int>(core));
+        }
+    }
+    std::sort(cores.begin(), cores.end());
+    cores.erase(std::unique(cores.begin(), cores.end()), cores.end());
+    return !cores.empty();
+}
+
+bool ThreadPlacement::configure(const std::string& settings, std::string& error) {
+    Policy parsed[ROLE_COUNT];
+    bool given[ROLE_COUNT] = {};
+    std::istringstream entries(settings);
+    std::string entry;
+    while (std::getline(entries, entry, ';')) {
+        entry.erase(std::remove_if(entry.begin(), entry.end(), ::isspace), entry.end());
+        if (entry.empty()) {
+            continue;
+        }
+        size_t equals = entry.find('=');
+        const char* const* found = std::find(ROLE_NAMES, ROLE_NAMES + ROLE_COUNT, entry.substr(0, equals));
+        if (equals == std::string::npos || found == ROLE_NAMES + ROLE_COUNT) {
+            error = "Unknown thread role in \"" + entry + "\"";
+            return false;
+        }
+        int role = static_cast<int>(found - ROLE_NAMES);
+
+        std::string value = entry.substr(equals + 1);
+        size_t colon = value.find(':');
+        Policy& policy = parsed[role];
+        policy.realTimePriority = NORMAL_PRIORITY;
+        if (colon != std::string::npos) {
+            std::string priority = value.substr(colon + 1);
+            value.erase(colon);
+            char* end = nullptr;
+            if (priority.compare(0, 2, "rt") != 0) {
+                end = &priority[0];
+            } else if (priority.size() == 2) {
+                policy.realTimePriority = DEFAULT_REALTIME_PRIORITY;
+                end = &priority[2];
+            } else {
+                policy.realTimePriority = static_cast<int>(std::strtol(priority.c_str() + 2, &end, 10));
+            }
+            if (*end != '\0' || policy.realTimePriority < 1 || policy.realTimePriority > 99) {
+                error = "Bad priority in \"" + entry + "\", rt or rt1 to rt99";
+                return false;
+            }
+        }
+        if (!parseCores(value, policy.cores)) {
+            error = "Bad cores in \"" + entry + "\"";
+            return false;
+        }
+        given[role] = true;
+    }
+
+    for (int role = 0; role < ROLE_COUNT; role++) {
+        if (given[role]) {
+            setPolicy(static_cast<Role>(role), parsed[role]);
+        }
+    }
+    return true;
+}
+
+void ThreadPlacement::applyToCurrentThread(Role role, const char* name) {
+    Placement& state = placement();
+    Policy policy;
+    bool configured;
+    {
+        std::lock_guard<std::mutex> lock(state.lock);
+        policy = state.policies[role];
+        configured = state.configured[role];
+    }
+
+    ThreadStatus status;
+    status.name = name ? name : "main";
+    status.role = role;
+    status.realTimePriority = NORMAL_PRIORITY;
+    status.affinityFailed = false;
+    status.priorityFailed = false;
+
+#if defined(THREAD_PLACEMENT_PRIORITY)
+    if (name) {
+        // Shown by top -H and the debuggers, cut to what Linux keeps
+        std::string shortName = status.name.substr(0, MAX_NAME_LENGTH);
+#if defined(__APPLE__)
+        pthread_setname_np(shortName.c_str());
+#else
+        pthread_setname_np(pthread_self(), shortName.c_str());
+#endif
+    }
+#endif
+
+    // A new thread inherits the cores and the scheduling of the one that
+    // started it, the headless runner's main thread is placed as emulation
+    if (policy.cores.empty()) {
+#if defined(THREAD_PLACEMENT_AFFINITY)
+        if (CPU_COUNT(&state.processCores) > 0) {
+            pthread_setaffinity_np(pthread_self(), sizeof(state.processCores), &state.processCores);
+        }
+#endif
+    } else {
+#if defined(THREAD_PLACEMENT_AFFINITY)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int core : policy.cores) {
+            CPU_SET(core, &set);
+        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+            status.cores = policy.cores;
+        } else {
+            status.affinityFailed = true;
+        }
+#else
+        status.affinityFailed = true;
+#endif
+    }
+
+    if (policy.realTimePriority == NORMAL_PRIORITY) {
+#if defined(THREAD_PLACEMENT_PRIORITY)
+        int current;
+        sched_param param = {};
+        if (pthread_getschedparam(pthread_self(), &current, &param) == 0 && current != SCHED_OTHER) {
+            param.sched_priority = 0;
+            pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+        }
+#endif
+    } else {
+#if defined(THREAD_PLACEMENT_PRIORITY)
+        sched_param param = {};
+        param.sched_priority = std::clamp(policy.realTimePriority, sched_get_priority_min(SCHED_FIFO),
+                                          sched_get_priority_max(SCHED_FIFO));
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0) {
+            status.realTimePriority = param.sched_priority;
+        } else {
+            status.priorityFailed = true;
+        }
+#else
+        status.priorityFailed = true;
+#endif
+    }
+
+    // The default audio priority is a wish, not a setting
+    if (configured && status.affinityFailed) {
+        Log::wrn("ThreadPlacement").str(status.name).str(": Cannot run on cores ").str(formatCores(policy.cores)).show();
+    }
+    if (configured && status.priorityFailed) {
+        Log::wrn("ThreadPlacement").str(status.name).str(": Real-time priority refused").show();
+    }
+
+    std::lock_guard<std::mutex> lock(state.lock);
+    for (ThreadStatus& thread : state.threads) {
+        if (thread.name == status.name) {
+            thread = status;
+            return;
+        }
+    }
+    state.threads.push_back(status);
+}
+
+std::vector<ThreadPlacement::ThreadStatus> ThreadPlacement::getThreads() {
+    Placement& state = placement();
+    std::lock_guard<std::mutex> lock(state.lock);
+    return state.threads;
+}
+
+void ThreadPlacement::writeReport(std::ostream& out) {
+    for (const ThreadStatus& thread : getThreads()) {
+        out << thread.name << " (" << getRoleName(thread.role) << "): cores " << formatCores(thread.cores)
+            << (thread.affinityFailed ? " (refused)" : "") << ", ";
+        if (thread.realTimePriority != NORMAL_PRIORITY) {
+            out << "real-time priority " << thread.realTimePriority;
+        } else {
+            out << "normal priority";
+        }
+        out << (thread.priorityFailed ? " (real-time refused)" : "") << "\n";
+    }
+}
+
+const char* ThreadPlacement::getRoleName(Role role) {
+    return role >= 0 && role < ROLE_COUNT ? ROLE_NAMES[role] : "unknown";
+}
+
+std::string ThreadPlacement::formatCores(const std::vector<int>& cores) {
+    if (cores.empty()) {
+        return "any";
+    }
+    std::ostringstream text;
+    for (size_t i = 0; i < cores.size(); i++) {
+        // Runs of consecutive cores as ranges
+        size_t last = i;
+        while (last + 1 < cores.size() && cores[last + 1] == cores[last] + 1) {
+            last++;
+        }
+        text << (i > 0 ? "," : "") << cores[i];
+        if (last > i) {
+            text << "-" << cores[last];
+        }
+        i = last;
+    }
+    return text.str();
+}
@@ -0,0 +1,81 @@
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Thread Placement
+ *
+ * Which cores each of the emulator's threads may run on, and whether it
+ * asks for real-time (SCHED_FIFO) scheduling, so that background services
+ * on a shared core cannot preempt the emulation or starve the audio device.
+ *
+ * A policy per role, process wide. Each thread applies the policy of its
+ * role to itself as it starts, see applyToCurrentThread(), so a change only
+ * affects the threads started after it. What every thread got is kept for
+ * diagnostics: a core or a priority the system refuses is reported, and
+ * logged when it was configured, the thread then runs as it would have.
+ *
+ * Settings, e.g. SANO_THREADS or sano_headless --threads:
+ *
+ *   emulation=2:rt50;graphics=3;sound=3;renderer=4-7;audio=1:rt70
+ *
+ * role=CORES[:rt[PRIORITY]], roles separated by ';'. CORES is "any" or a
+ * list of cores and ranges ("4-7", "1,3"), rt alone asks for
+ * DEFAULT_REALTIME_PRIORITY. Render workers share the cores of their role.
+ *
+ * Affinity needs Linux, real-time priority a POSIX system and the right to
+ * use it (CAP_SYS_NICE, or an rtprio limit). The QAudioSink backend plays
+ * from a Qt thread and is not placed, the ALSA one is.
+ */
+class ThreadPlacement {
+public:
+    enum Role {
+        ROLE_EMULATION,     // Emulator::runFrame(), Main CPU included
+        ROLE_GRAPHICS_CPU,  // Scheduler workers, with threaded execution
+        ROLE_SOUND_CPU,
+        ROLE_RENDERER,      // VideoRenderer workers
+        ROLE_AUDIO,         // AlsaAudioBackend
+        ROLE_COUNT
+    };
+
+    static constexpr int NORMAL_PRIORITY = 0;
+    static constexpr int DEFAULT_REALTIME_PRIORITY = 11;
+
+    struct Policy {
+        std::vector<int> cores;     // Empty for any
+        int realTimePriority;       // SCHED_FIFO priority, NORMAL_PRIORITY for none
+    };
+
+    struct ThreadStatus {
+        std::string name;
+        Role role;
+        std::vector<int> cores;     // Pinned to, empty for any
+        int realTimePriority;       // Granted
+        bool affinityFailed;
+        bool priorityFailed;
+    };
+
+    // Audio asks for DEFAULT_REALTIME_PRIORITY unless set, the others for nothing
+    static void setPolicy(Role role, const Policy& policy);
+    static Policy getPolicy(Role role);
+    // Sets the roles listed in the settings above, none of them on an error
+    static bool configure(const std::string& settings, std::string& error);
+
+    // Names the calling thread (unless name is nullptr, e.g. for a main
+    // thread) and applies the policy of the role to it
+    static void applyToCurrentThread(Role role, const char* name);
+
+    // Latest of each thread name, in the order they were first seen
+    static std::vector<ThreadStatus> getThreads();
+    // One line per thread
+    static void writeReport(std::ostream& out);
+
+    static const char* getRoleName(Role role);
+    // "4-7,9", "any" when empty
+    static std::string formatCores(const std::vector<int>& cores);
+};
+
+#endif // THREAD_PLACEMENT_H
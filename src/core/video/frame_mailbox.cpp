@@ -0,0 +1,48 @@
+#include "frame_mailbox.h"
+
+FrameMailbox::FrameMailbox()
+    : latest(1)
+    , droppedFrames(0)
+    , writeIndex(0)
+    , readIndex(2)
+    , published(false)
+{
+    for (Frame& frame : frames) {
+        frame.pixels.fill(0xFF000000);  // Black
+        frame.indices.fill(0);
+        frame.palette.fill(0xFF000000);
+        frame.indexed = false;
+        frame.number = 0;
+        frame.height = HEIGHT;
+        frame.field = 0;
+        frame.sequence = 0;
+        frame.lineSequences.fill(0);
+    }
+}
+
+//=============================================================================
+// Producer
+//=============================================================================
+
+void FrameMailbox::publish() {
+    // Release the frame written, take the older one back
+    uint8_t previous = latest.exchange(static_cast<uint8_t>(writeIndex) | FRESH, std::memory_order_acq_rel);
+    writeIndex = previous & INDEX_MASK;
+    if (previous & FRESH) {
+        droppedFrames.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+//=============================================================================
+// Consumer
+//=============================================================================
+
+const FrameMailbox::Frame* FrameMailbox::acquire() {
+    if (latest.load(std::memory_order_relaxed) & FRESH) {
+        // Hand the frame shown back, take the latest one
+        uint8_t previous = latest.exchange(static_cast<uint8_t>(readIndex), std::memory_order_acq_rel);
+        readIndex = previous & INDEX_MASK;
+        published = true;
+    }
+    return published ? &frames[readIndex] : nullptr;
+}
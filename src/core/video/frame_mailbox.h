@@ -0,0 +1,78 @@
+#ifndef FRAME_MAILBOX_H
+#define FRAME_MAILBOX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <atomic>
+
+/**
+ * Frame Mailbox
+ * 
+ * Lock-free triple buffer handing the completed frames of the emulation
+ * thread over to the display. The producer always has a frame of its own
+ * to fill, the consumer always has one to show, and the third one holds
+ * the latest completed frame. Neither side ever waits for the other; frames
+ * the display did not get to are dropped.
+ * 
+ * One producer and one consumer thread only.
+ */
+class FrameMailbox {
+public:
+    static constexpr int WIDTH = 320;
+    static constexpr int HEIGHT = 240;
+    static constexpr int INTERLACED_HEIGHT = 480;  // Both fields of 480i
+    
+    struct Frame {
+        // RGBA8888 pixels, or palette indices and palette with indexed output. height
+        // lines of them
+        std::array<uint32_t, WIDTH * INTERLACED_HEIGHT> pixels;
+        std::array<uint8_t, WIDTH * INTERLACED_HEIGHT> indices;
+        std::array<uint32_t, 256> palette;
+        bool indexed;
+        uint64_t number;  // Frame count when completed
+        
+        // 480i frames hold both fields, the one just rendered on the odd lines when
+        // field is 1
+        int height;
+        uint8_t field;
+        bool isInterlaced() const { return height == INTERLACED_HEIGHT; }
+        // Where line of the field just rendered starts, every line in 240p
+        size_t fieldLineOffset(int line) const {
+            return static_cast<size_t>(isInterlaced() ? line * 2 + field : line) * WIDTH;
+        }
+        
+        // Frames are numbered 1, 2, ... as published. A line whose number is not after
+        // the one of an earlier frame has not changed since that frame
+        uint64_t sequence;
+        std::array<uint64_t, INTERLACED_HEIGHT> lineSequences;
+    };
+    
+    FrameMailbox();
+    
+    // Producer: fill the frame, then publish it as the latest one
+    Frame& getWriteFrame() { return frames[writeIndex]; }
+    void publish();
+    
+    // Consumer: the latest frame published, or nullptr until the first one is.
+    // Stays valid until the next call.
+    const Frame* acquire();
+    bool hasNewFrame() const { return latest.load(std::memory_order_relaxed) & FRESH; }
+    
+    // Frames published over one the consumer never took, any thread
+    uint64_t getDroppedFrameCount() const { return droppedFrames.load(std::memory_order_relaxed); }
+    
+private:
+    // Index of the latest frame, and whether the consumer has seen it yet
+    static constexpr uint8_t INDEX_MASK = 0x03;
+    static constexpr uint8_t FRESH = 0x04;
+    
+    std::array<Frame, 3> frames;
+    std::atomic<uint8_t> latest;
+    std::atomic<uint64_t> droppedFrames;
+    int writeIndex;
+    int readIndex;
+    bool published;
+};
+
+#endif // FRAME_MAILBOX_H
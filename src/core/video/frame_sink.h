@@ -0,0 +1,27 @@
+#ifndef FRAME_SINK_H
+#define FRAME_SINK_H
+
+#include <cstddef>
+#include <cstdint>
+#include "frame_mailbox.h"
+
+/**
+ * Frame Sink
+ *
+ * Receives the output of the emulator besides the display: every frame
+ * published, then the audio mixed since the frame before, both on the
+ * emulation thread (see Emulator::addFrameSink). A sink must not hold the
+ * thread up, whatever takes longer than copying belongs on a thread of its
+ * own.
+ */
+class FrameSink {
+public:
+    virtual ~FrameSink() = default;
+
+    // Valid for the call only
+    virtual void writeFrame(const FrameMailbox::Frame& frame) = 0;
+    // Interleaved left/right 16-bit samples at AudioMixer::SAMPLE_RATE
+    virtual void writeAudio(const int16_t* samples, size_t frames) = 0;
+};
+
+#endif // FRAME_SINK_H
@@ -0,0 +1,163 @@
+#include "shared_memory_sink.h"
+#include "../audio/audio_mixer.h"
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define SHARED_MEMORY_SINK
+#endif
+
+static constexpr size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+SharedMemorySink::SharedMemorySink()
+    : memory(nullptr)
+    , size(0)
+    , header(nullptr)
+    , sequence(0)
+{
+}
+
+SharedMemorySink::~SharedMemorySink() {
+    close();
+}
+
+bool SharedMemorySink::open(const std::string& objectName, int slotCount) {
+    close();
+#if defined(SHARED_MEMORY_SINK)
+    if (slotCount < 2) {
+        slotCount = 2;
+    }
+    name = objectName.empty() || objectName[0] != '/' ? "/" + objectName : objectName;
+
+    const size_t pixelBytes = (size_t)FrameMailbox::WIDTH * FrameMailbox::HEIGHT * sizeof(uint32_t);
+    const size_t slotSize = alignUp(sizeof(SlotHeader) + pixelBytes, 64);
+    const size_t audioOffset = alignUp(sizeof(Header), 64) + slotSize * slotCount;
+    const size_t totalSize = audioOffset + (size_t)AUDIO_CAPACITY * 2 * sizeof(int16_t);
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        std::cerr << "SharedMemorySink: Failed to create " << name << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, (off_t)totalSize) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        std::cerr << "SharedMemorySink: Failed to size " << name << std::endl;
+        return false;
+    }
+    void* mapping = mmap(nullptr, totalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // The mapping keeps the object referenced
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        std::cerr << "SharedMemorySink: Failed to map " << name << std::endl;
+        return false;
+    }
+
+    memory = static_cast<uint8_t*>(mapping);
+    size = totalSize;
+    std::memset(memory, 0, size);
+
+    // Readers may already be polling: the magic goes in last
+    header = new (memory) Header;
+    header->version = VERSION;
+    header->width = FrameMailbox::WIDTH;
+    header->height = FrameMailbox::HEIGHT;
+    header->slotCount = (uint32_t)slotCount;
+    header->slotSize = (uint32_t)slotSize;
+    header->audioOffset = (uint32_t)audioOffset;
+    header->audioCapacity = AUDIO_CAPACITY;
+    header->sampleRate = AudioMixer::SAMPLE_RATE;
+    header->frameSequence.store(0, std::memory_order_relaxed);
+    header->audioWritten.store(0, std::memory_order_relaxed);
+    for (int slot = 0; slot < slotCount; slot++) {
+        new (getSlot(slot)) SlotHeader();
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = MAGIC;
+    sequence = 0;
+    return true;
+#else
+    (void)objectName;
+    (void)slotCount;
+    std::cerr << "SharedMemorySink: Not supported on this platform" << std::endl;
+    return false;
+#endif
+}
+
+void SharedMemorySink::close() {
+#if defined(SHARED_MEMORY_SINK)
+    if (memory) {
+        munmap(memory, size);
+        shm_unlink(name.c_str());
+    }
+#endif
+    memory = nullptr;
+    size = 0;
+    header = nullptr;
+}
+
+SharedMemorySink::SlotHeader* SharedMemorySink::getSlot(uint64_t index) const {
+    size_t offset = alignUp(sizeof(Header), 64) + (size_t)(index % header->slotCount) * header->slotSize;
+    return reinterpret_cast<SlotHeader*>(memory + offset);
+}
+
+void SharedMemorySink::writeFrame(const FrameMailbox::Frame& frame) {
+    if (!header) {
+        return;
+    }
+
+    // Frame n goes into slot n - 1, marked odd while it is written
+    uint64_t next = sequence + 1;
+    SlotHeader* slot = getSlot(sequence);
+    slot->sequence.store(2 * next - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // 480i frames as the field just rendered
+    uint32_t* pixels = reinterpret_cast<uint32_t*>(slot + 1);
+    const int width = FrameMailbox::WIDTH;
+    for (int line = 0; line < FrameMailbox::HEIGHT; line++) {
+        uint32_t* out = pixels + line * width;
+        size_t offset = frame.fieldLineOffset(line);
+        if (frame.indexed) {
+            for (int x = 0; x < width; x++) {
+                out[x] = frame.palette[frame.indices[offset + x]];
+            }
+        } else {
+            std::memcpy(out, frame.pixels.data() + offset, width * sizeof(uint32_t));
+        }
+    }
+    slot->frameNumber = frame.number;
+    slot->audioPosition = header->audioWritten.load(std::memory_order_relaxed);
+
+    slot->sequence.store(2 * next, std::memory_order_release);
+    header->frameSequence.store(next, std::memory_order_release);
+    sequence = next;
+}
+
+void SharedMemorySink::writeAudio(const int16_t* samples, size_t frames) {
+    if (!header || frames == 0) {
+        return;
+    }
+
+    int16_t* ring = reinterpret_cast<int16_t*>(memory + header->audioOffset);
+    uint64_t written = header->audioWritten.load(std::memory_order_relaxed);
+    // More than the ring holds: only the newest frames can still be read
+    if (frames > AUDIO_CAPACITY) {
+        samples += (frames - AUDIO_CAPACITY) * 2;
+        written += frames - AUDIO_CAPACITY;
+        frames = AUDIO_CAPACITY;
+    }
+    for (size_t i = 0; i < frames; i++) {
+        size_t index = (size_t)((written + i) & (AUDIO_CAPACITY - 1)) * 2;
+        ring[index] = samples[2 * i];
+        ring[index + 1] = samples[2 * i + 1];
+    }
+    header->audioWritten.store(written + frames, std::memory_order_release);
+}
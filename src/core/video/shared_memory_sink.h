@@ -0,0 +1,84 @@
+#ifndef SHARED_MEMORY_SINK_H
+#define SHARED_MEMORY_SINK_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "frame_sink.h"
+
+/**
+ * Shared Memory Sink
+ *
+ * Publishes frames and audio into a POSIX shared memory object, for an
+ * encoder or compositor in another process to read in place:
+ *
+ * - Header (below), at offset 0
+ * - slotCount frame slots of slotSize bytes: a SlotHeader, then the frame as
+ *   width * height 0xAARRGGBB pixels (indexed frames are converted, 480i
+ *   ones are the field just rendered)
+ * - The audio ring, audioCapacity interleaved stereo 16-bit frames
+ *
+ * Frame n (counted from 1) goes into slot (n - 1) % slotCount, whose sequence
+ * is odd while it is written and 2 * n once it is complete; frameSequence is
+ * the latest complete n. A reader checks the sequence before and after
+ * reading a slot, which is written again slotCount - 1 frames later.
+ * Audio is written ahead of audioWritten, the total of frames written so
+ * far; a reader that falls more than audioCapacity behind lost some.
+ *
+ * Single writer. The object is removed when the sink is closed.
+ */
+class SharedMemorySink : public FrameSink {
+public:
+    static constexpr uint32_t MAGIC = 0x4246534E;   // "SNFB"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr int DEFAULT_SLOTS = 4;
+    static constexpr uint32_t AUDIO_CAPACITY = 32768;  // Power of two, ~1 s
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t slotCount;
+        uint32_t slotSize;          // Bytes, header included
+        uint32_t audioOffset;       // Bytes from the start of the object
+        uint32_t audioCapacity;     // Stereo frames
+        uint32_t sampleRate;
+        uint32_t reserved;
+        std::atomic<uint64_t> frameSequence;
+        std::atomic<uint64_t> audioWritten;
+    };
+
+    struct SlotHeader {
+        std::atomic<uint64_t> sequence;
+        uint64_t frameNumber;       // Emulated frame count
+        uint64_t audioPosition;     // audioWritten when the frame was published
+        uint64_t reserved;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "Counters are shared with other processes");
+
+    SharedMemorySink();
+    ~SharedMemorySink() override;
+
+    // Creates (or takes over) the object, "/name" as for shm_open()
+    bool open(const std::string& name, int slotCount = DEFAULT_SLOTS);
+    void close();
+    bool isOpen() const { return header != nullptr; }
+
+    // FrameSink
+    void writeFrame(const FrameMailbox::Frame& frame) override;
+    void writeAudio(const int16_t* samples, size_t frames) override;
+
+private:
+    std::string name;
+    uint8_t* memory;
+    size_t size;
+    Header* header;
+    uint64_t sequence;
+
+    SlotHeader* getSlot(uint64_t index) const;
+};
+
+#endif // SHARED_MEMORY_SINK_H
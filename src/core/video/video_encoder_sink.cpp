@@ -0,0 +1,513 @@
+#include "video_encoder_sink.h"
+#include "../audio/audio_mixer.h"
+#include "../timing/master_clock.h"
+#include <algorithm>
+#include <iostream>
+
+#if defined(VIDEO_ENCODER_FFMPEG)
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/hwcontext.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+static constexpr int WIDTH = FrameMailbox::WIDTH;
+static constexpr int HEIGHT = FrameMailbox::HEIGHT;
+
+// Audio of dropped frames kept for the next one, at most a second of it
+static constexpr size_t MAX_CARRY_SAMPLES = AudioMixer::SAMPLE_RATE * 2;
+
+//=============================================================================
+// FFmpeg
+//=============================================================================
+
+#if defined(VIDEO_ENCODER_FFMPEG)
+
+struct VideoEncoderSink::Encoder {
+    AVFormatContext* format = nullptr;
+    AVCodecContext* video = nullptr;
+    AVCodecContext* audio = nullptr;
+    AVStream* videoStream = nullptr;
+    AVStream* audioStream = nullptr;
+    AVBufferRef* hwDevice = nullptr;
+    SwsContext* scaler = nullptr;
+    AVFrame* videoFrame = nullptr;      // Software frame, converted from RGB
+    AVFrame* hwFrame = nullptr;         // Uploaded from it for VAAPI
+    AVFrame* audioFrame = nullptr;
+    AVPacket* packet = nullptr;
+
+    std::vector<int16_t> audioPending;  // Less than an audio frame
+    int64_t audioPts = 0;
+    int64_t videoPts = -1;
+    uint64_t lastFrameNumber = 0;
+
+    ~Encoder();
+    bool open(const Settings& settings, Backend& opened);
+    bool openVideo(Backend backend, const Settings& settings);
+    bool openAudio();
+    void encodeVideo(const Item& item);
+    void encodeAudio(const int16_t* samples, size_t frames);
+    bool finish();
+
+private:
+    bool send(AVCodecContext* context, AVStream* stream, AVFrame* frame);
+    void closeVideo();
+};
+
+VideoEncoderSink::Encoder::~Encoder() {
+    closeVideo();
+    avcodec_free_context(&audio);
+    av_frame_free(&audioFrame);
+    av_packet_free(&packet);
+    if (format) {
+        if (format->pb && !(format->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&format->pb);
+        }
+        avformat_free_context(format);
+    }
+}
+
+void VideoEncoderSink::Encoder::closeVideo() {
+    avcodec_free_context(&video);
+    av_buffer_unref(&hwDevice);
+    sws_freeContext(scaler);
+    scaler = nullptr;
+    av_frame_free(&videoFrame);
+    av_frame_free(&hwFrame);
+}
+
+bool VideoEncoderSink::Encoder::open(const Settings& settings, Backend& opened) {
+    if (avformat_alloc_output_context2(&format, nullptr, nullptr, settings.path.c_str()) < 0 || !format) {
+        std::cerr << "VideoEncoderSink: No container for " << settings.path << std::endl;
+        return false;
+    }
+
+    // The first backend that opens, in the order asked for
+    static const Backend AUTO_ORDER[] = { BACKEND_NVENC, BACKEND_VAAPI, BACKEND_SOFTWARE };
+    bool videoOpen = false;
+    if (settings.backend == BACKEND_AUTO) {
+        for (Backend candidate : AUTO_ORDER) {
+            if (openVideo(candidate, settings)) {
+                opened = candidate;
+                videoOpen = true;
+                break;
+            }
+            closeVideo();
+        }
+    } else if (openVideo(settings.backend, settings)) {
+        opened = settings.backend;
+        videoOpen = true;
+    }
+    if (!videoOpen) {
+        std::cerr << "VideoEncoderSink: No H.264 encoder available" << std::endl;
+        return false;
+    }
+    if (!openAudio()) {
+        std::cerr << "VideoEncoderSink: No AAC encoder available" << std::endl;
+        return false;
+    }
+
+    videoStream = avformat_new_stream(format, nullptr);
+    audioStream = avformat_new_stream(format, nullptr);
+    if (!videoStream || !audioStream ||
+        avcodec_parameters_from_context(videoStream->codecpar, video) < 0 ||
+        avcodec_parameters_from_context(audioStream->codecpar, audio) < 0) {
+        return false;
+    }
+    videoStream->time_base = video->time_base;
+    audioStream->time_base = audio->time_base;
+
+    if (!(format->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&format->pb, settings.path.c_str(), AVIO_FLAG_WRITE) < 0) {
+        std::cerr << "VideoEncoderSink: Failed to create " << settings.path << std::endl;
+        return false;
+    }
+    if (avformat_write_header(format, nullptr) < 0) {
+        std::cerr << "VideoEncoderSink: Failed to write header: " << settings.path << std::endl;
+        return false;
+    }
+
+    packet = av_packet_alloc();
+    return packet != nullptr;
+}
+
+bool VideoEncoderSink::Encoder::openVideo(Backend backend, const Settings& settings) {
+    const AVCodec* codec = nullptr;
+    AVPixelFormat softwareFormat = AV_PIX_FMT_NV12;
+    AVDictionary* options = nullptr;
+    switch (backend) {
+        case BACKEND_VAAPI:
+            codec = avcodec_find_encoder_by_name("h264_vaapi");
+            break;
+        case BACKEND_NVENC:
+            codec = avcodec_find_encoder_by_name("h264_nvenc");
+            av_dict_set(&options, "preset", "p2", 0);
+            av_dict_set(&options, "tune", "ll", 0);
+            break;
+        default:
+            codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+            softwareFormat = AV_PIX_FMT_YUV420P;
+            av_dict_set(&options, "preset", "veryfast", 0);
+            av_dict_set(&options, "tune", "zerolatency", 0);
+            break;
+    }
+    if (!codec || !(video = avcodec_alloc_context3(codec))) {
+        av_dict_free(&options);
+        return false;
+    }
+
+    video->width = WIDTH;
+    video->height = HEIGHT;
+    video->time_base = AVRational{ 1, MasterClock::FRAME_RATE };
+    video->framerate = AVRational{ MasterClock::FRAME_RATE, 1 };
+    video->bit_rate = settings.bitrate;
+    video->gop_size = MasterClock::FRAME_RATE;
+    video->max_b_frames = 0;
+    video->pix_fmt = softwareFormat;
+    if (format->oformat->flags & AVFMT_GLOBALHEADER) {
+        video->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    // VAAPI encodes surfaces on the device, uploaded from NV12 frames
+    if (backend == BACKEND_VAAPI) {
+        if (av_hwdevice_ctx_create(&hwDevice, AV_HWDEVICE_TYPE_VAAPI, settings.device.c_str(), nullptr, 0) < 0) {
+            av_dict_free(&options);
+            return false;
+        }
+        AVBufferRef* frames = av_hwframe_ctx_alloc(hwDevice);
+        if (!frames) {
+            av_dict_free(&options);
+            return false;
+        }
+        AVHWFramesContext* framesContext = reinterpret_cast<AVHWFramesContext*>(frames->data);
+        framesContext->format = AV_PIX_FMT_VAAPI;
+        framesContext->sw_format = softwareFormat;
+        framesContext->width = WIDTH;
+        framesContext->height = HEIGHT;
+        framesContext->initial_pool_size = 4;
+        if (av_hwframe_ctx_init(frames) < 0) {
+            av_buffer_unref(&frames);
+            av_dict_free(&options);
+            return false;
+        }
+        video->hw_frames_ctx = av_buffer_ref(frames);
+        av_buffer_unref(&frames);
+        video->pix_fmt = AV_PIX_FMT_VAAPI;
+        hwFrame = av_frame_alloc();
+    }
+
+    int result = avcodec_open2(video, codec, &options);
+    av_dict_free(&options);
+    if (result < 0) {
+        return false;
+    }
+
+    videoFrame = av_frame_alloc();
+    if (!videoFrame) {
+        return false;
+    }
+    videoFrame->format = softwareFormat;
+    videoFrame->width = WIDTH;
+    videoFrame->height = HEIGHT;
+    if (av_frame_get_buffer(videoFrame, 0) < 0) {
+        return false;
+    }
+    // 0xAARRGGBB words, whatever the byte order
+    scaler = sws_getContext(WIDTH, HEIGHT, AV_PIX_FMT_RGB32, WIDTH, HEIGHT, softwareFormat,
+                            SWS_BILINEAR, nullptr, nullptr, nullptr);
+    return scaler != nullptr;
+}
+
+bool VideoEncoderSink::Encoder::openAudio() {
+    const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+    if (!codec || !(audio = avcodec_alloc_context3(codec))) {
+        return false;
+    }
+    audio->sample_fmt = AV_SAMPLE_FMT_FLTP;
+    audio->sample_rate = AudioMixer::SAMPLE_RATE;
+    audio->time_base = AVRational{ 1, AudioMixer::SAMPLE_RATE };
+    audio->bit_rate = 128000;
+    av_channel_layout_default(&audio->ch_layout, 2);
+    if (format->oformat->flags & AVFMT_GLOBALHEADER) {
+        audio->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    if (avcodec_open2(audio, codec, nullptr) < 0) {
+        return false;
+    }
+
+    audioFrame = av_frame_alloc();
+    if (!audioFrame) {
+        return false;
+    }
+    audioFrame->format = audio->sample_fmt;
+    audioFrame->sample_rate = audio->sample_rate;
+    audioFrame->nb_samples = audio->frame_size > 0 ? audio->frame_size : 1024;
+    av_channel_layout_copy(&audioFrame->ch_layout, &audio->ch_layout);
+    return av_frame_get_buffer(audioFrame, 0) >= 0;
+}
+
+bool VideoEncoderSink::Encoder::send(AVCodecContext* context, AVStream* stream, AVFrame* frame) {
+    if (avcodec_send_frame(context, frame) < 0) {
+        return false;
+    }
+    int result;
+    while ((result = avcodec_receive_packet(context, packet)) >= 0) {
+        av_packet_rescale_ts(packet, context->time_base, stream->time_base);
+        packet->stream_index = stream->index;
+        // Takes the packet's data
+        av_interleaved_write_frame(format, packet);
+    }
+    return result == AVERROR(EAGAIN) || result == AVERROR_EOF;
+}
+
+void VideoEncoderSink::Encoder::encodeVideo(const Item& item) {
+    // Frames dropped leave their time out, frames gone back over (rewind,
+    // loaded states) follow on
+    uint64_t step = item.frameNumber - lastFrameNumber;
+    if (videoPts < 0 || item.frameNumber <= lastFrameNumber || step > (uint64_t)MasterClock::FRAME_RATE) {
+        step = 1;
+    }
+    videoPts += (int64_t)step;
+    lastFrameNumber = item.frameNumber;
+
+    if (av_frame_make_writable(videoFrame) < 0) {
+        return;
+    }
+    const uint8_t* source[1] = { reinterpret_cast<const uint8_t*>(item.pixels.data()) };
+    const int sourceStride[1] = { WIDTH * (int)sizeof(uint32_t) };
+    sws_scale(scaler, source, sourceStride, 0, HEIGHT, videoFrame->data, videoFrame->linesize);
+    videoFrame->pts = videoPts;
+
+    if (hwFrame) {
+        av_frame_unref(hwFrame);
+        if (av_hwframe_get_buffer(video->hw_frames_ctx, hwFrame, 0) < 0 ||
+            av_hwframe_transfer_data(hwFrame, videoFrame, 0) < 0) {
+            return;
+        }
+        hwFrame->pts = videoPts;
+        send(video, videoStream, hwFrame);
+    } else {
+        send(video, videoStream, videoFrame);
+    }
+}
+
+void VideoEncoderSink::Encoder::encodeAudio(const int16_t* samples, size_t frames) {
+    audioPending.insert(audioPending.end(), samples, samples + frames * 2);
+
+    // Whole encoder frames, planar float
+    const size_t frameSize = (size_t)audioFrame->nb_samples;
+    size_t offset = 0;
+    while (audioPending.size() - offset >= frameSize * 2) {
+        if (av_frame_make_writable(audioFrame) < 0) {
+            break;
+        }
+        float* left = reinterpret_cast<float*>(audioFrame->data[0]);
+        float* right = reinterpret_cast<float*>(audioFrame->data[1]);
+        const int16_t* source = audioPending.data() + offset;
+        for (size_t i = 0; i < frameSize; i++) {
+            left[i] = source[2 * i] * (1.0f / 32768.0f);
+            right[i] = source[2 * i + 1] * (1.0f / 32768.0f);
+        }
+        audioFrame->pts = audioPts;
+        audioPts += (int64_t)frameSize;
+        send(audio, audioStream, audioFrame);
+        offset += frameSize * 2;
+    }
+    audioPending.erase(audioPending.begin(), audioPending.begin() + offset);
+}
+
+bool VideoEncoderSink::Encoder::finish() {
+    // The last audio padded out to a whole frame
+    if (!audioPending.empty()) {
+        std::vector<int16_t> silence((size_t)audioFrame->nb_samples * 2 - audioPending.size(), 0);
+        encodeAudio(silence.data(), silence.size() / 2);
+    }
+    send(video, videoStream, nullptr);
+    send(audio, audioStream, nullptr);
+    return av_write_trailer(format) >= 0;
+}
+
+#else
+
+struct VideoEncoderSink::Encoder {
+};
+
+#endif
+
+//=============================================================================
+// Video Encoder Sink
+//=============================================================================
+
+VideoEncoderSink::VideoEncoderSink()
+    : backend(BACKEND_AUTO)
+    , stopping(false)
+    , encodedFrames(0)
+    , droppedFrames(0)
+{
+}
+
+VideoEncoderSink::~VideoEncoderSink() {
+    close();
+}
+
+const char* VideoEncoderSink::getBackendName(Backend backend) {
+    switch (backend) {
+        case BACKEND_VAAPI: return "VAAPI";
+        case BACKEND_NVENC: return "NVENC";
+        case BACKEND_SOFTWARE: return "software";
+        default: return "auto";
+    }
+}
+
+bool VideoEncoderSink::open(const Settings& settings) {
+    close();
+#if defined(VIDEO_ENCODER_FFMPEG)
+    std::unique_ptr<Encoder> opened = std::make_unique<Encoder>();
+    Backend openedBackend = BACKEND_AUTO;
+    if (!opened->open(settings, openedBackend)) {
+        return false;
+    }
+
+    // Every buffer allocated up front, none while recording
+    int count = std::max(settings.queueFrames, 1) + 1;
+    for (int i = 0; i < count; i++) {
+        std::unique_ptr<Item> item = std::make_unique<Item>();
+        item->pixels.resize((size_t)WIDTH * HEIGHT);
+        item->hasVideo = false;
+        item->frameNumber = 0;
+        item->audio.reserve(AudioMixer::SAMPLE_RATE / 10);
+        freeItems.push_back(std::move(item));
+    }
+    carryAudio.reserve(MAX_CARRY_SAMPLES);
+
+    encoder = std::move(opened);
+    backend = openedBackend;
+    encodedFrames.store(0, std::memory_order_relaxed);
+    droppedFrames.store(0, std::memory_order_relaxed);
+    stopping = false;
+    thread = std::thread(&VideoEncoderSink::encoderLoop, this);
+    std::cout << "VideoEncoderSink: Recording " << settings.path << " with "
+              << getBackendName(backend) << " encoder" << std::endl;
+    return true;
+#else
+    (void)settings;
+    std::cerr << "VideoEncoderSink: Built without FFmpeg" << std::endl;
+    return false;
+#endif
+}
+
+void VideoEncoderSink::close() {
+    if (!encoder) {
+        return;
+    }
+
+    // A frame still waiting for its audio goes in as it is
+    if (current) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(current));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+#if defined(VIDEO_ENCODER_FFMPEG)
+    if (!encoder->finish()) {
+        std::cerr << "VideoEncoderSink: Failed to finish the file" << std::endl;
+    }
+#endif
+    encoder.reset();
+    queue.clear();
+    freeItems.clear();
+    carryAudio.clear();
+}
+
+void VideoEncoderSink::writeFrame(const FrameMailbox::Frame& frame) {
+    if (!encoder) {
+        return;
+    }
+
+    if (!current) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeItems.empty()) {
+            current = std::move(freeItems.back());
+            freeItems.pop_back();
+        }
+    }
+    // Every buffer queued, the encoder is behind
+    if (!current) {
+        droppedFrames.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // 480i frames as the field just rendered
+    for (int line = 0; line < HEIGHT; line++) {
+        uint32_t* out = current->pixels.data() + (size_t)line * WIDTH;
+        size_t offset = frame.fieldLineOffset(line);
+        if (frame.indexed) {
+            for (int x = 0; x < WIDTH; x++) {
+                out[x] = frame.palette[frame.indices[offset + x]];
+            }
+        } else {
+            std::copy_n(frame.pixels.begin() + offset, WIDTH, out);
+        }
+    }
+    current->hasVideo = true;
+    current->frameNumber = frame.number;
+}
+
+void VideoEncoderSink::writeAudio(const int16_t* samples, size_t frames) {
+    if (!encoder) {
+        return;
+    }
+
+    carryAudio.insert(carryAudio.end(), samples, samples + frames * 2);
+    if (!current) {
+        // Kept for the next frame queued, the oldest given up past a second
+        if (carryAudio.size() > MAX_CARRY_SAMPLES) {
+            carryAudio.erase(carryAudio.begin(), carryAudio.end() - MAX_CARRY_SAMPLES);
+        }
+        return;
+    }
+
+    current->audio.swap(carryAudio);
+    carryAudio.clear();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(current));
+    }
+    wake.notify_one();
+}
+
+void VideoEncoderSink::encoderLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return;
+        }
+        std::unique_ptr<Item> item = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+
+#if defined(VIDEO_ENCODER_FFMPEG)
+        if (item->hasVideo) {
+            encoder->encodeVideo(*item);
+            encodedFrames.fetch_add(1, std::memory_order_relaxed);
+        }
+        encoder->encodeAudio(item->audio.data(), item->audio.size() / 2);
+#endif
+        item->hasVideo = false;
+        item->audio.clear();
+
+        lock.lock();
+        freeItems.push_back(std::move(item));
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef VIDEO_ENCODER_SINK_H
+#define VIDEO_ENCODER_SINK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "frame_sink.h"
+
+/**
+ * Video Encoder Sink
+ *
+ * Records the frames and audio published into a video file, H.264 and AAC
+ * through FFmpeg, with the hardware encoders (VAAPI, NVENC) when there are
+ * any. Built with VIDEO_ENCODER_FFMPEG and linked against libavformat,
+ * libavcodec, libavutil and libswscale; open() fails without.
+ *
+ * The emulation thread only copies a frame into one of a few buffers, the
+ * encoding is done on a thread of its own. With all buffers queued the frame
+ * is dropped rather than waited for, its audio goes with the next one, and
+ * the file skips the frame's time: the recording keeps in sync.
+ */
+class VideoEncoderSink : public FrameSink {
+public:
+    enum Backend {
+        BACKEND_AUTO,       // The first of NVENC, VAAPI, software that opens
+        BACKEND_VAAPI,
+        BACKEND_NVENC,
+        BACKEND_SOFTWARE
+    };
+
+    static constexpr int DEFAULT_QUEUE_FRAMES = 8;
+    static constexpr int DEFAULT_BITRATE = 8000000;     // Bits per second
+
+    struct Settings {
+        std::string path;                               // Container from the extension
+        Backend backend = BACKEND_AUTO;
+        std::string device = "/dev/dri/renderD128";     // VAAPI render node
+        int bitrate = DEFAULT_BITRATE;
+        int queueFrames = DEFAULT_QUEUE_FRAMES;
+    };
+
+    VideoEncoderSink();
+    ~VideoEncoderSink() override;
+
+    bool open(const Settings& settings);
+    // Encodes what is still queued and finishes the file
+    void close();
+    bool isOpen() const { return encoder != nullptr; }
+
+    // Encoder used, once opened
+    Backend getBackend() const { return backend; }
+    static const char* getBackendName(Backend backend);
+
+    uint64_t getEncodedFrames() const { return encodedFrames.load(std::memory_order_relaxed); }
+    uint64_t getDroppedFrames() const { return droppedFrames.load(std::memory_order_relaxed); }
+
+    // FrameSink
+    void writeFrame(const FrameMailbox::Frame& frame) override;
+    void writeAudio(const int16_t* samples, size_t frames) override;
+
+private:
+    struct Item {
+        std::vector<uint32_t> pixels;
+        bool hasVideo;
+        uint64_t frameNumber;
+        std::vector<int16_t> audio;
+    };
+    struct Encoder;
+
+    std::unique_ptr<Encoder> encoder;
+    Backend backend;
+
+    // Encoder thread
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::unique_ptr<Item>> queue;
+    std::vector<std::unique_ptr<Item>> freeItems;
+    bool stopping;
+    void encoderLoop();
+
+    // Emulation thread: the frame waiting for its audio, and the audio of
+    // frames dropped
+    std::unique_ptr<Item> current;
+    std::vector<int16_t> carryAudio;
+
+    std::atomic<uint64_t> encodedFrames;
+    std::atomic<uint64_t> droppedFrames;
+};
+
+#endif // VIDEO_ENCODER_SINK_H
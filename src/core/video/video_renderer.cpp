@@ -2,37 +2,98 @@
 #include "../cpld/cpld2_video.h"
 #include "../cpld/cpld3_raster.h"
 #include "../memory/ram.h"
+#include "../timing/thread_placement.h"
 #include <cstring>
+#include <string>
 #include <algorithm>
-#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VIDEO_COMPOSITE_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VIDEO_COMPOSITE_NEON
+#endif
 
 VideoRenderer::VideoRenderer()
     : cpld2(nullptr)
     , cpld3(nullptr)
     , vram(nullptr)
+    , indexedOutput(false)
+    , renderGeneration(0)
+    , renderersBusy(0)
+    , renderersQuit(false)
     , paletteDirty(true)
+    , effectPaletteDirty(true)
+    , effectBrightness(31)
+    , effectTintR(0)
+    , effectTintG(0)
+    , effectTintB(0)
     , spriteCacheDirty(true)
 {
+    for (int index = 0; index < (int)tileCaches.size(); ++index) {
+        int size = index / 3 ? 16 : 8;
+        tileCaches[index].pixels.resize(TILE_COUNT * size * size * 2);
+        tileCaches[index].rowKinds.resize(TILE_COUNT * size);
+        tileCaches[index].valid.reset(new std::atomic<uint8_t>[TILE_COUNT]);
+    }
+    contexts.push_back(std::make_unique<LineContext>());
     reset();
 }
 
 VideoRenderer::~VideoRenderer() {
+    stopRenderWorkers();
+    if (vram) {
+        vram->setWriteListener(nullptr);
+        vram->clearWriteWatches();
+    }
+}
+
+void VideoRenderer::setVRAM(RAM* vram) {
+    if (this->vram) {
+        this->vram->setWriteListener(nullptr);
+        this->vram->clearWriteWatches();
+    }
+    this->vram = vram;
+    onVRAMWrite(0, UINT32_MAX);
+    
+    // Tilemaps are read as they are every line, nothing to track there
+    if (vram) {
+        vram->watchWrites(SPRITE_OAM, SPRITE_OAM + 512 * 8 - 1);
+        vram->watchWrites(PALETTE_RAM, PALETTE_RAM + 256 * 2 - 1);
+        // Tile numbers are 10 bits, the largest tiles are 256 bytes
+        vram->watchWrites(TILE_DATA, TILE_DATA + TILE_COUNT * 256 - 1);
+        vram->watchWrites(FRAMEBUFFER, FRAMEBUFFER + WIDTH * HEIGHT - 1);
+        vram->setWriteListener([this](uint32_t firstAddr, uint32_t lastAddr) {
+            onVRAMWrite(firstAddr, lastAddr);
+        });
+    }
 }
 
 void VideoRenderer::reset() {
     framebuffer.fill(0xFF000000);  // Black
-    paletteDirty = true;
-    spriteCacheDirty = true;
+    indexedFramebuffer.fill(0);
+    outputHeight = HEIGHT;
+    outputField = 0;
+    frameState = FrameState();
+    frameStateVersion = 0;
+    frameStateValid = false;
+    rasterEffects = false;
+    lineStates.assign(1, frameState);
+    lineRuns.fill(0);
+    changedLines.fill(1);
+    lineHashes.fill(0);
+    onVRAMWrite(0, UINT32_MAX);
 
     // Initialize default grayscale palette
     for (int i = 0; i < 256; ++i) {
         paletteRGBA[i] = 0xFF000000 | (i << 16) | (i << 8) | i;
     }
+    effectPaletteRGBA = paletteRGBA;
+    effectPaletteDirty = true;
     
-    for (auto& buf : layerBuffers) {
-        buf.color.fill(0);
-        buf.priority.fill(0);
-        buf.alpha.fill(16);  // Fully opaque
+    for (auto& context : contexts) {
+        clearBuffers(*context);
     }
 }
 
@@ -41,45 +102,157 @@ void VideoRenderer::reset() {
 //=============================================================================
 
 void VideoRenderer::renderFrame() {
-    for (int line = 0; line < HEIGHT; ++line) {
-        renderScanline(line);
-
-        static int frameCount = 0;
-        frameCount++;
-
-        if (frameCount == 120) {
-            std::cout << "[RENDERER F120] VRAM[$20]=$" << std::hex << (int)readVRAM(0x20) << std::dec << std::endl;
-            std::cout << "[RENDERER F120] framebuffer[32]=$" << std::hex << framebuffer[32] << std::dec << std::endl;
+    if (!cpld2 || !vram) return;
+    
+    prepareFrame(true);
+    
+    int bandCount = static_cast<int>(contexts.size());
+    if (bandCount > 1) {
+        {
+            std::lock_guard<std::mutex> lock(renderLock);
+            renderersBusy = static_cast<int>(renderWorkers.size());
+            renderGeneration++;
         }
+        renderStart.notify_all();
+        
+        renderBand(0, bandCount);
+        
+        std::unique_lock<std::mutex> lock(renderLock);
+        renderDone.wait(lock, [this]() { return renderersBusy == 0; });
+    } else {
+        renderBand(0, 1);
     }
 }
 
 void VideoRenderer::renderScanline(uint16_t line) {
     if (!cpld2 || !vram) return;
     
-    // Clear line buffers
-    //clearBuffers();
-    
+    prepareFrame(false);
+    renderLine(line, *contexts[0]);
+}
+
+void VideoRenderer::prepareFrame(bool frameLog) {
     // Update palette cache if needed (ALWAYS, regardless of mode)
     if (paletteDirty) {
         updatePaletteCache();
         paletteDirty = false;
     }
     
-    // Get video mode from CPLD2
-    uint8_t videoMode = cpld2->getRegister(0x00);
-    if ((videoMode & 0x03) == 0){
-        renderFramebufferMode(line);
-        return;
-    }
-
-    uint8_t layerEnable = cpld2->getRegister(0x01);
-
     if (spriteCacheDirty) {
         updateSpriteCache();
         spriteCacheDirty = false;
     }
     
+    // Video mode and layer configuration from CPLD2
+    const CPLD2_Video::Registers& registers = frameLog ? cpld2->getFrameRegisters() : cpld2->getRegisters();
+    if (!frameStateValid || registers.version != frameStateVersion) {
+        decodeFrameState(registers, frameState);
+        frameStateVersion = registers.version;
+        frameStateValid = true;
+    }
+    
+    // 480i renders one field, onto its own lines of the output. Every line looks
+    // different once the output switches
+    int height = frameState.mode.interlaced ? OUTPUT_HEIGHT : HEIGHT;
+    if (height != outputHeight) {
+        outputHeight = height;
+        framebufferDirtyLines.fill(1);
+        changedLines.fill(1);
+    }
+    outputField = frameState.mode.interlaced ? cpld2->getFrameField() : 0;
+    prepareLineStates(frameLog);
+    rasterEffects = cpld3 && cpld3->hasLineEffects();
+    
+    updateEffectPalette();
+}
+
+void VideoRenderer::prepareLineStates(bool frameLog) {
+    lineStates.resize(1);
+    lineStates[0] = frameState;
+    uint16_t runStart = 0;
+    
+    // Writes are in order: lines from the first a write shows on have a state of their
+    // own, all the writes to that line applied
+    if (frameLog && !cpld2->getRegisterWrites().empty()) {
+        const std::vector<CPLD2_Video::RegisterWrite>& writes = cpld2->getRegisterWrites();
+        CPLD2_Video::Registers registers = cpld2->getFrameRegisters();
+        size_t index = 0;
+        while (index < writes.size() && writes[index].line < HEIGHT) {
+            uint16_t line = writes[index].line;
+            for (; index < writes.size() && writes[index].line == line; ++index) {
+                CPLD2_Video::applyRegister(registers, writes[index].offset, writes[index].value);
+            }
+            std::fill(lineRuns.begin() + runStart, lineRuns.begin() + line,
+                      static_cast<uint16_t>(lineStates.size() - 1));
+            lineStates.emplace_back();
+            decodeFrameState(registers, lineStates.back());
+            runStart = line;
+        }
+    }
+    std::fill(lineRuns.begin() + runStart, lineRuns.end(), static_cast<uint16_t>(lineStates.size() - 1));
+}
+
+void VideoRenderer::decodeFrameState(const CPLD2_Video::Registers& registers, FrameState& state) {
+    VideoMode& mode = state.mode;
+    mode.mode = registers.mode & 0x03;
+    mode.interlaced = (registers.mode & 0x04) != 0;
+    mode.layerEnable = registers.layerEnable;
+    mode.mosaic = registers.mosaic & 0x0F;
+    mode.mosaicEnable = registers.mosaicEnable;
+    mode.brightness = registers.brightness;
+    mode.tintR = registers.tintR;
+    mode.tintG = registers.tintG;
+    mode.tintB = registers.tintB;
+    
+    for (int layerIndex = 0; layerIndex < 5; ++layerIndex) {
+        const CPLD2_Video::Registers::Layer& source = registers.layers[layerIndex];
+        LayerConfig& layer = state.layers[layerIndex];
+        layer.scrollX = source.scrollX;
+        layer.scrollY = source.scrollY;
+        layer.priority = source.priority;
+        layer.alpha = std::min<uint8_t>(source.blend, 16);
+        
+        // Control bits
+        layer.bpp = (source.control >> 0) & 0x03;       // 0=2bpp, 1=4bpp, 2=8bpp
+        layer.tileSize = (source.control >> 2) & 0x01;  // 0=8×8, 1=16×16
+        layer.mapSize = (source.control >> 3) & 0x01;   // 0=32×32, 1=64×64
+        layer.palBank = (source.control >> 4) & 0x0F;
+    }
+    
+    decodeWindows(registers, state);
+}
+
+void VideoRenderer::renderBand(int band, int bandCount) {
+    LineContext& context = *contexts[band];
+    int firstLine = band * HEIGHT / bandCount;
+    int endLine = (band + 1) * HEIGHT / bandCount;
+    for (int line = firstLine; line < endLine; ++line) {
+        renderLine(static_cast<uint16_t>(line), context);
+    }
+}
+
+void VideoRenderer::renderLine(uint16_t line, LineContext& context) {
+    const FrameState& state = lineStates[lineRuns[line]];
+    uint8_t videoMode = state.mode.mode;
+    if ((videoMode & 0x03) == 0){
+        renderFramebufferMode(line);
+        return;
+    }
+    
+    // Framebuffer mode has to write the line again after this
+    framebufferDirtyLines[outputLine(line)] = 1;
+    
+    // Every line starts from the backdrop
+    clearBuffers(context);
+    
+    uint8_t layerEnable = state.mode.layerEnable;
+    
+    // Mosaic layers are rendered as the first line of their block, windows and the
+    // rest of the mosaic go over the layer buffers once they are drawn
+    int mosaicSize = state.mode.mosaic + 1;
+    uint8_t mosaicEnable = (mosaicSize > 1) ? state.mode.mosaicEnable & layerEnable : 0;
+    uint16_t mosaicLine = line - line % mosaicSize;
+    
     // Render based on mode
     switch (videoMode & 0x03) {
         case 0:  // Framebuffer mode
@@ -89,25 +262,146 @@ void VideoRenderer::renderScanline(uint16_t line) {
         case 1:  // Standard mode (5 tilemaps + sprites)
         case 2:  // Max layers mode (6 tilemaps, no sprites)
         case 3:  // Background-only mode (2 backgrounds)
-            // Render enabled tilemap layers
-            if (layerEnable & 0x01) renderTileLayer(line, 0);  // BG0
-            if (layerEnable & 0x02) renderTileLayer(line, 1);  // BG1
-            if (layerEnable & 0x04) renderTileLayer(line, 2);  // FG0
-            if (layerEnable & 0x08) renderTileLayer(line, 3);  // FG1
-            if (layerEnable & 0x10) renderTileLayer(line, 4);  // HUD
+            // Render enabled tilemap layers (BG0, BG1, FG0, FG1, HUD), CPLD3's raster
+            // effects on all but the HUD
+            for (int layerIndex = 0; layerIndex < 5; ++layerIndex) {
+                if (!(layerEnable & (1 << layerIndex))) {
+                    continue;
+                }
+                uint16_t sourceLine = (mosaicEnable & (1 << layerIndex)) ? mosaicLine : line;
+                int16_t lineScroll = 0;
+                uint8_t lineBank = 0;
+                if (rasterEffects && layerIndex < 4) {
+                    const CPLD3_Raster::LineEffect& effect = cpld3->getLineEffects()[sourceLine];
+                    lineScroll = effect.scrollOffset;
+                    lineBank = effect.paletteSelect & 0x0F;
+                }
+                renderTileLayer(sourceLine, layerIndex, state.layers[layerIndex], lineScroll, lineBank, context);
+            }
             
             // Render sprites (if not in background-only or max layers mode)
             if ((videoMode & 0x03) == 1 && (layerEnable & 0x20)) {
-                renderSpritesOnLine(line);
+                renderSpritesOnLine((mosaicEnable & 0x20) ? mosaicLine : line, context);
+            } else {
+                layerEnable &= ~0x20;
             }
             break;
     }
     
-    // Composite all layers
-    compositeBuffers(line);
+    for (int layerIndex = 0; layerIndex < 6; ++layerIndex) {
+        if (!(layerEnable & (1 << layerIndex))) {
+            continue;
+        }
+        if (mosaicEnable & (1 << layerIndex)) {
+            applyMosaic(context.layerBuffers[layerIndex], mosaicSize);
+        }
+        if (state.windows[layerIndex].count) {
+            applyWindow(context.layerBuffers[layerIndex], state.windows[layerIndex]);
+        }
+    }
     
-    // Apply post-processing effects
-    applyEffects(line);
+    // Composite all layers, with post-processing effects
+    compositeBuffers(line, context);
+    checkLineChanged(line);
+}
+
+void VideoRenderer::checkLineChanged(uint16_t line) {
+    // Lines are hashed 8 bytes at a time, in whichever format they were written
+    int row = outputLine(line);
+    const uint8_t* bytes = indexedOutput
+        ? &indexedFramebuffer[row * WIDTH]
+        : reinterpret_cast<const uint8_t*>(&framebuffer[row * WIDTH]);
+    size_t size = indexedOutput ? WIDTH : WIDTH * sizeof(uint32_t);
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t offset = 0; offset < size; offset += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + offset, sizeof(word));
+        hash = (hash ^ word) * 0x100000001B3ull;
+        hash ^= hash >> 29;
+    }
+    
+    if (hash != lineHashes[row]) {
+        lineHashes[row] = hash;
+        changedLines[row] = 1;
+    }
+}
+
+void VideoRenderer::setIndexedOutput(bool enabled) {
+    if (enabled != indexedOutput) {
+        // The other framebuffer is out of date, and every line looks different
+        framebufferDirtyLines.fill(1);
+        changedLines.fill(1);
+    }
+    indexedOutput = enabled;
+}
+
+bool VideoRenderer::hasChangedLines() const {
+    return std::any_of(changedLines.begin(), changedLines.end(), [](uint8_t changed) { return changed != 0; });
+}
+
+const uint32_t* VideoRenderer::getOutputPalette() const {
+    // Framebuffer mode shows the palette as is, the other modes with the effects
+    if (frameState.mode.mode == 0) {
+        return paletteRGBA.data();
+    }
+    return effectPaletteRGBA.data();
+}
+
+//=============================================================================
+// Render Threads
+//=============================================================================
+
+void VideoRenderer::setRenderThreads(int count) {
+    count = std::max(1, std::min(count, HEIGHT));
+    stopRenderWorkers();
+    
+    contexts.resize(count);
+    for (auto& context : contexts) {
+        if (!context) {
+            context = std::make_unique<LineContext>();
+        }
+    }
+    
+    renderersQuit = false;
+    for (int band = 1; band < count; ++band) {
+        // The worker may only get going after the first frame started
+        renderWorkers.emplace_back(&VideoRenderer::renderWorkerLoop, this, band, renderGeneration);
+    }
+}
+
+void VideoRenderer::stopRenderWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(renderLock);
+        renderersQuit = true;
+    }
+    renderStart.notify_all();
+    for (std::thread& worker : renderWorkers) {
+        worker.join();
+    }
+    renderWorkers.clear();
+}
+
+void VideoRenderer::renderWorkerLoop(int band, uint64_t generation) {
+    std::string name = "sano-render-" + std::to_string(band);
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::ROLE_RENDERER, name.c_str());
+    
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(renderLock);
+            renderStart.wait(lock, [this, generation]() { return renderersQuit || renderGeneration != generation; });
+            if (renderersQuit) {
+                return;
+            }
+            generation = renderGeneration;
+        }
+        
+        renderBand(band, static_cast<int>(contexts.size()));
+        
+        std::lock_guard<std::mutex> lock(renderLock);
+        if (--renderersBusy == 0) {
+            renderDone.notify_one();
+        }
+    }
 }
 
 //=============================================================================
@@ -115,16 +409,26 @@ void VideoRenderer::renderScanline(uint16_t line) {
 //=============================================================================
 
 void VideoRenderer::updatePaletteCache() {
-    // Convert RGB565 palette to RGBA8888
+    // Convert the changed RGB565 entries to RGBA8888, read straight from palette RAM
+    const uint8_t* palette = vram->getPointer() + PALETTE_RAM;
     for (int i = 0; i < 256; ++i) {
-        uint16_t rgb565 = readVRAM16(PALETTE_RAM + i * 2);
+        if (!paletteDirtyEntries[i]) continue;
+        uint16_t rgb565 = palette[i * 2] | (palette[i * 2 + 1] << 8);
         paletteRGBA[i] = rgb565_to_rgba8888(rgb565);
     }
+    effectDirtyEntries |= paletteDirtyEntries;
+    paletteDirtyEntries.reset();
+    
+    // Indices stay the same, the colors of framebuffer mode do not
+    if (!indexedOutput) {
+        framebufferDirtyLines.fill(1);
+    }
 }
 
 void VideoRenderer::updateSpriteCache() {
-    // Load sprite attributes from OAM
+    // Load the changed sprite attributes from OAM
     for (int i = 0; i < 512; ++i) {
+        if (!spriteDirtyEntries[i]) continue;
         uint32_t oamAddr = SPRITE_OAM + i * 8;
         
         spriteCache[i].x = readVRAM16(oamAddr + 0);
@@ -134,6 +438,61 @@ void VideoRenderer::updateSpriteCache() {
         spriteCache[i].flags = readVRAM(oamAddr + 6);
         spriteCache[i].priority = readVRAM(oamAddr + 7);
     }
+    spriteDirtyEntries.reset();
+    binSprites();
+}
+
+void VideoRenderer::binSprites() {
+    static const int spriteSizes[] = { 8, 16, 32, 64 };
+    
+    for (SpriteBin& bin : spriteBins) {
+        bin.count = 0;
+    }
+    
+    // Reverse priority order (highest last), as they are drawn
+    for (int i = 511; i >= 0; --i) {
+        const Sprite& spr = spriteCache[i];
+        if (!spr.enabled()) continue;
+        
+        int lastLine = std::min<int>(spr.y + spriteSizes[spr.size()], HEIGHT) - 1;
+        for (int line = spr.y; line <= lastLine; ++line) {
+            SpriteBin& bin = spriteBins[line];
+            if (bin.count < MAX_SPRITES_PER_LINE) {
+                bin.sprites[bin.count++] = static_cast<uint16_t>(i);
+            }
+        }
+    }
+}
+
+void VideoRenderer::onVRAMWrite(uint32_t firstAddr, uint32_t lastAddr) {
+    // Palette entries are 2 bytes, sprites 8
+    if (firstAddr < PALETTE_RAM + 256 * 2 && lastAddr >= PALETTE_RAM) {
+        uint32_t first = firstAddr > PALETTE_RAM ? (firstAddr - PALETTE_RAM) / 2 : 0;
+        uint32_t last = std::min<uint32_t>((lastAddr - PALETTE_RAM) / 2, 255);
+        for (uint32_t i = first; i <= last; ++i) {
+            paletteDirtyEntries.set(i);
+        }
+        paletteDirty = true;
+    }
+    
+    if (firstAddr < SPRITE_OAM + 512 * 8 && lastAddr >= SPRITE_OAM) {
+        uint32_t first = firstAddr > SPRITE_OAM ? (firstAddr - SPRITE_OAM) / 8 : 0;
+        uint32_t last = std::min<uint32_t>((lastAddr - SPRITE_OAM) / 8, 511);
+        for (uint32_t i = first; i <= last; ++i) {
+            spriteDirtyEntries.set(i);
+        }
+        spriteCacheDirty = true;
+    }
+    
+    if (firstAddr < FRAMEBUFFER + WIDTH * HEIGHT && lastAddr >= FRAMEBUFFER) {
+        uint32_t first = firstAddr > FRAMEBUFFER ? (firstAddr - FRAMEBUFFER) / WIDTH : 0;
+        uint32_t last = std::min<uint32_t>((lastAddr - FRAMEBUFFER) / WIDTH, HEIGHT - 1);
+        // The output lines the region's lines go to in 240p, and in either field of 480i
+        std::fill(framebufferDirtyLines.begin() + first, framebufferDirtyLines.begin() + last + 1, 1);
+        std::fill(framebufferDirtyLines.begin() + first * 2, framebufferDirtyLines.begin() + last * 2 + 2, 1);
+    }
+    
+    invalidateTiles(firstAddr, lastAddr);
 }
 
 //=============================================================================
@@ -143,51 +502,77 @@ void VideoRenderer::updateSpriteCache() {
 void VideoRenderer::renderFramebufferMode(uint16_t line) {
     // Direct framebuffer rendering (8bpp indexed)
     // Framebuffer is 320Ã—240 Ã— 1 byte = 76,800 bytes
+    // In 480i both fields show the same line
+    int row = outputLine(line);
+    if (!framebufferDirtyLines[row]) {
+        return;
+    }
+    framebufferDirtyLines[row] = 0;
+    
     uint32_t fbAddr = FRAMEBUFFER + line * WIDTH;
     
+    if (indexedOutput) {
+        uint8_t* out = &indexedFramebuffer[row * WIDTH];
+        for (int x = 0; x < WIDTH; ++x) {
+            out[x] = readVRAM(fbAddr + x);
+        }
+        checkLineChanged(line);
+        return;
+    }
+    
     for (int x = 0; x < WIDTH; ++x) {
         uint8_t palIndex = readVRAM(fbAddr + x);
-        framebuffer[line * WIDTH + x] = paletteRGBA[palIndex];
+        framebuffer[row * WIDTH + x] = paletteRGBA[palIndex];
     }
+    checkLineChanged(line);
 }
 
 //=============================================================================
 // Tile Layer Rendering
 //=============================================================================
 
-void VideoRenderer::renderTileLayer(uint16_t line, int layerIndex) {
-    // Get layer configuration from CPLD2
-    uint8_t baseReg = 0x10 + layerIndex * 8;
-    uint16_t scrollX = cpld2->getRegister(baseReg + 0) | (cpld2->getRegister(baseReg + 1) << 8);
-    uint16_t scrollY = cpld2->getRegister(baseReg + 2) | (cpld2->getRegister(baseReg + 3) << 8);
-    uint8_t control = cpld2->getRegister(baseReg + 4);
-    uint8_t priority = cpld2->getRegister(baseReg + 5);
+void VideoRenderer::renderTileLayer(uint16_t line, int layerIndex, const LayerConfig& layer,
+                                    int16_t lineScroll, uint8_t lineBank, LineContext& context) {
+    // Layer configuration, as read from CPLD2
+    // The line's offset moves where the row starts, tiles are still stepped through whole
+    uint16_t scrollX = static_cast<uint16_t>(layer.scrollX + lineScroll);
+    uint16_t scrollY = layer.scrollY;
+    uint8_t priority = layer.priority;
+    uint8_t bpp = layer.bpp;
+    uint8_t tileSize = layer.tileSize;
+    uint8_t mapSize = layer.mapSize;
     
-    // Decode control bits
-    uint8_t bpp = ((control >> 0) & 0x03);  // 0=2bpp, 1=4bpp, 2=8bpp
-    uint8_t tileSize = (control >> 2) & 0x01;  // 0=8Ã—8, 1=16Ã—16
-    uint8_t mapSize = (control >> 3) & 0x01;   // 0=32Ã—32, 1=64Ã—64
-    uint8_t palBank = (control >> 4) & 0x0F;
+    // No such format, every pixel is transparent. Nor is anything seen of a layer blended in
+    // with no coverage
+    if (bpp > 2 || layer.alpha == 0) return;
+    uint8_t alpha = layer.alpha;
+    if (alpha < 16) {
+        context.translucent = true;
+    }
     
     // Get tilemap base address
     static const uint32_t tilemapBases[] = {
         TILEMAP_BG0, TILEMAP_BG1, TILEMAP_FG0, TILEMAP_FG1, TILEMAP_HUD
     };
     uint32_t tilemapBase = tilemapBases[layerIndex];
+    int size = tileSize ? 16 : 8;
     
     // Calculate which row of tiles we're on
     uint16_t worldY = (line + scrollY) & 0x1FF;  // Wrap at 512
-    uint16_t tileY = worldY / (tileSize ? 16 : 8);
-    uint16_t pixelY = worldY % (tileSize ? 16 : 8);
+    uint16_t tileY = worldY / size;
+    uint16_t pixelY = worldY % size;
     
     // Tilemap dimensions
     uint16_t mapWidth = (mapSize ? 64 : 32);
     
-    // Render tiles for this scanline
-    for (int screenX = 0; screenX < WIDTH; ++screenX) {
+    LineBuffer& buffer = context.layerBuffers[layerIndex];
+    
+    // Render the scanline one tile row at a time
+    int screenX = 0;
+    while (screenX < WIDTH) {
         uint16_t worldX = (screenX + scrollX) & 0x1FF;  // Wrap at 512
-        uint16_t tileX = worldX / (tileSize ? 16 : 8);
-        uint16_t pixelX = worldX % (tileSize ? 16 : 8);
+        uint16_t tileX = worldX / size;
+        uint16_t pixelX = worldX % size;
         
         // Get tile entry from tilemap
         uint32_t tileMapAddr = tilemapBase + (tileY * mapWidth + tileX) * 2;
@@ -199,72 +584,152 @@ void VideoRenderer::renderTileLayer(uint16_t line, int layerIndex) {
         bool vflip = (tileEntry & 0x0800) != 0;
         uint8_t tilePalBank = (tileEntry >> 12) & 0x0F;
         
-        // Apply flip to pixel coordinates
-        uint16_t px = hflip ? ((tileSize ? 15 : 7) - pixelX) : pixelX;
-        uint16_t py = vflip ? ((tileSize ? 15 : 7) - pixelY) : pixelY;
+        uint16_t py = vflip ? (size - 1 - pixelY) : pixelY;
+        uint8_t kind;
+        const uint8_t* row = getTileRow(bpp, tileSize, tileNum, py, hflip, &kind);
         
-        // Calculate tile data address
-        uint32_t bytesPerTile = (tileSize ? 16 : 8) * (tileSize ? 16 : 8);
-        if (bpp == 1) bytesPerTile /= 2;  // 4bpp
-        else if (bpp == 0) bytesPerTile /= 4;  // 2bpp
+        // 8bpp indices are used as they are, the line's palette select adds to the bank.
+        // Color 0 is transparent, with bank bits there is none
+        uint8_t bankBits = (bpp == 2) ? 0 : (((tilePalBank + lineBank) & 0x0F) << 4);
+        int count = std::min(size - pixelX, WIDTH - screenX);
+        if (bankBits) {
+            kind = ROW_OPAQUE;
+        }
         
-        uint32_t tileAddr = TILE_DATA + tileNum * bytesPerTile;
+        if (kind == ROW_OPAQUE) {
+            // Copied whole
+            const uint8_t* source = row + pixelX;
+            uint8_t* dest = buffer.color.data() + screenX;
+            for (int i = 0; i < count; ++i) {
+                dest[i] = source[i] | bankBits;
+            }
+            std::fill_n(buffer.priority.data() + screenX, count, priority);
+            std::fill_n(buffer.alpha.data() + screenX, count, alpha);
+            buffer.cover(screenX, count);
+        } else if (kind == ROW_MIXED) {
+            for (int i = 0; i < count; ++i) {
+                uint8_t colorIndex = row[pixelX + i];
+                
+                // Skip transparent pixels (color 0)
+                if (colorIndex == 0) continue;
+                
+                // Write to layer buffer
+                buffer.color[screenX + i] = colorIndex;
+                buffer.priority[screenX + i] = priority;
+                buffer.alpha[screenX + i] = alpha;
+            }
+            buffer.cover(screenX, count);
+        }
+        screenX += count;
+    }
+}
+
+//=============================================================================
+// Tile Cache
+//=============================================================================
+
+uint32_t VideoRenderer::bytesPerTile(uint8_t bpp, uint8_t tileSize) {
+    uint32_t bytes = tileSize ? 16 * 16 : 8 * 8;
+    if (bpp == 1) bytes /= 2;  // 4bpp
+    else if (bpp == 0) bytes /= 4;  // 2bpp
+    return bytes;
+}
+
+const uint8_t* VideoRenderer::getTileRow(uint8_t bpp, uint8_t tileSize, uint16_t tileNum, uint16_t row, bool hflip,
+                                         uint8_t* kind) {
+    int size = tileSize ? 16 : 8;
+    int pixelsPerTile = size * size;
+    TileCache& cache = tileCaches[tileSize * 3 + bpp];
+    
+    uint8_t* tile = &cache.pixels[tileNum * pixelsPerTile * 2];
+    if (!cache.valid[tileNum].load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(cache.decodeLock);
+        if (cache.valid[tileNum].load(std::memory_order_relaxed)) {
+            if (kind) *kind = cache.rowKinds[tileNum * size + row];
+            return tile + (hflip ? pixelsPerTile : 0) + row * size;
+        }
         
-        // Get pixel color
-        uint8_t colorIndex = 0;
+        uint32_t tileAddr = TILE_DATA + tileNum * bytesPerTile(bpp, tileSize);
+        switch (bpp) {
+            case 0: decodeTile_2bpp(tile, tileAddr, size); break;
+            case 1: decodeTile_4bpp(tile, tileAddr, size); break;
+            case 2: decodeTile_8bpp(tile, tileAddr, size); break;
+        }
         
-        if (tileSize == 0) {  // 8Ã—8 tile
-            uint32_t pixelAddr = tileAddr + py * 8;
-            
-            switch (bpp) {
-                case 0: {  // 2bpp
-                    uint8_t byte = readVRAM(pixelAddr + px / 4);
-                    colorIndex = (byte >> ((3 - (px % 4)) * 2)) & 0x03;
-                    colorIndex |= (tilePalBank << 4);
-                    break;
-                }
-                case 1: {  // 4bpp
-                    uint8_t byte = readVRAM(pixelAddr + px / 2);
-                    colorIndex = (px & 1) ? (byte & 0x0F) : (byte >> 4);
-                    colorIndex |= (tilePalBank << 4);
-                    break;
-                }
-                case 2: {  // 8bpp
-                    colorIndex = readVRAM(pixelAddr + px);
-                    break;
-                }
-            }
+        // Flipped copy right after
+        for (int y = 0; y < size; ++y) {
+            std::reverse_copy(tile + y * size, tile + (y + 1) * size, tile + pixelsPerTile + y * size);
         }
-        else {  // 16Ã—16 tile
-            uint32_t pixelAddr = tileAddr + py * 16;
-            
-            switch (bpp) {
-                case 0: {  // 2bpp
-                    uint8_t byte = readVRAM(pixelAddr + px / 4);
-                    colorIndex = (byte >> ((3 - (px % 4)) * 2)) & 0x03;
-                    colorIndex |= (tilePalBank << 4);
-                    break;
-                }
-                case 1: {  // 4bpp
-                    uint8_t byte = readVRAM(pixelAddr + px / 2);
-                    colorIndex = (px & 1) ? (byte & 0x0F) : (byte >> 4);
-                    colorIndex |= (tilePalBank << 4);
-                    break;
-                }
-                case 2: {  // 8bpp
-                    colorIndex = readVRAM(pixelAddr + px);
-                    break;
-                }
-            }
+        
+        // Flipping leaves the kind of a row as it is
+        for (int y = 0; y < size; ++y) {
+            int shown = size - static_cast<int>(std::count(tile + y * size, tile + (y + 1) * size, 0));
+            cache.rowKinds[tileNum * size + y] = shown == 0 ? ROW_TRANSPARENT
+                                               : shown == size ? ROW_OPAQUE : ROW_MIXED;
         }
+        cache.valid[tileNum].store(1, std::memory_order_release);
+    }
+    
+    if (kind) *kind = cache.rowKinds[tileNum * size + row];
+    return tile + (hflip ? pixelsPerTile : 0) + row * size;
+}
+
+void VideoRenderer::decodeTile_2bpp(uint8_t* dest, uint32_t tileAddr, int size) {
+    for (int y = 0; y < size; ++y) {
+        uint32_t rowAddr = tileAddr + y * size;
+        for (int x = 0; x < size; x += 4) {
+            uint8_t byte = readVRAM(rowAddr + x / 4);
+            dest[y * size + x + 0] = (byte >> 6) & 0x03;
+            dest[y * size + x + 1] = (byte >> 4) & 0x03;
+            dest[y * size + x + 2] = (byte >> 2) & 0x03;
+            dest[y * size + x + 3] = (byte >> 0) & 0x03;
+        }
+    }
+}
+
+void VideoRenderer::decodeTile_4bpp(uint8_t* dest, uint32_t tileAddr, int size) {
+    for (int y = 0; y < size; ++y) {
+        uint32_t rowAddr = tileAddr + y * size;
+        for (int x = 0; x < size; x += 2) {
+            uint8_t byte = readVRAM(rowAddr + x / 2);
+            dest[y * size + x + 0] = byte >> 4;
+            dest[y * size + x + 1] = byte & 0x0F;
+        }
+    }
+}
+
+void VideoRenderer::decodeTile_8bpp(uint8_t* dest, uint32_t tileAddr, int size) {
+    for (int y = 0; y < size; ++y) {
+        uint32_t rowAddr = tileAddr + y * size;
+        for (int x = 0; x < size; ++x) {
+            dest[y * size + x] = readVRAM(rowAddr + x);
+        }
+    }
+}
+
+void VideoRenderer::invalidateTiles(uint32_t firstAddr, uint32_t lastAddr) {
+    if (lastAddr < TILE_DATA) return;
+    
+    for (int index = 0; index < (int)tileCaches.size(); ++index) {
+        TileCache& cache = tileCaches[index];
+        
+        uint8_t tileSize = index / 3;
+        uint8_t bpp = index % 3;
+        uint32_t size = tileSize ? 16 : 8;
+        uint32_t tileBytes = bytesPerTile(bpp, tileSize);
+        // Rows are size bytes apart whatever the bpp, a tile may reach into the next ones
+        uint32_t footprint = (size - 1) * size + tileBytes / size;
         
-        // Skip transparent pixels (color 0)
-        if (colorIndex == 0) continue;
+        uint32_t first = firstAddr > TILE_DATA ? firstAddr - TILE_DATA : 0;
+        uint32_t last = lastAddr - TILE_DATA;
+        uint32_t firstTile = first >= footprint ? (first - footprint + 1 + tileBytes - 1) / tileBytes : 0;
+        uint32_t lastTile = std::min<uint32_t>(last / tileBytes, TILE_COUNT - 1);
         
-        // Write to layer buffer
-        layerBuffers[layerIndex].color[screenX] = colorIndex;
-        layerBuffers[layerIndex].priority[screenX] = priority;
-        layerBuffers[layerIndex].alpha[screenX] = 16;  // Opaque
+        if (firstTile <= lastTile) {
+            for (uint32_t tile = firstTile; tile <= lastTile; ++tile) {
+                cache.valid[tile].store(0, std::memory_order_relaxed);
+            }
+        }
     }
 }
 
@@ -272,64 +737,63 @@ void VideoRenderer::renderTileLayer(uint16_t line, int layerIndex) {
 // Sprite Rendering
 //=============================================================================
 
-void VideoRenderer::renderSpritesOnLine(uint16_t line) {
+void VideoRenderer::renderSpritesOnLine(uint16_t line, LineContext& context) {
     // Sprites are in layer buffer index 5
     constexpr int SPRITE_LAYER = 5;
+    LineBuffer& spriteBuffer = context.layerBuffers[SPRITE_LAYER];
     
-    int spritesOnLine = 0;
+    if (line >= HEIGHT) return;
     
-    // Render sprites in reverse priority order (highest last)
-    for (int i = 511; i >= 0 && spritesOnLine < 128; --i) {
-        const Sprite& spr = spriteCache[i];
-        if (!spr.enabled()) continue;
+    // Render this line's sprites, binned in reverse priority order (highest last)
+    const SpriteBin& bin = spriteBins[line];
+    for (int n = 0; n < bin.count; ++n) {
+        const Sprite& spr = spriteCache[bin.sprites[n]];
         
-        // Get sprite dimensions
+        // Square, made of 8×8 8bpp tiles numbered on from spr.tile row by row
         static const int spriteSizes[] = { 8, 16, 32, 64 };
-        int spriteHeight = spriteSizes[spr.size()];
-        
-        // Check if sprite intersects this scanline
-        if (line < spr.y || line >= spr.y + spriteHeight) continue;
+        int spriteSize = spriteSizes[spr.size()];
+        int tilesAcross = spriteSize / 8;
+        if (spr.x >= WIDTH) continue;
         
-        spritesOnLine++;
-        
-        int spriteWidth = spriteHeight;  // Square sprites
         uint16_t spriteY = line - spr.y;
         
         // Apply vertical flip
         if (spr.vflip()) {
-            spriteY = spriteHeight - 1 - spriteY;
+            spriteY = spriteSize - 1 - spriteY;
         }
+        uint16_t rowTile = spr.tile + (spriteY / 8) * tilesAcross;
+        uint16_t py = spriteY % 8;
         
-        // Get tile data
-        uint32_t tileAddr = TILE_DATA + spr.tile * 64;  // Assume 8Ã—8 base tile, 8bpp
+        // The 4 bit alpha spread over 0-16, 15 is opaque
+        uint8_t alpha = static_cast<uint8_t>((spr.alpha() * 16 + 7) / 15);
+        if (alpha > 0 && alpha < 16) {
+            context.translucent = true;
+        }
+        uint8_t bankBits = spr.palBank() << 4;
+        bool hflip = spr.hflip();
         
-        // Render sprite pixels
-        for (int sx = 0; sx < spriteWidth; ++sx) {
-            int screenX = spr.x + sx;
-            if (screenX < 0 || screenX >= WIDTH) continue;
+        // One decoded tile row at a time, from the tile cache. Flipped, the tiles are taken
+        // from the right and their rows come mirrored
+        for (int column = 0; column < tilesAcross; ++column) {
+            int screenX = spr.x + column * 8;
+            if (screenX >= WIDTH) break;
             
-            uint16_t spriteX = sx;
+            uint16_t tileNum = rowTile + (hflip ? tilesAcross - 1 - column : column);
+            const uint8_t* row = getTileRow(2, 0, tileNum, py, hflip);
+            int count = std::min(8, WIDTH - screenX);
+            spriteBuffer.cover(screenX, count);
             
-            // Apply horizontal flip
-            if (spr.hflip()) {
-                spriteX = spriteWidth - 1 - spriteX;
-            }
-            
-            // Get pixel (simplified - assumes 8Ã—8 tiles)
-            uint32_t pixelAddr = tileAddr + (spriteY % 8) * 8 + (spriteX % 8);
-            uint8_t colorIndex = readVRAM(pixelAddr);
-            
-            // Apply palette bank
-            colorIndex = (colorIndex & 0x0F) | (spr.palBank() << 4);
-            
-            // Skip transparent pixels
-            if ((colorIndex & 0x0F) == 0) continue;
-            
-            // Check if higher priority than what's already in buffer
-            if (spr.priority >= layerBuffers[SPRITE_LAYER].priority[screenX]) {
-                layerBuffers[SPRITE_LAYER].color[screenX] = colorIndex;
-                layerBuffers[SPRITE_LAYER].priority[screenX] = spr.priority;
-                layerBuffers[SPRITE_LAYER].alpha[screenX] = spr.alpha();
+            for (int i = 0; i < count; ++i) {
+                // Skip transparent pixels, the palette bank replaces the high bits
+                uint8_t colorIndex = row[i] & 0x0F;
+                if (colorIndex == 0) continue;
+                
+                // Check if higher priority than what's already in buffer
+                if (spr.priority >= spriteBuffer.priority[screenX + i]) {
+                    spriteBuffer.color[screenX + i] = colorIndex | bankBits;
+                    spriteBuffer.priority[screenX + i] = spr.priority;
+                    spriteBuffer.alpha[screenX + i] = alpha;
+                }
             }
         }
     }
@@ -339,87 +803,199 @@ void VideoRenderer::renderSpritesOnLine(uint16_t line) {
 // Compositing
 //=============================================================================
 
-void VideoRenderer::clearBuffers() {
-    for (auto& buf : layerBuffers) {
-        buf.color.fill(0);
-        buf.priority.fill(0);
-        buf.alpha.fill(16);
+void VideoRenderer::clearBuffers(LineContext& context) {
+    // Runs of the 8 pixel blocks drawn into only, mostly empty layers cost next to
+    // nothing. The final buffer is composited whole
+    for (auto& buf : context.layerBuffers) {
+        uint64_t coverage = buf.coverage;
+        while (coverage) {
+            int first = 0;
+            while (!(coverage & (1ull << first))) ++first;
+            int end = first;
+            while (coverage & (1ull << end)) ++end;
+            int x = first * 8;
+            int count = (end - first) * 8;
+            std::fill_n(buf.color.data() + x, count, 0);
+            std::fill_n(buf.priority.data() + x, count, 0);
+            std::fill_n(buf.alpha.data() + x, count, 16);
+            coverage &= ~((1ull << end) - 1);
+        }
+        buf.coverage = 0;
+    }
+    context.translucent = false;
+}
+
+void VideoRenderer::compositeBuffers(uint16_t line, LineContext& context) {
+    // Indices cannot hold a blend, indexed output shows the top pixel as it is
+    if (context.translucent && !indexedOutput) {
+        compositeTranslucent(line, context);
+        return;
     }
     
-    finalBuffer.color.fill(0);  // Backdrop color
-    finalBuffer.priority.fill(0);
-    finalBuffer.alpha.fill(16);
+    compositeLayers(context);
+    
+    if (indexedOutput) {
+        std::copy(context.finalBuffer.color.begin(), context.finalBuffer.color.end(),
+                  indexedFramebuffer.begin() + outputLine(line) * WIDTH);
+        return;
+    }
+    
+    // Convert to RGBA and write to framebuffer
+    uint32_t* out = &framebuffer[outputLine(line) * WIDTH];
+    for (int x = 0; x < WIDTH; ++x) {
+        out[x] = effectPaletteRGBA[context.finalBuffer.color[x]];
+    }
 }
 
-void VideoRenderer::compositeBuffers(uint16_t line) {
+void VideoRenderer::compositeLayers(LineContext& context) {
+    const std::array<LineBuffer, 6>& layerBuffers = context.layerBuffers;
+    LineBuffer& finalBuffer = context.finalBuffer;
+
     // Composite layers back-to-front based on priority
     // Priority: 0 = back, 15 = front
+    // A pixel wins over the layers before it when it is visible (color and alpha not 0)
+    // and its priority is not lower. Translucent pixels win as if they were opaque,
+    // lines that have any are blended by compositeTranslucent() instead.
+    int x = 0;
     
-    for (int x = 0; x < WIDTH; ++x) {
+#if defined(VIDEO_COMPOSITE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= WIDTH; x += 16) {
+        __m128i topColor = zero;
+        __m128i topPriority = zero;
+        for (int layer = 0; layer < 6; ++layer) {
+            const LineBuffer& buffer = layerBuffers[layer];
+            __m128i color = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&buffer.color[x]));
+            __m128i priority = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&buffer.priority[x]));
+            __m128i alpha = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&buffer.alpha[x]));
+            
+            __m128i hidden = _mm_or_si128(_mm_cmpeq_epi8(color, zero), _mm_cmpeq_epi8(alpha, zero));
+            __m128i notLower = _mm_cmpeq_epi8(_mm_max_epu8(priority, topPriority), priority);
+            __m128i wins = _mm_andnot_si128(hidden, notLower);
+            
+            topColor = _mm_or_si128(_mm_and_si128(wins, color), _mm_andnot_si128(wins, topColor));
+            topPriority = _mm_or_si128(_mm_and_si128(wins, priority), _mm_andnot_si128(wins, topPriority));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&finalBuffer.color[x]), topColor);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&finalBuffer.priority[x]), topPriority);
+    }
+#elif defined(VIDEO_COMPOSITE_NEON)
+    for (; x + 16 <= WIDTH; x += 16) {
+        uint8x16_t topColor = vdupq_n_u8(0);
+        uint8x16_t topPriority = vdupq_n_u8(0);
+        for (int layer = 0; layer < 6; ++layer) {
+            const LineBuffer& buffer = layerBuffers[layer];
+            uint8x16_t color = vld1q_u8(&buffer.color[x]);
+            uint8x16_t priority = vld1q_u8(&buffer.priority[x]);
+            uint8x16_t alpha = vld1q_u8(&buffer.alpha[x]);
+            
+            uint8x16_t visible = vandq_u8(vtstq_u8(color, color), vtstq_u8(alpha, alpha));
+            uint8x16_t wins = vandq_u8(visible, vcgeq_u8(priority, topPriority));
+            
+            topColor = vbslq_u8(wins, color, topColor);
+            topPriority = vbslq_u8(wins, priority, topPriority);
+        }
+        vst1q_u8(&finalBuffer.color[x], topColor);
+        vst1q_u8(&finalBuffer.priority[x], topPriority);
+    }
+#endif
+    
+    // Scalar path, and whatever does not fill a vector
+    for (; x < WIDTH; ++x) {
         uint8_t topColor = 0;  // Backdrop
         uint8_t topPriority = 0;
-        uint8_t topAlpha = 16;
         
-        // Find highest priority visible pixel
         for (int layer = 0; layer < 6; ++layer) {
             uint8_t color = layerBuffers[layer].color[x];
             uint8_t priority = layerBuffers[layer].priority[x];
             uint8_t alpha = layerBuffers[layer].alpha[x];
             
-            // Skip transparent pixels
-            if (color == 0) continue;
-            
-            // Check priority
-            if (priority >= topPriority) {
-                if (alpha == 16) {
-                    // Fully opaque - replace
-                    topColor = color;
-                    topPriority = priority;
-                    topAlpha = alpha;
-                }
-                else if (alpha > 0) {
-                    // Alpha blend with what's below
-                    uint32_t fgColor = paletteRGBA[color];
-                    uint32_t bgColor = paletteRGBA[topColor];
-                    uint32_t blended = blendAlpha(fgColor, bgColor, alpha);
-                    
-                    // Convert back to palette index (approximate)
-                    // For now, just use the fg color
-                    topColor = color;
-                    topPriority = priority;
-                    topAlpha = 16;
-                }
+            if (color != 0 && alpha != 0 && priority >= topPriority) {
+                topColor = color;
+                topPriority = priority;
             }
         }
         
         finalBuffer.color[x] = topColor;
         finalBuffer.priority[x] = topPriority;
-        finalBuffer.alpha[x] = topAlpha;
     }
     
-    // Convert to RGBA and write to framebuffer
+    finalBuffer.alpha.fill(16);
+}
+
+void VideoRenderer::compositeTranslucent(uint16_t line, LineContext& context) {
+    const std::array<LineBuffer, 6>& layerBuffers = context.layerBuffers;
+    LineBuffer& finalBuffer = context.finalBuffer;
+    uint32_t* out = &framebuffer[outputLine(line) * WIDTH];
+    
+    // The same pick as compositeLayers(), keeping the pixel each winner covers: it is
+    // the one that would have won without it. Only the top pixel is blended, over the
+    // one under it taken as opaque (the backdrop when there is none)
     for (int x = 0; x < WIDTH; ++x) {
-        uint8_t palIndex = finalBuffer.color[x];
-        framebuffer[line * WIDTH + x] = paletteRGBA[palIndex];
+        uint8_t topColor = 0;
+        uint8_t topPriority = 0;
+        uint8_t topAlpha = 16;
+        uint8_t underColor = 0;
+        uint8_t underPriority = 0;
+        
+        for (int layer = 0; layer < 6; ++layer) {
+            uint8_t color = layerBuffers[layer].color[x];
+            uint8_t priority = layerBuffers[layer].priority[x];
+            uint8_t alpha = layerBuffers[layer].alpha[x];
+            if (color == 0 || alpha == 0) {
+                continue;
+            }
+            
+            if (priority >= topPriority) {
+                underColor = topColor;
+                underPriority = topPriority;
+                topColor = color;
+                topPriority = priority;
+                topAlpha = alpha;
+            } else if (priority >= underPriority) {
+                underColor = color;
+                underPriority = priority;
+            }
+        }
+        
+        finalBuffer.color[x] = topColor;
+        finalBuffer.priority[x] = topPriority;
+        uint32_t top = effectPaletteRGBA[topColor];
+        out[x] = topAlpha >= 16 ? top : blendAlpha(top, effectPaletteRGBA[underColor], topAlpha);
     }
+    
+    finalBuffer.alpha.fill(16);
 }
 
 //=============================================================================
 // Effects
 //=============================================================================
 
-void VideoRenderer::applyEffects(uint16_t line) {
-    if (!cpld2) return;
-    
+void VideoRenderer::updateEffectPalette() {
     // Get global effects
-    uint8_t brightness = cpld2->getRegister(0x08);  // 0-31
-    int8_t tintR = cpld2->getRegister(0x09);
-    int8_t tintG = cpld2->getRegister(0x0A);
-    int8_t tintB = cpld2->getRegister(0x0B);
+    uint8_t brightness = frameState.mode.brightness;  // 0-31
+    int8_t tintR = frameState.mode.tintR;
+    int8_t tintG = frameState.mode.tintG;
+    int8_t tintB = frameState.mode.tintB;
     
-    // Apply to framebuffer line
-    for (int x = 0; x < WIDTH; ++x) {
-        uint32_t color = framebuffer[line * WIDTH + x];
+    bool changed = effectPaletteDirty || brightness != effectBrightness ||
+                   tintR != effectTintR || tintG != effectTintG || tintB != effectTintB;
+    if (!changed && effectDirtyEntries.none()) {
+        return;
+    }
+    if (changed) {
+        effectDirtyEntries.set();
+    }
+    effectPaletteDirty = false;
+    effectBrightness = brightness;
+    effectTintR = tintR;
+    effectTintG = tintG;
+    effectTintB = tintB;
+    
+    // Effects only depend on the color, apply them once per palette entry
+    for (int i = 0; i < 256; ++i) {
+        if (!effectDirtyEntries[i]) continue;
+        uint32_t color = paletteRGBA[i];
         
         // Apply brightness
         if (brightness != 31) {
@@ -431,8 +1007,9 @@ void VideoRenderer::applyEffects(uint16_t line) {
             color = applyTint(color, tintR, tintG, tintB);
         }
         
-        framebuffer[line * WIDTH + x] = color;
+        effectPaletteRGBA[i] = color;
     }
+    effectDirtyEntries.reset();
 }
 
 uint32_t VideoRenderer::applyBrightness(uint32_t color, uint8_t brightness) {
@@ -463,21 +1040,74 @@ uint32_t VideoRenderer::applyTint(uint32_t color, int8_t tintR, int8_t tintG, in
     return (a << 24) | (r << 16) | (g << 8) | b;
 }
 
-uint32_t VideoRenderer::blendAlpha(uint32_t fg, uint32_t bg, uint8_t alpha) {
-    // alpha: 0-16, where 16 = fully opaque
-    uint8_t fgR = (fg >> 16) & 0xFF;
-    uint8_t fgG = (fg >> 8) & 0xFF;
-    uint8_t fgB = (fg >> 0) & 0xFF;
-    
-    uint8_t bgR = (bg >> 16) & 0xFF;
-    uint8_t bgG = (bg >> 8) & 0xFF;
-    uint8_t bgB = (bg >> 0) & 0xFF;
+void VideoRenderer::applyMosaic(LineBuffer& buffer, int blockSize) {
+    // Blocks are no more than 16 pixels, a pixel reaches two blocks of 8 on at most
+    buffer.coverage |= ((buffer.coverage << 1) | (buffer.coverage << 2)) & LineBuffer::FULL_COVERAGE;
     
-    uint8_t r = (fgR * alpha + bgR * (16 - alpha)) / 16;
-    uint8_t g = (fgG * alpha + bgG * (16 - alpha)) / 16;
-    uint8_t b = (fgB * alpha + bgB * (16 - alpha)) / 16;
+    // Each block is one fill per array from its first pixel, no branch per pixel
+    for (int x = 0; x < WIDTH; x += blockSize) {
+        int count = std::min(blockSize, WIDTH - x);
+        std::fill_n(buffer.color.data() + x + 1, count - 1, buffer.color[x]);
+        std::fill_n(buffer.priority.data() + x + 1, count - 1, buffer.priority[x]);
+        std::fill_n(buffer.alpha.data() + x + 1, count - 1, buffer.alpha[x]);
+    }
+}
+
+void VideoRenderer::applyWindow(LineBuffer& buffer, const WindowSpans& windows) {
+    // Back to the state clearBuffers() left, the spans of two windows may overlap
+    for (int i = 0; i < windows.count; ++i) {
+        const WindowSpans::Span& span = windows.spans[i];
+        std::fill(buffer.color.data() + span.start, buffer.color.data() + span.end, 0);
+        std::fill(buffer.priority.data() + span.start, buffer.priority.data() + span.end, 0);
+        std::fill(buffer.alpha.data() + span.start, buffer.alpha.data() + span.end, 16);
+    }
+}
+
+void VideoRenderer::decodeWindows(const CPLD2_Video::Registers& registers, FrameState& state) {
+    for (WindowSpans& windows : state.windows) {
+        windows.count = 0;
+    }
     
-    return 0xFF000000 | (r << 16) | (g << 8) | b;
+    for (int window = 0; window < CPLD2_Video::Registers::WINDOW_COUNT; ++window) {
+        uint8_t enable = registers.windowEnable[window];
+        if (!enable) {
+            continue;
+        }
+        
+        // Edges past the line clip to it, an inverted window covers what is outside
+        uint16_t left = std::min<uint16_t>(registers.windowLeft[window], WIDTH);
+        uint16_t right = std::min<uint16_t>(registers.windowRight[window], WIDTH);
+        WindowSpans::Span spans[2];
+        int count = 0;
+        if (registers.windowInvert & (1 << window)) {
+            if (left < right) {
+                if (left > 0) spans[count++] = { 0, left };
+                if (right < WIDTH) spans[count++] = { right, WIDTH };
+            } else {
+                spans[count++] = { 0, WIDTH };
+            }
+        } else if (left < right) {
+            spans[count++] = { left, right };
+        }
+        
+        for (int layer = 0; layer < 6; ++layer) {
+            if (enable & (1 << layer)) {
+                WindowSpans& windows = state.windows[layer];
+                for (int i = 0; i < count; ++i) {
+                    windows.spans[windows.count++] = spans[i];
+                }
+            }
+        }
+    }
+}
+
+uint32_t VideoRenderer::blendAlpha(uint32_t fg, uint32_t bg, uint8_t alpha) {
+    // alpha: 0-16, where 16 = fully opaque. Red and blue are blended together, 16 bits
+    // apart, then green: two multiply-adds and a shift for the three channels
+    uint32_t inverse = 16 - alpha;
+    uint32_t rb = (((fg & 0x00FF00FF) * alpha + (bg & 0x00FF00FF) * inverse) >> 4) & 0x00FF00FF;
+    uint32_t g = (((fg & 0x0000FF00) * alpha + (bg & 0x0000FF00) * inverse) >> 4) & 0x0000FF00;
+    return 0xFF000000 | rb | g;
 }
 
 //=============================================================================
@@ -501,14 +1131,22 @@ uint16_t VideoRenderer::readVRAM16(uint32_t addr) {
 //=============================================================================
 
 uint32_t VideoRenderer::rgb565_to_rgba8888(uint16_t rgb565) {
-    uint8_t r5 = (rgb565 >> 11) & 0x1F;
-    uint8_t g6 = (rgb565 >> 5) & 0x3F;
-    uint8_t b5 = (rgb565 >> 0) & 0x1F;
-    
-    // Expand to 8-bit
-    uint8_t r = (r5 << 3) | (r5 >> 2);
-    uint8_t g = (g6 << 2) | (g6 >> 4);
-    uint8_t b = (b5 << 3) | (b5 >> 2);
-    
-    return 0xFF000000 | (b << 16) | (g << 8) | r;
+    // Shared by every renderer, 256 KB
+    static const std::vector<uint32_t> table = []() {
+        std::vector<uint32_t> colors(65536);
+        for (uint32_t color = 0; color < colors.size(); ++color) {
+            uint8_t r5 = (color >> 11) & 0x1F;
+            uint8_t g6 = (color >> 5) & 0x3F;
+            uint8_t b5 = (color >> 0) & 0x1F;
+            
+            // Expand to 8-bit
+            uint8_t r = (r5 << 3) | (r5 >> 2);
+            uint8_t g = (g6 << 2) | (g6 >> 4);
+            uint8_t b = (b5 << 3) | (b5 >> 2);
+            
+            colors[color] = 0xFF000000 | (b << 16) | (g << 8) | r;
+        }
+        return colors;
+    }();
+    return table[rgb565];
 }
@@ -3,10 +3,16 @@
 
 #include <cstdint>
 #include <array>
+#include <atomic>
+#include <bitset>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
+#include "../cpld/cpld2_video.h"
 
 // Forward declarations
-class CPLD2_Video;
 class CPLD3_Raster;
 class RAM;
 
@@ -15,7 +21,7 @@ class RAM;
  * 
  * Emulates SANo video output with hardware-accurate rendering pipeline:
  * - 5 tilemap layers (BG0, BG1, FG0, FG1, HUD)
- * - 512 sprites (128 per scanline)
+ * - 512 sprites (128 per scanline), 8 to 64 pixels square, of 8×8 8bpp tiles
  * - 256-color RGB565 palette
  * - Hardware effects (mosaic, alpha, windows, raster FX)
  * - 320×240 render resolution
@@ -26,20 +32,43 @@ public:
     ~VideoRenderer();
     
     // Configuration
-    void setCPLD2(CPLD2_Video* cpld2) { this->cpld2 = cpld2; }
+    void setCPLD2(CPLD2_Video* cpld2) { this->cpld2 = cpld2; frameStateValid = false; }
     void setCPLD3(CPLD3_Raster* cpld3) { this->cpld3 = cpld3; }
-    void setVRAM(RAM* vram) { this->vram = vram; }
+    void setVRAM(RAM* vram);
     
     // Frame rendering
     void renderFrame();
     void renderScanline(uint16_t line);
     
+    // Lines of a frame are split in bands rendered in parallel, 1 renders on the calling thread
+    void setRenderThreads(int count);
+    int getRenderThreads() const { return static_cast<int>(contexts.size()); }
+    
     // Framebuffer access
     const uint32_t* getFramebuffer() const { return framebuffer.data(); }
     
-    // Display dimensions
+    // Indexed output: frames are written as palette indices instead of RGBA, the
+    // display looks the colors up in getOutputPalette() (effects already applied)
+    void setIndexedOutput(bool enabled);
+    bool isIndexedOutput() const { return indexedOutput; }
+    const uint8_t* getIndexedFramebuffer() const { return indexedFramebuffer.data(); }
+    const uint32_t* getOutputPalette() const;
+    
+    // Display dimensions. HEIGHT lines are rendered each frame, in 480i those of one
+    // field only: the framebuffer is OUTPUT_HEIGHT lines then, the field on every other
+    // one, the other field's still there in between
     static constexpr int WIDTH = 320;
     static constexpr int HEIGHT = 240;
+    static constexpr int OUTPUT_HEIGHT = 480;
+    int getOutputHeight() const { return outputHeight; }
+    // 1 when the last frame rendered was the field on the odd lines
+    uint8_t getOutputField() const { return outputField; }
+    
+    // Lines of the output that changed since the last clearChangedLines(), the others
+    // still hold what they did then. Lines rendered the same as before do not count
+    const std::array<uint8_t, OUTPUT_HEIGHT>& getChangedLines() const { return changedLines; }
+    bool hasChangedLines() const;
+    void clearChangedLines() { changedLines.fill(0); }
     
     // Reset
     void reset();
@@ -50,18 +79,57 @@ private:
     CPLD3_Raster* cpld3;
     RAM* vram;
     
-    // Framebuffer (RGBA8888 for display)
-    std::array<uint32_t, WIDTH * HEIGHT> framebuffer;
+    // Framebuffer (RGBA8888 for display), outputHeight lines of it in use
+    std::array<uint32_t, WIDTH * OUTPUT_HEIGHT> framebuffer;
+    std::array<uint8_t, WIDTH * OUTPUT_HEIGHT> indexedFramebuffer;
+    bool indexedOutput;
+    int outputHeight;
+    uint8_t outputField;
+    // Output line a rendered line goes to
+    int outputLine(uint16_t line) const { return outputHeight == HEIGHT ? line : line * 2 + outputField; }
+    
+    // Output lines changed, one byte each as the render threads mark their own lines.
+    // A line changed when its hash is not the one it had when last written
+    std::array<uint8_t, OUTPUT_HEIGHT> changedLines;
+    std::array<uint64_t, OUTPUT_HEIGHT> lineHashes;
+    void checkLineChanged(uint16_t line);
+    
+    // Framebuffer mode output lines to convert again: their part of the framebuffer
+    // region was written, the palette changed or the output line holds something else.
+    // The others are left as they are
+    std::array<uint8_t, OUTPUT_HEIGHT> framebufferDirtyLines;
     
     // Line buffers for compositing
     struct LineBuffer {
         std::array<uint8_t, WIDTH> color;      // Palette index (0-255)
         std::array<uint8_t, WIDTH> priority;   // Layer priority (0-15)
         std::array<uint8_t, WIDTH> alpha;      // Alpha level (0-16, 16=opaque)
+        
+        // A bit per 8 pixels drawn into since the last clear, clearBuffers() clears
+        // these only. All of it to begin with
+        static constexpr uint64_t FULL_COVERAGE = (1ull << (WIDTH / 8)) - 1;
+        uint64_t coverage = FULL_COVERAGE;
+        void cover(int x, int count) {
+            coverage |= ((2ull << ((x + count - 1) / 8)) - 1) & ~((1ull << (x / 8)) - 1);
+        }
+    };
+    
+    // Everything a line is rendered into, one per render thread
+    struct LineContext {
+        std::array<LineBuffer, 6> layerBuffers; // BG0, BG1, FG0, FG1, HUD, Sprites
+        LineBuffer finalBuffer;
+        bool translucent;  // Any pixel with an alpha under 16 in the layer buffers
     };
+    std::vector<std::unique_ptr<LineContext>> contexts;
     
-    std::array<LineBuffer, 6> layerBuffers; // BG0, BG1, FG0, FG1, HUD, Sprites
-    LineBuffer finalBuffer;
+    // Render threads, rendering band i + 1 while the calling thread renders band 0
+    std::vector<std::thread> renderWorkers;
+    std::mutex renderLock;
+    std::condition_variable renderStart;
+    std::condition_variable renderDone;
+    uint64_t renderGeneration;
+    int renderersBusy;
+    bool renderersQuit;
     
     // VRAM layout (from video spec)
     static constexpr uint32_t PALETTE_RAM = 0x014000;
@@ -74,9 +142,34 @@ private:
     static constexpr uint32_t TILE_DATA = 0x020000;
     static constexpr uint32_t FRAMEBUFFER = 0x000000;
     
-    // Palette cache (RGB565 → RGBA8888)
+    // Decoded tile cache
+    // Tiles from TILE_DATA expanded to one palette index per pixel (before the palette
+    // bank is applied), each tile followed by its horizontally flipped copy. One cache
+    // per tile size and bpp, decoded on first use and dropped when VRAM under it is written.
+    static constexpr int TILE_COUNT = 1024;
+    // Render threads may decode at the same time, one at a time per cache
+    // What shows of a decoded tile row, for the tile layers to skip it or copy it whole
+    enum TileRowKind : uint8_t { ROW_TRANSPARENT, ROW_OPAQUE, ROW_MIXED };
+    struct TileCache {
+        std::vector<uint8_t> pixels;
+        std::vector<uint8_t> rowKinds;  // TileRowKind, size per tile
+        std::unique_ptr<std::atomic<uint8_t>[]> valid;
+        std::mutex decodeLock;
+    };
+    std::array<TileCache, 6> tileCaches;  // [tileSize * 3 + bpp]
+    
+    // Palette cache (RGB565 → RGBA8888), entries converted again as they are written
     std::array<uint32_t, 256> paletteRGBA;
     bool paletteDirty;
+    std::bitset<256> paletteDirtyEntries;
+    
+    // Palette with the global brightness and tint applied, as written to the framebuffer.
+    // All of it again when the effects change, otherwise the entries changed only
+    std::array<uint32_t, 256> effectPaletteRGBA;
+    bool effectPaletteDirty;
+    std::bitset<256> effectDirtyEntries;
+    uint8_t effectBrightness;
+    int8_t effectTintR, effectTintG, effectTintB;
     
     // Sprite structures
     struct Sprite {
@@ -97,12 +190,24 @@ private:
     
     std::array<Sprite, 512> spriteCache;
     bool spriteCacheDirty;
+    std::bitset<512> spriteDirtyEntries;
+    
+    // Sprites on each line, in drawing order and up to the 128 per line limit,
+    // evaluated again whenever the sprite cache changes
+    static constexpr int MAX_SPRITES_PER_LINE = 128;
+    struct SpriteBin {
+        std::array<uint16_t, MAX_SPRITES_PER_LINE> sprites;
+        uint8_t count;
+    };
+    std::array<SpriteBin, HEIGHT> spriteBins;
     
     // Video mode registers (from CPLD2)
     struct VideoMode {
         uint8_t mode;         // 0-3 (framebuffer, standard, max layers, bg-only)
+        bool interlaced;      // 480i, for the whole frame
         uint8_t layerEnable;  // Bit mask for enabled layers
-        uint8_t mosaic;       // Mosaic size (0-15)
+        uint8_t mosaic;       // Mosaic size (0-15), blocks of mosaic + 1 pixels
+        uint8_t mosaicEnable; // Layers it applies to, as layerEnable
         uint8_t brightness;   // Global brightness (0-31)
         int8_t tintR, tintG, tintB;  // Color tint offsets
     };
@@ -115,38 +220,95 @@ private:
         uint8_t mapSize;      // 0=32×32, 1=64×64
         uint8_t priority;
         uint8_t palBank;
+        uint8_t alpha;        // 0-16, 16 opaque
+    };
+    
+    // Pixels each of the line buffers is hidden over by CPLD2's windows, as [start, end)
+    // spans
+    struct WindowSpans {
+        static constexpr int MAX_SPANS = 4;
+        uint8_t count;
+        struct Span {
+            uint16_t start, end;
+        } spans[MAX_SPANS];
     };
     
+    // Registers as the frame started, decoded again only once CPLD2's register file
+    // changed. Brightness, tint and the output palette go by these for the whole frame
+    struct FrameState {
+        VideoMode mode;
+        LayerConfig layers[5];
+        WindowSpans windows[6];
+    };
+    FrameState frameState;
+    uint32_t frameStateVersion;
+    bool frameStateValid;
+    static void decodeFrameState(const CPLD2_Video::Registers& registers, FrameState& state);
+    
+    // Registers each line is rendered with: runs of lines between the writes CPLD2
+    // logged during the frame, frameState the first
+    std::vector<FrameState> lineStates;
+    std::array<uint16_t, HEIGHT> lineRuns;
+    void prepareLineStates(bool frameLog);
+    // Any of CPLD3's line effects in the frame
+    bool rasterEffects;
+    
     // Helper functions - VRAM access
     uint8_t readVRAM(uint32_t addr);
     uint16_t readVRAM16(uint32_t addr);
     void updatePaletteCache();
     void updateSpriteCache();
+    void binSprites();
+    
+    // VRAM write tracking, marks what the caches have to rebuild
+    void onVRAMWrite(uint32_t firstAddr, uint32_t lastAddr);
     
     // Helper functions - rendering
-    void clearBuffers();
-    void compositeBuffers(uint16_t line);
-    void applyEffects(uint16_t line);
+    // Brings the caches up to date and reads the registers, before any line is rendered:
+    // the frame's, mid-frame writes included, or the latest
+    void prepareFrame(bool frameLog);
+    void renderLine(uint16_t line, LineContext& context);
+    void renderBand(int band, int bandCount);
+    void renderWorkerLoop(int band, uint64_t generation);
+    void stopRenderWorkers();
+    void clearBuffers(LineContext& context);
+    // Picks the top pixel of each layer into finalBuffer and writes the framebuffer line,
+    // effects included
+    void compositeBuffers(uint16_t line, LineContext& context);
+    void compositeLayers(LineContext& context);
+    // RGBA output of lines with translucent pixels: the top pixel blended over the one
+    // under it
+    void compositeTranslucent(uint16_t line, LineContext& context);
+    void updateEffectPalette();
     
     // Layer rendering
     void renderFramebufferMode(uint16_t line);
-    void renderTileLayer(uint16_t line, int layerIndex);
-    void renderSpritesOnLine(uint16_t line);
+    // lineScroll and lineBank: CPLD3's offset and palette select for the line
+    void renderTileLayer(uint16_t line, int layerIndex, const LayerConfig& layer,
+                         int16_t lineScroll, uint8_t lineBank, LineContext& context);
+    void renderSpritesOnLine(uint16_t line, LineContext& context);
     
-    // Tile decoding
-    void decodeTile8x8_2bpp(uint8_t* dest, uint32_t tileAddr, uint8_t palBank, bool hflip, bool vflip);
-    void decodeTile8x8_4bpp(uint8_t* dest, uint32_t tileAddr, uint8_t palBank, bool hflip, bool vflip);
-    void decodeTile8x8_8bpp(uint8_t* dest, uint32_t tileAddr, bool hflip, bool vflip);
+    // Tile decoding (size is 8 or 16 pixels, rows are size bytes apart)
+    void decodeTile_2bpp(uint8_t* dest, uint32_t tileAddr, int size);
+    void decodeTile_4bpp(uint8_t* dest, uint32_t tileAddr, int size);
+    void decodeTile_8bpp(uint8_t* dest, uint32_t tileAddr, int size);
+    // kind, when given, is what shows of the row
+    const uint8_t* getTileRow(uint8_t bpp, uint8_t tileSize, uint16_t tileNum, uint16_t row, bool hflip,
+                              uint8_t* kind = nullptr);
+    void invalidateTiles(uint32_t firstAddr, uint32_t lastAddr);
+    static uint32_t bytesPerTile(uint8_t bpp, uint8_t tileSize);
     
-    // Effects
-    void applyMosaic(uint8_t* buffer, int width, uint8_t mosaicSize);
-    void applyWindow(LineBuffer& buffer, uint16_t line, uint8_t windowMask);
+    // Effects, over whole spans of a line buffer. Mosaic repeats the first pixel of each
+    // block of blockSize, windows clear their spans to transparent
+    static void applyMosaic(LineBuffer& buffer, int blockSize);
+    static void applyWindow(LineBuffer& buffer, const WindowSpans& windows);
+    static void decodeWindows(const CPLD2_Video::Registers& registers, FrameState& state);
     uint32_t applyBrightness(uint32_t color, uint8_t brightness);
     uint32_t applyTint(uint32_t color, int8_t r, int8_t g, int8_t b);
-    uint32_t blendAlpha(uint32_t fg, uint32_t bg, uint8_t alpha);
+    static uint32_t blendAlpha(uint32_t fg, uint32_t bg, uint8_t alpha);
     
-    // Color conversion
-    uint32_t rgb565_to_rgba8888(uint16_t rgb565);
+    // Color conversion, from a table of all 65536 colors built on first use
+    static uint32_t rgb565_to_rgba8888(uint16_t rgb565);
 };
 
 #endif // VIDEO_RENDERER_H
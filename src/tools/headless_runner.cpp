@@ -0,0 +1,690 @@
+/**
+ * Headless Runner
+ *
+ * Runs a ROM without any window nor audio device, as fast as the host
+ * allows, for regression runs over a ROM corpus and throughput measurements
+ * independent of the display. Frames are only rendered where their output
+ * is asked for.
+ *
+ * Build with EMULATOR_HEADLESS defined and the core sources, without Qt.
+ *
+ * Usage: sano_headless <rom> [options]
+ *   --frames N          Frames to run (default 600, or the length of the movie replayed)
+ *   --hash-every N      Print a hash of every Nth frame
+ *   --hash-at A,B,...   Print a hash of the given frames
+ *   --png-at A,B,...    Write the given frames as frame_<N>.png
+ *   --png-dir DIR       Where the PNGs go (default .)
+ *   --threaded          Graphics and Sound CPUs on worker threads
+ *   --fixed-quantum     Keep the threaded quantum as it is instead of adapting it,
+ *                       sync points fall at the same times on every run
+ *   --no-idle-skip      Execute every iteration of idle loops
+ *   --no-block-execution  Go back through the interpreter between all instructions
+ *   --vram-arbitration  Graphics CPU stores to VRAM wait for blanking, as on the
+ *                       console; prints the cycles waited
+ *   --boot-snapshots DIR  Restore the boot snapshot of the ROM from DIR, or save it there
+ *   --save-ram DIR      Keep the save RAM of the ROM in DIR
+ *   --profile FILE      Write a flat profile of the guest code
+ *   --folded FILE       Write its samples as folded stacks
+ *   --profile-interval N  Cycles between two samples
+ *   --trace FILE        Keep an instruction trace of each CPU, written to FILE at
+ *                       the end or when the runner crashes, see sano_trace
+ *   --trace-entries N   Instructions kept per CPU
+ *   --exec-stats FILE   Count executions and cycles per opcode and addressing mode,
+ *                       and bus accesses per device, as CSV or as JSON for a .json FILE
+ *   --shm NAME          Render every frame into the shared memory object NAME,
+ *                       with its audio, see SharedMemorySink
+ *   --encode FILE       Record the run as a video, H.264 and AAC (FFmpeg builds).
+ *                       Frames the encoder cannot keep up with are dropped
+ *   --encoder NAME      auto, vaapi, nvenc or software (default auto)
+ *   --record FILE       Record the run as an input movie
+ *   --replay FILE       Play an input movie back from its state, checking the
+ *                       state hash of every frame; exits with 3 if one differs
+ *   --netplay PORT[:HOST:PEER]  Run against another runner over UDP, from local
+ *                       port PORT, to HOST:PEER or whoever sends to PORT first
+ *   --player N          Controller of this side in netplay, 1 or 2 (default 1)
+ *   --input-delay N     Frames of netplay input delay (default 1)
+ *   --metrics PORT      Serve Prometheus metrics on PORT meanwhile, see MetricsExporter
+ *   --threads SPEC      Cores and real-time priority per thread, e.g.
+ *                       "emulation=2:rt50;graphics=3", see ThreadPlacement.
+ *                       Prints where each thread ran at the end
+ *   --mailbox-stats     Print the traffic through each mailbox, and its IRQs
+ *   --verbose           Keep the emulator's console output, with debug lines
+ *
+ * Frames are counted from 1, hashes are FNV-1a 64 over the ARGB framebuffer.
+ * A netplay run exits with 4 if the two sides' states differ.
+ */
+
+#include "emulator.h"
+#include "timing/master_clock.h"
+#include "timing/thread_placement.h"
+#include "cpu/Cpu65816.hpp"
+#include "cpu/Log.hpp"
+#include "memory/mailbox.h"
+#include "metrics/metrics_exporter.h"
+#include "state/input_movie.h"
+#include "netplay/rollback_session.h"
+#include "netplay/udp_transport.h"
+#include "video/shared_memory_sink.h"
+#include "video/video_encoder_sink.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//=============================================================================
+// Options
+//=============================================================================
+
+struct Options {
+    std::string romPath;
+    uint64_t frames = 600;
+    uint64_t hashEvery = 0;
+    std::set<uint64_t> hashFrames;
+    std::set<uint64_t> pngFrames;
+    std::string pngDir = ".";
+    bool threaded = false;
+    bool fixedQuantum = false;
+    bool idleSkip = true;
+    bool blockExecution = true;
+    bool vramArbitration = false;
+    std::string bootSnapshotDir;
+    std::string saveRAMDir;
+    bool verbose = false;
+    bool mailboxStats = false;
+    std::string profilePath;
+    std::string foldedPath;
+    uint32_t profileInterval = 0;
+    std::string tracePath;
+    size_t traceEntries = 0;
+    std::string execStatsPath;
+    std::string shmName;
+    std::string encodePath;
+    VideoEncoderSink::Backend encoder = VideoEncoderSink::BACKEND_AUTO;
+    std::string recordPath;
+    std::string replayPath;
+    bool netplay = false;
+    uint16_t netplayPort = 0;
+    std::string netplayHost;
+    uint16_t netplayPeerPort = 0;
+    int player = 1;
+    int inputDelay = RollbackSession::DEFAULT_INPUT_DELAY;
+    uint16_t metricsPort = 0;
+    std::string threadSettings;
+    bool framesGiven = false;
+};
+
+static void printUsage() {
+    std::fprintf(stderr,
+        "Usage: sano_headless <rom> [--frames N] [--hash-every N] [--hash-at A,B,...]\n"
+        "                           [--png-at A,B,...] [--png-dir DIR] [--threaded] [--fixed-quantum]\n"
+        "                           [--no-idle-skip] [--no-block-execution] [--vram-arbitration]\n"
+        "                           [--boot-snapshots DIR] [--save-ram DIR]\n"
+        "                           [--mailbox-stats] [--metrics PORT] [--threads SPEC] [--verbose]\n"
+        "                           [--profile FILE] [--folded FILE] [--profile-interval N]\n"
+        "                           [--trace FILE] [--trace-entries N] [--exec-stats FILE]\n"
+        "                           [--shm NAME] [--encode FILE] [--encoder NAME]\n"
+        "                           [--record FILE | --replay FILE]\n"
+        "                           [--netplay PORT[:HOST:PEER]] [--player N] [--input-delay N]\n");
+}
+
+static bool parseFrameList(const char* text, std::set<uint64_t>& frames) {
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        char* end = nullptr;
+        uint64_t frame = std::strtoull(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || frame == 0) {
+            return false;
+        }
+        frames.insert(frame);
+    }
+    return true;
+}
+
+static bool parseNetplay(const std::string& text, Options& options) {
+    // PORT, or PORT:HOST:PEER
+    size_t first = text.find(':');
+    size_t last = text.rfind(':');
+    options.netplayPort = static_cast<uint16_t>(std::strtoul(text.substr(0, first).c_str(), nullptr, 10));
+    if (first != std::string::npos) {
+        if (last == first) {
+            return false;
+        }
+        options.netplayHost = text.substr(first + 1, last - first - 1);
+        options.netplayPeerPort = static_cast<uint16_t>(std::strtoul(text.substr(last + 1).c_str(), nullptr, 10));
+    }
+    options.netplay = true;
+    return options.netplayPort != 0 && (options.netplayHost.empty() || options.netplayPeerPort != 0);
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--frames" && hasValue) {
+            options.frames = std::strtoull(argv[++i], nullptr, 10);
+            options.framesGiven = true;
+        } else if (arg == "--hash-every" && hasValue) {
+            options.hashEvery = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--hash-at" && hasValue) {
+            if (!parseFrameList(argv[++i], options.hashFrames)) return false;
+        } else if (arg == "--png-at" && hasValue) {
+            if (!parseFrameList(argv[++i], options.pngFrames)) return false;
+        } else if (arg == "--png-dir" && hasValue) {
+            options.pngDir = argv[++i];
+        } else if (arg == "--profile" && hasValue) {
+            options.profilePath = argv[++i];
+        } else if (arg == "--folded" && hasValue) {
+            options.foldedPath = argv[++i];
+        } else if (arg == "--profile-interval" && hasValue) {
+            options.profileInterval = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--trace" && hasValue) {
+            options.tracePath = argv[++i];
+        } else if (arg == "--trace-entries" && hasValue) {
+            options.traceEntries = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--exec-stats" && hasValue) {
+            options.execStatsPath = argv[++i];
+        } else if (arg == "--shm" && hasValue) {
+            options.shmName = argv[++i];
+        } else if (arg == "--encode" && hasValue) {
+            options.encodePath = argv[++i];
+        } else if (arg == "--encoder" && hasValue) {
+            std::string name = argv[++i];
+            if (name == "auto") {
+                options.encoder = VideoEncoderSink::BACKEND_AUTO;
+            } else if (name == "vaapi") {
+                options.encoder = VideoEncoderSink::BACKEND_VAAPI;
+            } else if (name == "nvenc") {
+                options.encoder = VideoEncoderSink::BACKEND_NVENC;
+            } else if (name == "software") {
+                options.encoder = VideoEncoderSink::BACKEND_SOFTWARE;
+            } else {
+                return false;
+            }
+        } else if (arg == "--boot-snapshots" && hasValue) {
+            options.bootSnapshotDir = argv[++i];
+        } else if (arg == "--save-ram" && hasValue) {
+            options.saveRAMDir = argv[++i];
+        } else if (arg == "--record" && hasValue) {
+            options.recordPath = argv[++i];
+        } else if (arg == "--replay" && hasValue) {
+            options.replayPath = argv[++i];
+        } else if (arg == "--netplay" && hasValue) {
+            if (!parseNetplay(argv[++i], options)) return false;
+        } else if (arg == "--player" && hasValue) {
+            options.player = std::atoi(argv[++i]);
+            if (options.player != 1 && options.player != 2) return false;
+        } else if (arg == "--input-delay" && hasValue) {
+            options.inputDelay = std::atoi(argv[++i]);
+        } else if (arg == "--metrics" && hasValue) {
+            options.metricsPort = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 10));
+            if (options.metricsPort == 0) return false;
+        } else if (arg == "--threads" && hasValue) {
+            options.threadSettings = argv[++i];
+        } else if (arg == "--threaded") {
+            options.threaded = true;
+        } else if (arg == "--fixed-quantum") {
+            options.fixedQuantum = true;
+        } else if (arg == "--no-idle-skip") {
+            options.idleSkip = false;
+        } else if (arg == "--no-block-execution") {
+            options.blockExecution = false;
+        } else if (arg == "--vram-arbitration") {
+            options.vramArbitration = true;
+        } else if (arg == "--mailbox-stats") {
+            options.mailboxStats = true;
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else if (arg[0] != '-' && options.romPath.empty()) {
+            options.romPath = arg;
+        } else {
+            return false;
+        }
+    }
+    // A movie has no say over the peer's buttons
+    bool movie = !options.recordPath.empty() || !options.replayPath.empty();
+    return !options.romPath.empty() && (options.recordPath.empty() || options.replayPath.empty()) &&
+           !(options.netplay && movie);
+}
+
+//=============================================================================
+// Frame Output
+//=============================================================================
+
+static uint64_t hashFrame(const uint32_t* pixels, size_t count) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(pixels);
+    for (size_t i = 0; i < count * sizeof(uint32_t); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static void putChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+    put32(out, static_cast<uint32_t>(data.size()));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put32(out, crc32(out.data() + start, out.size() - start));
+}
+
+// RGB PNG with stored (uncompressed) deflate blocks, no zlib needed
+static bool writePNG(const std::string& path, const uint32_t* pixels, int width, int height) {
+    std::vector<uint8_t> raw;
+    raw.reserve(static_cast<size_t>(height) * (width * 3 + 1));
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);  // No filter
+        for (int x = 0; x < width; x++) {
+            uint32_t pixel = pixels[y * width + x];
+            raw.push_back(static_cast<uint8_t>(pixel >> 16));
+            raw.push_back(static_cast<uint8_t>(pixel >> 8));
+            raw.push_back(static_cast<uint8_t>(pixel));
+        }
+    }
+
+    std::vector<uint8_t> zlib = { 0x78, 0x01 };
+    size_t offset = 0;
+    do {
+        size_t length = std::min<size_t>(0xFFFF, raw.size() - offset);
+        bool last = offset + length == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(static_cast<uint8_t>(length));
+        zlib.push_back(static_cast<uint8_t>(length >> 8));
+        zlib.push_back(static_cast<uint8_t>(~length));
+        zlib.push_back(static_cast<uint8_t>(~length >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+        offset += length;
+    } while (offset < raw.size());
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    put32(header, static_cast<uint32_t>(width));
+    put32(header, static_cast<uint32_t>(height));
+    header.insert(header.end(), { 8, 2, 0, 0, 0 });  // 8 bit RGB
+
+    std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    putChunk(png, "IHDR", header);
+    putChunk(png, "IDAT", zlib);
+    putChunk(png, "IEND", {});
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(png.data()), png.size());
+    return file.good();
+}
+
+static void writeProfile(const Emulator& emulator, const std::string& path, bool folded) {
+    if (path.empty()) {
+        return;
+    }
+    std::ofstream file(path);
+    emulator.writeGuestProfile(file, folded);
+    if (!file.good()) {
+        std::fprintf(stderr, "Failed to write %s\n", path.c_str());
+    }
+}
+
+static void writeExecutionStats(const Emulator& emulator, const std::string& path) {
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    std::ofstream file(path);
+    emulator.writeExecutionStats(file, json);
+    if (!file.good()) {
+        std::fprintf(stderr, "Failed to write %s\n", path.c_str());
+    }
+}
+
+static void writeTrace(const Emulator& emulator, const std::string& path) {
+    std::ofstream file(path, std::ios::binary);
+    emulator.writeInstructionTrace(file, false);
+    if (!file.good()) {
+        std::fprintf(stderr, "Failed to write %s\n", path.c_str());
+    }
+}
+
+// Rates per emulated second
+static void printMailboxStatistics(const char* name, const Mailbox::Statistics& statistics, uint64_t frames) {
+    double seconds = frames / (double)MasterClock::FRAME_RATE;
+    double rate = seconds > 0 ? 1.0 / seconds : 0.0;
+    std::printf("mailbox %s: %llu writes (%.0f/s), %llu bytes in, %llu bytes out, %llu IRQs (%.0f/s), %llu doorbells\n",
+                name, (unsigned long long)statistics.writes, statistics.writes * rate,
+                (unsigned long long)statistics.bytesWritten, (unsigned long long)statistics.bytesRead,
+                (unsigned long long)statistics.irqs, statistics.irqs * rate, (unsigned long long)statistics.doorbells);
+}
+
+// What the crash handler writes out
+static const Emulator* tracedEmulator = nullptr;
+static const char* crashTracePath = nullptr;
+
+// Best effort: the process is going down anyway, so the trace is written with
+// the regular streams rather than only async-signal-safe calls
+static void writeTraceOnCrash(int signal) {
+    std::signal(signal, SIG_DFL);
+    if (tracedEmulator) {
+        std::fprintf(stderr, "Crashed, instruction trace written to %s\n", crashTracePath);
+        writeTrace(*tracedEmulator, crashTracePath);
+    }
+    std::raise(signal);
+}
+
+//=============================================================================
+// Netplay
+//=============================================================================
+
+static constexpr int NETPLAY_TIMEOUT_MS = 10000;
+
+// Waits the frame out as long as the session does, false when the peer has
+// not let it run one for NETPLAY_TIMEOUT_MS
+static bool runNetplayFrame(RollbackSession& session) {
+    auto limit = std::chrono::steady_clock::now() + std::chrono::milliseconds(NETPLAY_TIMEOUT_MS);
+    while (!session.runFrame()) {
+        if (std::chrono::steady_clock::now() > limit) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+//=============================================================================
+// Main
+//=============================================================================
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 2;
+    }
+    std::string threadError;
+    if (!ThreadPlacement::configure(options.threadSettings, threadError)) {
+        std::fprintf(stderr, "%s\n", threadError.c_str());
+        return 2;
+    }
+    // Frames run on the main thread here
+    ThreadPlacement::applyToCurrentThread(ThreadPlacement::ROLE_EMULATION, nullptr);
+
+    // Status messages of the core still go to std::cout, results through stdio
+    Log::setLevel(options.verbose ? LogLevel::Debug : LogLevel::Error);
+    std::ostringstream discarded;
+    std::streambuf* coutBuffer = std::cout.rdbuf();
+    if (!options.verbose) {
+        std::cout.rdbuf(discarded.rdbuf());
+    }
+
+    Emulator emulator;
+    if (!emulator.initialize() || !emulator.loadROM(options.romPath)) {
+        std::cout.rdbuf(coutBuffer);
+        std::fprintf(stderr, "Failed to load %s\n", options.romPath.c_str());
+        return 1;
+    }
+    if (options.fixedQuantum) {
+        emulator.setAdaptiveQuantum(false);
+    }
+    if (options.threaded) {
+        emulator.setThreadedExecution(true);
+    }
+    for (Cpu65816* cpu : { emulator.getMainCPU(), emulator.getGraphicsCPU(), emulator.getSoundCPU() }) {
+        cpu->setIdleLoopSkipping(options.idleSkip);
+        cpu->setBlockExecution(options.blockExecution);
+    }
+    emulator.setVRAMArbitration(options.vramArbitration);
+    emulator.setSaveRAMDirectory(options.saveRAMDir);
+    emulator.setBootSnapshotDirectory(options.bootSnapshotDir);
+    emulator.reset();
+    emulator.run();
+    bool profiling = !options.profilePath.empty() || !options.foldedPath.empty();
+    if (profiling) {
+        emulator.setGuestProfiling(true, options.profileInterval);
+    }
+    bool counting = !options.execStatsPath.empty();
+    if (counting) {
+        emulator.setExecutionStats(true);
+    }
+    bool tracing = !options.tracePath.empty();
+    if (tracing) {
+        emulator.setInstructionTrace(true, options.traceEntries);
+        tracedEmulator = &emulator;
+        crashTracePath = options.tracePath.c_str();
+        for (int crashSignal : { SIGSEGV, SIGABRT, SIGFPE, SIGILL }) {
+            std::signal(crashSignal, writeTraceOnCrash);
+        }
+    }
+
+    // Movies start after the reset, from the state they hold when replayed
+    if (!options.recordPath.empty() && !emulator.startMovieRecording()) {
+        std::cout.rdbuf(coutBuffer);
+        std::fprintf(stderr, "Failed to start recording\n");
+        return 1;
+    }
+    if (!options.replayPath.empty()) {
+        std::unique_ptr<InputMovie> movie = std::make_unique<InputMovie>();
+        if (!movie->loadFromFile(options.replayPath)) {
+            std::cout.rdbuf(coutBuffer);
+            std::fprintf(stderr, "Failed to load %s\n", options.replayPath.c_str());
+            return 1;
+        }
+        if (!options.framesGiven) {
+            options.frames = movie->getFrameCount();
+        }
+        if (!emulator.startMoviePlayback(std::move(movie))) {
+            std::cout.rdbuf(coutBuffer);
+            std::fprintf(stderr, "Failed to start playback, the movie is for another ROM or build\n");
+            return 1;
+        }
+    }
+
+    SharedMemorySink sharedMemory;
+    bool sharing = !options.shmName.empty();
+    if (sharing) {
+        if (!sharedMemory.open(options.shmName)) {
+            std::cout.rdbuf(coutBuffer);
+            std::fprintf(stderr, "Failed to create %s\n", options.shmName.c_str());
+            return 1;
+        }
+        emulator.addFrameSink(&sharedMemory);
+    }
+    VideoEncoderSink videoEncoder;
+    bool encoding = !options.encodePath.empty();
+    if (encoding) {
+        VideoEncoderSink::Settings settings;
+        settings.path = options.encodePath;
+        settings.backend = options.encoder;
+        if (!videoEncoder.open(settings)) {
+            std::cout.rdbuf(coutBuffer);
+            std::fprintf(stderr, "Failed to record %s\n", options.encodePath.c_str());
+            return 1;
+        }
+        emulator.addFrameSink(&videoEncoder);
+    }
+
+    // Both runners from the same reset, frames wait for the peer
+    UdpTransport transport;
+    std::unique_ptr<RollbackSession> session;
+    if (options.netplay) {
+        if (!transport.open(options.netplayPort, options.netplayHost, options.netplayPeerPort)) {
+            std::cout.rdbuf(coutBuffer);
+            std::fprintf(stderr, "Failed to open netplay port %u\n", (unsigned)options.netplayPort);
+            return 1;
+        }
+        session = std::make_unique<RollbackSession>(&emulator, &transport, options.player - 1);
+        session->setInputDelay(options.inputDelay);
+    }
+
+    MetricsExporter metrics(&emulator);
+    if (options.metricsPort != 0 && !metrics.start(options.metricsPort)) {
+        std::cout.rdbuf(coutBuffer);
+        std::fprintf(stderr, "Failed to serve metrics on port %u\n", (unsigned)options.metricsPort);
+        return 1;
+    }
+
+    const int width = emulator.getFramebufferWidth();
+    const int height = emulator.getFramebufferHeight();
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t frame = 1; frame <= options.frames; frame++) {
+        bool hash = options.hashFrames.count(frame) ||
+                    (options.hashEvery != 0 && frame % options.hashEvery == 0);
+        bool png = options.pngFrames.count(frame) != 0;
+
+        // Only the frames looked at are rendered
+        emulator.setHeadless(!hash && !png && !sharing && !encoding);
+        if (session) {
+            if (!runNetplayFrame(*session)) {
+                std::cout.rdbuf(coutBuffer);
+                std::fprintf(stderr, "Netplay peer not heard from at frame %llu\n", (unsigned long long)frame);
+                return 1;
+            }
+        } else {
+            emulator.runFrame();
+        }
+
+        if (hash) {
+            std::printf("frame %llu %016llx\n", (unsigned long long)frame,
+                        (unsigned long long)hashFrame(emulator.getFramebuffer(), (size_t)width * height));
+        }
+        if (png) {
+            std::string path = options.pngDir + "/frame_" + std::to_string(frame) + ".png";
+            if (!writePNG(path, emulator.getFramebuffer(), width, height)) {
+                std::fprintf(stderr, "Failed to write %s\n", path.c_str());
+            }
+        }
+        if (!options.verbose) {
+            // Nobody reads it
+            discarded.str(std::string());
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (profiling) {
+        emulator.setGuestProfiling(false);
+        writeProfile(emulator, options.profilePath, false);
+        writeProfile(emulator, options.foldedPath, true);
+    }
+    if (counting) {
+        emulator.setExecutionStats(false);
+        writeExecutionStats(emulator, options.execStatsPath);
+    }
+    if (tracing) {
+        tracedEmulator = nullptr;
+        writeTrace(emulator, options.tracePath);
+    }
+    if (sharing) {
+        emulator.removeFrameSink(&sharedMemory);
+    }
+    if (encoding) {
+        emulator.removeFrameSink(&videoEncoder);
+        videoEncoder.close();
+    }
+    metrics.stop();
+    RollbackSession::Statistics netplay = {};
+    int64_t desync = -1;
+    if (session) {
+        netplay = session->getStatistics();
+        desync = session->getDesyncFrame();
+        session.reset();
+    }
+    int64_t divergence = emulator.getMovieDivergence();
+    uint64_t movieFrames = emulator.getMovieFrame();
+    std::unique_ptr<InputMovie> movie = emulator.stopMovie();
+    Mailbox::Statistics mailboxA = emulator.getMailboxA()->getStatistics();
+    Mailbox::Statistics mailboxB = emulator.getMailboxB()->getStatistics();
+    uint64_t slices = emulator.getScheduler()->getSliceCount();
+    uint64_t vramStalls = emulator.getVRAMStallCycles();
+    if (!options.recordPath.empty() && !movie->saveToFile(options.recordPath)) {
+        std::fprintf(stderr, "Failed to write %s\n", options.recordPath.c_str());
+    }
+    emulator.shutdown();
+    std::cout.rdbuf(coutBuffer);
+
+    if (encoding) {
+        std::printf("video %llu frames, %llu dropped\n",
+                    (unsigned long long)videoEncoder.getEncodedFrames(), (unsigned long long)videoEncoder.getDroppedFrames());
+    }
+    if (!options.replayPath.empty()) {
+        if (divergence >= 0) {
+            std::printf("movie diverged at frame %llu\n", (unsigned long long)divergence + 1);
+        } else {
+            std::printf("movie in sync over %llu of %llu frames\n",
+                        (unsigned long long)movieFrames, (unsigned long long)movie->getFrameCount());
+        }
+    }
+
+    if (options.netplay) {
+        std::printf("netplay %llu rollbacks, %llu frames run again (at most %d at once), %llu frames waited\n",
+                    (unsigned long long)netplay.rollbacks, (unsigned long long)netplay.resimulatedFrames,
+                    netplay.maxRollback, (unsigned long long)netplay.stalls);
+        if (desync >= 0) {
+            std::printf("netplay states differ from frame %llu\n", (unsigned long long)desync + 1);
+        }
+    }
+
+    if (options.threaded) {
+        std::printf("threaded %llu sync points, %.1f per frame\n", (unsigned long long)slices,
+                    options.frames > 0 ? (double)slices / options.frames : 0.0);
+    }
+
+    if (options.vramArbitration) {
+        std::printf("vram %llu Graphics CPU cycles waited, %.1f per frame\n", (unsigned long long)vramStalls,
+                    options.frames > 0 ? (double)vramStalls / options.frames : 0.0);
+    }
+
+    if (options.mailboxStats) {
+        printMailboxStatistics("A", mailboxA, options.frames);
+        printMailboxStatistics("B", mailboxB, options.frames);
+    }
+
+    if (!options.threadSettings.empty()) {
+        std::ostringstream report;
+        ThreadPlacement::writeReport(report);
+        std::fputs(report.str().c_str(), stdout);
+    }
+
+    double fps = seconds > 0 ? options.frames / seconds : 0.0;
+    std::printf("%llu frames in %.3f s, %.1f fps, %.2fx real time\n",
+                (unsigned long long)options.frames, seconds, fps, fps / MasterClock::FRAME_RATE);
+    if (desync >= 0) {
+        return 4;
+    }
+    return divergence >= 0 ? 3 : 0;
+}
@@ -0,0 +1,856 @@
+/**
+ * Micro Benchmarks
+ *
+ * Times the hot paths of the core in isolation, on synthetic inputs, so that
+ * a change to one of them can be measured without running a ROM:
+ *
+ * - Cpu65816::run() over tight loops of a single instruction, in RAM, with
+ *   and without block execution
+ * - SystemBus::readByte() on each kind of device
+ * - VideoRenderer::renderScanline() per mode, bit depth and tile size, and
+ *   with a full OAM of sprites
+ * - AudioMixer block production and generateSamples() per request size
+ *
+ * Every case runs for at least --min-time seconds, results are given per
+ * item (instruction, read, scanline, stereo frame).
+ *
+ * With --vectors the CPU is checked instead, against the single step test
+ * vectors of the 65816 (one JSON file per opcode and mode, 00.n.json,
+ * 00.e.json ...): each test is set up on a flat 16 MB bus, run for one
+ * instruction and its registers, memory and cycle count compared with the
+ * expected ones. Tests with a wrong cycle count are counted apart from the
+ * ones otherwise wrong, per opcode, mode and M/X widths, and
+ * each file is then timed again, giving instructions per second per opcode.
+ * Exits with 1 if any test fails.
+ *
+ * Build with the core sources, without Qt (emulator.cpp is not needed).
+ *
+ * Usage: sano_benchmarks [options]
+ *   --filter TEXT       Only the cases whose name contains TEXT
+ *   --min-time S        Seconds per case (default 0.2)
+ *   --json FILE         Also write the results as JSON, - for stdout
+ *   --vectors DIR       Run the test vectors in DIR, --filter on the file names
+ *   --show-failures N   Details of the first N failing tests per file (default 1)
+ */
+
+#include "cpu/Cpu65816.hpp"
+#include "cpu/SystemBus.hpp"
+#include "cpu/Log.hpp"
+#include "memory/ram.h"
+#include "memory/mailbox.h"
+#include "cartridge/cartridge.h"
+#include "cpld/cpld1_audio.h"
+#include "cpld/cpld2_video.h"
+#include "video/video_renderer.h"
+#include "audio/audio_mixer.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//=============================================================================
+// Harness
+//=============================================================================
+
+struct Options {
+    std::string filter;
+    double minTime = 0.2;
+    std::string jsonPath;
+    std::string vectorsDir;
+    int showFailures = 1;
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double nsPerItem;
+    double itemsPerSecond;
+};
+
+static Options options;
+static std::vector<Result> results;
+
+// Keeps the compiler from dropping the measured work
+static volatile uint64_t sink;
+
+static void addResult(const std::string& name, uint64_t iterations, double items, double seconds) {
+    Result result{name, iterations, seconds * 1e9 / items, items / seconds};
+    std::printf("%-44s %12llu %12.2f ns %14.0f /s\n", name.c_str(),
+                (unsigned long long)iterations, result.nsPerItem, result.itemsPerSecond);
+    std::fflush(stdout);
+    results.push_back(result);
+}
+
+// Calls body(), which processes itemsPerIteration items, until minTime is spent
+template <typename Body>
+static void runBenchmark(const std::string& name, double itemsPerIteration, Body body) {
+    if (name.find(options.filter) == std::string::npos) {
+        return;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    body();  // Warm up caches and lazy state
+
+    uint64_t iterations = 0;
+    uint64_t batch = 1;
+    double seconds = 0.0;
+    auto start = Clock::now();
+    while (seconds < options.minTime) {
+        for (uint64_t i = 0; i < batch; i++) {
+            body();
+        }
+        iterations += batch;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        // Few clock reads, without overshooting much either
+        if (seconds < options.minTime / 10) {
+            batch *= 2;
+        }
+    }
+
+    addResult(name, iterations, iterations * itemsPerIteration, seconds);
+}
+
+static bool writeJSON(std::ostream& out) {
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+            << ", \"ns_per_item\": " << r.nsPerItem
+            << ", \"items_per_second\": " << r.itemsPerSecond << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    return out.good();
+}
+
+//=============================================================================
+// CPU
+//=============================================================================
+
+static EmulationModeInterrupts emulationInterrupts{0, 0, 0, 0, 0, 0};
+static NativeModeInterrupts nativeInterrupts{0, 0, 0, 0, 0, 0};
+
+static constexpr uint16_t PROGRAM_START = 0x1000;
+static constexpr int LOOP_REPEAT = 64;
+
+// Native mode with the given register widths, LOOP_REPEAT copies of the
+// instruction, then a JMP back to them
+static void benchmarkInstruction(const char* name, std::vector<uint8_t> instruction, bool wide = true) {
+    SystemBus bus;
+    RAM ram(0x000000, 128 * 1024, "Benchmark RAM");
+    bus.registerDevice(&ram);
+
+    // Direct page and data for the addressing modes below
+    uint8_t* memory = ram.getPointer();
+    memory[0x10] = 0x00;
+    memory[0x11] = 0x02;
+
+    std::vector<uint8_t> program = { 0x18, 0xFB, static_cast<uint8_t>(wide ? 0xC2 : 0xE2), 0x30 };  // CLC XCE REP/SEP #$30
+    const size_t prologue = 3;
+    uint16_t loop = static_cast<uint16_t>(PROGRAM_START + program.size());
+    for (int i = 0; i < LOOP_REPEAT; i++) {
+        program.insert(program.end(), instruction.begin(), instruction.end());
+    }
+    program.insert(program.end(), { 0x4C, static_cast<uint8_t>(loop), static_cast<uint8_t>(loop >> 8) });
+    std::copy(program.begin(), program.end(), memory + PROGRAM_START);
+
+    Cpu65816 cpu(bus, &emulationInterrupts, &nativeInterrupts);
+    cpu.setRESPin(false);
+    cpu.setRDYPin(true);
+    // Most of these loops leave the registers as they were, they would be counted over
+    cpu.setIdleLoopSkipping(false);
+    cpu.setProgramAddress(Address(0, PROGRAM_START));
+    for (size_t i = 0; i < prologue; i++) {
+        cpu.executeNextInstruction();
+    }
+
+    // Cycles of one pass over the loop, to turn cycles into instructions
+    uint64_t startCycles = cpu.getTotalCycles();
+    for (int i = 0; i <= LOOP_REPEAT; i++) {
+        cpu.executeNextInstruction();
+    }
+    double cyclesPerInstruction = double(cpu.getTotalCycles() - startCycles) / (LOOP_REPEAT + 1);
+
+    const uint64_t budget = 100000;
+    runBenchmark(std::string("Cpu65816/") + name, budget / cyclesPerInstruction, [&]() {
+        sink = cpu.run(budget);
+    });
+    cpu.setBlockExecution(true);
+    runBenchmark(std::string("Cpu65816/block/") + name, budget / cyclesPerInstruction, [&]() {
+        sink = cpu.run(budget);
+    });
+}
+
+static void benchmarkCPU() {
+    benchmarkInstruction("NOP", { 0xEA });
+    benchmarkInstruction("LDA_imm8", { 0xA9, 0x12 }, false);
+    benchmarkInstruction("LDA_imm16", { 0xA9, 0x34, 0x12 });
+    benchmarkInstruction("LDA_abs", { 0xAD, 0x00, 0x02 });
+    benchmarkInstruction("LDA_long", { 0xAF, 0x00, 0x02, 0x00 });
+    benchmarkInstruction("LDA_dp_ind_y", { 0xB1, 0x10 });
+    benchmarkInstruction("STA_abs", { 0x8D, 0x00, 0x02 });
+    benchmarkInstruction("ADC_imm16", { 0x69, 0x01, 0x00 });
+    benchmarkInstruction("INC_dp", { 0xE6, 0x20 });
+    benchmarkInstruction("INX", { 0xE8 });
+    benchmarkInstruction("BRA", { 0x80, 0x00 });
+    benchmarkInstruction("PHA_PLA", { 0x48, 0x68 });
+}
+
+//=============================================================================
+// Bus
+//=============================================================================
+
+static void benchmarkBusReads(const char* name, SystemBus& bus, uint32_t base, uint32_t size) {
+    const int reads = 4096;
+    runBenchmark(std::string("SystemBus/readByte/") + name, reads, [&]() {
+        uint64_t sum = 0;
+        uint32_t offset = 0;
+        for (int i = 0; i < reads; i++) {
+            uint32_t address = base + offset;
+            sum += bus.readByte(Address::fromFlat(address));
+            offset = (offset + 97) % size;  // Crosses pages, stays in the device
+        }
+        sink = sum;
+    });
+}
+
+static void benchmarkBus() {
+    SystemBus bus;
+    RAM ram(0x000000, 128 * 1024, "Benchmark RAM");
+    Mailbox mailbox(0x400000, 1024, "Benchmark Mailbox");
+    CPLD1_Audio cpld1;
+    Cartridge cartridge;
+    std::vector<uint8_t> rom(1024 * 1024);
+    std::mt19937 rng(1);
+    for (uint8_t& byte : rom) {
+        byte = static_cast<uint8_t>(rng());
+    }
+    cartridge.loadROM(rom.data(), rom.size());
+
+    bus.registerDevice(&ram);
+    bus.registerDevice(&mailbox);
+    bus.registerDevice(&cpld1);
+    bus.registerDevice(&cartridge);
+
+    benchmarkBusReads("RAM", bus, 0x000000, 128 * 1024);
+    benchmarkBusReads("Mailbox", bus, 0x400000, 1024);
+    benchmarkBusReads("CPLD1", bus, cpld1.getBaseAddress(), 0x20);
+    benchmarkBusReads("CartridgeROM", bus, Cartridge::ROM_WINDOW_START, rom.size());
+}
+
+//=============================================================================
+// Renderer
+//=============================================================================
+
+static constexpr uint32_t OAM_ADDRESS = 0x13000;
+
+static void benchmarkScanlines(const std::string& name, RAM& vram, CPLD2_Video& cpld2) {
+    VideoRenderer renderer;
+    renderer.setCPLD2(&cpld2);
+    renderer.setVRAM(&vram);
+
+    runBenchmark("VideoRenderer/renderScanline/" + name, VideoRenderer::HEIGHT, [&]() {
+        for (int line = 0; line < VideoRenderer::HEIGHT; line++) {
+            renderer.renderScanline(static_cast<uint16_t>(line));
+        }
+        sink = renderer.getFramebuffer()[VideoRenderer::WIDTH * VideoRenderer::HEIGHT - 1];
+    });
+}
+
+static void benchmarkRenderer() {
+    // Random tiles, maps and palette, sprites off unless set up below
+    RAM vram(0x000000, 512 * 1024, "Benchmark VRAM");
+    std::mt19937 rng(2);
+    uint8_t* memory = vram.getPointer();
+    for (uint32_t i = 0; i < 512 * 1024; i++) {
+        memory[i] = static_cast<uint8_t>(rng());
+    }
+    for (int i = 0; i < 512; i++) {
+        memory[OAM_ADDRESS + i * 8 + 6] = 0;
+    }
+
+    CPLD2_Video cpld2;
+    cpld2.setRegister(0x48, 31);  // Full brightness, no tint
+
+    cpld2.setRegister(0x00, 0);
+    benchmarkScanlines("mode0", vram, cpld2);
+
+    // Four tile layers, all with the same setup
+    static const char* bppNames[] = { "2bpp", "4bpp", "8bpp" };
+    for (int mode = 1; mode <= 3; mode++) {
+        for (int bpp = 0; bpp < 3; bpp++) {
+            for (int tileSize = 0; tileSize < 2; tileSize++) {
+                cpld2.setRegister(0x00, static_cast<uint8_t>(mode));
+                cpld2.setRegister(0x01, 0x0F);
+                for (int layer = 0; layer < 4; layer++) {
+                    cpld2.setRegister(static_cast<uint8_t>(0x10 + layer * 8 + 4),
+                                      static_cast<uint8_t>(bpp | (tileSize << 2)));
+                }
+                benchmarkScanlines("mode" + std::to_string(mode) + "/" + bppNames[bpp] + "/" +
+                                   (tileSize ? "16x16" : "8x8"), vram, cpld2);
+            }
+        }
+    }
+
+    // Every sprite enabled, of all sizes, spread over the screen
+    for (int i = 0; i < 512; i++) {
+        uint8_t* entry = memory + OAM_ADDRESS + i * 8;
+        uint16_t x = static_cast<uint16_t>(rng() % VideoRenderer::WIDTH);
+        uint16_t y = static_cast<uint16_t>((i * 7) % VideoRenderer::HEIGHT);
+        entry[0] = static_cast<uint8_t>(x);
+        entry[1] = static_cast<uint8_t>(x >> 8);
+        entry[2] = static_cast<uint8_t>(y);
+        entry[3] = static_cast<uint8_t>(y >> 8);
+        entry[6] = static_cast<uint8_t>(0x01 | ((i % 3) << 4) | (i & 0x0C));  // Enabled, 8-32px, flips
+    }
+    cpld2.setRegister(0x00, 1);
+    cpld2.setRegister(0x01, 0x21);
+    benchmarkScanlines("sprites512", vram, cpld2);
+}
+
+//=============================================================================
+// Audio
+//=============================================================================
+
+static void benchmarkAudio() {
+    CPLD1_Audio cpld1;
+    // One sample per channel, low byte then high byte
+    for (int channel = 0; channel < AudioMixer::NUM_CHANNELS; channel++) {
+        cpld1.storeByte(Address(0x40, static_cast<uint16_t>(0x0100 + channel * 2)), 0x00);
+        cpld1.storeByte(Address(0x40, static_cast<uint16_t>(0x0101 + channel * 2)),
+                        static_cast<uint8_t>(0x10 + channel * 8));
+    }
+    // Disabled, the FIFOs play their front sample for ever
+    cpld1.storeByte(Address(0x40, 0x011E), 0x00);
+
+    static const int blockSizes[] = { 64, 256, 1024, 4096 };
+    for (int frames : blockSizes) {
+        AudioMixer mixer;
+        mixer.setCPLD1(&cpld1);
+        std::vector<int16_t> buffer(frames * 2);
+
+        // Primed to the target level, what goes in then matches what comes out
+        mixer.generateSamples(buffer.data(), frames);
+        while (mixer.getBufferedFrames() < mixer.getTargetBufferedFrames()) {
+            cpld1.tick();
+            mixer.produceFrame();
+        }
+
+        runBenchmark("AudioMixer/produceAndGenerate/" + std::to_string(frames), frames, [&]() {
+            for (int i = 0; i < frames; i++) {
+                cpld1.tick();
+                mixer.produceFrame();
+            }
+            mixer.generateSamples(buffer.data(), frames);
+            sink = static_cast<uint16_t>(buffer[frames - 1]);
+        });
+    }
+
+    // Resampled for a 48 kHz device, two frames in for every three out
+    for (int frames : blockSizes) {
+        AudioMixer mixer;
+        mixer.setCPLD1(&cpld1);
+        mixer.setOutputSampleRate(48000);
+        std::vector<int16_t> buffer(frames * 2);
+
+        mixer.generateSamples(buffer.data(), frames);
+        while (mixer.getBufferedFrames() < mixer.getTargetBufferedFrames()) {
+            cpld1.tick();
+            mixer.produceFrame();
+        }
+
+        runBenchmark("AudioMixer/produceAndGenerate48k/" + std::to_string(frames), frames, [&]() {
+            for (int i = 0; i < frames * 2 / 3; i++) {
+                cpld1.tick();
+                mixer.produceFrame();
+            }
+            mixer.generateSamples(buffer.data(), frames);
+            sink = static_cast<uint16_t>(buffer[frames - 1]);
+        });
+    }
+}
+
+//=============================================================================
+// CPU test vectors
+//=============================================================================
+
+// Registers and memory of a test, as in the vector files
+struct VectorState {
+    uint32_t pc = 0;
+    uint32_t s = 0;
+    uint32_t p = 0;
+    uint32_t a = 0;
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t dbr = 0;
+    uint32_t d = 0;
+    uint32_t pbr = 0;
+    uint32_t e = 0;
+    std::vector<std::pair<uint32_t, uint8_t>> ram;
+};
+
+struct VectorTest {
+    std::string name;
+    VectorState initial;
+    VectorState final;
+    size_t cycles = 0;     // Bus cycles listed
+};
+
+// Just enough JSON for the vector files: objects, arrays, strings and
+// integers, one pass over the text without building a tree
+class VectorReader {
+public:
+    explicit VectorReader(const std::string& text) : text(text), position(0) {}
+
+    // The array of tests, false on bad data
+    bool read(std::vector<VectorTest>& tests) {
+        if (!consume('[')) {
+            return false;
+        }
+        if (consume(']')) {
+            return true;
+        }
+        do {
+            VectorTest test;
+            if (!readTest(test)) {
+                return false;
+            }
+            tests.push_back(std::move(test));
+        } while (consume(','));
+        return consume(']');
+    }
+
+private:
+    const std::string& text;
+    size_t position;
+
+    void skipSpace() {
+        while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) {
+            position++;
+        }
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if (position < text.size() && text[position] == c) {
+            position++;
+            return true;
+        }
+        return false;
+    }
+
+    bool readString(std::string& value) {
+        if (!consume('"')) {
+            return false;
+        }
+        value.clear();
+        while (position < text.size() && text[position] != '"') {
+            if (text[position] == '\\') {
+                position++;
+            }
+            if (position < text.size()) {
+                value += text[position++];
+            }
+        }
+        return consume('"');
+    }
+
+    bool readNumber(uint32_t& value) {
+        skipSpace();
+        const char* start = text.c_str() + position;
+        char* end;
+        long long number = std::strtoll(start, &end, 10);
+        if (end == start) {
+            return false;
+        }
+        position += end - start;
+        value = static_cast<uint32_t>(number);
+        return true;
+    }
+
+    bool skipValue() {
+        skipSpace();
+        if (position >= text.size()) {
+            return false;
+        }
+        char c = text[position];
+        if (c == '"') {
+            std::string ignored;
+            return readString(ignored);
+        }
+        if (c == '[' || c == '{') {
+            char close = c == '[' ? ']' : '}';
+            position++;
+            if (consume(close)) {
+                return true;
+            }
+            do {
+                if (c == '{') {
+                    std::string key;
+                    if (!readString(key) || !consume(':')) {
+                        return false;
+                    }
+                }
+                if (!skipValue()) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(close);
+        }
+        // Number, true, false or null
+        size_t start = position;
+        while (position < text.size() && std::strchr(",]} \t\r\n", text[position]) == nullptr) {
+            position++;
+        }
+        return position > start;
+    }
+
+    // Calls member() with each key, positioned on its value
+    template <typename Member>
+    bool readObject(Member member) {
+        if (!consume('{')) {
+            return false;
+        }
+        if (consume('}')) {
+            return true;
+        }
+        do {
+            std::string key;
+            if (!readString(key) || !consume(':') || !member(key)) {
+                return false;
+            }
+        } while (consume(','));
+        return consume('}');
+    }
+
+    bool readState(VectorState& state) {
+        return readObject([&](const std::string& key) {
+            uint32_t* registers[] = { &state.pc, &state.s, &state.p, &state.a, &state.x, &state.y,
+                                      &state.dbr, &state.d, &state.pbr, &state.e };
+            const char* names[] = { "pc", "s", "p", "a", "x", "y", "dbr", "d", "pbr", "e" };
+            for (size_t i = 0; i < 10; i++) {
+                if (key == names[i]) {
+                    return readNumber(*registers[i]);
+                }
+            }
+            if (key != "ram") {
+                return skipValue();
+            }
+            // [[address, value], ...]
+            if (!consume('[')) {
+                return false;
+            }
+            if (consume(']')) {
+                return true;
+            }
+            do {
+                uint32_t address;
+                uint32_t value;
+                if (!consume('[') || !readNumber(address) || !consume(',') || !readNumber(value) || !consume(']')) {
+                    return false;
+                }
+                state.ram.emplace_back(address & 0xFFFFFF, static_cast<uint8_t>(value));
+            } while (consume(','));
+            return consume(']');
+        });
+    }
+
+    bool readTest(VectorTest& test) {
+        return readObject([&](const std::string& key) {
+            if (key == "name") {
+                return readString(test.name);
+            }
+            if (key == "initial") {
+                return readState(test.initial);
+            }
+            if (key == "final") {
+                return readState(test.final);
+            }
+            if (key != "cycles") {
+                return skipValue();
+            }
+            // One entry per bus cycle, the count is what matters
+            if (!consume('[')) {
+                return false;
+            }
+            if (consume(']')) {
+                return true;
+            }
+            do {
+                if (!skipValue()) {
+                    return false;
+                }
+                test.cycles++;
+            } while (consume(','));
+            return consume(']');
+        });
+    }
+};
+
+// Repeats of each test when timing a file
+static constexpr int VECTOR_TIMING_REPEAT = 8;
+// Failures are counted per width combination: m0x0, m0x1, m1x0, m1x1 and emulation
+static constexpr int WIDTH_COMBINATIONS = 5;
+
+// A CPU alone with 16 MB of RAM, code included; stores go through the bus so
+// that decoded code follows the tests
+struct VectorMachine {
+    SystemBus bus;
+    RAM ram { 0x000000, 0x1000000, "Test RAM" };
+    Cpu65816 cpu { bus, &emulationInterrupts, &nativeInterrupts };
+
+    VectorMachine() {
+        bus.registerDevice(&ram);
+        cpu.setRESPin(false);
+        cpu.setRDYPin(true);
+        cpu.setIdleLoopSkipping(false);
+    }
+
+    void load(const VectorState& state) {
+        for (const auto& byte : state.ram) {
+            bus.storeByte(Address::fromFlat(byte.first), byte.second);
+        }
+        loadRegisters(state);
+    }
+
+    void loadRegisters(const VectorState& state) {
+        Cpu65816::State registers = {};
+        registers.a = static_cast<uint16_t>(state.a);
+        registers.x = static_cast<uint16_t>(state.x);
+        registers.y = static_cast<uint16_t>(state.y);
+        registers.d = static_cast<uint16_t>(state.d);
+        registers.stackPointer = static_cast<uint16_t>(state.s);
+        registers.programCounter = static_cast<uint16_t>(state.pc);
+        registers.programBank = static_cast<uint8_t>(state.pbr);
+        registers.db = static_cast<uint8_t>(state.dbr);
+        registers.pinRDY = true;
+        cpu.loadState(registers);
+        // The widths P selects depend on E
+        CpuStatus* status = cpu.getCpuStatus();
+        if (state.e) {
+            status->setEmulationFlag();
+        } else {
+            status->clearEmulationFlag();
+        }
+        status->setRegisterValue(static_cast<uint8_t>(state.p));
+    }
+
+    void clear(const VectorTest& test) {
+        for (const VectorState* state : { &test.initial, &test.final }) {
+            for (const auto& byte : state->ram) {
+                bus.storeByte(Address::fromFlat(byte.first), 0);
+            }
+        }
+    }
+
+    // What differs from the expected state, empty if nothing does
+    std::string compare(const VectorTest& test) {
+        const VectorState& expected = test.final;
+        Cpu65816::State registers = cpu.saveState();
+        CpuStatus* status = cpu.getCpuStatus();
+        // Bits 4 and 5 of P are no flags in emulation mode
+        const uint8_t flagMask = expected.e ? 0xCF : 0xFF;
+        std::string differences;
+        auto check = [&](const char* name, uint32_t value, uint32_t expectedValue) {
+            if (value != expectedValue) {
+                char text[64];
+                std::snprintf(text, sizeof(text), " %s %X (expected %X)", name, value, expectedValue);
+                differences += text;
+            }
+        };
+        check("cycles", static_cast<uint32_t>(registers.totalCycles), static_cast<uint32_t>(test.cycles));
+        check("PC", registers.programCounter, expected.pc);
+        check("PB", registers.programBank, expected.pbr);
+        check("A", registers.a, expected.a);
+        check("X", registers.x, expected.x);
+        check("Y", registers.y, expected.y);
+        check("S", registers.stackPointer, expected.s);
+        check("D", registers.d, expected.d);
+        check("DB", registers.db, expected.dbr);
+        check("P", status->getRegisterValue() & flagMask, expected.p & flagMask);
+        check("E", status->emulationFlag() ? 1 : 0, expected.e);
+        const uint8_t* memory = ram.getPointer();
+        for (const auto& byte : expected.ram) {
+            if (memory[byte.first] != byte.second) {
+                char name[16];
+                std::snprintf(name, sizeof(name), "[%06X]", byte.first);
+                check(name, memory[byte.first], byte.second);
+            }
+        }
+        return differences;
+    }
+};
+
+static bool readFile(const std::string& path, std::string& text) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    text = contents.str();
+    return true;
+}
+
+static bool runTestVectors() {
+    using Clock = std::chrono::steady_clock;
+    std::unique_ptr<VectorMachine> machine = std::make_unique<VectorMachine>();
+
+    std::printf("%-10s %7s %7s %7s %6s %6s %6s %6s %6s %14s\n", "File", "Tests", "Cycles", "State",
+                "m0x0", "m0x1", "m1x0", "m1x1", "e", "Instructions/s");
+    uint64_t totalTests = 0;
+    uint64_t totalFailures = 0;
+    int files = 0;
+    for (int code = 0; code < 256; code++) {
+        for (char mode : { 'n', 'e' }) {
+            char name[16];
+            std::snprintf(name, sizeof(name), "%02x.%c.json", code, mode);
+            std::string text;
+            if (!readFile(options.vectorsDir + "/" + name, text)) {
+                std::snprintf(name, sizeof(name), "%02X.%c.json", code, mode);
+                if (!readFile(options.vectorsDir + "/" + name, text)) {
+                    continue;
+                }
+            }
+            if (std::string(name).find(options.filter) == std::string::npos) {
+                continue;
+            }
+            std::vector<VectorTest> tests;
+            if (!VectorReader(text).read(tests)) {
+                std::fprintf(stderr, "%s: Bad test vectors\n", name);
+                return false;
+            }
+            text.clear();
+            files++;
+
+            // Conformance
+            uint64_t cycleFailures = 0;
+            uint64_t stateFailures = 0;
+            uint64_t widthFailures[WIDTH_COMBINATIONS] = {};
+            int shown = 0;
+            for (const VectorTest& test : tests) {
+                machine->load(test.initial);
+                machine->cpu.executeNextInstruction();
+                std::string differences = machine->compare(test);
+                bool cyclesWrong = machine->cpu.getTotalCycles() != test.cycles;
+                machine->clear(test);
+                if (differences.empty()) {
+                    continue;
+                }
+                cyclesWrong ? cycleFailures++ : stateFailures++;
+                int widths = test.initial.e ? 4 : ((test.initial.p >> 5) & 1) << 1 | ((test.initial.p >> 4) & 1);
+                widthFailures[widths]++;
+                if (shown++ < options.showFailures) {
+                    std::printf("  %s:%s\n", test.name.c_str(), differences.c_str());
+                }
+            }
+
+            // Performance, with the registers loaded before each run
+            double seconds = 0.0;
+            for (const VectorTest& test : tests) {
+                machine->load(test.initial);
+                auto start = Clock::now();
+                for (int i = 0; i < VECTOR_TIMING_REPEAT; i++) {
+                    machine->loadRegisters(test.initial);
+                    machine->cpu.executeNextInstruction();
+                }
+                seconds += std::chrono::duration<double>(Clock::now() - start).count();
+                machine->clear(test);
+            }
+            uint64_t instructions = tests.size() * VECTOR_TIMING_REPEAT;
+            double instructionsPerSecond = seconds > 0.0 ? instructions / seconds : 0.0;
+            results.push_back({ std::string("Cpu65816/vectors/") + name, instructions,
+                                instructions > 0 ? seconds * 1e9 / instructions : 0.0, instructionsPerSecond });
+
+            std::printf("%-10s %7zu %7llu %7llu %6llu %6llu %6llu %6llu %6llu %14.0f\n", name, tests.size(),
+                        (unsigned long long)cycleFailures, (unsigned long long)stateFailures,
+                        (unsigned long long)widthFailures[0], (unsigned long long)widthFailures[1],
+                        (unsigned long long)widthFailures[2], (unsigned long long)widthFailures[3],
+                        (unsigned long long)widthFailures[4], instructionsPerSecond);
+            std::fflush(stdout);
+            totalTests += tests.size();
+            totalFailures += cycleFailures + stateFailures;
+        }
+    }
+
+    if (files == 0) {
+        std::fprintf(stderr, "No test vectors in %s\n", options.vectorsDir.c_str());
+        return false;
+    }
+    std::printf("%d files, %llu tests, %llu failed\n", files, (unsigned long long)totalTests,
+                (unsigned long long)totalFailures);
+    return totalFailures == 0;
+}
+
+//=============================================================================
+// Main
+//=============================================================================
+
+static bool parseOptions(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--filter" && hasValue) {
+            options.filter = argv[++i];
+        } else if (arg == "--min-time" && hasValue) {
+            options.minTime = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--json" && hasValue) {
+            options.jsonPath = argv[++i];
+        } else if (arg == "--vectors" && hasValue) {
+            options.vectorsDir = argv[++i];
+        } else if (arg == "--show-failures" && hasValue) {
+            options.showFailures = std::atoi(argv[++i]);
+        } else {
+            return false;
+        }
+    }
+    return options.minTime > 0;
+}
+
+int main(int argc, char** argv) {
+    if (!parseOptions(argc, argv)) {
+        std::fprintf(stderr, "Usage: sano_benchmarks [--filter TEXT] [--min-time S] [--json FILE]\n"
+                             "                       [--vectors DIR] [--show-failures N]\n");
+        return 2;
+    }
+
+    // Status messages of the core still go to std::cout, results through stdio
+    Log::setLevel(LogLevel::Error);
+    std::ostringstream discarded;
+    std::streambuf* coutBuffer = std::cout.rdbuf();
+    std::cout.rdbuf(discarded.rdbuf());
+
+    bool passed = true;
+    if (!options.vectorsDir.empty()) {
+        passed = runTestVectors();
+    } else {
+        std::printf("%-44s %12s %15s %16s\n", "Benchmark", "Iterations", "Time/item", "Items/s");
+        benchmarkCPU();
+        benchmarkBus();
+        benchmarkRenderer();
+        benchmarkAudio();
+    }
+
+    std::cout.rdbuf(coutBuffer);
+
+    if (options.jsonPath == "-") {
+        writeJSON(std::cout);
+    } else if (!options.jsonPath.empty()) {
+        std::ofstream file(options.jsonPath);
+        if (!writeJSON(file)) {
+            std::fprintf(stderr, "Failed to write %s\n", options.jsonPath.c_str());
+            return 1;
+        }
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+/**
+ * Trace Decoder
+ *
+ * Turns the binary instruction traces written by Emulator::writeInstructionTrace()
+ * (sano_headless --trace, or a unit in the field) into text, one instruction per
+ * line with the registers before it, oldest first.
+ *
+ * Build with the core CPU sources, without Qt.
+ *
+ * Usage: sano_trace <trace> [options]
+ *   --cpu NAME          Only the trace of the given CPU (main, graphics, sound)
+ *   --last N            Only the last N instructions of each CPU
+ */
+
+#include "cpu/Cpu65816Trace.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+    std::string path;
+    std::string cpu;
+    size_t last = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--cpu" && hasValue) {
+            cpu = argv[++i];
+        } else if (arg == "--last" && hasValue) {
+            last = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg[0] != '-' && path.empty()) {
+            path = arg;
+        } else {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty()) {
+        std::fprintf(stderr, "Usage: sano_trace <trace> [--cpu NAME] [--last N]\n");
+        return 2;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::fprintf(stderr, "Failed to open %s\n", path.c_str());
+        return 1;
+    }
+
+    std::string name;
+    std::vector<Cpu65816Trace::Entry> entries;
+    int blocks = 0;
+    while (Cpu65816Trace::read(file, name, entries)) {
+        blocks++;
+        if (!cpu.empty() && name != cpu) {
+            continue;
+        }
+        size_t first = last != 0 && entries.size() > last ? entries.size() - last : 0;
+        for (size_t i = first; i < entries.size(); i++) {
+            std::cout << name << " " << Cpu65816Trace::formatEntry(entries[i]) << "\n";
+        }
+    }
+    if (blocks == 0) {
+        std::fprintf(stderr, "%s: not a trace\n", path.c_str());
+        return 1;
+    }
+    return 0;
+}
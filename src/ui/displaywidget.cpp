@@ -1,8 +1,19 @@
 #include "displaywidget.h"
 #include "emulator.h"
+#include "video/frame_mailbox.h"
+#include "timing/frame_profiler.h"
+#include "timing/frame_pacer.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <QMatrix4x4>
+#include <QPainter>
+#include <QScreen>
+#include <QWindow>
+#include <QVector2D>
+#include <QStringList>
 
 // Vertex shader - transforms quad vertices and passes texture coords
 static const char *vertexShaderSource = R"(
@@ -20,16 +31,66 @@ static const char *vertexShaderSource = R"(
     }
 )";
 
-// Fragment shader - samples texture
+// Fragment shader - fetches the frame's pixel, or looks the color of the palette index up.
+// The pass is as large as the frame, the textures may hold more lines than it has
 static const char *fragmentShaderSource = R"(
     #version 330 core
     in vec2 TexCoord;
     out vec4 FragColor;
     
     uniform sampler2D screenTexture;
+    uniform sampler2D indexTexture;
+    uniform sampler2D paletteTexture;
+    uniform bool indexed;
+    uniform int bobField;  // 480i: the lines of the other field show this one's above them, -1 for none
     
     void main() {
-        FragColor = texture(screenTexture, TexCoord);
+        ivec2 texel = ivec2(gl_FragCoord.xy);
+        if (bobField >= 0) {
+            texel.y = max(texel.y - ((texel.y - bobField) & 1), bobField);
+        }
+        if (indexed) {
+            int index = int(texelFetch(indexTexture, texel, 0).r * 255.0 + 0.5);
+            FragColor = texelFetch(paletteTexture, ivec2(index, 0), 0);
+        } else {
+            FragColor = texelFetch(screenTexture, texel, 0);
+        }
+    }
+)";
+
+// Scaling fragment shader - samples the pass before, or draws it as a CRT would
+static const char *scaleFragmentShaderSource = R"(
+    #version 330 core
+    in vec2 TexCoord;
+    out vec4 FragColor;
+    
+    uniform sampler2D source;
+    uniform vec2 sourceSize;
+    uniform bool crt;
+    
+    void main() {
+        if (!crt) {
+            FragColor = texture(source, TexCoord);
+            return;
+        }
+        
+        // Each line a beam brightest along its middle, fading into the ones next
+        // to it. Filtered across, not down
+        vec2 position = TexCoord * sourceSize;
+        float lineY = floor(position.y) + 0.5;
+        float distance = position.y - lineY;
+        float nextY = lineY + (distance < 0.0 ? -1.0 : 1.0);
+        vec3 line = texture(source, vec2(position.x, lineY) / sourceSize).rgb;
+        vec3 next = texture(source, vec2(position.x, nextY) / sourceSize).rgb;
+        float lineWeight = exp(-pow(abs(distance) / 0.35, 2.0));
+        float nextWeight = exp(-pow((1.0 - abs(distance)) / 0.35, 2.0));
+        vec3 color = line * lineWeight + next * nextWeight;
+        
+        // Aperture mask, columns of the screen lean red, green and blue in turn.
+        // The brightness the scanlines cost is made up for
+        vec3 mask = vec3(0.85);
+        mask[int(gl_FragCoord.x) % 3] = 1.15;
+        FragColor = vec4(min(color * mask * 1.2, vec3(1.0)), 1.0);
     }
 )";
 
@@ -37,15 +98,39 @@ Displaywidget::Displaywidget(QWidget *parent)
     : QOpenGLWidget(parent)
     , emulator(nullptr)
     , shaderProgram(nullptr)
+    , scaleProgram(nullptr)
     , textureId(0)
+    , indexTextureId(0)
+    , paletteTextureId(0)
+    , pixelBuffers{}
+    , pixelBufferIndex(0)
+    , showingIndexed(false)
+    , frameHeight(SCREEN_HEIGHT)
+    , frameField(0)
+    , deinterlacer(Deinterlacer::Weave)
+    , textureSequence(0)
+    , indexTextureSequence(0)
+    , profilerOverlay(false)
+    , scaler(Scaler::Nearest)
+    , sourceTarget{}
+    , prescaleTarget{}
+    , sourceValid(false)
 {
     // Request OpenGL 3.3 Core Profile
     QSurfaceFormat format;
     format.setVersion(3, 3);
     format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setSwapInterval(1);
     setFormat(format);
     
     setUpdateBehavior(QOpenGLWidget::NoPartialUpdate);
+    
+    // Swaps return at the display's refreshes, the emulation starts its frames on them
+    connect(this, &QOpenGLWidget::frameSwapped, this, [this]() {
+        if (emulator) {
+            emulator->getFramePacer()->onVSync(FramePacer::Clock::now());
+        }
+    });
 }
 
 Displaywidget::~Displaywidget() {
@@ -55,16 +140,54 @@ Displaywidget::~Displaywidget() {
         glDeleteTextures(1, &textureId);
     }
     
+    if (indexTextureId) {
+        glDeleteTextures(1, &indexTextureId);
+        glDeleteTextures(1, &paletteTextureId);
+    }
+    
+    if (pixelBuffers[0]) {
+        glDeleteBuffers(PIXEL_BUFFER_COUNT, pixelBuffers);
+    }
+    
+    destroyRenderTarget(sourceTarget);
+    destroyRenderTarget(prescaleTarget);
+    
     vbo.destroy();
     vao.destroy();
     
     delete shaderProgram;
+    delete scaleProgram;
     
     doneCurrent();
 }
 
 void Displaywidget::setEmulator(Emulator *emu) {
     emulator = emu;
+    updateRefreshRate();
+}
+
+void Displaywidget::updateRefreshRate() {
+    if (emulator && screen()) {
+        emulator->getFramePacer()->setRefreshRate(screen()->refreshRate());
+    }
+}
+
+const char *Displaywidget::getScalerName(Scaler scaler) {
+    switch (scaler) {
+        case Scaler::Nearest:       return "Nearest";
+        case Scaler::Integer:       return "Integer";
+        case Scaler::SharpBilinear: return "Sharp bilinear";
+        case Scaler::CRT:           return "CRT";
+        default:                    return "Unknown";
+    }
+}
+
+const char *Displaywidget::getDeinterlacerName(Deinterlacer deinterlacer) {
+    switch (deinterlacer) {
+        case Deinterlacer::Weave: return "Weave";
+        case Deinterlacer::Bob:   return "Bob";
+        default:                  return "Unknown";
+    }
 }
 
 void Displaywidget::initializeGL() {
@@ -82,6 +205,18 @@ void Displaywidget::initializeGL() {
     initShaders();
     initGeometry();
     initTexture();
+    initPixelBuffers();
+    if (!initRenderTarget(sourceTarget, SCREEN_WIDTH, frameHeight)) {
+        std::cerr << "[DISPLAY] Offscreen framebuffer incomplete!" << std::endl;
+    }
+    
+    // Shown by now, on a screen whose refresh rate may change
+    updateRefreshRate();
+    if (QWindow *handle = window()->windowHandle()) {
+        connect(handle, &QWindow::screenChanged, this, [this](QScreen *) {
+            updateRefreshRate();
+        });
+    }
 }
 
 void Displaywidget::initShaders() {
@@ -105,6 +240,15 @@ void Displaywidget::initShaders() {
         return;
     }
     
+    scaleProgram = new QOpenGLShaderProgram(this);
+    if (!scaleProgram->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource) ||
+        !scaleProgram->addShaderFromSourceCode(QOpenGLShader::Fragment, scaleFragmentShaderSource) ||
+        !scaleProgram->link()) {
+        std::cerr << "[DISPLAY] Scaling shader failed: " 
+                  << scaleProgram->log().toStdString() << std::endl;
+        return;
+    }
+    
     std::cout << "[DISPLAY] Shaders compiled and linked successfully" << std::endl;
 }
 
@@ -157,82 +301,368 @@ void Displaywidget::initTexture() {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     
     // Allocate texture storage (will be filled each frame)
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, SCREEN_WIDTH, SCREEN_HEIGHT, 
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, SCREEN_WIDTH, MAX_FRAME_HEIGHT, 
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    
+    // Indexed output: one byte per pixel, and the 256 colors it indexes
+    glGenTextures(1, &indexTextureId);
+    glBindTexture(GL_TEXTURE_2D, indexTextureId);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, SCREEN_WIDTH, MAX_FRAME_HEIGHT,
+                 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    
+    glGenTextures(1, &paletteTextureId);
+    glBindTexture(GL_TEXTURE_2D, paletteTextureId);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, PALETTE_SIZE, 1,
                  0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     
     glBindTexture(GL_TEXTURE_2D, 0);
     
+    // Nothing uploaded to them yet
+    textureSequence = 0;
+    indexTextureSequence = 0;
+    
     std::cout << "[DISPLAY] Texture created, ID=" << textureId << std::endl;
 }
 
+void Displaywidget::initPixelBuffers() {
+    glGenBuffers(PIXEL_BUFFER_COUNT, pixelBuffers);
+    
+    for (int i = 0; i < PIXEL_BUFFER_COUNT; i++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffers[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, SCREEN_WIDTH * MAX_FRAME_HEIGHT * 4, nullptr, GL_STREAM_DRAW);
+    }
+    
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    
+    std::cout << "[DISPLAY] " << PIXEL_BUFFER_COUNT << " pixel buffers created" << std::endl;
+}
+
+bool Displaywidget::initRenderTarget(RenderTarget &target, int width, int height) {
+    destroyRenderTarget(target);
+    
+    glGenTextures(1, &target.texture);
+    glBindTexture(GL_TEXTURE_2D, target.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    glGenFramebuffers(1, &target.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+    
+    target.width = width;
+    target.height = height;
+    
+    // Whatever it held is gone
+    if (&target == &sourceTarget) {
+        sourceValid = false;
+    }
+    return complete;
+}
+
+void Displaywidget::destroyRenderTarget(RenderTarget &target) {
+    if (target.framebuffer) {
+        glDeleteFramebuffers(1, &target.framebuffer);
+        glDeleteTextures(1, &target.texture);
+    }
+    target = RenderTarget{};
+}
+
 void Displaywidget::resizeGL(int w, int h) {
     glViewport(0, 0, w, h);
+    
+    // Sharp bilinear's prescale follows the largest whole multiple that fits
+    const qreal ratio = devicePixelRatioF();
+    int scale = integerScale(qRound(width() * ratio), qRound(height() * ratio));
+    if (prescaleTarget.width != SCREEN_WIDTH * scale) {
+        if (!initRenderTarget(prescaleTarget, SCREEN_WIDTH * scale, SCREEN_HEIGHT * scale)) {
+            std::cerr << "[DISPLAY] Prescale framebuffer incomplete!" << std::endl;
+        }
+    }
+}
+
+int Displaywidget::integerScale(int outputWidth, int outputHeight) const {
+    return std::max(1, std::min(outputWidth / SCREEN_WIDTH, outputHeight / SCREEN_HEIGHT));
+}
+
+void Displaywidget::getOutputArea(int outputWidth, int outputHeight,
+                                  float &x, float &y, float &width, float &height) const {
+    if (scaler == Scaler::Integer) {
+        int scale = integerScale(outputWidth, outputHeight);
+        width = static_cast<float>(SCREEN_WIDTH * scale);
+        height = static_cast<float>(SCREEN_HEIGHT * scale);
+    } else {
+        // Aspect ratio kept, fit to the height when the widget is wider than the screen
+        float screenAspect = static_cast<float>(SCREEN_WIDTH) / SCREEN_HEIGHT;
+        float outputAspect = static_cast<float>(outputWidth) / outputHeight;
+        if (outputAspect > screenAspect) {
+            height = static_cast<float>(outputHeight);
+            width = height * screenAspect;
+        } else {
+            width = static_cast<float>(outputWidth);
+            height = width / screenAspect;
+        }
+    }
+    // Centered, on whole pixels so that nearest pixels stay even
+    x = std::floor((outputWidth - width) / 2.0f);
+    y = std::floor((outputHeight - height) / 2.0f);
 }
 
 void Displaywidget::paintGL() {
     glClear(GL_COLOR_BUFFER_BIT);
     
-    if (!emulator || !shaderProgram || !textureId) {
+    if (!emulator || !shaderProgram || !scaleProgram || !textureId || !sourceTarget.framebuffer) {
         return;
     }
     
     // Update texture with framebuffer data
-    updateTexture();
+    bool newFrame;
+    {
+        FrameProfiler::Scope scope(emulator->getProfiler(), FrameProfiler::TEXTURE_UPLOAD);
+        newFrame = updateTexture();
+    }
+    if (newFrame || !sourceValid) {
+        drawSourcePass();
+        sourceValid = true;
+    }
     
-    // Calculate aspect-ratio-correct rendering area
-    float screenAspect = static_cast<float>(SCREEN_WIDTH) / SCREEN_HEIGHT;
-    float widgetAspect = static_cast<float>(width()) / height();
+    // The quad covers the pass it draws into
+    QMatrix4x4 passProjection;
+    passProjection.ortho(0, SCREEN_WIDTH, 0, SCREEN_HEIGHT, -1, 1);
+    
+    GLuint input = sourceTarget.texture;
+    GLint filter = GL_NEAREST;
+    if (scaler == Scaler::SharpBilinear && prescaleTarget.framebuffer) {
+        glBindFramebuffer(GL_FRAMEBUFFER, prescaleTarget.framebuffer);
+        glViewport(0, 0, prescaleTarget.width, prescaleTarget.height);
+        drawScalePass(sourceTarget.texture, GL_NEAREST, passProjection, false);
+        input = prescaleTarget.texture;
+        filter = GL_LINEAR;
+    } else if (scaler == Scaler::CRT) {
+        filter = GL_LINEAR;
+    }
     
-    float scaleX, scaleY;
-    float offsetX = 0, offsetY = 0;
+    // Onto the widget, in device pixels
+    const qreal ratio = devicePixelRatioF();
+    const int outputWidth = qRound(width() * ratio);
+    const int outputHeight = qRound(height() * ratio);
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+    glViewport(0, 0, outputWidth, outputHeight);
     
-    if (widgetAspect > screenAspect) {
-        // Widget is wider than screen - fit to height
-        scaleY = static_cast<float>(height()) / SCREEN_HEIGHT;
-        scaleX = scaleY;
-        offsetX = (width() - SCREEN_WIDTH * scaleX) / 2.0f;
-    } else {
-        // Widget is taller than screen - fit to width
-        scaleX = static_cast<float>(width()) / SCREEN_WIDTH;
-        scaleY = scaleX;
-        offsetY = (height() - SCREEN_HEIGHT * scaleY) / 2.0f;
-    }
+    float x, y, areaWidth, areaHeight;
+    getOutputArea(outputWidth, outputHeight, x, y, areaWidth, areaHeight);
     
-    // Create orthographic projection matrix
     QMatrix4x4 projection;
-    projection.ortho(0, width(), height(), 0, -1, 1);
-    
-    // Apply scaling and offset via model transform
+    projection.ortho(0, outputWidth, outputHeight, 0, -1, 1);
     QMatrix4x4 model;
-    model.translate(offsetX, offsetY);
-    model.scale(scaleX, scaleY);
+    model.translate(x, y);
+    model.scale(areaWidth / SCREEN_WIDTH, areaHeight / SCREEN_HEIGHT);
+    drawScalePass(input, filter, projection * model, scaler == Scaler::CRT);
+    
+    if (profilerOverlay) {
+        drawProfilerOverlay();
+    }
+}
+
+void Displaywidget::drawSourcePass() {
+    glBindFramebuffer(GL_FRAMEBUFFER, sourceTarget.framebuffer);
+    glViewport(0, 0, sourceTarget.width, sourceTarget.height);
     
-    QMatrix4x4 mvp = projection * model;
+    QMatrix4x4 projection;
+    projection.ortho(0, SCREEN_WIDTH, 0, SCREEN_HEIGHT, -1, 1);
     
-    // Render
     shaderProgram->bind();
-    shaderProgram->setUniformValue("projection", mvp);
+    shaderProgram->setUniformValue("projection", projection);
     shaderProgram->setUniformValue("screenTexture", 0);
+    shaderProgram->setUniformValue("indexTexture", 1);
+    shaderProgram->setUniformValue("paletteTexture", 2);
+    shaderProgram->setUniformValue("indexed", showingIndexed);
+    bool bob = frameHeight > SCREEN_HEIGHT && deinterlacer == Deinterlacer::Bob;
+    shaderProgram->setUniformValue("bobField", bob ? frameField : -1);
     
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, textureId);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, indexTextureId);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, paletteTextureId);
     
     vao.bind();
     glDrawArrays(GL_TRIANGLES, 0, 6);
     vao.release();
     
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, 0);
     shaderProgram->release();
 }
 
-void Displaywidget::updateTexture() {
-    const uint32_t *framebuffer = emulator->getFramebuffer();
-    if (!framebuffer) {
+void Displaywidget::drawScalePass(GLuint input, GLint filter, const QMatrix4x4 &mvp, bool crt) {
+    scaleProgram->bind();
+    scaleProgram->setUniformValue("projection", mvp);
+    scaleProgram->setUniformValue("source", 0);
+    scaleProgram->setUniformValue("sourceSize", QVector2D(sourceTarget.width, sourceTarget.height));
+    scaleProgram->setUniformValue("crt", crt);
+    
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, input);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    
+    vao.bind();
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    vao.release();
+    
+    glBindTexture(GL_TEXTURE_2D, 0);
+    scaleProgram->release();
+}
+
+void Displaywidget::drawProfilerOverlay() {
+    FrameProfiler *profiler = emulator->getProfiler();
+    if (!profiler || !profiler->isEnabled()) {
         return;
     }
     
-    glBindTexture(GL_TEXTURE_2D, textureId);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT,
-                    GL_RGBA, GL_UNSIGNED_BYTE, framebuffer);
+    QStringList lines;
+    lines << QString("%1 fps, %2 slow frames")
+             .arg(profiler->getFrameRate(), 0, 'f', 1)
+             .arg(profiler->getSlowFrameCount());
+    lines << QString("%1 %2 %3 %4").arg("ms", -16).arg("avg", 6).arg("p50", 6).arg("p99", 6);
+    for (int i = 0; i < FrameProfiler::SECTION_COUNT; i++) {
+        auto section = static_cast<FrameProfiler::Section>(i);
+        FrameProfiler::Stats stats = profiler->getStats(section);
+        lines << QString("%1 %2 %3 %4")
+                 .arg(FrameProfiler::getSectionName(section), -16)
+                 .arg(stats.average, 6, 'f', 2)
+                 .arg(stats.p50, 6, 'f', 2)
+                 .arg(stats.p99, 6, 'f', 2);
+    }
+    
+    // Drawn with QPainter over the GL output, in the top left corner
+    QPainter painter(this);
+    QFont font("monospace");
+    font.setStyleHint(QFont::TypeWriter);
+    painter.setFont(font);
+    
+    const int lineHeight = painter.fontMetrics().height();
+    int widest = 0;
+    for (const QString &line : lines) {
+        widest = std::max(widest, painter.fontMetrics().horizontalAdvance(line));
+    }
+    painter.fillRect(4, 4, widest + 8, lines.size() * lineHeight + 8, QColor(0, 0, 0, 160));
+    painter.setPen(Qt::white);
+    for (int i = 0; i < lines.size(); i++) {
+        painter.drawText(8, 8 + i * lineHeight + painter.fontMetrics().ascent(), lines[i]);
+    }
+}
+
+bool Displaywidget::updateTexture() {
+    FrameMailbox *mailbox = emulator->getFrameMailbox();
+    if (!mailbox || !mailbox->hasNewFrame()) {
+        // Nothing new, the textures still hold the last frame
+        return false;
+    }
+    
+    // The emulation thread goes on with the next frame meanwhile
+    const FrameMailbox::Frame *frame = mailbox->acquire();
+    showingIndexed = frame->indexed;
+    frameField = frame->field;
+    if (frame->height != frameHeight) {
+        // The pass follows the frame. The lines the frame has are all uploaded again
+        frameHeight = frame->height;
+        textureSequence = 0;
+        indexTextureSequence = 0;
+        if (!initRenderTarget(sourceTarget, SCREEN_WIDTH, frameHeight)) {
+            std::cerr << "[DISPLAY] Offscreen framebuffer incomplete!" << std::endl;
+        }
+    }
+    if (!frame->indexed) {
+        uploadChangedLines(textureId, GL_RGBA, 4, frame->pixels.data(), frame->height,
+                           frame->lineSequences.data(), frame->sequence, textureSequence);
+        return true;
+    }
+    
+    uploadChangedLines(indexTextureId, GL_RED, 1, frame->indices.data(), frame->height,
+                       frame->lineSequences.data(), frame->sequence, indexTextureSequence);
+    
+    // The palette is small enough to go every frame, straight from the frame
+    glBindTexture(GL_TEXTURE_2D, paletteTextureId);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PALETTE_SIZE, 1,
+                    GL_RGBA, GL_UNSIGNED_BYTE, frame->palette.data());
     glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
+
+void Displaywidget::uploadChangedLines(GLuint texture, GLenum format, int pixelSize, const void *pixels, int lines,
+                                       const uint64_t *lineSequences, uint64_t sequence,
+                                       uint64_t &textureSequence) {
+    // Runs of lines changed since the frame the texture holds. All of them when it holds
+    // none, or one from before the emulator started over
+    uint64_t uploaded = sequence > textureSequence ? textureSequence : 0;
+    textureSequence = sequence;
+    uploadRuns.clear();
+    for (int line = 0; line < lines; line++) {
+        if (uploaded && lineSequences[line] <= uploaded) {
+            continue;
+        }
+        if (!uploadRuns.empty() && uploadRuns.back().end == line) {
+            uploadRuns.back().end++;
+        } else {
+            uploadRuns.push_back(LineRun{line, line + 1});
+        }
+    }
+    if (uploadRuns.empty()) {
+        return;
+    }
+    
+    const GLsizeiptr rowSize = SCREEN_WIDTH * pixelSize;
+    const uint8_t *source = static_cast<const uint8_t *>(pixels);
+    
+    // Pick the buffer uploaded the longest time ago, the driver is done with it by now.
+    // Invalidating lets the driver hand out fresh memory instead of waiting on the old contents
+    void *mapped = nullptr;
+    if (pixelBuffers[0]) {
+        pixelBufferIndex = (pixelBufferIndex + 1) % PIXEL_BUFFER_COUNT;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffers[pixelBufferIndex]);
+        mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, rowSize * lines,
+                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (mapped) {
+            // Lines go where they are in the frame, only the ones uploaded are written
+            for (const LineRun &run : uploadRuns) {
+                std::memcpy(static_cast<uint8_t *>(mapped) + run.first * rowSize, source + run.first * rowSize,
+                            (run.end - run.first) * rowSize);
+            }
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        } else {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+    }
+    
+    // Without pixel buffers, upload straight from the frame. From the bound buffer the
+    // uploads return without waiting for the copy
+    glBindTexture(GL_TEXTURE_2D, texture);
+    for (const LineRun &run : uploadRuns) {
+        GLsizeiptr offset = run.first * rowSize;
+        const void *data = mapped ? reinterpret_cast<const void *>(static_cast<uintptr_t>(offset)) : source + offset;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, run.first, SCREEN_WIDTH, run.end - run.first,
+                        format, GL_UNSIGNED_BYTE, data);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    if (mapped) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
 }
@@ -6,6 +6,9 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
 #include <QOpenGLVertexArrayObject>
+#include <QMatrix4x4>
+#include <cstdint>
+#include <vector>
 
 // Forward declaration
 class Emulator;
@@ -15,6 +18,15 @@ class Emulator;
  * 
  * Displays the 320x240 framebuffer from the emulator using OpenGL 3.3 Core.
  * Handles scaling and maintains aspect ratio.
+ * 
+ * Frames go through GPU passes: the frame is drawn 320x240 into an offscreen
+ * framebuffer first (indexed frames looked up in their palette), the scaler
+ * takes it from there to the screen. Offscreen framebuffers are only sized
+ * when the widget is, or the frame height changes: 480i frames are drawn
+ * 320x480, both fields woven or the latest one's lines doubled.
+ *
+ * Buffers are swapped at the display's refresh (swap interval 1); each swap
+ * and the screen's refresh rate are reported to the emulator's FramePacer.
  */
 class Displaywidget : public QOpenGLWidget, protected QOpenGLFunctions_3_3_Core {
     Q_OBJECT
@@ -25,6 +37,32 @@ public:
     
     // Set the emulator instance to render from
     void setEmulator(Emulator *emu);
+    
+    // Frame profiler timings drawn over the picture
+    void setProfilerOverlay(bool shown) { profilerOverlay = shown; update(); }
+    bool isProfilerOverlayShown() const { return profilerOverlay; }
+    
+    // How the picture is scaled to the widget
+    enum class Scaler {
+        Nearest,        // Nearest pixel, as large as fits
+        Integer,        // Nearest pixel, whole multiples only
+        SharpBilinear,  // Nearest to the largest whole multiple, bilinear from there
+        CRT,            // Scanlines and an aperture mask
+        COUNT
+    };
+    void setScaler(Scaler scaler) { this->scaler = scaler; update(); }
+    Scaler getScaler() const { return scaler; }
+    static const char *getScalerName(Scaler scaler);
+    
+    // How 480i frames are shown
+    enum class Deinterlacer {
+        Weave,          // Both fields, the latest one over the one before
+        Bob,            // The latest field only, each line twice
+        COUNT
+    };
+    void setDeinterlacer(Deinterlacer deinterlacer) { this->deinterlacer = deinterlacer; sourceValid = false; update(); }
+    Deinterlacer getDeinterlacer() const { return deinterlacer; }
+    static const char *getDeinterlacerName(Deinterlacer deinterlacer);
 
 protected:
     // QOpenGLWidget overrides
@@ -38,18 +76,72 @@ private:
     // Screen dimensions
     static constexpr int SCREEN_WIDTH = 320;
     static constexpr int SCREEN_HEIGHT = 240;
+    static constexpr int MAX_FRAME_HEIGHT = 480;  // 480i, the textures' height
     
     // Modern OpenGL objects
     QOpenGLShaderProgram *shaderProgram;
+    QOpenGLShaderProgram *scaleProgram;
     QOpenGLVertexArrayObject vao;
     QOpenGLBuffer vbo;
     GLuint textureId;
     
+    // Indexed output, looked up in the fragment shader
+    static constexpr int PALETTE_SIZE = 256;
+    GLuint indexTextureId;
+    GLuint paletteTextureId;
+    
+    // Pixel buffers the framebuffer is staged in, used in turn so that the
+    // texture upload from one runs while the next frame is written to another
+    static constexpr int PIXEL_BUFFER_COUNT = 3;
+    GLuint pixelBuffers[PIXEL_BUFFER_COUNT];
+    int pixelBufferIndex;
+    
+    // Whether the frame shown was indexed, it is only uploaded once
+    bool showingIndexed;
+    // Lines of the frame shown, and the 480i field it ended with
+    int frameHeight;
+    int frameField;
+    Deinterlacer deinterlacer;
+    
+    // Frames the textures hold, only lines changed since are uploaded
+    uint64_t textureSequence;
+    uint64_t indexTextureSequence;
+    struct LineRun {
+        int first, end;
+    };
+    std::vector<LineRun> uploadRuns;
+    
+    bool profilerOverlay;
+    
+    // Offscreen framebuffers of the passes
+    struct RenderTarget {
+        GLuint framebuffer;
+        GLuint texture;
+        int width, height;
+    };
+    Scaler scaler;
+    RenderTarget sourceTarget;     // The frame, 320 by frameHeight
+    RenderTarget prescaleTarget;   // Sharp bilinear's whole multiple of it
+    bool sourceValid;              // sourceTarget holds the textures' frame
+    
     // Helper methods
+    void updateRefreshRate();
     void initShaders();
     void initGeometry();
     void initTexture();
-    void updateTexture();
+    void initPixelBuffers();
+    bool initRenderTarget(RenderTarget &target, int width, int height);
+    void destroyRenderTarget(RenderTarget &target);
+    // Largest whole multiple of the picture that fits, at least 1
+    int integerScale(int outputWidth, int outputHeight) const;
+    // Where on the widget the picture goes, in device pixels
+    void getOutputArea(int outputWidth, int outputHeight, float &x, float &y, float &width, float &height) const;
+    void drawSourcePass();
+    void drawScalePass(GLuint input, GLint filter, const QMatrix4x4 &mvp, bool crt);
+    bool updateTexture();
+    void uploadChangedLines(GLuint texture, GLenum format, int pixelSize, const void *pixels, int lines,
+                            const uint64_t *lineSequences, uint64_t sequence, uint64_t &textureSequence);
+    void drawProfilerOverlay();
 };
 
 #endif // DISPLAYWIDGET_H
@@ -2,20 +2,31 @@
 #include "ui_mainwindow.h"
 #include "displaywidget.h"
 #include "emulator.h"
-#include <chrono>
+#include "timing/frame_profiler.h"
+#include "timing/thread_placement.h"
+#include "timing/frame_pacer.h"
+#include "state/input_movie.h"
+#include "video/shared_memory_sink.h"
+#include "video/video_encoder_sink.h"
+#include "netplay/rollback_session.h"
+#include "netplay/udp_transport.h"
+#include "metrics/metrics_exporter.h"
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QStatusBar>
 #include <QCloseEvent>
+#include <QKeyEvent>
 #include <QDateTime>
+#include <fstream>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , emulator(nullptr)
-    , frameTimer(nullptr)
-    , frameCount(0)
-    , lastFPSUpdate(0)
+    , statusTimer(nullptr)
+    , netplayInputDelay(RollbackSession::DEFAULT_INPUT_DELAY)
+    , heldButtons(0)
+    , controllerPort(0)
 {
     ui->setupUi(this);
     
@@ -28,10 +39,10 @@ MainWindow::MainWindow(QWidget *parent)
     // Connect signals/slots
     setupConnections();
     
-    // Setup frame timer (60 Hz)
-    frameTimer = new QTimer(this);
-    connect(frameTimer, &QTimer::timeout, this, &MainWindow::onUpdateFrame);
-    frameTimer->start(16); // ~60 FPS (16.67ms)
+    // Frames run on the emulation thread, only the status is refreshed from here
+    statusTimer = new QTimer(this);
+    connect(statusTimer, &QTimer::timeout, this, &MainWindow::updateStatusBar);
+    statusTimer->start(500);
     
     // Initial status
     updateStatusBar();
@@ -39,13 +50,28 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow() {
     if (emulator) {
+        emulator->stopEmulationThread();
         emulator->stop();
+        metricsExporter.reset();
+        if (sharedMemory) {
+            emulator->removeFrameSink(sharedMemory.get());
+        }
+        if (videoEncoder) {
+            emulator->removeFrameSink(videoEncoder.get());
+        }
+        emulator->setNetplaySession(nullptr);
         delete emulator;
     }
     delete ui;
 }
 
 void MainWindow::setupEmulator() {
+    // Before any thread starts, e.g. SANO_THREADS="emulation=2:rt50;audio=1:rt70"
+    std::string threadError;
+    if (!ThreadPlacement::configure(qgetenv("SANO_THREADS").toStdString(), threadError)) {
+        QMessageBox::warning(this, "Threads", QString::fromStdString(threadError));
+    }
+    
     emulator = new Emulator();
     
     if (!emulator->initialize()) {
@@ -53,10 +79,110 @@ void MainWindow::setupEmulator() {
         return;
     }
     
+    // Frames are paced by the audio device when there is one. SANO_LOW_LATENCY_AUDIO=1
+    // keeps a few milliseconds queued instead of QAudioSink's ~50
+    emulator->setLowLatencyAudio(qgetenv("SANO_LOW_LATENCY_AUDIO") == "1");
+    emulator->setAudioEnabled(true);
+    
+    // Keep a few seconds to rewind through
+    emulator->setRewindEnabled(true);
+    
+    // Frames start on the display's refreshes when its rate fits, SANO_DISPLAY_SYNC=vrr
+    // for variable refresh displays (they follow the emulation), =off for neither
+    QByteArray displaySync = qgetenv("SANO_DISPLAY_SYNC");
+    if (displaySync == "vrr") {
+        emulator->getFramePacer()->setMode(FramePacer::MODE_VRR);
+    } else if (displaySync == "off") {
+        emulator->getFramePacer()->setMode(FramePacer::MODE_CLOCK);
+    }
+    
+    // Instant-on for kiosks, e.g. SANO_BOOT_SNAPSHOTS=/var/cache/sano
+    emulator->setBootSnapshotDirectory(qgetenv("SANO_BOOT_SNAPSHOTS").toStdString());
+    
+    // Battery backed saves, e.g. SANO_SAVE_RAM=~/.local/share/sano
+    emulator->setSaveRAMDirectory(qgetenv("SANO_SAVE_RAM").toStdString());
+    
+    // Console VRAM timing, for raster effects written against it
+    emulator->setVRAMArbitration(qgetenv("SANO_VRAM_ARBITRATION") == "1");
+    
+    // Streamed by an encoder of its own, e.g. SANO_SHM_OUTPUT=/sano_cabinet
+    QByteArray shmName = qgetenv("SANO_SHM_OUTPUT");
+    if (!shmName.isEmpty()) {
+        sharedMemory = std::make_unique<SharedMemorySink>();
+        if (sharedMemory->open(shmName.toStdString())) {
+            emulator->addFrameSink(sharedMemory.get());
+        } else {
+            sharedMemory.reset();
+        }
+    }
+    
+    setupNetplay();
+    
+    // Scraped by the fleet's Prometheus, e.g. SANO_METRICS_PORT=9464
+    QByteArray metricsPort = qgetenv("SANO_METRICS_PORT");
+    if (!metricsPort.isEmpty()) {
+        metricsExporter = std::make_unique<MetricsExporter>(emulator);
+        if (!metricsExporter->start(static_cast<uint16_t>(metricsPort.toUShort()))) {
+            metricsExporter.reset();
+        }
+    }
+    
     // Connect emulator to display widget
     if (displayWidget) {
         displayWidget->setEmulator(emulator);
+        
+        // Repaint on the GUI thread whenever the emulation thread completes a frame that
+        // changed anything. The profiler overlay is drawn again every frame
+        Displaywidget *widget = displayWidget;
+        emulator->setFrameCallback([widget](bool changed) {
+            QMetaObject::invokeMethod(widget, [widget, changed]() {
+                if (changed || widget->isProfilerOverlayShown()) {
+                    widget->update();
+                }
+            }, Qt::QueuedConnection);
+        });
+    }
+}
+
+void MainWindow::setupNetplay() {
+    // Two cabinets on the same ROM, e.g. SANO_NETPLAY=7000 on the one hosting,
+    // SANO_NETPLAY=7000:cabinet1:7000 with SANO_NETPLAY_PLAYER=2 on the other.
+    // SANO_NETPLAY_DELAY sets the input delay in frames. Both reset together,
+    // the session starts over with each ROM load or reset.
+    QString spec = QString::fromLocal8Bit(qgetenv("SANO_NETPLAY"));
+    if (spec.isEmpty() || !emulator) {
+        return;
+    }
+    QStringList parts = spec.split(':');
+    if (parts.size() != 1 && parts.size() != 3) {
+        QMessageBox::warning(this, "Netplay", "SANO_NETPLAY is PORT or PORT:HOST:PEER");
+        return;
+    }
+    netplayTransport = std::make_unique<UdpTransport>();
+    bool opened = parts.size() == 1
+        ? netplayTransport->open(parts[0].toUShort())
+        : netplayTransport->open(parts[0].toUShort(), parts[1].toStdString(), parts[2].toUShort());
+    if (!opened) {
+        QMessageBox::warning(this, "Netplay", "Failed to open netplay port " + parts[0]);
+        netplayTransport.reset();
+        return;
+    }
+    controllerPort = qgetenv("SANO_NETPLAY_PLAYER") == "2" ? 1 : 0;
+    QByteArray delay = qgetenv("SANO_NETPLAY_DELAY");
+    if (!delay.isEmpty()) {
+        netplayInputDelay = delay.toInt();
+    }
+}
+
+void MainWindow::startNetplaySession() {
+    if (!netplayTransport) {
+        return;
     }
+    emulator->setNetplaySession(nullptr);
+    netplaySession = std::make_unique<RollbackSession>(emulator, netplayTransport.get(), controllerPort);
+    netplaySession->setInputDelay(netplayInputDelay);
+    emulator->setNetplaySession(netplaySession.get());
+    statusBar()->showMessage(QString("Netplay as player %1").arg(controllerPort + 1), 3000);
 }
 
 void MainWindow::setupConnections() {
@@ -82,6 +208,9 @@ void MainWindow::onLoadROM() {
     }
     
     // Stop emulation
+    if (emulator) {
+        emulator->stopEmulationThread();
+    }
     if (emulator && emulator->isRunning()) {
         emulator->stop();
     }
@@ -93,6 +222,8 @@ void MainWindow::onLoadROM() {
         // Reset and start
         emulator->reset();
         emulator->run();
+        startNetplaySession();
+        emulator->startEmulationThread();
         
         // Unpause if paused
         if (ui->actionPause->isChecked()) {
@@ -109,7 +240,14 @@ void MainWindow::onExit() {
 
 void MainWindow::onReset() {
     if (emulator && emulator->isROMLoaded()) {
+        // The emulation thread must not run a frame meanwhile
+        bool threadRunning = emulator->isEmulationThreadRunning();
+        emulator->stopEmulationThread();
         emulator->reset();
+        startNetplaySession();
+        if (threadRunning) {
+            emulator->startEmulationThread();
+        }
         statusBar()->showMessage("Emulator reset", 2000);
     }
 }
@@ -126,38 +264,6 @@ void MainWindow::onPause(bool checked) {
     }
 }
 
-void MainWindow::onUpdateFrame() {
-    if (!emulator || !emulator->isRunning()) {
-        return;
-    }
-    
-    // Run one frame of emulation
-    if (!emulator->isPaused()) {
-        emulator->runFrame();
-    }
-    
-    // Update display
-    if (displayWidget) {
-        displayWidget->update();
-    }
-    
-    // Update FPS counter
-    frameCount++;
-    qint64 currentTime = QDateTime::currentMSecsSinceEpoch();
-    if (lastFPSUpdate == 0) {
-        lastFPSUpdate = currentTime;
-    }
-    
-    qint64 elapsed = currentTime - lastFPSUpdate;
-    if (elapsed >= 1000) { // Update every second
-        double fps = (frameCount * 1000.0) / elapsed;
-        updateStatusBar();
-        
-        frameCount = 0;
-        lastFPSUpdate = currentTime;
-    }
-}
-
 void MainWindow::updateStatusBar() {
     QString status;
 
@@ -165,24 +271,19 @@ void MainWindow::updateStatusBar() {
         if (emulator->isROMLoaded()) {
             if (emulator->isPaused()) {
                 status = "Paused";
+            } else if (emulator->isRewinding()) {
+                status = "Rewinding";
             } else if (emulator->isRunning()) {
-                // Calculate FPS
-                static uint64_t lastFrameCount = 0;
-                static auto lastTime = std::chrono::steady_clock::now();
-                static double fps = 0.0;
-
-                auto now = std::chrono::steady_clock::now();
-                double elapsed = std::chrono::duration<double>(now - lastTime).count();
-
-                if (elapsed >= 0.5) {  // Update FPS every 0.5 seconds
-                    uint64_t currentFrames = emulator->getFrameCount();
-                    fps = (currentFrames - lastFrameCount) / elapsed;
-                    lastFrameCount = currentFrames;
-                    lastTime = now;
+                status = QString("%1 | FPS: %2 | Speed: %3%")
+                .arg(emulator->isTurbo() ? "Turbo" : "Running")
+                .arg(emulator->getProfiler()->getFrameRate(), 0, 'f', 1)
+                .arg(emulator->getEmulationSpeed() * 100.0, 0, 'f', 0);
+                if (emulator->getFramePacer()->isLocked()) {
+                    status += QString(" | VSync %1 Hz").arg(emulator->getFramePacer()->getRefreshRate(), 0, 'f', 2);
+                }
+                if (videoEncoder) {
+                    status += QString(" | REC (%1 dropped)").arg(static_cast<qulonglong>(videoEncoder->getDroppedFrames()));
                 }
-
-                status = QString("Running | FPS: %1")
-                .arg(fps, 0, 'f', 1);
             } else {
                 status = "Stopped";
             }
@@ -196,8 +297,231 @@ void MainWindow::updateStatusBar() {
     statusBar()->showMessage(status);
 }
 
+void MainWindow::keyPressEvent(QKeyEvent *event) {
+    // The emulation thread steps back one state per frame for as long as the key is held
+    if (event->key() == Qt::Key_Backspace && emulator) {
+        if (!event->isAutoRepeat()) {
+            emulator->setRewinding(true);
+            updateStatusBar();
+        }
+        return;
+    }
+    // Fast-forward for as long as the key is held
+    // The peer would have to wait the turbo frames out
+    if (event->key() == Qt::Key_Tab && emulator && !netplaySession) {
+        if (!event->isAutoRepeat()) {
+            emulator->setTurbo(true);
+            updateStatusBar();
+        }
+        return;
+    }
+    // Subsystem timings, measured only while they are shown or exported
+    if (event->key() == Qt::Key_F3 && emulator && displayWidget) {
+        bool shown = !displayWidget->isProfilerOverlayShown();
+        emulator->getProfiler()->setEnabled(shown || metricsExporter);
+        displayWidget->setProfilerOverlay(shown);
+        return;
+    }
+    // Next scaler, the GPU does all of the scaling
+    if (event->key() == Qt::Key_F4 && displayWidget) {
+        int next = (static_cast<int>(displayWidget->getScaler()) + 1) % static_cast<int>(Displaywidget::Scaler::COUNT);
+        displayWidget->setScaler(static_cast<Displaywidget::Scaler>(next));
+        statusBar()->showMessage(QString("Scaler: %1").arg(Displaywidget::getScalerName(displayWidget->getScaler())), 2000);
+        return;
+    }
+    if (event->key() == Qt::Key_F5 && emulator) {
+        toggleMovieRecording();
+        return;
+    }
+    if (event->key() == Qt::Key_F6 && emulator) {
+        toggleVideoRecording();
+        return;
+    }
+    // Weave or bob 480i
+    if (event->key() == Qt::Key_F7 && displayWidget) {
+        int next = (static_cast<int>(displayWidget->getDeinterlacer()) + 1) % static_cast<int>(Displaywidget::Deinterlacer::COUNT);
+        displayWidget->setDeinterlacer(static_cast<Displaywidget::Deinterlacer>(next));
+        statusBar()->showMessage(QString("Deinterlacer: %1").arg(Displaywidget::getDeinterlacerName(displayWidget->getDeinterlacer())), 2000);
+        return;
+    }
+    if (event->key() == Qt::Key_F8 && emulator) {
+        toggleExecutionStats();
+        return;
+    }
+    uint16_t button = buttonForKey(event->key());
+    if (button && emulator) {
+        heldButtons |= button;
+        emulator->setControllerState(controllerPort, heldButtons);
+        return;
+    }
+    QMainWindow::keyPressEvent(event);
+}
+
+void MainWindow::keyReleaseEvent(QKeyEvent *event) {
+    if (event->key() == Qt::Key_Backspace && emulator) {
+        if (!event->isAutoRepeat()) {
+            emulator->setRewinding(false);
+            updateStatusBar();
+        }
+        return;
+    }
+    if (event->key() == Qt::Key_Tab && emulator) {
+        if (!event->isAutoRepeat()) {
+            emulator->setTurbo(false);
+            updateStatusBar();
+        }
+        return;
+    }
+    uint16_t button = buttonForKey(event->key());
+    if (button && emulator) {
+        if (!event->isAutoRepeat()) {
+            heldButtons &= ~button;
+            emulator->setControllerState(controllerPort, heldButtons);
+        }
+        return;
+    }
+    QMainWindow::keyReleaseEvent(event);
+}
+
+bool MainWindow::focusNextPrevChild(bool next) {
+    return false;
+}
+
+uint16_t MainWindow::buttonForKey(int key) {
+    switch (key) {
+        case Qt::Key_Up: return InputPort::BUTTON_UP;
+        case Qt::Key_Down: return InputPort::BUTTON_DOWN;
+        case Qt::Key_Left: return InputPort::BUTTON_LEFT;
+        case Qt::Key_Right: return InputPort::BUTTON_RIGHT;
+        case Qt::Key_Z: return InputPort::BUTTON_B;
+        case Qt::Key_X: return InputPort::BUTTON_A;
+        case Qt::Key_A: return InputPort::BUTTON_Y;
+        case Qt::Key_S: return InputPort::BUTTON_X;
+        case Qt::Key_Q: return InputPort::BUTTON_L;
+        case Qt::Key_W: return InputPort::BUTTON_R;
+        case Qt::Key_Return: return InputPort::BUTTON_START;
+        case Qt::Key_Shift: return InputPort::BUTTON_SELECT;
+        default: return 0;
+    }
+}
+
+void MainWindow::toggleMovieRecording() {
+    if (!emulator->isROMLoaded()) {
+        return;
+    }
+    
+    // Movies start and end between two frames
+    bool threadRunning = emulator->isEmulationThreadRunning();
+    emulator->stopEmulationThread();
+    
+    if (emulator->getMovieMode() == Emulator::MOVIE_NONE) {
+        if (emulator->startMovieRecording()) {
+            statusBar()->showMessage("Recording input movie, F5 to stop", 3000);
+        }
+    } else {
+        std::unique_ptr<InputMovie> movie = emulator->stopMovie();
+        QString filename = QFileDialog::getSaveFileName(
+            this,
+            "Save Input Movie",
+            QString(),
+            "Input Movies (*.snmv);;All Files (*.*)"
+        );
+        if (movie && !filename.isEmpty()) {
+            if (movie->saveToFile(filename.toStdString())) {
+                statusBar()->showMessage(QString("Movie saved, %1 frames").arg(static_cast<qulonglong>(movie->getFrameCount())), 3000);
+            } else {
+                QMessageBox::critical(this, "Error", "Failed to save movie: " + filename);
+            }
+        }
+    }
+    
+    if (threadRunning) {
+        emulator->startEmulationThread();
+    }
+}
+
+void MainWindow::toggleVideoRecording() {
+    if (!emulator->isROMLoaded()) {
+        return;
+    }
+    
+    // Sinks are added and removed between two frames
+    bool threadRunning = emulator->isEmulationThreadRunning();
+    emulator->stopEmulationThread();
+    
+    if (!videoEncoder) {
+        QString filename = QFileDialog::getSaveFileName(
+            this,
+            "Record Video",
+            QString(),
+            "Videos (*.mp4 *.mkv);;All Files (*.*)"
+        );
+        if (!filename.isEmpty()) {
+            VideoEncoderSink::Settings settings;
+            settings.path = filename.toStdString();
+            std::unique_ptr<VideoEncoderSink> encoder = std::make_unique<VideoEncoderSink>();
+            if (encoder->open(settings)) {
+                emulator->addFrameSink(encoder.get());
+                videoEncoder = std::move(encoder);
+                statusBar()->showMessage(QString("Recording video with the %1 encoder, F6 to stop")
+                                         .arg(VideoEncoderSink::getBackendName(videoEncoder->getBackend())), 3000);
+            } else {
+                QMessageBox::critical(this, "Error", "Failed to record video: " + filename);
+            }
+        }
+    } else {
+        emulator->removeFrameSink(videoEncoder.get());
+        videoEncoder->close();
+        statusBar()->showMessage(QString("Video saved, %1 frames, %2 dropped")
+                                 .arg(static_cast<qulonglong>(videoEncoder->getEncodedFrames()))
+                                 .arg(static_cast<qulonglong>(videoEncoder->getDroppedFrames())), 3000);
+        videoEncoder.reset();
+    }
+    
+    if (threadRunning) {
+        emulator->startEmulationThread();
+    }
+}
+
+void MainWindow::toggleExecutionStats() {
+    if (!emulator->isROMLoaded()) {
+        return;
+    }
+    
+    // Counted by the emulation thread, read with it stopped
+    bool threadRunning = emulator->isEmulationThreadRunning();
+    emulator->stopEmulationThread();
+    
+    if (!emulator->isCountingExecution()) {
+        emulator->setExecutionStats(true);
+        statusBar()->showMessage("Counting executions, F8 to stop", 3000);
+    } else {
+        emulator->setExecutionStats(false);
+        QString filename = QFileDialog::getSaveFileName(
+            this,
+            "Save Execution Statistics",
+            QString(),
+            "CSV (*.csv);;JSON (*.json);;All Files (*.*)"
+        );
+        if (!filename.isEmpty()) {
+            std::ofstream file(filename.toStdString());
+            emulator->writeExecutionStats(file, filename.endsWith(".json", Qt::CaseInsensitive));
+            if (file.good()) {
+                statusBar()->showMessage("Execution statistics saved", 3000);
+            } else {
+                QMessageBox::critical(this, "Error", "Failed to save execution statistics: " + filename);
+            }
+        }
+    }
+    
+    if (threadRunning) {
+        emulator->startEmulationThread();
+    }
+}
+
 void MainWindow::closeEvent(QCloseEvent *event) {
     if (emulator) {
+        emulator->stopEmulationThread();
         emulator->stop();
     }
     event->accept();
@@ -2,12 +2,19 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <cstdint>
+#include <memory>
 #include <QString>
 #include <QTimer>
 
 // Forward declarations
 class Emulator;
 class Displaywidget;
+class SharedMemorySink;
+class VideoEncoderSink;
+class UdpTransport;
+class RollbackSession;
+class MetricsExporter;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -20,6 +27,14 @@ QT_END_NAMESPACE
  * - Menu bar (File, Emulation)
  * - Display widget (320x240 upscaled)
  * - Status bar (FPS, emulation status)
+ * - Rewind while Backspace is held, fast-forward while Tab is held
+ * - Frame profiler overlay toggled with F3
+ * - Controller 1 on the keyboard: arrows, Z/X (B/A), A/S (Y/X), Q/W (L/R),
+ *   Enter (Start), Shift (Select)
+ * - Input movie recording started and stopped with F5
+ * - Opcode and bus access counts started and stopped with F8
+ * - Netplay against another cabinet with SANO_NETPLAY set
+ * - Prometheus metrics on the port in SANO_METRICS_PORT
  */
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -37,8 +52,8 @@ private slots:
     void onReset();
     void onPause(bool checked);
     
-    // Update timer
-    void onUpdateFrame();
+    // Status timer
+    void updateStatusBar();
 
 private:
     // UI
@@ -48,16 +63,40 @@ private:
     // Emulator
     Emulator *emulator;
     
+    // Frames and audio for another process, with SANO_SHM_OUTPUT set
+    std::unique_ptr<SharedMemorySink> sharedMemory;
+    // Gameplay recorded with F6
+    std::unique_ptr<VideoEncoderSink> videoEncoder;
+    // Versus play, from each ROM load or reset on
+    std::unique_ptr<UdpTransport> netplayTransport;
+    std::unique_ptr<RollbackSession> netplaySession;
+    int netplayInputDelay;
+    // Fleet monitoring
+    std::unique_ptr<MetricsExporter> metricsExporter;
+    
     // Timing
-    QTimer *frameTimer;
-    int frameCount;
-    qint64 lastFPSUpdate;
+    QTimer *statusTimer;
+    
+    // Buttons held on the keyboard's controller, 1 but in netplay as player 2
+    uint16_t heldButtons;
+    int controllerPort;
     
     // Methods
     void setupEmulator();
     void setupConnections();
-    void updateStatusBar();
+    void setupNetplay();
+    // A new session, with the emulation thread stopped
+    void startNetplaySession();
+    void toggleMovieRecording();
+    void toggleVideoRecording();
+    void toggleExecutionStats();
+    // Controller button of a key, 0 for the others
+    static uint16_t buttonForKey(int key);
     void closeEvent(QCloseEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void keyReleaseEvent(QKeyEvent *event) override;
+    // Tab fast-forwards, it does not move the focus
+    bool focusNextPrevChild(bool next) override;
 };
 
 #endif // MAINWINDOW_H